@@ -4,13 +4,32 @@
 #include <mutex>
 #include <queue>
 
+#include <errno.h>
+#include <unistd.h>
+
 namespace ioremap { namespace elliptics {
 
+/*
+ * An 8-byte counter increment works for both eventfd and pipes. The
+ * write must not block the io thread, so register non-blocking pipes
+ * only; a dropped increment is harmless as long as older ones are
+ * still pending in the descriptor.
+ */
+static void notify_fd_signal(int fd)
+{
+	uint64_t event = 1;
+	ssize_t err;
+
+	do {
+		err = write(fd, &event, sizeof(event));
+	} while (err < 0 && errno == EINTR);
+}
+
 template <typename T>
 class async_result<T>::data
 {
 	public:
-		data() : total(0), finished(false)
+		data() : total(0), finished(false), notify_fd(-1), drained(0)
 		{
 			dnet_current_time(&start);
 		}
@@ -35,6 +54,9 @@ class async_result<T>::data
 		bool finished;
 		dnet_time start;
 		dnet_time end;
+
+		int notify_fd;
+		size_t drained;
 };
 
 template <typename T>
@@ -109,6 +131,31 @@ bool async_result<T>::ready() const
 	return m_data->finished;
 }
 
+template <typename T>
+void async_result<T>::set_notify_fd(int fd)
+{
+	bool signal;
+
+	{
+		std::unique_lock<std::mutex> locker(m_data->lock);
+		m_data->notify_fd = fd;
+		signal = (fd >= 0) && (m_data->finished || m_data->results.size() > m_data->drained);
+	}
+
+	if (signal)
+		notify_fd_signal(fd);
+}
+
+template <typename T>
+std::vector<T> async_result<T>::drain()
+{
+	std::unique_lock<std::mutex> locker(m_data->lock);
+
+	std::vector<T> ret(m_data->results.begin() + m_data->drained, m_data->results.end());
+	m_data->drained = m_data->results.size();
+	return ret;
+}
+
 template <typename T>
 dnet_time async_result<T>::elapsed_time() const
 {
@@ -422,6 +469,11 @@ void async_result_handler<T>::process(const T &result)
 	} else {
 		m_data->results.push_back(result);
 	}
+
+	int notify_fd = m_data->notify_fd;
+	locker.unlock();
+	if (notify_fd >= 0)
+		notify_fd_signal(notify_fd);
 }
 
 template <>
@@ -433,6 +485,11 @@ void async_result_handler<index_entry>::process(const index_entry &result)
 	} else {
 		m_data->results.push_back(result);
 	}
+
+	int notify_fd = m_data->notify_fd;
+	locker.unlock();
+	if (notify_fd >= 0)
+		notify_fd_signal(notify_fd);
 }
 
 template <>
@@ -444,6 +501,11 @@ void async_result_handler<find_indexes_result_entry>::process(const find_indexes
 	} else {
 		m_data->results.push_back(result);
 	}
+
+	int notify_fd = m_data->notify_fd;
+	locker.unlock();
+	if (notify_fd >= 0)
+		notify_fd_signal(notify_fd);
 }
 
 template <typename T>
@@ -461,6 +523,11 @@ void async_result_handler<T>::complete(const error_info &error)
 		m_data->final_handler(m_data->error);
 	}
 	m_data->condition.notify_all();
+
+	int notify_fd = m_data->notify_fd;
+	locker.unlock();
+	if (notify_fd >= 0)
+		notify_fd_signal(notify_fd);
 }
 
 template <typename T>
@@ -0,0 +1,548 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Standalone load generator for qualifying elliptics builds.
+ *
+ * Unlike dnet_cpp_test this tool does not spawn local server nodes and does
+ * not check data correctness - it drives an existing cluster with a
+ * configurable mix of read/write/lookup/index operations and reports
+ * throughput and latency percentiles, excluding a warmup period.
+ *
+ * Key popularity follows a zipfian distribution so that cache and oplock
+ * behaviour under skewed (hot-key) load can be measured as well as uniform.
+ * Load can be closed-loop (each worker thread keeps a fixed number of
+ * requests in flight) or open-loop (requests are issued at a fixed rate
+ * regardless of completions, exposing queueing delay).
+ */
+
+#include <sys/time.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../include/elliptics/cppdef.h"
+
+using namespace ioremap::elliptics;
+
+enum bench_op {
+	BENCH_OP_READ = 0,
+	BENCH_OP_WRITE,
+	BENCH_OP_LOOKUP,
+	BENCH_OP_INDEX,
+	__BENCH_OP_MAX
+};
+
+static const char *bench_op_names[__BENCH_OP_MAX] = { "read", "write", "lookup", "index" };
+
+struct bench_config {
+	std::string		remote_addr;
+	int			remote_port;
+	int			remote_family;
+	std::vector<int>	groups;
+	std::string		log_file;
+	int			log_level;
+
+	int			mix[__BENCH_OP_MAX];
+
+	uint64_t		key_count;
+	size_t			size_min, size_max;
+	double			zipf_theta;
+
+	int			threads;
+	int			depth;		/* in-flight requests per thread, closed loop */
+	double			rate;		/* total ops/sec, open loop; 0 - closed loop */
+	int			warmup_sec;
+	int			duration_sec;
+
+	bench_config() : remote_port(1025), remote_family(AF_INET),
+		log_file("/dev/stderr"), log_level(DNET_LOG_ERROR),
+		key_count(10000), size_min(100), size_max(100), zipf_theta(0),
+		threads(1), depth(1), rate(0), warmup_sec(5), duration_sec(30) {
+		mix[BENCH_OP_READ] = 95;
+		mix[BENCH_OP_WRITE] = 5;
+		mix[BENCH_OP_LOOKUP] = 0;
+		mix[BENCH_OP_INDEX] = 0;
+	}
+};
+
+/*
+ * Zipfian key selector after Gray et al: precomputes the generalized
+ * harmonic number once, then maps a uniform sample without rejection.
+ * theta 0 degenerates to uniform selection.
+ */
+class zipf_generator
+{
+	public:
+		zipf_generator(uint64_t n, double theta) : m_n(n), m_theta(theta) {
+			if (m_theta <= 0)
+				return;
+
+			m_zetan = 0;
+			for (uint64_t i = 1; i <= m_n; ++i)
+				m_zetan += 1.0 / pow((double)i, m_theta);
+
+			m_alpha = 1.0 / (1.0 - m_theta);
+			m_eta = (1.0 - pow(2.0 / m_n, 1.0 - m_theta)) /
+				(1.0 - (1.0 + 1.0 / pow(2.0, m_theta)) / m_zetan);
+		}
+
+		uint64_t next(std::mt19937_64 &rnd) const {
+			std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+			if (m_theta <= 0)
+				return rnd() % m_n;
+
+			double u = dist(rnd);
+			double uz = u * m_zetan;
+
+			if (uz < 1.0)
+				return 0;
+			if (uz < 1.0 + pow(0.5, m_theta))
+				return 1;
+
+			return (uint64_t)(m_n * pow(m_eta * u - m_eta + 1.0, m_alpha));
+		}
+
+	private:
+		uint64_t	m_n;
+		double		m_theta;
+		double		m_zetan, m_alpha, m_eta;
+};
+
+struct bench_stats {
+	std::mutex		lock;
+	uint64_t		ops[__BENCH_OP_MAX];
+	uint64_t		errors[__BENCH_OP_MAX];
+	uint64_t		bytes;
+	std::vector<double>	latency_ms;
+
+	bench_stats() : bytes(0) {
+		memset(ops, 0, sizeof(ops));
+		memset(errors, 0, sizeof(errors));
+	}
+};
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+struct bench_worker_ctx {
+	const bench_config	*cfg;
+	bench_stats		*stats;
+	bench_clock::time_point	measure_start;
+	bench_clock::time_point	stop;
+	int			worker_id;
+};
+
+static std::string bench_key_name(uint64_t idx)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "bench-key-%llu", (unsigned long long)idx);
+	return std::string(name);
+}
+
+static void bench_record(bench_worker_ctx &ctx, int op, bool ok, uint64_t bytes,
+		const bench_clock::time_point &issued)
+{
+	bench_clock::time_point now = bench_clock::now();
+
+	/* warmup samples are dropped - they measure cold caches, not the build */
+	if (issued < ctx.measure_start)
+		return;
+
+	double ms = std::chrono::duration_cast<std::chrono::microseconds>(now - issued).count() / 1000.;
+
+	std::lock_guard<std::mutex> guard(ctx.stats->lock);
+	if (ok) {
+		ctx.stats->ops[op]++;
+		ctx.stats->bytes += bytes;
+	} else {
+		ctx.stats->errors[op]++;
+	}
+	ctx.stats->latency_ms.push_back(ms);
+}
+
+static int bench_pick_op(const bench_config &cfg, std::mt19937_64 &rnd)
+{
+	int total = 0, op;
+
+	for (op = 0; op < __BENCH_OP_MAX; ++op)
+		total += cfg.mix[op];
+
+	int r = rnd() % total;
+	for (op = 0; op < __BENCH_OP_MAX; ++op) {
+		if (r < cfg.mix[op])
+			return op;
+		r -= cfg.mix[op];
+	}
+
+	return BENCH_OP_READ;
+}
+
+static size_t bench_pick_size(const bench_config &cfg, std::mt19937_64 &rnd)
+{
+	if (cfg.size_max <= cfg.size_min)
+		return cfg.size_min;
+	return cfg.size_min + rnd() % (cfg.size_max - cfg.size_min + 1);
+}
+
+/*
+ * Issues one asynchronous operation and accounts it on completion.
+ * @done is invoked from the completion thread once per operation.
+ */
+static void bench_issue(session &s, bench_worker_ctx &ctx, const zipf_generator &zipf,
+		std::mt19937_64 &rnd, const std::string &value_buf,
+		const std::function<void ()> &done)
+{
+	int op = bench_pick_op(*ctx.cfg, rnd);
+	std::string name = bench_key_name(zipf.next(rnd));
+	bench_clock::time_point issued = bench_clock::now();
+	bench_worker_ctx *pctx = &ctx;
+
+	switch (op) {
+	case BENCH_OP_WRITE: {
+		size_t size = bench_pick_size(*ctx.cfg, rnd);
+		s.write_data(key(name), data_pointer::copy(value_buf.data(), size), 0)
+			.connect(std::function<void (const write_result_entry &)>(),
+				[pctx, op, size, issued, done] (const error_info &error) {
+					bench_record(*pctx, op, !error, size, issued);
+					done();
+				});
+		break;
+	}
+	case BENCH_OP_LOOKUP:
+		s.lookup(key(name))
+			.connect(std::function<void (const lookup_result_entry &)>(),
+				[pctx, op, issued, done] (const error_info &error) {
+					bench_record(*pctx, op, !error, 0, issued);
+					done();
+				});
+		break;
+	case BENCH_OP_INDEX: {
+		std::vector<std::string> indexes(1, "bench-index-" + name);
+		std::vector<data_pointer> datas(1, data_pointer::copy(name));
+		s.set_indexes(key(name), indexes, datas)
+			.connect(std::function<void (const callback_result_entry &)>(),
+				[pctx, op, issued, done] (const error_info &error) {
+					bench_record(*pctx, op, !error, 0, issued);
+					done();
+				});
+		break;
+	}
+	case BENCH_OP_READ:
+	default: {
+		auto counter = std::make_shared<uint64_t>(0);
+		s.read_data(key(name), 0, 0)
+			.connect([counter] (const read_result_entry &entry) {
+					*counter += entry.file().size();
+				},
+				[pctx, op, counter, issued, done] (const error_info &error) {
+					bench_record(*pctx, op, !error, *counter, issued);
+					done();
+				});
+		break;
+	}
+	}
+}
+
+static void bench_worker(session parent, bench_worker_ctx ctx)
+{
+	session s = parent.clone();
+	s.set_exceptions_policy(session::no_exceptions);
+
+	std::mt19937_64 rnd(0x656c6c69 + ctx.worker_id);
+	zipf_generator zipf(ctx.cfg->key_count, ctx.cfg->zipf_theta);
+	std::string value_buf(ctx.cfg->size_max ? ctx.cfg->size_max : 1, 'b');
+
+	std::mutex lock;
+	std::condition_variable cond;
+	int in_flight = 0;
+
+	std::function<void ()> done = [&lock, &cond, &in_flight] () {
+		std::lock_guard<std::mutex> guard(lock);
+		--in_flight;
+		cond.notify_all();
+	};
+
+	if (ctx.cfg->rate > 0) {
+		/*
+		 * Open loop: issue at a fixed per-thread rate whether or not
+		 * previous requests have completed.
+		 */
+		double interval_us = 1000000. * ctx.cfg->threads / ctx.cfg->rate;
+		bench_clock::time_point next = bench_clock::now();
+
+		while (bench_clock::now() < ctx.stop) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				++in_flight;
+			}
+			bench_issue(s, ctx, zipf, rnd, value_buf, done);
+
+			next += std::chrono::microseconds((long)interval_us);
+			std::this_thread::sleep_until(next);
+		}
+	} else {
+		/* Closed loop: keep @depth requests in flight per thread */
+		while (bench_clock::now() < ctx.stop) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				cond.wait(guard, [&in_flight, &ctx] () {
+						return in_flight < ctx.cfg->depth;
+					});
+				++in_flight;
+			}
+			bench_issue(s, ctx, zipf, rnd, value_buf, done);
+		}
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	cond.wait(guard, [&in_flight] () { return in_flight == 0; });
+}
+
+/*
+ * Preloads the whole keyspace so that reads and lookups during the
+ * measured phase do not degenerate into -ENOENT error accounting.
+ */
+static int bench_populate(session &parent, const bench_config &cfg)
+{
+	session s = parent.clone();
+	s.set_exceptions_policy(session::no_exceptions);
+
+	std::string value_buf(cfg.size_max ? cfg.size_max : 1, 'b');
+	uint64_t failed = 0;
+
+	fprintf(stderr, "populating %llu keys\n", (unsigned long long)cfg.key_count);
+
+	for (uint64_t i = 0; i < cfg.key_count; ++i) {
+		std::mt19937_64 rnd(i);
+		size_t size = bench_pick_size(cfg, rnd);
+
+		auto result = s.write_data(key(bench_key_name(i)),
+				data_pointer::copy(value_buf.data(), size), 0);
+		result.wait();
+		if (result.error())
+			failed++;
+	}
+
+	if (failed) {
+		fprintf(stderr, "populate: %llu of %llu writes failed\n",
+				(unsigned long long)failed, (unsigned long long)cfg.key_count);
+		if (failed == cfg.key_count)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static void bench_report(const bench_config &cfg, bench_stats &stats, double seconds)
+{
+	uint64_t total_ops = 0, total_errors = 0;
+	int op;
+
+	for (op = 0; op < __BENCH_OP_MAX; ++op) {
+		total_ops += stats.ops[op];
+		total_errors += stats.errors[op];
+		if (cfg.mix[op])
+			printf("%8s: %llu ops, %llu errors\n", bench_op_names[op],
+					(unsigned long long)stats.ops[op],
+					(unsigned long long)stats.errors[op]);
+	}
+
+	printf("total: %llu ops, %llu errors, %.2f MB/s, %.2f ops/s over %.2f seconds\n",
+			(unsigned long long)total_ops, (unsigned long long)total_errors,
+			stats.bytes / seconds / (1024. * 1024.), total_ops / seconds, seconds);
+
+	if (stats.latency_ms.empty())
+		return;
+
+	std::sort(stats.latency_ms.begin(), stats.latency_ms.end());
+	size_t num = stats.latency_ms.size();
+
+	printf("latency ms: p50: %.3f, p90: %.3f, p99: %.3f, p99.9: %.3f, max: %.3f\n",
+			stats.latency_ms[num / 2],
+			stats.latency_ms[num * 9 / 10],
+			stats.latency_ms[num * 99 / 100],
+			stats.latency_ms[num * 999 / 1000],
+			stats.latency_ms[num - 1]);
+}
+
+static void bench_usage(const char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -r addr:port:family  - remote node to connect to\n"
+			"  -g groups            - comma-separated replica groups\n"
+			"  -l log               - log file (default: stderr)\n"
+			"  -w level             - log level\n"
+			"  -m r:w:l:i           - workload mix in percent: read:write:lookup:index (default 95:5:0:0)\n"
+			"  -k num               - number of keys in the keyspace (default 10000)\n"
+			"  -s min[:max]         - value size, bytes; uniform in [min, max] (default 100)\n"
+			"  -z theta             - zipfian skew, 0 - uniform, 0.99 - YCSB default\n"
+			"  -t num               - worker threads (default 1)\n"
+			"  -d num               - in-flight requests per thread, closed loop (default 1)\n"
+			"  -q rate              - total target ops/sec, switches to open loop\n"
+			"  -u sec               - warmup time excluded from the report (default 5)\n"
+			"  -T sec               - measured run time (default 30)\n"
+			"  -P                   - skip keyspace population\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_config cfg;
+	int ch, err, populate = 1;
+	char *p;
+
+	while ((ch = getopt(argc, argv, "r:g:l:w:m:k:s:z:t:d:q:u:T:Ph")) != -1) {
+		switch (ch) {
+			case 'r': {
+				char *addr = optarg;
+				p = strrchr(addr, ':');
+				if (!p)
+					bench_usage(argv[0]);
+				cfg.remote_family = atoi(p + 1);
+				*p = '\0';
+				p = strrchr(addr, ':');
+				if (!p)
+					bench_usage(argv[0]);
+				cfg.remote_port = atoi(p + 1);
+				*p = '\0';
+				cfg.remote_addr = addr;
+				break;
+			}
+			case 'g':
+				for (p = strtok(optarg, ","); p; p = strtok(NULL, ","))
+					cfg.groups.push_back(atoi(p));
+				break;
+			case 'l':
+				cfg.log_file = optarg;
+				break;
+			case 'w':
+				cfg.log_level = atoi(optarg);
+				break;
+			case 'm':
+				if (sscanf(optarg, "%d:%d:%d:%d", &cfg.mix[BENCH_OP_READ],
+							&cfg.mix[BENCH_OP_WRITE],
+							&cfg.mix[BENCH_OP_LOOKUP],
+							&cfg.mix[BENCH_OP_INDEX]) != 4)
+					bench_usage(argv[0]);
+				break;
+			case 'k':
+				cfg.key_count = strtoull(optarg, NULL, 0);
+				break;
+			case 's':
+				p = strchr(optarg, ':');
+				if (p) {
+					*p = '\0';
+					cfg.size_max = strtoull(p + 1, NULL, 0);
+				}
+				cfg.size_min = strtoull(optarg, NULL, 0);
+				if (!p)
+					cfg.size_max = cfg.size_min;
+				break;
+			case 'z':
+				cfg.zipf_theta = atof(optarg);
+				break;
+			case 't':
+				cfg.threads = atoi(optarg);
+				break;
+			case 'd':
+				cfg.depth = atoi(optarg);
+				break;
+			case 'q':
+				cfg.rate = atof(optarg);
+				break;
+			case 'u':
+				cfg.warmup_sec = atoi(optarg);
+				break;
+			case 'T':
+				cfg.duration_sec = atoi(optarg);
+				break;
+			case 'P':
+				populate = 0;
+				break;
+			case 'h':
+			default:
+				bench_usage(argv[0]);
+		}
+	}
+
+	if (cfg.remote_addr.empty() || cfg.groups.empty() || !cfg.key_count ||
+			cfg.threads < 1 || cfg.depth < 1)
+		bench_usage(argv[0]);
+
+	int total_mix = 0;
+	for (ch = 0; ch < __BENCH_OP_MAX; ++ch)
+		total_mix += cfg.mix[ch];
+	if (total_mix <= 0)
+		bench_usage(argv[0]);
+
+	try {
+		file_logger log(cfg.log_file.c_str(), cfg.log_level);
+		node n(log);
+		n.add_remote(cfg.remote_addr.c_str(), cfg.remote_port, cfg.remote_family);
+
+		session s(n);
+		s.set_groups(cfg.groups);
+
+		if (populate && (cfg.mix[BENCH_OP_READ] || cfg.mix[BENCH_OP_LOOKUP])) {
+			err = bench_populate(s, cfg);
+			if (err)
+				return err;
+		}
+
+		bench_stats stats;
+		bench_worker_ctx ctx;
+		ctx.cfg = &cfg;
+		ctx.stats = &stats;
+
+		bench_clock::time_point start = bench_clock::now();
+		ctx.measure_start = start + std::chrono::seconds(cfg.warmup_sec);
+		ctx.stop = ctx.measure_start + std::chrono::seconds(cfg.duration_sec);
+
+		fprintf(stderr, "running: %d threads, %s loop, %d sec warmup, %d sec measured\n",
+				cfg.threads, cfg.rate > 0 ? "open" : "closed",
+				cfg.warmup_sec, cfg.duration_sec);
+
+		std::vector<std::thread> workers;
+		for (ch = 0; ch < cfg.threads; ++ch) {
+			ctx.worker_id = ch;
+			workers.emplace_back(bench_worker, s, ctx);
+		}
+		for (auto &w : workers)
+			w.join();
+
+		double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+				bench_clock::now() - ctx.measure_start).count() / 1000.;
+		bench_report(cfg, stats, seconds);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "benchmark failed: %s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
@@ -68,6 +68,13 @@ error_info callback_result_entry::error() const
 
 data_pointer callback_result_entry::raw_data() const
 {
+	/*
+	 * Inline payloads live inside callback_result_data itself, so the
+	 * returned view has to share its lifetime to be able to outlive
+	 * this entry. Detached payloads already own their allocation.
+	 */
+	if (m_data->inline_payload)
+		return m_data->data.attach(m_data);
 	return m_data->data;
 }
 
@@ -86,7 +93,7 @@ struct dnet_cmd *callback_result_entry::command() const
 
 data_pointer callback_result_entry::data() const
 {
-	return m_data->data
+	return raw_data()
 		.skip<struct dnet_addr>()
 		.skip<struct dnet_cmd>();
 }
@@ -340,6 +347,41 @@ void iterator_result_container::diff(const iterator_result_container &other,
 	result.m_sorted = true;
 }
 
+//* K-way merge of sorted containers: newest record per key wins and is
+//* appended to the output container with the same index as its origin
+void iterator_result_container::merge(const std::vector<iterator_result_container> &inputs,
+		std::vector<iterator_result_container> &outputs)
+{
+	std::vector<int> in_fds, out_fds;
+	std::vector<uint64_t> in_sizes, out_sizes;
+	int err;
+
+	if (inputs.size() != outputs.size())
+		throw_error(-EINVAL, "merge: inputs and outputs number mismatch");
+	if (inputs.empty())
+		return;
+
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		if (inputs[i].m_sorted == false)
+			throw_error(-EINVAL, "merge: all input containers must be sorted");
+		in_fds.push_back(inputs[i].m_fd);
+		in_sizes.push_back(inputs[i].m_write_position);
+		out_fds.push_back(outputs[i].m_fd);
+	}
+	out_sizes.resize(outputs.size());
+
+	err = dnet_iterator_response_container_merge(inputs.size(),
+			in_fds.data(), in_sizes.data(), out_fds.data(), out_sizes.data());
+	if (err != 0)
+		throw_error(err, "merge failed");
+
+	for (size_t i = 0; i < outputs.size(); ++i) {
+		outputs[i].m_write_position = out_sizes[i];
+		outputs[i].m_count = out_sizes[i] / sizeof(dnet_iterator_response);
+		outputs[i].m_sorted = true;
+	}
+}
+
 //* Extract n-th item from container
 dnet_iterator_response iterator_result_container::operator [](size_t n) const
 {
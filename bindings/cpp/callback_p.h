@@ -20,10 +20,14 @@
 #include "elliptics/cppdef.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <exception>
 #include <iostream>
+#include <map>
 #include <mutex>
 #include <set>
 #include <thread>
@@ -68,22 +72,138 @@ class session_scope
 
 typedef int (*complete_func)(struct dnet_net_state *, struct dnet_cmd *, void *);
 
+/*
+ * Client-side request counters shared between all copies of a session.
+ *
+ * The completion path only touches relaxed atomics so it is lock-free,
+ * the per-node error map takes its lock only when an error actually
+ * happened. Snapshots are taken by session::get_metrics().
+ */
+class session_metrics_data
+{
+	public:
+		struct command_counters
+		{
+			std::atomic<uint64_t> count;
+			std::atomic<uint64_t> errors;
+			std::atomic<uint64_t> latency[command_metrics::latency_buckets];
+		};
+
+		session_metrics_data() : in_flight(0)
+		{
+			for (size_t i = 0; i < __DNET_CMD_MAX; ++i) {
+				commands[i].count = 0;
+				commands[i].errors = 0;
+				for (size_t j = 0; j < command_metrics::latency_buckets; ++j)
+					commands[i].latency[j] = 0;
+			}
+		}
+
+		void record(const dnet_cmd *cmd, dnet_net_state *state, uint64_t usec)
+		{
+			int c = cmd->cmd;
+			if (c < 0 || c >= __DNET_CMD_MAX)
+				c = DNET_CMD_UNKNOWN;
+
+			command_counters &counters = commands[c];
+			counters.count.fetch_add(1, std::memory_order_relaxed);
+
+			size_t bucket = 0;
+			while (usec > 1 && bucket < command_metrics::latency_buckets - 1) {
+				usec >>= 1;
+				++bucket;
+			}
+			counters.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+
+			if (cmd->status < 0) {
+				counters.errors.fetch_add(1, std::memory_order_relaxed);
+
+				if (state) {
+					char addr[128];
+					dnet_server_convert_dnet_addr_raw(dnet_state_addr(state), addr, sizeof(addr));
+
+					std::lock_guard<std::mutex> guard(node_errors_lock);
+					++node_errors[addr];
+				}
+			}
+		}
+
+		std::atomic<uint64_t> in_flight;
+		command_counters commands[__DNET_CMD_MAX];
+
+		std::mutex node_errors_lock;
+		std::map<std::string, uint64_t> node_errors;
+};
+
+/*
+ * Opt-in cache of lookup results, shared between all copies of a session
+ * the same way the metrics above are. An entry holds the complete reply
+ * of one successful lookup and is replayed to callers until its deadline
+ * passes or a write/remove issued through the same session drops it.
+ * See session::set_lookup_cache_ttl().
+ */
+class lookup_cache_data
+{
+	public:
+		enum { max_entries = 65536 };
+
+		typedef std::array<unsigned char, DNET_ID_SIZE> key_type;
+
+		struct entry
+		{
+			std::vector<lookup_result_entry> results;
+			std::chrono::steady_clock::time_point deadline;
+		};
+
+		lookup_cache_data() : ttl(0), hits(0), misses(0)
+		{
+		}
+
+		/* seconds, zero keeps the cache off */
+		std::atomic<long> ttl;
+		std::atomic<uint64_t> hits;
+		std::atomic<uint64_t> misses;
+
+		std::mutex lock;
+		std::map<key_type, entry> entries;
+};
+
 class callback_result_data
 {
 	public:
-		callback_result_data()
+		callback_result_data() : inline_payload(false)
 		{
 		}
 
-		callback_result_data(dnet_addr *addr, dnet_cmd *cmd)
+		/*
+		 * By default the reply copy goes into its own shared allocation.
+		 * With @detached_payload false a small reply is stored in the
+		 * inline buffer instead, turning the three allocations of the
+		 * bulk completion path (this object, the payload, the payload's
+		 * control block) into a single one - but then the stored
+		 * data_pointer is a bare view into this object, and everything
+		 * leaving the entry must be re-tied to its lifetime with
+		 * data_pointer::attach(), see callback_result_entry::raw_data().
+		 */
+		callback_result_data(dnet_addr *addr, dnet_cmd *cmd, bool detached_payload = true)
 		{
 			const size_t size = sizeof(struct dnet_addr) + sizeof(struct dnet_cmd) + cmd->size;
-			void *allocated = malloc(size);
-			if (!allocated)
-				throw std::bad_alloc();
-			data = data_pointer(allocated, size);
-			memcpy(data.data(), addr, sizeof(struct dnet_addr));
-			memcpy(data.data<char>() + sizeof(struct dnet_addr), cmd, sizeof(struct dnet_cmd) + cmd->size);
+			void *allocated;
+
+			inline_payload = (!detached_payload && size <= sizeof(inline_storage));
+			if (inline_payload) {
+				allocated = inline_storage;
+				data = data_pointer::from_raw(allocated, size);
+			} else {
+				allocated = malloc(size);
+				if (!allocated)
+					throw std::bad_alloc();
+				data = data_pointer(allocated, size);
+			}
+
+			memcpy(allocated, addr, sizeof(struct dnet_addr));
+			memcpy(reinterpret_cast<char *>(allocated) + sizeof(struct dnet_addr),
+				cmd, sizeof(struct dnet_cmd) + cmd->size);
 		}
 
 		virtual ~callback_result_data()
@@ -93,8 +213,23 @@ class callback_result_data
 		data_pointer data;
 		error_info error;
 		exec_context context;
+		bool inline_payload;
+
+	private:
+		/* covers the addr+cmd header and all ack/status replies */
+		char inline_storage[256];
 };
 
+/*
+ * Entries whose accessors hand out objects keeping long-lived references
+ * into the reply payload (exec_context stores one inside the result data
+ * itself, which would form an ownership cycle with an attached view) must
+ * keep the payload in a detached shared allocation; everything else can
+ * use the inline buffer of callback_result_data.
+ */
+template <typename T> struct entry_inline_payload { static const bool value = true; };
+template <> struct entry_inline_payload<exec_result_entry> { static const bool value = false; };
+
 enum special_count { unlimited };
 
 struct entry_converter
@@ -143,12 +278,17 @@ class default_callback
 
 		default_callback(const session &sess, const async_result<T> &result)
 			: m_logger(sess.get_node().get_log()),
-			  m_count(1), m_complete(0), m_result(result), m_proto_error(false)
+			  m_count(1), m_complete(0), m_result(result), m_proto_error(false),
+			  m_detached(false),
+			  m_metrics(sess.get_metrics_data())
 		{
+			dnet_current_time(&m_start);
+			m_metrics->in_flight.fetch_add(1, std::memory_order_relaxed);
 		}
 
 		virtual ~default_callback()
 		{
+			m_metrics->in_flight.fetch_sub(1, std::memory_order_relaxed);
 		}
 
 		bool set_count(size_t count)
@@ -188,8 +328,11 @@ class default_callback
 					} else {
 						m_statuses.push_back(cmd->status);
 					}
+
+					m_metrics->record(cmd, state, elapsed_usec());
 				}
-				auto data = std::make_shared<callback_result_data>(dnet_state_addr(state), cmd);
+				auto data = std::make_shared<callback_result_data>(dnet_state_addr(state), cmd,
+						!entry_inline_payload<T>::value);
 				process(cmd, data, data.get());
 			}
 			return (m_count == m_complete);
@@ -232,6 +375,9 @@ class default_callback
 
 		void process(const T &entry)
 		{
+			if (m_detached.load(std::memory_order_acquire))
+				return;
+
 			if (m_process_entry && entry.status() == 0 && !entry.data().empty()) {
 				m_process_entry(entry);
 			}
@@ -270,8 +416,23 @@ class default_callback
 			m_proto_error = false;
 		}
 
+		/*
+		 * Detaches the callback from its async_result: the result was
+		 * completed early (write quorum reached) while straggler
+		 * transactions are still in flight. Their replies and the
+		 * final complete() are swallowed, the callback itself stays
+		 * alive until every transaction is destroyed.
+		 */
+		void detach_result()
+		{
+			m_detached.store(true, std::memory_order_release);
+		}
+
 		void complete(std::exception_ptr exc)
 		{
+			if (m_detached.load(std::memory_order_acquire))
+				return;
+
 			if (exc) {
 				try {
 					std::rethrow_exception(exc);
@@ -287,10 +448,23 @@ class default_callback
 
 		void complete(const error_info &error)
 		{
+			if (m_detached.load(std::memory_order_acquire))
+				return;
+
 			m_result.complete(error);
 		}
 
 	protected:
+		uint64_t elapsed_usec() const
+		{
+			dnet_time now;
+			dnet_current_time(&now);
+
+			int64_t usec = (now.tsec - m_start.tsec) * 1000000 +
+				((int64_t)now.tnsec - (int64_t)m_start.tnsec) / 1000;
+			return usec > 0 ? usec : 0;
+		}
+
 		logger m_logger;
 		size_t m_count;
 		size_t m_complete;
@@ -299,6 +473,9 @@ class default_callback
 		entry_processor_func m_process_entry;
 		typename async_result<T>::handler m_result;
 		bool m_proto_error;
+		std::atomic<bool> m_detached;
+		std::shared_ptr<session_metrics_data> m_metrics;
+		dnet_time m_start;
 };
 
 template <typename Result, dnet_commands Command>
@@ -536,7 +713,9 @@ class read_callback : public multigroup_callback<read_result_entry>
 		typedef std::shared_ptr<read_callback> ptr;
 
 		read_callback(const session &sess, const async_read_result &result, const dnet_io_control &ctl)
-			: multigroup_callback<read_result_entry>(sess, result), ctl(ctl)
+			: multigroup_callback<read_result_entry>(sess, result), ctl(ctl),
+			hedge_delay(0), hedge_inflight(0), hedge_status(0),
+			hedge_pending(false), hedge_completed(false)
 		{
 			cb.set_process_entry(std::bind(&read_callback::process_entry, this, std::placeholders::_1));
 		}
@@ -564,6 +743,190 @@ class read_callback : public multigroup_callback<read_result_entry>
 			return cb.set_count(1);
 		}
 
+		/*
+		 * Hedged flavour: when session::set_read_hedging() is enabled and
+		 * the tail latency of the best group is known, session::read_data()
+		 * arms hedge_delay and the serial group iteration above is replaced
+		 * with "send to the best group, duplicate the request to the
+		 * second-best one unless an answer arrived within the delay, first
+		 * valid reply wins". The caller is unblocked by the winning reply,
+		 * but the callback itself lives until both transactions and the
+		 * deferred timer have fired, which keeps all lifetimes correct
+		 * without cancellation support.
+		 */
+		bool start(error_info *error, complete_func func, void *priv)
+		{
+			if (!hedge_delay)
+				return multigroup_callback<read_result_entry>::start(error, func, priv);
+
+			struct dnet_id id = kid.id();
+			id.group_id = groups[0];
+			m_group_index = 1;
+
+			memcpy(&ctl.id, &id, sizeof(id));
+			ctl.complete = func;
+			ctl.priv = priv;
+
+			cb.set_count(unlimited);
+
+			/*
+			 * Armed before the send: the reply (or the synchronous error
+			 * completion) may run immediately, and a pending hedge keeps
+			 * it from finishing the callback under us.
+			 */
+			hedge_inflight = 1;
+			hedge_pending = true;
+
+			int err = dnet_read_object(sess.get_native(), &ctl);
+			if (err) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				hedge_pending = false;
+				*error = create_error(err, ctl.id, "READ: size: %llu",
+					static_cast<unsigned long long>(ctl.io.size));
+				return true;
+			}
+
+			err = dnet_node_defer(sess.get_node().get_native(), hedge_delay,
+					hedge_fire_trampoline, this);
+			if (err) {
+				/* no timer - degrades to a plain single-group read */
+				std::lock_guard<std::mutex> lock(m_mutex);
+				hedge_pending = false;
+				return hedge_check_finished(error);
+			}
+
+			return false;
+		}
+
+		bool handle(error_info *error, struct dnet_net_state *state, struct dnet_cmd *cmd, complete_func func, void *priv)
+		{
+			if (!hedge_delay)
+				return multigroup_callback<read_result_entry>::handle(error, state, cmd, func, priv);
+
+			dnet_io_control retry_ctl;
+			bool complete_now = false;
+			bool retry = false;
+			bool finished;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				if (is_trans_destroyed(state, cmd)) {
+					--hedge_inflight;
+					/* everything failed without an answer - fall back serially */
+					if (!hedge_inflight && !hedge_completed)
+						retry = hedge_prepare_next(&retry_ctl);
+				} else {
+					if (!(cmd->flags & DNET_FLAGS_MORE) && cmd->status)
+						hedge_status = cmd->status;
+
+					if (!hedge_completed) {
+						cb.handle(state, cmd, func, priv);
+						if (cb.is_valid()) {
+							/* the winner - the loser is drained silently */
+							hedge_completed = true;
+							complete_now = true;
+						}
+					}
+				}
+
+				finished = hedge_check_finished(error);
+			}
+
+			if (retry) {
+				dnet_read_object(sess.get_native(), &retry_ctl);
+				/* on failure the completion handler has already run again */
+			}
+
+			if (complete_now)
+				cb.complete(error_info());
+
+			return finished;
+		}
+
+		/*
+		 * Fired by the node defer thread once the hedge delay elapsed (or
+		 * early on node shutdown). hedge_pending stays raised for the whole
+		 * call so that a racing reply cannot finish and free the callback
+		 * under us.
+		 */
+		void hedge_fire()
+		{
+			dnet_io_control send_ctl;
+			bool send = false;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				if (hedge_inflight > 0 && !hedge_completed)
+					send = hedge_prepare_next(&send_ctl);
+			}
+
+			if (send) {
+				dnet_log_raw(sess.get_node().get_native(), DNET_LOG_NOTICE,
+					"%s: hedged read: no answer from group %d within %ld usecs, duplicating to group %d\n",
+					dnet_dump_id(&send_ctl.id), groups[0], hedge_delay, send_ctl.id.group_id);
+
+				dnet_read_object(sess.get_native(), &send_ctl);
+				/* on failure the completion handler has already run with an error */
+			}
+
+			bool finished;
+			error_info error;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				hedge_pending = false;
+				finished = hedge_check_finished(&error);
+			}
+
+			if (finished) {
+				finish(error);
+				delete this;
+			}
+		}
+
+		static void hedge_fire_trampoline(void *priv)
+		{
+			reinterpret_cast<read_callback *>(priv)->hedge_fire();
+		}
+
+		/*
+		 * Consumes the next untried group and builds a control ready to be
+		 * sent outside the lock - the shared ctl must not be sent directly,
+		 * a racing fallback and hedge would overwrite each other's id.
+		 * The new request is accounted before the send because an error
+		 * completion may run synchronously. m_mutex must be held.
+		 */
+		bool hedge_prepare_next(dnet_io_control *out)
+		{
+			if (m_group_index >= groups.size())
+				return false;
+
+			struct dnet_id id = kid.id();
+			id.group_id = groups[m_group_index++];
+
+			memcpy(&ctl.id, &id, sizeof(id));
+			*out = ctl;
+
+			++hedge_inflight;
+			return true;
+		}
+
+		/* m_mutex must be held */
+		bool hedge_check_finished(error_info *error)
+		{
+			if (hedge_inflight || hedge_pending)
+				return false;
+
+			if (!hedge_completed)
+				*error = create_error(hedge_status ? hedge_status : -ENXIO, ctl.id,
+					"READ: size: %llu",
+					static_cast<unsigned long long>(ctl.io.size));
+
+			return true;
+		}
+
 		void process_entry(const read_result_entry &entry)
 		{
 			read_result = entry;
@@ -571,6 +934,10 @@ class read_callback : public multigroup_callback<read_result_entry>
 
 		void finish(const error_info &error)
 		{
+			/* hedged reads answer the caller from handle() as soon as the winning reply arrives */
+			if (hedge_completed)
+				return;
+
 			dnet_io_attr *io = (read_result.is_valid() ? read_result.io_attribute() : NULL);
 
 			if (!error && !failed_groups.empty()
@@ -638,6 +1005,12 @@ class read_callback : public multigroup_callback<read_result_entry>
 
 		struct dnet_io_control ctl;
 		std::vector<int> failed_groups;
+		/* hedged-read state, see the comment above start() */
+		long hedge_delay;
+		int hedge_inflight;
+		int hedge_status;
+		bool hedge_pending;
+		bool hedge_completed;
 		read_result_entry read_result;
 };
 
@@ -798,6 +1171,115 @@ class read_bulk_callback : public read_callback
 		std::vector<read_result_entry> result;
 };
 
+/*
+ * Removal happens in every session group, so unlike read_bulk_callback all
+ * transactions are started at once: keys are grouped into runs targeting
+ * the same destination state and every run becomes one DNET_CMD_BULK_DEL.
+ */
+class remove_bulk_callback
+{
+	public:
+		typedef std::shared_ptr<remove_bulk_callback> ptr;
+
+		remove_bulk_callback(const session &sess, const async_generic_result &result, const io_attr_set &ios, const dnet_io_control &ctl)
+			: sess(sess), cb(sess, result), ctl(ctl), ios_set(ios)
+		{
+		}
+
+		void send_run(int group_id, size_t start, size_t end, complete_func func, void *priv, int *count)
+		{
+			ctl.io.size = (end - start) * sizeof(struct dnet_io_attr);
+			ctl.data = ios_cache.data() + start;
+
+			dnet_setup_id(&ctl.id, group_id, ios_cache[start].id);
+			ctl.complete = func;
+			ctl.priv = priv;
+
+			int err = dnet_read_object(sess.get_native(), &ctl);
+			// errors arrive through the completion handler
+			(void) err;
+			++*count;
+		}
+
+		bool start(error_info *error, complete_func func, void *priv)
+		{
+			cb.set_count(unlimited);
+
+			const std::vector<int> groups = sess.get_groups();
+			cb.set_total(groups.size());
+
+			dnet_node *node = sess.get_node().get_native();
+			int count = 0;
+
+			ios_cache.assign(ios_set.begin(), ios_set.end());
+			const size_t io_num = ios_cache.size();
+
+			for (size_t group_index = 0; group_index < groups.size(); ++group_index) {
+				const int group_id = groups[group_index];
+				dnet_net_state *cur = NULL, *next;
+				size_t start = 0;
+				dnet_id id;
+
+				for (size_t i = 0; i < io_num; ++i) {
+					dnet_setup_id(&id, group_id, ios_cache[i].id);
+
+					next = dnet_state_get_first(node, &id);
+					if (!next) {
+						/* no route for this key - flush the pending run and skip it */
+						if (cur) {
+							send_run(group_id, start, i, func, priv, &count);
+							dnet_state_put(cur);
+							cur = NULL;
+						}
+						continue;
+					}
+
+					if (cur == next) {
+						dnet_state_put(next);
+						continue;
+					}
+
+					if (cur) {
+						send_run(group_id, start, i, func, priv, &count);
+						dnet_state_put(cur);
+					}
+
+					cur = next;
+					start = i;
+				}
+
+				if (cur) {
+					send_run(group_id, start, io_num, func, priv, &count);
+					dnet_state_put(cur);
+				}
+			}
+
+			if (!count) {
+				*error = create_error(-ENOENT, "bulk_remove: can't find any destination state");
+				return true;
+			}
+
+			return cb.set_count(count);
+		}
+
+		bool handle(error_info *error, struct dnet_net_state *state, struct dnet_cmd *cmd, complete_func func, void *priv)
+		{
+			(void) error;
+			return cb.handle(state, cmd, func, priv);
+		}
+
+		void finish(const error_info &error)
+		{
+			cb.complete(error);
+		}
+
+		session sess;
+		default_callback<callback_result_entry> cb;
+		dnet_io_control ctl;
+		io_attr_set ios_set;
+		std::vector<dnet_io_attr> ios_cache;
+};
+
 class cmd_callback
 {
 	public:
@@ -886,7 +1368,9 @@ class write_callback
 		typedef std::shared_ptr<write_callback> ptr;
 
 		write_callback(const session &sess, const async_write_result &result, const dnet_io_control &ctl):
-		sess(sess), cb(sess, result), ctl(ctl)
+		sess(sess), cb(sess, result), ctl(ctl),
+		quorum(sess.get_write_quorum()), error_handler(sess.get_error_handler()),
+		acked(0), quorum_done(false)
 		{
 		}
 
@@ -917,10 +1401,44 @@ class write_callback
 			return cb.set_count(err);
 		}
 
+		/*
+		 * Quorum mode: the result completes as soon as @quorum groups
+		 * sent a successful final reply, the straggler transactions
+		 * keep running detached and their late failures go to the
+		 * session's error handler. The checker runs against the
+		 * statuses collected up to the early completion.
+		 */
 		bool handle(error_info *error, struct dnet_net_state *state, struct dnet_cmd *cmd, complete_func func, void *priv)
 		{
+			bool complete_now = false;
+			bool late_failure = false;
+
 			(void) error;
-			return cb.handle(state, cmd, func, priv);
+
+			if (quorum && !is_trans_destroyed(state, cmd) && !(cmd->flags & DNET_FLAGS_MORE)) {
+				std::lock_guard<std::mutex> guard(quorum_mutex);
+
+				if (cmd->status == 0) {
+					if (++acked >= quorum && !quorum_done) {
+						quorum_done = true;
+						complete_now = true;
+					}
+				} else if (quorum_done) {
+					late_failure = true;
+				}
+			}
+
+			if (late_failure)
+				error_handler(create_error(*cmd), std::vector<dnet_cmd>(1, *cmd));
+
+			bool done = cb.handle(state, cmd, func, priv);
+
+			if (complete_now && !done) {
+				cb.complete(error_info());
+				cb.detach_result();
+			}
+
+			return done;
 		}
 
 		void finish(const error_info &exc)
@@ -931,6 +1449,88 @@ class write_callback
 		session sess;
 		default_callback<write_result_entry> cb;
 		dnet_io_control ctl;
+		size_t quorum;
+		result_error_handler error_handler;
+		std::mutex quorum_mutex;
+		size_t acked;
+		bool quorum_done;
+};
+
+/*
+ * Sends pre-packed DNET_CMD_BATCH envelopes of WRITE sub-commands - one
+ * per destination node - and collects the lookup results the sub-writes
+ * stream back within the envelope transactions. Packing is done by
+ * session::bulk_write(), each envelope is routed by its first key.
+ */
+class write_batch_callback
+{
+	public:
+		typedef std::shared_ptr<write_batch_callback> ptr;
+
+		write_batch_callback(const session &sess, const async_write_result &result,
+				const std::vector<dnet_id> &ids, std::vector<std::string> &&packets)
+			: sess(sess), cb(sess, result), ids(ids), packets(std::move(packets))
+		{
+		}
+
+		bool start(error_info *error, complete_func func, void *priv)
+		{
+			dnet_node *node = sess.get_node().get_native();
+
+			(void) error;
+
+			cb.set_count(unlimited);
+			cb.set_total(ids.size());
+
+			for (size_t i = 0; i < ids.size(); ++i) {
+				dnet_trans_control ctl;
+				memset(&ctl, 0, sizeof(ctl));
+
+				ctl.id = ids[i];
+				ctl.cmd = DNET_CMD_BATCH;
+				ctl.cflags = DNET_FLAGS_NEED_ACK | sess.get_cflags();
+				ctl.data = const_cast<char *>(packets[i].data());
+				ctl.size = packets[i].size();
+				ctl.complete = func;
+				ctl.priv = priv;
+
+				dnet_net_state *st;
+				if (ctl.cflags & DNET_FLAGS_DIRECT) {
+					dnet_id direct_id = sess.get_direct_id();
+					direct_id.group_id = ids[i].group_id;
+					st = dnet_state_get_first(node, &direct_id);
+				} else {
+					st = dnet_state_get_first(node, &ids[i]);
+				}
+
+				if (!st) {
+					/* keep the completion count consistent, see dnet_trans_alloc_send() */
+					func(NULL, NULL, priv);
+					continue;
+				}
+
+				dnet_trans_alloc_send_state(sess.get_native(), st, &ctl);
+				dnet_state_put(st);
+			}
+
+			return cb.set_count(ids.size());
+		}
+
+		bool handle(error_info *error, struct dnet_net_state *state, struct dnet_cmd *cmd, complete_func func, void *priv)
+		{
+			(void) error;
+			return cb.handle(state, cmd, func, priv);
+		}
+
+		void finish(const error_info &exc)
+		{
+			cb.complete(exc);
+		}
+
+		session sess;
+		default_callback<write_result_entry> cb;
+		std::vector<dnet_id> ids;
+		std::vector<std::string> packets;
 };
 
 class remove_callback
@@ -1109,7 +1709,7 @@ struct dnet_style_handler
 template <typename T, typename... Args>
 static inline std::unique_ptr<T> createCallback(Args && ...args)
 {
-	return std::unique_ptr<T>(new T(args...));
+	return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
 }
 
 template <typename T>
@@ -22,28 +22,29 @@
 
 namespace ioremap { namespace elliptics {
 
-key::key() : m_by_id(false), m_reserved(0)
+key::key() : m_by_id(false), m_reserved(0), m_transformed(false)
 {
 	memset(&m_id, 0, sizeof(m_id));
 }
 
-key::key(const std::string &remote) : m_by_id(false), m_remote(remote), m_reserved(0)
+key::key(const std::string &remote) : m_by_id(false), m_remote(remote), m_reserved(0), m_transformed(false)
 {
 	memset(&m_id, 0, sizeof(m_id));
 }
 
-key::key(const dnet_id &id) : m_by_id(true), m_reserved(0), m_id(id)
+key::key(const dnet_id &id) : m_by_id(true), m_reserved(0), m_id(id), m_transformed(false)
 {
 }
 
-key::key(const dnet_raw_id &id) : m_by_id(true), m_reserved(0)
+key::key(const dnet_raw_id &id) : m_by_id(true), m_reserved(0), m_transformed(false)
 {
 	memset(&m_id, 0, sizeof(m_id));
 	memcpy(m_id.id, id.id, sizeof(id.id));
 }
 
 key::key(const key &other)
-	: m_by_id(other.m_by_id), m_remote(other.m_remote), m_reserved(other.m_reserved), m_id(other.m_id)
+	: m_by_id(other.m_by_id), m_remote(other.m_remote), m_reserved(other.m_reserved), m_id(other.m_id),
+	m_transformed(other.m_transformed), m_transform_ns(other.m_transform_ns)
 {
 }
 
@@ -53,6 +54,8 @@ key &key::operator =(const key &other)
 	m_remote = other.m_remote;
 	m_reserved = other.m_reserved;
 	m_id = other.m_id;
+	m_transformed = other.m_transformed;
+	m_transform_ns = other.m_transform_ns;
 	return *this;
 }
 
@@ -121,8 +124,51 @@ void key::transform(session &sess)
 	if (m_by_id)
 		return;
 
+	const std::string ns = sess.get_namespace();
+
+	/*
+	 * The cached hash stays valid until the session namespace changes,
+	 * only the trace id belongs to the current session.
+	 */
+	if (m_transformed && ns == m_transform_ns) {
+		m_id.trace_id = sess.get_trace_id();
+		return;
+	}
+
 	memset(&m_id, 0, sizeof(m_id));
 	sess.transform(m_remote, m_id);
+
+	m_transformed = true;
+	m_transform_ns = ns;
+}
+
+std::vector<key> key::transform_all(session &sess, const std::vector<std::string> &remotes)
+{
+	std::vector<key> keys(remotes.begin(), remotes.end());
+	std::vector<const void *> srcs(keys.size());
+	std::vector<uint64_t> sizes(keys.size());
+	std::vector<char *> csums(keys.size());
+	const std::string ns = sess.get_namespace();
+	int err;
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		srcs[i] = keys[i].m_remote.data();
+		sizes[i] = keys[i].m_remote.size();
+		csums[i] = reinterpret_cast<char *>(keys[i].m_id.id);
+	}
+
+	err = dnet_transform_raw_batch(sess.get_native(), srcs.data(), sizes.data(),
+			csums.data(), DNET_ID_SIZE, keys.size());
+	if (err)
+		throw_error(err, "Failed to transform %zd keys", keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		keys[i].m_id.trace_id = sess.get_trace_id();
+		keys[i].m_transformed = true;
+		keys[i].m_transform_ns = ns;
+	}
+
+	return keys;
 }
 
 void key::set_id(const dnet_id &id)
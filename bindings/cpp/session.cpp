@@ -99,7 +99,7 @@ struct exec_context_data
 	{
 		std::shared_ptr<exec_context_data> p = std::make_shared<exec_context_data>();
 
-		p->sph = data_pointer::allocate(sizeof(struct sph) + event.size() + data.size());
+		p->sph = data_pointer::allocate_pooled(sizeof(struct sph) + event.size() + data.size());
 
 		struct sph *raw_sph = p->sph.data<struct sph>();
 		if (other) {
@@ -370,6 +370,10 @@ class session_data
 			error_handler = error_handlers::none;
 			policy = session::default_exceptions;
 			trace_id = 0;
+			read_hedging = false;
+			write_quorum = 0;
+			metrics = std::make_shared<session_metrics_data>();
+			lookup_cache = std::make_shared<lookup_cache_data>();
 			::trace_id = 0;
 		}
 
@@ -379,7 +383,13 @@ class session_data
 			checker(other.checker),
 			error_handler(other.error_handler),
 			policy(other.policy),
-			trace_id(other.trace_id)
+			trace_id(other.trace_id),
+			read_hedging(other.read_hedging),
+			write_quorum(other.write_quorum),
+			/* counters are aggregated over all clones of the session */
+			metrics(other.metrics),
+			/* shared too - a write through any clone must invalidate */
+			lookup_cache(other.lookup_cache)
 		{
 			session_ptr = dnet_session_copy(other.session_ptr);
 			if (!session_ptr)
@@ -401,6 +411,10 @@ class session_data
 		result_error_handler	error_handler;
 		uint32_t		policy;
 		uint32_t		trace_id;
+		bool			read_hedging;
+		size_t			write_quorum;
+		std::shared_ptr<session_metrics_data> metrics;
+		std::shared_ptr<lookup_cache_data> lookup_cache;
 };
 
 session::session(const node &n) : m_data(std::make_shared<session_data>(n))
@@ -473,6 +487,16 @@ result_error_handler session::get_error_handler() const
 	return m_data->error_handler;
 }
 
+void session::set_write_quorum(size_t quorum)
+{
+	m_data->write_quorum = quorum;
+}
+
+size_t session::get_write_quorum() const
+{
+	return m_data->write_quorum;
+}
+
 void session::set_exceptions_policy(uint32_t policy)
 {
 	m_data->policy = policy;
@@ -535,6 +559,35 @@ uint64_t session::get_cflags() const
 	return dnet_session_get_cflags(m_data->session_ptr);
 }
 
+void session::set_qos_class(uint32_t qos_class)
+{
+	uint64_t cflags = get_cflags() & ~(DNET_FLAGS_QOS_MASK << DNET_FLAGS_QOS_SHIFT);
+
+	set_cflags(cflags | (((uint64_t)qos_class & DNET_FLAGS_QOS_MASK) << DNET_FLAGS_QOS_SHIFT));
+}
+
+uint32_t session::get_qos_class() const
+{
+	return DNET_FLAGS_QOS(get_cflags());
+}
+
+void session::set_lookup_cache_ttl(long ttl_seconds)
+{
+	lookup_cache_data *cache = m_data->lookup_cache.get();
+
+	cache->ttl.store(ttl_seconds, std::memory_order_relaxed);
+
+	if (!ttl_seconds) {
+		std::lock_guard<std::mutex> guard(cache->lock);
+		cache->entries.clear();
+	}
+}
+
+long session::get_lookup_cache_ttl() const
+{
+	return m_data->lookup_cache->ttl.load(std::memory_order_relaxed);
+}
+
 void session::set_ioflags(uint32_t ioflags)
 {
 	dnet_session_set_ioflags(m_data->session_ptr, ioflags);
@@ -551,6 +604,24 @@ void session::set_namespace(const char *ns, int nsize)
 	}
 }
 
+std::string session::get_namespace() const
+{
+	int nsize = 0;
+	const char *ns = dnet_session_get_ns(m_data->session_ptr, &nsize);
+
+	return std::string(ns ? ns : "", nsize);
+}
+
+void session::set_indexes_shard_count(int shard_count)
+{
+	dnet_session_set_indexes_shard_count(m_data->session_ptr, shard_count);
+}
+
+int session::get_indexes_shard_count() const
+{
+	return dnet_session_get_indexes_shard_count(m_data->session_ptr);
+}
+
 uint32_t session::get_ioflags() const
 {
 	return dnet_session_get_ioflags(m_data->session_ptr);
@@ -598,6 +669,16 @@ uint32_t session::get_trace_id()
 	return m_data->trace_id;
 }
 
+void session::set_read_hedging(bool enable)
+{
+	m_data->read_hedging = enable;
+}
+
+bool session::get_read_hedging() const
+{
+	return m_data->read_hedging;
+}
+
 void session::read_file(const key &id, const std::string &file, uint64_t offset, uint64_t size)
 {
 	int err;
@@ -662,6 +743,17 @@ async_read_result session::read_data(const key &id, const std::vector<int> &grou
 	cb->kid = id;
 	cb->groups = groups;
 
+	if (m_data->read_hedging && groups.size() > 1) {
+		/*
+		 * Hedging needs latency history: until the first sample
+		 * arrives dnet_get_read_latency_p99() returns 0 and the
+		 * read stays serial.
+		 */
+		dnet_id raw = id.id();
+		raw.group_id = groups[0];
+		cb->hedge_delay = dnet_get_read_latency_p99(m_data->session_ptr, &raw);
+	}
+
 	startCallback(cb);
 	return result;
 }
@@ -798,29 +890,115 @@ async_lookup_result session::prepare_latest(const key &id, const std::vector<int
 	return result;
 }
 
-// It could be a lambda functor! :`(
-struct read_latest_callback
+/*
+ * Optimistic latest-read: the prepare_latest lookup fan-out runs in
+ * parallel with a read to the preferred group. When the lookups confirm
+ * that group held the newest timestamp (or the optimistic reply carries an
+ * equal one), the already-received data is delivered and latest-read costs
+ * a single round trip. On mismatch the optimistic reply is discarded and
+ * the read is reissued in freshest-first group order - the old two-RTT
+ * behaviour becomes the fallback instead of the common case.
+ */
+struct read_latest_state
 {
+	read_latest_state(const session &sess, const key &id, uint64_t offset, uint64_t size,
+			const async_result_handler<read_result_entry> &handler) :
+		sess(sess), id(id), offset(offset), size(size), handler(handler),
+		preferred_group(-1), pending(2), best_group(-1)
+	{
+		dnet_empty_time(&best_mtime);
+	}
+
 	session sess;
 	key id;
 	uint64_t offset;
 	uint64_t size;
 	async_result_handler<read_result_entry> handler;
+	int preferred_group;
+
+	std::mutex lock;
+	int pending;
+
+	// optimistic read outcome
+	std::vector<read_result_entry> read_entries;
+	error_info read_error;
+
+	// lookup outcome: freshest-first group order and the best timestamp
 	std::vector<int> groups;
+	dnet_time best_mtime;
+	int best_group;
+};
+
+static void read_latest_complete(const std::shared_ptr<read_latest_state> &state)
+{
+	bool fresh = false;
+
+	if (!state->read_error && !state->read_entries.empty()) {
+		if (state->best_group < 0 || state->best_group == state->preferred_group) {
+			// lookups failed everywhere or agreed with the preferred group
+			fresh = true;
+		} else {
+			const dnet_io_attr *io = state->read_entries.front().io_attribute();
+			fresh = io && io->timestamp.tsec == state->best_mtime.tsec
+				&& io->timestamp.tnsec == state->best_mtime.tnsec;
+		}
+	}
+
+	if (fresh) {
+		for (auto it = state->read_entries.begin(); it != state->read_entries.end(); ++it)
+			state->handler.process(*it);
+		state->handler.complete(error_info());
+		return;
+	}
+
+	session_scope scope(state->sess);
+	state->sess.set_exceptions_policy(session::no_exceptions);
+	state->sess.read_data(state->id, state->groups, state->offset, state->size).connect(state->handler);
+}
+
+// It could be a lambda functor! :`(
+struct read_latest_optimistic_callback
+{
+	std::shared_ptr<read_latest_state> state;
+
+	void operator() (const std::vector<read_result_entry> &entries, const error_info &error)
+	{
+		std::unique_lock<std::mutex> guard(state->lock);
+		state->read_entries = entries;
+		state->read_error = error;
+
+		if (--state->pending == 0) {
+			guard.unlock();
+			read_latest_complete(state);
+		}
+	}
+};
+
+struct read_latest_lookup_callback
+{
+	std::shared_ptr<read_latest_state> state;
 
 	void operator() (const std::vector<lookup_result_entry> &result, const error_info &error)
 	{
+		std::unique_lock<std::mutex> guard(state->lock);
+
 		if (!error && !result.empty()) {
-			groups.clear();
-			groups.reserve(result.size());
+			state->groups.clear();
+			state->groups.reserve(result.size());
 			for (auto it = result.begin(); it != result.end(); ++it)
-				groups.push_back(it->command()->id.group_id);
+				state->groups.push_back(it->command()->id.group_id);
+
+			// entries arrive sorted freshest-first, see prepare_latest_functor
+			const lookup_result_entry &best = result.front();
+			if (best.status() == 0 && best.data().size() > sizeof(dnet_file_info)) {
+				state->best_group = best.command()->id.group_id;
+				state->best_mtime = best.file_info()->mtime;
+			}
 		}
 
-		{
-			session_scope scope(sess);
-			sess.set_exceptions_policy(session::no_exceptions);
-			sess.read_data(id, groups, offset, size).connect(handler);
+		if (--state->pending == 0) {
+			guard.unlock();
+			read_latest_complete(state);
 		}
 	}
 };
@@ -833,14 +1011,39 @@ async_read_result session::read_latest(const key &id, uint64_t offset, uint64_t
 		set_filter(filters::positive);
 		set_checker(checkers::no_check);
 
-		read_latest_callback callback = { *this, id, offset, size, result, mix_states(id) };
-		prepare_latest(id, callback.groups).connect(callback);
+		transform(id);
+
+		std::vector<int> groups = mix_states(id);
+
+		async_result_handler<read_result_entry> handler(result);
+		auto state = std::make_shared<read_latest_state>(*this, id, offset, size, handler);
+		state->groups = groups;
+		state->preferred_group = groups.empty() ? -1 : groups.front();
+
+		{
+			session optimistic = clone();
+			optimistic.set_exceptions_policy(no_exceptions);
+			optimistic.set_filter(filters::positive);
+			optimistic.set_checker(checkers::no_check);
+
+			read_latest_optimistic_callback callback = { state };
+			optimistic.read_data(id, std::vector<int>(1, state->preferred_group),
+					offset, size).connect(callback);
+		}
+
+		read_latest_lookup_callback callback = { state };
+		prepare_latest(id, groups).connect(callback);
 	}
 	return result;
 }
 
+/* defined next to session::lookup below */
+static void lookup_cache_invalidate(lookup_cache_data *cache, const dnet_id &id);
+
 async_write_result session::write_data(const dnet_io_control &ctl)
 {
+	lookup_cache_invalidate(m_data->lookup_cache.get(), ctl.id);
+
 	async_write_result result(*this);
 	auto cb = createCallback<write_callback>(*this, result, ctl);
 
@@ -901,45 +1104,132 @@ async_write_result session::write_data(const key &id, const data_pointer &file,
 	return write_data(ctl);
 }
 
+/* default number of chunks kept in flight by chunked write_data() */
+static const size_t default_chunk_write_window = 8;
+
+/*
+ * Pipelined chunked write: the first chunk goes through write_prepare(),
+ * middle chunks are written with up to @window concurrent write_plain()
+ * requests and the final chunk is committed with a single write_commit()
+ * once every plain write has completed. Middle chunks cover distinct
+ * offsets, so their completion order does not matter; the commit is sent
+ * only to the groups where the prepare and every chunk succeeded.
+ */
 struct chunk_handler : public std::enable_shared_from_this<chunk_handler> {
 
 	chunk_handler(const async_write_result::handler &handler, const session &sess,
-				  const key &id, const data_pointer &content, const uint64_t &remote_offset, const uint64_t &local_offset, const uint64_t &chunk_size)
+				  const key &id, const data_pointer &content, const uint64_t &remote_offset,
+				  const uint64_t &chunk_size, size_t window)
 		: handler(handler)
 		, sess(sess.clone())
 		, id (id)
 		, content(content)
 		, remote_offset(remote_offset)
-		, local_offset(local_offset)
 		, chunk_size(chunk_size)
+		, commit_offset(((content.size() - 1) / chunk_size) * chunk_size)
+		, next_offset(chunk_size)
+		, window(window ? window : 1)
+		, in_flight(0)
+		, commit_sent(false)
 	{
 		//this->sess.set_filter(filters::all_with_ack);
 	}
 
-	void write_next(const std::vector<write_result_entry> &entries, const error_info &error) {
+	void start(const std::vector<write_result_entry> &entries, const error_info &error) {
 		if (error.code() != 0) {
 			handler.complete(error);
 			return;
 		}
 
-		std::vector<int> groups;
-		for (auto it = entries.begin(); it != entries.end(); ++it) {
+		for (auto it = entries.begin(); it != entries.end(); ++it)
 			groups.push_back(it->command()->id.group_id);
-		}
 		sess.set_groups(groups);
 
-		local_offset += chunk_size;
-		if (local_offset + chunk_size >= content.size()) {
-			auto write_content = content.slice(local_offset, content.size() - local_offset);
-			auto awr = sess.write_commit(id, write_content, remote_offset + local_offset, remote_offset + content.size());
-			awr.connect(std::bind(&chunk_handler::finish, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
-		} else {
-			auto write_content = content.slice(local_offset, chunk_size);
-			auto awr = sess.write_plain(id, write_content, remote_offset + local_offset);
-			awr.connect(std::bind(&chunk_handler::write_next, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+		pump();
+	}
+
+	void chunk_complete(const std::vector<write_result_entry> &entries, const error_info &error) {
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			--in_flight;
+
+			if (error.code() != 0) {
+				if (chunk_error.code() == 0)
+					chunk_error = error;
+			} else {
+				narrow_groups(entries);
+			}
+		}
+
+		pump();
+	}
+
+	void pump() {
+		std::vector<uint64_t> offsets;
+		error_info fail;
+		bool commit = false;
+		bool failed = false;
+
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+
+			if (chunk_error.code() != 0) {
+				/* drain in-flight chunks before reporting the error once */
+				if (in_flight == 0 && !commit_sent) {
+					commit_sent = true;
+					fail = chunk_error;
+					failed = true;
+				}
+			} else {
+				while (in_flight < window && next_offset < commit_offset) {
+					offsets.push_back(next_offset);
+					next_offset += chunk_size;
+					++in_flight;
+				}
+
+				if (next_offset >= commit_offset && in_flight == 0 && !commit_sent) {
+					commit_sent = true;
+					commit = true;
+				}
+			}
+		}
+
+		if (failed) {
+			handler.complete(fail);
+			return;
+		}
+
+		for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+			auto write_content = content.slice(*it, chunk_size);
+			auto awr = sess.write_plain(id, write_content, remote_offset + *it);
+			awr.connect(std::bind(&chunk_handler::chunk_complete, shared_from_this(),
+						std::placeholders::_1, std::placeholders::_2));
+		}
+
+		if (commit) {
+			sess.set_groups(groups);
+			auto write_content = content.slice(commit_offset, content.size() - commit_offset);
+			auto awr = sess.write_commit(id, write_content, remote_offset + commit_offset, remote_offset + content.size());
+			awr.connect(std::bind(&chunk_handler::finish, shared_from_this(),
+						std::placeholders::_1, std::placeholders::_2));
 		}
 	}
 
+	/* called under @mutex */
+	void narrow_groups(const std::vector<write_result_entry> &entries) {
+		std::vector<int> succeeded, result;
+
+		for (auto it = entries.begin(); it != entries.end(); ++it)
+			succeeded.push_back(it->command()->id.group_id);
+
+		for (auto it = groups.begin(); it != groups.end(); ++it) {
+			if (std::find(succeeded.begin(), succeeded.end(), *it) != succeeded.end())
+				result.push_back(*it);
+		}
+
+		groups.swap(result);
+	}
+
 	void finish(const std::vector<write_result_entry> &entries, const error_info &error) {
 		for (auto it = entries.begin(); it != entries.end(); ++it)
 			handler.process(*it);
@@ -952,12 +1242,25 @@ struct chunk_handler : public std::enable_shared_from_this<chunk_handler> {
 	key id;
 	data_pointer content;
 	const uint64_t remote_offset;
-	uint64_t local_offset;
 	uint64_t chunk_size;
+	const uint64_t commit_offset;
+
+	std::mutex mutex;
+	uint64_t next_offset;
+	size_t window;
+	size_t in_flight;
+	bool commit_sent;
+	std::vector<int> groups;
+	error_info chunk_error;
 
 };
 
 async_write_result session::write_data(const key &id, const data_pointer &file, uint64_t remote_offset, uint64_t chunk_size)
+{
+	return write_data(id, file, remote_offset, chunk_size, default_chunk_write_window);
+}
+
+async_write_result session::write_data(const key &id, const data_pointer &file, uint64_t remote_offset, uint64_t chunk_size, size_t chunk_window)
 {
 	if (file.size() <= chunk_size || chunk_size == 0)
 		return write_data(id, file, remote_offset);
@@ -968,8 +1271,8 @@ async_write_result session::write_data(const key &id, const data_pointer &file,
 	async_write_result res(*this);
 	async_write_result::handler handler(res);
 
-	auto ch = std::make_shared<chunk_handler>(handler, *this, id, file, remote_offset, 0, chunk_size);
-	awr.connect(std::bind(&chunk_handler::write_next, ch, std::placeholders::_1, std::placeholders::_2));
+	auto ch = std::make_shared<chunk_handler>(handler, *this, id, file, remote_offset, chunk_size, chunk_window);
+	awr.connect(std::bind(&chunk_handler::start, ch, std::placeholders::_1, std::placeholders::_2));
 
 	return res;
 }
@@ -1335,10 +1638,93 @@ void session::transform(const key &id)
 	const_cast<key&>(id).transform(*this);
 }
 
+static lookup_cache_data::key_type lookup_cache_key(const dnet_id &id)
+{
+	lookup_cache_data::key_type key;
+
+	memcpy(key.data(), id.id, DNET_ID_SIZE);
+	return key;
+}
+
+static void lookup_cache_invalidate(lookup_cache_data *cache, const dnet_id &id)
+{
+	if (!cache->ttl.load(std::memory_order_relaxed))
+		return;
+
+	std::lock_guard<std::mutex> guard(cache->lock);
+	cache->entries.erase(lookup_cache_key(id));
+}
+
+struct lookup_cache_store_functor
+{
+	async_result_handler<lookup_result_entry> handler;
+	std::shared_ptr<lookup_cache_data> cache;
+	lookup_cache_data::key_type key;
+	long ttl;
+
+	void operator() (const std::vector<lookup_result_entry> &results, const error_info &error)
+	{
+		if (!error && !results.empty()) {
+			lookup_cache_data::entry e;
+			e.results = results;
+			e.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+
+			std::lock_guard<std::mutex> guard(cache->lock);
+			if (cache->entries.size() >= lookup_cache_data::max_entries) {
+				const auto now = std::chrono::steady_clock::now();
+				for (auto it = cache->entries.begin(); it != cache->entries.end();) {
+					if (it->second.deadline <= now)
+						it = cache->entries.erase(it);
+					else
+						++it;
+				}
+			}
+			/* when pruning could not make room the reply just is not cached */
+			if (cache->entries.size() < lookup_cache_data::max_entries)
+				cache->entries[key] = e;
+		}
+
+		for (auto it = results.begin(); it != results.end(); ++it)
+			handler.process(*it);
+		handler.complete(error);
+	}
+};
+
 async_lookup_result session::lookup(const key &id)
 {
 	transform(id);
 
+	lookup_cache_data *cache = m_data->lookup_cache.get();
+	const long ttl = cache->ttl.load(std::memory_order_relaxed);
+
+	if (ttl) {
+		std::vector<lookup_result_entry> cached;
+
+		{
+			std::lock_guard<std::mutex> guard(cache->lock);
+			auto it = cache->entries.find(lookup_cache_key(id.id()));
+			if (it != cache->entries.end()) {
+				if (std::chrono::steady_clock::now() < it->second.deadline)
+					cached = it->second.results;
+				else
+					cache->entries.erase(it);
+			}
+		}
+
+		if (!cached.empty()) {
+			cache->hits.fetch_add(1, std::memory_order_relaxed);
+
+			async_lookup_result result(*this);
+			async_result_handler<lookup_result_entry> handler(result);
+			for (auto it = cached.begin(); it != cached.end(); ++it)
+				handler.process(*it);
+			handler.complete(error_info());
+			return result;
+		}
+
+		cache->misses.fetch_add(1, std::memory_order_relaxed);
+	}
+
 	async_lookup_result result(*this);
 	auto cb = createCallback<lookup_callback>(*this, result);
 	cb->kid = id;
@@ -1346,13 +1732,28 @@ async_lookup_result session::lookup(const key &id)
 	mix_states(id, cb->groups);
 
 	startCallback(cb);
-	return result;
+
+	if (!ttl)
+		return result;
+
+	/* replies flow through the storing functor into the result the caller sees */
+	async_lookup_result cached_result(*this);
+	lookup_cache_store_functor functor = {
+		async_result_handler<lookup_result_entry>(cached_result),
+		m_data->lookup_cache,
+		lookup_cache_key(id.id()),
+		ttl
+	};
+	result.connect(functor);
+	return cached_result;
 }
 
 async_remove_result session::remove(const key &id)
 {
 	transform(id);
 
+	lookup_cache_invalidate(m_data->lookup_cache.get(), id.id());
+
 	async_remove_result result(*this);
 	auto cb = createCallback<remove_callback>(*this, result, id.id());
 
@@ -1405,6 +1806,149 @@ async_generic_result session::request_cmd(const transport_control &ctl)
 	return result;
 }
 
+class batch session::batch()
+{
+	return ioremap::elliptics::batch(*this);
+}
+
+batch::batch(const session &sess) : m_sess(sess), m_count(0)
+{
+	memset(&m_first_id, 0, sizeof(m_first_id));
+}
+
+batch::batch(const batch &other)
+	: m_sess(other.m_sess), m_packet(other.m_packet), m_first_id(other.m_first_id), m_count(other.m_count)
+{
+}
+
+batch::~batch()
+{
+}
+
+batch &batch::operator =(const batch &other)
+{
+	m_sess = other.m_sess;
+	m_packet = other.m_packet;
+	m_first_id = other.m_first_id;
+	m_count = other.m_count;
+	return *this;
+}
+
+/*
+ * Serializes one sub-command in wire order: converted dnet_cmd followed by
+ * its data. The first key routes the whole envelope, see batch::send().
+ */
+void batch::append(const key &id, unsigned int cmd,
+		const void *attr, size_t attr_size,
+		const void *payload, size_t payload_size)
+{
+	m_sess.transform(id);
+
+	if (!m_count)
+		m_first_id = id.id();
+
+	struct dnet_cmd sub;
+	memset(&sub, 0, sizeof(sub));
+
+	sub.id = id.id();
+	sub.id.group_id = 0;
+	sub.cmd = cmd;
+	sub.flags = DNET_FLAGS_NEED_ACK | m_sess.get_cflags();
+	sub.size = attr_size + payload_size;
+
+	dnet_convert_cmd(&sub);
+
+	const size_t offset = m_packet.size();
+	m_packet.resize(offset + sizeof(sub) + attr_size + payload_size);
+
+	char *ptr = m_packet.data() + offset;
+	memcpy(ptr, &sub, sizeof(sub));
+	if (attr_size)
+		memcpy(ptr + sizeof(sub), attr, attr_size);
+	if (payload_size)
+		memcpy(ptr + sizeof(sub) + attr_size, payload, payload_size);
+
+	++m_count;
+}
+
+void batch::write(const key &id, const data_pointer &file, uint64_t remote_offset)
+{
+	m_sess.transform(id);
+
+	struct dnet_io_attr io;
+	memset(&io, 0, sizeof(io));
+
+	memcpy(io.id, id.id().id, DNET_ID_SIZE);
+	memcpy(io.parent, id.id().id, DNET_ID_SIZE);
+	io.flags = m_sess.get_ioflags();
+	io.offset = remote_offset;
+	io.size = file.size();
+	io.user_flags = m_sess.get_user_flags();
+
+	m_sess.get_timestamp(&io.timestamp);
+	if (dnet_time_is_empty(&io.timestamp))
+		dnet_current_time(&io.timestamp);
+
+	dnet_convert_io_attr(&io);
+
+	append(id, DNET_CMD_WRITE, &io, sizeof(io), file.data(), file.size());
+}
+
+void batch::lookup(const key &id)
+{
+	append(id, DNET_CMD_LOOKUP, NULL, 0, NULL, 0);
+}
+
+void batch::remove(const key &id)
+{
+	m_sess.transform(id);
+
+	struct dnet_io_attr io;
+	memset(&io, 0, sizeof(io));
+
+	memcpy(io.id, id.id().id, DNET_ID_SIZE);
+	memcpy(io.parent, id.id().id, DNET_ID_SIZE);
+	io.flags = m_sess.get_ioflags();
+
+	dnet_convert_io_attr(&io);
+
+	append(id, DNET_CMD_DEL, &io, sizeof(io), NULL, 0);
+}
+
+size_t batch::size() const
+{
+	return m_count;
+}
+
+async_generic_result batch::send()
+{
+	async_generic_result result(m_sess);
+
+	if (!m_count) {
+		async_result_handler<callback_result_entry> handler(result);
+		handler.complete(create_error(-EINVAL, "batch: no operations were added"));
+		return result;
+	}
+
+	std::vector<int> groups = m_sess.get_groups();
+	if (groups.empty()) {
+		async_result_handler<callback_result_entry> handler(result);
+		handler.complete(create_error(-ENXIO, m_first_id, "batch: session has no groups"));
+		return result;
+	}
+
+	dnet_id id = m_first_id;
+	id.group_id = groups.front();
+
+	transport_control ctl(id, DNET_CMD_BATCH, DNET_FLAGS_NEED_ACK | m_sess.get_cflags());
+	ctl.set_data(m_packet.data(), m_packet.size());
+
+	auto cb = createCallback<single_cmd_callback>(m_sess, result, ctl);
+
+	startCallback(cb);
+	return result;
+}
+
 void session::update_status(const char *saddr, const int port, const int family, struct dnet_node_status *status)
 {
 	int err;
@@ -1423,6 +1967,25 @@ void session::update_status(const char *saddr, const int port, const int family,
 	}
 }
 
+void session::update_status(const char *saddr, const int port, const int family,
+		struct dnet_node_status *status, struct dnet_node_tune *tune)
+{
+	int err;
+	struct dnet_addr addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.addr_len = sizeof(addr.addr);
+	addr.family = family;
+
+	err = dnet_fill_addr(&addr, saddr, port, SOCK_STREAM, IPPROTO_TCP);
+	if (!err)
+		err = dnet_update_status_tune(m_data->session_ptr, &addr, NULL, status, tune);
+
+	if (err < 0) {
+		throw_error(err, "%s:%d: failed to request status/tune update %p", saddr, port, status);
+	}
+}
+
 void session::update_status(const key &id, struct dnet_node_status *status)
 {
 	transform(id);
@@ -1436,6 +1999,15 @@ void session::update_status(const key &id, struct dnet_node_status *status)
 	}
 }
 
+/*
+ * Ranges are fetched from every sub-range in windows of at most
+ * @default_range_window records per round-trip: the server applies the
+ * window through the LIMIT(start, num) fields of dnet_io_attr and entries
+ * are streamed to the handler as they arrive, so client memory stays
+ * bounded by one window regardless of the range size.
+ */
+enum { default_range_window = 1024 };
+
 class read_data_range_callback
 {
 	public:
@@ -1454,6 +2026,14 @@ class read_data_range_callback
 			bool has_any;
 			dnet_io_attr rep;
 
+			uint64_t window;
+			uint64_t sub_start;
+			uint64_t start_sent;
+			uint64_t num_sent;
+			uint64_t received;
+			bool sub_more;
+			bool has_rep;
+
 			async_result_handler<read_result_entry> handler;
 			std::function<void (const read_result_entry &)> me_entry;
 			std::function<void (const error_info &)> me_final;
@@ -1482,6 +2062,18 @@ class read_data_range_callback
 			d->cmd = DNET_CMD_READ_RANGE;
 			d->size = io.size;
 
+			/*
+			 * NODATA requests only count records on the server, there
+			 * are no per-record replies to window.
+			 */
+			d->window = (io.flags & DNET_IO_FLAGS_NODATA) ? 0 : default_range_window;
+			d->sub_start = 0;
+			d->start_sent = 0;
+			d->num_sent = 0;
+			d->received = 0;
+			d->sub_more = false;
+			d->has_rep = false;
+
 			memcpy(d->end.id, d->io.parent, DNET_ID_SIZE);
 
 			dnet_setup_id(&d->id, d->group_id, d->io.id);
@@ -1493,7 +2085,7 @@ class read_data_range_callback
 			struct dnet_node * const node = d->sess.get_node().get_native();
 			d->has_any = false;
 
-			if (d->need_exit) {
+			if (d->need_exit && !d->sub_more) {
 				if (d->result.empty())
 					d->handler.complete(d->last_exception);
 				else
@@ -1536,6 +2128,24 @@ class read_data_range_callback
 
 			d->io.size = d->size;
 
+			/*
+			 * Window the request: the server only sends records
+			 * [start_sent, start_sent + num_sent) of the sub-range,
+			 * the final handler continues from there if the window
+			 * was filled.
+			 */
+			d->start_sent = d->io.start + d->sub_start;
+			d->num_sent = d->io.num;
+			if (d->window && (!d->num_sent || d->num_sent > d->window))
+				d->num_sent = d->window;
+
+			struct dnet_io_attr io = d->io;
+			io.start = d->start_sent;
+			io.num = d->num_sent;
+
+			d->received = 0;
+			d->has_rep = false;
+
 			std::vector<int> groups(1, d->group_id);
 			{
 				session_scope scope(d->sess);
@@ -1543,7 +2153,7 @@ class read_data_range_callback
 				d->sess.set_filter(filters::all_with_ack);
 				d->sess.set_exceptions_policy(session::no_exceptions);
 
-				d->sess.read_data(d->id, groups, d->io, d->cmd).connect(d->me_entry, d->me_final);
+				d->sess.read_data(d->id, groups, io, d->cmd).connect(d->me_entry, d->me_final);
 			}
 		}
 
@@ -1552,10 +2162,13 @@ class read_data_range_callback
 			scope *d = data.get();
 
 			d->has_any = true;
-			if (entry.status() == 0 && entry.data().size() == sizeof(dnet_io_attr))
+			if (entry.status() == 0 && entry.data().size() == sizeof(dnet_io_attr)) {
 				d->rep = *entry.io_attribute();
-			else
+				d->has_rep = true;
+			} else {
+				d->received++;
 				d->handler.process(entry);
+			}
 		}
 
 		void operator() (const error_info &error)
@@ -1564,15 +2177,46 @@ class read_data_range_callback
 
 			if (error) {
 				d->last_exception = error;
-			} else {
+			} else if (d->has_rep) {
 				struct dnet_io_attr *rep = &d->rep;
 
 				dnet_log_raw(d->sess.get_node().get_native(),
-					DNET_LOG_NOTICE, "%s: rep_num: %llu, io_start: %llu, io_num: %llu, io_size: %llu\n",
-					dnet_dump_id(&d->id), (unsigned long long)rep->num, (unsigned long long)d->io.start,
-					(unsigned long long)d->io.num, (unsigned long long)d->io.size);
+					DNET_LOG_NOTICE, "%s: rep_num: %llu, received: %llu, io_start: %llu, io_num: %llu, io_size: %llu\n",
+					dnet_dump_id(&d->id), (unsigned long long)rep->num, (unsigned long long)d->received,
+					(unsigned long long)d->io.start, (unsigned long long)d->io.num,
+					(unsigned long long)d->io.size);
+
+				if (d->received) {
+					/* Skip was consumed inside this sub-range */
+					d->io.start = 0;
+
+					if (d->io.num) {
+						d->io.num -= d->received;
+						if (!d->io.num) {
+							d->handler.complete(error_info());
+							return;
+						}
+					}
+
+					d->last_exception = error_info();
 
-				if (d->io.start < rep->num) {
+					/*
+					 * The window was filled and the server reported
+					 * more matching records - continue this sub-range
+					 * from where the window ended.
+					 */
+					if (d->window && d->received == d->num_sent &&
+							(int64_t)rep->num > (int64_t)d->received) {
+						d->sub_start = d->start_sent + d->received;
+						d->sub_more = true;
+
+						error_info next_error;
+						do_next(&next_error);
+						if (next_error)
+							d->handler.complete(next_error);
+						return;
+					}
+				} else if (d->io.start < rep->num) {
 					rep->num -= d->io.start;
 					d->io.start = 0;
 					d->io.num -= rep->num;
@@ -1588,6 +2232,9 @@ class read_data_range_callback
 				}
 			}
 
+			d->sub_start = 0;
+			d->sub_more = false;
+
 			memcpy(d->id.id, d->next.id, DNET_ID_SIZE);
 
 			error_info next_error;
@@ -1608,6 +2255,8 @@ class remove_data_range_callback : public read_data_range_callback
 			scope *d = data.get();
 
 			d->cmd = DNET_CMD_DEL_RANGE;
+			/* Removal replies are tiny, there is nothing to window */
+			d->window = 0;
 			d->me_entry = *this;
 			d->me_final = *this;
 		}
@@ -1782,20 +2431,26 @@ std::vector<int> session::mix_states()
 
 async_iterator_result session::start_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
 								uint32_t type, uint64_t flags,
-								const dnet_time& time_begin, const dnet_time& time_end)
+								const dnet_time& time_begin, const dnet_time& time_end,
+								uint64_t user_flags_mask, uint64_t user_flags_value,
+								uint64_t iterator_id)
 {
 	auto ranges_size = ranges.size() * sizeof(ranges.front());
 
-	data_pointer data = data_pointer::allocate(sizeof(dnet_iterator_request) + ranges_size);
+	data_pointer data = data_pointer::allocate_pooled(sizeof(dnet_iterator_request) + ranges_size);
 
 	auto req = data.data<dnet_iterator_request>();
 
+	memset(req, 0, sizeof(dnet_iterator_request));
+	req->id = iterator_id;
 	req->action = DNET_ITERATOR_ACTION_START;
 	req->itype = type;
 	req->flags = flags;
 	req->time_begin = time_begin;
 	req->time_end = time_end;
 	req->range_num = ranges.size();
+	req->user_flags_mask = user_flags_mask;
+	req->user_flags_value = user_flags_value;
 
 	memcpy(data.skip<dnet_iterator_request>().data(), &ranges.front(), ranges_size);
 
@@ -1804,7 +2459,7 @@ async_iterator_result session::start_iterator(const key &id, const std::vector<d
 
 async_iterator_result session::pause_iterator(const key &id, uint64_t iterator_id)
 {
-	data_pointer data = data_pointer::allocate(sizeof(dnet_iterator_request));
+	data_pointer data = data_pointer::allocate_pooled(sizeof(dnet_iterator_request));
 	auto request = data.data<dnet_iterator_request>();
 	memset(request, 0, sizeof(dnet_iterator_request));
 	request->action = DNET_ITERATOR_ACTION_PAUSE;
@@ -1815,7 +2470,7 @@ async_iterator_result session::pause_iterator(const key &id, uint64_t iterator_i
 
 async_iterator_result session::continue_iterator(const key &id, uint64_t iterator_id)
 {
-	data_pointer data = data_pointer::allocate(sizeof(dnet_iterator_request));
+	data_pointer data = data_pointer::allocate_pooled(sizeof(dnet_iterator_request));
 	auto request = data.data<dnet_iterator_request>();
 	memset(request, 0, sizeof(dnet_iterator_request));
 	request->action = DNET_ITERATOR_ACTION_CONTINUE;
@@ -1826,7 +2481,7 @@ async_iterator_result session::continue_iterator(const key &id, uint64_t iterato
 
 async_iterator_result session::cancel_iterator(const key &id, uint64_t iterator_id)
 {
-	data_pointer data = data_pointer::allocate(sizeof(dnet_iterator_request));
+	data_pointer data = data_pointer::allocate_pooled(sizeof(dnet_iterator_request));
 	auto request = data.data<dnet_iterator_request>();
 	memset(request, 0, sizeof(dnet_iterator_request));
 	request->action = DNET_ITERATOR_ACTION_CANCEL;
@@ -1835,6 +2490,20 @@ async_iterator_result session::cancel_iterator(const key &id, uint64_t iterator_
 	return iterator(id, data);
 }
 
+async_iterator_result session::set_iterator_limits(const key &id, uint64_t iterator_id,
+								uint64_t bytes_per_sec, uint64_t replies_per_sec)
+{
+	data_pointer data = data_pointer::allocate_pooled(sizeof(dnet_iterator_request));
+	auto request = data.data<dnet_iterator_request>();
+	memset(request, 0, sizeof(dnet_iterator_request));
+	request->action = DNET_ITERATOR_ACTION_LIMIT;
+	request->id = iterator_id;
+	request->limit_bytes_per_sec = bytes_per_sec;
+	request->limit_replies_per_sec = replies_per_sec;
+
+	return iterator(id, data);
+}
+
 async_exec_result session::exec(dnet_id *id, const std::string &event, const data_pointer &data)
 {
 	exec_context context = exec_context_data::create(event, data);
@@ -1862,6 +2531,19 @@ async_exec_result session::exec(struct dnet_id *id, int src_key, const std::stri
 	return request(id, context);
 }
 
+async_exec_result session::exec_affinity(dnet_id *id, const std::string &event, const data_pointer &data)
+{
+	exec_context context = exec_context_data::create(event, data);
+
+	sph *s = context.m_data->sph.data<sph>();
+	s->flags = DNET_SPH_FLAGS_SRC_BLOCK | DNET_SPH_FLAGS_KEY_AFFINITY;
+
+	if (id)
+		memcpy(s->src.id, id->id, sizeof(s->src.id));
+
+	return request(id, context);
+}
+
 async_exec_result session::exec(const exec_context &tmp_context, const std::string &event, const data_pointer &data)
 {
 	exec_context context = exec_context_data::copy(tmp_context, event, data);
@@ -1912,6 +2594,67 @@ void session::reply(const struct sph &sph, const std::string &event, const std::
 	reply(context, data, (sph.flags & DNET_SPH_FLAGS_FINISH) ? exec_context::final : exec_context::progressive).wait();
 }
 
+exec_reply_stream session::reply_stream(const exec_context &context)
+{
+	return exec_reply_stream(*this, context);
+}
+
+exec_reply_stream::exec_reply_stream(const session &sess, const exec_context &context) :
+	m_sess(sess),
+	m_context(context),
+	m_closed(false)
+{
+}
+
+exec_reply_stream::exec_reply_stream(const exec_reply_stream &other) :
+	m_sess(other.m_sess),
+	m_context(other.m_context),
+	m_closed(other.m_closed)
+{
+}
+
+exec_reply_stream::~exec_reply_stream()
+{
+}
+
+exec_reply_stream &exec_reply_stream::operator =(const exec_reply_stream &other)
+{
+	m_sess = other.m_sess;
+	m_context = other.m_context;
+	m_closed = other.m_closed;
+	return *this;
+}
+
+async_reply_result exec_reply_stream::send_chunk(const data_pointer &chunk, exec_context::final_state state)
+{
+	if (m_closed) {
+		async_reply_result result(m_sess);
+		async_result_handler<exec_result_entry> handler(result);
+		handler.complete(create_error(-EINVAL, "reply_stream: stream has already been closed"));
+		return result;
+	}
+
+	if (state == exec_context::final)
+		m_closed = true;
+
+	return m_sess.reply(m_context, chunk, state);
+}
+
+async_reply_result exec_reply_stream::write(const data_pointer &chunk)
+{
+	return send_chunk(chunk, exec_context::progressive);
+}
+
+async_reply_result exec_reply_stream::close(const data_pointer &chunk)
+{
+	return send_chunk(chunk, exec_context::final);
+}
+
+bool exec_reply_stream::closed() const
+{
+	return m_closed;
+}
+
 async_read_result session::bulk_read(const std::vector<struct dnet_io_attr> &ios_vector)
 {
 	if (ios_vector.empty()) {
@@ -2014,22 +2757,117 @@ async_write_result session::bulk_write(const std::vector<dnet_io_attr> &ios, con
 		}
 	}
 
-	std::list<async_write_result> results;
+	/*
+	 * Pack the whole set into DNET_CMD_BATCH envelopes - one per destination
+	 * node in every group - so recovery-style copies of many small objects
+	 * cost one network exchange per node instead of one transaction per key.
+	 * The sub-writes stream their lookup results back within the envelope
+	 * transactions, see dnet_cmd_batch().
+	 */
+	const std::vector<int> session_groups = get_groups();
+
+	if (ios.empty() || session_groups.empty()) {
+		error_info error = create_error(ios.empty() ? -EINVAL : -ENXIO,
+			"BULK_WRITE: %s", ios.empty() ? "no operations were added" : "session has no groups");
+		if (get_exceptions_policy() & throw_at_start) {
+			error.throw_error();
+		} else {
+			async_write_result result(*this);
+			async_result_handler<write_result_entry> handler(result);
+			handler.complete(error);
+			return result;
+		}
+	}
 
-	{
-		session_scope scope(*this);
+	// Sorting makes keys sharing a destination node adjacent
+	std::vector<size_t> order(ios.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&ios] (size_t first, size_t second) {
+		return dnet_id_cmp_str(ios[first].id, ios[second].id) < 0;
+	});
 
-		// Ensure checkers and filters will work only for aggregated request
-		set_filter(filters::all_with_ack);
-		set_checker(checkers::no_check);
-		set_exceptions_policy(no_exceptions);
+	// Bounds peak memory of one envelope on both sides
+	const size_t packet_size_limit = 8 * 1024 * 1024;
+
+	const bool direct = (get_cflags() & DNET_FLAGS_DIRECT) != 0;
+	dnet_node *node = get_node().get_native();
+
+	std::vector<dnet_id> envelope_ids;
+	std::vector<std::string> packets;
+
+	for (size_t group_index = 0; group_index < session_groups.size(); ++group_index) {
+		std::string packet;
+		dnet_id first_id;
+		dnet_net_state *cur = NULL;
+
+		memset(&first_id, 0, sizeof(first_id));
+
+		for (size_t i = 0; i < order.size(); ++i) {
+			const dnet_io_attr &io = ios[order[i]];
+			const data_pointer &file = data[order[i]];
+
+			dnet_id id;
+			memset(&id, 0, sizeof(id));
+			dnet_setup_id(&id, session_groups[group_index], (unsigned char *)io.id);
+
+			dnet_net_state *st = NULL;
+			if (!direct)
+				st = dnet_state_get_first(node, &id);
 
-		for(size_t i = 0; i < ios.size(); ++i) {
-			results.emplace_back(std::move(write_data(ios[i], data[i])));
+			if (!packet.empty() && ((!direct && st != cur) || packet.size() >= packet_size_limit)) {
+				envelope_ids.push_back(first_id);
+				packets.emplace_back(std::move(packet));
+				packet = std::string();
+			}
+			if (packet.empty())
+				first_id = id;
+			if (cur)
+				dnet_state_put(cur);
+			cur = st;
+
+			dnet_cmd sub;
+			memset(&sub, 0, sizeof(sub));
+			sub.id = id;
+			sub.cmd = DNET_CMD_WRITE;
+			sub.flags = DNET_FLAGS_NEED_ACK | get_cflags();
+			sub.size = sizeof(dnet_io_attr) + file.size();
+			dnet_convert_cmd(&sub);
+
+			dnet_io_attr wio = io;
+			wio.size = file.size();
+			wio.flags |= get_ioflags();
+			if (dnet_time_is_empty(&wio.timestamp)) {
+				get_timestamp(&wio.timestamp);
+				if (dnet_time_is_empty(&wio.timestamp))
+					dnet_current_time(&wio.timestamp);
+			}
+			if (wio.user_flags == 0)
+				wio.user_flags = get_user_flags();
+			dnet_convert_io_attr(&wio);
+
+			const size_t offset = packet.size();
+			packet.resize(offset + sizeof(sub) + sizeof(wio) + file.size());
+			char *ptr = &packet[offset];
+			memcpy(ptr, &sub, sizeof(sub));
+			memcpy(ptr + sizeof(sub), &wio, sizeof(wio));
+			if (file.size())
+				memcpy(ptr + sizeof(sub) + sizeof(wio), file.data(), file.size());
+		}
+
+		if (!packet.empty()) {
+			envelope_ids.push_back(first_id);
+			packets.emplace_back(std::move(packet));
 		}
+		if (cur)
+			dnet_state_put(cur);
 	}
 
-	return aggregated(*this, results.begin(), results.end());
+	async_write_result result(*this);
+	auto cb = createCallback<write_batch_callback>(*this, result, envelope_ids, std::move(packets));
+
+	startCallback(cb);
+	return result;
 }
 
 async_write_result session::bulk_write(const std::vector<dnet_io_attr> &ios, const std::vector<std::string> &data)
@@ -2038,6 +2876,96 @@ async_write_result session::bulk_write(const std::vector<dnet_io_attr> &ios, con
 	return bulk_write(ios, pointer_data);
 }
 
+async_remove_result session::bulk_remove(const std::vector<key> &keys)
+{
+	if (keys.empty()) {
+		error_info error = create_error(-EINVAL, "bulk_remove failed: keys list is empty");
+		if (get_exceptions_policy() & throw_at_start) {
+			error.throw_error();
+		} else {
+			async_remove_result result(*this);
+			async_result_handler<remove_result_entry> handler(result);
+			handler.complete(error);
+			return result;
+		}
+	}
+
+	std::vector<struct dnet_io_attr> ios_vector;
+	struct dnet_io_attr io;
+	memset(&io, 0, sizeof(io));
+
+	io.flags = get_ioflags();
+	ios_vector.reserve(keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		transform(keys[i]);
+
+		memcpy(io.id, keys[i].id().id, sizeof(io.id));
+		ios_vector.push_back(io);
+	}
+
+	io_attr_set ios(ios_vector.begin(), ios_vector.end());
+
+	struct dnet_io_control control;
+	memset(&control, 0, sizeof(control));
+
+	control.fd = -1;
+
+	control.cmd = DNET_CMD_BULK_DEL;
+	control.cflags = DNET_FLAGS_NEED_ACK | get_cflags();
+
+	memset(&control.io, 0, sizeof(struct dnet_io_attr));
+	control.io.flags = get_ioflags();
+
+	async_remove_result result(*this);
+	auto cb = createCallback<remove_bulk_callback>(*this, result, ios, control);
+
+	startCallback(cb);
+	return result;
+}
+
+async_remove_result session::bulk_remove(const std::vector<std::string> &keys)
+{
+	return bulk_remove(std::vector<key>(keys.begin(), keys.end()));
+}
+
+session_metrics session::get_metrics() const
+{
+	session_metrics_data *data = m_data->metrics.get();
+	session_metrics snapshot;
+
+	snapshot.in_flight = data->in_flight.load(std::memory_order_relaxed);
+
+	for (size_t i = 0; i < __DNET_CMD_MAX; ++i) {
+		const session_metrics_data::command_counters &counters = data->commands[i];
+
+		uint64_t count = counters.count.load(std::memory_order_relaxed);
+		if (!count)
+			continue;
+
+		command_metrics &metrics = snapshot.commands[i];
+		metrics.count = count;
+		metrics.errors = counters.errors.load(std::memory_order_relaxed);
+		for (size_t j = 0; j < command_metrics::latency_buckets; ++j)
+			metrics.latency[j] = counters.latency[j].load(std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(data->node_errors_lock);
+		snapshot.node_errors = data->node_errors;
+	}
+
+	snapshot.lookup_cache_hits = m_data->lookup_cache->hits.load(std::memory_order_relaxed);
+	snapshot.lookup_cache_misses = m_data->lookup_cache->misses.load(std::memory_order_relaxed);
+
+	return snapshot;
+}
+
+std::shared_ptr<session_metrics_data> session::get_metrics_data() const
+{
+	return m_data->metrics;
+}
+
 node &session::get_node()
 {
 	return m_data->node_guard;
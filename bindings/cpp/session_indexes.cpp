@@ -90,6 +90,8 @@ static async_set_indexes_result session_set_indexes(session &orig_sess, const ke
 
 		request.flags = flags & ~DNET_INDEXES_FLAGS_NOUPDATE;
 		request.id = request_id.id();
+		// the server shards the tables with the session's count
+		request.shard_count = orig_sess.get_indexes_shard_count();
 
 		request.entries_count = indexes.size();
 
@@ -140,7 +142,7 @@ static async_set_indexes_result session_set_indexes(session &orig_sess, const ke
 		control.set_command(DNET_CMD_INDEXES_INTERNAL);
 		control.set_cflags(DNET_FLAGS_NEED_ACK);
 
-		data_pointer data = data_pointer::allocate(sizeof(dnet_indexes_request) +
+		data_pointer data = data_pointer::allocate_pooled(sizeof(dnet_indexes_request) +
 				sizeof(dnet_indexes_request_entry) + max_data_size);
 		memset(data.data(), 0, data.size());
 
@@ -156,12 +158,16 @@ static async_set_indexes_result session_set_indexes(session &orig_sess, const ke
 		dnet_id id;
 		memset(&id, 0, sizeof(id));
 
-		const int shard_id = dnet_indexes_get_shard_id(node, &key(indexes_id).raw_id());
+		const int shard_count = orig_sess.get_indexes_shard_count();
+		const int shard_id = dnet_indexes_get_shard_id_raw(&key(indexes_id).raw_id(), shard_count);
+
+		request->shard_id = shard_id;
+		request->shard_count = shard_count;
 
 		for (size_t i = 0; i < indexes.size(); ++i) {
 			const index_entry &index = indexes[i];
 
-			dnet_indexes_transform_index_id(node, &index.index, &tmp_entry_id, shard_id);
+			dnet_indexes_transform_index_id_raw(node, &index.index, &tmp_entry_id, shard_id, shard_count);
 			memcpy(id.id, tmp_entry_id.id, DNET_ID_SIZE);
 
 			entry->size = index.data.size();
@@ -285,15 +291,21 @@ typedef std::map<dnet_raw_id, dnet_raw_id, dnet_raw_id_less_than<> > dnet_raw_id
 struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_functor>
 {
 	find_indexes_functor(session &original_sess, const std::vector<dnet_raw_id> &indexes, bool intersect,
+		uint64_t result_offset, uint64_t result_limit, uint64_t batch_size,
 		const async_result_handler<find_indexes_result_entry> &handler) :
-	sess(original_sess.clone()), log(sess.get_node().get_log()), indexes(indexes), handler(handler) {
-		data = data_pointer::allocate(sizeof(dnet_indexes_request)
+	sess(original_sess.clone()), log(sess.get_node().get_log()), indexes(indexes),
+	batch_size(batch_size), handler(handler) {
+		data = data_pointer::allocate_pooled(sizeof(dnet_indexes_request)
 			+ indexes.size() * sizeof(dnet_indexes_request_entry));
 
 		memset(data.data(), 0, data.size());
 
 		dnet_indexes_request *request = data.data<dnet_indexes_request>();
 		request->entries_count = indexes.size();
+		// in batched mode every shard keeps its own cursor, the offset is
+		// filled in per request by send_request()
+		request->result_offset = result_offset;
+		request->result_limit = batch_size ? batch_size : result_limit;
 		if (intersect)
 			request->flags |= DNET_INDEXES_FLAGS_INTERSECT;
 		else
@@ -313,12 +325,16 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 
 	void run() {
 		dnet_node *node = sess.get_node().get_native();
-		int shard_count = dnet_node_get_indexes_shard_count(node);
+		int shard_count = sess.get_indexes_shard_count();
+
+		dnet_indexes_request *request = data.data<dnet_indexes_request>();
+		request->shard_count = shard_count;
 
 		std::vector<int> groups(1, 0);
 		sess.set_groups(groups);
 
 		unprocessed_count = shard_count;
+		shard_offsets.assign(shard_count, 0);
 
 		id_precalc.resize(shard_count * indexes.size());
 
@@ -326,7 +342,7 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 			for (size_t j = 0; j < indexes.size(); ++j) {
 				dnet_raw_id &id = id_precalc[shard_id * indexes.size() + j];
 
-				dnet_indexes_transform_index_id(node, &indexes[j], &id, shard_id);
+				dnet_indexes_transform_index_id_raw(node, &indexes[j], &id, shard_id, shard_count);
 
 				convert_map[id] = indexes[j];
 			}
@@ -348,9 +364,13 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 		}
 	}
 
+	// called with the mutex held - the request buffer is shared between shards
 	async_generic_result send_request(size_t group_index, int shard_id) {
 		dnet_indexes_request *request = data.data<dnet_indexes_request>();
 
+		if (batch_size)
+			request->result_offset = shard_offsets[shard_id];
+
 		dnet_id indexes_id;
 		memset(&indexes_id, 0, sizeof(indexes_id));
 
@@ -413,6 +433,7 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 			}
 		} else {
 			sync_find_indexes_result tmp;
+			uint64_t page_entries = 0;
 
 			for (auto it = result.begin(); it != result.end(); ++it) {
 				data_pointer data = it->data();
@@ -420,6 +441,8 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 				find_result_unpack(sess.get_node().get_native(), &it->command()->id,
 						data, &tmp, "find_indexes_functor::on_result");
 
+				page_entries += tmp.size();
+
 				for (auto jt = tmp.begin(); jt != tmp.end(); ++jt) {
 					find_indexes_result_entry &entry = *jt;
 
@@ -434,6 +457,21 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 					handler.process(entry);
 				}
 			}
+
+			// a full page means the shard may have more matches: advance
+			// this shard's cursor and fetch the next batch
+			if (batch_size && page_entries >= batch_size) {
+				std::unique_ptr<async_generic_result> result_ptr;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+
+					shard_offsets[shard_id] += page_entries;
+					result_ptr.reset(new async_generic_result(
+							std::move(send_request(group_index, shard_id))));
+				}
+				connect_result(*result_ptr, group_index, shard_id);
+				return;
+			}
 		}
 
 		if (0 == --unprocessed_count) {
@@ -447,6 +485,8 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 	transport_control control;
 	data_pointer data;
 	async_result_handler<find_indexes_result_entry> handler;
+	uint64_t batch_size;
+	std::vector<uint64_t> shard_offsets;
 	dnet_raw_id_map convert_map;
 	std::atomic_int unprocessed_count;
 	std::vector<int> known_groups;
@@ -456,7 +496,8 @@ struct find_indexes_functor : public std::enable_shared_from_this<find_indexes_f
 };
 
 static async_find_indexes_result do_find_indexes(session &sess,
-		const std::vector<dnet_raw_id> &indexes, bool intersect)
+		const std::vector<dnet_raw_id> &indexes, bool intersect,
+		uint64_t result_offset = 0, uint64_t result_limit = 0, uint64_t batch_size = 0)
 {
 	async_find_indexes_result result(sess);
 	async_result_handler<find_indexes_result_entry> handler(result);
@@ -466,7 +507,8 @@ static async_find_indexes_result do_find_indexes(session &sess,
 		return result;
 	}
 
-	std::make_shared<find_indexes_functor>(sess, indexes, intersect, handler)->run();
+	std::make_shared<find_indexes_functor>(sess, indexes, intersect,
+			result_offset, result_limit, batch_size, handler)->run();
 
 	return result;
 }
@@ -493,6 +535,18 @@ async_find_indexes_result session::find_all_indexes(const std::vector<std::strin
 	return find_all_indexes(convert(*this, indexes));
 }
 
+async_find_indexes_result session::find_all_indexes(const std::vector<dnet_raw_id> &indexes,
+		uint64_t offset, uint64_t limit)
+{
+	return do_find_indexes(*this, indexes, true, offset, limit);
+}
+
+async_find_indexes_result session::find_all_indexes(const std::vector<std::string> &indexes,
+		uint64_t offset, uint64_t limit)
+{
+	return find_all_indexes(convert(*this, indexes), offset, limit);
+}
+
 async_find_indexes_result session::find_any_indexes(const std::vector<dnet_raw_id> &indexes)
 {
 	return do_find_indexes(*this, indexes, false);
@@ -503,6 +557,30 @@ async_find_indexes_result session::find_any_indexes(const std::vector<std::strin
 	return find_any_indexes(convert(*this, indexes));
 }
 
+async_find_indexes_result session::find_all_indexes_stream(const std::vector<dnet_raw_id> &indexes,
+		uint64_t batch_size)
+{
+	return do_find_indexes(*this, indexes, true, 0, 0, batch_size);
+}
+
+async_find_indexes_result session::find_all_indexes_stream(const std::vector<std::string> &indexes,
+		uint64_t batch_size)
+{
+	return find_all_indexes_stream(convert(*this, indexes), batch_size);
+}
+
+async_find_indexes_result session::find_any_indexes_stream(const std::vector<dnet_raw_id> &indexes,
+		uint64_t batch_size)
+{
+	return do_find_indexes(*this, indexes, false, 0, 0, batch_size);
+}
+
+async_find_indexes_result session::find_any_indexes_stream(const std::vector<std::string> &indexes,
+		uint64_t batch_size)
+{
+	return find_any_indexes_stream(convert(*this, indexes), batch_size);
+}
+
 struct check_indexes_handler
 {
 	session sess;
@@ -14,6 +14,8 @@ namespace ioremap { namespace elliptics {
 
 struct dnet_indexes
 {
+	typedef index_entry entry_type;
+
 	int shard_id;
 	int shard_count;
 	std::vector<index_entry> indexes;
@@ -43,6 +45,8 @@ struct raw_index_entry
 
 struct raw_dnet_indexes
 {
+	typedef raw_index_entry entry_type;
+
 	int shard_id;
 	int shard_count;
 	std::vector<raw_index_entry> indexes;
@@ -72,12 +76,252 @@ struct update_index_request
 	bool remove;
 };
 
+/*
+ * Binary sorted on-disk index table, version 2.
+ *
+ * Layout: header, entries_count fixed-stride entries sorted by index id,
+ * data heap of heap_size bytes, optional append log. Lookups binary-search
+ * the entry array without deserializing anything and single-entry updates
+ * are block copies instead of a full msgpack decode/encode cycle.
+ * Multi-byte fields are stored big-endian, same as the magic. Legacy
+ * msgpack tables remain readable and are rewritten in this format by the
+ * first update touching them.
+ *
+ * In delta-log mode mutations do not rewrite the table at all: a small
+ * dnet_index_delta_record (plus its entry data) is appended past the heap
+ * through the backend append path. Readers replay the log on top of the
+ * base entries in append order, updates fold the log back into the base
+ * once it grows too long.
+ */
+#define DNET_INDEX_TABLE_BINARY_MAGIC 0x6A1B277CD3F49E52ull
+#define DNET_INDEX_TABLE_BINARY_VERSION 2
+
+#define DNET_INDEX_DELTA_MAGIC 0x9F6BD41A0E3C7285ull
+
+/* matches update_index_action */
+#define DNET_INDEX_DELTA_INSERT 1
+#define DNET_INDEX_DELTA_REMOVE 2
+
+struct dnet_index_table_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t shard_id;
+	uint32_t shard_count;
+	uint32_t entries_count;
+	uint32_t heap_size;		/* delta records follow the heap */
+} __attribute__ ((packed));
+
+struct dnet_index_table_entry
+{
+	dnet_raw_id index;
+	uint32_t data_offset;		/* relative to the data heap start */
+	uint32_t data_size;
+} __attribute__ ((packed));
+
+struct dnet_index_delta_record
+{
+	uint64_t magic;
+	uint32_t action;
+	uint32_t data_size;		/* entry data follows the record */
+	dnet_raw_id id;
+} __attribute__ ((packed));
+
+static inline void index_table_assign_entry(index_entry &entry, const dnet_raw_id &index, const void *data, uint32_t size)
+{
+	entry.index = index;
+	if (size)
+		entry.data = data_pointer::copy(data, size);
+	else
+		entry.data = data_pointer();
+}
+
+static inline void index_table_assign_entry(raw_index_entry &entry, const dnet_raw_id &index, const void *data, uint32_t size)
+{
+	entry.index = index;
+	entry.data.data = size ? data : NULL;
+	entry.data.size = size;
+}
+
+static inline const void *index_table_entry_data(const index_entry &entry)
+{
+	return entry.data.data();
+}
+
+static inline uint32_t index_table_entry_size(const index_entry &entry)
+{
+	return entry.data.size();
+}
+
+static inline const void *index_table_entry_data(const raw_index_entry &entry)
+{
+	return entry.data.data;
+}
+
+static inline uint32_t index_table_entry_size(const raw_index_entry &entry)
+{
+	return entry.data.size;
+}
+
+/*
+ * Replays an append log of dnet_index_delta_record entries on top of the
+ * already decoded base table in @data, keeping it sorted. Entry data
+ * stays referenced inside @file for raw entry types, throws on a
+ * corrupted record.
+ */
+template <typename T>
+static inline void indexes_apply_delta(const data_pointer &file, size_t offset, T *data)
+{
+	while (offset < file.size()) {
+		if (file.size() - offset < sizeof(dnet_index_delta_record))
+			throw std::runtime_error("truncated index delta record");
+
+		const dnet_index_delta_record *record =
+			reinterpret_cast<const dnet_index_delta_record *>(file.data<char>() + offset);
+		if (record->magic != dnet_bswap64(DNET_INDEX_DELTA_MAGIC))
+			throw std::runtime_error("invalid index delta record magic");
+
+		const uint32_t action = dnet_bswap32(record->action);
+		const uint32_t size = dnet_bswap32(record->data_size);
+
+		offset += sizeof(dnet_index_delta_record);
+		if (file.size() - offset < size)
+			throw std::runtime_error("truncated index delta record data");
+
+		const char *record_data = file.data<char>() + offset;
+		offset += size;
+
+		size_t low = 0, high = data->indexes.size();
+		while (low < high) {
+			const size_t mid = low + (high - low) / 2;
+
+			if (memcmp(data->indexes[mid].index.id, record->id.id, DNET_ID_SIZE) < 0)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		const bool found = (low < data->indexes.size())
+			&& !memcmp(data->indexes[low].index.id, record->id.id, DNET_ID_SIZE);
+
+		if (action == DNET_INDEX_DELTA_INSERT) {
+			if (!found)
+				data->indexes.insert(data->indexes.begin() + low, typename T::entry_type());
+			index_table_assign_entry(data->indexes[low], record->id, record_data, size);
+		} else if (action == DNET_INDEX_DELTA_REMOVE) {
+			if (found)
+				data->indexes.erase(data->indexes.begin() + low);
+		} else {
+			throw std::runtime_error("invalid index delta record action");
+		}
+	}
+}
+
+/*
+ * Decodes a binary index table into @data, replaying the append log when
+ * one follows the heap.
+ * Returns false when @file is not in the binary format so the caller can
+ * fall back to msgpack, throws on a corrupted table. Raw entry types
+ * reference the data heap inside @file instead of copying it, so @file
+ * has to outlive @data.
+ */
+template <typename T>
+static inline bool indexes_unpack_binary(const data_pointer &file, T *data)
+{
+	if (file.size() < sizeof(dnet_index_table_header))
+		return false;
+
+	const dnet_index_table_header *header = file.data<dnet_index_table_header>();
+	if (header->magic != dnet_bswap64(DNET_INDEX_TABLE_BINARY_MAGIC))
+		return false;
+
+	if (dnet_bswap32(header->version) != DNET_INDEX_TABLE_BINARY_VERSION)
+		throw std::runtime_error("unknown binary index table version");
+
+	const size_t count = dnet_bswap32(header->entries_count);
+	const size_t heap_size = dnet_bswap32(header->heap_size);
+	const size_t heap_offset = sizeof(dnet_index_table_header) + count * sizeof(dnet_index_table_entry);
+	if (heap_offset + heap_size > file.size())
+		throw std::runtime_error("truncated binary index table");
+
+	const dnet_index_table_entry *entries =
+		reinterpret_cast<const dnet_index_table_entry *>(file.data<char>() + sizeof(dnet_index_table_header));
+	const char *heap = file.data<char>() + heap_offset;
+
+	data->shard_id = dnet_bswap32(header->shard_id);
+	data->shard_count = dnet_bswap32(header->shard_count);
+	data->indexes.clear();
+	data->indexes.resize(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		const size_t offset = dnet_bswap32(entries[i].data_offset);
+		const uint32_t size = dnet_bswap32(entries[i].data_size);
+
+		if (offset + size > heap_size)
+			throw std::runtime_error("binary index table entry out of bounds");
+
+		index_table_assign_entry(data->indexes[i], entries[i].index, heap + offset, size);
+	}
+
+	if (heap_offset + heap_size < file.size())
+		indexes_apply_delta(file, heap_offset + heap_size, data);
+
+	return true;
+}
+
+/*
+ * Serializes sorted @data into a fresh binary index table with a compact heap.
+ */
+template <typename T>
+static inline data_pointer indexes_pack_binary(const T &data)
+{
+	size_t heap_size = 0;
+	for (size_t i = 0; i < data.indexes.size(); ++i)
+		heap_size += index_table_entry_size(data.indexes[i]);
+
+	data_buffer buffer(sizeof(dnet_index_table_header)
+			+ data.indexes.size() * sizeof(dnet_index_table_entry) + heap_size);
+
+	dnet_index_table_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = dnet_bswap64(DNET_INDEX_TABLE_BINARY_MAGIC);
+	header.version = dnet_bswap32(DNET_INDEX_TABLE_BINARY_VERSION);
+	header.shard_id = dnet_bswap32(data.shard_id);
+	header.shard_count = dnet_bswap32(data.shard_count);
+	header.entries_count = dnet_bswap32(static_cast<uint32_t>(data.indexes.size()));
+	header.heap_size = dnet_bswap32(static_cast<uint32_t>(heap_size));
+	buffer.write(header);
+
+	uint32_t offset = 0;
+	for (size_t i = 0; i < data.indexes.size(); ++i) {
+		dnet_index_table_entry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.index = data.indexes[i].index;
+		entry.data_offset = dnet_bswap32(offset);
+		entry.data_size = dnet_bswap32(index_table_entry_size(data.indexes[i]));
+		buffer.write(entry);
+
+		offset += index_table_entry_size(data.indexes[i]);
+	}
+
+	for (size_t i = 0; i < data.indexes.size(); ++i) {
+		if (index_table_entry_size(data.indexes[i]))
+			buffer.write(reinterpret_cast<const char *>(index_table_entry_data(data.indexes[i])),
+					index_table_entry_size(data.indexes[i]));
+	}
+
+	return std::move(buffer);
+}
+
 template <typename T>
 static inline void indexes_unpack(dnet_node *node, dnet_id *id, const data_pointer &file, T *data, const char *scope)
 {
 	static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_MAGIC);
 
 	try {
+		if (indexes_unpack_binary(file, data))
+			return;
+
 		if (file.size() < DNET_INDEX_TABLE_MAGIC_SIZE
 			|| memcmp(file.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
 			throw std::runtime_error("Invalid magic");
@@ -26,12 +26,21 @@ template <typename T>
 struct def_async_result<T>
 {
 	static void init() {
+		bp::class_<python_async_result_iterator<T>>("AsyncResultIterator", bp::no_init)
+			.def("__iter__", &python_async_result_iterator<T>::iter)
+			.def("__next__", &python_async_result_iterator<T>::next)
+			.def("next", &python_async_result_iterator<T>::next)
+		;
+
 		bp::class_<python_async_result<T>>("AsyncResult", bp::no_init)
-			.def("__iter__", bp::iterator<python_async_result<T>>())
+			.def("__iter__", &python_async_result<T>::iter)
 			.def("get", &python_async_result<T>::get)
 			.def("wait", &python_async_result<T>::wait)
 			.def("successful", &python_async_result<T>::successful)
 			.def("ready", &python_async_result<T>::ready)
+			.def("set_notify_fd", &python_async_result<T>::set_notify_fd,
+			     (bp::arg("fd")))
+			.def("drain", &python_async_result<T>::drain)
 			.def("elapsed_time", &python_async_result<T>::elapsed_time)
 			.def("connect", &python_async_result<T>::connect,
 			     (bp::arg("result_handler"), bp::arg("final_handler")))
@@ -64,6 +64,46 @@ struct callback_handlers {
 	PyObject *final_handler;
 };
 
+/*
+ * Every step of async_result iteration may block waiting for the next
+ * entry to arrive from the network, so the GIL is released around each
+ * step instead of being held across the whole wait.
+ */
+template <typename T>
+struct python_async_result_iterator
+{
+	typedef typename async_result<T>::iterator iterator;
+
+	iterator cur;
+	iterator end;
+
+	python_async_result_iterator iter() {
+		return *this;
+	}
+
+	T next() {
+		bool at_end;
+		T result;
+
+		{
+			py_allow_threads_scoped pythr;
+
+			at_end = (cur == end);
+			if (!at_end) {
+				result = *cur;
+				++cur;
+			}
+		}
+
+		if (at_end) {
+			PyErr_SetString(PyExc_StopIteration, "no more results");
+			bp::throw_error_already_set();
+		}
+
+		return result;
+	}
+};
+
 template <typename T>
 struct python_async_result
 {
@@ -81,9 +121,22 @@ struct python_async_result
 		return scope->end();
 	}
 
-	bp::list get() {
+	python_async_result_iterator<T> iter() {
 		py_allow_threads_scoped pythr;
-		return convert_to_list(scope->get());
+		python_async_result_iterator<T> ret = { scope->begin(), scope->end() };
+		return ret;
+	}
+
+	bp::list get() {
+		std::vector<T> results;
+
+		{
+			py_allow_threads_scoped pythr;
+			results = scope->get();
+		}
+
+		/* back under the GIL - python objects may be created again */
+		return convert_to_list(results);
 	}
 
 	void wait() {
@@ -91,6 +144,19 @@ struct python_async_result
 		scope->wait();
 	}
 
+	/*
+	 * Event-loop integration: register an eventfd or non-blocking
+	 * pipe with set_notify_fd(), add it to the loop and call drain()
+	 * whenever it becomes readable - no thread blocks in wait().
+	 */
+	void set_notify_fd(int fd) {
+		scope->set_notify_fd(fd);
+	}
+
+	bp::list drain() {
+		return convert_to_list(scope->drain());
+	}
+
 	bool successful() {
 		if (!scope->ready()) {
 			PyErr_SetString(PyExc_ValueError, "Async write operation hasn't yet been completed");
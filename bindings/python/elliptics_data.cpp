@@ -31,23 +31,96 @@ data_wrapper::data_wrapper(const data_pointer &pointer) {
 	m_pointer = pointer;
 }
 
+/*
+ * Keeps a borrowed buffer-protocol view (and with it the exporting Python
+ * object) alive for as long as any data_pointer references it. Write
+ * completion runs on an IO thread without the GIL, so the release has to
+ * take it explicitly.
+ */
+struct py_buffer_holder {
+	Py_buffer view;
+
+	py_buffer_holder() {
+		memset(&view, 0, sizeof(view));
+	}
+
+	~py_buffer_holder() {
+		PyGILState_STATE gstate = PyGILState_Ensure();
+		PyBuffer_Release(&view);
+		PyGILState_Release(gstate);
+	}
+};
+
 data_wrapper data_wrapper::convert(const bp::api::object &obj) {
-	bp::extract<std::string> get_string(obj);
 	bp::extract<data_pointer> get_pointer(obj);
 	bp::extract<data_wrapper> get_wrapper(obj);
 
-	if(get_string.check())
-		return data_wrapper(get_string());
-
 	if(get_pointer.check())
 		return data_wrapper(get_pointer());
 
-	return get_wrapper();
+	if(get_wrapper.check())
+		return get_wrapper();
+
+	/*
+	 * Anything exporting the buffer protocol (bytes, bytearray, memoryview,
+	 * numpy arrays) is passed on as a borrowed zero-copy view: the payload
+	 * is not copied into the wrapper, the view pins the exporting object
+	 * until the last transaction referencing it completes. The caller must
+	 * not mutate the buffer while a write is in flight - the same contract
+	 * as os.write() with a memoryview.
+	 */
+	if (PyObject_CheckBuffer(obj.ptr())) {
+		auto holder = std::make_shared<py_buffer_holder>();
+
+		if (PyObject_GetBuffer(obj.ptr(), &holder->view, PyBUF_SIMPLE) == 0) {
+			return data_wrapper(data_pointer(
+					std::shared_ptr<void>(holder, holder->view.buf),
+					holder->view.len));
+		}
+
+		PyErr_Clear();
+	}
+
+	bp::extract<std::string> get_string(obj);
+	return data_wrapper(get_string());
+}
+
+
+/*
+ * Exposes the buffer protocol over the wrapped data_pointer, so
+ * memoryview(data) and everything else accepting a buffer (file.write(),
+ * socket.send(), numpy.frombuffer() and friends) reads the received bytes
+ * in place instead of copying them through str(). The view references the
+ * Data object which in turn keeps the underlying allocation alive.
+ */
+static int data_wrapper_getbuffer(PyObject *obj, Py_buffer *view, int flags)
+{
+	bp::extract<data_wrapper &> wrapper(obj);
+
+	if (!wrapper.check()) {
+		PyErr_SetString(PyExc_BufferError, "invalid elliptics.Data object");
+		view->obj = NULL;
+		return -1;
+	}
+
+	data_pointer pointer = wrapper().pointer();
+	return PyBuffer_FillInfo(view, obj, pointer.data(), pointer.size(), 1, flags);
 }
 
+static PyBufferProcs data_wrapper_as_buffer = {
+#if PY_MAJOR_VERSION < 3
+	NULL, /* bf_getreadbuffer */
+	NULL, /* bf_getwritebuffer */
+	NULL, /* bf_getsegcount */
+	NULL, /* bf_getcharbuffer */
+#endif
+	data_wrapper_getbuffer,
+	NULL, /* bf_releasebuffer */
+};
 
 void init_elliptcs_data() {
-	bp::class_<data_wrapper>("Data", bp::init<std::string>())
+	bp::class_<data_wrapper> data_class("Data", bp::init<std::string>());
+	data_class
 		.def(bp::init<data_pointer>())
 		.def(bp::init<data_wrapper>())
 		.def("__str__", &data_wrapper::to_string)
@@ -55,6 +128,16 @@ void init_elliptcs_data() {
 		.def("size", &data_wrapper::size)
 		.def("__len__", &data_wrapper::size)
 	;
+
+	/*
+	 * boost::python has no hook for the buffer protocol,
+	 * patch the type object directly.
+	 */
+	PyTypeObject *data_type = reinterpret_cast<PyTypeObject *>(data_class.ptr());
+	data_type->tp_as_buffer = &data_wrapper_as_buffer;
+#if PY_MAJOR_VERSION < 3
+	data_type->tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
 }
 
 } } } // namespace ioremap::elliptics::python
\ No newline at end of file
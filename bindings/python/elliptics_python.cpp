@@ -48,6 +48,7 @@ enum elliptics_iterator_flags {
 	iflag_data = DNET_IFLAGS_DATA,
 	iflag_key_range = DNET_IFLAGS_KEY_RANGE,
 	iflag_ts_range = DNET_IFLAGS_TS_RANGE,
+	iflag_resume = DNET_IFLAGS_RESUME,
 };
 
 enum elliptics_cflags {
@@ -251,8 +252,21 @@ void iterator_container_diff(iterator_result_container &left,
 	left.diff(right, diff);
 }
 
-void iterator_container_merge(const bp::list& /*results*/, bp::dict& /*splitted_dict*/)
-{}
+void iterator_container_merge(const bp::list &results, bp::list splitted)
+{
+	std::vector<iterator_result_container> inputs, outputs;
+
+	for (bp::stl_input_iterator<iterator_result_container> it(results), end; it != end; ++it)
+		inputs.push_back(*it);
+	for (bp::stl_input_iterator<iterator_result_container> it(splitted), end; it != end; ++it)
+		outputs.push_back(*it);
+
+	iterator_result_container::merge(inputs, outputs);
+
+	/* containers are extracted by value - write the updated ones back */
+	for (size_t i = 0; i < outputs.size(); ++i)
+		splitted[i] = outputs[i];
+}
 
 elliptics_id index_entry_get_index(index_entry &result)
 {
@@ -358,6 +372,7 @@ BOOST_PYTHON_MODULE(core)
 		.value("data", iflag_data)
 		.value("key_range", iflag_key_range)
 		.value("ts_range", iflag_ts_range)
+		.value("resume", iflag_resume)
 	;
 
 	bp::enum_<elliptics_iterator_types>("iterator_types")
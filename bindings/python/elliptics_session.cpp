@@ -126,6 +126,53 @@ public:
 		}
 	}
 
+	/*
+	 * Transforms a list of byte strings in one binding crossing: the GIL
+	 * is released while dnet_transform_raw_batch() hashes all keys, going
+	 * through the multi-buffer transform path when one is available.
+	 */
+	bp::list transform_all(const bp::api::object &keys) {
+		std::vector<std::string> strings;
+
+		for (bp::stl_input_iterator<std::string> it(keys), end; it != end; ++it)
+			strings.push_back(*it);
+
+		std::vector<dnet_id> ids(strings.size());
+		const size_t num = strings.size();
+
+		if (num) {
+			std::vector<const void *> srcs(num);
+			std::vector<uint64_t> sizes(num);
+			std::vector<char *> csums(num);
+
+			for (size_t i = 0; i < num; ++i) {
+				srcs[i] = strings[i].data();
+				sizes[i] = strings[i].size();
+
+				memset(&ids[i], 0, sizeof(dnet_id));
+				csums[i] = reinterpret_cast<char *>(ids[i].id);
+			}
+
+			py_allow_threads_scoped pythr;
+
+			int err = dnet_transform_raw_batch(session::get_native(), srcs.data(), sizes.data(),
+					csums.data(), DNET_ID_SIZE, num);
+
+			pythr.disallow();
+
+			if (err)
+				throw_error(err, "transform_all: failed to transform %zd keys", num);
+		}
+
+		bp::list result;
+		for (size_t i = 0; i < num; ++i) {
+			ids[i].trace_id = session::get_trace_id();
+			result.append(elliptics_id(ids[i]));
+		}
+
+		return result;
+	}
+
 	void set_groups(const bp::api::object &groups) {
 		session::set_groups(convert_to_vector<int>(groups));
 	}
@@ -256,7 +303,9 @@ public:
 	}
 
 	elliptics_status update_status(const bp::api::object &id, elliptics_status &status) {
-		session::update_status(elliptics_id::convert(id), &status);
+		auto eid = elliptics_id::convert(id);
+		py_allow_threads_scoped pythr;
+		session::update_status(eid, &status);
 		return status;
 	}
 
@@ -294,10 +343,12 @@ public:
 	python_iterator_result start_iterator(const bp::api::object &id, const bp::api::object &ranges,
 	                                      uint32_t type, uint64_t flags,
 	                                      const elliptics_time& time_begin = elliptics_time(0, 0),
-	                                      const elliptics_time& time_end = elliptics_time(-1, -1)) {
+	                                      const elliptics_time& time_end = elliptics_time(-1, -1),
+	                                      uint64_t iterator_id = 0) {
 		std::vector<dnet_iterator_range> std_ranges = convert_to_vector<dnet_iterator_range>(ranges);
 
-		return create_result(std::move(session::start_iterator(elliptics_id::convert(id), std_ranges, type, flags, time_begin.m_time, time_end.m_time)));
+		return create_result(std::move(session::start_iterator(elliptics_id::convert(id), std_ranges, type, flags,
+				time_begin.m_time, time_end.m_time, 0, 0, iterator_id)));
 	}
 
 	python_iterator_result pause_iterator(const bp::api::object &id, const uint64_t &iterator_id) {
@@ -512,6 +563,7 @@ void init_elliptcs_session() {
 
 	bp::class_<elliptics_session, boost::noncopyable>("Session", bp::init<node &>())
 		.def("transform", &elliptics_session::transform, (bp::args("data")))
+		.def("transform_all", &elliptics_session::transform_all, (bp::args("keys")))
 
 		.add_property("groups",
 		              &elliptics_session::get_groups,
@@ -627,7 +679,11 @@ void init_elliptcs_session() {
 		.def("stat_log", &elliptics_session::stat_log_id,
 		     (bp::arg("key")))
 
-		.def("start_iterator", &elliptics_session::start_iterator)
+		.def("start_iterator", &elliptics_session::start_iterator,
+		     (bp::arg("id"), bp::arg("ranges"), bp::arg("type"), bp::arg("flags"),
+		      bp::arg("time_begin") = elliptics_time(0, 0),
+		      bp::arg("time_end") = elliptics_time(-1, -1),
+		      bp::arg("iterator_id") = 0))
 		.def("pause_iterator", &elliptics_session::pause_iterator)
 		.def("continue_iterator", &elliptics_session::continue_iterator)
 		.def("cancel_iterator", &elliptics_session::cancel_iterator)
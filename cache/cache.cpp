@@ -14,17 +14,30 @@
  */
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdexcept>
 #include <deque>
 #include <vector>
 #include <deque>
+#include <map>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <thread>
 #include <cstdio>
 
+#include <sys/mman.h>
+
 #include <boost/unordered_map.hpp>
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/set.hpp>
 
+#ifdef HAVE_LZ4_SUPPORT
+#include <lz4.h>
+#endif
+
 #include "../library/elliptics.h"
 #include "../indexes/local_session.h"
 
@@ -33,23 +46,366 @@
 
 namespace ioremap { namespace cache {
 
+class raw_data_t;
+
+/*
+ * Scatter-gather read reply holds a reference to cached data instead of
+ * copying it into the send queue, this callback drops the reference when
+ * the reply has been sent or the state has been destroyed.
+ */
+static void cache_read_data_release(void *priv)
+{
+	delete reinterpret_cast<std::shared_ptr<raw_data_t> *>(priv);
+}
+
+/*
+ * Size-classed slab cache for value buffers, modelled on the io request
+ * cache in net.c: allocations are rounded up to the nearest class and freed
+ * blocks of a class are kept on a bounded free list, so small values (session
+ * tokens are typically 64 bytes) do not pay full malloc metadata and arena
+ * locking on every cache write. Blocks above the largest class fall back to
+ * plain malloc.
+ */
+enum {
+	SLAB_CACHE_CLASSES = 4,
+	SLAB_CACHE_MAX_FREE = 256,
+};
+
+static const size_t slab_cache_sizes[SLAB_CACHE_CLASSES] = {128, 512, 2048, 8192};
+
+struct slab_cache_t {
+	std::mutex lock;
+	std::vector<char *> blocks;
+};
+
+static slab_cache_t slab_cache[SLAB_CACHE_CLASSES];
+
+static int slab_cache_class(size_t capacity)
+{
+	for (int i = 0; i < SLAB_CACHE_CLASSES; ++i) {
+		if (capacity <= slab_cache_sizes[i])
+			return i;
+	}
+
+	return -1;
+}
+
+static char *slab_alloc(size_t capacity)
+{
+	int cache_class = slab_cache_class(capacity);
+
+	if (cache_class >= 0) {
+		slab_cache_t &cache = slab_cache[cache_class];
+		std::lock_guard<std::mutex> guard(cache.lock);
+
+		if (!cache.blocks.empty()) {
+			char *data = cache.blocks.back();
+			cache.blocks.pop_back();
+			return data;
+		}
+	}
+
+	return reinterpret_cast<char *>(malloc(capacity));
+}
+
+#define DNET_CACHE_HUGE_PAGE_SIZE	(2UL * 1024 * 1024)
+
+/* 0 - disabled, set once in dnet_cache_init() before any shard exists */
+static size_t huge_page_threshold;
+
+static void huge_free(char *data, size_t capacity);
+
+static void slab_free(char *data, size_t capacity)
+{
+	if (!data)
+		return;
+
+	/*
+	 * Huge blocks are the only ones with a huge-page multiple capacity:
+	 * slab_alloc_rounded() routes every size above the threshold to
+	 * huge_alloc() while the threshold is set.
+	 */
+	if (huge_page_threshold && (capacity >= huge_page_threshold) &&
+			!(capacity & (DNET_CACHE_HUGE_PAGE_SIZE - 1))) {
+		huge_free(data, capacity);
+		return;
+	}
+
+	int cache_class = slab_cache_class(capacity);
+
+	if (cache_class >= 0 && capacity == slab_cache_sizes[cache_class]) {
+		slab_cache_t &cache = slab_cache[cache_class];
+		std::lock_guard<std::mutex> guard(cache.lock);
+
+		if (cache.blocks.size() < SLAB_CACHE_MAX_FREE) {
+			cache.blocks.push_back(data);
+			return;
+		}
+	}
+
+	free(data);
+}
+
+/*
+ * Huge page tier for large values: buffers of at least one huge page are
+ * mapped with MAP_HUGETLB (falling back to transparent huge pages when no
+ * hugetlb pool is configured) to cut dTLB pressure of multi-megabyte
+ * objects. Unmapped regions are pooled per capacity so a steady stream of
+ * same-sized values does not churn mmap/munmap and page faults.
+ * Disabled unless DNET_CFG_CACHE_HUGE_PAGES is set.
+ */
+enum {
+	HUGE_POOL_MAX_BYTES = 256 * 1024 * 1024,
+};
+
+struct huge_block_t {
+	char *data;
+	size_t capacity;
+};
+
+struct huge_pool_t {
+	std::mutex lock;
+	std::vector<huge_block_t> blocks;
+	size_t bytes;
+
+	huge_pool_t() : bytes(0) {}
+};
+
+static huge_pool_t huge_pool;
+
+static char *huge_alloc(size_t capacity)
+{
+	{
+		std::lock_guard<std::mutex> guard(huge_pool.lock);
+
+		for (std::vector<huge_block_t>::iterator it = huge_pool.blocks.begin(); it != huge_pool.blocks.end(); ++it) {
+			if (it->capacity == capacity) {
+				char *data = it->data;
+
+				huge_pool.bytes -= capacity;
+				*it = huge_pool.blocks.back();
+				huge_pool.blocks.pop_back();
+				return data;
+			}
+		}
+	}
+
+	void *data = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (data == MAP_FAILED) {
+		// no preallocated hugetlb pages - ask for transparent huge pages instead
+		data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(data, capacity, MADV_HUGEPAGE);
+#endif
+	}
+
+	return reinterpret_cast<char *>(data);
+}
+
+static void huge_free(char *data, size_t capacity)
+{
+	{
+		std::lock_guard<std::mutex> guard(huge_pool.lock);
+
+		if (huge_pool.bytes + capacity <= HUGE_POOL_MAX_BYTES) {
+			huge_block_t block = { data, capacity };
+
+			huge_pool.blocks.push_back(block);
+			huge_pool.bytes += capacity;
+			return;
+		}
+	}
+
+	munmap(data, capacity);
+}
+
+static void huge_pool_cleanup(void)
+{
+	std::lock_guard<std::mutex> guard(huge_pool.lock);
+
+	for (std::vector<huge_block_t>::iterator it = huge_pool.blocks.begin(); it != huge_pool.blocks.end(); ++it)
+		munmap(it->data, it->capacity);
+
+	huge_pool.blocks.clear();
+	huge_pool.bytes = 0;
+}
+
+/*
+ * Refcounted (via std::shared_ptr) slab-backed value buffer. Unlike the
+ * std::vector it replaces it never value-initializes bytes the caller is
+ * about to overwrite and recycles small buffers through the slab cache.
+ */
+static char *slab_alloc_rounded(size_t size, size_t *capacity)
+{
+	if (huge_page_threshold && size >= huge_page_threshold) {
+		*capacity = (size + DNET_CACHE_HUGE_PAGE_SIZE - 1) & ~(DNET_CACHE_HUGE_PAGE_SIZE - 1);
+		return huge_alloc(*capacity);
+	}
+
+	int cache_class = slab_cache_class(size);
+
+	*capacity = (cache_class >= 0) ? slab_cache_sizes[cache_class] : size;
+
+	return slab_alloc(*capacity);
+}
+
 class raw_data_t {
 	public:
-		raw_data_t(const char *data, size_t size) {
-			m_data.reserve(size);
-			m_data.insert(m_data.begin(), data, data + size);
+		raw_data_t(const char *data, size_t size) : m_data(NULL), m_size(0), m_capacity(0),
+			m_compressed(false), m_incompressible(false), m_raw_size(0) {
+			if (size) {
+				reserve(size);
+				memcpy(m_data, data, size);
+			}
+			m_size = size;
 		}
 
-		std::vector<char> &data(void) {
+		~raw_data_t() {
+			slab_free(m_data, m_capacity);
+		}
+
+		char *data(void) {
 			return m_data;
 		}
 
 		size_t size(void) {
-			return m_data.size();
+			return m_size;
+		}
+
+		// vector-alike: bytes between old and new size are zero-filled
+		void resize(size_t size) {
+			if (size > m_capacity)
+				reserve(size);
+			if (size > m_size)
+				memset(m_data + m_size, 0, size - m_size);
+			m_size = size;
+		}
+
+		void append(const char *data, size_t size) {
+			if (m_size + size > m_capacity)
+				reserve(m_size + size);
+			memcpy(m_data + m_size, data, size);
+			m_size += size;
+		}
+
+		bool compressed(void) const {
+			return m_compressed;
+		}
+
+		/*
+		 * Compression tier for cold entries: both methods return the number
+		 * of bytes the in-memory footprint changed by, zero when nothing
+		 * happened. Callers must hold the shard lock and must not compress
+		 * a buffer other readers still reference.
+		 */
+		size_t compress(void) {
+#ifdef HAVE_LZ4_SUPPORT
+			if (m_compressed || m_incompressible || !m_size)
+				return 0;
+
+			size_t bound_capacity;
+			char *bound = slab_alloc_rounded(LZ4_compressBound(m_size), &bound_capacity);
+			if (!bound)
+				return 0;
+
+			int compressed_size = LZ4_compress_default(m_data, bound, m_size, bound_capacity);
+			// reject entries which do not even save a slab class worth of bytes
+			if ((compressed_size <= 0) || ((size_t)compressed_size + 64 >= m_size)) {
+				slab_free(bound, bound_capacity);
+				m_incompressible = true;
+				return 0;
+			}
+
+			size_t capacity;
+			char *data = slab_alloc_rounded(compressed_size, &capacity);
+			if (!data) {
+				slab_free(bound, bound_capacity);
+				return 0;
+			}
+
+			memcpy(data, bound, compressed_size);
+			slab_free(bound, bound_capacity);
+			slab_free(m_data, m_capacity);
+
+			m_raw_size = m_size;
+			m_data = data;
+			m_size = compressed_size;
+			m_capacity = capacity;
+			m_compressed = true;
+
+			return m_raw_size - m_size;
+#else
+			return 0;
+#endif
+		}
+
+		size_t decompress(void) {
+#ifdef HAVE_LZ4_SUPPORT
+			if (!m_compressed)
+				return 0;
+
+			size_t capacity;
+			char *data = slab_alloc_rounded(m_raw_size, &capacity);
+			if (!data)
+				throw std::bad_alloc();
+
+			int err = LZ4_decompress_safe(m_data, data, m_size, m_raw_size);
+			if (err != (int)m_raw_size) {
+				// we compressed these bytes ourselves, failure means memory corruption
+				slab_free(data, capacity);
+				throw std::runtime_error("cache: lz4 decompression failed");
+			}
+
+			size_t grown = m_raw_size - m_size;
+
+			slab_free(m_data, m_capacity);
+			m_data = data;
+			m_size = m_raw_size;
+			m_capacity = capacity;
+			m_compressed = false;
+			m_raw_size = 0;
+
+			return grown;
+#else
+			return 0;
+#endif
 		}
 
 	private:
-		std::vector<char> m_data;
+		char *m_data;
+		size_t m_size;
+		size_t m_capacity;
+		bool m_compressed;
+		bool m_incompressible;
+		size_t m_raw_size;
+
+		raw_data_t(const raw_data_t &) = delete;
+		raw_data_t &operator =(const raw_data_t &) = delete;
+
+		void reserve(size_t size) {
+			size_t want = size;
+
+			if ((slab_cache_class(size) < 0) && (want < m_capacity * 2))
+				want = m_capacity * 2;
+
+			size_t capacity;
+			char *data = slab_alloc_rounded(want, &capacity);
+			if (!data)
+				throw std::bad_alloc();
+
+			if (m_size)
+				memcpy(data, m_data, m_size);
+
+			slab_free(m_data, m_capacity);
+			m_data = data;
+			m_capacity = capacity;
+		}
 };
 
 struct data_lru_tag_t;
@@ -61,25 +417,30 @@ typedef boost::intrusive::set_base_hook<boost::intrusive::tag<data_set_tag_t>,
 					 boost::intrusive::link_mode<boost::intrusive::safe_link>
 					> set_base_hook_t;
 
-struct time_set_tag_t;
-typedef boost::intrusive::set_base_hook<boost::intrusive::tag<time_set_tag_t>,
-					 boost::intrusive::link_mode<boost::intrusive::safe_link>
-					> time_set_base_hook_t;
+/*
+ * Timer wheel hooks are auto-unlink so an element can be dropped from its
+ * bucket without knowing which bucket (or pending list) it currently sits in.
+ */
+struct life_wheel_tag_t;
+typedef boost::intrusive::list_base_hook<boost::intrusive::tag<life_wheel_tag_t>,
+					 boost::intrusive::link_mode<boost::intrusive::auto_unlink>
+					> life_wheel_hook_t;
 
-struct sync_set_tag_t;
-typedef boost::intrusive::set_base_hook<boost::intrusive::tag<sync_set_tag_t>,
-					 boost::intrusive::link_mode<boost::intrusive::safe_link>
-					> sync_set_base_hook_t;
+struct sync_wheel_tag_t;
+typedef boost::intrusive::list_base_hook<boost::intrusive::tag<sync_wheel_tag_t>,
+					 boost::intrusive::link_mode<boost::intrusive::auto_unlink>
+					> sync_wheel_hook_t;
 
-class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_set_base_hook_t, public sync_set_base_hook_t {
+class data_t : public lru_list_base_hook_t, public set_base_hook_t, public life_wheel_hook_t, public sync_wheel_hook_t {
 	public:
 		data_t(const unsigned char *id) {
 			memcpy(m_id.id, id, DNET_ID_SIZE);
 		}
 
 		data_t(const unsigned char *id, size_t lifetime, const char *data, size_t size, bool remove_from_disk) :
-			m_lifetime(0), m_synctime(0), m_user_flags(0),
-			m_remove_from_disk(remove_from_disk), m_remove_from_cache(false), m_only_append(false) {
+			m_lifetime(0), m_synctime(0), m_synced_size(0), m_user_flags(0),
+			m_remove_from_disk(remove_from_disk), m_remove_from_cache(false), m_only_append(false),
+			m_touched(false) {
 			memcpy(m_id.id, id, DNET_ID_SIZE);
 			dnet_empty_time(&m_timestamp);
 
@@ -103,6 +464,27 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 			return m_data;
 		}
 
+		/*
+		 * Copy-on-write barrier for writers: a queued zero-copy read reply
+		 * keeps a reference to the buffer until it hits the wire, and
+		 * append()/resize() may slab_free the bytes under it. When the
+		 * buffer is shared the writer switches the element to a private
+		 * copy, readers finish sending from the old one which their shared
+		 * pointer keeps alive. Called under the shard lock; a shared buffer
+		 * is never compressed (see evict()), so copying the raw bytes is
+		 * enough.
+		 */
+		raw_data_t &detach_data(void) {
+			if (m_data.use_count() > 1)
+				m_data.reset(new raw_data_t(m_data->data(), m_data->size()));
+			return *m_data;
+		}
+
+		// whether anything besides the cache itself references the buffer
+		long data_use_count(void) const {
+			return m_data.use_count();
+		}
+
 		size_t lifetime(void) const {
 			return m_lifetime;
 		}
@@ -123,6 +505,21 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 			m_synctime = 0;
 		}
 
+		/*
+		 * Number of leading bytes already flushed to the backend. Only
+		 * meaningful for append-only elements: every sync appends just the
+		 * [synced_size, size) suffix instead of the whole accumulated
+		 * buffer, so append write amplification does not grow with object
+		 * size. Protected by the shard lock.
+		 */
+		size_t synced_size() const {
+			return m_synced_size;
+		}
+
+		void set_synced_size(size_t synced_size) {
+			m_synced_size = synced_size;
+		}
+
 		const dnet_time &timestamp() const {
 			return m_timestamp;
 		}
@@ -159,6 +556,14 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 			m_only_append = only_append;
 		}
 
+		bool touched() const {
+			return m_touched.load(std::memory_order_relaxed);
+		}
+
+		void set_touched(bool touched) {
+			m_touched.store(touched, std::memory_order_relaxed);
+		}
+
 		size_t size(void) const {
 			return m_data->size();
 		}
@@ -178,11 +583,20 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 	private:
 		size_t m_lifetime;
 		size_t m_synctime;
+		size_t m_synced_size;
 		dnet_time m_timestamp;
 		uint64_t m_user_flags;
 		bool m_remove_from_disk;
 		bool m_remove_from_cache;
 		bool m_only_append;
+		/*
+		 * CLOCK reference bit: read hits set it instead of splicing the LRU
+		 * list, resize() turns it back into an LRU move. It is atomic so a
+		 * hit does not issue a locked write to shared list nodes and so it
+		 * may be set without holding the shard lock once lookups no longer
+		 * need it.
+		 */
+		std::atomic<bool> m_touched;
 		struct dnet_raw_id m_id;
 		std::shared_ptr<raw_data_t> m_data;
 };
@@ -192,27 +606,189 @@ typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<set_base_hook_
 					  boost::intrusive::compare<std::less<data_t> >
 			     > iset_t;
 
-struct lifetime_less {
-	bool operator() (const data_t &x, const data_t &y) const {
-		return x.lifetime() < y.lifetime()
-			|| (x.lifetime() == y.lifetime() && ((&x) < (&y)));
-	}
+/*
+ * Hashed timer wheel keyed by second-granularity absolute deadlines.
+ * Insert and cancel are O(1) list operations; a tick visits only the
+ * buckets between the previous tick and now, skipping over entries parked
+ * there for later revolutions of the wheel. This replaces rbtrees ordered
+ * by expiry/sync time whose walks under the shard lock showed up as p99
+ * read latency spikes on caches with tens of millions of entries.
+ */
+template <typename hook_t>
+class timer_wheel_t {
+	public:
+		enum { buckets_num = 512 };
+
+		typedef boost::intrusive::list<data_t, boost::intrusive::base_hook<hook_t>,
+					boost::intrusive::constant_time_size<false> > list_t;
+
+		timer_wheel_t() : m_last(0) {}
+
+		void insert(data_t &obj, size_t deadline) {
+			// overdue deadlines go to the very next tick
+			if (deadline <= m_last)
+				deadline = m_last + 1;
+
+			m_buckets[deadline % buckets_num].push_back(obj);
+		}
+
+		static bool linked(const data_t &obj) {
+			return static_cast<const hook_t &>(obj).is_linked();
+		}
+
+		static void erase(data_t &obj) {
+			if (linked(obj))
+				static_cast<hook_t &>(obj).unlink();
+		}
+
+		/*
+		 * Moves entries due at @time into @due, entries whose deadline is
+		 * still in the future stay in their buckets for a later revolution.
+		 */
+		void drain(size_t time, list_t &due, size_t (data_t::*deadline)(void) const) {
+			size_t start = m_last + 1;
+
+			if (time + 1 >= start + buckets_num)
+				start = time + 1 - buckets_num;
+
+			for (size_t t = start; t <= time; ++t) {
+				list_t &bucket = m_buckets[t % buckets_num];
+
+				for (typename list_t::iterator it = bucket.begin(); it != bucket.end();) {
+					data_t &obj = *it;
+					++it;
+
+					if ((obj.*deadline)() <= time) {
+						erase(obj);
+						due.push_back(obj);
+					}
+				}
+			}
+
+			m_last = time;
+		}
+
+		list_t &bucket(size_t i) {
+			return m_buckets[i];
+		}
+
+	private:
+		size_t m_last;
+		list_t m_buckets[buckets_num];
 };
 
-typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<time_set_base_hook_t>,
-					  boost::intrusive::compare<lifetime_less>
-			     > life_set_t;
+typedef timer_wheel_t<life_wheel_hook_t> life_wheel_t;
+typedef timer_wheel_t<sync_wheel_hook_t> sync_wheel_t;
 
-struct synctime_less {
-	bool operator() (const data_t &x, const data_t &y) const {
-		return x.synctime() < y.synctime()
-			|| (x.synctime() == y.synctime() && ((&x) < (&y)));
-	}
+/*
+ * Snapshot of one dirty entry due for write-back, taken under the shard
+ * lock and flushed to the backend outside of it.
+ */
+struct sync_item_t {
+	struct dnet_id id;
+	std::vector<char> data;
+	uint64_t user_flags;
+	dnet_time timestamp;
 };
 
-typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<sync_set_base_hook_t>,
-					  boost::intrusive::compare<synctime_less>
-			     > sync_set_t;
+static bool sync_item_id_less(const sync_item_t &a, const sync_item_t &b)
+{
+	return dnet_id_cmp_str(a.id.id, b.id.id) < 0;
+}
+
+/*
+ * Per-shard counters scraped through the DNET_CMD_STAT_COUNT path, relaxed
+ * atomics so the hot paths never take an extra lock for accounting.
+ */
+struct cache_stats_t {
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> evictions;
+	std::atomic<uint64_t> sync_queue;
+	std::atomic<uint64_t> lock_wait_ms;
+	std::atomic<uint64_t> hot_pins;
+
+	cache_stats_t() : hits(0), misses(0), evictions(0), sync_queue(0), lock_wait_ms(0), hot_pins(0) {}
+};
+
+/*
+ * Count-min sketch over recently accessed ids. Ids are already uniform
+ * cryptographic hashes, so each row is indexed by its own 4-byte slice of
+ * the id instead of rehashing. The life thread halves all counters every
+ * decay_seconds, which turns the counts into an exponentially decayed
+ * access frequency: an id is "hot" while its estimate stays at or above
+ * hot_threshold. All updates run under the shard lock.
+ */
+class frequency_sketch_t {
+	public:
+		enum {
+			rows = 4,
+			row_size = 8192,	/* counters per row, power of two */
+			hot_threshold = 64,	/* accesses per decay window */
+			decay_seconds = 10,
+		};
+
+		frequency_sketch_t() {
+			memset(m_counters, 0, sizeof(m_counters));
+		}
+
+		uint32_t add(const unsigned char *id) {
+			uint32_t est = ~0u;
+
+			for (int i = 0; i < rows; ++i) {
+				uint32_t &counter = m_counters[i][index(id, i)];
+
+				if (counter != ~0u)
+					++counter;
+				if (counter < est)
+					est = counter;
+			}
+
+			return est;
+		}
+
+		uint32_t estimate(const unsigned char *id) const {
+			uint32_t est = ~0u;
+
+			for (int i = 0; i < rows; ++i) {
+				const uint32_t counter = m_counters[i][index(id, i)];
+
+				if (counter < est)
+					est = counter;
+			}
+
+			return est;
+		}
+
+		void decay() {
+			for (int i = 0; i < rows; ++i)
+				for (size_t j = 0; j < row_size; ++j)
+					m_counters[i][j] /= 2;
+		}
+
+	private:
+		static size_t index(const unsigned char *id, int row) {
+			uint32_t slice;
+
+			memcpy(&slice, id + row * sizeof(slice), sizeof(slice));
+			return slice & (row_size - 1);
+		}
+
+		uint32_t m_counters[rows][row_size];
+};
+
+/*
+ * Singleflight fill: concurrent misses for one key coalesce onto a single
+ * backend read, the first caller performs it and populates the entry, the
+ * others wait on the fill and pick up the result.
+ */
+struct fill_t {
+	std::condition_variable cond;
+	bool done;
+	int err;
+
+	fill_t() : done(false), err(0) {}
+};
 
 template <typename T>
 class elliptics_unique_lock
@@ -257,6 +833,12 @@ public:
 		m_guard.unlock();
 	}
 
+	// for condition_variable waits
+	std::unique_lock<T> &native()
+	{
+		return m_guard;
+	}
+
 private:
 	std::unique_lock<T> m_guard;
 	dnet_node *m_node;
@@ -270,7 +852,8 @@ class cache_t {
 		m_need_exit(false),
 		m_node(n),
 		m_cache_size(0),
-		m_max_cache_size(max_size) {
+		m_max_cache_size(max_size),
+		m_last_decay(time(NULL)) {
 			m_lifecheck = std::thread(std::bind(&cache_t::life_check, this));
 		}
 
@@ -283,17 +866,22 @@ class cache_t {
 
 			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "~cache_t: %p", this);
 
-			while(!m_syncset.empty()) { //removes datas from syncset
-				erase_element(&*m_syncset.begin());
+			for (size_t i = 0; i < sync_wheel_t::buckets_num; ++i) { //removes datas from sync wheel
+				while (!m_syncwheel.bucket(i).empty()) {
+					erase_element(&*m_syncwheel.bucket(i).begin());
+				}
 			}
 
-			while(!m_lifeset.empty()) { //removes datas from lifeset
-				erase_element(&*m_lifeset.begin());
+			for (size_t i = 0; i < life_wheel_t::buckets_num; ++i) { //removes datas from life wheel
+				while (!m_lifewheel.bucket(i).empty()) {
+					erase_element(&*m_lifewheel.bucket(i).begin());
+				}
 			}
 		}
 
 		void stop() {
 			m_need_exit = true;
+			m_wakeup.notify_one();
 		}
 
 		int write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data) {
@@ -308,7 +896,11 @@ class cache_t {
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: before guard\n", dnet_dump_id_str(id));
 			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE WRITE: %p", dnet_dump_id_str(id), this);
-			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: after guard, lock: %lld ms\n", dnet_dump_id_str(id), timer.restart());
+			const long long lock_wait = timer.restart();
+			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: after guard, lock: %lld ms\n", dnet_dump_id_str(id), lock_wait);
+			m_stats.lock_wait_ms.fetch_add(lock_wait, std::memory_order_relaxed);
+
+			account_access(id);
 
 			iset_t::iterator it = m_set.find(id);
 
@@ -324,10 +916,13 @@ class cache_t {
 						it = create_data(id, 0, 0, false);
 						it->set_only_append(true);
 						it->set_synctime(time(NULL) + m_node->cache_sync_timeout);
-						m_syncset.insert(*it);
+						m_syncwheel.insert(*it, it->synctime());
+						m_stats.sync_queue.fetch_add(1, std::memory_order_relaxed);
 					}
 
-					auto &raw = it->data()->data();
+					raw_data_t &raw = it->detach_data();
+
+					m_cache_size += raw.decompress();
 
 					m_cache_size -= raw.size();
 					m_lru.erase(m_lru.iterator_to(*it));
@@ -336,20 +931,24 @@ class cache_t {
 
 					timer.restart();
 
-					if (m_cache_size + new_size > m_max_cache_size) {
-						dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called\n", dnet_dump_id_str(id));
-						resize(new_size * 2);
-						dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize finished: %lld ms\n", dnet_dump_id_str(id), timer.restart());
-					}
-
 					m_lru.push_back(*it);
+					it->set_touched(false);
 					m_cache_size += new_size;
+					check_size();
 
-					raw.insert(raw.end(), data, data + io->size);
+					raw.append(data, io->size);
 
 					it->set_timestamp(io->timestamp);
 					it->set_user_flags(io->user_flags);
 
+					// re-arm the sync timer: a suffix flush keeps the
+					// element cached with its synctime cleared
+					if (!it->synctime()) {
+						it->set_synctime(time(NULL) + m_node->cache_sync_timeout);
+						m_syncwheel.insert(*it, it->synctime());
+						m_stats.sync_queue.fetch_add(1, std::memory_order_relaxed);
+					}
+
 					cmd->flags &= ~DNET_FLAGS_NEED_ACK;
 					return dnet_send_file_info_ts_without_fd(st, cmd, data, io->size, &io->timestamp);
 				} else if (it != m_set.end() && it->only_append()) {
@@ -390,14 +989,16 @@ class cache_t {
 			}
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: data ensured: %lld ms\n", dnet_dump_id_str(id), timer.restart());
 
-			raw_data_t &raw = *it->data();
+			raw_data_t &raw = it->detach_data();
+
+			m_cache_size += raw.decompress();
 
 			if (io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) {
 				// Data is already in memory, so it's free to use it
 				// raw.size() is zero only if there is no such file on the server
 				if (raw.size() != 0) {
 					struct dnet_raw_id csum;
-					dnet_transform_node(m_node, raw.data().data(), raw.size(), csum.id, sizeof(csum.id));
+					dnet_transform_node(m_node, raw.data(), raw.size(), csum.id, sizeof(csum.id));
 
 					if (memcmp(csum.id, io->parent, DNET_ID_SIZE)) {
 						dnet_log(m_node, DNET_LOG_ERROR, "%s: cas: cache checksum mismatch\n", dnet_dump_id(&cmd->id));
@@ -416,25 +1017,22 @@ class cache_t {
 				new_size = io->offset + io->size;
 			}
 
-			// Recalc used space, free enough space for new data, move object to the end of the queue
+			// Recalc used space, move object to the end of the queue; eviction
+			// itself is incremental and runs on the life thread
 			m_cache_size -= raw.size();
 			m_lru.erase(m_lru.iterator_to(*it));
 
-			if (m_cache_size + new_size > m_max_cache_size) {
-				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called: %lld ms\n", dnet_dump_id_str(id), timer.restart());
-				resize(new_size * 2);
-				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize finished: %lld ms\n", dnet_dump_id_str(id), timer.restart());
-			}
-
 			m_lru.push_back(*it);
 			it->set_remove_from_cache(false);
+			it->set_touched(false);
 			m_cache_size += new_size;
+			check_size();
 
 			if (append) {
-				raw.data().insert(raw.data().end(), data, data + size);
+				raw.append(data, size);
 			} else {
-				raw.data().resize(new_size);
-				memcpy(raw.data().data() + io->offset, data, size);
+				raw.resize(new_size);
+				memcpy(raw.data() + io->offset, data, size);
 			}
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: data modified: %lld ms\n", dnet_dump_id_str(id), timer.restart());
@@ -442,15 +1040,16 @@ class cache_t {
 			// Mark data as dirty one, so it will be synced to the disk
 			if (!it->synctime() && !(io->flags & DNET_IO_FLAGS_CACHE_ONLY)) {
 				it->set_synctime(time(NULL) + m_node->cache_sync_timeout);
-				m_syncset.insert(*it);
+				m_syncwheel.insert(*it, it->synctime());
+				m_stats.sync_queue.fetch_add(1, std::memory_order_relaxed);
 			}
 
 			if (it->lifetime())
-				m_lifeset.erase(m_lifeset.iterator_to(*it));
+				life_wheel_t::erase(*it);
 
 			if (lifetime) {
 				it->set_lifetime(lifetime + time(NULL));
-				m_lifeset.insert(*it);
+				m_lifewheel.insert(*it, it->lifetime());
 			}
 
 			it->set_timestamp(io->timestamp);
@@ -459,7 +1058,7 @@ class cache_t {
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: finished write: %lld ,s\n", dnet_dump_id_str(id), timer.restart());
 
 			cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-			return dnet_send_file_info_ts_without_fd(st, cmd, raw.data().data() + io->offset, io->size, &io->timestamp);
+			return dnet_send_file_info_ts_without_fd(st, cmd, raw.data() + io->offset, io->size, &io->timestamp);
 		}
 
 		std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
@@ -471,14 +1070,18 @@ class cache_t {
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: before guard\n", dnet_dump_id_str(id));
 			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE READ: %p", dnet_dump_id_str(id), this);
-			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: after guard, lock: %lld ms\n", dnet_dump_id_str(id), timer.restart());
+			const long long lock_wait = timer.restart();
+			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: after guard, lock: %lld ms\n", dnet_dump_id_str(id), lock_wait);
+			m_stats.lock_wait_ms.fetch_add(lock_wait, std::memory_order_relaxed);
+
+			account_access(id);
 
 			iset_t::iterator it = m_set.find(id);
-			if (it != m_set.end() && it->only_append()) {
-				sync_after_append(guard, true, &*it);
+			if (it != m_set.end() && it->only_append() && it->synctime()) {
+				// flush the dirty suffix but keep the element, the read
+				// below is served straight from the cache
+				sync_after_append(guard, true, &*it, true);
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: synced append-only data, find+sync: %lld ms\n", dnet_dump_id_str(id), timer.restart());
-
-				it = m_set.end();
 			}
 			timer.restart();
 
@@ -493,9 +1096,20 @@ class cache_t {
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: data ensured: %lld ms\n", dnet_dump_id_str(id), timer.restart());
 
 			if (it != m_set.end()) {
-				m_lru.erase(m_lru.iterator_to(*it));
+				m_stats.hits.fetch_add(1, std::memory_order_relaxed);
+
+				/*
+				 * Read hit does not touch the LRU list: it only marks the
+				 * element, resize() will move marked elements to the back
+				 * instead of evicting them. This keeps the hot read path
+				 * critical section as short as possible.
+				 */
+				it->set_touched(true);
 				it->set_remove_from_cache(false);
-				m_lru.push_back(*it);
+
+				// promotion from the compression tier
+				m_cache_size += it->data()->decompress();
+				check_size();
 
 				io->timestamp = it->timestamp();
 				io->user_flags = it->user_flags();
@@ -503,6 +1117,7 @@ class cache_t {
 				return it->data();
 			}
 
+			m_stats.misses.fetch_add(1, std::memory_order_relaxed);
 			return std::shared_ptr<raw_data_t>();
 		}
 
@@ -515,7 +1130,9 @@ class cache_t {
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE REMOVE: before guard\n", dnet_dump_id_str(id));
 			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE REMOVE: %p", dnet_dump_id_str(id), this);
-			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE REMOVE: after guard, lock: %lld ms\n", dnet_dump_id_str(id), timer.restart());
+			const long long lock_wait = timer.restart();
+			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE REMOVE: after guard, lock: %lld ms\n", dnet_dump_id_str(id), lock_wait);
+			m_stats.lock_wait_ms.fetch_add(lock_wait, std::memory_order_relaxed);
 
 			iset_t::iterator it = m_set.find(id);
 			if (it != m_set.end()) {
@@ -523,8 +1140,9 @@ class cache_t {
 				// If data is marked and cache_only is not set - data must be synced to the disk
 				remove_from_disk |= it->remove_from_disk();
 				if (it->synctime() && !cache_only) {
-					m_syncset.erase(m_syncset.iterator_to(*it));
+					sync_wheel_t::erase(*it);
 					it->clear_synctime();
+					m_stats.sync_queue.fetch_sub(1, std::memory_order_relaxed);
 				}
 				erase_element(&(*it));
 				err = 0;
@@ -557,7 +1175,9 @@ class cache_t {
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE LOOKUP: before guard\n", dnet_dump_id_str(id));
 			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE LOOKUP: %p", dnet_dump_id_str(id), this);
-			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE LOOKUP: after guard, lock: %lld ms\n", dnet_dump_id_str(id), timer.restart());
+			const long long lock_wait = timer.restart();
+			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE LOOKUP: after guard, lock: %lld ms\n", dnet_dump_id_str(id), lock_wait);
+			m_stats.lock_wait_ms.fetch_add(lock_wait, std::memory_order_relaxed);
 
 			iset_t::iterator it = m_set.find(id);
 			if (it == m_set.end()) {
@@ -588,39 +1208,128 @@ class cache_t {
 			return dnet_send_reply(st, cmd, data.data(), data.size(), 0);
 		}
 
+		const cache_stats_t &stats(void) const {
+			return m_stats;
+		}
+
+		/*
+		 * Runtime limit change: shrinking below the current size wakes
+		 * the life thread which evicts down to the new watermark.
+		 */
+		void set_max_size(size_t max_size) {
+			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "set_max_size: %zu", max_size);
+
+			m_max_cache_size = max_size;
+			if (m_cache_size > m_max_cache_size)
+				m_wakeup.notify_one();
+		}
+
+		/* unlocked read, only used for statistics */
+		size_t cache_size(void) const {
+			return m_cache_size;
+		}
+
+		/* appends this shard's hot ids to @keys, locked briefly per scrape */
+		void hot_keys(std::vector<std::pair<std::string, uint64_t> > &keys) {
+			elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE HOT KEYS: %p", this);
+
+			for (auto it = m_hot_keys.begin(); it != m_hot_keys.end(); ++it)
+				keys.push_back(*it);
+		}
+
 	private:
 		bool m_need_exit;
 		struct dnet_node *m_node;
 		size_t m_cache_size, m_max_cache_size;
 		std::mutex m_lock;
+		std::condition_variable m_wakeup;
 		iset_t m_set;
 		lru_list_t m_lru;
-		life_set_t m_lifeset;
-		sync_set_t m_syncset;
+		life_wheel_t m_lifewheel;
+		sync_wheel_t m_syncwheel;
+		boost::unordered_map<std::string, std::shared_ptr<fill_t> > m_fills;
 		std::thread m_lifecheck;
+		cache_stats_t m_stats;
+		frequency_sketch_t m_sketch;
+		std::map<std::string, uint64_t> m_hot_keys;
+		size_t m_last_decay;
 
 		cache_t(const cache_t &) = delete;
 
-		iset_t::iterator create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk) {
-			if (m_cache_size + size > m_max_cache_size) {
-				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called from create_data\n", dnet_dump_id_str(id));
-				resize(size);
-				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize finished from create_data\n", dnet_dump_id_str(id));
+		/*
+		 * Frequency accounting for one access, called under the shard
+		 * lock. Crossing the hot threshold puts the id into the shard's
+		 * top list, which is capped by dropping its coldest entry.
+		 */
+		void account_access(const unsigned char *id) {
+			enum { hot_keys_max = 16 };
+
+			const uint32_t freq = m_sketch.add(id);
+			if (freq < frequency_sketch_t::hot_threshold)
+				return;
+
+			m_hot_keys[std::string(reinterpret_cast<const char *>(id), DNET_ID_SIZE)] = freq;
+
+			if (m_hot_keys.size() > hot_keys_max) {
+				auto coldest = m_hot_keys.begin();
+
+				for (auto it = m_hot_keys.begin(); it != m_hot_keys.end(); ++it) {
+					if (it->second < coldest->second)
+						coldest = it;
+				}
+				m_hot_keys.erase(coldest);
 			}
+		}
+
+		bool hot(const data_t *raw) const {
+			return m_sketch.estimate(raw->id().id) >= frequency_sketch_t::hot_threshold;
+		}
 
+		iset_t::iterator create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk) {
 			data_t *raw = new data_t(id, 0, data, size, remove_from_disk);
 
 			m_cache_size += size;
+			check_size();
 
 			m_lru.push_back(*raw);
 			return m_set.insert(*raw).first;
 		}
 
+		/*
+		 * O(1) watermark check for the foreground paths: crossing the high
+		 * watermark only wakes the life thread, which evicts down to the
+		 * low watermark in bounded lock holds.
+		 */
+		void check_size(void) {
+			if (m_cache_size > m_max_cache_size)
+				m_wakeup.notify_one();
+		}
+
 		iset_t::iterator populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err) {
-			if (guard.owns_lock()) {
-				guard.unlock();
+			if (!guard.owns_lock()) {
+				guard.lock();
 			}
 
+			std::string key(reinterpret_cast<const char *>(id), DNET_ID_SIZE);
+
+			auto fit = m_fills.find(key);
+			if (fit != m_fills.end()) {
+				std::shared_ptr<fill_t> fill = fit->second;
+
+				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: joining in-flight fill\n", dnet_dump_id_str(id));
+
+				while (!fill->done)
+					fill->cond.wait(guard.native());
+
+				*err = fill->err;
+				return m_set.find(id);
+			}
+
+			std::shared_ptr<fill_t> fill = std::make_shared<fill_t>();
+			m_fills[key] = fill;
+
+			guard.unlock();
+
 			elliptics_timer timer;
 
 			local_session sess(m_node);
@@ -644,15 +1353,96 @@ class cache_t {
 			guard.lock();
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: populating from disk, after lock: %lld ms\n", dnet_dump_id_str(id), timer.restart());
 
+			iset_t::iterator it = m_set.end();
+
 			if (*err == 0) {
-				auto it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
+				it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
 				it->set_user_flags(user_flags);
 				it->set_timestamp(timestamp);
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: populating from disk, data created: %lld ms\n", dnet_dump_id_str(id), timer.restart());
-				return it;
 			}
 
-			return m_set.end();
+			m_fills.erase(key);
+			fill->err = *err;
+			fill->done = true;
+			fill->cond.notify_all();
+
+			return it;
+		}
+
+		/*
+		 * Incremental watermark eviction run by the life thread: once the
+		 * cache crosses the high watermark (m_max_cache_size), evict LRU
+		 * entries down to the low watermark in bounded lock holds so
+		 * foreground operations interleave with the eviction.
+		 */
+		void evict(void) {
+			const size_t low_mark = m_max_cache_size / 10 * 9;
+			size_t removed_size = 0;
+
+			while (!m_need_exit) {
+				int budget = 128;
+
+				elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE EVICT: %p", this);
+
+				lru_list_t::iterator it = m_lru.begin();
+
+				while (budget-- > 0) {
+					if (it == m_lru.end())
+						return;
+
+					if (m_cache_size <= low_mark + removed_size)
+						return;
+
+					data_t *raw = &*it;
+					++it;
+
+					if (hot(raw)) {
+						// pinned: a viral key must survive large-object
+						// churn, the pin lapses once the sketch decays
+						m_lru.erase(m_lru.iterator_to(*raw));
+						m_lru.push_back(*raw);
+						m_stats.hot_pins.fetch_add(1, std::memory_order_relaxed);
+						continue;
+					}
+
+					if (raw->touched()) {
+						// second chance, same as resize()
+						raw->set_touched(false);
+						m_lru.erase(m_lru.iterator_to(*raw));
+						m_lru.push_back(*raw);
+						continue;
+					}
+
+					if (raw->synctime() || raw->remove_from_cache()) {
+						if (!raw->remove_from_cache()) {
+							raw->set_remove_from_cache(true);
+
+							sync_wheel_t::erase(*raw);
+							raw->set_synctime(1);
+							m_syncwheel.insert(*raw, raw->synctime());
+						}
+						removed_size += raw->size();
+					} else {
+						/*
+						 * Compression tier: a clean cold entry is compressed
+						 * in place instead of being dropped, the next visit
+						 * (still cold, already compressed) evicts it for real.
+						 */
+						size_t saved = 0;
+
+						if ((m_node->flags & DNET_CFG_CACHE_COMPRESS) && (raw->data_use_count() == 1))
+							saved = raw->data()->compress();
+
+						if (saved) {
+							m_cache_size -= saved;
+						} else {
+							erase_element(raw);
+							m_stats.evictions.fetch_add(1, std::memory_order_relaxed);
+						}
+					}
+				}
+			}
 		}
 
 		void resize(size_t reserve) {
@@ -665,17 +1455,27 @@ class cache_t {
 				data_t *raw = &*it;
 				++it;
 
+				if (raw->touched()) {
+					// second chance: the element was read since it got to
+					// the head of the LRU list, move it to the back instead
+					raw->set_touched(false);
+					m_lru.erase(m_lru.iterator_to(*raw));
+					m_lru.push_back(*raw);
+					continue;
+				}
+
 				if (raw->synctime() || raw->remove_from_cache()) {
 					if (!raw->remove_from_cache()) {
 						raw->set_remove_from_cache(true);
 
-						m_syncset.erase(m_syncset.iterator_to(*raw));
+						sync_wheel_t::erase(*raw);
 						raw->set_synctime(1);
-						m_syncset.insert(*raw);
+						m_syncwheel.insert(*raw, raw->synctime());
 					}
 					removed_size += raw->size();
 				} else {
 					erase_element(raw);
+					m_stats.evictions.fetch_add(1, std::memory_order_relaxed);
 				}
 			}
 		}
@@ -685,14 +1485,14 @@ class cache_t {
 
 			m_lru.erase(m_lru.iterator_to(*obj));
 			m_set.erase(m_set.iterator_to(*obj));
-			if (obj->lifetime())
-				m_lifeset.erase(m_lifeset.iterator_to(*obj));
+			life_wheel_t::erase(*obj);
 
 			if (obj->synctime()) {
 				sync_element(obj);
 
-				m_syncset.erase(m_syncset.iterator_to(*obj));
+				sync_wheel_t::erase(*obj);
 				obj->clear_synctime();
+				m_stats.sync_queue.fetch_sub(1, std::memory_order_relaxed);
 			}
 
 			m_cache_size -= obj->size();
@@ -702,11 +1502,11 @@ class cache_t {
 			delete obj;
 		}
 
-		void sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp) {
+		void sync_element(const dnet_id &raw, bool after_append, const char *data, size_t size, uint64_t user_flags, const dnet_time &timestamp) {
 			local_session sess(m_node);
 			sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | (after_append ? DNET_IO_FLAGS_APPEND : 0));
 
-			int err = sess.write(raw, data.data(), data.size(), user_flags, timestamp);
+			int err = sess.write(raw, data, size, user_flags, timestamp);
 			if (err) {
 				dnet_log(m_node, DNET_LOG_ERROR, "%s: CACHE: forced to sync to disk, err: %d\n", dnet_dump_id_str(raw.id), err);
 			} else {
@@ -719,17 +1519,38 @@ class cache_t {
 			memset(&raw, 0, sizeof(struct dnet_id));
 			memcpy(raw.id, obj->id().id, DNET_ID_SIZE);
 
-			auto &data = obj->data()->data();
+			auto data = obj->data();
 
-			sync_element(raw, obj->only_append(), data, obj->user_flags(), obj->timestamp());
+			// append-only elements flush just the unsynced suffix
+			const size_t synced = obj->only_append() ? obj->synced_size() : 0;
+			if (obj->only_append() && synced >= data->size())
+				return;
+
+			sync_element(raw, obj->only_append(), data->data() + synced, data->size() - synced,
+					obj->user_flags(), obj->timestamp());
+
+			if (obj->only_append())
+				obj->set_synced_size(data->size());
 		}
 
-		void sync_after_append(elliptics_unique_lock<std::mutex> &guard, bool lock_guard, data_t *obj) {
+		/*
+		 * Appends the unsynced suffix of an append-only element to the
+		 * backend. With @keep the element stays cached and only its synced
+		 * prefix marker advances, so periodic syncs of a growing event log
+		 * flush just the new bytes; without it the element is erased first
+		 * (used when a non-append write converts the object back to the
+		 * generic path).
+		 */
+		void sync_after_append(elliptics_unique_lock<std::mutex> &guard, bool lock_guard, data_t *obj, bool keep = false) {
 			elliptics_timer timer;
 
 			std::shared_ptr<raw_data_t> raw_data = obj->data();
-			m_syncset.erase(m_syncset.iterator_to(*obj));
+			const size_t synced = obj->synced_size();
+			const size_t size = raw_data->size();
+
+			sync_wheel_t::erase(*obj);
 			obj->set_synctime(0);
+			m_stats.sync_queue.fetch_sub(1, std::memory_order_relaxed);
 
 			dnet_id id;
 			memset(&id, 0, sizeof(id));
@@ -738,9 +1559,30 @@ class cache_t {
 			uint64_t user_flags = obj->user_flags();
 			dnet_time timestamp = obj->timestamp();
 
+			if (synced >= size) {
+				// everything accumulated so far has already been flushed
+				if (!keep)
+					erase_element(&*obj);
+				return;
+			}
+
 			const auto timer_prepare = timer.restart();
 
-			erase_element(&*obj);
+			std::vector<char> suffix;
+			const char *suffix_data;
+
+			if (keep) {
+				// snapshot: writers may append (and reallocate) the buffer
+				// once the shard lock is dropped
+				suffix.assign(raw_data->data() + synced, raw_data->data() + size);
+				suffix_data = suffix.data();
+				obj->set_synced_size(size);
+			} else {
+				// erased element is unreachable for writers, the buffer is
+				// kept alive by the shared pointer - no copy needed
+				erase_element(&*obj);
+				suffix_data = raw_data->data() + synced;
+			}
 
 			const auto timer_erase = timer.restart();
 
@@ -749,11 +1591,9 @@ class cache_t {
 			local_session sess(m_node);
 			sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | DNET_IO_FLAGS_APPEND);
 
-			auto &raw = raw_data->data();
-
 			const auto timer_before_write = timer.restart();
 
-			int err = sess.write(id, raw.data(), raw.size(), user_flags, timestamp);
+			int err = sess.write(id, suffix_data, size - synced, user_flags, timestamp);
 
 			const auto timer_after_write = timer.restart();
 
@@ -763,101 +1603,182 @@ class cache_t {
 			const auto timer_lock = timer.restart();
 
 			dnet_log(m_node, DNET_LOG_INFO, "%s: CACHE: sync after append, "
+				"synced: %zu, suffix: %zu, keep: %d, "
 				"prepare: %lld ms, erase: %lld ms, before_write: %lld ms, after_write: %lld ms, lock: %lld ms, err: %d",
-				 dnet_dump_id_str(id.id), timer_prepare, timer_erase, timer_before_write, timer_after_write, timer_lock, err);
+				 dnet_dump_id_str(id.id), synced, size - synced, keep,
+				 timer_prepare, timer_erase, timer_before_write, timer_after_write, timer_lock, err);
 		}
 
 		void life_check(void) {
 			while (!m_need_exit) {
 				std::deque<struct dnet_id> remove;
+				size_t time = ::time(NULL);
 
-				while (!m_need_exit && !m_lifeset.empty()) {
-					size_t time = ::time(NULL);
-
+				{
 					elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE LIFE: %p", this);
 
-					if (m_lifeset.empty())
-						break;
+					life_wheel_t::list_t expired;
+					m_lifewheel.drain(time, expired, &data_t::lifetime);
+
+					while (!expired.empty()) {
+						data_t *obj = &*expired.begin();
+						expired.pop_front();
 
-					life_set_t::iterator it = m_lifeset.begin();
-					if (it->lifetime() > time)
-						break;
+						if (obj->remove_from_disk()) {
+							struct dnet_id id;
+							memset(&id, 0, sizeof(struct dnet_id));
 
-					if (it->remove_from_disk()) {
-						struct dnet_id id;
-						memset(&id, 0, sizeof(struct dnet_id));
+							dnet_setup_id(&id, 0, (unsigned char *)obj->id().id);
 
-						dnet_setup_id(&id, 0, (unsigned char *)it->id().id);
+							remove.push_back(id);
+						}
 
-						remove.push_back(id);
+						erase_element(obj);
+					}
+				}
+
+				if (time >= m_last_decay + frequency_sketch_t::decay_seconds) {
+					elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE DECAY: %p", this);
+
+					m_sketch.decay();
+
+					// ids which cooled below the threshold leave the top list
+					for (auto it = m_hot_keys.begin(); it != m_hot_keys.end();) {
+						const uint32_t freq = m_sketch.estimate(
+								reinterpret_cast<const unsigned char *>(it->first.data()));
+
+						if (freq < frequency_sketch_t::hot_threshold) {
+							it = m_hot_keys.erase(it);
+						} else {
+							it->second = freq;
+							++it;
+						}
 					}
 
-					erase_element(&(*it));
+					m_last_decay = time;
 				}
 
-				dnet_id id;
-				std::vector<char> data;
-				uint64_t user_flags;
-				dnet_time timestamp;
+				const size_t batch_max = m_node->cache_sync_batch_size > 0 ? m_node->cache_sync_batch_size : 128;
+				const size_t batch_max_bytes = m_node->cache_sync_batch_bytes > 0 ? m_node->cache_sync_batch_bytes : 8 * 1024 * 1024;
+
+				/*
+				 * The due list is accessed strictly under the shard lock:
+				 * another thread erasing an element auto-unlinks it from
+				 * this list, which is only safe while that erase and our
+				 * iteration are serialized by m_lock.
+				 */
+				sync_wheel_t::list_t due;
+				std::vector<sync_item_t> batch;
+
+				while (!m_need_exit) {
+					batch.clear();
+					size_t batch_bytes = 0;
+
+					{
+						elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE SYNC: %p", this);
+
+						if (due.empty()) {
+							m_syncwheel.drain(time, due, &data_t::synctime);
+							if (due.empty())
+								break;
+						}
 
-				memset(&id, 0, sizeof(id));
+						while (!due.empty() && batch.size() < batch_max && batch_bytes < batch_max_bytes) {
+							data_t *obj = &*due.begin();
+							due.pop_front();
 
-				while (!m_need_exit && !m_syncset.empty()) {
-					size_t time = ::time(NULL);
+							if (obj->only_append()) {
+								// suffix-only flush, element stays cached
+								sync_after_append(guard, true, obj, true);
+								continue;
+							}
 
-					elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE SYNC: %p", this);
+							batch.push_back(sync_item_t());
+							sync_item_t &item = batch.back();
 
-					if (m_syncset.empty())
-						break;
+							memset(&item.id, 0, sizeof(item.id));
+							memcpy(item.id.id, obj->id().id, DNET_ID_SIZE);
+							// snapshot the data, writers may modify the buffer once the lock is dropped
+							item.data.assign(obj->data()->data(), obj->data()->data() + obj->data()->size());
+							item.user_flags = obj->user_flags();
+							item.timestamp = obj->timestamp();
 
-					sync_set_t::iterator it = m_syncset.begin();
+							batch_bytes += item.data.size();
 
-					data_t *obj = &*it;
-					if (obj->synctime() > time)
-						break;
+							obj->clear_synctime();
+							m_stats.sync_queue.fetch_sub(1, std::memory_order_relaxed);
+						}
+					}
 
-					if (obj->only_append()) {
-						sync_after_append(guard, false, obj);
+					if (batch.empty())
 						continue;
-					}
 
-					memcpy(id.id, obj->id().id, DNET_ID_SIZE);
-					data = it->data()->data();
-					user_flags = obj->user_flags();
-					timestamp = obj->timestamp();
+					/*
+					 * Flushing the batch in id order turns scattered small
+					 * backend writes into mostly sequential IO, one session
+					 * is reused for the whole batch.
+					 */
+					std::sort(batch.begin(), batch.end(), sync_item_id_less);
 
-					m_syncset.erase(it);
-					obj->clear_synctime();
+					local_session sess(m_node);
+					sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
 
-					guard.unlock();
-					dnet_oplock(m_node, &id);
+					for (std::vector<sync_item_t>::iterator it = batch.begin(); it != batch.end(); ++it) {
+						dnet_oplock(m_node, &it->id);
 
-					// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
-					sync_element(id, false, data, user_flags, timestamp);
+						// local_session always uses DNET_FLAGS_NOLOCK
+						int err = sess.write(it->id, it->data.data(), it->data.size(), it->user_flags, it->timestamp);
+						if (err) {
+							dnet_log(m_node, DNET_LOG_ERROR, "%s: CACHE: forced to sync to disk, err: %d\n",
+									dnet_dump_id_str(it->id.id), err);
+						}
 
-					dnet_opunlock(m_node, &id);
-					guard.lock();
+						dnet_opunlock(m_node, &it->id);
+					}
+
+					elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE SYNC CLEANUP: %p", this);
 
-					auto jt = m_set.find(id.id);
-					if (jt != m_set.end()) {
-						if (jt->remove_from_cache()) {
-							erase_element(&*jt);
+					for (std::vector<sync_item_t>::iterator it = batch.begin(); it != batch.end(); ++it) {
+						auto jt = m_set.find(it->id.id);
+						if (jt != m_set.end()) {
+							if (jt->remove_from_cache())
+								erase_element(&*jt);
 						}
 					}
 				}
 
+				if (!due.empty()) {
+					// exiting: push unprocessed entries back onto the wheel
+					// so the destructor finds and syncs them
+					elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE SYNC REQUEUE: %p", this);
+
+					while (!due.empty()) {
+						data_t *obj = &*due.begin();
+						due.pop_front();
+						m_syncwheel.insert(*obj, obj->synctime());
+					}
+				}
+
 				for (std::deque<struct dnet_id>::iterator it = remove.begin(); it != remove.end(); ++it) {
 					dnet_remove_local(m_node, &(*it));
 				}
 
-				sleep(1);
+				if (m_cache_size > m_max_cache_size)
+					evict();
+
+				{
+					elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE WAIT: %p", this);
+
+					if (!m_need_exit && m_cache_size <= m_max_cache_size)
+						m_wakeup.wait_for(guard.native(), std::chrono::seconds(1));
+				}
 			}
 		}
 };
 
 class cache_manager {
 	public:
-		cache_manager(struct dnet_node *n, int num = 16) {
+		cache_manager(struct dnet_node *n, int num) {
 			for (int i  = 0; i < num; ++i) {
 				m_caches.emplace_back(std::make_shared<cache_t>(n, n->cache_size / num));
 			}
@@ -904,6 +1825,56 @@ class cache_manager {
 			return -ENOTSUP;
 		}
 
+		void set_total_size(size_t total) {
+			for (auto it(m_caches.begin()), end(m_caches.end()); it != end; ++it)
+				(*it)->set_max_size(total / m_caches.size());
+		}
+
+		void export_stats(struct dnet_node *n) {
+			uint64_t hits = 0, misses = 0, evictions = 0, sync_queue = 0, bytes = 0, lock_wait = 0, hot_pins = 0;
+
+			for (auto it(m_caches.begin()), end(m_caches.end()); it != end; ++it) {
+				const cache_stats_t &st = (*it)->stats();
+
+				hits += st.hits.load(std::memory_order_relaxed);
+				misses += st.misses.load(std::memory_order_relaxed);
+				evictions += st.evictions.load(std::memory_order_relaxed);
+				sync_queue += st.sync_queue.load(std::memory_order_relaxed);
+				lock_wait += st.lock_wait_ms.load(std::memory_order_relaxed);
+				hot_pins += st.hot_pins.load(std::memory_order_relaxed);
+				bytes += (*it)->cache_size();
+			}
+
+			dnet_counter_set(n, DNET_CNTR_CACHE_HIT, 0, hits);
+			dnet_counter_set(n, DNET_CNTR_CACHE_MISS, 0, misses);
+			dnet_counter_set(n, DNET_CNTR_CACHE_EVICT, 0, evictions);
+			dnet_counter_set(n, DNET_CNTR_CACHE_SYNC_QUEUE, 0, sync_queue);
+			dnet_counter_set(n, DNET_CNTR_CACHE_BYTES, 0, bytes);
+			dnet_counter_set(n, DNET_CNTR_CACHE_LOCK_WAIT, 0, lock_wait);
+			dnet_counter_set(n, DNET_CNTR_CACHE_HOT_PIN, 0, hot_pins);
+		}
+
+		int hot_keys(struct dnet_cache_hot_key *keys, int num) {
+			std::vector<std::pair<std::string, uint64_t> > all;
+
+			for (auto it(m_caches.begin()), end(m_caches.end()); it != end; ++it)
+				(*it)->hot_keys(all);
+
+			std::sort(all.begin(), all.end(),
+					[] (const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) {
+						return a.second > b.second;
+					});
+
+			int count = std::min<int>(num, all.size());
+
+			for (int i = 0; i < count; ++i) {
+				memcpy(keys[i].id.id, all[i].first.data(), DNET_ID_SIZE);
+				keys[i].frequency = all[i].second;
+			}
+
+			return count;
+		}
+
 	private:
 		std::vector<std::shared_ptr<cache_t>> m_caches;
 
@@ -960,7 +1931,16 @@ int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dn
 					io->size = d->size() - io->offset;
 
 				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-				err = dnet_send_read_data(st, cmd, io, (char *)d->data().data() + io->offset, -1, io->offset, 0);
+				{
+					struct iovec iov;
+					iov.iov_base = d->data() + io->offset;
+					iov.iov_len = io->size;
+
+					std::shared_ptr<raw_data_t> *ref = new std::shared_ptr<raw_data_t>(d);
+					err = dnet_send_read_data_iov(st, cmd, io, &iov, 1, cache_read_data_release, ref);
+					if (err)
+						delete ref;
+				}
 				break;
 			case DNET_CMD_DEL:
 				err = cache->remove(cmd->id.id, io);
@@ -1036,8 +2016,11 @@ int dnet_cache_init(struct dnet_node *n)
 	if (!n->cache_size)
 		return 0;
 
+	if (n->flags & DNET_CFG_CACHE_HUGE_PAGES)
+		huge_page_threshold = DNET_CACHE_HUGE_PAGE_SIZE;
+
 	try {
-		n->cache = (void *)(new cache_manager(n, 16));
+		n->cache = (void *)(new cache_manager(n, n->cache_shards ? n->cache_shards : DNET_DEFAULT_CACHE_SHARDS));
 	} catch (const std::exception &e) {
 		dnet_log_raw(n, DNET_LOG_ERROR, "Could not create cache: %s\n", e.what());
 		return -ENOMEM;
@@ -1046,8 +2029,43 @@ int dnet_cache_init(struct dnet_node *n)
 	return 0;
 }
 
+int dnet_cache_set_size(struct dnet_node *n, uint64_t size)
+{
+	/* resizing can not create a cache which was disabled at startup */
+	if (!n->cache)
+		return -ENOTSUP;
+
+	((cache_manager *)n->cache)->set_total_size(size);
+	n->cache_size = size;
+
+	return 0;
+}
+
 void dnet_cache_cleanup(struct dnet_node *n)
 {
-	if (n->cache)
+	if (n->cache) {
 		delete (cache_manager *)n->cache;
+		huge_pool_cleanup();
+	}
+}
+
+void dnet_cache_stat(struct dnet_node *n)
+{
+	if (!n->cache)
+		return;
+
+	((cache_manager *)n->cache)->export_stats(n);
+}
+
+int dnet_cache_hot_keys(struct dnet_node *n, struct dnet_cache_hot_key *keys, int num)
+{
+	if (!n->cache)
+		return 0;
+
+	try {
+		return ((cache_manager *)n->cache)->hot_keys(keys, num);
+	} catch (const std::exception &e) {
+		dnet_log_raw(n, DNET_LOG_ERROR, "Failed to collect cache hot keys: %s\n", e.what());
+		return 0;
+	}
 }
@@ -0,0 +1,498 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * In-process microbenchmark for the cache subsystem.
+ *
+ * Drives cache_manager directly - no network, no real backend - with
+ * concurrent read/write/erase threads, so that shard count, object size and
+ * lifetime/sync settings can be varied and compared in seconds instead of a
+ * full cluster run. The disk sync path is served by a mocked local_session
+ * with a configurable write delay, making sync backpressure measurable
+ * without eblob.
+ *
+ * cache_manager and cache_t are private to cache.cpp by design, so the
+ * implementation is included into this translation unit and the handful of
+ * library entry points it calls are provided as mocks below instead of
+ * linking the elliptics libraries. Keep the mock list in sync with cache.cpp
+ * when adding library calls there.
+ *
+ * Reported: per-op ops/s, cumulative shard lock wait (published by
+ * export_stats() into node counters), malloc call count during the
+ * measured phase (via -Wl,--wrap=malloc, see cache/CMakeLists.txt) and the
+ * number of writes the sync path pushed to the mocked backend.
+ */
+
+#include "cache.cpp"
+
+#include <getopt.h>
+
+#include <random>
+
+using namespace ioremap::cache;
+
+/*
+ * Allocation accounting: the linker redirects malloc/free here, glibc
+ * operator new ends up in malloc as well, so container churn is counted too.
+ * calloc/realloc are not wrapped - the cache hot paths do not use them.
+ */
+extern "C" void *__real_malloc(size_t size);
+extern "C" void __real_free(void *ptr);
+
+static std::atomic<uint64_t> bench_malloc_calls(0);
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+	bench_malloc_calls.fetch_add(1, std::memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+extern "C" void __wrap_free(void *ptr)
+{
+	__real_free(ptr);
+}
+
+/*
+ * Mocked library entry points: everything cache.cpp calls outside of this
+ * translation unit. Replies are dropped, the "disk" is a counter plus an
+ * optional delay emulating backend write latency.
+ */
+static std::atomic<uint64_t> bench_sync_writes(0);
+static unsigned bench_sync_delay_us;
+
+/* referenced by the dnet_log macro; normally defined in library/log.c */
+__thread uint32_t trace_id;
+
+/*
+ * cache.cpp throws ioremap::elliptics::error and not_found_error, whose
+ * out-of-line members normally come from the cpp bindings; mirror them here
+ * (bindings/cpp/exception.cpp pulls in far more of the client library).
+ */
+namespace ioremap { namespace elliptics {
+
+error::error(int code, const std::string &message) throw() : m_errno(code), m_message(message)
+{
+}
+
+const char *error::what() const throw()
+{
+	return m_message.c_str();
+}
+
+not_found_error::not_found_error(const std::string &message) throw() : error(-ENOENT, message)
+{
+}
+
+}} /* namespace ioremap::elliptics */
+
+extern "C" void dnet_log_raw(struct dnet_node *n, int level, const char *format, ...)
+{
+	(void) n;
+	(void) level;
+	(void) format;
+}
+
+extern "C" char *dnet_cmd_string(int cmd)
+{
+	(void) cmd;
+	return (char *)"mocked";
+}
+
+extern "C" int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more)
+{
+	(void) state;
+	(void) cmd;
+	(void) odata;
+	(void) size;
+	(void) more;
+	return 0;
+}
+
+extern "C" int dnet_send_read_data_iov(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		const struct iovec *iov, int iov_num, void (* iov_free)(void *iov_priv), void *iov_priv)
+{
+	(void) state;
+	(void) cmd;
+	(void) io;
+	(void) iov;
+	(void) iov_num;
+
+	if (iov_free)
+		iov_free(iov_priv);
+	return 0;
+}
+
+extern "C" int dnet_send_file_info_ts_without_fd(void *state, struct dnet_cmd *cmd,
+		const void *data, int64_t size, struct dnet_time *timestamp)
+{
+	(void) state;
+	(void) cmd;
+	(void) data;
+	(void) size;
+	(void) timestamp;
+	return 0;
+}
+
+extern "C" int dnet_transform_node(struct dnet_node *n, const void *src, uint64_t size,
+		unsigned char *csum, int csize)
+{
+	(void) n;
+	(void) src;
+	(void) size;
+	memset(csum, 0, csize);
+	return 0;
+}
+
+extern "C" int dnet_remove_local(struct dnet_node *n, struct dnet_id *id)
+{
+	(void) n;
+	(void) id;
+	return 0;
+}
+
+extern "C" void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
+{
+	(void) n;
+	(void) key;
+}
+
+extern "C" void dnet_opunlock(struct dnet_node *n, struct dnet_id *key)
+{
+	(void) n;
+	(void) key;
+}
+
+static int bench_backend_command_handler(void *state, void *priv, struct dnet_cmd *cmd, void *data)
+{
+	(void) state;
+	(void) priv;
+	(void) cmd;
+	(void) data;
+	return -ENOENT;
+}
+
+local_session::local_session(dnet_node *node) : m_ioflags(0), m_cflags(0), m_state(NULL)
+{
+	(void) node;
+}
+
+local_session::~local_session()
+{
+}
+
+void local_session::set_ioflags(uint32_t flags)
+{
+	m_ioflags = flags;
+}
+
+ioremap::elliptics::data_pointer local_session::read(const dnet_id &id,
+		uint64_t *user_flags, dnet_time *timestamp, int *errp)
+{
+	(void) id;
+	if (user_flags)
+		*user_flags = 0;
+	if (timestamp)
+		dnet_current_time(timestamp);
+	*errp = -ENOENT;
+	return ioremap::elliptics::data_pointer();
+}
+
+int local_session::write(const dnet_id &id, const char *data, size_t size,
+		uint64_t user_flags, const dnet_time &timestamp)
+{
+	(void) id;
+	(void) data;
+	(void) user_flags;
+	(void) timestamp;
+
+	if (bench_sync_delay_us)
+		usleep(bench_sync_delay_us);
+
+	bench_sync_writes.fetch_add(1, std::memory_order_relaxed);
+	(void) size;
+	return 0;
+}
+
+ioremap::elliptics::data_pointer local_session::lookup(const dnet_cmd &cmd, int *errp)
+{
+	(void) cmd;
+	*errp = -ENOENT;
+	return ioremap::elliptics::data_pointer();
+}
+
+/*
+ * Benchmark proper.
+ */
+struct cache_bench_config {
+	int		shards;
+	uint64_t	total_size;
+	uint64_t	keys;
+	size_t		object_size;
+	size_t		lifetime;
+	int		sync_timeout;
+	int		cache_only;
+	int		readers, writers, erasers;
+	int		duration_sec;
+};
+
+struct cache_bench_stats {
+	std::atomic<uint64_t> reads, read_hits, writes, erases;
+
+	cache_bench_stats() : reads(0), read_hits(0), writes(0), erases(0) {}
+};
+
+static std::atomic<bool> bench_stop(false);
+
+static void bench_fill_id(unsigned char *id, uint64_t key)
+{
+	memset(id, 0, DNET_ID_SIZE);
+	memcpy(id, &key, sizeof(key));
+}
+
+static void cache_bench_writer(cache_manager *cache, const cache_bench_config *cfg,
+		dnet_net_state *st, cache_bench_stats *stats, int seed)
+{
+	std::mt19937_64 rnd(seed);
+	std::vector<char> data(cfg->object_size, 'c');
+
+	while (!bench_stop.load(std::memory_order_relaxed)) {
+		uint64_t key = rnd() % cfg->keys;
+
+		struct dnet_cmd cmd;
+		struct dnet_io_attr io;
+
+		memset(&cmd, 0, sizeof(cmd));
+		memset(&io, 0, sizeof(io));
+
+		bench_fill_id(cmd.id.id, key);
+		cmd.cmd = DNET_CMD_WRITE;
+
+		memcpy(io.id, cmd.id.id, DNET_ID_SIZE);
+		io.size = cfg->object_size;
+		io.start = cfg->lifetime;
+		io.flags = DNET_IO_FLAGS_CACHE | (cfg->cache_only ? DNET_IO_FLAGS_CACHE_ONLY : 0);
+
+		cache->write(cmd.id.id, st, &cmd, &io, data.data());
+		stats->writes.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+static void cache_bench_reader(cache_manager *cache, const cache_bench_config *cfg,
+		cache_bench_stats *stats, int seed)
+{
+	std::mt19937_64 rnd(seed);
+
+	while (!bench_stop.load(std::memory_order_relaxed)) {
+		uint64_t key = rnd() % cfg->keys;
+
+		struct dnet_cmd cmd;
+		struct dnet_io_attr io;
+
+		memset(&cmd, 0, sizeof(cmd));
+		memset(&io, 0, sizeof(io));
+
+		bench_fill_id(cmd.id.id, key);
+		cmd.cmd = DNET_CMD_READ;
+
+		memcpy(io.id, cmd.id.id, DNET_ID_SIZE);
+		io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+
+		if (cache->read(cmd.id.id, &cmd, &io))
+			stats->read_hits.fetch_add(1, std::memory_order_relaxed);
+		stats->reads.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+static void cache_bench_eraser(cache_manager *cache, const cache_bench_config *cfg,
+		cache_bench_stats *stats, int seed)
+{
+	std::mt19937_64 rnd(seed);
+
+	while (!bench_stop.load(std::memory_order_relaxed)) {
+		uint64_t key = rnd() % cfg->keys;
+
+		struct dnet_io_attr io;
+		unsigned char id[DNET_ID_SIZE];
+
+		memset(&io, 0, sizeof(io));
+		bench_fill_id(id, key);
+		memcpy(io.id, id, DNET_ID_SIZE);
+		io.flags = DNET_IO_FLAGS_CACHE;
+
+		cache->remove(id, &io);
+		stats->erases.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+static void cache_bench_usage(const char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -c num   - cache shards (default %d)\n"
+			"  -S bytes - total cache size (default 256 MB)\n"
+			"  -k num   - keyspace size (default 100000)\n"
+			"  -s bytes - object size (default 100)\n"
+			"  -L sec   - object lifetime, 0 - infinite (default 0)\n"
+			"  -y sec   - sync timeout for non cache-only writes (default 5)\n"
+			"  -o       - cache-only writes, disables the sync path\n"
+			"  -D us    - mocked backend write delay in the sync path (default 0)\n"
+			"  -R num   - reader threads (default 2)\n"
+			"  -W num   - writer threads (default 2)\n"
+			"  -E num   - eraser threads (default 0)\n"
+			"  -T sec   - run time (default 10)\n"
+			, p, DNET_DEFAULT_CACHE_SHARDS);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	cache_bench_config cfg;
+	int ch;
+
+	cfg.shards = DNET_DEFAULT_CACHE_SHARDS;
+	cfg.total_size = 256ULL * 1024 * 1024;
+	cfg.keys = 100000;
+	cfg.object_size = 100;
+	cfg.lifetime = 0;
+	cfg.sync_timeout = 5;
+	cfg.cache_only = 0;
+	cfg.readers = 2;
+	cfg.writers = 2;
+	cfg.erasers = 0;
+	cfg.duration_sec = 10;
+
+	while ((ch = getopt(argc, argv, "c:S:k:s:L:y:oD:R:W:E:T:h")) != -1) {
+		switch (ch) {
+			case 'c':
+				cfg.shards = atoi(optarg);
+				break;
+			case 'S':
+				cfg.total_size = strtoull(optarg, NULL, 0);
+				break;
+			case 'k':
+				cfg.keys = strtoull(optarg, NULL, 0);
+				break;
+			case 's':
+				cfg.object_size = strtoull(optarg, NULL, 0);
+				break;
+			case 'L':
+				cfg.lifetime = atoi(optarg);
+				break;
+			case 'y':
+				cfg.sync_timeout = atoi(optarg);
+				break;
+			case 'o':
+				cfg.cache_only = 1;
+				break;
+			case 'D':
+				bench_sync_delay_us = atoi(optarg);
+				break;
+			case 'R':
+				cfg.readers = atoi(optarg);
+				break;
+			case 'W':
+				cfg.writers = atoi(optarg);
+				break;
+			case 'E':
+				cfg.erasers = atoi(optarg);
+				break;
+			case 'T':
+				cfg.duration_sec = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				cache_bench_usage(argv[0]);
+		}
+	}
+
+	if (cfg.shards < 1 || !cfg.keys || !cfg.object_size || cfg.duration_sec < 1 ||
+			cfg.readers < 0 || cfg.writers < 0 || cfg.erasers < 0 ||
+			cfg.readers + cfg.writers + cfg.erasers == 0)
+		cache_bench_usage(argv[0]);
+
+	struct dnet_backend_callbacks cb;
+	memset(&cb, 0, sizeof(cb));
+	cb.command_handler = bench_backend_command_handler;
+
+	struct dnet_node *n = (struct dnet_node *)calloc(1, sizeof(struct dnet_node));
+	struct dnet_net_state *st = (struct dnet_net_state *)calloc(1, sizeof(struct dnet_net_state));
+	if (!n || !st)
+		return -ENOMEM;
+
+	dnet_lock_init(&n->counters_lock);
+	n->cache_size = cfg.total_size;
+	n->cache_shards = cfg.shards;
+	n->cache_sync_timeout = cfg.sync_timeout;
+	n->cb = &cb;
+	st->n = n;
+
+	cache_manager *cache = new cache_manager(n, cfg.shards);
+
+	fprintf(stderr, "running: %d shards, %d readers, %d writers, %d erasers, "
+			"%zu byte objects, %s, %d sec\n",
+			cfg.shards, cfg.readers, cfg.writers, cfg.erasers, cfg.object_size,
+			cfg.cache_only ? "cache-only" : "sync enabled", cfg.duration_sec);
+
+	cache_bench_stats stats;
+	std::vector<std::thread> threads;
+	int seed = 0;
+
+	uint64_t malloc_start = bench_malloc_calls.load(std::memory_order_relaxed);
+
+	for (ch = 0; ch < cfg.writers; ++ch)
+		threads.emplace_back(cache_bench_writer, cache, &cfg, st, &stats, seed++);
+	for (ch = 0; ch < cfg.readers; ++ch)
+		threads.emplace_back(cache_bench_reader, cache, &cfg, &stats, seed++);
+	for (ch = 0; ch < cfg.erasers; ++ch)
+		threads.emplace_back(cache_bench_eraser, cache, &cfg, &stats, seed++);
+
+	sleep(cfg.duration_sec);
+	bench_stop.store(true, std::memory_order_relaxed);
+
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	uint64_t malloc_calls = bench_malloc_calls.load(std::memory_order_relaxed) - malloc_start;
+
+	/* export_stats() publishes shard stats into n->counters */
+	cache->export_stats(n);
+
+	double seconds = cfg.duration_sec;
+	uint64_t reads = stats.reads.load();
+	uint64_t writes = stats.writes.load();
+	uint64_t erases = stats.erases.load();
+
+	printf("reads:  %llu (%llu hits), %.0f ops/s\n",
+			(unsigned long long)reads,
+			(unsigned long long)stats.read_hits.load(), reads / seconds);
+	printf("writes: %llu, %.0f ops/s\n", (unsigned long long)writes, writes / seconds);
+	if (cfg.erasers)
+		printf("erases: %llu, %.0f ops/s\n", (unsigned long long)erases, erases / seconds);
+	printf("lock wait: %lld ms total across shards\n",
+			(long long)n->counters[DNET_CNTR_CACHE_LOCK_WAIT].count);
+	printf("cache: %lld bytes, %lld evictions, sync queue: %lld\n",
+			(long long)n->counters[DNET_CNTR_CACHE_BYTES].count,
+			(long long)n->counters[DNET_CNTR_CACHE_EVICT].count,
+			(long long)n->counters[DNET_CNTR_CACHE_SYNC_QUEUE].count);
+	printf("mallocs: %llu (%.2f per op)\n", (unsigned long long)malloc_calls,
+			malloc_calls / (double)(reads + writes + erases ? reads + writes + erases : 1));
+	printf("backend sync writes: %llu\n", (unsigned long long)bench_sync_writes.load());
+
+	delete cache;
+	dnet_lock_destroy(&n->counters_lock);
+	free(st);
+	free(n);
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+# Check whether the compiler can generate AVX2 code per-function
+
+include(CheckCSourceCompiles)
+
+check_c_source_compiles("#include <immintrin.h>
+__attribute__((target(\"avx2\"))) static int avx2_probe(void)
+{
+    __m256i x = _mm256_set1_epi64x(1);
+    x = _mm256_add_epi64(x, x);
+    return _mm256_extract_epi32(x, 0);
+}
+int main()
+{
+    if (!__builtin_cpu_supports(\"avx2\"))
+        return 0;
+    return avx2_probe();
+}" HAVE_AVX2_SUPPORT)
+
+if(HAVE_AVX2_SUPPORT)
+    add_definitions(-DHAVE_AVX2_SUPPORT=1)
+    message(STATUS "AVX2 support: runtime dispatch")
+else()
+    message(STATUS "AVX2 support: no support")
+endif()
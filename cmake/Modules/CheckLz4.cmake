@@ -0,0 +1,28 @@
+# Check whether liblz4 is available
+
+include(CheckCSourceCompiles)
+
+find_library(LZ4_LIBRARY lz4)
+
+if (LZ4_LIBRARY)
+    SET(CMAKE_REQUIRED_LIBRARIES "${LZ4_LIBRARY}")
+    check_c_source_compiles("#include <lz4.h>
+int main()
+{
+    char src[64], dst[128];
+    int err = LZ4_compress_default(src, dst, sizeof(src), sizeof(dst));
+    if (err <= 0)
+        return 1;
+    return LZ4_decompress_safe(dst, src, err, sizeof(src)) <= 0;
+}" HAVE_LZ4_SUPPORT)
+    unset(CMAKE_REQUIRED_LIBRARIES)
+endif()
+
+if(HAVE_LZ4_SUPPORT)
+    add_definitions(-DHAVE_LZ4_SUPPORT=1)
+    set(LZ4_LIBRARIES ${LZ4_LIBRARY})
+    message(STATUS "LZ4 support: liblz4")
+else()
+    set(LZ4_LIBRARIES)
+    message(STATUS "LZ4 support: no support, cache compression tier disabled")
+endif()
@@ -0,0 +1,27 @@
+# Check whether libnuma is available
+
+include(CheckCSourceCompiles)
+
+find_library(NUMA_LIBRARY numa)
+
+if (NUMA_LIBRARY)
+    SET(CMAKE_REQUIRED_LIBRARIES "${NUMA_LIBRARY}")
+    check_c_source_compiles("#include <numa.h>
+int main()
+{
+    if (numa_available() < 0)
+        return 0;
+    numa_run_on_node(0);
+    return numa_max_node();
+}" HAVE_NUMA_SUPPORT)
+    unset(CMAKE_REQUIRED_LIBRARIES)
+endif()
+
+if(HAVE_NUMA_SUPPORT)
+    add_definitions(-DHAVE_NUMA_SUPPORT=1)
+    set(NUMA_LIBRARIES ${NUMA_LIBRARY})
+    message(STATUS "NUMA support: libnuma")
+else()
+    set(NUMA_LIBRARIES)
+    message(STATUS "NUMA support: no support")
+endif()
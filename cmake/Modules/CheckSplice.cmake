@@ -0,0 +1,23 @@
+# Check whether splice() is supported
+
+include(CheckCSourceCompiles)
+
+if (UNIX OR MINGW)
+    SET(CMAKE_REQUIRED_DEFINITIONS "-D_GNU_SOURCE -Werror-implicit-function-declaration")
+endif()
+
+check_c_source_compiles("#define _GNU_SOURCE
+#include <fcntl.h>
+int main()
+{
+    splice(0, (void *)0, 1, (void *)0, 0, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    return 0;
+}" HAVE_SPLICE_SUPPORT)
+unset(CMAKE_REQUIRED_DEFINITIONS)
+
+if(HAVE_SPLICE_SUPPORT)
+    add_definitions(-DHAVE_SPLICE_SUPPORT=1)
+    message(STATUS "Splice support: Linux splice()")
+else()
+    message(STATUS "Splice support: no support")
+endif()
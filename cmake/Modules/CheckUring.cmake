@@ -0,0 +1,24 @@
+# Check whether liburing is available for the io_uring network engine
+
+include(CheckCSourceCompiles)
+
+find_library(URING_LIBRARIES NAMES uring)
+if(URING_LIBRARIES)
+    set(CMAKE_REQUIRED_LIBRARIES ${URING_LIBRARIES})
+    check_c_source_compiles("#include <liburing.h>
+int main()
+{
+    struct io_uring ring;
+    io_uring_queue_init(64, &ring, 0);
+    return 0;
+}" HAVE_URING_SUPPORT)
+    unset(CMAKE_REQUIRED_LIBRARIES)
+endif()
+
+if(HAVE_URING_SUPPORT)
+    add_definitions(-DHAVE_URING_SUPPORT=1)
+    message(STATUS "io_uring support: liburing")
+else()
+    set(URING_LIBRARIES "")
+    message(STATUS "io_uring support: no support")
+endif()
@@ -51,6 +51,11 @@ public:
 	bulk_read(const std::string &collection, const std::vector<std::string> &keys) {
 		return call<io::elliptics::bulk_read>(collection, keys);
 	}
+
+	service_traits<io::elliptics::bulk_write>::future_type
+	bulk_write(const std::string &collection, const std::vector<std::string> &keys, const std::vector<std::string> &blobs) {
+		return call<io::elliptics::bulk_write>(collection, keys, blobs);
+	}
 };
 
 }} // namespace cocaine::framework
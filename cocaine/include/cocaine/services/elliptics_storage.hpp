@@ -111,8 +111,8 @@ struct protocol<elliptics_tag> : public extends<storage_tag>
 	typedef boost::mpl::list<
 		elliptics::cache_read,
 		elliptics::cache_write,
-		elliptics::bulk_read
-//		elliptics::bulk_write
+		elliptics::bulk_read,
+		elliptics::bulk_write
 	> type;
 };
 
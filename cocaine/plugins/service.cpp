@@ -26,6 +26,7 @@ elliptics_service_t::elliptics_service_t(context_t &context, io::reactor_t &reac
 	on<io::elliptics::cache_read >("cache_read",  std::bind(&elliptics_service_t::cache_read,  this, _1, _2));
 	on<io::elliptics::cache_write>("cache_write", std::bind(&elliptics_service_t::cache_write, this, _1, _2, _3, _4));
 	on<io::elliptics::bulk_read  >("bulk_read",   std::bind(&elliptics_service_t::bulk_read,   this, _1, _2));
+	on<io::elliptics::bulk_write >("bulk_write",  std::bind(&elliptics_service_t::bulk_write,  this, _1, _2, _3));
 }
 
 deferred<std::string> elliptics_service_t::read(const std::string &collection, const std::string &key)
@@ -50,13 +51,20 @@ deferred<void> elliptics_service_t::write(const std::string &collection, const s
 	return promise;
 }
 
-deferred<std::vector<std::string> > elliptics_service_t::find(const std::string &collection, const std::vector<std::string> &tags)
+/*
+ * find and bulk_read stream their results: every elliptics result entry
+ * is converted and written to the cocaine channel as soon as it arrives,
+ * so service memory stays bounded by a single entry and the consumer can
+ * start processing before the whole operation completes.
+ */
+streamed<std::vector<std::string> > elliptics_service_t::find(const std::string &collection, const std::vector<std::string> &tags)
 {
 	debug() << "lits, collection: " << collection << std::endl;
-	deferred<std::vector<std::string> > promise;
+	streamed<std::vector<std::string> > promise;
 
-	m_elliptics->async_find(collection, tags).connect(std::bind(&elliptics_service_t::on_find_completed,
-		promise, _1, _2));
+	m_elliptics->async_find(collection, tags).connect(
+		std::bind(&elliptics_service_t::on_find_entry, promise, _1),
+		std::bind(&elliptics_service_t::on_find_finished, promise, _1));
 
 	return promise;
 }
@@ -93,13 +101,14 @@ deferred<void> elliptics_service_t::cache_write(const std::string &collection, c
 	return promise;
 }
 
-deferred<std::map<std::string, std::string> > elliptics_service_t::bulk_read(const std::string &collection, const std::vector<std::string> &keys)
+streamed<std::map<std::string, std::string> > elliptics_service_t::bulk_read(const std::string &collection, const std::vector<std::string> &keys)
 {
-	deferred<std::map<std::string, std::string> > promise;
+	streamed<std::map<std::string, std::string> > promise;
 
 	auto result = m_elliptics->async_bulk_read(collection, keys);
-	result.first.connect(std::bind(&elliptics_service_t::on_bulk_read_completed,
-		promise, std::move(result.second), _1, _2));
+	result.first.connect(
+		std::bind(&elliptics_service_t::on_bulk_read_entry, promise, std::move(result.second), _1),
+		std::bind(&elliptics_service_t::on_bulk_read_finished, promise, _1));
 
 	return promise;
 }
@@ -107,13 +116,16 @@ deferred<std::map<std::string, std::string> > elliptics_service_t::bulk_read(con
 deferred<std::map<std::string, int> > elliptics_service_t::bulk_write(const std::string &collection, const std::vector<std::string> &keys,
 	const std::vector<std::string> &blobs)
 {
-	(void) collection;
-	(void) keys;
-	(void) blobs;
-
 	deferred<std::map<std::string, int> > promise;
 
-	promise.abort(ENOTSUP, "Not supported yet");
+	if (keys.size() != blobs.size()) {
+		promise.abort(EINVAL, "Keys and blobs counts mismatch");
+		return promise;
+	}
+
+	auto result = m_elliptics->async_bulk_write(collection, keys, blobs);
+	result.first.connect(std::bind(&elliptics_service_t::on_bulk_write_completed,
+		promise, std::move(result.second), _1, _2));
 
 	return promise;
 }
@@ -140,14 +152,25 @@ void elliptics_service_t::on_write_completed(deferred<void> promise,
 	}
 }
 
-void elliptics_service_t::on_find_completed(deferred<std::vector<std::string> > promise,
-	const ioremap::elliptics::sync_find_indexes_result &result,
+void elliptics_service_t::on_find_entry(streamed<std::vector<std::string> > promise,
+	const ioremap::elliptics::find_indexes_result_entry &entry)
+{
+	std::vector<std::string> chunk;
+
+	for (auto it = entry.indexes.begin(); it != entry.indexes.end(); ++it) {
+		chunk.push_back(it->data.to_string());
+	}
+
+	promise.write(chunk);
+}
+
+void elliptics_service_t::on_find_finished(streamed<std::vector<std::string> > promise,
 	const ioremap::elliptics::error_info &error)
 {
 	if (error) {
 		promise.abort(-error.code(), error.message());
 	} else {
-		promise.write(storage::elliptics_storage_t::convert_list_result(result));
+		promise.close();
 	}
 }
 
@@ -162,43 +185,69 @@ void elliptics_service_t::on_remove_completed(deferred<void> promise,
 	}
 }
 
-void elliptics_service_t::on_bulk_read_completed(deferred<std::map<std::string, std::string> > promise,
+void elliptics_service_t::on_bulk_read_entry(streamed<std::map<std::string, std::string> > promise,
 	const key_name_map &keys,
-	const ioremap::elliptics::sync_read_result &result,
-	const ioremap::elliptics::error_info &error)
+	const ioremap::elliptics::read_result_entry &entry)
 {
-	if (error) {
-		promise.abort(-error.code(), error.message());
-	} else {
-		std::map<std::string, std::string> read_result;
+	const auto &id = reinterpret_cast<const dnet_raw_id &>(entry.command()->id);
 
-		for (size_t i = 0; i < result.size(); ++i) {
-			const auto &entry = result[i];
-			const auto &id = reinterpret_cast<const dnet_raw_id &>(entry.command()->id);
+	auto it = keys.find(id);
 
-			auto it = keys.find(id);
+	if (it == keys.end()) {
+		return;
+	}
 
-			if (it == keys.end()) {
-				continue;
-			}
+	std::map<std::string, std::string> chunk;
+	chunk[it->second] = entry.file().to_string();
 
-			read_result[it->second] = entry.file().to_string();
-		}
+	promise.write(chunk);
+}
 
-		promise.write(read_result);
+void elliptics_service_t::on_bulk_read_finished(streamed<std::map<std::string, std::string> > promise,
+	const ioremap::elliptics::error_info &error)
+{
+	if (error) {
+		promise.abort(-error.code(), error.message());
+	} else {
+		promise.close();
 	}
 }
 
-// Not implemented yet
 void elliptics_service_t::on_bulk_write_completed(deferred<std::map<std::string, int> > promise,
 	const key_name_map &keys,
 	const ioremap::elliptics::sync_write_result &result,
 	const ioremap::elliptics::error_info &error)
 {
-	(void) promise;
-	(void) keys;
-	(void) result;
-	(void) error;
+	if (error && result.empty()) {
+		promise.abort(-error.code(), error.message());
+		return;
+	}
+
+	std::map<std::string, int> write_result;
+
+	// Keys which receive no reply at all are reported as disconnected
+	for (auto it = keys.begin(); it != keys.end(); ++it) {
+		write_result[it->second] = ENXIO;
+	}
+
+	for (size_t i = 0; i < result.size(); ++i) {
+		const auto &entry = result[i];
+		const auto &id = reinterpret_cast<const dnet_raw_id &>(entry.command()->id);
+
+		auto it = keys.find(id);
+
+		if (it == keys.end()) {
+			continue;
+		}
+
+		// A key is written if at least one group stored it,
+		// otherwise the last error is reported
+		int &status = write_result[it->second];
+		if (status)
+			status = -entry.status();
+	}
+
+	promise.write(write_result);
 }
 
 }
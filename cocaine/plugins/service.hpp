@@ -6,6 +6,7 @@
 #include <cocaine/api/service.hpp>
 #include <cocaine/messages.hpp>
 #include <cocaine/rpc/slots/deferred.hpp>
+#include <cocaine/rpc/slots/streamed.hpp>
 #include "storage.hpp"
 
 namespace cocaine {
@@ -20,12 +21,12 @@ class elliptics_service_t : public api::service_t
 
 		deferred<std::string> read(const std::string &collection, const std::string &key);
 		deferred<void> write(const std::string &collection, const std::string &key, const std::string &blob, const std::vector<std::string> &tags);
-		deferred<std::vector<std::string> > find(const std::string &collection, const std::vector<std::string> &tags);
+		streamed<std::vector<std::string> > find(const std::string &collection, const std::vector<std::string> &tags);
 		deferred<void> remove(const std::string &collection, const std::string &key);
 		deferred<std::string> cache_read(const std::string &collection, const std::string &key);
 		deferred<void> cache_write(const std::string &collection, const std::string &key,
 			const std::string &blob, int timeout);
-		deferred<std::map<std::string, std::string> > bulk_read(const std::string &collection, const std::vector<std::string> &keys);
+		streamed<std::map<std::string, std::string> > bulk_read(const std::string &collection, const std::vector<std::string> &keys);
 		deferred<std::map<std::string, int> > bulk_write(const std::string &collection, const std::vector<std::string> &keys,
 			const std::vector<std::string> &blob);
 
@@ -38,15 +39,17 @@ class elliptics_service_t : public api::service_t
 		static void on_write_completed(deferred<void> promise,
 			const ioremap::elliptics::sync_write_result &result,
 			const ioremap::elliptics::error_info &error);
-		static void on_find_completed(deferred<std::vector<std::string> > promise,
-			const ioremap::elliptics::sync_find_indexes_result &result,
+		static void on_find_entry(streamed<std::vector<std::string> > promise,
+			const ioremap::elliptics::find_indexes_result_entry &entry);
+		static void on_find_finished(streamed<std::vector<std::string> > promise,
 			const ioremap::elliptics::error_info &error);
 		static void on_remove_completed(deferred<void> promise,
 			const ioremap::elliptics::sync_remove_result &result,
 			const ioremap::elliptics::error_info &error);
-		static void on_bulk_read_completed(deferred<std::map<std::string, std::string> > promise,
+		static void on_bulk_read_entry(streamed<std::map<std::string, std::string> > promise,
 			const key_name_map &keys,
-			const ioremap::elliptics::sync_read_result &result,
+			const ioremap::elliptics::read_result_entry &entry);
+		static void on_bulk_read_finished(streamed<std::map<std::string, std::string> > promise,
 			const ioremap::elliptics::error_info &error);
 		static void on_bulk_write_completed(deferred<std::map<std::string, int> > promise,
 			const key_name_map &keys,
@@ -392,8 +392,8 @@ std::pair<ioremap::elliptics::async_read_result, elliptics_storage_t::key_name_m
 	return std::make_pair(session.bulk_read(keys), std::move(keys_map));
 }
 
-ioremap::elliptics::async_write_result elliptics_storage_t::async_bulk_write(const std::string &collection, const std::vector<std::string> &keys,
-	const std::vector<std::string> &blobs)
+std::pair<ioremap::elliptics::async_write_result, elliptics_storage_t::key_name_map> elliptics_storage_t::async_bulk_write(
+	const std::string &collection, const std::vector<std::string> &keys, const std::vector<std::string> &blobs)
 {
 	COCAINE_LOG_DEBUG(
 		m_log,
@@ -408,8 +408,11 @@ ioremap::elliptics::async_write_result elliptics_storage_t::async_bulk_write(con
 	std::vector<dnet_io_attr> ios;
 	ios.reserve(blobs.size());
 
+	key_name_map keys_map;
+
 	dnet_io_attr io;
 	dnet_id id;
+	dnet_raw_id raw;
 	memset(&io, 0, sizeof(io));
 	dnet_empty_time(&io.timestamp);
 	memset(&id, 0, sizeof(id));
@@ -417,13 +420,15 @@ ioremap::elliptics::async_write_result elliptics_storage_t::async_bulk_write(con
 	for (size_t i = 0; i < blobs.size(); ++i) {
 		session.transform(keys[i], id);
 		memcpy(io.id, id.id, sizeof(io.id));
+		memcpy(raw.id, id.id, sizeof(raw.id));
+		keys_map[raw] = keys[i];
 
 		io.size = blobs[i].size();
 
 		ios.push_back(io);
 	}
 
-	return session.bulk_write(ios, blobs);
+	return std::make_pair(session.bulk_write(ios, blobs), std::move(keys_map));
 }
 
 std::vector<std::string> elliptics_storage_t::convert_list_result(const ioremap::elliptics::sync_find_indexes_result &result)
@@ -77,8 +77,8 @@ class elliptics_storage_t : public api::storage_t
 		ioremap::elliptics::async_write_result async_cache_write(const std::string &collection, const std::string &key,
 			const std::string &blob, int timeout);
 		std::pair<ioremap::elliptics::async_read_result, key_name_map> async_bulk_read(const std::string &collection, const std::vector<std::string> &keys);
-		ioremap::elliptics::async_write_result async_bulk_write(const std::string &collection, const std::vector<std::string> &keys,
-			const std::vector<std::string> &blobs);
+		std::pair<ioremap::elliptics::async_write_result, key_name_map> async_bulk_write(const std::string &collection,
+			const std::vector<std::string> &keys, const std::vector<std::string> &blobs);
 
 		static std::vector<std::string> convert_list_result(const ioremap::elliptics::sync_find_indexes_result &result);
 
@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -150,11 +151,10 @@ static int backend_vm_stat(struct dnet_stat *st __unused)
 }
 #endif
 
-int backend_stat_low_level(const char *path, struct dnet_stat *st)
+static int backend_stat_fill(const char *path, struct dnet_stat *st)
 {
 	struct statvfs s;
 	int err;
-	float la[3];
 
 	err = statvfs(path, &s);
 	if (err) {
@@ -176,9 +176,142 @@ int backend_stat_low_level(const char *path, struct dnet_stat *st)
 	st->flag = s.f_flag;
 	st->namemax = s.f_namemax;
 
-	err = backend_vm_stat(st);
-	if (err)
-		return err;
+	return backend_vm_stat(st);
+}
+
+/*
+ * Cached filesystem and VM statistics.
+ *
+ * Monitoring tends to poll every node about once a second and both statvfs()
+ * and the /proc reads above serialize with IO. When a backend enables the
+ * cache, a background thread refreshes a snapshot every @interval seconds and
+ * stat requests copy it without taking any locks: the sampler fills the
+ * inactive half of a double buffer and flips @idx afterwards, readers load
+ * @idx once and copy that half. A reader can only race with the sampler if it
+ * stalls for two full refresh intervals inside a memcpy() of a few hundred
+ * bytes, which does not happen with second-scale intervals.
+ *
+ * The snapshot is stored unconverted, @stat_age_ms is patched in per request
+ * before dnet_convert_stat().
+ *
+ * A node runs a single backend, so the cache does not compare the requested
+ * path against the sampled one: every stat request refers to the same mount
+ * point and the VM counters are global anyway.
+ */
+struct backend_stat_cache {
+	pthread_t		tid;
+	int			started;
+	int			need_exit;
+	int			interval;	/* refresh interval, seconds */
+	char			*path;
+	volatile int		idx;		/* published buffer, -1 until the first sample */
+	struct dnet_stat	st[2];
+	struct dnet_time	time[2];
+};
+
+static struct backend_stat_cache backend_stat_global = { .idx = -1 };
+
+static void *backend_stat_cache_sampler(void *arg)
+{
+	struct backend_stat_cache *cache = arg;
+	struct dnet_stat st;
+	int next, err, i;
+
+	while (!cache->need_exit) {
+		memset(&st, 0, sizeof(struct dnet_stat));
+
+		err = backend_stat_fill(cache->path, &st);
+		if (!err) {
+			next = (cache->idx + 1) & 1;
+			cache->st[next] = st;
+			dnet_current_time(&cache->time[next]);
+
+			/* Publish the buffer only after it is fully written */
+			__sync_synchronize();
+			cache->idx = next;
+		}
+
+		for (i = 0; i < cache->interval && !cache->need_exit; ++i)
+			sleep(1);
+	}
+
+	return NULL;
+}
+
+int backend_stat_cache_init(const char *path, int interval)
+{
+	struct backend_stat_cache *cache = &backend_stat_global;
+	int err;
+
+	if (interval <= 0 || cache->started)
+		return 0;
+
+	cache->path = strdup(path ? path : ".");
+	if (!cache->path) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	cache->interval = interval;
+	cache->need_exit = 0;
+
+	err = pthread_create(&cache->tid, NULL, backend_stat_cache_sampler, cache);
+	if (err) {
+		err = -err;
+		dnet_backend_log(DNET_LOG_ERROR, "Failed to start statistics sampler for '%s': %s [%d].\n",
+				cache->path, strerror(-err), -err);
+		goto err_out_free;
+	}
+
+	cache->started = 1;
+	dnet_backend_log(DNET_LOG_INFO, "Started statistics sampler for '%s', refresh interval: %d seconds.\n",
+			cache->path, cache->interval);
+	return 0;
+
+err_out_free:
+	free(cache->path);
+	cache->path = NULL;
+err_out_exit:
+	return err;
+}
+
+void backend_stat_cache_cleanup(void)
+{
+	struct backend_stat_cache *cache = &backend_stat_global;
+
+	if (!cache->started)
+		return;
+
+	cache->need_exit = 1;
+	pthread_join(cache->tid, NULL);
+
+	free(cache->path);
+	cache->path = NULL;
+	cache->started = 0;
+	cache->idx = -1;
+}
+
+int backend_stat_low_level(const char *path, struct dnet_stat *st)
+{
+	struct backend_stat_cache *cache = &backend_stat_global;
+	struct dnet_time now;
+	float la[3];
+	int err, idx;
+
+	idx = cache->idx;
+	if (cache->started && idx >= 0) {
+		*st = cache->st[idx];
+
+		dnet_current_time(&now);
+		st->stat_age_ms = (now.tsec - cache->time[idx].tsec) * 1000 +
+			((int64_t)now.tnsec - (int64_t)cache->time[idx].tnsec) / 1000000;
+	} else {
+		err = backend_stat_fill(path, st);
+		if (err)
+			return err;
+
+		st->stat_age_ms = 0;
+	}
 
 	la[0] = (float)st->la[0] / 100.0;
 	la[1] = (float)st->la[1] / 100.0;
@@ -207,6 +340,8 @@ int backend_stat(void *state, char *path, struct dnet_cmd *cmd)
 	if (err)
 		return err;
 
+	dnet_fill_queue_stat(state, &st);
+
 	return dnet_send_reply(state, cmd, &st, sizeof(struct dnet_stat), 0);
 }
 
@@ -88,6 +88,12 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cur_cfg_data->cfg_state.stall_count = value;
 	else if (!strcmp(key, "join"))
 		dnet_cur_cfg_data->cfg_state.flags |= value ? DNET_CFG_JOIN_NETWORK : 0;
+	else if (!strcmp(key, "cache_compress"))
+		dnet_cur_cfg_data->cfg_state.flags |= value ? DNET_CFG_CACHE_COMPRESS : 0;
+	else if (!strcmp(key, "cache_huge_pages"))
+		dnet_cur_cfg_data->cfg_state.flags |= value ? DNET_CFG_CACHE_HUGE_PAGES : 0;
+	else if (!strcmp(key, "indexes_delta_log"))
+		dnet_cur_cfg_data->cfg_state.flags |= value ? DNET_CFG_INDEXES_DELTA : 0;
 	else if (!strcmp(key, "flags"))
 		dnet_cur_cfg_data->cfg_state.flags |= (value & ~DNET_CFG_JOIN_NETWORK);
 	else if (!strcmp(key, "daemon"))
@@ -96,6 +102,14 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cur_cfg_data->cfg_state.io_thread_num = value;
 	else if (!strcmp(key, "nonblocking_io_thread_num"))
 		dnet_cur_cfg_data->cfg_state.nonblocking_io_thread_num = value;
+	else if (!strcmp(key, "io_pool_queue_shards"))
+		dnet_cur_cfg_data->cfg_state.io_pool_queue_shards = value;
+	else if (!strcmp(key, "io_thread_num_min"))
+		dnet_cur_cfg_data->cfg_state.io_thread_num_min = value;
+	else if (!strcmp(key, "io_thread_num_max"))
+		dnet_cur_cfg_data->cfg_state.io_thread_num_max = value;
+	else if (!strcmp(key, "numa_aware"))
+		dnet_cur_cfg_data->cfg_state.numa_aware = value;
 	else if (!strcmp(key, "net_thread_num"))
 		dnet_cur_cfg_data->cfg_state.net_thread_num = value;
 	else if (!strcmp(key, "bg_ionice_class"))
@@ -108,8 +122,26 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cur_cfg_data->cfg_state.server_prio = value;
 	else if (!strcmp(key, "client_net_prio"))
 		dnet_cur_cfg_data->cfg_state.client_prio = value;
+	else if (!strcmp(key, "cache_shards"))
+		dnet_cur_cfg_data->cfg_state.cache_shards = value;
+	else if (!strcmp(key, "cache_sync_batch_size"))
+		dnet_cur_cfg_data->cfg_state.cache_sync_batch_size = value;
+	else if (!strcmp(key, "cache_sync_batch_bytes"))
+		dnet_cur_cfg_data->cfg_state.cache_sync_batch_bytes = value;
+	else if (!strcmp(key, "slow_cmd_threshold"))
+		dnet_cur_cfg_data->cfg_state.slow_cmd_threshold = value;
+	else if (!strcmp(key, "monitor_port"))
+		dnet_cur_cfg_data->cfg_state.monitor_port = value;
 	else if (!strcmp(key, "indexes_shard_count"))
 		dnet_cur_cfg_data->cfg_state.indexes_shard_count = value;
+	else if (!strcmp(key, "indexes_update_window"))
+		dnet_cur_cfg_data->cfg_state.indexes_update_window = value;
+	else if (!strcmp(key, "connections_per_addr"))
+		dnet_cur_cfg_data->cfg_state.connections_per_addr = value;
+	else if (!strcmp(key, "oplock_num"))
+		dnet_cur_cfg_data->cfg_state.oplock_num = value;
+	else if (!strcmp(key, "capture_sample"))
+		dnet_cur_cfg_data->cfg_state.capture_sample = value;
 	else
 		return -1;
 
@@ -248,6 +280,26 @@ static int dnet_set_srw(struct dnet_config_backend *b __unused, char *key, char
 	return 0;
 }
 
+static int dnet_set_capture_journal(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	free(dnet_cur_cfg_data->cfg_state.capture_journal);
+	dnet_cur_cfg_data->cfg_state.capture_journal = strdup(value);
+	if (!dnet_cur_cfg_data->cfg_state.capture_journal)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int dnet_set_qos(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	free(dnet_cur_cfg_data->cfg_state.qos);
+	dnet_cur_cfg_data->cfg_state.qos = strdup(value);
+	if (!dnet_cur_cfg_data->cfg_state.qos)
+		return -ENOMEM;
+
+	return 0;
+}
+
 static int dnet_set_malloc_options(struct dnet_config_backend *b __unused, char *key __unused, char *value)
 {
 	int err, thr = atoi(value);
@@ -262,6 +314,34 @@ static int dnet_set_malloc_options(struct dnet_config_backend *b __unused, char
 	return 0;
 }
 
+static int dnet_set_net_io_engine(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	if (!strcmp(value, "epoll"))
+		dnet_cur_cfg_data->cfg_state.net_io_engine = DNET_NET_IO_ENGINE_EPOLL;
+	else if (!strcmp(value, "uring"))
+		dnet_cur_cfg_data->cfg_state.net_io_engine = DNET_NET_IO_ENGINE_URING;
+	else {
+		dnet_backend_log(DNET_LOG_ERROR, "cnf: unknown network engine '%s', use 'epoll' or 'uring'\n", value);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int dnet_set_transform(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	if (!strcmp(value, "sha512"))
+		dnet_cur_cfg_data->cfg_state.transform = DNET_TRANSFORM_SHA512;
+	else if (!strcmp(value, "fasthash"))
+		dnet_cur_cfg_data->cfg_state.transform = DNET_TRANSFORM_FASTHASH;
+	else {
+		dnet_backend_log(DNET_LOG_ERROR, "cnf: unknown transform '%s', use 'sha512' or 'fasthash'\n", value);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int dnet_set_auth_cookie(struct dnet_config_backend *b __unused, char *key __unused, char *value)
 {
 	snprintf(dnet_cur_cfg_data->cfg_state.cookie, DNET_AUTH_COOKIE_SIZE, "%s", value);
@@ -354,7 +434,13 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"history", dnet_set_history_env},
 	{"io_thread_num", dnet_simple_set},
 	{"nonblocking_io_thread_num", dnet_simple_set},
+	{"io_pool_queue_shards", dnet_simple_set},
+	{"io_thread_num_min", dnet_simple_set},
+	{"io_thread_num_max", dnet_simple_set},
+	{"numa_aware", dnet_simple_set},
 	{"net_thread_num", dnet_simple_set},
+	{"net_io_engine", dnet_set_net_io_engine},
+	{"transform", dnet_set_transform},
 	{"bg_ionice_class", dnet_simple_set},
 	{"bg_ionice_prio", dnet_simple_set},
 	{"removal_delay", dnet_simple_set},
@@ -363,7 +449,21 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"client_net_prio", dnet_simple_set},
 	{"srw_config", dnet_set_srw},
 	{"cache_size", dnet_set_cache_size},
+	{"cache_shards", dnet_simple_set},
+	{"cache_sync_batch_size", dnet_simple_set},
+	{"cache_sync_batch_bytes", dnet_simple_set},
+	{"slow_cmd_threshold", dnet_simple_set},
+	{"monitor_port", dnet_simple_set},
+	{"cache_compress", dnet_simple_set},
+	{"cache_huge_pages", dnet_simple_set},
+	{"indexes_delta_log", dnet_simple_set},
 	{"indexes_shard_count", dnet_simple_set},
+	{"indexes_update_window", dnet_simple_set},
+	{"connections_per_addr", dnet_simple_set},
+	{"oplock_num", dnet_simple_set},
+	{"capture_journal", dnet_set_capture_journal},
+	{"capture_sample", dnet_simple_set},
+	{"qos", dnet_set_qos},
 };
 
 static int dnet_set_backend(struct dnet_config_backend *current_backend __unused, char *key __unused, char *value)
@@ -407,6 +507,15 @@ int dnet_backend_register(struct dnet_config_backend *b)
 	return 0;
 }
 
+static void *dnet_backend_init_proc(void *arg)
+{
+	struct dnet_config_data *data = arg;
+
+	data->backend_init_err = data->cfg_current_backend->init(data->cfg_current_backend, &data->cfg_state);
+
+	return NULL;
+}
+
 struct dnet_node *dnet_parse_config(const char *file, int mon)
 {
 	FILE *f;
@@ -560,9 +669,23 @@ struct dnet_node *dnet_parse_config(const char *file, int mon)
 	if (dnet_cur_cfg_data->daemon_mode && !mon)
 		dnet_background();
 
-	err = dnet_cur_cfg_data->cfg_current_backend->init(dnet_cur_cfg_data->cfg_current_backend, &dnet_cur_cfg_data->cfg_state);
-	if (err)
-		goto err_out_free;
+	/*
+	 * Backend initialization (eblob open and index scan) dominates startup
+	 * on large nodes: run it concurrently with node and cache setup,
+	 * dnet_server_node_create() joins the thread before the backend is
+	 * first needed. Fall back to the old synchronous path if the thread
+	 * can not be started.
+	 */
+	err = pthread_create(&dnet_cur_cfg_data->backend_init_thread, NULL,
+			dnet_backend_init_proc, dnet_cur_cfg_data);
+	if (err) {
+		err = dnet_cur_cfg_data->cfg_current_backend->init(dnet_cur_cfg_data->cfg_current_backend, &dnet_cur_cfg_data->cfg_state);
+		if (err)
+			goto err_out_free;
+	} else {
+		dnet_cur_cfg_data->backend_init_async = 1;
+		dnet_cur_cfg_data->cfg_state.cb_deferred = 1;
+	}
 
 	fclose(f);
 	f = NULL;
@@ -591,6 +714,10 @@ err_out_node_destroy:
 	dnet_cur_cfg_data = NULL;
 	dnet_server_node_destroy(n);
 err_out_free:
+	if (dnet_cur_cfg_data && dnet_cur_cfg_data->backend_init_async) {
+		pthread_join(dnet_cur_cfg_data->backend_init_thread, NULL);
+		dnet_cur_cfg_data->backend_init_async = 0;
+	}
 	if (dnet_cur_cfg_data)
 		free(dnet_cur_cfg_data->cfg_remotes);
 
@@ -77,10 +77,70 @@ static int eblob_read_params_compare(const void *p1, const void *p2)
 	return 0;
 }
 
+/*
+ * Group commit: writes arriving within sync_window_ms of each other are
+ * acknowledged after one shared fsync instead of one fsync each. The
+ * first writer of a batch becomes the leader, sleeps out the window so
+ * concurrent writes can join, flushes every data fd the batch touched
+ * and wakes the followers. @current is the generation writes register
+ * into, @flushed is the last generation known durable.
+ */
+#define EBLOB_SYNC_BATCH_MAX_FDS	16
+
+struct eblob_sync_batch {
+	pthread_mutex_t			lock;
+	pthread_cond_t			wait;
+	int				leader_active;
+	uint64_t			current;
+	uint64_t			flushed;
+	int				fds[EBLOB_SYNC_BATCH_MAX_FDS];
+	int				fd_count;
+	int				err;
+};
+
+#define EBLOB_DEFRAG_SCHED_IDLE		0
+#define EBLOB_DEFRAG_SCHED_WAITING	1
+#define EBLOB_DEFRAG_SCHED_RUNNING	2
+
+/* consecutive one-second idle polls required before defragmentation starts */
+#define EBLOB_DEFRAG_IDLE_POLLS		3
+
+/*
+ * Load-aware defragmentation scheduler.
+ *
+ * eblob only exposes start and status calls, so the scheduler controls
+ * admission: a DNET_DEFRAG_FLAGS_SCHEDULE request parks in the waiting
+ * state and defragmentation starts only after the IO pool queues have
+ * stayed at or below @idle_queue for several consecutive one-second polls.
+ * A defragmentation already in flight can not be paused - the scheduler
+ * tracks its completion instead and exports the state and its age through
+ * DNET_CMD_STAT replies.
+ */
+struct eblob_defrag_sched {
+	pthread_mutex_t			lock;
+	pthread_cond_t			wait;
+	pthread_t			tid;
+	int				thread_started;
+	int				need_exit;
+	int				state;
+	struct dnet_time		state_time;
+	/* captured from the first scheduled defrag request */
+	struct dnet_node		*node;
+	/* queue depth at or below which the node counts as idle */
+	int				idle_queue;
+};
+
 struct eblob_backend_config {
 	struct eblob_config		data;
 	struct eblob_backend		*eblob;
 
+	int				sync_window_ms;
+	struct eblob_sync_batch		sync_batch;
+
+	struct eblob_defrag_sched	defrag_sched;
+
+	int				stat_refresh_interval;
+
 	pthread_mutex_t			last_read_lock;
 	int64_t				vm_total;		/* squared in bytes */
 	int				random_access;
@@ -88,6 +148,82 @@ struct eblob_backend_config {
 	struct eblob_read_params	last_reads[100];
 };
 
+static int blob_sync_batch_add_fd(struct eblob_sync_batch *batch, int fd)
+{
+	int i;
+
+	for (i = 0; i < batch->fd_count; ++i) {
+		if (batch->fds[i] == fd)
+			return 0;
+	}
+
+	if (batch->fd_count == EBLOB_SYNC_BATCH_MAX_FDS)
+		return -ENOSPC;
+
+	batch->fds[batch->fd_count++] = fd;
+	return 0;
+}
+
+static int blob_batch_fsync(struct eblob_backend_config *c, int fd)
+{
+	struct eblob_sync_batch *batch = &c->sync_batch;
+	int fds[EBLOB_SYNC_BATCH_MAX_FDS];
+	int fd_count, i, err;
+	uint64_t my_gen, commit_gen;
+
+	pthread_mutex_lock(&batch->lock);
+
+	if (blob_sync_batch_add_fd(batch, fd)) {
+		/* too many distinct blobs in one batch, flush this one alone */
+		pthread_mutex_unlock(&batch->lock);
+		return fsync(fd) < 0 ? -errno : 0;
+	}
+
+	my_gen = batch->current;
+
+	while (batch->flushed < my_gen) {
+		if (!batch->leader_active) {
+			batch->leader_active = 1;
+			pthread_mutex_unlock(&batch->lock);
+
+			/* batching window - let concurrent writers join this commit */
+			usleep(c->sync_window_ms * 1000);
+
+			pthread_mutex_lock(&batch->lock);
+			commit_gen = batch->current++;
+			fd_count = batch->fd_count;
+			memcpy(fds, batch->fds, fd_count * sizeof(int));
+			batch->fd_count = 0;
+			pthread_mutex_unlock(&batch->lock);
+
+			err = 0;
+			for (i = 0; i < fd_count; ++i) {
+				if (fsync(fds[i]) < 0)
+					err = -errno;
+			}
+
+			pthread_mutex_lock(&batch->lock);
+			batch->flushed = commit_gen;
+			batch->err = err;
+			batch->leader_active = 0;
+			pthread_cond_broadcast(&batch->wait);
+			continue;
+		}
+
+		pthread_cond_wait(&batch->wait, &batch->lock);
+	}
+
+	/*
+	 * This is the error of the last retired commit; a later commit may
+	 * have overwritten the one this write rode on, in which case an
+	 * unrelated flush error is reported - conservative, never the
+	 * other way around.
+	 */
+	err = batch->err;
+	pthread_mutex_unlock(&batch->lock);
+	return err;
+}
+
 /* Pre-callback that formats arguments and calls ictl->callback */
 static int blob_iterate_callback(struct eblob_disk_control *dc,
 		struct eblob_ram_control *rctl __unused,
@@ -134,6 +270,14 @@ static int blob_iterate(struct eblob_backend_config *c, struct dnet_iterator_ctl
 		.b = b,
 		.log = c->data.log,
 		.flags = EBLOB_ITERATE_FLAGS_ALL | EBLOB_ITERATE_FLAGS_READONLY,
+		/*
+		 * Walk bases in parallel: each thread iterates whole bases
+		 * sequentially, so per-base reply ordering is preserved while
+		 * the scan scales with the device queue depth. The reply path
+		 * is safe to run concurrently: sends serialize on the state
+		 * send lock, file dumps rely on O_APPEND write atomicity.
+		 */
+		.thread_num = c->data.iterate_threads > 0 ? c->data.iterate_threads : 1,
 		.iterator_cb = {
 			.iterator = blob_iterate_callback,
 		},
@@ -241,6 +385,16 @@ static int blob_write(struct eblob_backend_config *c, void *state,
 		}
 	}
 
+	if (c->sync_window_ms > 0 && wc.data_fd >= 0) {
+		err = blob_batch_fsync(c, wc.data_fd);
+		if (err) {
+			dnet_backend_log(DNET_LOG_ERROR, "%s: EBLOB: blob-write: group fsync: "
+					"fd: %d: %s %d\n", dnet_dump_id_str(io->id),
+					wc.data_fd, strerror(-err), err);
+			goto err_out_exit;
+		}
+	}
+
 	if (io->flags & DNET_IO_FLAGS_WRITE_NO_FILE_INFO) {
 		cmd->flags |= DNET_FLAGS_NEED_ACK;
 		err = 0;
@@ -398,6 +552,8 @@ static int blob_read(struct eblob_backend_config *c, void *state, struct dnet_cm
 	if (c->random_access)
 		on_close = DNET_IO_REQ_FLAGS_CACHE_FORGET;
 
+	dnet_backend_io_advise(fd, offset, size, io->flags);
+
 	err = dnet_send_read_data(state, cmd, io, NULL, fd, offset, on_close);
 
 err_out_exit:
@@ -405,6 +561,51 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Batched multi-key read: processes the whole key array in one backend
+ * invocation under the single bulk oplock, instead of re-entering
+ * command processing (lock, cache check, accounting) once per key.
+ * The generic per-key loop remains the fallback for cache-routed
+ * requests, which only the node core can serve.
+ */
+static int blob_bulk_read(struct eblob_backend_config *c, void *state, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_io_attr *io = data;
+	struct dnet_io_attr *ios = io + 1;
+	struct dnet_cmd read_cmd = *cmd;
+	uint64_t count, i;
+	int err = -1, ret;
+
+	read_cmd.size = sizeof(struct dnet_io_attr);
+	read_cmd.cmd = DNET_CMD_READ;
+	read_cmd.flags |= DNET_FLAGS_MORE;
+
+	dnet_convert_io_attr(io);
+	count = io->size / sizeof(struct dnet_io_attr);
+
+	/* cache-routed keys need the generic per-key path */
+	for (i = 0; i < count; i++) {
+		if (dnet_bswap32(ios[i].flags) & (DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY)) {
+			dnet_convert_io_attr(io);
+			return -ENOTSUP;
+		}
+	}
+
+	dnet_backend_log(DNET_LOG_NOTICE, "%s: EBLOB: blob-bulk-read: %d keys\n",
+			dnet_dump_id(&cmd->id), (int)count);
+
+	for (i = 0; i < count; i++) {
+		ret = blob_read(c, state, &read_cmd, &ios[i], 1);
+
+		if (!ret)
+			err = 0;
+		else if (err == -1)
+			err = ret;
+	}
+
+	return err;
+}
+
 struct eblob_read_range_priv {
 	void			*state;
 	struct dnet_cmd		*cmd;
@@ -461,6 +662,8 @@ static int blob_read_range_callback(struct eblob_range_request *req)
 		memcpy(io.id, req->record_key, DNET_ID_SIZE);
 		memcpy(io.parent, req->end, DNET_ID_SIZE);
 
+		dnet_backend_io_advise(req->record_fd, req->record_offset + io.offset, io.size, p->flags);
+
 		err = dnet_send_read_data(p->state, p->cmd, &io, NULL, req->record_fd,
 				req->record_offset + io.offset, 0);
 		if (!err)
@@ -645,6 +848,60 @@ static int blob_del(struct eblob_backend_config *c, struct dnet_cmd *cmd)
 	return err;
 }
 
+/*
+ * Native batched removal: loops eblob_remove() over all keys of the request
+ * and replies with one packed array of per-key statuses.
+ */
+static int blob_bulk_del(struct eblob_backend_config *c, void *state, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_io_attr *io = data;
+	struct dnet_io_attr *ios = io + 1;
+	struct dnet_bulk_del_entry *entries;
+	struct eblob_key key;
+	uint64_t count, i;
+	int err = -1, ret;
+
+	if (cmd->size < sizeof(struct dnet_io_attr))
+		return -EINVAL;
+
+	dnet_convert_io_attr(io);
+	count = io->size / sizeof(struct dnet_io_attr);
+
+	if (!count || (cmd->size < (count + 1) * sizeof(struct dnet_io_attr)))
+		return -EINVAL;
+
+	entries = malloc(count * sizeof(struct dnet_bulk_del_entry));
+	if (!entries)
+		return -ENOMEM;
+
+	for (i = 0; i < count; ++i) {
+		memcpy(key.id, ios[i].id, EBLOB_ID_SIZE);
+
+		ret = eblob_remove(c->eblob, &key);
+		if (ret) {
+			dnet_backend_log(DNET_LOG_ERROR, "%s: EBLOB: blob-bulk-del: REMOVE: %d: %s\n",
+				dnet_dump_id_str(ios[i].id), ret, strerror(-ret));
+		}
+
+		memcpy(entries[i].id, ios[i].id, DNET_ID_SIZE);
+		entries[i].status = ret;
+		memset(entries[i].reserved, 0, sizeof(entries[i].reserved));
+		dnet_convert_bulk_del_entry(&entries[i]);
+
+		if (!ret)
+			err = 0;
+		else if (err == -1)
+			err = ret;
+	}
+
+	ret = dnet_send_reply(state, cmd, entries, count * sizeof(struct dnet_bulk_del_entry), 1);
+	free(entries);
+	if (ret)
+		err = ret;
+
+	return err;
+}
+
 static int blob_file_info(struct eblob_backend_config *c, void *state, struct dnet_cmd *cmd)
 {
 	struct eblob_backend *b = c->eblob;
@@ -739,8 +996,83 @@ err_out_exit:
 	return err;
 }
 
-static int blob_start_defrag(struct eblob_backend_config *c, struct dnet_cmd *cmd, void *data)
+static void blob_defrag_sched_set_state(struct eblob_defrag_sched *sched, int state)
+{
+	sched->state = state;
+	dnet_current_time(&sched->state_time);
+}
+
+static void *blob_defrag_sched_proc(void *data)
 {
+	struct eblob_backend_config *c = data;
+	struct eblob_defrag_sched *sched = &c->defrag_sched;
+	struct timespec ts;
+	uint64_t queue;
+	int idle_polls = 0;
+	int err;
+
+	pthread_mutex_lock(&sched->lock);
+	while (!sched->need_exit) {
+		if (sched->state == EBLOB_DEFRAG_SCHED_IDLE) {
+			idle_polls = 0;
+			pthread_cond_wait(&sched->wait, &sched->lock);
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&sched->wait, &sched->lock, &ts);
+		if (sched->need_exit)
+			break;
+
+		if (sched->state == EBLOB_DEFRAG_SCHED_WAITING) {
+			/* somebody started defrag directly - just track it */
+			if (eblob_defrag_status(c->eblob) > 0) {
+				blob_defrag_sched_set_state(sched, EBLOB_DEFRAG_SCHED_RUNNING);
+				continue;
+			}
+
+			queue = sched->node ? dnet_node_io_queue_size(sched->node) : 0;
+			if (queue > (uint64_t)sched->idle_queue) {
+				idle_polls = 0;
+				continue;
+			}
+
+			if (++idle_polls < EBLOB_DEFRAG_IDLE_POLLS)
+				continue;
+
+			pthread_mutex_unlock(&sched->lock);
+			err = eblob_start_defrag(c->eblob);
+			pthread_mutex_lock(&sched->lock);
+
+			idle_polls = 0;
+			if (err) {
+				dnet_backend_log(DNET_LOG_ERROR, "DEFRAG: scheduled defragmentation failed to start: %d\n", err);
+				blob_defrag_sched_set_state(sched, EBLOB_DEFRAG_SCHED_IDLE);
+			} else {
+				dnet_backend_log(DNET_LOG_INFO, "DEFRAG: node was idle for %d seconds, starting scheduled defragmentation\n",
+						EBLOB_DEFRAG_IDLE_POLLS);
+				blob_defrag_sched_set_state(sched, EBLOB_DEFRAG_SCHED_RUNNING);
+			}
+		} else if (sched->state == EBLOB_DEFRAG_SCHED_RUNNING) {
+			pthread_mutex_unlock(&sched->lock);
+			err = eblob_defrag_status(c->eblob);
+			pthread_mutex_lock(&sched->lock);
+
+			if (err <= 0) {
+				dnet_backend_log(DNET_LOG_INFO, "DEFRAG: scheduled defragmentation completed: %d\n", err);
+				blob_defrag_sched_set_state(sched, EBLOB_DEFRAG_SCHED_IDLE);
+			}
+		}
+	}
+	pthread_mutex_unlock(&sched->lock);
+
+	return NULL;
+}
+
+static int blob_start_defrag(struct eblob_backend_config *c, void *state, struct dnet_cmd *cmd, void *data)
+{
+	struct eblob_defrag_sched *sched = &c->defrag_sched;
 	struct dnet_defrag_ctl *ctl = data;
 	int err;
 
@@ -755,6 +1087,15 @@ static int blob_start_defrag(struct eblob_backend_config *c, struct dnet_cmd *cm
 
 	if (ctl->flags & DNET_DEFRAG_FLAGS_STATUS) {
 		ctl->status = eblob_defrag_status(c->eblob);
+	} else if (ctl->flags & DNET_DEFRAG_FLAGS_SCHEDULE) {
+		pthread_mutex_lock(&sched->lock);
+		sched->node = dnet_get_node_from_state(state);
+		if (sched->state == EBLOB_DEFRAG_SCHED_IDLE)
+			blob_defrag_sched_set_state(sched, EBLOB_DEFRAG_SCHED_WAITING);
+		pthread_cond_broadcast(&sched->wait);
+		pthread_mutex_unlock(&sched->lock);
+
+		ctl->status = 0;
 	} else {
 		ctl->status = eblob_start_defrag(c->eblob);
 	}
@@ -768,6 +1109,39 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * DNET_CMD_STAT handler: generic statistics plus defragmentation scheduler
+ * progress. The statistics are already converted to wire order when
+ * backend_stat_low_level() returns, so the patched fields are swapped by
+ * hand.
+ */
+static int blob_stat(struct eblob_backend_config *c, void *state, char *path, struct dnet_cmd *cmd)
+{
+	struct eblob_defrag_sched *sched = &c->defrag_sched;
+	struct dnet_stat st;
+	struct dnet_time now;
+	int err;
+
+	if (!path)
+		path = ".";
+
+	memset(&st, 0, sizeof(struct dnet_stat));
+
+	err = backend_stat_low_level(path, &st);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&sched->lock);
+	dnet_current_time(&now);
+	st.defrag_state = dnet_bswap64(sched->state);
+	st.defrag_state_sec = dnet_bswap64(now.tsec - sched->state_time.tsec);
+	pthread_mutex_unlock(&sched->lock);
+
+	dnet_fill_queue_stat(state, &st);
+
+	return dnet_send_reply(state, cmd, &st, sizeof(struct dnet_stat), 0);
+}
+
 static int eblob_backend_command_handler(void *state, void *priv, struct dnet_cmd *cmd, void *data)
 {
 	int err;
@@ -784,6 +1158,9 @@ static int eblob_backend_command_handler(void *state, void *priv, struct dnet_cm
 		case DNET_CMD_READ:
 			err = blob_read(c, state, cmd, data, 1);
 			break;
+		case DNET_CMD_BULK_READ:
+			err = blob_bulk_read(c, state, cmd, data);
+			break;
 		case DNET_CMD_READ_RANGE:
 		case DNET_CMD_DEL_RANGE:
 			err = blob_read_range(c, state, cmd, data);
@@ -803,14 +1180,17 @@ static int eblob_backend_command_handler(void *state, void *priv, struct dnet_cm
 				path = NULL;
 			}
 
-			err = backend_stat(state, path, cmd);
+			err = blob_stat(c, state, path, cmd);
 			free(path);
 			break;
 		case DNET_CMD_DEL:
 			err = blob_del(c, cmd);
 			break;
+		case DNET_CMD_BULK_DEL:
+			err = blob_bulk_del(c, state, cmd, data);
+			break;
 		case DNET_CMD_DEFRAG:
-			err = blob_start_defrag(c, cmd, data);
+			err = blob_start_defrag(c, state, cmd, data);
 			break;
 		default:
 			err = -ENOTSUP;
@@ -828,6 +1208,22 @@ static int dnet_blob_set_sync(struct dnet_config_backend *b, char *key __unused,
 	return 0;
 }
 
+static int dnet_blob_set_sync_window(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct eblob_backend_config *c = b->data;
+
+	c->sync_window_ms = atoi(value);
+	return 0;
+}
+
+static int dnet_blob_set_stat_refresh_interval(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct eblob_backend_config *c = b->data;
+
+	c->stat_refresh_interval = atoi(value);
+	return 0;
+}
+
 static int dnet_blob_set_data(struct dnet_config_backend *b, char *key __unused, char *file)
 {
 	struct eblob_backend_config *c = b->data;
@@ -927,6 +1323,14 @@ static int dnet_blob_set_defrag_splay(struct dnet_config_backend *b, char *key _
 	return 0;
 }
 
+static int dnet_blob_set_defrag_idle_queue(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct eblob_backend_config *c = b->data;
+
+	c->defrag_sched.idle_queue = atoi(value);
+	return 0;
+}
+
 static int dnet_blob_set_defrag_percentage(struct dnet_config_backend *b, char *key __unused, char *value)
 {
 	struct eblob_backend_config *c = b->data;
@@ -980,8 +1384,23 @@ static void eblob_backend_cleanup(void *priv)
 {
 	struct eblob_backend_config *c = priv;
 
+	if (c->defrag_sched.thread_started) {
+		pthread_mutex_lock(&c->defrag_sched.lock);
+		c->defrag_sched.need_exit = 1;
+		pthread_cond_broadcast(&c->defrag_sched.wait);
+		pthread_mutex_unlock(&c->defrag_sched.lock);
+
+		pthread_join(c->defrag_sched.tid, NULL);
+	}
+
+	backend_stat_cache_cleanup();
+
 	eblob_cleanup(c->eblob);
 
+	pthread_cond_destroy(&c->defrag_sched.wait);
+	pthread_mutex_destroy(&c->defrag_sched.lock);
+	pthread_cond_destroy(&c->sync_batch.wait);
+	pthread_mutex_destroy(&c->sync_batch.lock);
 	pthread_mutex_destroy(&c->last_read_lock);
 	free(c->data.file);
 }
@@ -1013,19 +1432,76 @@ static int dnet_blob_config_init(struct dnet_config_backend *b, struct dnet_conf
 		goto err_out_exit;
 	}
 
+	err = pthread_mutex_init(&c->sync_batch.lock, NULL);
+	if (err) {
+		err = -err;
+		dnet_backend_log(DNET_LOG_ERROR, "blob: could not create sync-batch lock: %d.\n", err);
+		goto err_out_last_read_lock_destroy;
+	}
+
+	err = pthread_cond_init(&c->sync_batch.wait, NULL);
+	if (err) {
+		err = -err;
+		dnet_backend_log(DNET_LOG_ERROR, "blob: could not create sync-batch condition variable: %d.\n", err);
+		goto err_out_sync_batch_lock_destroy;
+	}
+
+	err = pthread_mutex_init(&c->defrag_sched.lock, NULL);
+	if (err) {
+		err = -err;
+		dnet_backend_log(DNET_LOG_ERROR, "blob: could not create defrag-scheduler lock: %d.\n", err);
+		goto err_out_sync_batch_destroy;
+	}
+
+	err = pthread_cond_init(&c->defrag_sched.wait, NULL);
+	if (err) {
+		err = -err;
+		dnet_backend_log(DNET_LOG_ERROR, "blob: could not create defrag-scheduler condition variable: %d.\n", err);
+		goto err_out_defrag_sched_lock_destroy;
+	}
+
+	blob_defrag_sched_set_state(&c->defrag_sched, EBLOB_DEFRAG_SCHED_IDLE);
+
+	/* generation zero is 'already flushed', writes register into generation one */
+	c->sync_batch.current = 1;
+
+	if (c->sync_window_ms > 0 && c->data.sync == 0) {
+		/*
+		 * sync=0 makes eblob fsync inside every write, which defeats
+		 * group commit - durability is provided by the shared fsync,
+		 * so switch eblob to a slow background sync instead.
+		 */
+		c->data.sync = 30;
+		dnet_backend_log(DNET_LOG_INFO, "blob: sync_window_ms is set, "
+				"overriding sync=0 with background sync every %d seconds.\n",
+				c->data.sync);
+	}
+
 	memset(&st, 0, sizeof(struct dnet_stat));
 	err = eblob_backend_storage_stat(c, &st);
 	if (err)
-		goto err_out_last_read_lock_destroy;
+		goto err_out_defrag_sched_destroy;
 
 	c->vm_total = st.vm_total * st.vm_total * 1024 * 1024;
 
 	c->eblob = eblob_init(&c->data);
 	if (!c->eblob) {
 		err = -EINVAL;
-		goto err_out_last_read_lock_destroy;
+		goto err_out_defrag_sched_destroy;
 	}
 
+	err = backend_stat_cache_init(c->data.file, c->stat_refresh_interval);
+	if (err)
+		goto err_out_eblob_cleanup;
+
+	err = pthread_create(&c->defrag_sched.tid, NULL, blob_defrag_sched_proc, c);
+	if (err) {
+		err = -err;
+		dnet_backend_log(DNET_LOG_ERROR, "blob: could not start defrag-scheduler thread: %d.\n", err);
+		goto err_out_stat_cache_cleanup;
+	}
+	c->defrag_sched.thread_started = 1;
+
 	cfg->cb = &b->cb;
 	cfg->storage_size = b->storage_size;
 	cfg->storage_free = b->storage_free;
@@ -1040,6 +1516,18 @@ static int dnet_blob_config_init(struct dnet_config_backend *b, struct dnet_conf
 
 	return 0;
 
+err_out_stat_cache_cleanup:
+	backend_stat_cache_cleanup();
+err_out_eblob_cleanup:
+	eblob_cleanup(c->eblob);
+err_out_defrag_sched_destroy:
+	pthread_cond_destroy(&c->defrag_sched.wait);
+err_out_defrag_sched_lock_destroy:
+	pthread_mutex_destroy(&c->defrag_sched.lock);
+err_out_sync_batch_destroy:
+	pthread_cond_destroy(&c->sync_batch.wait);
+err_out_sync_batch_lock_destroy:
+	pthread_mutex_destroy(&c->sync_batch.lock);
 err_out_last_read_lock_destroy:
 	pthread_mutex_destroy(&c->last_read_lock);
 err_out_exit:
@@ -1055,6 +1543,8 @@ static void dnet_blob_config_cleanup(struct dnet_config_backend *b)
 
 static struct dnet_config_entry dnet_cfg_entries_blobsystem[] = {
 	{"sync", dnet_blob_set_sync},
+	{"sync_window_ms", dnet_blob_set_sync_window},
+	{"stat_refresh_interval", dnet_blob_set_stat_refresh_interval},
 	{"data", dnet_blob_set_data},
 	{"blob_flags", dnet_blob_set_blob_flags},
 	{"iterate_thread_num", dnet_blob_set_iterate_thread_num},
@@ -1064,6 +1554,7 @@ static struct dnet_config_entry dnet_cfg_entries_blobsystem[] = {
 	{"defrag_time", dnet_blob_set_defrag_time},
 	{"defrag_splay", dnet_blob_set_defrag_splay},
 	{"defrag_percentage", dnet_blob_set_defrag_percentage},
+	{"defrag_idle_queue", dnet_blob_set_defrag_idle_queue},
 	{"blob_size_limit", dnet_blob_set_blob_size},
 	{"index_block_size", dnet_blob_set_index_block_size},
 	{"index_block_bloom_length", dnet_blob_set_index_block_bloom_length},
@@ -13,6 +13,7 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 600
 
 #include <sys/types.h>
@@ -25,6 +26,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,6 +43,39 @@
 #define __unused	__attribute__ ((unused))
 #endif
 
+/*
+ * Sharded LRU descriptor cache for the read path: repeated access to hot
+ * objects costs a dup() instead of a full open()/close() pair with its
+ * path walk and dentry churn. The cache owns its descriptors and hands
+ * out duplicates, so the network layer closes what it was given exactly
+ * as before; entries are dropped when the object file is removed, since
+ * a recreated file is a new inode the cached descriptor would miss.
+ */
+#define FILE_FD_CACHE_SHARDS		16
+
+struct file_fd_cache_entry {
+	unsigned char		id[DNET_ID_SIZE];
+	int			fd;
+	uint64_t		last_used;
+};
+
+struct file_fd_cache_shard {
+	pthread_mutex_t			lock;
+	struct file_fd_cache_entry	*entries;
+	int				capacity;
+	uint64_t			clock;
+};
+
+/*
+ * Direct IO staging: objects of at least @odirect_size bytes are written
+ * through O_DIRECT so bulk archive writes do not evict the page cache
+ * serving interactive reads. Data is staged through a small pool of
+ * page-aligned buffers, since client buffers carry no alignment guarantee.
+ */
+#define FILE_ODIRECT_ALIGN		4096
+#define FILE_ODIRECT_CHUNK		(1024 * 1024)
+#define FILE_ODIRECT_POOL_SIZE		4
+
 struct file_backend_root
 {
 	char			*root;
@@ -49,6 +84,16 @@ struct file_backend_root
 	int			sync;
 	int			bit_num;
 
+	uint64_t		odirect_size;
+	pthread_mutex_t		odirect_lock;
+	void			*odirect_bufs[FILE_ODIRECT_POOL_SIZE];
+	int			odirect_buf_count;
+
+	int			fd_cache_size;
+	struct file_fd_cache_shard	fd_cache[FILE_FD_CACHE_SHARDS];
+
+	int			stat_refresh_interval;
+
 	uint64_t		records_in_blob;
 	uint64_t		blob_size;
 	int			defrag_percentage;
@@ -89,6 +134,152 @@ static inline uint64_t file_backend_get_dir_bits(const unsigned char *id, int bi
 #endif
 }
 
+static struct file_fd_cache_shard *file_fd_cache_shard(struct file_backend_root *r, const unsigned char *id)
+{
+	return &r->fd_cache[id[0] & (FILE_FD_CACHE_SHARDS - 1)];
+}
+
+static int file_fd_cache_init(struct file_backend_root *r)
+{
+	int i, j, capacity;
+
+	if (r->fd_cache_size <= 0)
+		return 0;
+
+	capacity = (r->fd_cache_size + FILE_FD_CACHE_SHARDS - 1) / FILE_FD_CACHE_SHARDS;
+
+	for (i = 0; i < FILE_FD_CACHE_SHARDS; ++i) {
+		struct file_fd_cache_shard *shard = &r->fd_cache[i];
+
+		shard->entries = calloc(capacity, sizeof(struct file_fd_cache_entry));
+		if (!shard->entries)
+			goto err_out_free;
+
+		for (j = 0; j < capacity; ++j)
+			shard->entries[j].fd = -1;
+
+		shard->capacity = capacity;
+		pthread_mutex_init(&shard->lock, NULL);
+	}
+
+	return 0;
+
+err_out_free:
+	while (--i >= 0) {
+		pthread_mutex_destroy(&r->fd_cache[i].lock);
+		free(r->fd_cache[i].entries);
+		r->fd_cache[i].entries = NULL;
+	}
+	return -ENOMEM;
+}
+
+static void file_fd_cache_cleanup(struct file_backend_root *r)
+{
+	int i, j;
+
+	for (i = 0; i < FILE_FD_CACHE_SHARDS; ++i) {
+		struct file_fd_cache_shard *shard = &r->fd_cache[i];
+
+		if (!shard->entries)
+			continue;
+
+		for (j = 0; j < shard->capacity; ++j) {
+			if (shard->entries[j].fd >= 0)
+				close(shard->entries[j].fd);
+		}
+
+		pthread_mutex_destroy(&shard->lock);
+		free(shard->entries);
+		shard->entries = NULL;
+	}
+}
+
+/* Returns a duplicate of the cached descriptor which the caller owns, or -ENOENT */
+static int file_fd_cache_get(struct file_backend_root *r, const unsigned char *id)
+{
+	struct file_fd_cache_shard *shard = file_fd_cache_shard(r, id);
+	int i, fd = -ENOENT;
+
+	if (!shard->entries)
+		return -ENOENT;
+
+	pthread_mutex_lock(&shard->lock);
+	for (i = 0; i < shard->capacity; ++i) {
+		struct file_fd_cache_entry *e = &shard->entries[i];
+
+		if (e->fd >= 0 && !memcmp(e->id, id, DNET_ID_SIZE)) {
+			e->last_used = ++shard->clock;
+			fd = dup(e->fd);
+			if (fd < 0)
+				fd = -errno;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return fd;
+}
+
+/* Duplicates @fd into the cache, evicting the least recently used entry */
+static void file_fd_cache_put(struct file_backend_root *r, const unsigned char *id, int fd)
+{
+	struct file_fd_cache_shard *shard = file_fd_cache_shard(r, id);
+	struct file_fd_cache_entry *victim;
+	int i;
+
+	if (!shard->entries)
+		return;
+
+	fd = dup(fd);
+	if (fd < 0)
+		return;
+
+	pthread_mutex_lock(&shard->lock);
+	victim = &shard->entries[0];
+	for (i = 0; i < shard->capacity; ++i) {
+		struct file_fd_cache_entry *e = &shard->entries[i];
+
+		if (e->fd >= 0 && !memcmp(e->id, id, DNET_ID_SIZE)) {
+			victim = e;
+			break;
+		}
+		if (e->fd < 0) {
+			victim = e;
+			break;
+		}
+		if (e->last_used < victim->last_used)
+			victim = e;
+	}
+
+	if (victim->fd >= 0)
+		close(victim->fd);
+	memcpy(victim->id, id, DNET_ID_SIZE);
+	victim->fd = fd;
+	victim->last_used = ++shard->clock;
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static void file_fd_cache_invalidate(struct file_backend_root *r, const unsigned char *id)
+{
+	struct file_fd_cache_shard *shard = file_fd_cache_shard(r, id);
+	int i;
+
+	if (!shard->entries)
+		return;
+
+	pthread_mutex_lock(&shard->lock);
+	for (i = 0; i < shard->capacity; ++i) {
+		struct file_fd_cache_entry *e = &shard->entries[i];
+
+		if (e->fd >= 0 && !memcmp(e->id, id, DNET_ID_SIZE)) {
+			close(e->fd);
+			e->fd = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
 static void dnet_remove_file_if_empty_raw(char *file)
 {
 	struct stat st;
@@ -104,6 +295,7 @@ static void dnet_remove_file_if_empty(struct file_backend_root *r, struct dnet_i
 	char file[DNET_ID_SIZE * 2 + 8 + 8 + 2];
 
 	file_backend_setup_file(r, file, sizeof(file), io->id);
+	file_fd_cache_invalidate(r, io->id);
 	dnet_remove_file_if_empty_raw(file);
 }
 
@@ -112,25 +304,104 @@ static void dnet_remove_file_local(struct file_backend_root *r, struct dnet_io_a
 	char file[DNET_ID_SIZE * 2 + 8 + 8 + 2];
 
 	file_backend_setup_file(r, file, sizeof(file), io->id);
+	file_fd_cache_invalidate(r, io->id);
 	remove(file);
 }
 
+static void *file_odirect_buf_get(struct file_backend_root *r)
+{
+	void *buf = NULL;
+
+	pthread_mutex_lock(&r->odirect_lock);
+	if (r->odirect_buf_count)
+		buf = r->odirect_bufs[--r->odirect_buf_count];
+	pthread_mutex_unlock(&r->odirect_lock);
+
+	if (!buf && posix_memalign(&buf, FILE_ODIRECT_ALIGN, FILE_ODIRECT_CHUNK))
+		return NULL;
+
+	return buf;
+}
+
+static void file_odirect_buf_put(struct file_backend_root *r, void *buf)
+{
+	pthread_mutex_lock(&r->odirect_lock);
+	if (r->odirect_buf_count < FILE_ODIRECT_POOL_SIZE) {
+		r->odirect_bufs[r->odirect_buf_count++] = buf;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&r->odirect_lock);
+
+	free(buf);
+}
+
+static ssize_t file_write_odirect(struct file_backend_root *r, int fd, void *data, uint64_t size)
+{
+	uint64_t written = 0, chunk, aligned;
+	void *buf;
+	ssize_t err;
+
+	buf = file_odirect_buf_get(r);
+	if (!buf)
+		return -ENOMEM;
+
+	while (written < size) {
+		chunk = size - written;
+		if (chunk > FILE_ODIRECT_CHUNK)
+			chunk = FILE_ODIRECT_CHUNK;
+
+		aligned = ALIGN(chunk, FILE_ODIRECT_ALIGN);
+
+		memcpy(buf, data + written, chunk);
+		if (aligned > chunk)
+			memset(buf + chunk, 0, aligned - chunk);
+
+		err = pwrite(fd, buf, aligned, written);
+		if (err != (ssize_t)aligned) {
+			err = -errno;
+			goto err_out_put;
+		}
+
+		written += chunk;
+	}
+
+	/* the last block was zero-padded to the alignment, cut the file back */
+	err = ftruncate(fd, size);
+	if (err)
+		err = -errno;
+
+err_out_put:
+	file_odirect_buf_put(r, buf);
+	return err;
+}
+
 static int file_write_raw(struct file_backend_root *r, struct dnet_io_attr *io)
 {
 	/* null byte + maximum directory length (32 bits in hex) + '/' directory prefix */
 	char file[DNET_ID_SIZE * 2 + 8 + 8 + 2];
 	int oflags = O_RDWR | O_CREAT | O_LARGEFILE | O_CLOEXEC;
 	void *data = io + 1;
-	int fd;
+	int fd, odirect;
 	ssize_t err;
 
 	file_backend_setup_file(r, file, sizeof(file), io->id);
 
+	/*
+	 * Direct IO only covers whole-object writes: appends and writes
+	 * into the middle of a file keep the buffered path, their offsets
+	 * carry no alignment guarantee.
+	 */
+	odirect = r->odirect_size && (io->size >= r->odirect_size) &&
+		!(io->flags & DNET_IO_FLAGS_APPEND) && !io->offset;
+
 	if (io->flags & DNET_IO_FLAGS_APPEND)
 		oflags |= O_APPEND;
 	else if (!io->offset)
 		oflags |= O_TRUNC;
-	
+
+	if (odirect)
+		oflags |= O_DIRECT;
+
 	fd = open(file, oflags, 0644);
 	if (fd < 0) {
 		err = -errno;
@@ -139,14 +410,31 @@ static int file_write_raw(struct file_backend_root *r, struct dnet_io_attr *io)
 		goto err_out_exit;
 	}
 
-	err = pwrite(fd, data, io->size, io->offset);
-	if (err != (ssize_t)io->size) {
-		err = -errno;
-		dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: WRITE: %zd: offset: %llu, size: %llu: %s.\n",
-			dnet_dump_id_str(io->id), file, err,
-			(unsigned long long)io->offset, (unsigned long long)io->size,
-			strerror(-err));
-		goto err_out_close;
+	if (odirect) {
+		err = file_write_odirect(r, fd, data, io->size);
+		if (err == -EINVAL) {
+			/* the filesystem does not support direct IO - retry buffered */
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+			ftruncate(fd, 0);
+			odirect = 0;
+		} else if (err) {
+			dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: DIRECT-WRITE: %zd: size: %llu: %s.\n",
+				dnet_dump_id_str(io->id), file, err,
+				(unsigned long long)io->size, strerror(-err));
+			goto err_out_close;
+		}
+	}
+
+	if (!odirect) {
+		err = pwrite(fd, data, io->size, io->offset);
+		if (err != (ssize_t)io->size) {
+			err = -errno;
+			dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: WRITE: %zd: offset: %llu, size: %llu: %s.\n",
+				dnet_dump_id_str(io->id), file, err,
+				(unsigned long long)io->offset, (unsigned long long)io->size,
+				strerror(-err));
+			goto err_out_close;
+		}
 	}
 
 	if (!r->sync)
@@ -251,12 +539,17 @@ static int file_read(struct file_backend_root *r, void *state, struct dnet_cmd *
 
 	file_backend_setup_file(r, file, sizeof(file), io->id);
 
-	fd = open(file, O_RDONLY | O_CLOEXEC, 0644);
+	fd = file_fd_cache_get(r, io->id);
 	if (fd < 0) {
-		err = -errno;
-		dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: READ: %d: %s.\n",
-				dnet_dump_id(&cmd->id), file, err, strerror(-err));
-		goto err_out_exit;
+		fd = open(file, O_RDONLY | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			err = -errno;
+			dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: READ: %d: %s.\n",
+					dnet_dump_id(&cmd->id), file, err, strerror(-err));
+			goto err_out_exit;
+		}
+
+		file_fd_cache_put(r, io->id, fd);
 	}
 
 	size = io->size;
@@ -276,6 +569,9 @@ static int file_read(struct file_backend_root *r, void *state, struct dnet_cmd *
 	}
 
 	io->size = size;
+
+	dnet_backend_io_advise(fd, io->offset, io->size, io->flags);
+
 	err = dnet_send_read_data(state, cmd, io, NULL, fd, io->offset, 1);
 	if (err)
 		goto err_out_close_fd;
@@ -299,6 +595,7 @@ static int file_del(struct file_backend_root *r, void *state __unused, struct dn
 
 	snprintf(file, sizeof(file), "%s/%s",
 		dir, dnet_dump_id_len_raw(cmd->id.id, DNET_ID_SIZE, id));
+	file_fd_cache_invalidate(r, cmd->id.id);
 	remove(file);
 
 	eblob_remove(r->meta, &key);
@@ -326,12 +623,17 @@ static int file_info(struct file_backend_root *r, void *state, struct dnet_cmd *
 	snprintf(file, sizeof(file), "%s/%s",
 		dir, dnet_dump_id_len_raw(cmd->id.id, DNET_ID_SIZE, id));
 
-	err = open(file, O_RDONLY | O_CLOEXEC);
+	err = file_fd_cache_get(r, cmd->id.id);
 	if (err < 0) {
-		err = -errno;
-		dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: info-stat-open-csum: %d: %s.\n",
-			dnet_dump_id(&cmd->id), file, err, strerror(-err));
-		goto err_out_exit;
+		err = open(file, O_RDONLY | O_CLOEXEC);
+		if (err < 0) {
+			err = -errno;
+			dnet_backend_log(DNET_LOG_ERROR, "%s: FILE: %s: info-stat-open-csum: %d: %s.\n",
+				dnet_dump_id(&cmd->id), file, err, strerror(-err));
+			goto err_out_exit;
+		}
+
+		file_fd_cache_put(r, cmd->id.id, err);
 	}
 	fd = err;
 
@@ -452,6 +754,40 @@ static int dnet_file_set_defrag_percentage(struct dnet_config_backend *b, char *
 	return 0;
 }
 
+static int dnet_file_set_fd_cache_size(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct file_backend_root *r = b->data;
+
+	r->fd_cache_size = atoi(value);
+	return 0;
+}
+
+static int dnet_file_set_stat_refresh_interval(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct file_backend_root *r = b->data;
+
+	r->stat_refresh_interval = atoi(value);
+	return 0;
+}
+
+static int dnet_file_set_odirect_size(struct dnet_config_backend *b, char *key __unused, char *value)
+{
+	struct file_backend_root *r = b->data;
+	uint64_t val = strtoul(value, NULL, 0);
+
+	if (strchr(value, 'T'))
+		val *= 1024*1024*1024*1024ULL;
+	else if (strchr(value, 'G'))
+		val *= 1024*1024*1024ULL;
+	else if (strchr(value, 'M'))
+		val *= 1024*1024;
+	else if (strchr(value, 'K'))
+		val *= 1024;
+
+	r->odirect_size = val;
+	return 0;
+}
+
 static int dnet_file_set_sync(struct dnet_config_backend *b, char *key __unused, char *value)
 {
 	struct file_backend_root *r = b->data;
@@ -553,7 +889,16 @@ static void file_backend_cleanup(void *priv)
 {
 	struct file_backend_root *r = priv;
 
+	backend_stat_cache_cleanup();
+
 	dnet_file_db_cleanup(r);
+
+	file_fd_cache_cleanup(r);
+
+	while (r->odirect_buf_count)
+		free(r->odirect_bufs[--r->odirect_buf_count]);
+	pthread_mutex_destroy(&r->odirect_lock);
+
 	close(r->rootfd);
 	free(r->root);
 }
@@ -573,6 +918,16 @@ static int dnet_file_config_init(struct dnet_config_backend *b, struct dnet_conf
 	struct file_backend_root *r = b->data;
 	int err;
 
+	err = pthread_mutex_init(&r->odirect_lock, NULL);
+	if (err)
+		return -err;
+
+	err = file_fd_cache_init(r);
+	if (err) {
+		pthread_mutex_destroy(&r->odirect_lock);
+		return err;
+	}
+
 	c->cb = &b->cb;
 
 	b->cb.command_private = r;
@@ -588,8 +943,19 @@ static int dnet_file_config_init(struct dnet_config_backend *b, struct dnet_conf
 
 	mkdir("history", 0755);
 	err = dnet_file_db_init(r, c, "history");
-	if (err)
+	if (err) {
+		file_fd_cache_cleanup(r);
+		pthread_mutex_destroy(&r->odirect_lock);
 		return err;
+	}
+
+	err = backend_stat_cache_init(r->root ? r->root : ".", r->stat_refresh_interval);
+	if (err) {
+		dnet_file_db_cleanup(r);
+		file_fd_cache_cleanup(r);
+		pthread_mutex_destroy(&r->odirect_lock);
+		return err;
+	}
 
 	return 0;
 }
@@ -609,6 +975,9 @@ static struct dnet_config_entry dnet_cfg_entries_filesystem[] = {
 	{"blob_size", dnet_file_set_blob_size},
 	{"defrag_timeout", dnet_file_set_defrag_timeout},
 	{"defrag_percentage", dnet_file_set_defrag_percentage},
+	{"odirect_size", dnet_file_set_odirect_size},
+	{"fd_cache_size", dnet_file_set_fd_cache_size},
+	{"stat_refresh_interval", dnet_file_set_stat_refresh_interval},
 };
 
 static struct dnet_config_backend dnet_file_backend = {
@@ -28,15 +28,507 @@
 static void ids_usage(char *p)
 {
 	fprintf(stderr, "Usage: %s <options>\n"
+			"Single-node mode (random ids sized after the storage device):\n"
 			"  -i file                   - ids file\n"
 			"  -r file                   - random file\n"
 			"  -d dir                    - storage dir path\n"
 			"  -t                        - use total size of the storage device instead of free size\n"
+			"Cluster partitioning mode (spec file holds 'name weight' lines,\n"
+			"weight is the node capacity in arbitrary units; per-node ids files\n"
+			"are read from/written to <outdir>/<name>.ids):\n"
+			"  -g spec -o outdir         - generate capacity-weighted, evenly spaced ids files\n"
+			"  -b spec -o outdir         - rebalance: nodes from spec without an ids file are new,\n"
+			"                              their ids split the largest ranges; prints moved ranges\n"
+			"  -V spec -o outdir         - verify: print per-node ownership share vs expected\n"
+			"  -n num                    - ids per weight unit (default: 8)\n"
 			"  -h                        - this help\n"
 			, p);
 	exit(-1);
 }
 
+/*
+ * Cluster partitioning.
+ *
+ * An ids file is a list of raw DNET_ID_SIZE ids; each id is a point on the
+ * hash ring and the node owns the range ending at that point. The original
+ * random generation gives capacity-proportional id counts but the random
+ * positions make per-node fill levels diverge badly, so the partitioning
+ * modes below place ids deterministically: positions are encoded in the top
+ * 8 bytes of the id (the tail is zero, comparison is lexicographic so the
+ * top bytes decide), spaced evenly over the ring and dealt to nodes by
+ * weighted round-robin. Rebalancing keeps every existing id in place and
+ * only inserts ids for the new nodes into the currently largest ranges,
+ * which bounds data movement to the ranges it prints.
+ */
+
+struct ids_node {
+	char			name[256];
+	unsigned long long	weight;
+	int			is_new;
+	int			token_num;
+	uint64_t		*tokens;
+	uint64_t		owned;
+};
+
+struct ids_token {
+	uint64_t		pos;
+	int			node;
+};
+
+static int ids_token_cmp(const void *a, const void *b)
+{
+	const struct ids_token *t1 = a, *t2 = b;
+
+	if (t1->pos < t2->pos)
+		return -1;
+	if (t1->pos > t2->pos)
+		return 1;
+	return 0;
+}
+
+static int ids_spec_read(const char *spec_file, struct ids_node **nodesp)
+{
+	struct ids_node *nodes = NULL, *tmp;
+	char line[512], name[256];
+	unsigned long long weight;
+	int num = 0;
+	FILE *f;
+
+	f = fopen(spec_file, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open spec file '%s': %s [%d]\n",
+				spec_file, strerror(errno), errno);
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%255s %llu", name, &weight) != 2 || !weight) {
+			fprintf(stderr, "Invalid spec line: %s", line);
+			continue;
+		}
+
+		tmp = realloc(nodes, (num + 1) * sizeof(struct ids_node));
+		if (!tmp) {
+			free(nodes);
+			fclose(f);
+			return -ENOMEM;
+		}
+		nodes = tmp;
+
+		memset(&nodes[num], 0, sizeof(struct ids_node));
+		snprintf(nodes[num].name, sizeof(nodes[num].name), "%s", name);
+		nodes[num].weight = weight;
+		num++;
+	}
+	fclose(f);
+
+	if (!num) {
+		fprintf(stderr, "Spec file '%s' contains no nodes\n", spec_file);
+		free(nodes);
+		return -EINVAL;
+	}
+
+	*nodesp = nodes;
+	return num;
+}
+
+static void ids_path(char *path, size_t size, const char *dir, const char *name)
+{
+	snprintf(path, size, "%s/%s.ids", dir, name);
+}
+
+static int ids_file_write(const char *dir, struct ids_node *node)
+{
+	unsigned char id[DNET_ID_SIZE];
+	char path[512];
+	int fd, i, err = 0;
+
+	ids_path(path, sizeof(path), dir, node->name);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open ids file '%s': %s [%d]\n",
+				path, strerror(errno), errno);
+		return -errno;
+	}
+
+	for (i = 0; i < node->token_num; ++i) {
+		uint64_t pos = node->tokens[i];
+		int j;
+
+		memset(id, 0, DNET_ID_SIZE);
+		for (j = 0; j < 8; ++j)
+			id[j] = (pos >> (8 * (7 - j))) & 0xff;
+
+		err = write(fd, id, DNET_ID_SIZE);
+		if (err != DNET_ID_SIZE) {
+			fprintf(stderr, "Failed to write ids file '%s': %s [%d]\n",
+					path, strerror(errno), errno);
+			err = -errno;
+			close(fd);
+			return err;
+		}
+	}
+
+	close(fd);
+	fprintf(stderr, "Wrote '%s': %d ids\n", path, node->token_num);
+	return 0;
+}
+
+static int ids_file_read(const char *dir, struct ids_node *node)
+{
+	unsigned char id[DNET_ID_SIZE];
+	char path[512];
+	struct stat st;
+	int fd, i, num, err;
+
+	ids_path(path, sizeof(path), dir, node->name);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -errno;
+
+	err = fstat(fd, &st);
+	if (err == -1) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	num = st.st_size / DNET_ID_SIZE;
+	node->tokens = malloc(num * sizeof(uint64_t));
+	if (!node->tokens) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num; ++i) {
+		uint64_t pos = 0;
+		int j;
+
+		err = read(fd, id, DNET_ID_SIZE);
+		if (err != DNET_ID_SIZE) {
+			err = -errno;
+			close(fd);
+			return err;
+		}
+
+		for (j = 0; j < 8; ++j)
+			pos = (pos << 8) | id[j];
+		node->tokens[i] = pos;
+	}
+
+	close(fd);
+	node->token_num = num;
+	return 0;
+}
+
+/* collects all tokens from all nodes into one ring-ordered array */
+static int ids_ring_build(struct ids_node *nodes, int node_num, struct ids_token **ringp)
+{
+	struct ids_token *ring;
+	int i, j, total = 0;
+
+	for (i = 0; i < node_num; ++i)
+		total += nodes[i].token_num;
+
+	ring = malloc(total * sizeof(struct ids_token));
+	if (!ring)
+		return -ENOMEM;
+
+	total = 0;
+	for (i = 0; i < node_num; ++i) {
+		for (j = 0; j < nodes[i].token_num; ++j) {
+			ring[total].pos = nodes[i].tokens[j];
+			ring[total].node = i;
+			total++;
+		}
+	}
+
+	qsort(ring, total, sizeof(struct ids_token), ids_token_cmp);
+
+	*ringp = ring;
+	return total;
+}
+
+static int ids_generate(const char *spec_file, const char *dir, int per_weight)
+{
+	struct ids_node *nodes;
+	unsigned long long total_weight = 0;
+	long long *credit;
+	int node_num, total, i, k, err = 0;
+
+	node_num = ids_spec_read(spec_file, &nodes);
+	if (node_num < 0)
+		return node_num;
+
+	total = 0;
+	for (i = 0; i < node_num; ++i) {
+		nodes[i].token_num = 0;
+		nodes[i].tokens = malloc(nodes[i].weight * per_weight * sizeof(uint64_t));
+		if (!nodes[i].tokens) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+		total += nodes[i].weight * per_weight;
+		total_weight += nodes[i].weight;
+	}
+
+	credit = calloc(node_num, sizeof(long long));
+	if (!credit) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	/*
+	 * Evenly spaced ring positions dealt to nodes by weighted round-robin
+	 * (Bresenham-style credit), so every node's ids are interleaved over
+	 * the whole ring and its share matches weight/total_weight.
+	 */
+	for (k = 0; k < total; ++k) {
+		uint64_t pos = (uint64_t)(((unsigned __int128)k << 64) / total);
+		int best = 0;
+
+		for (i = 0; i < node_num; ++i) {
+			credit[i] += nodes[i].weight;
+			if (credit[i] > credit[best])
+				best = i;
+		}
+
+		credit[best] -= total_weight;
+		nodes[best].tokens[nodes[best].token_num++] = pos;
+	}
+	free(credit);
+
+	for (i = 0; i < node_num; ++i) {
+		err = ids_file_write(dir, &nodes[i]);
+		if (err)
+			break;
+	}
+
+err_out_free:
+	for (i = 0; i < node_num; ++i)
+		free(nodes[i].tokens);
+	free(nodes);
+	return err;
+}
+
+static int ids_verify(const char *spec_file, const char *dir)
+{
+	struct ids_node *nodes;
+	struct ids_token *ring;
+	unsigned long long total_weight = 0;
+	int node_num, total, i, err = 0;
+
+	node_num = ids_spec_read(spec_file, &nodes);
+	if (node_num < 0)
+		return node_num;
+
+	for (i = 0; i < node_num; ++i) {
+		err = ids_file_read(dir, &nodes[i]);
+		if (err) {
+			fprintf(stderr, "Failed to read ids of node '%s': %s [%d]\n",
+					nodes[i].name, strerror(-err), -err);
+			goto err_out_free;
+		}
+		total_weight += nodes[i].weight;
+	}
+
+	total = ids_ring_build(nodes, node_num, &ring);
+	if (total < 0) {
+		err = total;
+		goto err_out_free;
+	}
+	if (!total) {
+		fprintf(stderr, "No ids found in '%s'\n", dir);
+		err = -EINVAL;
+		free(ring);
+		goto err_out_free;
+	}
+
+	for (i = 0; i < total; ++i) {
+		uint64_t prev = ring[i ? i - 1 : total - 1].pos;
+
+		nodes[ring[i].node].owned += ring[i].pos - prev;
+	}
+
+	printf("%-24s %8s %10s %10s %10s\n", "node", "ids", "share", "expected", "error");
+	for (i = 0; i < node_num; ++i) {
+		double share = (double)nodes[i].owned / (double)UINT64_MAX * 100.0;
+		double expected = (double)nodes[i].weight / (double)total_weight * 100.0;
+
+		printf("%-24s %8d %9.3f%% %9.3f%% %+9.3f%%\n",
+				nodes[i].name, nodes[i].token_num, share, expected, share - expected);
+	}
+
+	free(ring);
+
+err_out_free:
+	for (i = 0; i < node_num; ++i)
+		free(nodes[i].tokens);
+	free(nodes);
+	return err;
+}
+
+static int ids_rebalance(const char *spec_file, const char *dir, int per_weight)
+{
+	struct ids_node *nodes;
+	struct ids_token *ring = NULL;
+	uint64_t deficit;
+	int node_num, total, i, k, err = 0, new_total = 0;
+
+	node_num = ids_spec_read(spec_file, &nodes);
+	if (node_num < 0)
+		return node_num;
+
+	for (i = 0; i < node_num; ++i) {
+		err = ids_file_read(dir, &nodes[i]);
+		if (err == -ENOENT) {
+			nodes[i].is_new = 1;
+			nodes[i].token_num = 0;
+			nodes[i].tokens = malloc(nodes[i].weight * per_weight * sizeof(uint64_t));
+			if (!nodes[i].tokens) {
+				err = -ENOMEM;
+				goto err_out_free;
+			}
+			new_total += nodes[i].weight * per_weight;
+			err = 0;
+		} else if (err) {
+			fprintf(stderr, "Failed to read ids of node '%s': %s [%d]\n",
+					nodes[i].name, strerror(-err), -err);
+			goto err_out_free;
+		}
+	}
+
+	if (!new_total) {
+		fprintf(stderr, "Every node in '%s' already has an ids file, nothing to rebalance\n", spec_file);
+		goto err_out_free;
+	}
+
+	total = ids_ring_build(nodes, node_num, &ring);
+	if (total < 0) {
+		err = total;
+		ring = NULL;
+		goto err_out_free;
+	}
+	if (!total) {
+		fprintf(stderr, "No existing ids in '%s' - use -g to generate from scratch\n", dir);
+		err = -EINVAL;
+		goto err_out_free;
+	}
+
+	/*
+	 * Existing ids never move. Every new id takes a slice off the head of
+	 * the currently largest range - only those printed ranges need data
+	 * migration, so total movement equals exactly the share the new nodes
+	 * must own. Slices are sized by the remaining share deficit spread
+	 * over the remaining ids, and new nodes take ids in weighted
+	 * round-robin order so they interleave like generated ones do.
+	 */
+	{
+		unsigned long long new_weight = 0, total_weight = 0;
+
+		for (i = 0; i < node_num; ++i) {
+			total_weight += nodes[i].weight;
+			if (nodes[i].is_new)
+				new_weight += nodes[i].weight;
+		}
+
+		deficit = (uint64_t)(((unsigned __int128)new_weight << 64) / total_weight);
+	}
+
+	for (k = 0; k < new_total; ++k) {
+		struct ids_token *tmp;
+		uint64_t best_len = 0, prev, mid, slice;
+		int best = -1, owner, new_node = -1, j;
+		unsigned long long best_credit = 0;
+
+		for (i = 0; i < node_num; ++i) {
+			unsigned long long c;
+
+			if (!nodes[i].is_new)
+				continue;
+
+			/* fewest-ids-per-weight first */
+			c = (unsigned long long)nodes[i].token_num * 1000000ULL / nodes[i].weight;
+			if (new_node == -1 || c < best_credit) {
+				best_credit = c;
+				new_node = i;
+			}
+		}
+
+		if ((int)(nodes[new_node].weight * per_weight) <= nodes[new_node].token_num)
+			break;
+
+		for (i = 0; i < total; ++i) {
+			uint64_t p = ring[i ? i - 1 : total - 1].pos;
+			uint64_t len = ring[i].pos - p;
+
+			if (len > best_len) {
+				best_len = len;
+				best = i;
+			}
+		}
+
+		slice = deficit / (new_total - k);
+		if (slice >= best_len)
+			slice = best_len - 1;
+		if (!slice)
+			break;
+		deficit -= slice;
+
+		prev = ring[best ? best - 1 : total - 1].pos;
+		mid = prev + slice;
+		owner = ring[best].node;
+
+		printf("move %016llx..%016llx from %s to %s\n",
+				(unsigned long long)(prev + 1), (unsigned long long)mid,
+				nodes[owner].name, nodes[new_node].name);
+
+		nodes[new_node].tokens[nodes[new_node].token_num++] = mid;
+
+		tmp = realloc(ring, (total + 1) * sizeof(struct ids_token));
+		if (!tmp) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+		ring = tmp;
+
+		/*
+		 * @mid wraps around zero when the split range does, so find the
+		 * sorted slot explicitly instead of reusing @best.
+		 */
+		for (i = 0; i < total; ++i) {
+			if (mid < ring[i].pos)
+				break;
+		}
+		for (j = total; j > i; --j)
+			ring[j] = ring[j - 1];
+		ring[i].pos = mid;
+		ring[i].node = new_node;
+		total++;
+	}
+
+	for (i = 0; i < node_num; ++i) {
+		if (!nodes[i].is_new)
+			continue;
+
+		err = ids_file_write(dir, &nodes[i]);
+		if (err)
+			break;
+	}
+
+err_out_free:
+	free(ring);
+	for (i = 0; i < node_num; ++i)
+		free(nodes[i].tokens);
+	free(nodes);
+	return err;
+}
+
 static int ids_append(char *random_file, int fd, unsigned long long diff)
 {
 	unsigned long long sz = 1024 * 1024;
@@ -143,10 +635,11 @@ int main(int argc, char *argv[])
 	char *random = "/dev/urandom";
 	char *ids = NULL;
 	char *dir = NULL;
-	int total = 0;
+	char *generate = NULL, *rebalance = NULL, *verify = NULL, *outdir = NULL;
+	int total = 0, per_weight = 8;
 	unsigned long long storage_size;
 
-	while ((ch = getopt(argc, argv, "i:r:d:th")) != -1) {
+	while ((ch = getopt(argc, argv, "i:r:d:tg:b:V:o:n:h")) != -1) {
 		switch (ch) {
 			case 'i':
 				ids = optarg;
@@ -160,6 +653,21 @@ int main(int argc, char *argv[])
 			case 't':
 				total = 1;
 				break;
+			case 'g':
+				generate = optarg;
+				break;
+			case 'b':
+				rebalance = optarg;
+				break;
+			case 'V':
+				verify = optarg;
+				break;
+			case 'o':
+				outdir = optarg;
+				break;
+			case 'n':
+				per_weight = atoi(optarg);
+				break;
 			case 'h':
 			default:
 				ids_usage(argv[0]);
@@ -167,6 +675,26 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (per_weight <= 0) {
+		fprintf(stderr, "Ids per weight unit must be positive\n");
+		ids_usage(argv[0]);
+		/* not reached */
+	}
+
+	if (generate || rebalance || verify) {
+		if (!outdir) {
+			fprintf(stderr, "Partitioning modes need an output directory (-o)\n");
+			ids_usage(argv[0]);
+			/* not reached */
+		}
+
+		if (generate)
+			return ids_generate(generate, outdir, per_weight);
+		if (rebalance)
+			return ids_rebalance(rebalance, outdir, per_weight);
+		return ids_verify(verify, outdir);
+	}
+
 	if (!ids || !dir) {
 		fprintf(stderr, "Both ids and dir options must be specified\n");
 		ids_usage(argv[0]);
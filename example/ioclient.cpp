@@ -32,6 +32,14 @@
 
 #include <netinet/in.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
 #include "elliptics/cppdef.h"
 #include "elliptics/backends.h"
 
@@ -72,11 +80,166 @@ static void dnet_usage(char *p)
 			" -d request_string    - defragmentation request: 'start' - start defragmentation, 'status' - request current status\n"
 			" -i flags             - IO flags (see DNET_IO_FLAGS_* in include/elliptics/packet.h\n"
 			" -H                   - do not hash id, use it as is\n"
+			" -b manifest          - write files listed in manifest ('path [key]' per line) in parallel\n"
+			" -B manifest          - read keys listed in manifest ('key [dest-path]' per line) in parallel\n"
+			" -P window            - max in-flight operations for manifest transfers. Default: 64\n"
 			" -h                   - this help\n"
 			" ...                  - every parameter can be repeated multiple times, in this case the last one will be used\n"
 			, p);
 }
 
+/*
+ * Parallel manifest transfers: many concurrent async operations pipelined
+ * through one session with a bounded in-flight window, plus aggregate
+ * throughput and per-operation latency percentiles on completion.
+ */
+struct bulk_stats {
+	std::mutex		lock;
+	std::condition_variable	cond;
+	int			in_flight = 0;
+	uint64_t		ops = 0;
+	uint64_t		errors = 0;
+	uint64_t		bytes = 0;
+	std::vector<double>	latency_ms;
+};
+
+static void bulk_report(const char *mode, bulk_stats &stats, double seconds)
+{
+	std::vector<double> &lat = stats.latency_ms;
+	std::sort(lat.begin(), lat.end());
+
+	double mb = stats.bytes / (1024. * 1024.);
+
+	fprintf(stdout, "%s: %llu ops, %llu errors, %.1f MB in %.2f s: %.1f MB/s, %.0f ops/s\n",
+			mode,
+			(unsigned long long)stats.ops, (unsigned long long)stats.errors,
+			mb, seconds, seconds ? mb / seconds : 0.,
+			seconds ? stats.ops / seconds : 0.);
+
+	if (!lat.empty()) {
+		fprintf(stdout, "%s latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+				mode,
+				lat[lat.size() * 50 / 100],
+				lat[lat.size() * 90 / 100],
+				lat[std::min(lat.size() - 1, lat.size() * 99 / 100)],
+				lat.back());
+	}
+}
+
+static int bulk_transfer(session &s, const char *manifest, int window, bool write_mode)
+{
+	std::ifstream in(manifest);
+	if (!in) {
+		fprintf(stderr, "Failed to open manifest file '%s'\n", manifest);
+		return -ENOENT;
+	}
+
+	/*
+	 * Completion handlers only update counters, exceptions are reported
+	 * through error_info there.
+	 */
+	session bs = s.clone();
+	bs.set_exceptions_policy(session::no_exceptions);
+
+	bulk_stats stats;
+	auto start = std::chrono::steady_clock::now();
+	std::string line;
+	uint64_t line_num = 0;
+
+	while (std::getline(in, line)) {
+		line_num++;
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		/*
+		 * Manifest line: "<first> [<second>]".
+		 * Write mode: local file path, optional key (defaults to path).
+		 * Read mode: key, optional local destination path (data is
+		 * only counted when destination is omitted).
+		 */
+		std::istringstream parser(line);
+		std::string first, second;
+		parser >> first >> second;
+
+		if (first.empty())
+			continue;
+
+		{
+			std::unique_lock<std::mutex> guard(stats.lock);
+			stats.cond.wait(guard, [&stats, window] { return stats.in_flight < window; });
+			stats.in_flight++;
+		}
+
+		auto op_start = std::chrono::steady_clock::now();
+
+		auto complete = [&stats, op_start] (uint64_t bytes, bool ok) {
+			auto op_end = std::chrono::steady_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(op_end - op_start).count();
+
+			std::lock_guard<std::mutex> guard(stats.lock);
+			stats.ops++;
+			if (!ok)
+				stats.errors++;
+			stats.bytes += bytes;
+			stats.latency_ms.push_back(ms);
+			stats.in_flight--;
+			stats.cond.notify_one();
+		};
+
+		if (write_mode) {
+			std::ifstream file(first.c_str(), std::ios::binary);
+			if (!file) {
+				fprintf(stderr, "%s:%llu: can not open file '%s'\n",
+						manifest, (unsigned long long)line_num, first.c_str());
+				std::lock_guard<std::mutex> guard(stats.lock);
+				stats.errors++;
+				stats.in_flight--;
+				continue;
+			}
+
+			std::ostringstream content;
+			content << file.rdbuf();
+
+			const std::string &name = second.empty() ? first : second;
+			uint64_t bytes = content.str().size();
+
+			bs.write_data(key(name), data_pointer::copy(content.str()), 0)
+				.connect([] (const write_result_entry &) {},
+						[complete, bytes] (const error_info &error) {
+					complete(bytes, !error);
+				});
+		} else {
+			std::shared_ptr<uint64_t> bytes = std::make_shared<uint64_t>(0);
+			std::string dest = second;
+
+			bs.read_data(key(first), 0, 0)
+				.connect([bytes, dest] (const read_result_entry &entry) {
+					if (!entry.size())
+						return;
+					*bytes += entry.file().size();
+					if (!dest.empty()) {
+						std::ofstream out(dest.c_str(), std::ios::binary);
+						out.write(entry.file().data<char>(), entry.file().size());
+					}
+				}, [complete, bytes] (const error_info &error) {
+					complete(*bytes, !error);
+				});
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> guard(stats.lock);
+		stats.cond.wait(guard, [&stats] { return stats.in_flight == 0; });
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	bulk_report(write_mode ? "bulk-write" : "bulk-read", stats,
+			std::chrono::duration<double>(end - start).count());
+
+	return stats.errors && !stats.ops ? -EIO : 0;
+}
+
 static key create_id(unsigned char *id, const char *file_name)
 {
 	if (id) {
@@ -115,6 +278,8 @@ int main(int argc, char *argv[])
 	int nsize = 0;
 	std::string as_is_key;
 	int exec_src_key = -1;
+	const char *bulk_writef = NULL, *bulk_readf = NULL;
+	int bulk_window = 64;
 
 	memset(&node_status, 0, sizeof(struct dnet_node_status));
 	memset(&cfg, 0, sizeof(struct dnet_config));
@@ -130,7 +295,7 @@ int main(int argc, char *argv[])
 	cfg.wait_timeout = 60;
 	int log_level = DNET_LOG_ERROR;
 
-	while ((ch = getopt(argc, argv, "i:d:C:A:F:M:N:g:u:O:S:m:zsU:aL:w:l:c:k:I:r:W:R:D:hH")) != -1) {
+	while ((ch = getopt(argc, argv, "i:d:C:A:F:M:N:g:u:O:S:m:zsU:aL:w:l:c:k:I:r:W:R:D:b:B:P:hH")) != -1) {
 		switch (ch) {
 			case 'i':
 				ioflags = strtoull(optarg, NULL, 0);
@@ -217,6 +382,17 @@ int main(int argc, char *argv[])
 			case 'W':
 				writef = optarg;
 				break;
+			case 'b':
+				bulk_writef = optarg;
+				break;
+			case 'B':
+				bulk_readf = optarg;
+				break;
+			case 'P':
+				bulk_window = atoi(optarg);
+				if (bulk_window <= 0)
+					bulk_window = 1;
+				break;
 			case 'R':
 				readf = optarg;
 				break;
@@ -304,6 +480,18 @@ int main(int argc, char *argv[])
 		if (writef)
 			s.write_file(create_id(id, writef), writef, offset, offset, size);
 
+		if (bulk_writef) {
+			err = bulk_transfer(s, bulk_writef, bulk_window, true);
+			if (err)
+				return err;
+		}
+
+		if (bulk_readf) {
+			err = bulk_transfer(s, bulk_readf, bulk_window, false);
+			if (err)
+				return err;
+		}
+
 		if (readf)
 			s.read_file(create_id(id, readf), readf, offset, size);
 
@@ -17,9 +17,16 @@
  * GNU General Public License for more details.
  */
 
+#include <iostream>
 #include <vector>
 #include <string>
 #include <set>
+#include <queue>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <boost/program_options.hpp>
 
@@ -28,16 +35,164 @@
 struct Ctx {
 	Ctx()
 	: iflags(0)
+	, sorted(false)
+	, mem_limit(256 * 1024 * 1024ULL)
+	, progress(0)
 	{}
 
 	std::vector<int> groups;
 	uint64_t iflags;
 	dnet_iterator_range key_range;
 	dnet_time time_begin, time_end;
+	bool sorted;
+	uint64_t mem_limit;
+	uint64_t progress;
+	std::string tmp_dir;
 	std::unique_ptr<ioremap::elliptics::session> session;
 	std::vector<std::pair<struct dnet_id, struct dnet_addr>> routes;
 };
 
+static void print_response(const dnet_addr &node, const dnet_iterator_response &resp, const std::string &data) {
+	char buffer[2*DNET_ID_SIZE + 1] = {0};
+	std::cout << "node: "    << dnet_server_convert_dnet_addr(const_cast<dnet_addr*>(&node)) << node.family
+	          << ", key: "   << dnet_dump_id_len_raw(resp.key.id, DNET_ID_SIZE, buffer)
+	          << ", flags: " << resp.user_flags
+	          << ", ts: "    << resp.timestamp.tsec << "/" << resp.timestamp.tnsec
+	          << " size: "   << resp.size
+	          << " data: "   << data
+	          << std::endl;
+}
+
+/*
+ * Bounded-memory external sort for ordered scans: responses are appended to
+ * unlinked run files in tmp_dir, every mem_limit bytes the run is sorted in
+ * place via dnet_iterator_response_container_sort() and a new one is started,
+ * ordered output is a k-way heap merge over the mmap()ed runs. Only the run
+ * heads are ever held in memory.
+ */
+class sorted_dump {
+public:
+	sorted_dump(const std::string &tmp_dir, uint64_t mem_limit)
+	: m_tmp_dir(tmp_dir), m_limit(mem_limit), m_fd(-1), m_size(0)
+	{}
+
+	~sorted_dump() {
+		for (auto it = m_runs.begin(), end = m_runs.end(); it != end; ++it)
+			close(it->first);
+		if (m_fd >= 0)
+			close(m_fd);
+	}
+
+	void append(const dnet_iterator_response *resp) {
+		int err;
+
+		if (m_fd >= 0 && m_size >= m_limit)
+			rotate();
+		if (m_fd < 0) {
+			std::string path = m_tmp_dir + "/dnet_iterate_XXXXXX";
+			std::vector<char> tmpl(path.begin(), path.end());
+			tmpl.push_back('\0');
+
+			m_fd = mkstemp(tmpl.data());
+			if (m_fd < 0)
+				throw std::runtime_error("can not create run file in " + m_tmp_dir);
+			unlink(tmpl.data());
+			m_size = 0;
+		}
+
+		err = dnet_iterator_response_container_append(resp, m_fd, m_size);
+		if (err)
+			throw std::runtime_error("can not append response to run file");
+		m_size += sizeof(dnet_iterator_response);
+	}
+
+	size_t runs() const {
+		return m_runs.size() + (m_fd >= 0 ? 1 : 0);
+	}
+
+	void merge_and_print(const dnet_addr &node) {
+		static const uint64_t resp_size = sizeof(dnet_iterator_response);
+
+		if (m_fd >= 0)
+			rotate();
+
+		std::vector<run_cursor> cursors;
+		std::vector<std::pair<void *, uint64_t>> maps;
+
+		for (auto it = m_runs.begin(), end = m_runs.end(); it != end; ++it) {
+			if (it->second == 0)
+				continue;
+
+			void *data = mmap(NULL, it->second, PROT_READ, MAP_SHARED, it->first, 0);
+			if (data == MAP_FAILED)
+				throw std::runtime_error("can not mmap run file");
+			maps.push_back(std::make_pair(data, it->second));
+
+			run_cursor c = { reinterpret_cast<const dnet_iterator_response *>(data),
+				it->second / resp_size, 0 };
+			cursors.push_back(c);
+		}
+
+		/* heap of (host-order head, cursor index), smallest key on top */
+		typedef std::pair<dnet_iterator_response, size_t> head_entry;
+		struct head_greater {
+			bool operator() (const head_entry &lhs, const head_entry &rhs) const {
+				int cmp = dnet_id_cmp_str(lhs.first.key.id, rhs.first.key.id);
+				if (cmp == 0)
+					cmp = dnet_time_cmp(&rhs.first.timestamp, &lhs.first.timestamp);
+				return cmp > 0;
+			}
+		};
+		std::priority_queue<head_entry, std::vector<head_entry>, head_greater> heap;
+
+		for (size_t i = 0; i < cursors.size(); ++i)
+			push_head(heap, cursors[i], i);
+
+		while (!heap.empty()) {
+			head_entry top = heap.top();
+			heap.pop();
+
+			print_response(node, top.first, std::string());
+			push_head(heap, cursors[top.second], top.second);
+		}
+
+		for (auto it = maps.begin(), end = maps.end(); it != end; ++it)
+			munmap(it->first, it->second);
+	}
+
+private:
+	struct run_cursor {
+		const dnet_iterator_response	*records;
+		uint64_t			count, pos;
+	};
+
+	template<typename Heap>
+	void push_head(Heap &heap, run_cursor &c, size_t index) {
+		if (c.pos >= c.count)
+			return;
+
+		/* runs hold wire-order records, convert a copy of the head */
+		dnet_iterator_response resp = c.records[c.pos++];
+		dnet_convert_iterator_response(&resp);
+		heap.push(std::make_pair(resp, index));
+	}
+
+	void rotate() {
+		int err = dnet_iterator_response_container_sort(m_fd, m_size);
+		if (err)
+			throw std::runtime_error("can not sort run file");
+		m_runs.push_back(std::make_pair(m_fd, m_size));
+		m_fd = -1;
+		m_size = 0;
+	}
+
+	std::string m_tmp_dir;
+	uint64_t m_limit;
+	int m_fd;
+	uint64_t m_size;
+	std::vector<std::pair<int, uint64_t>> m_runs;
+};
+
 void iterate_node(Ctx &ctx, const dnet_addr &node) {
 	std::cout << "Iterating node: " << dnet_server_convert_dnet_addr(const_cast<dnet_addr*>(&node)) << ":" << node.family << std::endl;
 	std::vector<dnet_iterator_range> ranges;
@@ -65,16 +220,31 @@ void iterate_node(Ctx &ctx, const dnet_addr &node) {
 	                                       ranges, DNET_ITYPE_NETWORK,
 	                                       ctx.iflags, ctx.time_begin, ctx.time_end);
 
-	char buffer[2*DNET_ID_SIZE + 1] = {0};
+	sorted_dump dump(ctx.tmp_dir, ctx.mem_limit);
+	uint64_t records = 0, bytes = 0;
+
 	for (auto it = res.begin(), end = res.end(); it != end; ++it) {
-		std::cout << "node: "    << dnet_server_convert_dnet_addr(const_cast<dnet_addr*>(&node)) << node.family
-		          << ", key: "   << dnet_dump_id_len_raw(it->reply()->key.id, DNET_ID_SIZE, buffer)
-		          << ", flags: " << it->reply()->user_flags
-		          << ", ts: "    << it->reply()->timestamp.tsec << "/" << it->reply()->timestamp.tnsec
-		          << " size: "   << it->reply_data().size()
-		          << " data: "   << it->reply_data().to_string()
-		          << std::endl;
+		if (ctx.sorted)
+			dump.append(it->reply());
+		else
+			print_response(node, *it->reply(), it->reply_data().to_string());
+
+		records++;
+		bytes += it->reply()->size;
+		if (ctx.progress && (records % ctx.progress) == 0)
+			fprintf(stderr, "progress: %s: %llu records, %llu bytes, %zd runs\n",
+					dnet_server_convert_dnet_addr(const_cast<dnet_addr*>(&node)),
+					(unsigned long long)records, (unsigned long long)bytes,
+					ctx.sorted ? dump.runs() : 0);
 	}
+
+	if (ctx.sorted)
+		dump.merge_and_print(node);
+
+	if (ctx.progress)
+		fprintf(stderr, "done: %s: %llu records, %llu bytes\n",
+				dnet_server_convert_dnet_addr(const_cast<dnet_addr*>(&node)),
+				(unsigned long long)records, (unsigned long long)bytes);
 }
 
 struct less {
@@ -171,6 +341,10 @@ int main(int argc, char *argv[]) {
 	("time-end,T", boost::program_options::value<std::string>(), "End timestamp of time range for iterating")
 	("nodes,n", "Iterate nodes")
 	("groups,G", "Iterate nodes in groups")
+	("sorted,s", "Sort output by key: external sort via on-disk runs, implies metadata-only")
+	("memory-limit,m", boost::program_options::value<uint64_t>()->default_value(256), "Size of one sorted run in Mb")
+	("tmp-dir", boost::program_options::value<std::string>()->default_value("/var/tmp"), "Directory for sorted runs")
+	("progress,p", boost::program_options::value<uint64_t>()->default_value(100000), "Report progress to stderr every N records, 0 disables")
 	("help,h", "this help");
 
 	boost::program_options::variables_map vm;
@@ -210,6 +384,16 @@ int main(int argc, char *argv[]) {
 			iter_groups = true;
 		if (vm.count("nodes"))
 			iter_node = true;
+		if (vm.count("sorted")) {
+			ctx.sorted = true;
+			if (ctx.iflags & DNET_IFLAGS_DATA) {
+				std::cerr << "Sorted mode keeps only metadata, ignoring --data" << std::endl;
+				ctx.iflags &= ~DNET_IFLAGS_DATA;
+			}
+		}
+		ctx.mem_limit = vm["memory-limit"].as<uint64_t>() * 1024 * 1024;
+		ctx.tmp_dir = vm["tmp-dir"].as<std::string>();
+		ctx.progress = vm["progress"].as<uint64_t>();
 
 		boost::program_options::notify(vm);
 	} catch(boost::program_options::error& e) {
@@ -228,14 +412,19 @@ int main(int argc, char *argv[]) {
 
 	ctx.routes = ctx.session->get_routes();
 
-	if (iter_groups)
-		iterate_groups(ctx);
-	else if (iter_node) {
-		for (auto it = remotes.begin(), end = remotes.end(); it != end; ++it) {
-			iterate_node(ctx, parse_addr(*it));
+	try {
+		if (iter_groups)
+			iterate_groups(ctx);
+		else if (iter_node) {
+			for (auto it = remotes.begin(), end = remotes.end(); it != end; ++it) {
+				iterate_node(ctx, parse_addr(*it));
+			}
+		} else {
+			std::cerr << "You should specify one of iteration mode: --nodes or --groups\n" << desc << std::endl;
+			exit(1);
 		}
-	} else {
-		std::cerr << "You should specify one of iteration mode: --nodes or --groups\n" << desc << std::endl;
+	} catch (const std::exception &e) {
+		std::cerr << "Iteration failed: " << e.what() << std::endl;
 		exit(1);
 	}
 
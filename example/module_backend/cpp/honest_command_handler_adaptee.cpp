@@ -1,6 +1,7 @@
 #include "honest_command_handler_adaptee.hpp"
 #include "../core/module_backend_t.h"
 #include <elliptics/interface.h>
+#include <elliptics/backends.h>
 #include <elliptics/error.hpp>
 #include <iostream>
 
@@ -33,9 +34,25 @@ int ell::honest_command_handler_adaptee::file_write(module_backend_t * /*r*/, vo
 int ell::honest_command_handler_adaptee::file_read(module_backend_t * /*r*/, void *state, dnet_cmd *cmd, void *data)
 {
 	const std::string key(dnet_cmd2string(cmd->id));
-	const std::string result = m_uncomplicated_handler->read(key);
 	dnet_io_attr *io = static_cast<dnet_io_attr *>(data);
 
+	int fd = -1;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	int err = m_uncomplicated_handler->read_fd(key, fd, offset, size);
+	if (err == 0) {
+		int64_t result_size = dnet_backend_check_get_size(io, size);
+		if (result_size < 0)
+			return result_size;
+
+		io->size = result_size;
+		return dnet_send_read_data(state, cmd, io, NULL, fd, offset + io->offset, 0);
+	}
+	if (err != -ENOTSUP)
+		return err;
+
+	const std::string result = m_uncomplicated_handler->read(key);
+
 	io->size = result.size();
 	return dnet_send_read_data(state, cmd, io, (void *)result.data(), -1, io->offset, 0);
 }
@@ -0,0 +1,301 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Replays a captured traffic journal (dnet_config::capture_journal, see
+ * struct dnet_capture_record in elliptics/packet.h) against a test cluster.
+ *
+ * The captured arrival process is reproduced open-loop: every record is
+ * issued at its recorded offset from the first record, optionally
+ * time-scaled, whether or not earlier requests have completed - so queueing
+ * under the real production burst structure is measured, not just average
+ * throughput. Keys and payload sizes are taken from the records, payload
+ * content is synthetic.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "elliptics/cppdef.h"
+
+using namespace ioremap::elliptics;
+
+typedef std::chrono::high_resolution_clock replay_clock;
+
+struct replay_stats {
+	std::mutex		lock;
+	std::condition_variable	cond;
+	int			in_flight;
+	uint64_t		ops, errors, skipped;
+	std::vector<double>	latency_ms;
+
+	replay_stats() : in_flight(0), ops(0), errors(0), skipped(0) {}
+};
+
+static int replay_load(const char *path, std::vector<dnet_capture_record> &records)
+{
+	struct dnet_capture_header hdr;
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open journal '%s': %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != DNET_CAPTURE_MAGIC) {
+		fprintf(stderr, "'%s' is not a capture journal\n", path);
+		fclose(f);
+		return -EINVAL;
+	}
+
+	if (hdr.version != DNET_CAPTURE_VERSION) {
+		fprintf(stderr, "Unsupported journal version %u, expected %u\n",
+				hdr.version, DNET_CAPTURE_VERSION);
+		fclose(f);
+		return -EINVAL;
+	}
+
+	struct dnet_capture_record rec;
+	while (fread(&rec, sizeof(rec), 1, f) == 1)
+		records.push_back(rec);
+
+	fclose(f);
+
+	if (records.empty()) {
+		fprintf(stderr, "Journal '%s' contains no records\n", path);
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+static void replay_usage(const char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -r addr:port:family  - remote node to connect to\n"
+			"  -g groups            - comma-separated replica groups\n"
+			"  -l log               - log file (default: stderr)\n"
+			"  -w level             - log level\n"
+			"  -i journal           - capture journal to replay\n"
+			"  -x scale             - time scale: 2 replays twice as fast, 0 - no pacing (default 1)\n"
+			"  -n num               - replay at most this many records\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	std::string remote_addr, log_file = "/dev/stderr";
+	const char *journal = NULL;
+	std::vector<int> groups;
+	int remote_port = 1025, remote_family = AF_INET;
+	int log_level = DNET_LOG_ERROR;
+	double scale = 1.0;
+	uint64_t max_records = 0;
+	int ch, err;
+	char *p;
+
+	while ((ch = getopt(argc, argv, "r:g:l:w:i:x:n:h")) != -1) {
+		switch (ch) {
+			case 'r': {
+				char *addr = optarg;
+				p = strrchr(addr, ':');
+				if (!p)
+					replay_usage(argv[0]);
+				remote_family = atoi(p + 1);
+				*p = '\0';
+				p = strrchr(addr, ':');
+				if (!p)
+					replay_usage(argv[0]);
+				remote_port = atoi(p + 1);
+				*p = '\0';
+				remote_addr = addr;
+				break;
+			}
+			case 'g':
+				for (p = strtok(optarg, ","); p; p = strtok(NULL, ","))
+					groups.push_back(atoi(p));
+				break;
+			case 'l':
+				log_file = optarg;
+				break;
+			case 'w':
+				log_level = atoi(optarg);
+				break;
+			case 'i':
+				journal = optarg;
+				break;
+			case 'x':
+				scale = atof(optarg);
+				break;
+			case 'n':
+				max_records = strtoull(optarg, NULL, 0);
+				break;
+			case 'h':
+			default:
+				replay_usage(argv[0]);
+		}
+	}
+
+	if (!journal || remote_addr.empty() || groups.empty())
+		replay_usage(argv[0]);
+
+	std::vector<dnet_capture_record> records;
+	err = replay_load(journal, records);
+	if (err)
+		return err;
+
+	if (max_records && records.size() > max_records)
+		records.resize(max_records);
+
+	/* one shared payload buffer, writes take zero-copy slices of it */
+	uint64_t max_write = 0;
+	for (auto it = records.begin(); it != records.end(); ++it) {
+		if (it->cmd == DNET_CMD_WRITE) {
+			uint64_t size = it->size > sizeof(struct dnet_io_attr) ?
+				it->size - sizeof(struct dnet_io_attr) : 0;
+			max_write = std::max(max_write, size);
+		}
+	}
+
+	try {
+		file_logger log(log_file.c_str(), log_level);
+		node n(log);
+		n.add_remote(remote_addr.c_str(), remote_port, remote_family);
+
+		session s(n);
+		s.set_groups(groups);
+		s.set_exceptions_policy(session::no_exceptions);
+
+		data_pointer payload = data_pointer::allocate(max_write ? max_write : 1);
+		memset(payload.data(), 'r', payload.size());
+
+		replay_stats stats;
+		replay_stats *st = &stats;
+
+		replay_clock::time_point start = replay_clock::now();
+		const struct dnet_time t0 = records.front().ts;
+
+		fprintf(stderr, "replaying %zu records, scale: %g\n", records.size(), scale);
+
+		for (auto it = records.begin(); it != records.end(); ++it) {
+			const struct dnet_capture_record &rec = *it;
+
+			if (scale > 0) {
+				long long offset_us = (long long)(rec.ts.tsec - t0.tsec) * 1000000 +
+					((long long)rec.ts.tnsec - (long long)t0.tnsec) / 1000;
+				std::this_thread::sleep_until(start +
+						std::chrono::microseconds((long long)(offset_us / scale)));
+			}
+
+			struct dnet_id id = rec.id;
+			id.group_id = 0;
+
+			replay_clock::time_point issued = replay_clock::now();
+			auto complete = [st, issued] (const error_info &error) {
+				double ms = std::chrono::duration_cast<std::chrono::microseconds>(
+						replay_clock::now() - issued).count() / 1000.;
+
+				std::lock_guard<std::mutex> guard(st->lock);
+				st->ops++;
+				if (error)
+					st->errors++;
+				st->latency_ms.push_back(ms);
+				st->in_flight--;
+				st->cond.notify_all();
+			};
+
+			{
+				std::lock_guard<std::mutex> guard(stats.lock);
+				stats.in_flight++;
+			}
+
+			switch (rec.cmd) {
+			case DNET_CMD_WRITE: {
+				uint64_t size = rec.size > sizeof(struct dnet_io_attr) ?
+					rec.size - sizeof(struct dnet_io_attr) : 0;
+				s.write_data(key(id), payload.slice(0, size), 0)
+					.connect(std::function<void (const write_result_entry &)>(),
+							complete);
+				break;
+			}
+			case DNET_CMD_READ:
+				s.read_data(key(id), 0, 0)
+					.connect(std::function<void (const read_result_entry &)>(),
+							complete);
+				break;
+			case DNET_CMD_LOOKUP:
+				s.lookup(key(id))
+					.connect(std::function<void (const lookup_result_entry &)>(),
+							complete);
+				break;
+			case DNET_CMD_DEL:
+				s.remove(key(id))
+					.connect(std::function<void (const callback_result_entry &)>(),
+							complete);
+				break;
+			default:
+				{
+					std::lock_guard<std::mutex> guard(stats.lock);
+					stats.in_flight--;
+					stats.skipped++;
+				}
+				break;
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> guard(stats.lock);
+			stats.cond.wait(guard, [st] () { return st->in_flight == 0; });
+		}
+
+		double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+				replay_clock::now() - start).count() / 1000.;
+
+		printf("replayed: %llu ops, %llu errors, %llu skipped, %.2f ops/s over %.2f seconds\n",
+				(unsigned long long)stats.ops, (unsigned long long)stats.errors,
+				(unsigned long long)stats.skipped, stats.ops / seconds, seconds);
+
+		if (!stats.latency_ms.empty()) {
+			std::sort(stats.latency_ms.begin(), stats.latency_ms.end());
+			size_t num = stats.latency_ms.size();
+
+			printf("latency ms: p50: %.3f, p90: %.3f, p99: %.3f, max: %.3f\n",
+					stats.latency_ms[num / 2],
+					stats.latency_ms[num * 9 / 10],
+					stats.latency_ms[num * 99 / 100],
+					stats.latency_ms[num - 1]);
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "replay failed: %s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
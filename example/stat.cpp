@@ -36,6 +36,9 @@
 #include "common.h"
 
 #include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 
 using namespace ioremap::elliptics;
 
@@ -47,17 +50,269 @@ static struct dnet_log stat_logger;
 static int stat_mem, stat_la, stat_fs;
 static FILE *stream = NULL;
 
+/* Statistics of a single node, everything already in host byte order */
+struct node_stat {
+	std::string		addr;
+	int			group;
+	struct dnet_stat	st;
+	int			have_counters;
+	unsigned long long	cache_hit;
+	unsigned long long	cache_miss;
+	unsigned long long	cache_bytes;
+};
+
+/* Per-group or cluster-wide aggregate of node statistics */
+struct stat_summary {
+	int			nodes;
+	unsigned long long	total;
+	unsigned long long	avail;
+	unsigned long long	io_queue;
+	unsigned long long	io_nb_queue;
+	unsigned long long	send_queue;
+	double			la_sum;
+	double			la_max;
+	unsigned long long	cache_hit;
+	unsigned long long	cache_miss;
+	unsigned long long	cache_bytes;
+};
+
+static void stat_summary_add(struct stat_summary &s, const struct node_stat &n)
+{
+	double la = (double)n.st.la[0] / 100.0;
+
+	s.nodes++;
+	s.total += n.st.frsize * n.st.blocks;
+	s.avail += n.st.bavail * n.st.bsize;
+	s.io_queue += n.st.io_queue_size;
+	s.io_nb_queue += n.st.io_nb_queue_size;
+	s.send_queue += n.st.send_queue_size;
+	s.la_sum += la;
+	if (la > s.la_max)
+		s.la_max = la;
+	s.cache_hit += n.cache_hit;
+	s.cache_miss += n.cache_miss;
+	s.cache_bytes += n.cache_bytes;
+}
+
+static double cache_hit_rate(unsigned long long hit, unsigned long long miss)
+{
+	if (!(hit + miss))
+		return 0;
+	return 100.0 * hit / (hit + miss);
+}
+
+/*
+ * Fans stat and counter requests out to every node in parallel: both
+ * requests are in flight before the first result is waited for, so the
+ * collection takes one network round trip regardless of cluster size.
+ */
+static std::vector<node_stat> collect_cluster_stats(session &sess)
+{
+	std::vector<node_stat> nodes;
+	std::map<std::string, node_stat> counters_by_addr;
+
+	async_stat_result stats = sess.stat_log();
+	async_stat_count_result counters = sess.stat_log_count();
+
+	sync_stat_count_result count_results = counters.get();
+	for (size_t i = 0; i < count_results.size(); ++i) {
+		struct dnet_addr_stat *as = count_results[i].statistics();
+		struct node_stat cnt;
+
+		memset(&cnt.st, 0, sizeof(cnt.st));
+		dnet_convert_addr_stat(as, 0);
+
+		cnt.have_counters = 1;
+		cnt.cache_hit = cnt.cache_miss = cnt.cache_bytes = 0;
+		if (as->num > (int)DNET_CNTR_CACHE_MISS) {
+			cnt.cache_hit = as->count[DNET_CNTR_CACHE_HIT].count;
+			cnt.cache_miss = as->count[DNET_CNTR_CACHE_MISS].count;
+		}
+		if (as->num > (int)DNET_CNTR_CACHE_BYTES)
+			cnt.cache_bytes = as->count[DNET_CNTR_CACHE_BYTES].count;
+
+		counters_by_addr[dnet_server_convert_dnet_addr(count_results[i].address())] = cnt;
+	}
+
+	sync_stat_result stat_results = stats.get();
+	for (size_t i = 0; i < stat_results.size(); ++i) {
+		struct dnet_cmd *cmd = stat_results[i].command();
+		struct node_stat ns;
+
+		if (cmd->size < sizeof(struct dnet_stat))
+			continue;
+
+		memcpy(&ns.st, cmd + 1, sizeof(struct dnet_stat));
+		dnet_convert_stat(&ns.st);
+
+		ns.addr = dnet_server_convert_dnet_addr(stat_results[i].address());
+		ns.group = cmd->id.group_id;
+		ns.have_counters = 0;
+		ns.cache_hit = ns.cache_miss = ns.cache_bytes = 0;
+
+		std::map<std::string, node_stat>::iterator it = counters_by_addr.find(ns.addr);
+		if (it != counters_by_addr.end()) {
+			ns.have_counters = 1;
+			ns.cache_hit = it->second.cache_hit;
+			ns.cache_miss = it->second.cache_miss;
+			ns.cache_bytes = it->second.cache_bytes;
+		}
+
+		nodes.push_back(ns);
+	}
+
+	return nodes;
+}
+
+static void print_node_text(const struct node_stat &n)
+{
+	fprintf(stream, "  %3d/%-25s ", n.group, n.addr.c_str());
+
+	if (stat_la)
+		fprintf(stream, "la: %5.2f %5.2f %5.2f ",
+			(float)n.st.la[0] / 100.0, (float)n.st.la[1] / 100.0, (float)n.st.la[2] / 100.0);
+
+	if (stat_mem)
+		fprintf(stream, "mem: total: %8llu kB, free: %8llu kB, cache: %8llu kB ",
+			(unsigned long long)n.st.vm_total, (unsigned long long)n.st.vm_free,
+			(unsigned long long)n.st.vm_cached);
+
+	if (stat_fs)
+		fprintf(stream, "fs: total: %8llu mB, avail: %8llu mB ",
+			(unsigned long long)(n.st.frsize * n.st.blocks / 1024 / 1024),
+			(unsigned long long)(n.st.bavail * n.st.bsize / 1024 / 1024));
+
+	fprintf(stream, "queues: io: %llu/%llu send: %llu ",
+		(unsigned long long)n.st.io_queue_size,
+		(unsigned long long)n.st.io_nb_queue_size,
+		(unsigned long long)n.st.send_queue_size);
+
+	if (n.have_counters)
+		fprintf(stream, "cache: %.1f%% hit, %llu kB",
+			cache_hit_rate(n.cache_hit, n.cache_miss), n.cache_bytes / 1024);
+
+	fprintf(stream, "\n");
+}
+
+static void print_summary_text(const char *name, const struct stat_summary &s)
+{
+	double used = s.total ? 100.0 * (s.total - s.avail) / s.total : 0;
+
+	fprintf(stream, "%s: nodes: %d, capacity: %llu/%llu gB (%.1f%% used), "
+			"la avg/max: %.2f/%.2f, queues: io: %llu/%llu send: %llu, "
+			"cache: %.1f%% hit, %llu mB\n",
+		name, s.nodes,
+		(s.total - s.avail) / (1024 * 1024 * 1024ULL), s.total / (1024 * 1024 * 1024ULL), used,
+		s.nodes ? s.la_sum / s.nodes : 0, s.la_max,
+		s.io_queue, s.io_nb_queue, s.send_queue,
+		cache_hit_rate(s.cache_hit, s.cache_miss), s.cache_bytes / (1024 * 1024));
+}
+
+static void print_summary_json(const char *name, const struct stat_summary &s)
+{
+	fprintf(stream, "{\"name\":\"%s\",\"nodes\":%d,\"total_bytes\":%llu,\"avail_bytes\":%llu,"
+			"\"la_avg\":%.2f,\"la_max\":%.2f,"
+			"\"io_queue\":%llu,\"io_nb_queue\":%llu,\"send_queue\":%llu,"
+			"\"cache_hit\":%llu,\"cache_miss\":%llu,\"cache_bytes\":%llu}",
+		name, s.nodes, s.total, s.avail,
+		s.nodes ? s.la_sum / s.nodes : 0, s.la_max,
+		s.io_queue, s.io_nb_queue, s.send_queue,
+		s.cache_hit, s.cache_miss, s.cache_bytes);
+}
+
+static void print_node_json(const struct node_stat &n)
+{
+	fprintf(stream, "{\"addr\":\"%s\",\"group\":%d,"
+			"\"la\":[%.2f,%.2f,%.2f],"
+			"\"vm_total_kb\":%llu,\"vm_free_kb\":%llu,\"vm_cached_kb\":%llu,"
+			"\"total_bytes\":%llu,\"avail_bytes\":%llu,"
+			"\"io_queue\":%llu,\"io_nb_queue\":%llu,\"send_queue\":%llu,"
+			"\"cache_hit\":%llu,\"cache_miss\":%llu,\"cache_bytes\":%llu}",
+		n.addr.c_str(), n.group,
+		(float)n.st.la[0] / 100.0, (float)n.st.la[1] / 100.0, (float)n.st.la[2] / 100.0,
+		(unsigned long long)n.st.vm_total, (unsigned long long)n.st.vm_free,
+		(unsigned long long)n.st.vm_cached,
+		(unsigned long long)(n.st.frsize * n.st.blocks),
+		(unsigned long long)(n.st.bavail * n.st.bsize),
+		(unsigned long long)n.st.io_queue_size,
+		(unsigned long long)n.st.io_nb_queue_size,
+		(unsigned long long)n.st.send_queue_size,
+		n.cache_hit, n.cache_miss, n.cache_bytes);
+}
+
+static void print_cluster_stats(const std::vector<node_stat> &nodes, int json)
+{
+	std::map<int, stat_summary> groups;
+	struct stat_summary cluster;
+	char str[64];
+	struct tm tm;
+	struct timeval tv;
+	size_t i;
+
+	memset(&cluster, 0, sizeof(cluster));
+
+	for (i = 0; i < nodes.size(); ++i) {
+		std::map<int, stat_summary>::iterator it = groups.find(nodes[i].group);
+		if (it == groups.end()) {
+			struct stat_summary empty;
+			memset(&empty, 0, sizeof(empty));
+			it = groups.insert(std::make_pair(nodes[i].group, empty)).first;
+		}
+
+		stat_summary_add(it->second, nodes[i]);
+		stat_summary_add(cluster, nodes[i]);
+	}
+
+	gettimeofday(&tv, NULL);
+	localtime_r((time_t *)&tv.tv_sec, &tm);
+	strftime(str, sizeof(str), "%F %R:%S", &tm);
+
+	if (json) {
+		fprintf(stream, "{\"time\":\"%s\",\"nodes\":[", str);
+		for (i = 0; i < nodes.size(); ++i) {
+			if (i)
+				fprintf(stream, ",");
+			print_node_json(nodes[i]);
+		}
+		fprintf(stream, "],\"groups\":[");
+		for (std::map<int, stat_summary>::iterator it = groups.begin(); it != groups.end(); ++it) {
+			char name[32];
+			if (it != groups.begin())
+				fprintf(stream, ",");
+			snprintf(name, sizeof(name), "%d", it->first);
+			print_summary_json(name, it->second);
+		}
+		fprintf(stream, "],\"cluster\":");
+		print_summary_json("cluster", cluster);
+		fprintf(stream, "}\n");
+	} else {
+		fprintf(stream, "%s.%06lu: %zd nodes\n", str, (unsigned long)tv.tv_usec, nodes.size());
+
+		if (stat_mem || stat_la || stat_fs)
+			for (i = 0; i < nodes.size(); ++i)
+				print_node_text(nodes[i]);
+
+		for (std::map<int, stat_summary>::iterator it = groups.begin(); it != groups.end(); ++it) {
+			char name[32];
+			snprintf(name, sizeof(name), "group %d", it->first);
+			print_summary_text(name, it->second);
+		}
+		print_summary_text("cluster", cluster);
+	}
+
+	fflush(stream);
+}
+
 static void print_stat(const stat_result_entry &result)
 {
 	dnet_cmd *cmd = result.command();
-	dnet_stat *st = result.statistics();
-
+	struct dnet_stat st;
 	float la[3];
 	char str[64];
 	struct tm tm;
 	struct timeval tv;
 
-	if (!stat_mem && !stat_la && !stat_fs)
+	if (cmd->size < sizeof(struct dnet_stat))
 		return;
 
 	gettimeofday(&tv, NULL);
@@ -66,14 +321,12 @@ static void print_stat(const stat_result_entry &result)
 
 	fprintf(stream, "%s.%06lu :", str, (unsigned long)tv.tv_usec);
 
-	st = (struct dnet_stat *)(cmd + 1);
-
-	dnet_convert_stat(st);
-
-	la[0] = (float)st->la[0] / 100.0;
-	la[1] = (float)st->la[1] / 100.0;
-	la[2] = (float)st->la[2] / 100.0;
+	memcpy(&st, cmd + 1, sizeof(struct dnet_stat));
+	dnet_convert_stat(&st);
 
+	la[0] = (float)st.la[0] / 100.0;
+	la[1] = (float)st.la[1] / 100.0;
+	la[2] = (float)st.la[2] / 100.0;
 
 	fprintf(stream, "%s: %s: ", dnet_dump_id(&cmd->id),
 		dnet_server_convert_dnet_addr(result.address()));
@@ -83,15 +336,15 @@ static void print_stat(const stat_result_entry &result)
 
 	if (stat_mem)
 		fprintf(stream, "mem: total: %8llu kB, free: %8llu kB, cache: %8llu kB, buffers: %8llu, active: %8llu, inactive: %8llu ",
-			(unsigned long long)st->vm_total, (unsigned long long)st->vm_free,
-			(unsigned long long)st->vm_cached, (unsigned long long)st->vm_buffers,
-			(unsigned long long)st->vm_active, (unsigned long long)st->vm_inactive);
+			(unsigned long long)st.vm_total, (unsigned long long)st.vm_free,
+			(unsigned long long)st.vm_cached, (unsigned long long)st.vm_buffers,
+			(unsigned long long)st.vm_active, (unsigned long long)st.vm_inactive);
 
 	if (stat_fs)
 		fprintf(stream, "fs: total: %8llu mB, avail: %8llu/%8llu mB ",
-			(unsigned long long)(st->frsize * st->blocks / 1024 / 1024),
-			(unsigned long long)(st->bavail * st->bsize / 1024 / 1024),
-			(unsigned long long)(st->bfree * st->bsize / 1024 / 1024));
+			(unsigned long long)(st.frsize * st.blocks / 1024 / 1024),
+			(unsigned long long)(st.bavail * st.bsize / 1024 / 1024),
+			(unsigned long long)(st.bfree * st.bsize / 1024 / 1024));
 
 	fprintf(stream, "\n");
 	fflush(stream);
@@ -106,10 +359,12 @@ static void stat_usage(char *p)
 			" -w timeout           - wait timeout in seconds used to wait for content sync.\n"
 			" -m level             - log level\n"
 			" -I id                - request statistics from node which handles given id\n"
-			" -t timeout           - timeout in seconds to repeatedly request statistics\n"
-			" -M                   - show memory usage statistics\n"
-			" -F                   - show filesystem usage statistics\n"
-			" -A                   - show load average statistics\n"
+			" -t timeout           - interval in seconds between updates in watch mode\n"
+			" -W                   - watch mode: repeatedly collect and print statistics\n"
+			" -j                   - JSON output\n"
+			" -M                   - show per-node memory usage statistics\n"
+			" -F                   - show per-node filesystem usage statistics\n"
+			" -A                   - show per-node load average statistics\n"
 	       , p);
 }
 
@@ -121,6 +376,7 @@ int main(int argc, char *argv[])
 	int remote_port, remote_family;
 	int max_id_idx = 1000, id_idx = 0;
 	int timeout;
+	int watch = 0, json = 0;
 	unsigned char id[max_id_idx][DNET_ID_SIZE];
 	const char *logfile = "/dev/stderr";
 	const char *statfile = "/dev/stdout";
@@ -132,7 +388,7 @@ int main(int argc, char *argv[])
 
 	timeout = 1;
 
-	while ((ch = getopt(argc, argv, "g:MFAt:m:w:l:I:r:h")) != -1) {
+	while ((ch = getopt(argc, argv, "g:MFAWjt:m:w:l:L:I:r:h")) != -1) {
 		switch (ch) {
 			case 'g':
 				group = atoi(optarg);
@@ -146,6 +402,12 @@ int main(int argc, char *argv[])
 			case 'A':
 				stat_la = 1;
 				break;
+			case 'W':
+				watch = 1;
+				break;
+			case 'j':
+				json = 1;
+				break;
 			case 't':
 				timeout = atoi(optarg);
 				break;
@@ -199,6 +461,8 @@ int main(int argc, char *argv[])
 		node n(log, cfg);
 		session sess(n);
 		sess.set_timeout(timeout);
+		/* partial results are better than none for a monitoring tool */
+		sess.set_exceptions_policy(session::no_exceptions);
 
 		n.add_remote(remote_addr, remote_port, remote_family);
 
@@ -206,13 +470,13 @@ int main(int argc, char *argv[])
 			struct dnet_id raw;
 
 			if (!id_idx) {
-				auto result = sess.stat_log();
-				std::for_each(result.begin(), result.end(), print_stat);
+				print_cluster_stats(collect_cluster_stats(sess), json);
 			} else {
 				if (group != -1) {
 					for (i = 0; i < id_idx; ++i) {
 						dnet_setup_id(&raw, group, id[i]);
-						sess.stat_log(raw).connect(print_stat, async_stat_result::final_function());
+						auto result = sess.stat_log(raw).get();
+						std::for_each(result.begin(), result.end(), print_stat);
 					}
 				} else {
 					std::cerr << "If you provide list of IDs you have to specify group number" << std::endl;
@@ -220,6 +484,9 @@ int main(int argc, char *argv[])
 				}
 			}
 
+			if (!watch)
+				break;
+
 			sleep(timeout);
 		}
 	} catch (const std::exception &e) {
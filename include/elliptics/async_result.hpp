@@ -118,6 +118,27 @@ class async_result
 		 */
 		 dnet_time elapsed_time() const;
 
+		/*!
+		 * Registers an eventfd or pipe write end to be signalled
+		 * every time an entry arrives and once on completion: an
+		 * 8-byte counter increment is written, which suits both
+		 * eventfd and non-blocking pipes. An event loop can poll
+		 * the descriptor instead of blocking a thread in wait().
+		 *
+		 * Pass -1 to unregister. If entries have already arrived
+		 * or the result is already complete, the descriptor is
+		 * signalled immediately. The descriptor is never closed.
+		 */
+		void set_notify_fd(int fd);
+
+		/*!
+		 * Returns entries received since the previous drain() call
+		 * without blocking, intended to be called when the
+		 * descriptor registered with set_notify_fd() becomes
+		 * readable. Does not affect get().
+		 */
+		std::vector<T> drain();
+
 		/*!
 		 * Blocks current thread until all entries are received, then
 		 * returns all of them as list.
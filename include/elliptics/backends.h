@@ -21,6 +21,7 @@ extern "C" {
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <strings.h>
 
@@ -53,10 +54,37 @@ static inline int64_t dnet_backend_check_get_size(struct dnet_io_attr *io, uint6
 	return size;
 }
 
+/*
+ * Translates DNET_IO_FLAGS_SEQUENTIAL/RANDOM/WILLNEED access-pattern hints
+ * into posix_fadvise() on the backend fd covering the requested range.
+ * Advisory only: errors are ignored, the read proceeds either way.
+ */
+static inline void dnet_backend_io_advise(int fd, uint64_t offset, uint64_t size, uint32_t ioflags)
+{
+	if (fd < 0)
+		return;
+
+	if (ioflags & DNET_IO_FLAGS_SEQUENTIAL)
+		posix_fadvise(fd, offset, size, POSIX_FADV_SEQUENTIAL);
+	if (ioflags & DNET_IO_FLAGS_RANDOM)
+		posix_fadvise(fd, offset, size, POSIX_FADV_RANDOM);
+	if (ioflags & DNET_IO_FLAGS_WILLNEED)
+		posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+}
+
 int backend_stat(void *state, char *path, struct dnet_cmd *cmd);
 
 int backend_stat_low_level(const char *path, struct dnet_stat *st);
 
+/*
+ * Background statistics sampler: refreshes the statvfs()/VM snapshot served
+ * by backend_stat_low_level() every @interval seconds, so that stat commands
+ * do not issue these syscalls inline. Zero @interval leaves statistics
+ * sampling synchronous.
+ */
+int backend_stat_cache_init(const char *path, int interval);
+void backend_stat_cache_cleanup(void);
+
 static inline char *file_backend_get_dir(const unsigned char *id, uint64_t bit_num, char *dst)
 {
 	char *res = dnet_dump_id_len_raw(id, (bit_num + 7) / 8, dst);
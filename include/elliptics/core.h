@@ -72,6 +72,8 @@
 
 #define DNET_DEFAULT_INDEXES_SHARD_COUNT 16
 
+#define DNET_DEFAULT_CACHE_SHARDS 16
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #ifndef dnet_offsetof
@@ -26,6 +26,7 @@
 
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -218,6 +219,9 @@ enum dnet_log_level {
 #define DNET_CFG_MIX_STATES		(1<<2)		/* mix states according to their weights before reading data */
 #define DNET_CFG_NO_CSUM		(1<<3)		/* globally disable checksum verification and update */
 #define DNET_CFG_RANDOMIZE_STATES	(1<<5)		/* randomize states for read requests */
+#define DNET_CFG_CACHE_COMPRESS		(1<<6)		/* LZ4-compress cold in-memory cache entries instead of evicting them */
+#define DNET_CFG_CACHE_HUGE_PAGES	(1<<7)		/* back large in-memory cache values with 2MB huge pages */
+#define DNET_CFG_INDEXES_DELTA		(1<<8)		/* append index mutations as delta records instead of rewriting tables */
 
 struct dnet_log {
 	/*
@@ -251,6 +255,9 @@ int dnet_iterator_response_container_read(int fd, uint64_t pos,
 		struct dnet_iterator_response *response);
 int64_t dnet_iterator_response_container_diff(int diff_fd, int left_fd, uint64_t left_size,
 		int right_fd, uint64_t right_size);
+int dnet_iterator_response_container_merge(int num,
+		int in_fds[], uint64_t in_sizes[],
+		int out_fds[], uint64_t out_sizes[]);
 
 struct dnet_backend_callbacks {
 	/* command handler processes DNET_CMD_* commands */
@@ -287,6 +294,14 @@ struct dnet_backend_callbacks {
 /*
  * Node configuration interface.
  */
+/* Network engines for dnet_config::net_io_engine */
+#define DNET_NET_IO_ENGINE_EPOLL	0
+#define DNET_NET_IO_ENGINE_URING	1
+
+/* Key/data transform functions for dnet_config::transform */
+#define DNET_TRANSFORM_SHA512		0
+#define DNET_TRANSFORM_FASTHASH		1
+
 struct dnet_config
 {
 	/*
@@ -332,6 +347,14 @@ struct dnet_config
 	 */
 	struct dnet_backend_callbacks	*cb;
 
+	/*
+	 * Nonzero when the server defers backend initialization to a
+	 * concurrent thread: @cb and storage sizes are filled in later,
+	 * before the node starts serving commands.
+	 * Managed by the server startup path, do not set manually.
+	 */
+	int			cb_deferred;
+
 	/*
 	 * Free and total space on given storage.
 	 */
@@ -395,12 +418,134 @@ struct dnet_config
 
 	int			cache_sync_timeout;
 
-	/* so that we do not change major version frequently */
-	int			reserved_for_future_use[11];
+	/*
+	 * Number of independently locked queue shards in every IO processing pool.
+	 * Zero means single queue protected by single lock - old behaviour.
+	 */
+	int			io_pool_queue_shards;
+
+	/*
+	 * Network engine used by network processing threads, DNET_NET_IO_ENGINE_*.
+	 * io_uring engine requires liburing at build time and kernel 5.1+,
+	 * otherwise node falls back to epoll.
+	 */
+	int			net_io_engine;
+
+	/*
+	 * Blocking IO pool size bounds for runtime autoscaling.
+	 * When max > min > 0, pool monitor thread grows/shrinks the pool
+	 * within these bounds following the queue depth, otherwise pool
+	 * statically contains @io_thread_num threads.
+	 */
+	int			io_thread_num_min;
+	int			io_thread_num_max;
+
+	/*
+	 * When set on multi-socket machine (and elliptics is built with
+	 * libnuma), IO pool queue shards are spread over NUMA nodes, worker
+	 * threads are pinned to the node of their shard and requests prefer
+	 * workers on the node their buffer was allocated on.
+	 */
+	int			numa_aware;
+
+	/*
+	 * Transform used to hash keys into ids and to checksum data,
+	 * DNET_TRANSFORM_*. The fast non-cryptographic transform trades
+	 * collision and tampering resistance for hashing speed and only makes
+	 * sense on fully trusted clusters. Every node and every client of a
+	 * cluster must use the same transform - ids and checksums are not
+	 * comparable across transforms.
+	 */
+	int			transform;
+
+	/*
+	 * Number of striped reader-writer key locks serializing command
+	 * processing. Keys hash onto stripes, so this bounds both memory and
+	 * false contention between distinct keys. Zero selects the default.
+	 */
+	int			oplock_num;
+
+	/*
+	 * TCP port of the embedded HTTP monitoring endpoint serving
+	 * read-only JSON statistic snapshots: counters, latency
+	 * histograms, slow command samples and IO queue depths.
+	 * Zero disables the endpoint.
+	 */
+	int			monitor_port;
+
+	/*
+	 * Commands whose processing takes at least this many microseconds
+	 * are sampled into the slow command ring exported together with the
+	 * per-command latency histograms via DNET_CMD_STAT_COUNT with
+	 * DNET_ATTR_CNTR_HISTOGRAM set. Zero disables sampling.
+	 */
+	long			slow_cmd_threshold;
+
+	/*
+	 * Number of cache shards @cache_size is split into. Every shard is
+	 * locked independently, so this should grow with the number of cores
+	 * actually hitting the cache. Zero selects the default.
+	 */
+	int			cache_shards;
+
+	/*
+	 * Write-back cache sync batching limits: at most this many dirty
+	 * entries / bytes are snapshotted, sorted by id and flushed to the
+	 * backend per batch. Zero selects the defaults (128 entries, 8MB).
+	 */
+	int			cache_sync_batch_size;
+	int			cache_sync_batch_bytes;
+
+	/*
+	 * At most this many index-internal update transactions are kept in
+	 * flight per DNET_CMD_INDEXES_UPDATE command, the rest are issued as
+	 * replies come back. Zero means no limit.
+	 */
+	int			indexes_update_window;
+
+	/*
+	 * Number of TCP connections opened to every remote node. Small
+	 * transactions are spread over them round-robin and large transfers
+	 * prefer a dedicated connection, so one bulk stream does not
+	 * head-of-line block interactive lookups. Zero or one keeps a single
+	 * connection per node.
+	 */
+	int			connections_per_addr;
+
+	/*
+	 * Sampled traffic capture: every @capture_sample'th processed command
+	 * header is appended to the binary journal at @capture_journal, see
+	 * struct dnet_capture_record. Zero @capture_sample (or NULL path)
+	 * disables capture.
+	 */
+	char			*capture_journal;
+	int			capture_sample;
+
+	/*
+	 * Per-tenant QoS budgets: space-separated 'class:ops_per_sec:bytes_per_sec'
+	 * triplets, class is the DNET_FLAGS_QOS value 1..15, zero limit means
+	 * unlimited in that dimension. NULL disables QoS entirely.
+	 */
+	char			*qos;
 };
 
 struct dnet_node *dnet_get_node_from_state(void *state);
 
+/*
+ * Approximate number of requests queued in the node's IO processing pools.
+ * Backends use it as a foreground-load probe, for example to defer
+ * defragmentation while clients are waiting.
+ */
+uint64_t dnet_node_io_queue_size(struct dnet_node *n);
+
+/*
+ * Fills IO queue statistics fields of the DNET_CMD_STAT reply (queue
+ * depth, wait time and send queue length, see struct dnet_stat).
+ * Backends call it right before sending the reply, when the rest of the
+ * structure has already been converted to wire order.
+ */
+void dnet_fill_queue_stat(void *state, struct dnet_stat *st);
+
 int __attribute__((weak)) dnet_session_set_groups(struct dnet_session *s, const int *groups, int group_num);
 int *dnet_session_get_groups(struct dnet_session *s, int *count);
 
@@ -423,6 +568,7 @@ void dnet_session_set_timeout(struct dnet_session *s, unsigned int wait_timeout)
 struct timespec *dnet_session_get_timeout(struct dnet_session *s);
 
 int dnet_session_set_ns(struct dnet_session *s, const char *ns, int nsize);
+const char *dnet_session_get_ns(struct dnet_session *s, int *nsize);
 
 struct dnet_node *dnet_session_get_node(struct dnet_session *s);
 
@@ -435,6 +581,12 @@ struct dnet_node *dnet_session_get_node(struct dnet_session *s);
  */
 int dnet_log_init(struct dnet_node *s, struct dnet_log *l);
 void __attribute__((weak)) dnet_log_raw(struct dnet_node *n, int level, const char *format, ...) DNET_LOG_CHECK;
+/*
+ * Waits until the asynchronous log pipeline has delivered everything queued
+ * so far. Must be called before a log sink referenced by queued records goes
+ * away - dnet_node_destroy() does it for the node's own logger.
+ */
+void dnet_log_flush(void);
 
 #define NIP6(addr) \
 	(addr).s6_addr[0], \
@@ -710,6 +862,23 @@ static inline int dnet_id_cmp(const struct dnet_id *id1, const struct dnet_id *i
 int __attribute__((weak)) dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more);
 int __attribute__((weak)) dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more);
 
+/*
+ * Scatter-gather variant of dnet_send_reply(): payload fragments are not
+ * copied, they are referenced from the send queue and pushed to the socket
+ * via writev(). @iov_free (if set) is invoked with @iov_priv when the last
+ * fragment has been sent or the request has been dropped, releasing fragment
+ * owner. On error @iov_free is not called and fragments stay owned by caller.
+ */
+int __attribute__((weak)) dnet_send_reply_iov(void *state, struct dnet_cmd *cmd, const struct iovec *iov, int iov_num,
+		int more, void (* iov_free)(void *iov_priv), void *iov_priv);
+
+/*
+ * Scatter-gather variant of dnet_send_read_data(): same reply header setup,
+ * but data fragments are sent without coalescing, see dnet_send_reply_iov().
+ */
+int __attribute__((weak)) dnet_send_read_data_iov(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		const struct iovec *iov, int iov_num, void (* iov_free)(void *iov_priv), void *iov_priv);
+
 
 /*
  * Request statistics from the node corresponding to given ID.
@@ -771,6 +940,8 @@ struct dnet_trans_control
  * Allocate and send transaction according to above control structure.
  */
 int dnet_trans_alloc_send(struct dnet_session *s, struct dnet_trans_control *ctl);
+/* Same, but to an explicitly resolved state instead of routing by ctl->id */
+int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl);
 int dnet_trans_create_send_all(struct dnet_session *s, struct dnet_io_control *ctl);
 
 int dnet_request_cmd(struct dnet_session *s, struct dnet_trans_control *ctl);
@@ -779,6 +950,8 @@ int dnet_fill_addr(struct dnet_addr *addr, const char *saddr, const int port, co
 
 /* Change node status on given address or ID */
 int dnet_update_status(struct dnet_session *s, struct dnet_addr *addr, struct dnet_id *id, struct dnet_node_status *status);
+int dnet_update_status_tune(struct dnet_session *s, struct dnet_addr *addr, struct dnet_id *id,
+		struct dnet_node_status *status, struct dnet_node_tune *tune);
 
 /*
  * Remove object by @id
@@ -812,6 +985,20 @@ int dnet_transform(struct dnet_session *s, const void *src, uint64_t size, struc
 int __attribute__((weak)) dnet_transform_node(struct dnet_node *n, const void *src, uint64_t size,
 		unsigned char *csum, int csize);
 int dnet_transform_raw(struct dnet_session *s, const void *src, uint64_t size, char *csum, unsigned int csize);
+/*
+ * Transforms @num independent buffers in one call. When the node's transform
+ * provides a batch mode (the default SHA512 one hashes several buffers in
+ * parallel on capable CPUs), it is noticeably faster than a loop of
+ * dnet_transform_node() calls.
+ */
+int dnet_transform_node_batch(struct dnet_node *n, const void *const *srcs, const uint64_t *sizes,
+		unsigned char *const *csums, int csize, int num);
+/*
+ * Session-aware variant of the above: the session namespace salts every
+ * buffer the same way dnet_transform() does.
+ */
+int dnet_transform_raw_batch(struct dnet_session *s, const void *const *srcs, const uint64_t *sizes,
+		char *const *csums, unsigned int csize, int num);
 
 /*
  * Transform object id to id where to store object's secondary indexes table
@@ -821,9 +1008,30 @@ void dnet_indexes_transform_object_id(struct dnet_node *node, const struct dnet_
  * Transform index id to id where to store secondary index's objects table
  */
 void dnet_indexes_transform_index_id(struct dnet_node *node, const struct dnet_raw_id *src, struct dnet_raw_id *id, int shard_id);
+/*
+ * Same with an explicit shard count instead of the node-wide one
+ */
+void dnet_indexes_transform_index_id_raw(struct dnet_node *node, const struct dnet_raw_id *src,
+		struct dnet_raw_id *id, int shard_id, int shard_count);
+/*
+ * Same for @num index ids at once, batching the underlying hash calls
+ */
+void dnet_indexes_transform_index_ids(struct dnet_node *node, const struct dnet_raw_id *const *srcs,
+		struct dnet_raw_id *const *ids, int shard_id, int num);
+void dnet_indexes_transform_index_ids_raw(struct dnet_node *node, const struct dnet_raw_id *const *srcs,
+		struct dnet_raw_id *const *ids, int shard_id, int shard_count, int num);
 int dnet_indexes_get_shard_id(struct dnet_node *node, const struct dnet_raw_id *object_id);
+int dnet_indexes_get_shard_id_raw(const struct dnet_raw_id *object_id, int shard_count);
 int dnet_node_get_indexes_shard_count(struct dnet_node *node);
 
+/*
+ * Per-session index shard count override, zero restores the node-wide
+ * indexes_shard_count. Set it together with the namespace to shard hot
+ * indexes of that namespace wider over the ring.
+ */
+void dnet_session_set_indexes_shard_count(struct dnet_session *s, int shard_count);
+int dnet_session_get_indexes_shard_count(struct dnet_session *s);
+
 int dnet_lookup_addr(struct dnet_session *s, const void *remote, int len, struct dnet_id *id, int group_id, char *dst, int dlen);
 
 struct dnet_id_param {
@@ -910,6 +1118,22 @@ static inline int is_trans_destroyed(struct dnet_net_state *st, struct dnet_cmd
 
 int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp);
 
+/*
+ * Tail (roughly p99) READ/LOOKUP latency estimate in microseconds for the
+ * state which serves @id, based on the per-state EWMA latency tracking.
+ * Returns 0 when there is no such state or no sample has been taken yet.
+ * Used by clients to pick a hedged-read delay.
+ */
+long dnet_get_read_latency_p99(struct dnet_session *s, struct dnet_id *id);
+
+/*
+ * Runs @func(@priv) once after @delay_usec microseconds on a dedicated
+ * node thread. The call is guaranteed to fire: on node shutdown pending
+ * entries are executed early instead of being dropped, so @priv may be
+ * owned (and freed) by the callback itself.
+ */
+int dnet_node_defer(struct dnet_node *n, long delay_usec, void (* func)(void *priv), void *priv);
+
 char * __attribute__((weak)) dnet_cmd_string(int cmd);
 char *dnet_counter_string(int cntr, int cmd_num);
 
@@ -29,6 +29,11 @@ public:
  * This is abstract class for simple (aka uncomplicated) interface
  * of elliptics module. This class must be used if you don't interested
  * in internal elliptics structres, and just want to make it work fast.
+ *
+ * Modules that need scatter-gather replies should use
+ * @a honest_command_handler instead: its handlers receive the state and
+ * command and can feed iovec fragments straight into
+ * dnet_send_read_data_iov() without copying.
  */
 class uncomplicated_handler {
 public:
@@ -36,6 +41,22 @@ public:
      * This function should implement reading data by key
      */
 	virtual std::string read(const std::string &key)=0;
+	/**
+	 * Zero-copy variant of read(): point elliptics at an open
+	 * descriptor instead of copying the object into a reply buffer.
+	 * On success fill @a fd, @a offset and @a size with the record
+	 * location - the reply is then forwarded through the same
+	 * fd-based send path the eblob backend uses, without a userspace
+	 * copy. Elliptics does not close the descriptor; it must stay
+	 * valid at least until the module is destroyed.
+	 * The default implementation returns -ENOTSUP, which makes
+	 * elliptics fall back to the copying read().
+	 */
+	virtual int read_fd(const std::string & /*key*/, int & /*fd*/,
+			uint64_t & /*offset*/, uint64_t & /*size*/)
+	{
+		return -ENOTSUP;
+	}
 	virtual ~uncomplicated_handler() {};
 };
 
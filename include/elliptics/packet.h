@@ -61,6 +61,18 @@ enum dnet_commands {
 	DNET_CMD_INDEXES_UPDATE,		/* Update secondary indexes for id */
 	DNET_CMD_INDEXES_INTERNAL,		/* Update identificators table for certain secondary index. Internal usage only */
 	DNET_CMD_INDEXES_FIND,		/* Find all objects by indexes */
+	DNET_CMD_BATCH,			/* Envelope carrying several sub-commands executed in one network exchange.
+					 * Payload is a sequence of (struct dnet_cmd, data) pairs in wire order,
+					 * replies and acks of every sub-command are sent within the envelope
+					 * transaction with DNET_FLAGS_MORE set, envelope ack completes it. */
+	DNET_CMD_RANGE_DIFF,		/* Server-to-server replica diff: the receiving node iterates the given
+					 * key range locally, fetches (key, timestamp, checksum) digests of the
+					 * same range from its counterpart in the requested remote group via
+					 * DNET_CMD_ITERATOR, and replies with the divergent keys only. */
+	DNET_CMD_BULK_DEL,		/* Remove a number of ids at one time. Payload mirrors DNET_CMD_BULK_READ:
+					 * a dnet_io_attr header followed by the array of per-key dnet_io_attr.
+					 * Reply is a packed array of struct dnet_bulk_del_entry, one per key
+					 * in submission order. */
 	DNET_CMD_UNKNOWN,			/* This slot is allocated for statistics gathered for unknown commands */
 	__DNET_CMD_MAX,
 };
@@ -92,6 +104,14 @@ enum dnet_counters {
 	DNET_CNTR_DBR_ERROR,			/* Kyoto Cabinet DB read error */
 	DNET_CNTR_DBW_SYSTEM,			/* Kyoto Cabinet DB write error KCESYSTEM */
 	DNET_CNTR_DBW_ERROR,			/* Kyoto Cabinet DB write error */
+	DNET_CNTR_CACHE_HIT,			/* In-memory cache read hits */
+	DNET_CNTR_CACHE_MISS,			/* In-memory cache read misses */
+	DNET_CNTR_CACHE_EVICT,			/* In-memory cache entries evicted */
+	DNET_CNTR_CACHE_SYNC_QUEUE,		/* Dirty in-memory cache entries queued for sync */
+	DNET_CNTR_CACHE_BYTES,			/* Bytes resident in the in-memory cache */
+	DNET_CNTR_CACHE_LOCK_WAIT,		/* Cumulative cache shard lock wait, ms */
+	DNET_CNTR_CACHE_HOT_PIN,		/* In-memory cache evictions skipped because the entry is hot */
+	DNET_CNTR_QOS_DEMOTED,			/* Requests demoted to the background lane by per-tenant QoS */
 	DNET_CNTR_UNKNOWN,			/* This slot is allocated for statistics gathered for unknown counters */
 	__DNET_CNTR_MAX,
 };
@@ -131,6 +151,63 @@ enum dnet_counters {
 /* Currently only valid flag for LOOKUP command - when set, don't check fileinfo in cache */
 #define DNET_FLAGS_NOCACHE		(1<<6)
 
+/*
+ * Command is background traffic (recovery, bulk ingest and so on) -
+ * server IO pool serves it from the low-priority lane so interactive
+ * requests do not queue behind it. Clients mark their sessions via
+ * session::set_cflags(DNET_FLAGS_BACKGROUND).
+ */
+#define DNET_FLAGS_BACKGROUND		(1<<7)
+
+/*
+ * Collect per-hop span timestamps for this command: the server records
+ * when the command was queued, dequeued and processed and returns the
+ * timestamps in a trace annex (struct dnet_trace_annex) appended to the
+ * final ack. Sampled clients set it via session::set_cflags() together
+ * with a trace id; the extra ack packet is the cost of tracing.
+ */
+#define DNET_FLAGS_TRACE		(1<<8)
+
+/*
+ * Reply payload tail carries struct dnet_trace_annex. Set by the server
+ * on the final ack of traced transactions, stripped by the client
+ * library before the completion callback runs, so command parsers never
+ * see the annex.
+ */
+#define DNET_FLAGS_TRACE_ANNEX		(1<<9)
+
+/*
+ * Reply header arrived in compact form (struct dnet_cmd_compact) without
+ * the destination ID. Set locally by the receive path when it expands the
+ * header, cleared again once the ID is restored from the matched
+ * transaction - command handlers and completions never see it.
+ */
+#define DNET_FLAGS_COMPACT		(1<<10)
+
+/*
+ * Packet body is LZ4 compressed: the payload past the command header was
+ * replaced by struct dnet_lz4_hdr, an uncompressed attribute-header
+ * prefix and an LZ4 block. Only set on connections which negotiated
+ * DNET_CAPABILITIES_LZ4 during the reverse lookup handshake; the receive
+ * path expands the body and clears the flag before the packet enters the
+ * command machinery.
+ */
+#define DNET_FLAGS_LZ4			(1<<11)
+
+/*
+ * Per-tenant QoS class carried in command flags bits 12-15, zero means
+ * untagged/default. Sessions tag their commands via
+ * session::set_qos_class(), servers with a configured budget for the
+ * class ('qos' config option) enforce token-bucket ops/s and bytes/s
+ * limits at IO queue admission: requests over budget are demoted to the
+ * background lane instead of being dropped, so a batch tenant is
+ * throttled to leftover capacity while interactive tenants keep their
+ * latency.
+ */
+#define DNET_FLAGS_QOS_SHIFT		12
+#define DNET_FLAGS_QOS_MASK		0xfULL
+#define DNET_FLAGS_QOS(flags)		((int)(((flags) >> DNET_FLAGS_QOS_SHIFT) & DNET_FLAGS_QOS_MASK))
+
 struct dnet_id {
 	uint8_t			id[DNET_ID_SIZE];
 	uint32_t		group_id;
@@ -178,6 +255,82 @@ static inline void dnet_convert_cmd(struct dnet_cmd *cmd)
 	cmd->trans = dnet_bswap64(cmd->trans);
 }
 
+/*
+ * Compact wire framing, negotiated during the reverse lookup handshake.
+ *
+ * When both peers advertise support, every packet on the connection is
+ * prefixed with a 4-byte frame tag. Requests still carry the full
+ * struct dnet_cmd (routing needs the ID), but replies are sent as
+ * struct dnet_cmd_compact: the receiver already holds the full command,
+ * including the ID, in the transaction it matches the reply against, so
+ * resending those bytes with every reply packet is pure overhead.
+ * Connections which did not negotiate (older peers, extra sibling
+ * connections which skip the handshake) stay on the untagged full format.
+ */
+#define DNET_FRAME_FULL			0x46454e44	/* "DNEF" */
+#define DNET_FRAME_COMPACT		0x43454e44	/* "DNEC" */
+
+struct dnet_cmd_compact
+{
+	int			status;
+	int			cmd;
+	uint64_t		flags;
+	uint64_t		trans;
+	uint64_t		size;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_cmd_compact(struct dnet_cmd_compact *cmd)
+{
+	cmd->status = dnet_bswap32(cmd->status);
+	cmd->cmd = dnet_bswap32(cmd->cmd);
+	cmd->flags = dnet_bswap64(cmd->flags);
+	cmd->trans = dnet_bswap64(cmd->trans);
+	cmd->size = dnet_bswap64(cmd->size);
+}
+
+/*
+ * Body prefix of an LZ4-compressed packet (DNET_FLAGS_LZ4). The body is
+ * laid out as this header, @raw_size bytes kept uncompressed (attribute
+ * headers the command machinery parses before the payload) and one LZ4
+ * block which expands to @orig_size bytes; cmd->size covers the whole
+ * compressed body.
+ */
+struct dnet_lz4_hdr {
+	uint64_t		orig_size;
+	uint64_t		raw_size;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_lz4_hdr(struct dnet_lz4_hdr *h)
+{
+	h->orig_size = dnet_bswap64(h->orig_size);
+	h->raw_size = dnet_bswap64(h->raw_size);
+}
+
+/*
+ * Per-hop span timestamps of a traced command (DNET_FLAGS_TRACE), all
+ * in microseconds of the serving node's clock: when the command was
+ * fully received and put into the IO processing queue, when an IO
+ * worker picked it up, when the command handler was invoked and when
+ * the final ack was queued for sending. Consecutive differences give
+ * queue wait, dispatch overhead and backend processing time, the client
+ * subtracts the whole server residence from its own round-trip to get
+ * the network share.
+ */
+struct dnet_trace_annex {
+	uint64_t		queue_time;
+	uint64_t		dequeue_time;
+	uint64_t		proc_time;
+	uint64_t		send_time;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_trace_annex(struct dnet_trace_annex *a)
+{
+	a->queue_time = dnet_bswap64(a->queue_time);
+	a->dequeue_time = dnet_bswap64(a->dequeue_time);
+	a->proc_time = dnet_bswap64(a->proc_time);
+	a->send_time = dnet_bswap64(a->send_time);
+}
+
 /*
  * cmd flags which are not 'common' to all commands
  * they occupy higher 32 bits
@@ -189,6 +342,9 @@ static inline void dnet_convert_cmd(struct dnet_cmd *cmd)
 /* What type of counters to fetch */
 #define DNET_ATTR_CNTR_GLOBAL			(1ULL<<32)
 
+/* Fetch per-command latency histograms and slow command samples instead of plain counters */
+#define DNET_ATTR_CNTR_HISTOGRAM		(1ULL<<33)
+
 /* Bulk request for checking files */
 #define DNET_ATTR_BULK_CHECK			(1ULL<<32)
 
@@ -239,6 +395,26 @@ static inline void dnet_convert_addr_cmd(struct dnet_addr_cmd *acmd)
 	dnet_convert_cmd(&acmd->cmd);
 }
 
+/*
+ * Route table version exchange for incremental DNET_CMD_ROUTE_LIST.
+ *
+ * The version is a monotonic per-node counter bumped whenever the local
+ * route table changes. A route list request may carry the version the
+ * requester saw last: when it still matches, the node replies with a
+ * bare ack instead of resending the whole table. Full transfers are
+ * followed by a version-only reply record (recognized by its size), so
+ * the requester knows which version the received table corresponds to.
+ */
+struct dnet_route_version
+{
+	uint64_t		version;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_route_version(struct dnet_route_version *rv)
+{
+	rv->version = dnet_bswap64(rv->version);
+}
+
 static inline int dnet_addr_equal(struct dnet_addr *a1, struct dnet_addr *a2)
 {
 	if (a1->family != a2->family)
@@ -339,6 +515,18 @@ static inline void dnet_convert_list(struct dnet_list *l)
  */
 #define DNET_IO_FLAGS_WRITE_NO_FILE_INFO	(1<<14)
 
+/*
+ * Access-pattern hints for the backend read path.
+ * SEQUENTIAL: the client will stream the object (or a range of objects) in order,
+ * the backend asks the kernel for aggressive readahead.
+ * RANDOM: point lookups, readahead would only pollute the page cache.
+ * WILLNEED: the data will be read again shortly, start populating the cache now.
+ * Hints only - backends are free to ignore them.
+ */
+#define DNET_IO_FLAGS_SEQUENTIAL	(1<<15)
+#define DNET_IO_FLAGS_RANDOM		(1<<16)
+#define DNET_IO_FLAGS_WILLNEED		(1<<17)
+
 #define DNET_INDEXES_FLAGS_INTERSECT		(1<<0)
 #define DNET_INDEXES_FLAGS_UNITE		(1<<1)
 #define DNET_INDEXES_FLAGS_UPDATE_ONLY	(1<<2)
@@ -363,6 +551,36 @@ static inline int dnet_time_before(struct dnet_time *t1, struct dnet_time *t2)
 }
 #define dnet_time_after(t2, t1) 	dnet_time_before(t1, t2)
 
+/*
+ * Sampled command journal: when capture is enabled on the server (see
+ * dnet_config::capture_journal), every Nth processed command header is
+ * appended to a binary journal as a fixed-size record, preserving the
+ * arrival timestamp, key, command and payload size of real traffic.
+ * The journal can later be replayed against a test cluster (dnet_replay).
+ *
+ * Records are written in host byte order - the journal is a local
+ * diagnostic artifact, not a wire format, and is consumed offline.
+ */
+#define DNET_CAPTURE_MAGIC	0x4a504143444e4554ULL	/* "DNETCAPJ" */
+#define DNET_CAPTURE_VERSION	1
+
+struct dnet_capture_header
+{
+	uint64_t		magic;
+	uint32_t		version;
+	uint32_t		pad;
+} __attribute__ ((packed));
+
+struct dnet_capture_record
+{
+	struct dnet_time	ts;		/* command arrival time */
+	struct dnet_id		id;
+	uint64_t		flags;
+	uint64_t		size;		/* payload size, without the header */
+	int32_t			cmd;
+	uint32_t		pad;
+} __attribute__ ((packed));
+
 struct dnet_io_attr
 {
 	uint8_t			parent[DNET_ID_SIZE];
@@ -403,6 +621,22 @@ static inline void dnet_convert_io_attr(struct dnet_io_attr *a)
 	a->size = dnet_bswap64(a->size);
 }
 
+/*
+ * Per-key result of DNET_CMD_BULK_DEL: the reply carries a packed array of
+ * these, one entry per submitted key in submission order.
+ */
+struct dnet_bulk_del_entry
+{
+	uint8_t			id[DNET_ID_SIZE];
+	int32_t			status;
+	uint8_t			reserved[12];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_bulk_del_entry(struct dnet_bulk_del_entry *e)
+{
+	e->status = dnet_bswap32(e->status);
+}
+
 struct dnet_history_entry
 {
 	uint8_t			id[DNET_ID_SIZE];
@@ -488,11 +722,50 @@ struct dnet_stat
 	uint64_t		vm_cached;
 	uint64_t		vm_buffers;
 
+	/*
+	 * Age of this statistics snapshot in milliseconds. Nonzero when the
+	 * node samples statistics in background (see the backend's
+	 * 'stat_refresh_interval' option), zero when the reply was sampled
+	 * synchronously. Occupies former reserved space, so the structure
+	 * size did not change.
+	 */
+	uint64_t		stat_age_ms;
+
+	/*
+	 * Defragmentation scheduler progress: state is 0 when the scheduler
+	 * is idle, 1 while a scheduled defragmentation waits for foreground
+	 * IO load to drop and 2 while defragmentation runs; state_sec counts
+	 * seconds spent in the current state.
+	 */
+	uint64_t		defrag_state;
+	uint64_t		defrag_state_sec;
+
+	/*
+	 * IO processing queue statistics, filled by the server core via
+	 * dnet_fill_queue_stat(): for the blocking and nonblocking
+	 * (io_nb_*) IO pools - current queue length summed over per-thread
+	 * shards, peak length over the recent sampling interval, total
+	 * number of processed requests and total number of microseconds
+	 * those requests spent waiting in the queues. The latter two are
+	 * cumulative, so two subsequent snapshots give the average queue
+	 * wait time over the period. @send_queue_size is the summary
+	 * number of replies sitting in per-client send queues.
+	 */
+	uint64_t		io_queue_size;
+	uint64_t		io_queue_max;
+	uint64_t		io_queue_num;
+	uint64_t		io_queue_wait_time;
+	uint64_t		io_nb_queue_size;
+	uint64_t		io_nb_queue_max;
+	uint64_t		io_nb_queue_num;
+	uint64_t		io_nb_queue_wait_time;
+	uint64_t		send_queue_size;
+
 	/*
 	 * Per node IO statistics will live here.
 	 * Reserved for future use.
 	 */
-	uint64_t		reserved[32];
+	uint64_t		reserved[20];
 };
 
 static inline void dnet_convert_stat(struct dnet_stat *st)
@@ -519,6 +792,20 @@ static inline void dnet_convert_stat(struct dnet_stat *st)
 	st->vm_free = dnet_bswap64(st->vm_free);
 	st->vm_buffers = dnet_bswap64(st->vm_buffers);
 	st->vm_cached = dnet_bswap64(st->vm_cached);
+
+	st->stat_age_ms = dnet_bswap64(st->stat_age_ms);
+	st->defrag_state = dnet_bswap64(st->defrag_state);
+	st->defrag_state_sec = dnet_bswap64(st->defrag_state_sec);
+
+	st->io_queue_size = dnet_bswap64(st->io_queue_size);
+	st->io_queue_max = dnet_bswap64(st->io_queue_max);
+	st->io_queue_num = dnet_bswap64(st->io_queue_num);
+	st->io_queue_wait_time = dnet_bswap64(st->io_queue_wait_time);
+	st->io_nb_queue_size = dnet_bswap64(st->io_nb_queue_size);
+	st->io_nb_queue_max = dnet_bswap64(st->io_nb_queue_max);
+	st->io_nb_queue_num = dnet_bswap64(st->io_nb_queue_num);
+	st->io_nb_queue_wait_time = dnet_bswap64(st->io_nb_queue_wait_time);
+	st->send_queue_size = dnet_bswap64(st->send_queue_size);
 }
 
 struct dnet_io_notification
@@ -609,6 +896,65 @@ static inline int dnet_time_is_empty(struct dnet_time *t)
 	return 0;
 }
 
+/*
+ * Per-command-type latency histogram, exported by DNET_CMD_STAT_COUNT
+ * when DNET_ATTR_CNTR_HISTOGRAM is set. Bucket @i counts commands whose
+ * processing took [2^i, 2^(i+1)) usecs, the last bucket collects
+ * everything above. Commands served from the cache and from the storage
+ * backend are accumulated separately.
+ */
+#define DNET_HISTOGRAM_BUCKETS		32
+
+struct dnet_cmd_histogram {
+	uint64_t		cache[DNET_HISTOGRAM_BUCKETS];
+	uint64_t		disk[DNET_HISTOGRAM_BUCKETS];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_cmd_histogram(struct dnet_cmd_histogram *h)
+{
+	int i;
+
+	for (i = 0; i < DNET_HISTOGRAM_BUCKETS; ++i) {
+		h->cache[i] = dnet_bswap64(h->cache[i]);
+		h->disk[i] = dnet_bswap64(h->disk[i]);
+	}
+}
+
+/*
+ * Sample of a command which took at least the configured slow threshold:
+ * the full command header plus its duration and completion time.
+ */
+struct dnet_slow_cmd {
+	struct dnet_cmd		cmd;
+	uint64_t		duration;		/* usecs */
+	struct dnet_time	time;			/* completion wall clock */
+} __attribute__ ((packed));
+
+static inline void dnet_convert_slow_cmd(struct dnet_slow_cmd *s)
+{
+	dnet_convert_cmd(&s->cmd);
+	s->duration = dnet_bswap64(s->duration);
+	dnet_convert_time(&s->time);
+}
+
+/*
+ * Header of the DNET_ATTR_CNTR_HISTOGRAM reply: @cmd_num histograms
+ * follow the header, then @slow_num slow command samples.
+ */
+struct dnet_histogram_stat {
+	int			cmd_num;
+	int			slow_num;
+	uint64_t		slow_threshold;		/* usecs, zero means sampling is disabled */
+	struct dnet_cmd_histogram	histograms[0];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_histogram_stat(struct dnet_histogram_stat *st)
+{
+	st->cmd_num = dnet_bswap32(st->cmd_num);
+	st->slow_num = dnet_bswap32(st->slow_num);
+	st->slow_threshold = dnet_bswap64(st->slow_threshold);
+}
+
 struct dnet_file_info {
 	int			flen;		/* filename length, which goes after this structure */
 	unsigned char		checksum[DNET_CSUM_SIZE];
@@ -660,6 +1006,37 @@ static inline void dnet_convert_node_status(struct dnet_node_status *st)
 	st->log_level = dnet_bswap32(st->log_level);
 }
 
+/* "do not change" sentinel for dnet_node_tune fields */
+#define DNET_TUNE_UNSET			(-1)
+
+/*
+ * Optional runtime tuning extension of DNET_CMD_STATUS: when the command
+ * payload holds this structure right after dnet_node_status, performance
+ * parameters are changed live without node restart. Fields set to
+ * DNET_TUNE_UNSET are left intact, reply carries the current values.
+ */
+struct dnet_node_tune {
+	int32_t			io_thread_num;		/* blocking IO pool size, applied by pool monitor */
+	int32_t			io_thread_num_min;	/* autoscale bounds, both must be set to take effect */
+	int32_t			io_thread_num_max;
+	int32_t			wait_timeout;		/* seconds */
+	int32_t			check_timeout;		/* seconds */
+	int32_t			stall_count;
+	int64_t			cache_size;		/* bytes for the whole data cache */
+	int64_t			reserved[2];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_node_tune(struct dnet_node_tune *t)
+{
+	t->io_thread_num = dnet_bswap32(t->io_thread_num);
+	t->io_thread_num_min = dnet_bswap32(t->io_thread_num_min);
+	t->io_thread_num_max = dnet_bswap32(t->io_thread_num_max);
+	t->wait_timeout = dnet_bswap32(t->wait_timeout);
+	t->check_timeout = dnet_bswap32(t->check_timeout);
+	t->stall_count = dnet_bswap32(t->stall_count);
+	t->cache_size = dnet_bswap64(t->cache_size);
+}
+
 #define DNET_AUTH_COOKIE_SIZE	32
 
 struct dnet_auth {
@@ -730,9 +1107,39 @@ enum {
 #define DNET_IFLAGS_KEY_RANGE		(1<<1)
 /* When set timestamp range is used */
 #define DNET_IFLAGS_TS_RANGE		(1<<2)
+
+/*
+ * Server-side user_flags predicate: ship only records where
+ * (user_flags & user_flags_mask) == user_flags_value.
+ * Evaluated before the response is built, so filtered-out records
+ * cost no network traffic at all.
+ */
+#define DNET_IFLAGS_USER_FLAGS		(1<<3)
+
+/*
+ * Compute data checksum server-side and return it in the response.
+ * Combined with unset DNET_IFLAGS_DATA this turns the iterator into a
+ * verification scan: replicas are compared by (key, timestamp, size,
+ * checksum) at metadata bandwidth instead of shipping every record.
+ */
+#define DNET_IFLAGS_CSUM		(1<<4)
+
+/*
+ * Checkpointed/resumable iteration. The server periodically persists how
+ * many backend records the iterator keyed by dnet_iterator_request::id has
+ * already shipped, and a restarted iterator with the same non-zero id and
+ * this flag set skips that many leading records instead of rescanning from
+ * zero. Relies on backend iteration order being stable between runs (file
+ * order), which holds unless the base was defragmented in between.
+ * The checkpoint is removed once the iterator completes successfully.
+ */
+#define DNET_IFLAGS_RESUME		(1<<5)
+
 /* Sanity */
 #define DNET_IFLAGS_ALL			(DNET_IFLAGS_DATA	\
-		| DNET_IFLAGS_KEY_RANGE | DNET_IFLAGS_TS_RANGE)
+		| DNET_IFLAGS_KEY_RANGE | DNET_IFLAGS_TS_RANGE	\
+		| DNET_IFLAGS_USER_FLAGS | DNET_IFLAGS_CSUM	\
+		| DNET_IFLAGS_RESUME)
 
 enum dnet_iterator_types {
 	DNET_ITYPE_FIRST,		/* Sanity */
@@ -753,6 +1160,7 @@ enum dnet_iterator_action {
 	DNET_ITERATOR_ACTION_PAUSE,	/* Pause iterator */
 	DNET_ITERATOR_ACTION_CONTINUE,	/* Continue previously paused iterator */
 	DNET_ITERATOR_ACTION_CANCEL,	/* Cancel running or paused iterator */
+	DNET_ITERATOR_ACTION_LIMIT,	/* Set rate limits of running iterator */
 	DNET_ITERATOR_ACTION_LAST,	/* Sanity */
 };
 
@@ -774,7 +1182,11 @@ struct dnet_iterator_request
 	struct dnet_time		time_end;	/* End time */
 	uint32_t			itype;		/* Callback to use: Net/File, XXX: enum */
 	uint64_t			flags;		/* DNET_IFLAGS_* */
-	uint64_t			reserved[5];
+	uint64_t			user_flags_mask;	/* DNET_IFLAGS_USER_FLAGS predicate */
+	uint64_t			user_flags_value;
+	uint64_t			limit_bytes_per_sec;	/* Reply rate limits, zero: unlimited. */
+	uint64_t			limit_replies_per_sec;	/* Set at start or via ACTION_LIMIT mid-flight. */
+	uint64_t			reserved[1];
 } __attribute__ ((packed));
 
 static inline void dnet_convert_iterator_request(struct dnet_iterator_request *r)
@@ -786,6 +1198,10 @@ static inline void dnet_convert_iterator_request(struct dnet_iterator_request *r
 	r->range_num = dnet_bswap64(r->range_num);
 	dnet_convert_time(&r->time_begin);
 	dnet_convert_time(&r->time_end);
+	r->user_flags_mask = dnet_bswap64(r->user_flags_mask);
+	r->user_flags_value = dnet_bswap64(r->user_flags_value);
+	r->limit_bytes_per_sec = dnet_bswap64(r->limit_bytes_per_sec);
+	r->limit_replies_per_sec = dnet_bswap64(r->limit_replies_per_sec);
 }
 
 /*
@@ -800,7 +1216,12 @@ struct dnet_iterator_response
 	struct dnet_time		timestamp;	/* Timestamp from extended header */
 	uint64_t			user_flags;	/* User flags set in extended header */
 	uint64_t			size;
-	uint64_t			reserved[4];
+	/*
+	 * Truncated data checksum, filled when DNET_IFLAGS_CSUM was
+	 * requested, zero otherwise. Occupies former reserved space,
+	 * so the response size did not change.
+	 */
+	unsigned char			checksum[32];
 } __attribute__ ((packed));
 
 static inline void dnet_convert_iterator_response(struct dnet_iterator_response *r)
@@ -810,6 +1231,60 @@ static inline void dnet_convert_iterator_response(struct dnet_iterator_response
 	dnet_convert_time(&r->timestamp);
 }
 
+/*
+ * Range diff request: ask a node to compare one key range of its own data
+ * against the same range in @group_id and return only divergent keys.
+ * The range must be route-intersected by the caller so that a single
+ * remote node owns it completely.
+ */
+struct dnet_range_diff_request
+{
+	uint32_t			group_id;	/* Remote group to diff against */
+	uint64_t			flags;		/* DNET_IFLAGS_TS_RANGE / DNET_IFLAGS_CSUM */
+	struct dnet_time		time_begin;	/* Timestamp predicate, used with TS_RANGE */
+	struct dnet_time		time_end;
+	struct dnet_iterator_range	range;		/* Key range to compare */
+	uint64_t			reserved[2];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_range_diff_request(struct dnet_range_diff_request *r)
+{
+	r->group_id = dnet_bswap32(r->group_id);
+	r->flags = dnet_bswap64(r->flags);
+	dnet_convert_time(&r->time_begin);
+	dnet_convert_time(&r->time_end);
+}
+
+/* Reasons a key ended up in the diff, set in dnet_range_diff_entry.flags */
+#define DNET_DIFF_REMOTE_MISSING	(1<<0)		/* Key exists locally only */
+#define DNET_DIFF_LOCAL_MISSING		(1<<1)		/* Key exists remotely only */
+#define DNET_DIFF_LOCAL_NEWER		(1<<2)		/* Both exist, local timestamp is newer */
+#define DNET_DIFF_REMOTE_NEWER		(1<<3)		/* Both exist, remote timestamp is newer */
+#define DNET_DIFF_DATA_MISMATCH		(1<<4)		/* Same timestamp, size or checksum differs */
+
+/*
+ * Range diff reply is an array of these, one per divergent key.
+ * Timestamp/size of a missing side are zero.
+ */
+struct dnet_range_diff_entry
+{
+	struct dnet_raw_id		key;
+	uint64_t			flags;		/* DNET_DIFF_* */
+	struct dnet_time		local_ts;
+	struct dnet_time		remote_ts;
+	uint64_t			local_size;
+	uint64_t			remote_size;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_range_diff_entry(struct dnet_range_diff_entry *e)
+{
+	e->flags = dnet_bswap64(e->flags);
+	dnet_convert_time(&e->local_ts);
+	dnet_convert_time(&e->remote_ts);
+	e->local_size = dnet_bswap64(e->local_size);
+	e->remote_size = dnet_bswap64(e->remote_size);
+}
+
 /*
  * Indexes request entry
  */
@@ -831,7 +1306,9 @@ struct dnet_indexes_request
 	uint32_t			flags;
 	uint32_t			shard_id;
 	uint32_t			shard_count;
-	uint64_t			reserved[5];
+	uint64_t			result_offset;	/* Find: skip this many matches per shard */
+	uint64_t			result_limit;	/* Find: return at most this many matches per shard, 0 - no limit */
+	uint64_t			reserved[3];
 	uint64_t			entries_count;	/* Count of indexes */
 	struct dnet_indexes_request_entry	entries[0];	/* List of indexes to set */
 } __attribute__ ((packed));
@@ -862,6 +1339,12 @@ struct dnet_indexes_reply
 
 /* when status flag is set, do not start defrag, just return its status */
 #define DNET_DEFRAG_FLAGS_STATUS	(1<<0)
+/*
+ * when schedule flag is set, the backend does not start defrag right away,
+ * but waits until foreground IO load drops (see the blob backend's
+ * 'defrag_idle_queue' option), progress is exported via dnet_stat
+ */
+#define DNET_DEFRAG_FLAGS_SCHEDULE	(1<<1)
 
 struct dnet_defrag_ctl {
 	uint64_t	flags;
@@ -212,6 +212,10 @@ class iterator_result_container
 		//! Puts difference between \a this and \a other into \a diff
 		void diff(const iterator_result_container &other,
 				iterator_result_container &result) const;
+		//! K-way merges sorted \a inputs: for every key the newest record
+		//! lands in the output with the same index as its origin
+		static void merge(const std::vector<iterator_result_container> &inputs,
+				std::vector<iterator_result_container> &outputs);
 		dnet_iterator_response operator [](size_t n) const;
 
 		int m_fd;
@@ -21,6 +21,7 @@
 #include <functional>
 #include <vector>
 #include <list>
+#include <map>
 
 #include "result_entry.hpp"
 #include "packet.h"
@@ -51,6 +52,8 @@ bool quorum(const std::vector<dnet_cmd> &statuses, size_t total);
 }
 
 class session;
+class batch;
+class exec_reply_stream;
 
 namespace error_handlers
 {
@@ -90,6 +93,40 @@ class transport_control
 		struct dnet_trans_control m_data;
 };
 
+class session_metrics_data;
+
+/*!
+ * Per-command-type counters of session_metrics.
+ *
+ * \a latency is a logarithmic histogram of transaction completion times:
+ * bucket \a i counts completions which took [2^i, 2^(i+1)) microseconds,
+ * the last bucket collects everything above.
+ */
+struct command_metrics
+{
+	enum { latency_buckets = 32 };
+
+	uint64_t	count;
+	uint64_t	errors;
+	uint64_t	latency[latency_buckets];
+};
+
+/*!
+ * Snapshot of client-side request metrics, see session::get_metrics().
+ */
+struct session_metrics
+{
+	//! Operations started and not yet completed
+	uint64_t					in_flight;
+	//! Completed transactions keyed by dnet command id, see dnet_commands
+	std::map<int, command_metrics>			commands;
+	//! Error counters keyed by server address
+	std::map<std::string, uint64_t>			node_errors;
+	//! Lookup cache counters, stay zero unless set_lookup_cache_ttl() enabled the cache
+	uint64_t					lookup_cache_hits;
+	uint64_t					lookup_cache_misses;
+};
+
 struct address
 {
 	address(const std::string &l_host, const int l_port, const int l_family = AF_INET)
@@ -190,6 +227,14 @@ class key
 
 		void transform(session &sess);
 
+		/*!
+		 * Transforms all \a remotes in one batch and returns keys
+		 * which already carry their ids - bulk_read()/bulk_write()
+		 * over such keys do not hash anything. The batch goes through
+		 * the multi-buffer transform path when one is available.
+		 */
+		static std::vector<key> transform_all(session &sess, const std::vector<std::string> &remotes);
+
 		void set_trace_id(uint32_t trace_id) { m_trace_id = trace_id; }
 		uint32_t get_trace_id() { return m_trace_id; }
 
@@ -199,6 +244,13 @@ class key
 		int m_reserved;
 		struct dnet_id m_id;
 		uint32_t m_trace_id;
+		/*
+		 * Transform result cache: a key hashed under @m_transform_ns
+		 * is not hashed again until the session namespace changes -
+		 * lookup-then-read style sequences pay for one SHA512 only.
+		 */
+		bool m_transformed;
+		std::string m_transform_ns;
 };
 
 class session
@@ -273,6 +325,21 @@ class session
 		void			set_error_handler(const result_error_handler &error_handler);
 		result_error_handler	get_error_handler() const;
 
+		/*!
+		 * Complete write results as soon as \a quorum groups acknowledged
+		 * the write instead of waiting for the slowest replica. Straggler
+		 * transactions keep running in the background and their late
+		 * failures are reported through the error handler, not through
+		 * the already completed result.
+		 *
+		 * Zero (the default) waits for all groups as before.
+		 */
+		void			set_write_quorum(size_t quorum);
+		/*!
+		 * Returns write acknowledgement quorum.
+		 */
+		size_t			get_write_quorum() const;
+
 		/*!
 		 * Set exception policy \a policies.
 		 *
@@ -296,6 +363,22 @@ class session
 		 */
 		void			set_namespace(const char *ns, int nsize);
 
+		/*!
+		 * Returns the namespace of this session, empty string when
+		 * none was set.
+		 */
+		std::string		get_namespace() const;
+
+		/*!
+		 * Sets the index shard count used by this session, \a shard_count
+		 * of zero restores the node-wide one. Set it together with the
+		 * namespace to spread hot indexes of that namespace wider over
+		 * the ring; all sessions working with the namespace have to
+		 * agree on the count.
+		 */
+		void			set_indexes_shard_count(int shard_count);
+		int			get_indexes_shard_count() const;
+
 		/*!
 		 * Get id that this session was stuck to.
 		 */
@@ -312,6 +395,35 @@ class session
 		 */
 		uint64_t		get_cflags() const;
 
+		/*!
+		 * Sets QoS class \a qos_class (1..15, 0 - no class) for all commands
+		 * sent through this session. Servers configured with a 'qos' limit
+		 * for that class demote over-budget requests to the low-priority
+		 * i/o lane, they are never dropped.
+		 */
+		void			set_qos_class(uint32_t qos_class);
+		/*!
+		 * Gets QoS class of the session.
+		 */
+		uint32_t		get_qos_class() const;
+
+		/*!
+		 * Enables the client-side lookup cache: successful lookup()
+		 * replies are replayed from memory for \a ttl_seconds before
+		 * the network is asked again. Writes and removes issued through
+		 * this session or any of its copies invalidate the affected key
+		 * immediately, writes from other clients are only noticed once
+		 * the entry expires, so pick a TTL matching how stale an
+		 * address may be. Zero (the default) disables the cache and
+		 * drops all entries. Hit/miss counters are reported by
+		 * get_metrics().
+		 */
+		void			set_lookup_cache_ttl(long ttl_seconds);
+		/*!
+		 * Gets the lookup cache TTL, zero when the cache is disabled.
+		 */
+		long			get_lookup_cache_ttl() const;
+
 		/*!
 		 * Sets i/o flags \a ioflags to the session.
 		 */
@@ -346,11 +458,31 @@ class session
 		long			get_timeout() const;
 
 		/*!
-		 * Sets/gets trace_id for all elliptics commands
+		 * Sets/gets trace_id for all elliptics commands.
+		 *
+		 * Trace id enables verbose logging for the marked commands on
+		 * every node they touch. Combined with the DNET_FLAGS_TRACE
+		 * cflag the server also returns per-hop span timestamps
+		 * (queue wait, dispatch, backend time) on the final ack,
+		 * which the client logs together with the round-trip time -
+		 * see struct dnet_trace_annex.
 		 */
 		void			set_trace_id(uint32_t trace_id);
 		uint32_t		get_trace_id();
 
+		/*!
+		 * Enables/disables hedged reads for multi-group read operations.
+		 *
+		 * When enabled and more than one group is available, a read which
+		 * has not been answered within the tail (p99) latency estimate of
+		 * the fastest group gets a duplicate request to the second-best
+		 * group, and the first successful reply wins. This cuts read tail
+		 * latency at the cost of a few percent of duplicated requests.
+		 * Disabled by default.
+		 */
+		void			set_read_hedging(bool enable);
+		bool			get_read_hedging() const;
+
 		/*!
 		 * Read file by key \a id to \a file by \a offset and \a size.
 		 */
@@ -437,11 +569,20 @@ class session
 		 *
 		 * Returns async_write_result.
 		 *
-		 * \note Calling this method is equal to consecutive calling
-		 * of write_prepare(), write_plain() and write_commit().
+		 * \note Calling this method is equal to calling write_prepare(),
+		 * write_plain() for every middle chunk and a final write_commit().
+		 * Middle chunks are pipelined with a default in-flight window,
+		 * see the \a chunk_window overload to tune it.
 		 */
 		async_write_result write_data(const key &id, const data_pointer &file, uint64_t remote_offset, uint64_t chunk_size);
 
+		/*!
+		 * Same as above, but keeps up to \a chunk_window chunk writes in flight,
+		 * so the upload is bounded by bandwidth rather than by per-chunk
+		 * round-trips. \a chunk_window of 1 writes chunks strictly serially.
+		 */
+		async_write_result write_data(const key &id, const data_pointer &file, uint64_t remote_offset, uint64_t chunk_size, size_t chunk_window);
+
 
 		/*!
 		 * Reads data by \a id and passes it through \a converter. If converter returns the same data
@@ -563,6 +704,12 @@ class session
 		 */
 		async_generic_result request_cmd(const transport_control &ctl);
 
+		/*!
+		 * Creates an empty batch builder bound to this session,
+		 * see class batch.
+		 */
+		class batch		batch();
+
 		/*!
 		 * Changes node \a status on given \a address, \a port and network \a family.
 		 */
@@ -572,10 +719,24 @@ class session
 		 * Changes node \a status on key \a id.
 		 */
 		void			update_status(const key &id, struct dnet_node_status *status);
+		/*!
+		 * Changes node \a status and runtime performance parameters \a tune
+		 * on given \a address, \a port and network \a family.
+		 * Fields set to DNET_TUNE_UNSET are left intact, on return both
+		 * structures hold the node's current values.
+		 */
+		void			update_status(const char *addr, const int port, const int family,
+						struct dnet_node_status *status, struct dnet_node_tune *tune);
 
 		/*!
 		 * Reads data in range specified in \a io at group \a group_id.
 		 *
+		 * Entries are streamed through the returned async_result as they
+		 * arrive: the range is fetched from the servers in bounded
+		 * windows of records, so connect() or the iterator API keeps
+		 * client memory independent of the range size; get() still
+		 * accumulates everything.
+		 *
 		 * Returns async_read_result.
 		 */
 		async_read_result read_data_range(const struct dnet_io_attr &io, int group_id);
@@ -601,13 +762,36 @@ class session
 		 */
 		std::vector<std::pair<struct dnet_id, struct dnet_addr> > get_routes();
 
+		/*!
+		 * Starts a server-side iterator on the node hosting \a id.
+		 *
+		 * Filters are evaluated on the server before any reply is built:
+		 * key \a ranges (DNET_IFLAGS_KEY_RANGE), the \a time_begin .. \a time_end
+		 * window (DNET_IFLAGS_TS_RANGE) and the user flags predicate
+		 * (user_flags & \a user_flags_mask) == \a user_flags_value
+		 * (DNET_IFLAGS_USER_FLAGS), so filtered-out records are not shipped.
+		 *
+		 * A non-zero \a iterator_id together with DNET_IFLAGS_RESUME in
+		 * \a flags makes the scan checkpointed: the server persists its
+		 * progress under that id and a restarted iterator with the same
+		 * id continues from the last checkpoint instead of rescanning.
+		 */
 		async_iterator_result start_iterator(const key &id, const std::vector<dnet_iterator_range>& ranges,
 								uint32_t type, uint64_t flags,
 								const dnet_time& time_begin = dnet_time(),
-								const dnet_time& time_end = dnet_time());
+								const dnet_time& time_end = dnet_time(),
+								uint64_t user_flags_mask = 0,
+								uint64_t user_flags_value = 0,
+								uint64_t iterator_id = 0);
 		async_iterator_result pause_iterator(const key &id, uint64_t iterator_id);
 		async_iterator_result continue_iterator(const key &id, uint64_t iterator_id);
 		async_iterator_result cancel_iterator(const key &id, uint64_t iterator_id);
+		/*!
+		 * Adjusts reply rate limits of running iterator \a iterator_id
+		 * mid-flight, zero means unlimited.
+		 */
+		async_iterator_result set_iterator_limits(const key &id, uint64_t iterator_id,
+								uint64_t bytes_per_sec, uint64_t replies_per_sec);
 
 		/*!
 		 * Starts execution for \a id of the given \a event with \a data.
@@ -616,6 +800,9 @@ class session
 		 *
 		 * Returns async_exec_result.
 		 * Result contains all replies sent by nodes processing this event.
+		 * Replies are delivered as they arrive: connect a handler to the
+		 * result (or iterate it) to consume the output of a long-running
+		 * job incrementally instead of waiting for the final reply.
 		 */
 		async_exec_result exec(dnet_id *id, const std::string &event, const data_pointer &data);
 		/*!
@@ -630,6 +817,19 @@ class session
 		 * Result contains all replies sent by nodes processing this event.
 		 */
 		async_exec_result exec(dnet_id *id, int src_key, const std::string &event, const data_pointer &data);
+		/*!
+		 * Starts execution for \a id of the given \a event with \a data,
+		 * requesting key-affine worker routing: the processing node
+		 * derives the worker index from the id prefix, so execs against
+		 * the same id are handled by the same named worker and its
+		 * per-key state stays warm. The application must be started via
+		 * start-multiple-task for named workers to exist, otherwise the
+		 * request falls back to the shared queue.
+		 *
+		 * Returns async_exec_result.
+		 * Result contains all replies sent by nodes processing this event.
+		 */
+		async_exec_result exec_affinity(dnet_id *id, const std::string &event, const data_pointer &data);
 		/*!
 		 * Sends execution request of the given \a event and \a data
 		 * to the party specified by a given \a context.
@@ -654,11 +854,22 @@ class session
 		 *
 		 * If \a state is equal to exec_context::final it is the last reply, otherwise there will be more.
 		 *
+		 * Each non-final reply travels with the 'more' flag set, so the
+		 * starter receives it as a separate entry of its async_exec_result
+		 * while the transaction stays open - a worker can emit output
+		 * chunk by chunk with O(chunk) memory, see reply_stream().
+		 *
 		 * Returns async_reply_result.
 		 * Result contains information if starter received the reply.
 		 */
 		async_reply_result reply(const exec_context &context, const data_pointer &data, exec_context::final_state state);
 
+		/*!
+		 * Creates a chunked reply stream to the starter of the process
+		 * specified by \a context, see class exec_reply_stream.
+		 */
+		exec_reply_stream reply_stream(const exec_context &context);
+
 		/*!
 		 * Send reply back to blocked execution client
 		 *
@@ -702,6 +913,23 @@ class session
 		 */
 		async_write_result bulk_write(const std::vector<struct dnet_io_attr> &ios, const std::vector<std::string> &data);
 
+		/*!
+		 * Removes all \a keys in every session group: keys routed to the
+		 * same node are packed into one DNET_CMD_BULK_DEL command which the
+		 * server executes as a batch against the backend. Every reply
+		 * carries a packed array of struct dnet_bulk_del_entry with the
+		 * per-key statuses.
+		 *
+		 * Returns async_remove_result.
+		 */
+		async_remove_result bulk_remove(const std::vector<key> &keys);
+		/*!
+		 * \overload bulk_remove()
+		 *
+		 * Allows to specify the list of string \a keys.
+		 */
+		async_remove_result bulk_remove(const std::vector<std::string> &keys);
+
 		async_set_indexes_result set_indexes(const key &id, const std::vector<index_entry> &indexes);
 		async_set_indexes_result set_indexes(const key &id, const std::vector<std::string> &indexes,
 				const std::vector<data_pointer> &data);
@@ -714,11 +942,56 @@ class session
 
 		async_find_indexes_result find_all_indexes(const std::vector<dnet_raw_id> &indexes);
 		async_find_indexes_result find_all_indexes(const std::vector<std::string> &indexes);
+		/*!
+		 * \overload find_all_indexes()
+		 *
+		 * Skips \a offset matches and returns at most \a limit matches
+		 * (0 - no limit) from every index shard, the trimming is done
+		 * on the server so only the requested window crosses the network.
+		 */
+		async_find_indexes_result find_all_indexes(const std::vector<dnet_raw_id> &indexes,
+				uint64_t offset, uint64_t limit);
+		async_find_indexes_result find_all_indexes(const std::vector<std::string> &indexes,
+				uint64_t offset, uint64_t limit);
 		async_find_indexes_result find_any_indexes(const std::vector<dnet_raw_id> &indexes);
 		async_find_indexes_result find_any_indexes(const std::vector<std::string> &indexes);
 
+		/*!
+		 * Streaming variants of the find calls: matches are fetched from
+		 * every shard in server-side batches of \a batch_size entries and
+		 * delivered through the returned async_result as they arrive, so
+		 * the client holds O(batch) results in memory and the first
+		 * entries show up before the whole index is scanned. The cursor
+		 * advances by result offset, entries added or removed while
+		 * iterating may be skipped or seen twice.
+		 */
+		async_find_indexes_result find_all_indexes_stream(const std::vector<dnet_raw_id> &indexes,
+				uint64_t batch_size);
+		async_find_indexes_result find_all_indexes_stream(const std::vector<std::string> &indexes,
+				uint64_t batch_size);
+		async_find_indexes_result find_any_indexes_stream(const std::vector<dnet_raw_id> &indexes,
+				uint64_t batch_size);
+		async_find_indexes_result find_any_indexes_stream(const std::vector<std::string> &indexes,
+				uint64_t batch_size);
+
 		async_list_indexes_result list_indexes(const key &id);
 
+		/*!
+		 * Returns a snapshot of client-side request metrics: per-command
+		 * latency histograms and error counts, the number of operations
+		 * in flight and per-node error counters.
+		 *
+		 * The counters are shared between all copies and clones of the
+		 * session and are updated with plain atomics at transaction
+		 * completion, so they can stay enabled in production.
+		 */
+		session_metrics get_metrics() const;
+		/*!
+		 * \internal
+		 * Returns the shared counters updated by the callback machinery.
+		 */
+		std::shared_ptr<session_metrics_data> get_metrics_data() const;
+
 		/*!
 		 * Returns reference to parent node.
 		 */
@@ -744,6 +1017,104 @@ class session
 		std::vector<int>	mix_states();
 };
 
+/*!
+ * Builder which packs several small operations into a single
+ * DNET_CMD_BATCH network transaction.
+ *
+ * All operations are executed by the node serving the first added key,
+ * so the batch is meant for metadata-style workloads where many tiny
+ * commands target the same server and the per-packet overhead dominates.
+ * Every operation produces its own reply (and ack) delivered as a
+ * separate entry of the returned result, the final envelope ack carries
+ * the first error if none of the operations succeeded.
+ */
+class batch
+{
+	public:
+		explicit batch(const session &sess);
+		batch(const batch &other);
+		~batch();
+
+		batch &operator =(const batch &other);
+
+		/*!
+		 * Appends writing of \a file at \a remote_offset to key \a id.
+		 */
+		void write(const key &id, const data_pointer &file, uint64_t remote_offset = 0);
+		/*!
+		 * Appends lookup of key \a id.
+		 */
+		void lookup(const key &id);
+		/*!
+		 * Appends removal of key \a id.
+		 */
+		void remove(const key &id);
+
+		/*!
+		 * Returns the number of operations added so far.
+		 */
+		size_t size() const;
+
+		/*!
+		 * Sends all added operations as one packet to the node
+		 * serving the first added key in the first session group.
+		 *
+		 * Returns async_generic_result with one entry per operation.
+		 */
+		async_generic_result send();
+
+	private:
+		void append(const key &id, unsigned int cmd,
+				const void *attr, size_t attr_size,
+				const void *payload, size_t payload_size);
+
+		session			m_sess;
+		std::vector<char>	m_packet;
+		struct dnet_id		m_first_id;
+		size_t			m_count;
+};
+
+/*!
+ * Chunked reply stream from a worker back to the client blocked in exec().
+ *
+ * Every written chunk is sent as a progressive reply and reaches the
+ * client as a separate exec result entry while its transaction stays
+ * open, so a job can pipe a large result with O(chunk) memory and the
+ * consumer starts reading immediately. Wait on the result of each
+ * write() to keep at most one chunk in flight.
+ */
+class exec_reply_stream
+{
+	public:
+		exec_reply_stream(const session &sess, const exec_context &context);
+		exec_reply_stream(const exec_reply_stream &other);
+		~exec_reply_stream();
+
+		exec_reply_stream &operator =(const exec_reply_stream &other);
+
+		/*!
+		 * Sends \a chunk as a progressive reply.
+		 */
+		async_reply_result write(const data_pointer &chunk);
+		/*!
+		 * Sends the final, possibly empty, \a chunk and completes the
+		 * client transaction. Further writes fail with -EINVAL.
+		 */
+		async_reply_result close(const data_pointer &chunk = data_pointer());
+
+		/*!
+		 * Returns whether close() has already been called.
+		 */
+		bool closed() const;
+
+	private:
+		async_reply_result send_chunk(const data_pointer &chunk, exec_context::final_state state);
+
+		session			m_sess;
+		exec_context		m_context;
+		bool			m_closed;
+};
+
 }} /* namespace ioremap::elliptics */
 
 #endif // ELLIPTICS_SESSION_HPP
@@ -16,6 +16,15 @@
 #ifndef __ELLIPTICS_SRW_H
 #define __ELLIPTICS_SRW_H
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -26,6 +35,10 @@ extern "C" {
 #define DNET_SPH_FLAGS_SRC_BLOCK	(1<<0)		/* when set data in @src is valid ID and can be used to send reply data, caller blocks */
 #define DNET_SPH_FLAGS_REPLY		(1<<1)		/* this packet is a reply to the blocked request with ID stored in @src */
 #define DNET_SPH_FLAGS_FINISH		(1<<2)		/* complete request with ID stored in @src, this packet will unblock client */
+#define DNET_SPH_FLAGS_SHM		(1<<3)		/* the data part of @data (after the event string) is struct sph_shm_info,
+							 * the payload itself lives in a posix shared memory segment */
+#define DNET_SPH_FLAGS_KEY_AFFINITY	(1<<4)		/* route exec to the named worker chosen by the command id prefix,
+							 * so requests against the same id always hit the same worker */
 
 struct sph {
 	struct dnet_raw_id	src;			/* reply has to be sent to this id */
@@ -50,6 +63,73 @@ static inline void dnet_convert_sph(struct sph *e)
 	dnet_convert_addr(&e->addr);
 }
 
+/*
+ * Large exec payloads are passed between the server and cocaine workers
+ * through posix shared memory instead of being copied into the worker
+ * stream: when DNET_SPH_FLAGS_SHM is set, sph::data_size equals
+ * sizeof(struct sph_shm_info) and the info describes the segment holding
+ * the real payload. Both sides live on the same host, so no byte order
+ * conversion is needed.
+ *
+ * The creator fills the segment via the descriptor returned by
+ * dnet_sph_shm_create(), the consumer maps it with dnet_sph_shm_map(),
+ * which also unlinks the name - the segment is freed when the last
+ * mapping goes away, even if one of the parties crashes in between.
+ */
+struct sph_shm_info {
+	uint64_t		shm_size;		/* payload size inside the segment */
+	char			shm_name[64];		/* shm_open() name, NUL-terminated */
+};
+
+static inline int dnet_sph_shm_create(struct sph_shm_info *info, uint64_t size)
+{
+	struct timespec ts;
+	int fd, err;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	snprintf(info->shm_name, sizeof(info->shm_name), "/dnet.sph.%d.%lx.%lx",
+			(int)getpid(), (long)ts.tv_sec, (long)ts.tv_nsec);
+	info->shm_size = size;
+
+	fd = shm_open(info->shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size) < 0) {
+		err = -errno;
+		close(fd);
+		shm_unlink(info->shm_name);
+		return err;
+	}
+
+	return fd;
+}
+
+static inline void *dnet_sph_shm_map(const struct sph_shm_info *info)
+{
+	void *ptr;
+	int fd;
+
+	fd = shm_open(info->shm_name, O_RDWR, 0);
+	if (fd < 0)
+		return NULL;
+
+	shm_unlink(info->shm_name);
+
+	ptr = mmap(NULL, info->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	return ptr;
+}
+
+static inline void dnet_sph_shm_unmap(const struct sph_shm_info *info, void *ptr)
+{
+	munmap(ptr, info->shm_size);
+}
+
 struct srw_init_ctl {
 	char			*config;
 };
@@ -110,18 +110,74 @@ class data_buffer
 		size_t m_capacity;
 };
 
+/*
+ * Thread-local freelist of fixed-size chunks backing the short-lived
+ * header+payload compositions of request construction. Chunks released
+ * on another thread simply land in that thread's pool, so the pool size
+ * stays bounded per thread without any locking.
+ */
+class data_pool
+{
+	public:
+		enum {
+			chunk_size = 4096,
+			max_chunks = 64
+		};
+
+		static void *take()
+		{
+			pool &p = get();
+			if (p.num)
+				return p.chunks[--p.num];
+
+			void *data = ::malloc(chunk_size);
+			if (!data)
+				throw std::bad_alloc();
+			return data;
+		}
+
+		static void put(void *data)
+		{
+			pool &p = get();
+			if (p.num < max_chunks) {
+				p.chunks[p.num++] = data;
+				return;
+			}
+			::free(data);
+		}
+
+	private:
+		struct pool {
+			void *chunks[max_chunks];
+			size_t num;
+
+			pool() : num(0) {}
+			~pool()
+			{
+				while (num)
+					::free(chunks[--num]);
+			}
+		};
+
+		static pool &get()
+		{
+			static thread_local pool p;
+			return p;
+		}
+};
+
 class data_pointer
 {
 	public:
 		data_pointer() : m_index(0), m_size(0) {}
 
 		data_pointer(void *data, size_t size)
-			: m_data(std::make_shared<wrapper>(data)), m_index(0), m_size(size)
+			: m_data(data, ::free), m_index(0), m_size(size)
 		{
 		}
 
 		data_pointer(const std::string &str)
-			: m_data(std::make_shared<wrapper>(const_cast<char*>(str.c_str()), false)),
+			: m_data(std::shared_ptr<void>(), const_cast<char*>(str.c_str())),
 			m_index(0), m_size(str.size())
 		{
 		}
@@ -129,7 +185,12 @@ class data_pointer
 		data_pointer(data_buffer &&buf)
 			: m_index(0), m_size(buf.size())
 		{
-			m_data = std::make_shared<wrapper>(buf.release());
+			m_data = std::shared_ptr<void>(buf.release(), ::free);
+		}
+
+		data_pointer(const std::shared_ptr<void> &data, size_t size)
+			: m_data(data), m_index(0), m_size(size)
+		{
 		}
 
 		static data_pointer copy(const void *data, size_t size)
@@ -157,12 +218,26 @@ class data_pointer
 			return data_pointer(data, size);
 		}
 
+		/*
+		 * Allocation drawing small buffers from the per-thread
+		 * data_pool - cheap for the header+payload compositions built
+		 * on every request. Sizes above the pool chunk size fall back
+		 * to plain allocate().
+		 */
+		static data_pointer allocate_pooled(size_t size)
+		{
+			if (size > data_pool::chunk_size)
+				return allocate(size);
+			return data_pointer(std::shared_ptr<void>(data_pool::take(), data_pool::put), size);
+		}
+
 		static data_pointer from_raw(void *data, size_t size)
 		{
 			data_pointer pointer;
 			pointer.m_index = 0;
 			pointer.m_size = size;
-			pointer.m_data =  std::make_shared<wrapper>(data, false);
+			/* non-owning alias, does not allocate a control block */
+			pointer.m_data = std::shared_ptr<void>(std::shared_ptr<void>(), data);
 			return pointer;
 		}
 
@@ -194,6 +269,20 @@ class data_pointer
 			return tmp;
 		}
 
+		/*
+		 * Returns a copy whose lifetime is tied to @owner instead of
+		 * whatever this pointer references - used to hand out views
+		 * into memory embedded in a shared object without giving the
+		 * view its own allocation. Does not allocate.
+		 */
+		template <typename T>
+		data_pointer attach(const std::shared_ptr<T> &owner) const
+		{
+			data_pointer tmp(*this);
+			tmp.m_data = std::shared_ptr<void>(owner, tmp.m_data.get());
+			return tmp;
+		}
+
 		void *data() const
 		{
 			if (m_index > m_size)
@@ -201,7 +290,7 @@ class data_pointer
 			else if (m_index == m_size)
 				return NULL;
 			else
-				return reinterpret_cast<char*>(m_data->get()) + m_index;
+				return reinterpret_cast<char*>(m_data.get()) + m_index;
 		}
 
 		template <typename T>
@@ -212,26 +301,39 @@ class data_pointer
 			return reinterpret_cast<T *>(data());
 		}
 
+		/*
+		 * Copy-on-write access: returns a writable pointer to the
+		 * visible range, first detaching from the underlying buffer if
+		 * it is shared with other views or not owned at all. A unique
+		 * owner is written in place.
+		 */
+		void *mutable_data()
+		{
+			if (m_data.use_count() != 1)
+				*this = copy(*this);
+			return data();
+		}
+
+		template <typename T>
+		T *mutable_data()
+		{
+			if (m_index + sizeof(T) > m_size)
+				throw not_found_error("null pointer exception");
+			return reinterpret_cast<T *>(mutable_data());
+		}
+
 		size_t size() const { return m_index >= m_size ? 0 : (m_size - m_index); }
 		size_t offset() const { return m_index; }
 		bool empty() const { return m_index >= m_size; }
 		std::string to_string() const { return std::string(reinterpret_cast<char*>(data()), size()); }
 
 	private:
-		class wrapper
-		{
-			public:
-				inline wrapper(void *data, bool owner = true) : data(data), owner(owner) {}
-				inline ~wrapper() { if (owner && data) free(data); }
-
-				inline void *get() const { return data; }
-
-			private:
-				void *data;
-				bool owner;
-		};
-
-		std::shared_ptr<wrapper> m_data;
+		/*
+		 * Owning pointers carry a free() deleter, non-owning ones alias
+		 * an empty shared_ptr, so only owning pointers pay for a
+		 * control block allocation.
+		 */
+		std::shared_ptr<void> m_data;
 		size_t m_index;
 		size_t m_size;
 };
@@ -39,7 +39,8 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 	typedef std::shared_ptr<update_indexes_functor> ptr;
 
 	update_indexes_functor(dnet_net_state *state, const dnet_cmd *cmd, const dnet_indexes_request *request)
-		: sess(state->n), state(dnet_state_get(state)), cmd(*cmd), requests_in_progress(1), flags(request->flags)
+		: sess(state->n), state(dnet_state_get(state)), cmd(*cmd), remote_sess(NULL), pending_pos(0),
+		requests_in_progress(1), flags(request->flags)
 	{
 		this->cmd.flags |= DNET_FLAGS_MORE;
 
@@ -60,15 +61,17 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 		}
 
 		std::sort(indexes.indexes.begin(), indexes.indexes.end(), dnet_raw_id_less_than<>());
-		indexes.shard_id = dnet_indexes_get_shard_id(state->n, reinterpret_cast<const dnet_raw_id*>(&cmd->id));
-		indexes.shard_count = state->n->indexes_shard_count;
-		if (!(flags & DNET_INDEXES_FLAGS_UPDATE_ONLY)) {
-			msgpack::pack(buffer, indexes);
-		}
+		// the client's session may shard this namespace wider than the node default
+		indexes.shard_count = request->shard_count
+			? static_cast<int>(request->shard_count) : state->n->indexes_shard_count;
+		indexes.shard_id = dnet_indexes_get_shard_id_raw(
+				reinterpret_cast<const dnet_raw_id*>(&cmd->id), indexes.shard_count);
 	}
 
 	~update_indexes_functor()
 	{
+		if (remote_sess)
+			dnet_session_destroy(remote_sess);
 		dnet_opunlock(state->n, &cmd.id);
 		dnet_state_put(state);
 	}
@@ -85,13 +88,30 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 	// indexes to update
 	dnet_indexes indexes;
 
-	msgpack::sbuffer buffer;
 	// already updated indexes - they are read from storage and changed
 	dnet_indexes remote_indexes;
 	std::vector<index_entry> inserted_ids;
 	std::vector<index_entry> removed_ids;
 	std::vector<dnet_indexes_reply_entry> result;
 
+	struct pending_entry
+	{
+		dnet_raw_id entry_id;
+		data_pointer data;
+		update_index_action action;
+	};
+
+	/*
+	 * Remote index updates prepared by process(): all of them are logically
+	 * issued concurrently, but at most node's indexes_update_window
+	 * transactions are in flight at once, the rest are sent from
+	 * on_reply_received() as earlier ones retire. @pending_pos is the next
+	 * entry to send, protected by @requests_order_guard.
+	 */
+	dnet_session *remote_sess;
+	std::vector<pending_entry> pending;
+	size_t pending_pos;
+
 	std::atomic_int requests_in_progress;
 	uint32_t flags;
 	std::mutex requests_order_guard;
@@ -134,14 +154,10 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 			auto it = std::unique(result.indexes.begin(), result.indexes.end(), index_entry_equal);
 			result.indexes.erase(it, result.indexes.end());
 
-			msgpack::pack(buffer, result);
+			return indexes_pack_binary(result);
 		}
 
-		data_buffer tmp_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
-		tmp_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
-		tmp_buffer.write(buffer.data(), buffer.size());
-
-		return std::move(tmp_buffer);
+		return indexes_pack_binary(indexes);
 	}
 
 	int process(bool *finished)
@@ -158,6 +174,9 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 		std::vector<size_t> local_inserted_ids;
 		std::vector<size_t> local_removed_ids;
 
+		std::vector<dnet_raw_id> inserted_entry_ids;
+		std::vector<dnet_raw_id> removed_entry_ids;
+
 		size_t remote_inserted = 0;
 		size_t remote_removed = 0;
 
@@ -211,18 +230,46 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 		dnet_indexes_reply_entry result_entry;
 		memset(&result_entry, 0, sizeof(result_entry));
 
+		/*
+		 * Hash all changed entry ids in one go - the transform batches the
+		 * underlying SHA512 calls - and reuse the results in both the remote
+		 * and the local update loops below.
+		 */
+		inserted_entry_ids.resize(inserted_ids.size());
+		removed_entry_ids.resize(removed_ids.size());
+		{
+			std::vector<const dnet_raw_id *> srcs(inserted_ids.size() + removed_ids.size());
+			std::vector<dnet_raw_id *> dsts(srcs.size());
+
+			for (size_t i = 0; i < inserted_ids.size(); ++i) {
+				srcs[i] = &inserted_ids[i].index;
+				dsts[i] = &inserted_entry_ids[i];
+			}
+			for (size_t i = 0; i < removed_ids.size(); ++i) {
+				srcs[inserted_ids.size() + i] = &removed_ids[i].index;
+				dsts[inserted_ids.size() + i] = &removed_entry_ids[i];
+			}
+
+			dnet_indexes_transform_index_ids_raw(state->n, &srcs[0], &dsts[0],
+					shard_id, indexes.shard_count, static_cast<int>(srcs.size()));
+		}
+
 		new_sess = dnet_session_create(state->n);
 		dnet_session_set_groups(new_sess, &group_id, 1);
+		// destroyed in the destructor - deferred sends may outlive process()
+		remote_sess = new_sess;
 
 		/*
 		 * Some indexes are stored on other servers,
-		 * so we should send the request through network
+		 * so we should send the request through network.
+		 * All remote updates are prepared first and then issued
+		 * concurrently, bounded by the configured in-flight window.
 		 */
 		dnet_raw_id tmp_entry_id;
 		for (size_t i = 0; i < inserted_ids.size(); ++i) {
 			const index_entry &entry = inserted_ids[i];
 
-			dnet_indexes_transform_index_id(state->n, &entry.index, &tmp_entry_id, shard_id);
+			tmp_entry_id = inserted_entry_ids[i];
 
 			memcpy(base_id.id, tmp_entry_id.id, sizeof(base_id.id));
 
@@ -230,9 +277,8 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 
 			if (index_state) {
 				remote_inserted++;
-				int err = send_remote(new_sess, tmp_entry_id, entry.data, insert_data);
-				if (err)
-					goto err_out_complete;
+				pending_entry pending_update = { tmp_entry_id, entry.data, insert_data };
+				pending.push_back(pending_update);
 			} else {
 				local_inserted_ids.push_back(i);
 			}
@@ -241,7 +287,7 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 		for (size_t i = 0; i < removed_ids.size(); ++i) {
 			const index_entry &entry = removed_ids[i];
 
-			dnet_indexes_transform_index_id(state->n, &entry.index, &tmp_entry_id, shard_id);
+			tmp_entry_id = removed_entry_ids[i];
 
 			memcpy(base_id.id, tmp_entry_id.id, sizeof(base_id.id));
 
@@ -249,16 +295,31 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 
 			if (index_state) {
 				remote_removed++;
-				int err = send_remote(new_sess, tmp_entry_id, entry.data, remove_data);
-				if (err)
-					goto err_out_complete;
+				pending_entry pending_update = { tmp_entry_id, entry.data, remove_data };
+				pending.push_back(pending_update);
 			} else {
 				local_removed_ids.push_back(i);
 			}
 		}
 
+		{
+			size_t window = pending.size();
+
+			if ((state->n->indexes_update_window > 0) && (window > (size_t)state->n->indexes_update_window))
+				window = state->n->indexes_update_window;
+
+			for (size_t i = 0; i < window; ++i) {
+				err = send_next();
+				if (err) {
+					// drop the deferred updates, in-flight ones will still be gathered
+					std::lock_guard<std::mutex> lock(requests_order_guard);
+					pending_pos = pending.size();
+					goto err_out_complete;
+				}
+			}
+		}
+
 		gettimeofday(&send_remote_time, NULL);
-		dnet_session_destroy(new_sess);
 
 		/*
 		 * Iterate over all indexes and update those which changed.
@@ -268,9 +329,10 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 		for (size_t i = 0; i < local_inserted_ids.size(); ++i) {
 			const index_entry &entry = inserted_ids[local_inserted_ids[i]];
 
-			dnet_indexes_transform_index_id(state->n, &entry.index, &tmp_entry_id, shard_id);
+			tmp_entry_id = inserted_entry_ids[local_inserted_ids[i]];
 
-			err = sess.update_index_internal(request_id, tmp_entry_id, entry.data, insert_data);
+			err = sess.update_index_internal(request_id, tmp_entry_id, entry.data, insert_data,
+					indexes.shard_id, indexes.shard_count);
 
 			result_entry.status = err;
 			result_entry.id = tmp_entry_id;
@@ -284,9 +346,10 @@ struct update_indexes_functor : public std::enable_shared_from_this<update_index
 		for (size_t i = 0; i < local_removed_ids.size(); ++i) {
 			const index_entry &entry = removed_ids[local_removed_ids[i]];
 
-			dnet_indexes_transform_index_id(state->n, &entry.index, &tmp_entry_id, shard_id);
+			tmp_entry_id = removed_entry_ids[local_removed_ids[i]];
 
-			err = sess.update_index_internal(request_id, tmp_entry_id, entry.data, remove_data);
+			err = sess.update_index_internal(request_id, tmp_entry_id, entry.data, remove_data,
+					indexes.shard_id, indexes.shard_count);
 
 			result_entry.status = err;
 			result_entry.id = tmp_entry_id;
@@ -328,6 +391,26 @@ err_out_complete:
 		ptr functor;
 	};
 
+	/*
+	 * Send the next prepared remote update, if any.
+	 * Returns the send error, zero on success or when nothing is left.
+	 */
+	int send_next()
+	{
+		pending_entry *entry;
+
+		{
+			std::lock_guard<std::mutex> lock(requests_order_guard);
+
+			if (pending_pos >= pending.size())
+				return 0;
+
+			entry = &pending[pending_pos++];
+		}
+
+		return send_remote(remote_sess, entry->entry_id, entry->data, entry->action);
+	}
+
 	int send_remote(dnet_session *sess, const dnet_raw_id &index, const data_pointer &data, update_index_action action)
 	{
 		data_buffer buffer(sizeof(dnet_indexes_request) + sizeof(dnet_indexes_request_entry) + data.size());
@@ -385,6 +468,11 @@ err_out_complete:
 		scope_data *scope = reinterpret_cast<scope_data *>(priv);
 
 		if (is_trans_destroyed(st, cmd)) {
+			// a retired transaction frees a window slot, issue the next
+			// deferred update; on a send error just try the one after it
+			while (scope->functor->send_next())
+				;
+
 			std::lock_guard<std::mutex> lock(scope->functor->requests_order_guard);
 
 			if (0 == --scope->functor->requests_in_progress) {
@@ -440,17 +528,206 @@ err_out_complete:
 	}
 };
 
+/*!
+ * Single-entry update of a binary index table done with block copies.
+ *
+ * The position is found by binary search over the fixed-stride sorted
+ * entry array, the output is assembled from the prefix and suffix of the
+ * old table around that slot, new entry data is appended to the heap.
+ * Removed or replaced entries leave dead bytes in the heap; once more
+ * than half of the heap is dead the table is repacked with a compact one.
+ */
+data_pointer update_index_table_binary(dnet_node *node, dnet_id *cmd_id, dnet_indexes_request *request,
+	const data_pointer &index_data, const data_pointer &data, update_index_action action)
+{
+	elliptics_timer timer;
+
+	const dnet_index_table_header *header = data.data<dnet_index_table_header>();
+	const size_t count = dnet_bswap32(header->entries_count);
+	const size_t entries_offset = sizeof(dnet_index_table_header);
+	const size_t heap_offset = entries_offset + count * sizeof(dnet_index_table_entry);
+	const size_t heap_size = dnet_bswap32(header->heap_size);
+
+	if (heap_offset + heap_size > data.size())
+		throw std::runtime_error("truncated binary index table");
+
+	const dnet_index_table_entry *entries =
+		reinterpret_cast<const dnet_index_table_entry *>(data.data<char>() + entries_offset);
+	const char *heap = data.data<char>() + heap_offset;
+	// append-log records past the heap make the base entry array stale
+	const bool has_delta = heap_offset + heap_size < data.size();
+
+	size_t low = 0, high = count;
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+
+		if (memcmp(entries[mid].index.id, request->id.id, DNET_ID_SIZE) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	const bool found = (low < count) && !memcmp(entries[low].index.id, request->id.id, DNET_ID_SIZE);
+
+	const int64_t timer_search = timer.restart();
+
+	if (!has_delta && action == insert_data && found) {
+		const size_t old_offset = dnet_bswap32(entries[low].data_offset);
+		const uint32_t old_size = dnet_bswap32(entries[low].data_size);
+
+		if (old_size == index_data.size() && (!old_size ||
+					!memcmp(heap + old_offset, index_data.data(), old_size))) {
+			// All's ok, keep it untouched
+			return data;
+		}
+	} else if (!has_delta && action == remove_data && !found) {
+		// All's ok, keep it untouched
+		return data;
+	}
+
+	/*
+	 * Live heap bytes after this update: removal and replacement leave the
+	 * old entry data dead in place, compact the whole table instead of
+	 * block-copying once the dead share grows past the live one. A pending
+	 * append log also forces the compact path, which folds it into the
+	 * base through the merged unpack below.
+	 */
+	size_t live = index_data.size();
+	for (size_t i = 0; i < count; ++i) {
+		if (!(found && i == low))
+			live += dnet_bswap32(entries[i].data_size);
+	}
+
+	if (has_delta || (found && (heap_size + index_data.size() > 2 * live))) {
+		raw_dnet_indexes indexes;
+		indexes_unpack_binary(data, &indexes);
+
+		raw_index_entry request_index;
+		memcpy(request_index.index.id, request->id.id, sizeof(request_index.index.id));
+		request_index.data.data = index_data.data();
+		request_index.data.size = index_data.size();
+
+		auto it = std::lower_bound(indexes.indexes.begin(), indexes.indexes.end(), request_index);
+		const bool merged_found = it != indexes.indexes.end()
+			&& !memcmp(it->index.id, request->id.id, DNET_ID_SIZE);
+
+		if (action == insert_data) {
+			if (merged_found)
+				*it = request_index;
+			else
+				indexes.indexes.insert(it, request_index);
+		} else if (merged_found) {
+			indexes.indexes.erase(it);
+		} else {
+			// nothing to remove, but fold a pending log anyway
+			if (!has_delta)
+				return data;
+		}
+
+		data_pointer new_data = indexes_pack_binary(indexes);
+
+		DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
+		dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: binary compact: id: %s, data size: %zu, new data size: %zu,"
+			 "search: %lld ms, repack: %lld ms\n",
+			 id_str, data.size(), new_data.size(), (long long)timer_search, (long long)timer.restart());
+
+		return new_data;
+	}
+
+	data_pointer new_data;
+
+	if (action == insert_data && !found) {
+		data_buffer buffer(data.size() + sizeof(dnet_index_table_entry) + index_data.size());
+
+		dnet_index_table_header new_header = *header;
+		new_header.entries_count = dnet_bswap32(static_cast<uint32_t>(count + 1));
+		buffer.write(new_header);
+
+		dnet_index_table_entry entry;
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.index.id, request->id.id, DNET_ID_SIZE);
+		entry.data_offset = dnet_bswap32(static_cast<uint32_t>(heap_size));
+		entry.data_size = dnet_bswap32(static_cast<uint32_t>(index_data.size()));
+
+		buffer.write(reinterpret_cast<const char *>(entries), low * sizeof(dnet_index_table_entry));
+		buffer.write(entry);
+		buffer.write(reinterpret_cast<const char *>(entries + low), (count - low) * sizeof(dnet_index_table_entry));
+
+		buffer.write(heap, heap_size);
+		if (!index_data.empty())
+			buffer.write(index_data.data<char>(), index_data.size());
+
+		new_data = std::move(buffer);
+	} else if (action == insert_data) {
+		// replace: patch the entry to point at new data appended to the heap
+		data_buffer buffer(data.size() + index_data.size());
+
+		buffer.write(*header);
+
+		dnet_index_table_entry entry = entries[low];
+		entry.data_offset = dnet_bswap32(static_cast<uint32_t>(heap_size));
+		entry.data_size = dnet_bswap32(static_cast<uint32_t>(index_data.size()));
+
+		buffer.write(reinterpret_cast<const char *>(entries), low * sizeof(dnet_index_table_entry));
+		buffer.write(entry);
+		buffer.write(reinterpret_cast<const char *>(entries + low + 1), (count - low - 1) * sizeof(dnet_index_table_entry));
+
+		buffer.write(heap, heap_size);
+		if (!index_data.empty())
+			buffer.write(index_data.data<char>(), index_data.size());
+
+		new_data = std::move(buffer);
+	} else {
+		data_buffer buffer(data.size() - sizeof(dnet_index_table_entry));
+
+		dnet_index_table_header new_header = *header;
+		new_header.entries_count = dnet_bswap32(static_cast<uint32_t>(count - 1));
+		buffer.write(new_header);
+
+		buffer.write(reinterpret_cast<const char *>(entries), low * sizeof(dnet_index_table_entry));
+		buffer.write(reinterpret_cast<const char *>(entries + low + 1), (count - low - 1) * sizeof(dnet_index_table_entry));
+
+		buffer.write(heap, heap_size);
+
+		new_data = std::move(buffer);
+	}
+
+	DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: binary update: id: %s, data size: %zu, new data size: %zu,"
+		 "search: %lld ms, copy: %lld ms\n",
+		 id_str, data.size(), new_data.size(), (long long)timer_search, (long long)timer.restart());
+
+	return new_data;
+}
+
 /*!
  * Update data-object table for certain secondary index.
  *
  * @index_data is what client provided
  * @data is what was downloaded from the storage
+ *
+ * Binary tables are updated in place by update_index_table_binary(),
+ * legacy msgpack tables take the full decode path below and are written
+ * back in the binary format.
  */
 data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, dnet_indexes_request *request,
 	const data_pointer &index_data, const data_pointer &data, update_index_action action)
 {
 	elliptics_timer timer;
 
+	if (data.size() >= sizeof(dnet_index_table_header)
+			&& data.data<dnet_index_table_header>()->magic == dnet_bswap64(DNET_INDEX_TABLE_BINARY_MAGIC)
+			&& dnet_bswap32(data.data<dnet_index_table_header>()->version) == DNET_INDEX_TABLE_BINARY_VERSION) {
+		try {
+			return update_index_table_binary(node, cmd_id, request, index_data, data, action);
+		} catch (const std::exception &e) {
+			DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
+			dnet_log(node, DNET_LOG_ERROR, "INDEXES_INTERNAL: corrupted binary index table, rebuilding: id: %s, err: %s\n",
+				 id_str, e.what());
+			// fall through - indexes_unpack() below resets the broken table
+		}
+	}
+
 	raw_dnet_indexes indexes;
 	if (!data.empty())
 		indexes_unpack(node, cmd_id, data, &indexes, "convert_index_table");
@@ -511,25 +788,338 @@ data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, dnet_indexes_
 	indexes.shard_id = request->shard_id;
 	indexes.shard_count = request->shard_count;
 
-	msgpack::sbuffer buffer;
-	msgpack::pack(&buffer, indexes);
+	// migrate the legacy msgpack table to the binary format
+	data_pointer new_data = indexes_pack_binary(indexes);
 
 	const int64_t timer_pack = timer.restart();
 
-	data_buffer new_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
-	new_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
-	new_buffer.write(buffer.data(), buffer.size());
-
-	const int64_t timer_write = timer.restart();
-
 	DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
 	typedef long long int lld;
 	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, data size: %zu, new data size: %zu,"
-		 "unpack: %lld ms, lower_bound: %lld ms, update: %lld ms, pack: %lld ms, write: %lld ms\n",
-		 id_str, data.size(), new_buffer.size(), lld(timer_unpack), lld(timer_lower_bound),
-		 lld(timer_update), lld(timer_pack), lld(timer_write));
+		 "unpack: %lld ms, lower_bound: %lld ms, update: %lld ms, pack: %lld ms\n",
+		 id_str, data.size(), new_data.size(), lld(timer_unpack), lld(timer_lower_bound),
+		 lld(timer_update), lld(timer_pack));
 
-	return std::move(new_buffer);
+	return new_data;
+}
+
+/*
+ * Zero-copy cursor over a binary index table, used by the Bloom filter
+ * build and the streaming merge-join: @pos walks the sorted fixed-stride
+ * entry array.
+ */
+struct index_table_view
+{
+	data_pointer file;
+	dnet_raw_id request_id;		// index id as the client sent it
+	const dnet_index_table_entry *entries;
+	const char *heap;
+	size_t heap_size;
+	size_t count;
+	size_t pos;
+};
+
+static bool index_table_view_init(const data_pointer &file, index_table_view &view)
+{
+	if (file.size() < sizeof(dnet_index_table_header))
+		return false;
+
+	const dnet_index_table_header *header = file.data<dnet_index_table_header>();
+	if (header->magic != dnet_bswap64(DNET_INDEX_TABLE_BINARY_MAGIC))
+		return false;
+	if (dnet_bswap32(header->version) != DNET_INDEX_TABLE_BINARY_VERSION)
+		return false;
+
+	const size_t count = dnet_bswap32(header->entries_count);
+	const size_t heap_size = dnet_bswap32(header->heap_size);
+	const size_t heap_offset = sizeof(dnet_index_table_header) + count * sizeof(dnet_index_table_entry);
+	if (heap_offset + heap_size > file.size())
+		return false;
+
+	// a pending append log makes the base entry array stale, take the
+	// merging unpack path instead
+	if (heap_offset + heap_size < file.size())
+		return false;
+
+	view.file = file;
+	view.entries = reinterpret_cast<const dnet_index_table_entry *>(file.data<char>() + sizeof(dnet_index_table_header));
+	view.heap = file.data<char>() + heap_offset;
+	view.heap_size = heap_size;
+	view.count = count;
+	view.pos = 0;
+	return true;
+}
+
+/*
+ * In-memory Bloom filters over the object ids of each index table.
+ *
+ * A filter is built lazily from the binary table by the first internal
+ * update reading it and kept current on inserts. Removals do not clear
+ * bits, so the filter stays a superset of the table and never gives a
+ * false negative; once inserts outgrow the capacity the filter was sized
+ * for it is dropped and rebuilt bigger by the next read. Consulted by
+ * remove requests: an object the filter definitely does not know about
+ * cannot be in the index, which turns such no-op updates into a few
+ * probes instead of a backend read of the whole table.
+ */
+enum {
+	INDEX_BLOOM_BITS_PER_ENTRY = 10,	// ~1% false positives with 4 probes
+	INDEX_BLOOM_MIN_BITS = 1024,
+	INDEX_BLOOM_PROBES = 4,
+	INDEX_BLOOM_MAX_FILTERS = 16384,
+};
+
+struct index_bloom_t
+{
+	std::vector<uint64_t> bits;
+	size_t capacity;	// entry count the filter was sized for
+	size_t entries;
+};
+
+static std::mutex bloom_lock;
+static std::map<dnet_raw_id, index_bloom_t, dnet_raw_id_less_than<> > bloom_map;
+
+static dnet_raw_id bloom_key(const dnet_id *table_id)
+{
+	dnet_raw_id key;
+
+	memcpy(key.id, table_id->id, DNET_ID_SIZE);
+	return key;
+}
+
+/*
+ * Object ids are transform (sha512) output, so slices of the id itself
+ * already are independent uniform hash values.
+ */
+static void bloom_probes(const unsigned char *object_id, size_t nbits, size_t *probes)
+{
+	uint32_t words[INDEX_BLOOM_PROBES];
+
+	memcpy(words, object_id, sizeof(words));
+
+	for (int i = 0; i < INDEX_BLOOM_PROBES; ++i)
+		probes[i] = words[i] % nbits;
+}
+
+static void bloom_set(index_bloom_t &bloom, const unsigned char *object_id)
+{
+	size_t probes[INDEX_BLOOM_PROBES];
+
+	bloom_probes(object_id, bloom.bits.size() * 64, probes);
+
+	for (int i = 0; i < INDEX_BLOOM_PROBES; ++i)
+		bloom.bits[probes[i] / 64] |= 1ULL << (probes[i] % 64);
+}
+
+// false means the object is definitely not in the index
+static bool index_bloom_maybe_contains(const dnet_id *table_id, const unsigned char *object_id)
+{
+	std::lock_guard<std::mutex> guard(bloom_lock);
+
+	auto it = bloom_map.find(bloom_key(table_id));
+	if (it == bloom_map.end())
+		return true;	// no filter, no answer
+
+	size_t probes[INDEX_BLOOM_PROBES];
+
+	bloom_probes(object_id, it->second.bits.size() * 64, probes);
+
+	for (int i = 0; i < INDEX_BLOOM_PROBES; ++i) {
+		if (!(it->second.bits[probes[i] / 64] & (1ULL << (probes[i] % 64))))
+			return false;
+	}
+
+	return true;
+}
+
+static void index_bloom_insert(const dnet_id *table_id, const unsigned char *object_id)
+{
+	std::lock_guard<std::mutex> guard(bloom_lock);
+
+	auto it = bloom_map.find(bloom_key(table_id));
+	if (it == bloom_map.end())
+		return;
+
+	bloom_set(it->second, object_id);
+
+	// past the sized-for capacity the false positive rate degrades,
+	// drop the filter and let the next table read rebuild a bigger one
+	if (++it->second.entries > it->second.capacity)
+		bloom_map.erase(it);
+}
+
+static void index_bloom_build_if_missing(const dnet_id *table_id, const data_pointer &table)
+{
+	index_table_view view;
+
+	std::lock_guard<std::mutex> guard(bloom_lock);
+
+	if (bloom_map.find(bloom_key(table_id)) != bloom_map.end())
+		return;
+
+	if (!index_table_view_init(table, view))
+		return;
+
+	if (bloom_map.size() >= INDEX_BLOOM_MAX_FILTERS)
+		bloom_map.erase(bloom_map.begin());
+
+	index_bloom_t &bloom = bloom_map[bloom_key(table_id)];
+
+	bloom.capacity = 2 * view.count + 64;
+	bloom.entries = view.count;
+	bloom.bits.assign((std::max<size_t>(bloom.capacity * INDEX_BLOOM_BITS_PER_ENTRY,
+					INDEX_BLOOM_MIN_BITS) + 63) / 64, 0);
+
+	for (size_t i = 0; i < view.count; ++i)
+		bloom_set(bloom, view.entries[i].index.id);
+}
+
+/*
+ * Delta-log mode (DNET_CFG_INDEXES_DELTA): instead of rewriting the whole
+ * table a mutation appends a small dnet_index_delta_record through the
+ * backend append path, which keeps index write amplification proportional
+ * to the entry instead of the table. Readers replay the log on top of the
+ * base (indexes_apply_delta()), so the on-disk state is always valid.
+ *
+ * The append path is only armed for tables this process has itself
+ * written as a plain binary table, tracked in delta_map: the first update
+ * after a restart (or after the map evicted the table) takes the full
+ * read/convert/write path, which also folds any pending log back into
+ * the base. Past INDEX_DELTA_FOLD_RECORDS appended records the next
+ * update folds the same way instead of letting the log grow unbounded.
+ */
+enum {
+	INDEX_DELTA_FOLD_RECORDS = 128,
+	INDEX_DELTA_MAX_TABLES = 65536,
+};
+
+struct index_delta_state_t
+{
+	uint32_t records;
+};
+
+static std::mutex delta_lock;
+static std::map<dnet_raw_id, index_delta_state_t, dnet_raw_id_less_than<> > delta_map;
+
+static bool index_delta_append_allowed(const dnet_id *table_id)
+{
+	std::lock_guard<std::mutex> guard(delta_lock);
+
+	auto it = delta_map.find(bloom_key(table_id));
+	return it != delta_map.end() && it->second.records < INDEX_DELTA_FOLD_RECORDS;
+}
+
+static void index_delta_appended(const dnet_id *table_id)
+{
+	std::lock_guard<std::mutex> guard(delta_lock);
+
+	auto it = delta_map.find(bloom_key(table_id));
+	if (it != delta_map.end())
+		++it->second.records;
+}
+
+// the table was just written back as a plain binary table, arm the append path
+static void index_delta_folded(const dnet_id *table_id)
+{
+	std::lock_guard<std::mutex> guard(delta_lock);
+
+	if (delta_map.size() >= INDEX_DELTA_MAX_TABLES
+			&& delta_map.find(bloom_key(table_id)) == delta_map.end())
+		delta_map.erase(delta_map.begin());
+
+	delta_map[bloom_key(table_id)].records = 0;
+}
+
+/*
+ * Node-local cache of raw index table blobs, shared by every
+ * local_session user in the indexes code. The same few hot indexes are
+ * touched thousands of times per second and every update and find
+ * re-read the table from the backend; the cache is write-through on the
+ * internal update path and dnet_indexes_invalidate() drops an entry
+ * whenever the generic write or removal path touches the table object
+ * out of band (delta appends, recovery, direct writes). Each entry
+ * remembers the backend timestamp of the data it holds.
+ */
+enum {
+	INDEX_TABLE_CACHE_MAX_BYTES = 64 * 1024 * 1024,
+};
+
+struct index_table_cache_entry_t
+{
+	data_pointer data;
+	dnet_time timestamp;
+};
+
+static std::mutex table_cache_lock;
+static std::map<dnet_raw_id, index_table_cache_entry_t, dnet_raw_id_less_than<> > table_cache_map;
+static size_t table_cache_bytes;
+
+static bool index_table_cache_get(const dnet_id *table_id, data_pointer *data)
+{
+	std::lock_guard<std::mutex> guard(table_cache_lock);
+
+	auto it = table_cache_map.find(bloom_key(table_id));
+	if (it == table_cache_map.end())
+		return false;
+
+	*data = it->second.data;
+	return true;
+}
+
+static void index_table_cache_put(const dnet_id *table_id, const data_pointer &data, const dnet_time &timestamp)
+{
+	std::lock_guard<std::mutex> guard(table_cache_lock);
+
+	auto it = table_cache_map.find(bloom_key(table_id));
+	if (it != table_cache_map.end()) {
+		table_cache_bytes -= it->second.data.size();
+	} else {
+		// evict in map order, hot entries are put back by the next update
+		while (!table_cache_map.empty()
+				&& table_cache_bytes + data.size() > INDEX_TABLE_CACHE_MAX_BYTES) {
+			auto victim = table_cache_map.begin();
+			table_cache_bytes -= victim->second.data.size();
+			table_cache_map.erase(victim);
+		}
+
+		it = table_cache_map.insert(std::make_pair(bloom_key(table_id), index_table_cache_entry_t())).first;
+	}
+
+	it->second.data = data;
+	it->second.timestamp = timestamp;
+	table_cache_bytes += data.size();
+}
+
+static void index_table_cache_erase(const dnet_raw_id &key)
+{
+	std::lock_guard<std::mutex> guard(table_cache_lock);
+
+	auto it = table_cache_map.find(key);
+	if (it != table_cache_map.end()) {
+		table_cache_bytes -= it->second.data.size();
+		table_cache_map.erase(it);
+	}
+}
+
+// reads an index table through the shared table cache
+static data_pointer index_table_cached_read(local_session &sess, const dnet_id &table_id, int *errp)
+{
+	data_pointer data;
+
+	if (index_table_cache_get(&table_id, &data)) {
+		*errp = 0;
+		return data;
+	}
+
+	uint64_t user_flags = 0;
+	dnet_time timestamp;
+	dnet_empty_time(&timestamp);
+
+	data = sess.read(table_id, &user_flags, &timestamp, errp);
+	if (!*errp)
+		index_table_cache_put(&table_id, data, timestamp);
+
+	return data;
 }
 
 int process_internal_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_request *request)
@@ -568,25 +1158,87 @@ int process_internal_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_
 	const int64_t timer_checks = timer.restart();
 
 	int err = 0;
-	data_pointer data = sess.read(cmd->id, &err);
-	const int64_t timer_read = timer.restart();
+	data_pointer data;
+	data_pointer new_data;
+
+	/*
+	 * Bloom short-circuit: removing an object the filter definitely does
+	 * not know about cannot change the table, skip the backend read.
+	 */
+	const bool bloom_miss = (action == remove_data) &&
+		!index_bloom_maybe_contains(&cmd->id, request->id.id);
+
+	const bool delta_mode = !!(state->n->flags & DNET_CFG_INDEXES_DELTA);
+
+	int64_t timer_read = 0;
+	int64_t timer_convert = 0;
+	int64_t timer_write = 0;
+
+	if (bloom_miss) {
+		dnet_log(state->n, DNET_LOG_DEBUG, "INDEXES_INTERNAL: bloom filter miss, nothing to remove\n");
+	} else if (delta_mode && index_delta_append_allowed(&cmd->id)) {
+		// append a small delta record instead of rewriting the table
+		data_buffer record_buffer(sizeof(dnet_index_delta_record) + entry_data.size());
+
+		dnet_index_delta_record record;
+		memset(&record, 0, sizeof(record));
+		record.magic = dnet_bswap64(DNET_INDEX_DELTA_MAGIC);
+		record.action = dnet_bswap32(action == insert_data ?
+				DNET_INDEX_DELTA_INSERT : DNET_INDEX_DELTA_REMOVE);
+		record.data_size = dnet_bswap32(static_cast<uint32_t>(entry_data.size()));
+		memcpy(record.id.id, request->id.id, DNET_ID_SIZE);
+
+		record_buffer.write(record);
+		if (!entry_data.empty())
+			record_buffer.write(entry_data.data<char>(), entry_data.size());
+
+		data_pointer record_data = std::move(record_buffer);
+
+		sess.set_ioflags(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+		err = sess.write(cmd->id, record_data);
+		sess.set_ioflags(DNET_IO_FLAGS_CACHE);
+
+		if (!err) {
+			index_delta_appended(&cmd->id);
+			if (action == insert_data)
+				index_bloom_insert(&cmd->id, request->id.id);
+		}
+		timer_write = timer.restart();
 
-	data_pointer new_data = convert_index_table(state->n, &cmd->id, request, entry_data, data, action);
-	const int64_t timer_convert = timer.restart();
+		dnet_log(state->n, DNET_LOG_DEBUG, "INDEXES_INTERNAL: delta append: size: %zu, err: %d\n",
+			 record_data.size(), err);
+	} else {
+		data = index_table_cached_read(sess, cmd->id, &err);
+		timer_read = timer.restart();
 
-	const bool data_equal = data == new_data;
+		index_bloom_build_if_missing(&cmd->id, data);
 
-	const int64_t timer_compare = timer.restart();
+		new_data = convert_index_table(state->n, &cmd->id, request, entry_data, data, action);
+		timer_convert = timer.restart();
 
-	int64_t timer_write = timer_compare;
+		const bool data_equal = data == new_data;
 
-	if (data_equal) {
-		dnet_log(state->n, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is the same\n");
-		err = 0;
-	} else {
-		dnet_log(state->n, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is different\n");
-		err = sess.write(cmd->id, new_data);
-		timer_write = timer.restart();
+		if (data_equal) {
+			dnet_log(state->n, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is the same\n");
+			err = 0;
+		} else {
+			dnet_log(state->n, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is different\n");
+			err = sess.write(cmd->id, new_data);
+			if (!err) {
+				// write-through: the write itself invalidated the entry
+				dnet_time timestamp;
+				dnet_current_time(&timestamp);
+				index_table_cache_put(&cmd->id, new_data, timestamp);
+
+				if (action == insert_data)
+					index_bloom_insert(&cmd->id, request->id.id);
+				// convert_index_table() output is a plain binary table,
+				// the next update may append to it
+				if (delta_mode)
+					index_delta_folded(&cmd->id);
+			}
+			timer_write = timer.restart();
+		}
 	}
 
 	data_buffer buffer(sizeof(dnet_indexes_reply) + sizeof(dnet_indexes_reply_entry));
@@ -624,6 +1276,85 @@ int process_internal_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_
 	return err;
 }
 
+/*
+ * Streaming merge-join over sorted binary index tables: every cursor
+ * advances towards the running candidate id and a match is emitted only
+ * when all tables agree on it, so nothing is deserialized and nothing
+ * past the offset/limit window is materialized.
+ */
+static void find_indexes_merge_join(std::vector<index_table_view> &views,
+		uint64_t result_offset, uint64_t result_limit,
+		std::vector<find_indexes_result_entry> &result)
+{
+	uint64_t skipped = 0;
+	bool done = false;
+
+	while (!done) {
+		index_table_view &first = views[0];
+
+		if (first.pos == first.count)
+			break;
+
+		const unsigned char *candidate = first.entries[first.pos].index.id;
+		bool equal = true;
+
+		for (size_t i = 1; i < views.size(); ++i) {
+			index_table_view &view = views[i];
+
+			while (view.pos < view.count
+					&& memcmp(view.entries[view.pos].index.id, candidate, DNET_ID_SIZE) < 0)
+				++view.pos;
+
+			if (view.pos == view.count) {
+				done = true;
+				equal = false;
+				break;
+			}
+
+			if (memcmp(view.entries[view.pos].index.id, candidate, DNET_ID_SIZE)) {
+				// overshot: restart with the bigger id as the candidate
+				candidate = view.entries[view.pos].index.id;
+				while (first.pos < first.count
+						&& memcmp(first.entries[first.pos].index.id, candidate, DNET_ID_SIZE) < 0)
+					++first.pos;
+				equal = false;
+				break;
+			}
+		}
+
+		if (!equal)
+			continue;
+
+		if (skipped < result_offset) {
+			++skipped;
+		} else {
+			result.resize(result.size() + 1);
+			find_indexes_result_entry &entry = result.back();
+
+			entry.id = first.entries[first.pos].index;
+
+			for (size_t i = 0; i < views.size(); ++i) {
+				const index_table_view &view = views[i];
+				const dnet_index_table_entry &table_entry = view.entries[view.pos];
+				const size_t offset = dnet_bswap32(table_entry.data_offset);
+				uint32_t size = dnet_bswap32(table_entry.data_size);
+
+				if (offset + size > view.heap_size)
+					size = 0;
+
+				entry.indexes.emplace_back(view.request_id,
+						size ? data_pointer::copy(view.heap + offset, size) : data_pointer());
+			}
+
+			if (result_limit && result.size() >= result_limit)
+				break;
+		}
+
+		for (size_t i = 0; i < views.size(); ++i)
+			++views[i].pos;
+	}
+}
+
 int process_find_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_request *request)
 {
 	local_session sess(state->n);
@@ -638,6 +1369,9 @@ int process_find_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_requ
 		return -ENOTSUP;
 	}
 
+	const uint64_t result_offset = request->result_offset;
+	const uint64_t result_limit = request->result_limit;
+
 	std::vector<find_indexes_result_entry> result;
 
 	std::map<dnet_raw_id, size_t, dnet_raw_id_less_than<> > result_map;
@@ -646,17 +1380,60 @@ int process_find_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_requ
 
 	int err = -1;
 	dnet_id id = cmd->id;
+	bool merged = false;
+
+	if (intersection && request->entries_count > 0) {
+		/*
+		 * Fast path: when every requested table is in the binary sorted
+		 * format, intersect them with a streaming merge-join right over
+		 * the stored bytes. A legacy msgpack table drops us back to the
+		 * generic decode path below.
+		 */
+		std::vector<index_table_view> views(request->entries_count);
+		bool binary = true;
+
+		size_t view_offset = 0;
+		char *view_start = reinterpret_cast<char *>(request->entries);
+		for (uint64_t i = 0; i < request->entries_count; ++i) {
+			dnet_indexes_request_entry &request_entry = *reinterpret_cast<dnet_indexes_request_entry *>(view_start + view_offset);
+			view_offset += sizeof(dnet_indexes_request_entry) + request_entry.size;
+
+			memcpy(id.id, request_entry.id.id, sizeof(id.id));
+
+			int ret = 0;
+			data_pointer table = index_table_cached_read(sess, id, &ret);
+
+			if (ret) {
+				dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND, err: %d\n",
+					 dnet_dump_id(&id), ret);
+				return ret;
+			}
+
+			if (!index_table_view_init(table, views[i])) {
+				binary = false;
+				break;
+			}
+
+			views[i].request_id = request_entry.id;
+		}
+
+		if (binary) {
+			find_indexes_merge_join(views, result_offset, result_limit, result);
+			err = 0;
+			merged = true;
+		}
+	}
 
 	size_t data_offset = 0;
 	char *data_start = reinterpret_cast<char *>(request->entries);
-	for (uint64_t i = 0; i < request->entries_count; ++i) {
+	for (uint64_t i = 0; !merged && i < request->entries_count; ++i) {
 		dnet_indexes_request_entry &request_entry = *reinterpret_cast<dnet_indexes_request_entry *>(data_start + data_offset);
 		data_offset += sizeof(dnet_indexes_request_entry) + request_entry.size;
 
 		memcpy(id.id, request_entry.id.id, sizeof(id.id));
 
 		int ret = 0;
-		data_pointer data = sess.read(id, &ret);
+		data_pointer data = index_table_cached_read(sess, id, &ret);
 
 		if (ret) {
 			dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND, err: %d\n",
@@ -722,6 +1499,15 @@ int process_find_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_requ
 //	if (err != 0)
 //		return err;
 
+	if (!merged) {
+		// pagination for the decode paths, the merge-join applies it while streaming
+		if (result_offset)
+			result.erase(result.begin(),
+					result.begin() + std::min<size_t>(result_offset, result.size()));
+		if (result_limit && result.size() > result_limit)
+			result.resize(result_limit);
+	}
+
 	dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND: result of find: %zu objects\n",
 		dnet_dump_id(&id), result.size());
 
@@ -745,6 +1531,16 @@ void dnet_indexes_cleanup(struct dnet_node *)
 {
 }
 
+/*
+ * Called by the generic write and removal paths: any out-of-band change
+ * to an object that happens to be a cached index table makes the cached
+ * copy stale.
+ */
+void dnet_indexes_invalidate(struct dnet_node *, struct dnet_id *id)
+{
+	index_table_cache_erase(bloom_key(id));
+}
+
 int dnet_process_indexes(dnet_net_state *st, dnet_cmd *cmd, void *data)
 {
 	dnet_indexes_request *request = static_cast<dnet_indexes_request*>(data);
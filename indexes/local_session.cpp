@@ -222,7 +222,8 @@ data_pointer local_session::lookup(const dnet_cmd &tmp_cmd, int *errp)
 	return data_pointer();
 }
 
-int local_session::update_index_internal(const dnet_id &id, const dnet_raw_id &index, const data_pointer &data, update_index_action action)
+int local_session::update_index_internal(const dnet_id &id, const dnet_raw_id &index, const data_pointer &data,
+		update_index_action action, int shard_id, int shard_count)
 {
 	struct timeval start, end;
 
@@ -237,6 +238,8 @@ int local_session::update_index_internal(const dnet_id &id, const dnet_raw_id &i
 
 	request.id = id;
 	request.entries_count = 1;
+	request.shard_id = shard_id;
+	request.shard_count = shard_count;
 
 	buffer.write(request);
 
@@ -13,6 +13,11 @@
  * GNU General Public License for more details.
  */
 
+/* pipe2() and splice() with their SPLICE_F_* flags are GNU extensions */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -171,6 +176,88 @@ int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t
 }
 #endif
 
+#ifdef HAVE_SPLICE_SUPPORT
+/*
+ * Zero-copy fallback for descriptors sendfile() can not handle:
+ * file is spliced into lazily created per-state pipe and then from
+ * the pipe into the socket, so data never crosses into userspace.
+ *
+ * @offset/@size only account bytes pushed into the socket - bytes
+ * parked in the pipe (st->splice_pending) are drained first on the
+ * next invocation, exactly like not-yet-sent bytes of a plain buffer.
+ */
+#define DNET_SPLICE_CHUNK_SIZE	(512 * 1024)
+
+int dnet_splicefile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size)
+{
+	uint64_t total = 0;
+	loff_t foff;
+	ssize_t err = 0;
+
+	if (st->splice_pipe[0] < 0) {
+		if (pipe2(st->splice_pipe, O_NONBLOCK)) {
+			err = -errno;
+			st->splice_pipe[0] = st->splice_pipe[1] = -1;
+			dnet_log_err(st->n, "%s: failed to create splice pipe",
+					dnet_state_dump_addr(st));
+			return err;
+		}
+	}
+
+	while (size) {
+		if (st->splice_pending) {
+			err = splice(st->splice_pipe[0], NULL, st->write_s, NULL,
+					st->splice_pending,
+					SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+			if (err < 0) {
+				if (errno == EINTR)
+					continue;
+				err = -errno;
+				break;
+			}
+			if (err == 0) {
+				err = -ECONNRESET;
+				break;
+			}
+
+			st->splice_pending -= err;
+			size -= err;
+			*offset += err;
+			total += err;
+			continue;
+		}
+
+		foff = *offset;
+		err = splice(fd, &foff, st->splice_pipe[1], NULL,
+				size < DNET_SPLICE_CHUNK_SIZE ? size : DNET_SPLICE_CHUNK_SIZE,
+				SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+		if (err == 0)
+			break;
+
+		st->splice_pending += err;
+	}
+
+	if (total)
+		return total;
+
+	return err < 0 ? err : 0;
+}
+#else
+int dnet_splicefile(struct dnet_net_state *st __attribute__ ((unused)),
+		int fd __attribute__ ((unused)),
+		uint64_t *offset __attribute__ ((unused)),
+		uint64_t size __attribute__ ((unused)))
+{
+	return -ENOTSUP;
+}
+#endif
+
 #ifdef HAVE_IOPRIO_SUPPORT
 
 enum {
@@ -61,15 +61,234 @@ static int dnet_local_digest_transform(void *priv __unused, struct dnet_session
 	return 0;
 }
 
+static int dnet_local_digest_transform_batch(void *priv, struct dnet_session *s,
+		const void *const *srcs, const uint64_t *sizes,
+		void *const *dsts, unsigned int *dsize, unsigned int flags, int num)
+{
+	unsigned int rs = *dsize;
+	unsigned char hash[SHA512_MB_LANES][64];
+	const char *bufs[SHA512_MB_LANES];
+	size_t lens[SHA512_MB_LANES];
+	void *res[SHA512_MB_LANES];
+	int i, j, lanes, err;
+
+	/*
+	 * Namespace bytes would have to be folded into every lane separately,
+	 * and batched callers (index id generation, bulk checksumming) do not
+	 * use namespaces - take the scalar path when one is set.
+	 */
+	if ((s && s->ns && s->nsize) || !sha512_mb_available()) {
+		for (i = 0; i < num; ++i) {
+			unsigned int ds = rs;
+
+			err = dnet_local_digest_transform(priv, s, srcs[i], sizes[i], dsts[i], &ds, flags);
+			if (err)
+				return err;
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < num; i += SHA512_MB_LANES) {
+		lanes = num - i;
+		if (lanes > SHA512_MB_LANES)
+			lanes = SHA512_MB_LANES;
+
+		if (lanes == SHA512_MB_LANES) {
+			for (j = 0; j < lanes; ++j) {
+				bufs[j] = srcs[i + j];
+				lens[j] = sizes[i + j];
+				res[j] = hash[j];
+			}
+
+			sha512_buffer_x4(bufs, lens, res);
+		} else {
+			for (j = 0; j < lanes; ++j)
+				sha512_buffer(srcs[i + j], sizes[i + j], hash[j]);
+		}
+
+		for (j = 0; j < lanes; ++j) {
+			unsigned int ds = rs;
+
+			dnet_transform_final(dsts[i + j], hash[j], &ds, rs);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Fast non-cryptographic transform for trusted clusters.
+ *
+ * xxhash64-style single-pass hash: an order of magnitude cheaper than SHA512,
+ * with dispersion good enough for id routing, but with no collision or
+ * tampering resistance whatsoever. The 64-bit result seeds a splitmix64
+ * stream which fills the whole id, so route distribution over the full
+ * DNET_ID_SIZE stays uniform.
+ *
+ * Words are read in host byte order - all nodes and clients of a cluster
+ * must agree on endianness (as they must agree on the transform itself).
+ */
+
+#define DNET_FH_PRIME_1	0x9e3779b185ebca87ULL
+#define DNET_FH_PRIME_2	0xc2b2ae3d27d4eb4fULL
+#define DNET_FH_PRIME_3	0x165667b19e3779f9ULL
+#define DNET_FH_PRIME_4	0x85ebca77c2b2ae63ULL
+#define DNET_FH_PRIME_5	0x27d4eb2f165667c5ULL
+
+static inline uint64_t dnet_fh_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t dnet_fh_read64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t dnet_fh_read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t dnet_fh_round(uint64_t acc, uint64_t input)
+{
+	acc += input * DNET_FH_PRIME_2;
+	acc = dnet_fh_rotl(acc, 31);
+	acc *= DNET_FH_PRIME_1;
+	return acc;
+}
+
+static inline uint64_t dnet_fh_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= dnet_fh_round(0, val);
+	return acc * DNET_FH_PRIME_1 + DNET_FH_PRIME_4;
+}
+
+static uint64_t dnet_fasthash64(const void *data, size_t len, uint64_t seed)
+{
+	const unsigned char *p = data;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		const unsigned char *limit = end - 32;
+		uint64_t v1 = seed + DNET_FH_PRIME_1 + DNET_FH_PRIME_2;
+		uint64_t v2 = seed + DNET_FH_PRIME_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - DNET_FH_PRIME_1;
+
+		do {
+			v1 = dnet_fh_round(v1, dnet_fh_read64(p)); p += 8;
+			v2 = dnet_fh_round(v2, dnet_fh_read64(p)); p += 8;
+			v3 = dnet_fh_round(v3, dnet_fh_read64(p)); p += 8;
+			v4 = dnet_fh_round(v4, dnet_fh_read64(p)); p += 8;
+		} while (p <= limit);
+
+		h = dnet_fh_rotl(v1, 1) + dnet_fh_rotl(v2, 7) +
+			dnet_fh_rotl(v3, 12) + dnet_fh_rotl(v4, 18);
+		h = dnet_fh_merge_round(h, v1);
+		h = dnet_fh_merge_round(h, v2);
+		h = dnet_fh_merge_round(h, v3);
+		h = dnet_fh_merge_round(h, v4);
+	} else {
+		h = seed + DNET_FH_PRIME_5;
+	}
+
+	h += len;
+
+	while (p + 8 <= end) {
+		h ^= dnet_fh_round(0, dnet_fh_read64(p));
+		h = dnet_fh_rotl(h, 27) * DNET_FH_PRIME_1 + DNET_FH_PRIME_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t)dnet_fh_read32(p) * DNET_FH_PRIME_1;
+		h = dnet_fh_rotl(h, 23) * DNET_FH_PRIME_2 + DNET_FH_PRIME_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		h ^= *p * DNET_FH_PRIME_5;
+		h = dnet_fh_rotl(h, 11) * DNET_FH_PRIME_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= DNET_FH_PRIME_2;
+	h ^= h >> 29;
+	h *= DNET_FH_PRIME_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static void dnet_fasthash_expand(uint64_t h, unsigned char *dst, unsigned int len)
+{
+	uint64_t z;
+	unsigned int i, rest;
+
+	for (i = 0; i < len; i += 8) {
+		h += 0x9e3779b97f4a7c15ULL;
+		z = h;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+
+		rest = len - i;
+		memcpy(dst + i, &z, rest >= 8 ? 8 : rest);
+	}
+}
+
+static int dnet_local_fast_transform(void *priv __unused, struct dnet_session *s,
+		const void *src, uint64_t size,
+		void *dst, unsigned int *dsize, unsigned int flags __unused)
+{
+	unsigned int rs = *dsize;
+	unsigned char hash[64];
+	uint64_t seed = 0;
+
+	if (s && s->ns && s->nsize)
+		seed = dnet_fasthash64(s->ns, s->nsize, 0);
+
+	dnet_fasthash_expand(dnet_fasthash64(src, size, seed), hash, sizeof(hash));
+
+	dnet_transform_final(dst, hash, dsize, rs);
+	return 0;
+}
+
 void dnet_crypto_cleanup(struct dnet_node *n __unused)
 {
 }
 
-int dnet_crypto_init(struct dnet_node *n)
+int dnet_crypto_init(struct dnet_node *n, struct dnet_config *cfg)
 {
 	struct dnet_transform *t = &n->transform;
 
-	t->transform = dnet_local_digest_transform;
+	switch (cfg->transform) {
+	case DNET_TRANSFORM_FASTHASH:
+		/*
+		 * Single-buffer hash is already cheap, batch mode buys nothing -
+		 * callers fall back to per-buffer calls.
+		 */
+		t->transform = dnet_local_fast_transform;
+		t->transform_batch = NULL;
+		dnet_log(n, DNET_LOG_INFO, "Using fast non-cryptographic transform for ids and checksums\n");
+		break;
+	case DNET_TRANSFORM_SHA512:
+	default:
+		t->transform = dnet_local_digest_transform;
+		t->transform_batch = dnet_local_digest_transform_batch;
+		break;
+	}
+
 	t->priv = NULL;
 
 	return 0;
@@ -0,0 +1,263 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "sha512.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Multi-buffer SHA512.
+ *
+ * A single SHA512 message can not be vectorized - every round depends on the
+ * previous one. Four independent messages can: each 64-bit lane of a 256-bit
+ * AVX2 register carries the working state of one message and all four digests
+ * come out for roughly the cost of one scalar pass.
+ *
+ * The vector kernel consumes one 128-byte block per lane per call, so the
+ * lanes run in lock-step while every buffer still has a full block left and
+ * the (generally different-sized) tails are finished with the scalar code.
+ * Everything is dispatched at runtime: on CPUs without AVX2, and on builds
+ * where the compiler can not target it, sha512_buffer_x4() degrades to four
+ * sequential sha512_buffer() calls.
+ */
+
+#if defined(HAVE_AVX2_SUPPORT) && defined(__x86_64__)
+
+#include <immintrin.h>
+
+/* Native-endian copy of the round constants from sha512.c */
+static const uint64_t sha512_mb_round_constants[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+  0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+  0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+  0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+  0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+  0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+  0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+  0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+  0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+  0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+  0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+  0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+  0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+  0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+  0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+  0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+  0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+  0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+  0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+  0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+  0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+int
+sha512_mb_available (void)
+{
+  static int avx2 = -1;
+
+  if (avx2 < 0)
+    avx2 = __builtin_cpu_supports ("avx2");
+
+  return avx2;
+}
+
+/* Big-endian message word load, alignment-safe.  */
+static inline uint64_t
+mb_load_be (const unsigned char *p)
+{
+  uint64_t v;
+
+  memcpy (&v, p, sizeof v);
+  return __builtin_bswap64 (v);
+}
+
+#define mb_rotr(x, n) \
+  _mm256_or_si256 (_mm256_srli_epi64 (x, n), _mm256_slli_epi64 (x, 64 - (n)))
+
+/* Process one 128-byte block of each of the four lanes, accumulating into the
+   respective contexts. Semantically equivalent to four calls of
+   sha512_process_block() with len == 128.  */
+__attribute__((target("avx2"))) static void
+sha512_process_block_x4 (const unsigned char *const blocks[SHA512_MB_LANES],
+                         struct sha512_ctx *const ctxs[SHA512_MB_LANES])
+{
+  __m256i x[16];
+  __m256i st[8];
+  __m256i a, b, c, d, e, f, g, h;
+  __m256i w, s0, s1, t1, t2;
+  uint64_t out[SHA512_MB_LANES] __attribute__((aligned(32)));
+  int t, i;
+
+  for (i = 0; i < 8; i++)
+    st[i] = _mm256_set_epi64x (ctxs[3]->state[i], ctxs[2]->state[i],
+                               ctxs[1]->state[i], ctxs[0]->state[i]);
+
+  a = st[0]; b = st[1]; c = st[2]; d = st[3];
+  e = st[4]; f = st[5]; g = st[6]; h = st[7];
+
+  for (t = 0; t < 16; t++)
+    x[t] = _mm256_set_epi64x (mb_load_be (blocks[3] + t * 8),
+                              mb_load_be (blocks[2] + t * 8),
+                              mb_load_be (blocks[1] + t * 8),
+                              mb_load_be (blocks[0] + t * 8));
+
+  for (t = 0; t < 80; t++)
+    {
+      if (t < 16)
+        {
+          w = x[t];
+        }
+      else
+        {
+          /* S0 (x[t - 15]) - rotr1 ^ rotr8 ^ shr7 */
+          s0 = _mm256_xor_si256 (mb_rotr (x[(t - 15) & 15], 1),
+                 _mm256_xor_si256 (mb_rotr (x[(t - 15) & 15], 8),
+                                   _mm256_srli_epi64 (x[(t - 15) & 15], 7)));
+          /* S1 (x[t - 2]) - rotr19 ^ rotr61 ^ shr6 */
+          s1 = _mm256_xor_si256 (mb_rotr (x[(t - 2) & 15], 19),
+                 _mm256_xor_si256 (mb_rotr (x[(t - 2) & 15], 61),
+                                   _mm256_srli_epi64 (x[(t - 2) & 15], 6)));
+          w = x[t & 15]
+            = _mm256_add_epi64 (_mm256_add_epi64 (x[t & 15], s0),
+                                _mm256_add_epi64 (x[(t - 7) & 15], s1));
+        }
+
+      /* SS1 (e) - rotr14 ^ rotr18 ^ rotr41 */
+      s1 = _mm256_xor_si256 (mb_rotr (e, 14),
+             _mm256_xor_si256 (mb_rotr (e, 18), mb_rotr (e, 41)));
+      /* t1 = h + SS1 (e) + F1 (e, f, g) + K + w */
+      t1 = _mm256_add_epi64 (h, _mm256_add_epi64 (s1,
+             _mm256_add_epi64 (
+               _mm256_xor_si256 (g, _mm256_and_si256 (e,
+                                      _mm256_xor_si256 (f, g))),
+               _mm256_add_epi64 (
+                 _mm256_set1_epi64x (sha512_mb_round_constants[t]), w))));
+      /* SS0 (a) - rotr28 ^ rotr34 ^ rotr39 */
+      s0 = _mm256_xor_si256 (mb_rotr (a, 28),
+             _mm256_xor_si256 (mb_rotr (a, 34), mb_rotr (a, 39)));
+      /* t2 = SS0 (a) + F2 (a, b, c) */
+      t2 = _mm256_add_epi64 (s0,
+             _mm256_or_si256 (_mm256_and_si256 (a, b),
+               _mm256_and_si256 (c, _mm256_or_si256 (a, b))));
+
+      h = g; g = f; f = e;
+      e = _mm256_add_epi64 (d, t1);
+      d = c; c = b; b = a;
+      a = _mm256_add_epi64 (t1, t2);
+    }
+
+  st[0] = a; st[1] = b; st[2] = c; st[3] = d;
+  st[4] = e; st[5] = f; st[6] = g; st[7] = h;
+
+  for (i = 0; i < 8; i++)
+    {
+      _mm256_store_si256 ((__m256i *) out, st[i]);
+      ctxs[0]->state[i] += out[0];
+      ctxs[1]->state[i] += out[1];
+      ctxs[2]->state[i] += out[2];
+      ctxs[3]->state[i] += out[3];
+    }
+
+  for (i = 0; i < SHA512_MB_LANES; i++)
+    {
+      ctxs[i]->total[0] += 128;
+      if (ctxs[i]->total[0] < 128)
+        ctxs[i]->total[1]++;
+    }
+}
+
+void
+sha512_buffer_x4 (const char *const *buffers, const size_t *lens,
+                  void *const *resblocks)
+{
+  struct sha512_ctx ctx[SHA512_MB_LANES];
+  struct sha512_ctx *ctxs[SHA512_MB_LANES];
+  const unsigned char *blocks[SHA512_MB_LANES];
+  size_t left[SHA512_MB_LANES];
+  int i;
+
+  if (!sha512_mb_available ())
+    {
+      for (i = 0; i < SHA512_MB_LANES; i++)
+        sha512_buffer (buffers[i], lens[i], resblocks[i]);
+      return;
+    }
+
+  for (i = 0; i < SHA512_MB_LANES; i++)
+    {
+      sha512_init_ctx (&ctx[i]);
+      ctxs[i] = &ctx[i];
+      blocks[i] = (const unsigned char *) buffers[i];
+      left[i] = lens[i];
+    }
+
+  while (left[0] >= 128 && left[1] >= 128 && left[2] >= 128 && left[3] >= 128)
+    {
+      sha512_process_block_x4 (blocks, ctxs);
+
+      for (i = 0; i < SHA512_MB_LANES; i++)
+        {
+          blocks[i] += 128;
+          left[i] -= 128;
+        }
+    }
+
+  for (i = 0; i < SHA512_MB_LANES; i++)
+    {
+      if (left[i] > 0)
+        sha512_process_bytes (blocks[i], left[i], &ctx[i]);
+      sha512_finish_ctx (&ctx[i], resblocks[i]);
+    }
+}
+
+#else /* !HAVE_AVX2_SUPPORT || !__x86_64__ */
+
+int
+sha512_mb_available (void)
+{
+  return 0;
+}
+
+void
+sha512_buffer_x4 (const char *const *buffers, const size_t *lens,
+                  void *const *resblocks)
+{
+  int i;
+
+  for (i = 0; i < SHA512_MB_LANES; i++)
+    sha512_buffer (buffers[i], lens[i], resblocks[i]);
+}
+
+#endif
@@ -88,6 +88,21 @@ extern int sha384_stream (FILE *stream, void *resblock);
 extern void *sha512_buffer (const char *buffer, size_t len, void *resblock);
 extern void *sha384_buffer (const char *buffer, size_t len, void *resblock);
 
+/* Multi-buffer interface: number of independent buffers hashed in parallel
+   by one sha512_buffer_x4 call.  */
+enum { SHA512_MB_LANES = 4 };
+
+/* Return nonzero when the running CPU can hash SHA512_MB_LANES buffers in
+   parallel.  Cheap after the first call, suitable for per-batch dispatch.  */
+extern int sha512_mb_available (void);
+
+/* Compute SHA512 message digests of SHA512_MB_LANES independent buffers,
+   BUFFERS[i] of LENS[i] bytes each, into the 64 bytes at RESBLOCKS[i].
+   Results are bit-identical to sha512_buffer; without CPU support this
+   degrades to sequential sha512_buffer calls.  */
+extern void sha512_buffer_x4 (const char *const *buffers, const size_t *lens,
+                              void *const *resblocks);
+
 # ifdef __cplusplus
 }
 # endif
@@ -190,19 +190,25 @@ err_out_exit:
 	return err;
 }
 
-static int dnet_cmd_reverse_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data __unused)
+static int dnet_cmd_reverse_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data __unused, int *cache __unused)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_net_state *base;
 	int err = -ENXIO;
 	int version[4] = {0, 0, 0, 0};
 	int indexes_shard_count = 0;
+	int caps = 0;
 
 	dnet_version_decode(&cmd->id, version);
 	dnet_indexes_shard_count_decode(&cmd->id, &indexes_shard_count);
+	dnet_capabilities_decode(&cmd->id, &caps);
+
+	/* reply with the intersection of what both sides support */
+	caps &= DNET_CAPABILITIES_SUPPORTED;
 
 	dnet_version_encode(&cmd->id);
 	dnet_indexes_shard_count_encode(&cmd->id, n->indexes_shard_count);
+	dnet_capabilities_encode(&cmd->id, caps);
 
 	err = dnet_version_compare(st, version);
 	if (err)
@@ -220,6 +226,24 @@ static int dnet_cmd_reverse_lookup(struct dnet_net_state *st, struct dnet_cmd *c
 		dnet_state_put(base);
 	}
 
+	/*
+	 * The handshake reply above was queued with full framing, everything
+	 * after it uses the negotiated format. The client sends nothing else
+	 * until it has parsed the reply, so flipping the receive side here
+	 * can not cut an in-flight packet.
+	 */
+	if (!err && (caps & DNET_CAPABILITIES_COMPACT)) {
+		st->compact = 1;
+		dnet_log(n, DNET_LOG_INFO, "%s: negotiated compact wire framing\n",
+				dnet_state_dump_addr(st));
+	}
+
+	if (!err && (caps & DNET_CAPABILITIES_LZ4)) {
+		st->lz4 = 1;
+		dnet_log(n, DNET_LOG_INFO, "%s: negotiated LZ4 wire compression\n",
+				dnet_state_dump_addr(st));
+	}
+
 err_out_exit:
 	if (err) {
 		cmd->flags |= DNET_FLAGS_NEED_ACK;
@@ -241,7 +265,9 @@ static int dnet_check_connection(struct dnet_node *n, struct dnet_addr *addr)
 	return 0;
 }
 
-static int dnet_cmd_join_client(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+static void dnet_gossip_route_update(struct dnet_net_state *joined);
+
+static int dnet_cmd_join_client(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_addr_container *cnt = data;
@@ -320,20 +346,71 @@ static int dnet_cmd_join_client(struct dnet_net_state *st, struct dnet_cmd *cmd,
 			dnet_dump_id(&cmd->id), client_addr, server_addr,
 			idx, cnt->addr_num, n->addr_num, ids_num, err);
 
+	if (!err)
+		dnet_gossip_route_update(st);
+
 err_out_exit:
 	return err;
 }
 
-static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd)
+/*
+ * Unsolicited route update pushed by a peer which saw a new node join:
+ * payload is a single address container with ids, merged the same way
+ * route list replies are. Merging is idempotent - already known states
+ * only get their address list refreshed.
+ */
+static int dnet_cmd_route_update(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_addr_container *cnt = data;
+	int num;
+
+	dnet_convert_addr_container(cnt);
+
+	if (cmd->size < sizeof(struct dnet_addr_container) +
+			cnt->addr_num * sizeof(struct dnet_addr) + sizeof(struct dnet_raw_id))
+		return -EINVAL;
+
+	num = (cmd->size - sizeof(struct dnet_addr_container) -
+			cnt->addr_num * sizeof(struct dnet_addr)) / sizeof(struct dnet_raw_id);
+
+	return dnet_process_route_reply(orig, cnt, cmd->id.group_id, num);
+}
+
+static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data, int *cache __unused)
 {
 	struct dnet_node *n = orig->n;
 	struct dnet_net_state *st;
 	struct dnet_group *g;
+	struct dnet_route_version rv;
+	uint64_t version;
 	void *buf = NULL;
 	size_t size, orig_size = 0;
 	int err;
 
+	/* pushed route update, not a request */
+	if (cmd->size >= sizeof(struct dnet_addr_container) + sizeof(struct dnet_raw_id))
+		return dnet_cmd_route_update(orig, cmd, data);
+
 	pthread_mutex_lock(&n->state_lock);
+
+	version = n->route_version;
+
+	/*
+	 * Request carries the version the client saw last: when the table
+	 * did not change since then, the final ack is the whole reply.
+	 */
+	if (cmd->size == sizeof(struct dnet_route_version)) {
+		memcpy(&rv, data, sizeof(struct dnet_route_version));
+		dnet_convert_route_version(&rv);
+
+		if (rv.version == version) {
+			pthread_mutex_unlock(&n->state_lock);
+			dnet_log(n, DNET_LOG_NOTICE, "%s: route table unchanged: version: %llu\n",
+					dnet_server_convert_dnet_addr(&orig->addr),
+					(unsigned long long)version);
+			return 0;
+		}
+	}
 	list_for_each_entry(g, &n->group_list, group_entry) {
 		list_for_each_entry(st, &g->state_list, state_entry) {
 			if (dnet_addr_equal(&st->addr, &orig->addr) || !st->addrs)
@@ -372,10 +449,49 @@ static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd
 err_out_unlock:
 	pthread_mutex_unlock(&n->state_lock);
 	free(buf);
+
+	/*
+	 * Version record follows the table, so the client only remembers
+	 * the version after the full transfer. Mutations that raced with
+	 * the snapshot bump the counter and the next pull transfers again.
+	 */
+	if (!err) {
+		rv.version = version;
+		dnet_convert_route_version(&rv);
+		err = dnet_send_reply(orig, cmd, &rv, sizeof(struct dnet_route_version), 1);
+	}
+
 	return err;
 }
 
-static int dnet_cmd_exec(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+/*
+ * One-hop gossip: pushes the idc record of a state which just joined to
+ * every other joined state, so peers learn about the newcomer without
+ * pulling the full table. Transitive spread and missed pushes are
+ * covered by the periodic version-checked route table pulls.
+ */
+static void dnet_gossip_route_update(struct dnet_net_state *joined)
+{
+	struct dnet_node *n = joined->n;
+	struct dnet_net_state *st;
+	struct dnet_group *g;
+	struct dnet_id id;
+
+	dnet_setup_id(&id, joined->idc->group->group_id, joined->idc->ids[0].raw.id);
+
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		list_for_each_entry(st, &g->state_list, state_entry) {
+			if (st == joined || st == n->st || !st->addrs)
+				continue;
+
+			dnet_send_idc(joined, st, &id, 0, DNET_CMD_ROUTE_LIST, 0, 1, 0);
+		}
+	}
+	pthread_mutex_unlock(&n->state_lock);
+}
+
+static int dnet_cmd_exec(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
 {
 	struct dnet_node *n = st->n;
 	struct sph *e = data;
@@ -432,6 +548,8 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 	as->num = __DNET_CNTR_MAX;
 	as->cmd_num = __DNET_CMD_MAX;
 
+	dnet_cache_stat(n);
+
 	memcpy(as->count, n->counters, sizeof(struct dnet_stat_count) * __DNET_CNTR_MAX);
 
 	if (n->cb->storage_stat) {
@@ -464,13 +582,67 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 	return dnet_send_reply(orig, cmd, as, sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count), 1);
 }
 
-static int dnet_cmd_stat_count(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data __unused)
+static int dnet_cmd_stat_histogram(struct dnet_net_state *orig, struct dnet_cmd *cmd)
+{
+	struct dnet_node *n = orig->n;
+	struct dnet_histogram_stat *st;
+	struct dnet_slow_cmd *slow;
+	size_t size;
+	int i, slow_num = 0, err;
+
+	size = sizeof(struct dnet_histogram_stat) +
+		__DNET_CMD_MAX * sizeof(struct dnet_cmd_histogram) +
+		DNET_SLOW_CMD_NUM * sizeof(struct dnet_slow_cmd);
+
+	st = malloc(size);
+	if (!st)
+		return -ENOMEM;
+
+	st->cmd_num = __DNET_CMD_MAX;
+	st->slow_threshold = n->slow_cmd_threshold;
+
+	/*
+	 * Racy reads of counters being incremented by worker threads are
+	 * fine here: every bucket is monotonic, so a snapshot can only lag
+	 * behind by the commands completed while it was taken.
+	 */
+	memcpy(st->histograms, n->cmd_histograms, __DNET_CMD_MAX * sizeof(struct dnet_cmd_histogram));
+
+	slow = (struct dnet_slow_cmd *)(st->histograms + __DNET_CMD_MAX);
+	for (i = 0; i < DNET_SLOW_CMD_NUM; ++i) {
+		if (!n->slow_cmds[i].duration)
+			continue;
+
+		slow[slow_num] = n->slow_cmds[i];
+		dnet_convert_slow_cmd(&slow[slow_num]);
+		slow_num++;
+	}
+
+	st->slow_num = slow_num;
+	size = sizeof(struct dnet_histogram_stat) +
+		__DNET_CMD_MAX * sizeof(struct dnet_cmd_histogram) +
+		slow_num * sizeof(struct dnet_slow_cmd);
+
+	for (i = 0; i < __DNET_CMD_MAX; ++i)
+		dnet_convert_cmd_histogram(&st->histograms[i]);
+	dnet_convert_histogram_stat(st);
+
+	err = dnet_send_reply(orig, cmd, st, size, 1);
+
+	free(st);
+	return err;
+}
+
+static int dnet_cmd_stat_count(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data __unused, int *cache __unused)
 {
 	struct dnet_node *n = orig->n;
 	struct dnet_net_state *st;
 	struct dnet_addr_stat *as;
 	int err = 0;
 
+	if (cmd->flags & DNET_ATTR_CNTR_HISTOGRAM)
+		return dnet_cmd_stat_histogram(orig, cmd);
+
 	as = alloca(sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count));
 	if (!as) {
 		err = -ENOMEM;
@@ -501,7 +673,56 @@ err_out_exit:
 	return err;
 }
 
-static int dnet_cmd_status(struct dnet_net_state *orig, struct dnet_cmd *cmd __unused, void *data)
+/*
+ * Applies the optional runtime tuning extension of DNET_CMD_STATUS:
+ * thread pool resize goes through the pool monitor, the rest is applied
+ * in place. Unset fields are skipped, current values are reported back.
+ */
+static void dnet_cmd_status_tune(struct dnet_net_state *orig, struct dnet_node_tune *tune)
+{
+	struct dnet_node *n = orig->n;
+	int err;
+
+	dnet_convert_node_tune(tune);
+
+	dnet_log(n, DNET_LOG_INFO, "tune: io_threads: %d, bounds: %d/%d, wait: %d, check: %d, stall: %d, cache: %lld\n",
+			tune->io_thread_num, tune->io_thread_num_min, tune->io_thread_num_max,
+			tune->wait_timeout, tune->check_timeout, tune->stall_count,
+			(long long)tune->cache_size);
+
+	dnet_io_pool_set_size(n,
+			(tune->io_thread_num != DNET_TUNE_UNSET) ? tune->io_thread_num : 0,
+			(tune->io_thread_num_min != DNET_TUNE_UNSET) ? tune->io_thread_num_min : 0,
+			(tune->io_thread_num_max != DNET_TUNE_UNSET) ? tune->io_thread_num_max : 0);
+
+	if (tune->wait_timeout > 0)
+		n->wait_ts.tv_sec = tune->wait_timeout;
+
+	if (tune->check_timeout > 0)
+		n->check_timeout = tune->check_timeout;
+
+	if (tune->stall_count > 0)
+		n->stall_count = tune->stall_count;
+
+	if (tune->cache_size >= 0) {
+		err = dnet_cache_set_size(n, tune->cache_size);
+		if (err)
+			dnet_log(n, DNET_LOG_ERROR, "tune: failed to resize cache to %lld bytes: %d\n",
+					(long long)tune->cache_size, err);
+	}
+
+	tune->io_thread_num = n->io->recv_pool->num;
+	tune->io_thread_num_min = n->io->recv_pool->min;
+	tune->io_thread_num_max = n->io->recv_pool->max;
+	tune->wait_timeout = n->wait_ts.tv_sec;
+	tune->check_timeout = n->check_timeout;
+	tune->stall_count = n->stall_count;
+	tune->cache_size = n->cache_size;
+
+	dnet_convert_node_tune(tune);
+}
+
+static int dnet_cmd_status(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data, int *cache __unused)
 {
 	struct dnet_node *n = orig->n;
 	struct dnet_node_status *st = data;
@@ -543,10 +764,17 @@ static int dnet_cmd_status(struct dnet_net_state *orig, struct dnet_cmd *cmd __u
 
 	dnet_convert_node_status(st);
 
+	if (cmd->size >= sizeof(struct dnet_node_status) + sizeof(struct dnet_node_tune)) {
+		dnet_cmd_status_tune(orig, (struct dnet_node_tune *)(st + 1));
+
+		return dnet_send_reply(orig, cmd, st,
+				sizeof(struct dnet_node_status) + sizeof(struct dnet_node_tune), 1);
+	}
+
 	return dnet_send_reply(orig, cmd, st, sizeof(struct dnet_node_status), 1);
 }
 
-static int dnet_cmd_auth(struct dnet_net_state *orig, struct dnet_cmd *cmd __unused, void *data)
+static int dnet_cmd_auth(struct dnet_net_state *orig, struct dnet_cmd *cmd __unused, void *data, int *cache __unused)
 {
 	struct dnet_node *n = orig->n;
 	struct dnet_auth *a = data;
@@ -574,7 +802,9 @@ int dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int
 	if (st && cmd && (cmd->flags & DNET_FLAGS_NEED_ACK)) {
 		struct dnet_node *n = st->n;
 		unsigned long long tid = cmd->trans & ~DNET_TRANS_REPLY;
+		char buf[sizeof(struct dnet_cmd) + sizeof(struct dnet_trace_annex)];
 		struct dnet_cmd ack;
+		size_t size = sizeof(struct dnet_cmd);
 
 		memcpy(&ack.id, &cmd->id, sizeof(struct dnet_id));
 		ack.cmd = cmd->cmd;
@@ -587,12 +817,35 @@ int dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int
 			ack.flags = cmd->flags & ~(DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
 		ack.status = err;
 
+		/*
+		 * Final ack of a traced command carries the trace annex with
+		 * span timestamps recorded by the IO thread which processed
+		 * the command. Acks sent out of that context (zero queue
+		 * timestamp) go out plain.
+		 */
+		if ((cmd->flags & DNET_FLAGS_TRACE) && !(ack.flags & DNET_FLAGS_MORE) && trace_queue_time) {
+			struct dnet_trace_annex annex;
+
+			annex.queue_time = trace_queue_time;
+			annex.dequeue_time = trace_dequeue_time;
+			annex.proc_time = trace_proc_time;
+			annex.send_time = dnet_usecs_now();
+			dnet_convert_trace_annex(&annex);
+
+			ack.size = sizeof(struct dnet_trace_annex);
+			ack.flags |= DNET_FLAGS_TRACE_ANNEX;
+
+			memcpy(buf + sizeof(struct dnet_cmd), &annex, sizeof(struct dnet_trace_annex));
+			size += sizeof(struct dnet_trace_annex);
+		}
+
 		dnet_log(n, DNET_LOG_NOTICE, "%s: %s: ack -> %s: trans: %llu, flags: 0x%llx, status: %d.\n",
 				dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
 				tid, (unsigned long long)ack.flags, err);
 
 		dnet_convert_cmd(&ack);
-		err = dnet_send(st, &ack, sizeof(struct dnet_cmd));
+		memcpy(buf, &ack, sizeof(struct dnet_cmd));
+		err = dnet_send(st, buf, size);
 	}
 
 	return err;
@@ -640,21 +893,145 @@ static int dnet_iterator_callback_send(void *priv, void *data, uint64_t dsize)
  *
  * While state is 'paused' - wait on condition variable.
  * If state is 'canceled' - exit with error.
+ *
+ * It also enforces the reply rate limits: \a dsize bytes and one reply
+ * are charged against per-iterator token buckets refilled from the wall
+ * clock, and the iterator thread sleeps here once a bucket runs dry.
+ * Limit updates and state changes broadcast the condition variable, so
+ * the sleep reacts to them mid-flight.
  */
-static int dnet_iterator_flow_control(struct dnet_iterator_common_private *ipriv)
+static int dnet_iterator_flow_control(struct dnet_iterator_common_private *ipriv, uint64_t dsize)
 {
+	struct dnet_iterator *it = ipriv->it;
 	int err = 0;
 
-	pthread_mutex_lock(&ipriv->it->lock);
-	while (ipriv->it->state == DNET_ITERATOR_ACTION_PAUSE)
-		err = pthread_cond_wait(&ipriv->it->wait, &ipriv->it->lock);
-	if (ipriv->it->state == DNET_ITERATOR_ACTION_CANCEL)
+	pthread_mutex_lock(&it->lock);
+
+	while (err == 0 && it->state == DNET_ITERATOR_ACTION_START
+			&& (it->limit_bytes_per_sec || it->limit_replies_per_sec)) {
+		struct dnet_time now;
+		struct timespec ts;
+		long long elapsed_ms;
+		int ok_bytes, ok_replies;
+
+		/* Refill buckets, burst is capped at one second worth of tokens */
+		dnet_current_time(&now);
+		elapsed_ms = ((long long)now.tsec - (long long)it->tokens_time.tsec) * 1000 +
+			((long long)now.tnsec - (long long)it->tokens_time.tnsec) / 1000000;
+		if (elapsed_ms > 0) {
+			it->tokens_bytes += it->limit_bytes_per_sec * elapsed_ms / 1000;
+			if (it->tokens_bytes > it->limit_bytes_per_sec)
+				it->tokens_bytes = it->limit_bytes_per_sec;
+
+			it->tokens_replies += it->limit_replies_per_sec * elapsed_ms / 1000;
+			if (it->tokens_replies > it->limit_replies_per_sec)
+				it->tokens_replies = it->limit_replies_per_sec;
+
+			it->tokens_time = now;
+		}
+
+		/* A reply larger than the whole bucket passes on a full bucket */
+		ok_bytes = !it->limit_bytes_per_sec || it->tokens_bytes >= dsize ||
+			it->tokens_bytes == it->limit_bytes_per_sec;
+		ok_replies = !it->limit_replies_per_sec || it->tokens_replies >= 1;
+
+		if (ok_bytes && ok_replies) {
+			if (it->limit_bytes_per_sec)
+				it->tokens_bytes -= dsize < it->tokens_bytes ? dsize : it->tokens_bytes;
+			if (it->limit_replies_per_sec)
+				it->tokens_replies--;
+			break;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100 * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+		pthread_cond_timedwait(&it->wait, &it->lock, &ts);
+	}
+
+	while (it->state == DNET_ITERATOR_ACTION_PAUSE)
+		err = pthread_cond_wait(&it->wait, &it->lock);
+	if (it->state == DNET_ITERATOR_ACTION_CANCEL)
 		err = -ENOEXEC;
-	pthread_mutex_unlock(&ipriv->it->lock);
+	pthread_mutex_unlock(&it->lock);
 
 	return err;
 }
 
+/* Checkpoint at most once per this many shipped records / this many seconds */
+#define DNET_ITERATOR_CHECKPOINT_RECORDS	10000
+#define DNET_ITERATOR_CHECKPOINT_SECONDS	5
+
+static void dnet_iterator_checkpoint_path(struct dnet_node *n, uint64_t id, char *path, size_t size)
+{
+	snprintf(path, size, "%s/iterator.%016" PRIx64 ".chk", n->iterator_dir, id);
+}
+
+static uint64_t dnet_iterator_checkpoint_load(struct dnet_node *n, uint64_t id)
+{
+	struct dnet_iterator_checkpoint chk;
+	char path[1100];
+	int fd;
+	ssize_t err;
+
+	dnet_iterator_checkpoint_path(n, id, path, sizeof(path));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	err = read(fd, &chk, sizeof(chk));
+	close(fd);
+
+	if (err != sizeof(chk) || chk.magic != DNET_ITERATOR_CHECKPOINT_MAGIC)
+		return 0;
+
+	return chk.pos;
+}
+
+/*
+ * Checkpoint is written into a temporary file and renamed over the old one,
+ * so a crash mid-write can not leave a truncated checkpoint behind.
+ */
+static void dnet_iterator_checkpoint_store(struct dnet_node *n, uint64_t id, uint64_t pos)
+{
+	struct dnet_iterator_checkpoint chk = {
+		.magic = DNET_ITERATOR_CHECKPOINT_MAGIC,
+		.pos = pos,
+	};
+	char path[1100], tmp_path[1110];
+	int fd;
+	ssize_t err;
+
+	dnet_iterator_checkpoint_path(n, id, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		dnet_log_err(n, "Failed to open iterator checkpoint '%s'", tmp_path);
+		return;
+	}
+
+	err = write(fd, &chk, sizeof(chk));
+	close(fd);
+
+	if (err != sizeof(chk) || rename(tmp_path, path) < 0) {
+		dnet_log_err(n, "Failed to store iterator checkpoint '%s'", path);
+		unlink(tmp_path);
+	}
+}
+
+static void dnet_iterator_checkpoint_remove(struct dnet_node *n, uint64_t id)
+{
+	char path[1100];
+
+	dnet_iterator_checkpoint_path(n, id, path, sizeof(path));
+	unlink(path);
+}
+
 /*!
  * Common callback part that is run by all iterator types.
  * It's responsible for sanity checks and flow control.
@@ -662,7 +1039,7 @@ static int dnet_iterator_flow_control(struct dnet_iterator_common_private *ipriv
  * Also now it "prepares" data for next callback by combining data itself with
  * fixed-size response header.
  */
-static int dnet_iterator_callback_common(void *priv, struct dnet_raw_id *key,
+int dnet_iterator_callback_common(void *priv, struct dnet_raw_id *key,
 		void *data, uint64_t dsize, struct dnet_ext_list *elist)
 {
 	struct dnet_iterator_common_private *ipriv = priv;
@@ -671,12 +1048,21 @@ static int dnet_iterator_callback_common(void *priv, struct dnet_raw_id *key,
 	uint64_t size;
 	const uint64_t fsize = dsize;
 	unsigned char *combined = NULL, *position;
+	unsigned char csum[sizeof(response->checksum)];
 	int err = 0;
 
 	/* Sanity */
 	if (ipriv == NULL || key == NULL || data == NULL || elist == NULL)
 		return -EINVAL;
 
+	/*
+	 * Position-based resume: backend iteration order is stable between
+	 * runs, so the records a previous checkpointed run already shipped
+	 * are skipped by raw position before any filtering.
+	 */
+	if (++ipriv->pos <= ipriv->skip)
+		return 0;
+
 	/* If DNET_IFLAGS_KEY_RANGE is set... */
 	if (ipriv->req->flags & DNET_IFLAGS_KEY_RANGE) {
 		/* ...skip keys not in key ranges */
@@ -700,6 +1086,20 @@ key_range_found:
 					|| dnet_time_cmp(&elist->timestamp, &ipriv->req->time_end) > 0)
 				goto err_out_exit;
 
+	/* If DNET_IFLAGS_USER_FLAGS is set... */
+	if (ipriv->req->flags & DNET_IFLAGS_USER_FLAGS)
+		/* ...skip records whose masked user flags do not match */
+			if ((elist->flags & ipriv->req->user_flags_mask) != ipriv->req->user_flags_value)
+				goto err_out_exit;
+
+	/* If DNET_IFLAGS_CSUM is set - checksum the data before it may be dropped below */
+	if (ipriv->req->flags & DNET_IFLAGS_CSUM) {
+		memset(csum, 0, sizeof(csum));
+		err = dnet_checksum_data(ipriv->n, data, fsize, csum, sizeof(csum));
+		if (err)
+			goto err_out_exit;
+	}
+
 	/* Set data to NULL in case it's not requested */
 	if (!(ipriv->req->flags & DNET_IFLAGS_DATA)) {
 		data = NULL;
@@ -721,6 +1121,8 @@ key_range_found:
 	response->timestamp = elist->timestamp;
 	response->user_flags = elist->flags;
 	response->size = fsize;
+	if (ipriv->req->flags & DNET_IFLAGS_CSUM)
+		memcpy(response->checksum, csum, sizeof(response->checksum));
 	dnet_convert_iterator_response(response);
 
 	/* Data */
@@ -735,9 +1137,25 @@ key_range_found:
 		goto err_out_exit;
 
 	/* Check that we are allowed to run */
-	err = dnet_iterator_flow_control(ipriv);
+	err = dnet_iterator_flow_control(ipriv, size);
 
 err_out_exit:
+	/*
+	 * Everything up to @pos has been fully handled (shipped or filtered
+	 * out), advance the resume position and checkpoint it periodically.
+	 */
+	if (!err) {
+		ipriv->done = ipriv->pos;
+
+		if (ipriv->checkpoint_id &&
+				(ipriv->done - ipriv->checkpoint_pos >= DNET_ITERATOR_CHECKPOINT_RECORDS ||
+				 time(NULL) >= ipriv->checkpoint_time + DNET_ITERATOR_CHECKPOINT_SECONDS)) {
+			dnet_iterator_checkpoint_store(ipriv->n, ipriv->checkpoint_id, ipriv->done);
+			ipriv->checkpoint_pos = ipriv->done;
+			ipriv->checkpoint_time = time(NULL);
+		}
+	}
+
 	free(combined);
 	return err;
 }
@@ -816,6 +1234,31 @@ static int dnet_iterator_check_ts_range(struct dnet_net_state *st, struct dnet_c
 	return 0;
 }
 
+static int dnet_iterator_check_user_flags(struct dnet_net_state *st, struct dnet_cmd *cmd,
+		struct dnet_iterator_request *ireq)
+{
+	if (ireq->flags & DNET_IFLAGS_USER_FLAGS) {
+		/* Unset DNET_IFLAGS_USER_FLAGS if the mask matches everything */
+		if (ireq->user_flags_mask == 0 && ireq->user_flags_value == 0) {
+			dnet_log(st->n, DNET_LOG_NOTICE, "%s: user flags mask is empty: cmd: %u\n",
+				dnet_dump_id(&cmd->id), cmd->cmd);
+			ireq->flags &= ~DNET_IFLAGS_USER_FLAGS;
+		}
+		/* Value bits outside the mask can never match */
+		if (ireq->user_flags_value & ~ireq->user_flags_mask) {
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: user flags value is wider than mask: cmd: %u\n",
+				dnet_dump_id(&cmd->id), cmd->cmd);
+			return -ERANGE;
+		}
+	}
+	if (ireq->flags & DNET_IFLAGS_USER_FLAGS)
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: using user flags predicate: "
+				"mask: 0x%" PRIx64 ", value: 0x%" PRIx64 "\n",
+				dnet_dump_id(&cmd->id),
+				ireq->user_flags_mask, ireq->user_flags_value);
+	return 0;
+}
+
 static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		struct dnet_iterator_request *ireq,
 		struct dnet_iterator_range *irange)
@@ -823,6 +1266,7 @@ static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 	struct dnet_iterator_common_private cpriv = {
 		.req = ireq,
 		.range = irange,
+		.n = st->n,
 	};
 	struct dnet_iterator_ctl ictl = {
 		.iterate_private = st->n->cb->command_private,
@@ -845,7 +1289,8 @@ static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 	}
 	/* Check ranges */
 	if ((err = dnet_iterator_check_key_range(st, cmd, ireq, irange)) ||
-			(err = dnet_iterator_check_ts_range(st, cmd, ireq)))
+			(err = dnet_iterator_check_ts_range(st, cmd, ireq)) ||
+			(err = dnet_iterator_check_user_flags(st, cmd, ireq)))
 		goto err_out_exit;
 
 	switch (ireq->itype) {
@@ -870,6 +1315,28 @@ static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		goto err_out_exit;
 	}
 
+	/*
+	 * Checkpointed resume: the client keys the checkpoint with a stable
+	 * non-zero request id, the node persists progress next to the ids
+	 * file. Without a server-side directory or an id the iterator
+	 * degrades to a plain full scan.
+	 */
+	if (ireq->flags & DNET_IFLAGS_RESUME) {
+		if (st->n->iterator_dir[0] == '\0' || ireq->id == 0) {
+			dnet_log(st->n, DNET_LOG_NOTICE,
+					"%s: iterator resume requested but disabled: dir: '%s', id: %" PRIu64 "\n",
+					dnet_dump_id(&cmd->id), st->n->iterator_dir, ireq->id);
+		} else {
+			cpriv.checkpoint_id = ireq->id;
+			cpriv.checkpoint_time = time(NULL);
+			cpriv.skip = dnet_iterator_checkpoint_load(st->n, ireq->id);
+			if (cpriv.skip)
+				dnet_log(st->n, DNET_LOG_INFO,
+						"%s: resuming iterator id: %" PRIu64 " from record %" PRIu64 "\n",
+						dnet_dump_id(&cmd->id), ireq->id, cpriv.skip);
+		}
+	}
+
 	/* Create iterator */
 	cpriv.it = dnet_iterator_create(st->n);
 	if (cpriv.it == NULL) {
@@ -877,9 +1344,25 @@ static int dnet_iterator_start(struct dnet_net_state *st, struct dnet_cmd *cmd,
 		goto err_out_exit;
 	}
 
+	/* Apply rate limits requested along with the start */
+	if (ireq->limit_bytes_per_sec || ireq->limit_replies_per_sec)
+		dnet_iterator_set_limits(st->n, cpriv.it->id,
+				ireq->limit_bytes_per_sec, ireq->limit_replies_per_sec);
+
 	/* Run iterator */
 	err = st->n->cb->iterator(&ictl);
 
+	/*
+	 * Completed scans do not need their checkpoint anymore, interrupted
+	 * ones store the final position for the next resume.
+	 */
+	if (cpriv.checkpoint_id) {
+		if (err)
+			dnet_iterator_checkpoint_store(st->n, cpriv.checkpoint_id, cpriv.done);
+		else
+			dnet_iterator_checkpoint_remove(st->n, cpriv.checkpoint_id);
+	}
+
 	/* Remove iterator */
 	dnet_iterator_destroy(st->n, cpriv.it);
 
@@ -892,7 +1375,25 @@ err_out_exit:
 /*!
  * Starts low-level backend iterator and passes data to network or file
  */
-static int dnet_cmd_iterator(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+/*
+ * Read-only commands take the key lock shared, so readers of one hot key
+ * spread across the IO pool; everything else is exclusive.
+ */
+static void dnet_cmd_oplock(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	switch (cmd->cmd) {
+	case DNET_CMD_READ:
+	case DNET_CMD_LOOKUP:
+	case DNET_CMD_BULK_READ:
+		dnet_oplock_read(n, &cmd->id);
+		break;
+	default:
+		dnet_oplock(n, &cmd->id);
+		break;
+	}
+}
+
+static int dnet_cmd_iterator(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
 {
 	struct dnet_iterator_request *ireq = data;
 	struct dnet_iterator_range *irange = data + sizeof(struct dnet_iterator_request);
@@ -924,6 +1425,10 @@ static int dnet_cmd_iterator(struct dnet_net_state *st, struct dnet_cmd *cmd, vo
 	case DNET_ITERATOR_ACTION_CANCEL:
 		err = dnet_iterator_set_state(st->n, ireq->action, ireq->id);
 		break;
+	case DNET_ITERATOR_ACTION_LIMIT:
+		err = dnet_iterator_set_limits(st->n, ireq->id,
+				ireq->limit_bytes_per_sec, ireq->limit_replies_per_sec);
+		break;
 	default:
 		err = -EINVAL;
 		goto err_out_exit;
@@ -982,7 +1487,87 @@ static int dnet_cmd_bulk_read(struct dnet_net_state *st, struct dnet_cmd *cmd, v
 	}
 
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(st->n, &cmd->id);
+		dnet_cmd_oplock(st->n, cmd);
+	}
+
+	return err;
+}
+
+/*
+ * Batch envelope: cmd->size bytes of (struct dnet_cmd, data) pairs in wire
+ * order. Mirrors dnet_cmd_bulk_read(): every sub-command runs through
+ * dnet_process_cmd_raw() in recursive mode, so its replies and ack are sent
+ * within the envelope transaction with DNET_FLAGS_MORE raised, and the
+ * envelope ack - carrying the first error if nothing succeeded - completes
+ * the exchange. One network round trip and one client transaction instead
+ * of one per operation.
+ */
+static int dnet_cmd_batch(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
+{
+	int err = -1, ret;
+	uint64_t size = cmd->size;
+	void *ptr = data;
+	struct dnet_cmd sub_cmd;
+	int count = 0;
+
+	cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+
+	/*
+	 * we have to drop io lock, otherwise it will be grabbed again in dnet_process_cmd_raw()
+	 * being recursively called - every sub-command locks its own id
+	 */
+	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
+		dnet_opunlock(st->n, &cmd->id);
+	}
+
+	while (size) {
+		if (size < sizeof(struct dnet_cmd)) {
+			err = -EINVAL;
+			break;
+		}
+
+		sub_cmd = *(struct dnet_cmd *)ptr;
+		dnet_convert_cmd(&sub_cmd);
+
+		if (sub_cmd.size > size - sizeof(struct dnet_cmd)) {
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: BATCH: invalid sub-command size: %llu, rest: %llu\n",
+					dnet_dump_id(&cmd->id), (unsigned long long)sub_cmd.size,
+					(unsigned long long)(size - sizeof(struct dnet_cmd)));
+			err = -EINVAL;
+			break;
+		}
+
+		/* no nested envelopes */
+		if (sub_cmd.cmd == DNET_CMD_BATCH) {
+			err = -EINVAL;
+			break;
+		}
+
+		sub_cmd.trans = cmd->trans;
+		sub_cmd.flags |= DNET_FLAGS_MORE;
+
+		ret = dnet_process_cmd_raw(st, &sub_cmd, (char *)ptr + sizeof(struct dnet_cmd), 1);
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: processing BATCH.%s for %d command, err: %d\n",
+				dnet_dump_id(&cmd->id), dnet_cmd_string(sub_cmd.cmd), count, ret);
+
+		if (!ret)
+			err = 0;
+		else if (err == -1)
+			err = ret;
+
+		ptr = (char *)ptr + sizeof(struct dnet_cmd) + sub_cmd.size;
+		size -= sizeof(struct dnet_cmd) + sub_cmd.size;
+		count++;
+	}
+
+	/* empty envelope */
+	if (err == -1)
+		err = -EINVAL;
+
+	cmd->flags |= DNET_FLAGS_NEED_ACK;
+
+	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
+		dnet_cmd_oplock(st->n, cmd);
 	}
 
 	return err;
@@ -1034,177 +1619,401 @@ int dnet_cas_local(struct dnet_node *n, struct dnet_id *id, void *remote_csum, i
 	return err;
 }
 
-int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int recursive)
+/*
+ * Accounts finished command into the per-command-type latency histogram
+ * and, when sampling is enabled, into the slow command ring. Only atomic
+ * increments are used, so worker threads never serialize here.
+ */
+static void dnet_cmd_stat_update(struct dnet_node *n, struct dnet_cmd *cmd, int cache, long diff)
 {
-	int err = 0;
-	unsigned long long size = cmd->size;
-	struct dnet_node *n = st->n;
-	unsigned long long tid = cmd->trans & ~DNET_TRANS_REPLY;
-	struct dnet_io_attr *io;
-#if 0
-	struct dnet_indexes_request *indexes_request;
-#endif
-	struct timeval start, end;
-	char time_str[64];
-	struct tm io_tm;
-	struct timeval io_tv;
-	long diff;
+	struct dnet_cmd_histogram *h;
+	uint64_t usecs = (diff > 0) ? diff : 0;
+	unsigned int c = cmd->cmd;
+	int bucket = 0;
 
-	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(n, &cmd->id);
+	if (c >= __DNET_CMD_MAX)
+		c = DNET_CMD_UNKNOWN;
+
+	while ((usecs > 1) && (bucket < DNET_HISTOGRAM_BUCKETS - 1)) {
+		usecs >>= 1;
+		bucket++;
 	}
 
-	gettimeofday(&start, NULL);
+	h = &n->cmd_histograms[c];
+	if (cache)
+		(void) __sync_add_and_fetch(&h->cache[bucket], 1);
+	else
+		(void) __sync_add_and_fetch(&h->disk[bucket], 1);
 
-	switch (cmd->cmd) {
-		case DNET_CMD_AUTH:
-			err = dnet_cmd_auth(st, cmd, data);
-			break;
-		case DNET_CMD_STATUS:
-			err = dnet_cmd_status(st, cmd, data);
-			break;
-		case DNET_CMD_REVERSE_LOOKUP:
-			err = dnet_cmd_reverse_lookup(st, cmd, data);
-			break;
-		case DNET_CMD_JOIN:
-			err = dnet_cmd_join_client(st, cmd, data);
-			break;
-		case DNET_CMD_ROUTE_LIST:
-			err = dnet_cmd_route_list(st, cmd);
-			break;
-		case DNET_CMD_EXEC:
-			err = dnet_cmd_exec(st, cmd, data);
-			break;
-		case DNET_CMD_ITERATOR:
-			err = dnet_cmd_iterator(st, cmd, data);
-			break;
-		case DNET_CMD_INDEXES_UPDATE:
-		case DNET_CMD_INDEXES_INTERNAL:
-		case DNET_CMD_INDEXES_FIND:
-#if 0 // We don't wont to specially process this commands yet
-			indexes_request = (struct dnet_indexes_request*)data;
-			if (!(indexes_request->flags & DNET_IO_FLAGS_NOCACHE)) {
-				err = dnet_cmd_cache_indexes(st, cmd, indexes_request);
-
-				if (err != -ENOTSUP)
-					return err;
-			}
-#endif
+	if (n->slow_cmd_threshold && (diff >= n->slow_cmd_threshold)) {
+		uint32_t pos = __sync_fetch_and_add(&n->slow_cmd_pos, 1) % DNET_SLOW_CMD_NUM;
+		struct dnet_slow_cmd *s = &n->slow_cmds[pos];
 
-			err = dnet_process_indexes(st, cmd, data);
-			break;
-		case DNET_CMD_STAT_COUNT:
-			err = dnet_cmd_stat_count(st, cmd, data);
-			break;
-		case DNET_CMD_NOTIFY:
-			if (!(cmd->flags & DNET_ATTR_DROP_NOTIFICATION)) {
-				err = dnet_notify_add(st, cmd);
-				/*
-				 * We drop 'need ack' flag, since notification
-				 * transaction is a long-living one, since
-				 * every notification will be sent as transaction
-				 * completion.
-				 *
-				 * Transaction acknowledge will be sent when
-				 * notification is removed.
-				 */
-				if (!err)
-					cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-			} else
-				err = dnet_notify_remove(st, cmd);
-			break;
-		case DNET_CMD_BULK_READ:
-			err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
+		s->cmd = *cmd;
+		s->duration = diff;
+		dnet_current_time(&s->time);
+	}
+}
 
-			if (err == -ENOTSUP) {
-				err = dnet_cmd_bulk_read(st, cmd, data);
-			}
-			break;
-		case DNET_CMD_READ:
-		case DNET_CMD_WRITE:
-		case DNET_CMD_DEL:
-			if (n->ro && ((cmd->cmd == DNET_CMD_DEL) || (cmd->cmd == DNET_CMD_WRITE))) {
-				err = -EROFS;
-				break;
-			}
+/*
+ * Backend leg shared by every command which is not fully served above the
+ * storage: LOOKUP consults the cache first, WRITE/READ acks are collapsed
+ * into the data reply unless the command is traced.
+ */
+static int dnet_cmd_backend(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache)
+{
+	struct dnet_node *n = st->n;
+	int err;
 
-			io = NULL;
-			if (size < sizeof(struct dnet_io_attr)) {
-				dnet_log(st->n, DNET_LOG_ERROR, "%s: invalid size: cmd: %u, rest_size: %llu\n",
-					dnet_dump_id(&cmd->id), cmd->cmd, size);
-				err = -EINVAL;
-				break;
-			}
-			io = data;
-			dnet_convert_io_attr(io);
-
-			io_tv.tv_sec = io->timestamp.tsec;
-			io_tv.tv_usec = io->timestamp.tnsec / 1000;
-
-			if (cmd->cmd == DNET_CMD_READ) {
-				dnet_log(n, DNET_LOG_INFO, "%s: %s io command, offset: %llu, size: %llu, ioflags: 0x%x, cflags: 0x%llx, "
-						"node-flags: 0x%x\n",
-						dnet_dump_id_str(io->id), dnet_cmd_string(cmd->cmd),
-						(unsigned long long)io->offset, (unsigned long long)io->size,
-						io->flags, (unsigned long long)cmd->flags,
-						n->flags);
-			} else {
-				localtime_r((time_t *)&io_tv.tv_sec, &io_tm);
-				strftime(time_str, sizeof(time_str), "%F %R:%S", &io_tm);
-
-				dnet_log(n, DNET_LOG_INFO, "%s: %s io command, offset: %llu, size: %llu, ioflags: 0x%x, cflags: 0x%llx, "
-						"node-flags: 0x%x, ts: %ld.%06ld '%s'\n",
-						dnet_dump_id_str(io->id), dnet_cmd_string(cmd->cmd),
-						(unsigned long long)io->offset, (unsigned long long)io->size,
-						io->flags, (unsigned long long)cmd->flags,
-						n->flags, io_tv.tv_sec, io_tv.tv_usec, time_str);
-			}
+	if (cmd->cmd == DNET_CMD_LOOKUP && !(cmd->flags & DNET_FLAGS_NOCACHE)) {
+		err = dnet_cmd_cache_lookup(st, cmd);
 
-			if (n->flags & DNET_CFG_NO_CSUM)
-				io->flags |= DNET_IO_FLAGS_NOCSUM;
+		if (err != -ENOTSUP) {
+			*cache = 1;
+			return err;
+		}
+	}
 
-			if (!(io->flags & DNET_IO_FLAGS_NOCACHE)) {
-				err = dnet_cmd_cache_io(st, cmd, io, data + sizeof(struct dnet_io_attr));
+	/* Remove DNET_FLAGS_NEED_ACK flags for WRITE command
+	   to eliminate double reply packets
+	   (the first one with dnet_file_info structure,
+	   the second to destroy transaction on client side).
+	   Traced commands keep the ack - it carries the trace
+	   annex with per-hop span timestamps. */
+	if (((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_READ)) &&
+			!(cmd->flags & DNET_FLAGS_TRACE)) {
+		cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+	}
+	err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
 
-				if (err != -ENOTSUP)
-					break;
-			}
+	/* If there was error in WRITE command - send empty reply
+	   to notify client with error code and destroy transaction */
+	if (err && ((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_READ))) {
+		cmd->flags |= DNET_FLAGS_NEED_ACK;
+	}
 
-			if ((io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) && (cmd->cmd == DNET_CMD_WRITE)) {
-				err = dnet_cas_local(n, &cmd->id, io->parent, DNET_ID_SIZE);
+	if (!err && (cmd->cmd == DNET_CMD_WRITE)) {
+		dnet_update_notify(st, cmd, data);
+	}
 
-				if (err != 0 && err != -ENOENT)
-					break;
-			}
+	return err;
+}
 
-			dnet_convert_io_attr(io);
-		default:
-			if (cmd->cmd == DNET_CMD_LOOKUP && !(cmd->flags & DNET_FLAGS_NOCACHE)) {
-				err = dnet_cmd_cache_lookup(st, cmd);
+/* READ/WRITE/DEL preamble: attribute parsing, cache leg, CAS check */
+static int dnet_cmd_io(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_io_attr *io;
+	struct timeval io_tv;
+	struct tm io_tm;
+	char time_str[64];
+	int err;
 
-				if (err != -ENOTSUP)
-					break;
-			}
+	if (n->ro && ((cmd->cmd == DNET_CMD_DEL) || (cmd->cmd == DNET_CMD_WRITE)))
+		return -EROFS;
 
-			/* Remove DNET_FLAGS_NEED_ACK flags for WRITE command
-			   to eliminate double reply packets
-			   (the first one with dnet_file_info structure,
-			   the second to destroy transaction on client side) */
-			if ((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_READ)) {
-				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-			}
-			err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
+	if (cmd->size < sizeof(struct dnet_io_attr)) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: invalid size: cmd: %u, rest_size: %llu\n",
+			dnet_dump_id(&cmd->id), cmd->cmd, (unsigned long long)cmd->size);
+		return -EINVAL;
+	}
 
-			/* If there was error in WRITE command - send empty reply
-			   to notify client with error code and destroy transaction */
-			if (err && ((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_READ))) {
-				cmd->flags |= DNET_FLAGS_NEED_ACK;
-			}
+	io = data;
+	dnet_convert_io_attr(io);
 
-			if (!err && (cmd->cmd == DNET_CMD_WRITE)) {
-				dnet_update_notify(st, cmd, data);
-			}
-			break;
+	io_tv.tv_sec = io->timestamp.tsec;
+	io_tv.tv_usec = io->timestamp.tnsec / 1000;
+
+	if (cmd->cmd == DNET_CMD_READ) {
+		dnet_log(n, DNET_LOG_INFO, "%s: %s io command, offset: %llu, size: %llu, ioflags: 0x%x, cflags: 0x%llx, "
+				"node-flags: 0x%x\n",
+				dnet_dump_id_str(io->id), dnet_cmd_string(cmd->cmd),
+				(unsigned long long)io->offset, (unsigned long long)io->size,
+				io->flags, (unsigned long long)cmd->flags,
+				n->flags);
+	} else {
+		localtime_r((time_t *)&io_tv.tv_sec, &io_tm);
+		strftime(time_str, sizeof(time_str), "%F %R:%S", &io_tm);
+
+		dnet_log(n, DNET_LOG_INFO, "%s: %s io command, offset: %llu, size: %llu, ioflags: 0x%x, cflags: 0x%llx, "
+				"node-flags: 0x%x, ts: %ld.%06ld '%s'\n",
+				dnet_dump_id_str(io->id), dnet_cmd_string(cmd->cmd),
+				(unsigned long long)io->offset, (unsigned long long)io->size,
+				io->flags, (unsigned long long)cmd->flags,
+				n->flags, io_tv.tv_sec, io_tv.tv_usec, time_str);
+	}
+
+	if (n->flags & DNET_CFG_NO_CSUM)
+		io->flags |= DNET_IO_FLAGS_NOCSUM;
+
+	if (!(io->flags & DNET_IO_FLAGS_NOCACHE)) {
+		err = dnet_cmd_cache_io(st, cmd, io, data + sizeof(struct dnet_io_attr));
+
+		if (err != -ENOTSUP) {
+			*cache = 1;
+			return err;
+		}
+	}
+
+	if ((io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) && (cmd->cmd == DNET_CMD_WRITE)) {
+		err = dnet_cas_local(n, &cmd->id, io->parent, DNET_ID_SIZE);
+
+		if (err != 0 && err != -ENOENT)
+			return err;
+	}
+
+	dnet_convert_io_attr(io);
+
+	return dnet_cmd_backend(st, cmd, data, cache);
+}
+
+static int dnet_cmd_notify_toggle(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data __unused, int *cache __unused)
+{
+	int err;
+
+	if (!(cmd->flags & DNET_ATTR_DROP_NOTIFICATION)) {
+		err = dnet_notify_add(st, cmd);
+		/*
+		 * We drop 'need ack' flag, since notification
+		 * transaction is a long-living one, since
+		 * every notification will be sent as transaction
+		 * completion.
+		 *
+		 * Transaction acknowledge will be sent when
+		 * notification is removed.
+		 */
+		if (!err)
+			cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+	} else
+		err = dnet_notify_remove(st, cmd);
+
+	return err;
+}
+
+static int dnet_cmd_bulk_read_route(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
+{
+	struct dnet_node *n = st->n;
+	int err;
+
+	err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
+
+	if (err == -ENOTSUP) {
+		err = dnet_cmd_bulk_read(st, cmd, data);
+	}
+
+	return err;
+}
+
+/*
+ * Removes every key of the request and replies with one packed array of
+ * per-key statuses instead of per-key acks. Each key goes through
+ * dnet_process_cmd_raw() as a plain DNET_CMD_DEL, so the cache and oplock
+ * layers see ordinary removals.
+ */
+static int dnet_cmd_bulk_del(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_io_attr *io = data;
+	struct dnet_io_attr *ios = io + 1;
+	struct dnet_bulk_del_entry *entries;
+	struct dnet_cmd del_cmd;
+	uint64_t count, i;
+	int err = -1, ret;
+
+	if (cmd->size < sizeof(struct dnet_io_attr))
+		return -EINVAL;
+
+	dnet_convert_io_attr(io);
+	count = io->size / sizeof(struct dnet_io_attr);
+
+	if (!count || (cmd->size < (count + 1) * sizeof(struct dnet_io_attr)))
+		return -EINVAL;
+
+	entries = malloc(count * sizeof(struct dnet_bulk_del_entry));
+	if (!entries)
+		return -ENOMEM;
+
+	/*
+	 * Drop the envelope oplock - every sub-command takes its own per-key
+	 * lock in dnet_process_cmd_raw(). Taken back after the loop, the
+	 * caller unlocks as usual.
+	 */
+	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
+		dnet_opunlock(st->n, &cmd->id);
+
+	dnet_log(st->n, DNET_LOG_NOTICE, "%s: starting BULK_DEL for %d keys\n",
+			dnet_dump_id(&cmd->id), (int)count);
+
+	for (i = 0; i < count; ++i) {
+		del_cmd = *cmd;
+		memcpy(del_cmd.id.id, ios[i].id, DNET_ID_SIZE);
+		del_cmd.cmd = DNET_CMD_DEL;
+		del_cmd.size = sizeof(struct dnet_io_attr);
+		/* statuses are collected into the packed reply instead */
+		del_cmd.flags &= ~DNET_FLAGS_NEED_ACK;
+
+		ret = dnet_process_cmd_raw(st, &del_cmd, &ios[i], 1);
+
+		memcpy(entries[i].id, ios[i].id, DNET_ID_SIZE);
+		entries[i].status = ret;
+		memset(entries[i].reserved, 0, sizeof(entries[i].reserved));
+		dnet_convert_bulk_del_entry(&entries[i]);
+
+		if (!ret)
+			err = 0;
+		else if (err == -1)
+			err = ret;
+	}
+
+	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
+		dnet_cmd_oplock(st->n, cmd);
+
+	ret = dnet_send_reply(st, cmd, entries, count * sizeof(struct dnet_bulk_del_entry), 1);
+	free(entries);
+	if (ret)
+		err = ret;
+
+	return err;
+}
+
+static int dnet_cmd_bulk_del_route(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
+{
+	struct dnet_node *n = st->n;
+	int err = -ENOTSUP;
+
+	/*
+	 * The backend's native batch path bypasses the cache layer, so it is
+	 * only taken when there is no cache to get out of sync with.
+	 */
+	if (!n->cache)
+		err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
+
+	if (err == -ENOTSUP)
+		err = dnet_cmd_bulk_del(st, cmd, data);
+
+	return err;
+}
+
+static int dnet_cmd_indexes(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
+{
+	return dnet_process_indexes(st, cmd, data);
+}
+
+static int dnet_cmd_range_diff_wrap(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache __unused)
+{
+	return dnet_cmd_range_diff(st, cmd, data);
+}
+
+/*
+ * Per-command dispatch descriptors: the flags declare what the processing
+ * preamble must set up, so control commands skip the key oplock and the
+ * write-invalidation machinery entirely. Commands without a descriptor,
+ * including unknown ones, go to the backend with full key treatment.
+ */
+struct dnet_cmd_desc {
+	int		(* handler)(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int *cache);
+	unsigned int	flags;
+};
+
+/* command addresses a key and takes the striped oplock unless DNET_FLAGS_NOLOCK */
+#define DNET_CMD_DESC_OPLOCK		(1<<0)
+/* control command, routed to the nonblocking pool regardless of client flags */
+#define DNET_CMD_DESC_NONBLOCKING	(1<<1)
+/* modifies the key: drop checksum cache and cached index tables afterwards */
+#define DNET_CMD_DESC_INVALIDATE	(1<<2)
+
+static const struct dnet_cmd_desc dnet_cmd_dispatch[__DNET_CMD_MAX] = {
+	[DNET_CMD_LOOKUP]		= { dnet_cmd_backend, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_REVERSE_LOOKUP]	= { dnet_cmd_reverse_lookup, DNET_CMD_DESC_NONBLOCKING },
+	[DNET_CMD_JOIN]			= { dnet_cmd_join_client, DNET_CMD_DESC_NONBLOCKING },
+	[DNET_CMD_WRITE]		= { dnet_cmd_io, DNET_CMD_DESC_OPLOCK | DNET_CMD_DESC_INVALIDATE },
+	[DNET_CMD_READ]			= { dnet_cmd_io, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_EXEC]			= { dnet_cmd_exec, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_ROUTE_LIST]		= { dnet_cmd_route_list, DNET_CMD_DESC_NONBLOCKING },
+	[DNET_CMD_STAT]			= { dnet_cmd_backend, 0 },
+	[DNET_CMD_NOTIFY]		= { dnet_cmd_notify_toggle, 0 },
+	[DNET_CMD_DEL]			= { dnet_cmd_io, DNET_CMD_DESC_OPLOCK | DNET_CMD_DESC_INVALIDATE },
+	[DNET_CMD_STAT_COUNT]		= { dnet_cmd_stat_count, DNET_CMD_DESC_NONBLOCKING },
+	[DNET_CMD_STATUS]		= { dnet_cmd_status, DNET_CMD_DESC_NONBLOCKING },
+	[DNET_CMD_READ_RANGE]		= { dnet_cmd_backend, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_DEL_RANGE]		= { dnet_cmd_backend, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_AUTH]			= { dnet_cmd_auth, DNET_CMD_DESC_NONBLOCKING },
+	[DNET_CMD_BULK_READ]		= { dnet_cmd_bulk_read_route, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_BULK_DEL]		= { dnet_cmd_bulk_del_route, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_DEFRAG]		= { dnet_cmd_backend, 0 },
+	[DNET_CMD_ITERATOR]		= { dnet_cmd_iterator, 0 },
+	[DNET_CMD_INDEXES_UPDATE]	= { dnet_cmd_indexes, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_INDEXES_INTERNAL]	= { dnet_cmd_indexes, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_INDEXES_FIND]		= { dnet_cmd_indexes, DNET_CMD_DESC_OPLOCK },
+	[DNET_CMD_BATCH]		= { dnet_cmd_batch, 0 },
+	[DNET_CMD_RANGE_DIFF]		= { dnet_cmd_range_diff_wrap, 0 },
+};
+
+static const struct dnet_cmd_desc dnet_cmd_desc_default = { dnet_cmd_backend, DNET_CMD_DESC_OPLOCK };
+
+int dnet_cmd_nonblocking(int cmd)
+{
+	if (cmd <= 0 || cmd >= __DNET_CMD_MAX)
+		return 0;
+
+	return !!(dnet_cmd_dispatch[cmd].flags & DNET_CMD_DESC_NONBLOCKING);
+}
+
+/*
+ * Appends every capture_sample'th command header to the capture journal,
+ * see dnet_config::capture_journal. The record is written with a single
+ * write() to an O_APPEND descriptor, so records from concurrent IO threads
+ * do not interleave; a short or failed write just loses the sample.
+ */
+static void dnet_cmd_capture(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	struct dnet_capture_record rec;
+
+	if (atomic_inc(&n->capture_counter) % n->capture_sample)
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+
+	dnet_current_time(&rec.ts);
+	rec.id = cmd->id;
+	rec.flags = cmd->flags;
+	rec.size = cmd->size;
+	rec.cmd = cmd->cmd;
+
+	if (write(n->capture_fd, &rec, sizeof(rec)) != sizeof(rec)) {
+		/* sample dropped */
+	}
+}
+
+int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int recursive)
+{
+	int err = 0;
+	struct dnet_node *n = st->n;
+	unsigned long long tid = cmd->trans & ~DNET_TRANS_REPLY;
+	const struct dnet_cmd_desc *desc = &dnet_cmd_desc_default;
+	struct timeval start, end;
+	long diff;
+	int cache = 0;
+
+	if (cmd->cmd > 0 && cmd->cmd < __DNET_CMD_MAX && dnet_cmd_dispatch[cmd->cmd].handler)
+		desc = &dnet_cmd_dispatch[cmd->cmd];
+
+	if (n->capture_fd >= 0 && !recursive)
+		dnet_cmd_capture(n, cmd);
+
+	if ((desc->flags & DNET_CMD_DESC_OPLOCK) && !(cmd->flags & DNET_FLAGS_NOLOCK))
+		dnet_cmd_oplock(n, cmd);
+
+	gettimeofday(&start, NULL);
+
+	if (cmd->flags & DNET_FLAGS_TRACE)
+		trace_proc_time = start.tv_sec * 1000000ULL + start.tv_usec;
+
+	err = desc->handler(st, cmd, data, &cache);
+
+	/* drop caches which went stale when this command rewrote its object out of band */
+	if (desc->flags & DNET_CMD_DESC_INVALIDATE) {
+		dnet_csum_cache_remove(n, cmd->id.id);
+		dnet_indexes_invalidate(n, &cmd->id);
 	}
 
 	dnet_stat_inc(st->stat, cmd->cmd, err);
@@ -1216,13 +2025,14 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 	gettimeofday(&end, NULL);
 
 	diff = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	dnet_cmd_stat_update(n, cmd, cache, diff);
 	dnet_log(n, DNET_LOG_INFO, "%s: %s: trans: %llu, cflags: 0x%llx, time: %ld usecs, err: %d.\n",
 			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), tid,
 			(unsigned long long)cmd->flags, diff, err);
 
 	err = dnet_send_ack(st, cmd, err, recursive);
 
-	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
+	if ((desc->flags & DNET_CMD_DESC_OPLOCK) && !(cmd->flags & DNET_FLAGS_NOLOCK))
 		dnet_opunlock(n, &cmd->id);
 
 	return err;
@@ -1369,6 +2179,9 @@ err_out_exit:
 }
 */
 
+static int dnet_checksum_fd_cached(struct dnet_node *n, const unsigned char *id,
+		int fd, uint64_t offset, uint64_t size, void *csum, int csize);
+
 int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
 		int fd, uint64_t offset, int on_exit)
 {
@@ -1421,7 +2234,7 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 		if (data) {
 			err = dnet_checksum_data(n, data, rio->size, rio->parent, sizeof(rio->parent));
 		} else {
-			err = dnet_checksum_fd(n, fd, offset, rio->size, rio->parent, sizeof(rio->parent));
+			err = dnet_checksum_fd_cached(n, io->id, fd, offset, rio->size, rio->parent, sizeof(rio->parent));
 		}
 
 		if (err)
@@ -1456,6 +2269,60 @@ err_out_exit:
 	return err;
 }
 
+int dnet_send_read_data_iov(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		const struct iovec *iov, int iov_num, void (* iov_free)(void *iov_priv), void *iov_priv)
+{
+	struct dnet_net_state *st = state;
+	struct dnet_node *n = st->n;
+	struct {
+		struct dnet_cmd		cmd;
+		struct dnet_io_attr	io;
+	} __attribute__ ((packed)) h;
+	int err;
+
+	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING)
+		return 0;
+
+	memset(&h, 0, sizeof(h));
+
+	dnet_setup_id(&h.cmd.id, cmd->id.group_id, io->id);
+
+	h.cmd.flags = cmd->flags & ~(DNET_FLAGS_NEED_ACK);
+	if (cmd->flags & DNET_FLAGS_NEED_ACK)
+		h.cmd.flags |= DNET_FLAGS_MORE;
+
+	h.cmd.size = sizeof(struct dnet_io_attr) + io->size;
+	h.cmd.trans = cmd->trans | DNET_TRANS_REPLY;
+	h.cmd.cmd = DNET_CMD_READ;
+
+	memcpy(&h.io, io, sizeof(struct dnet_io_attr));
+
+	dnet_convert_cmd(&h.cmd);
+	dnet_convert_io_attr(&h.io);
+
+	if (io->flags & DNET_IO_FLAGS_CHECKSUM) {
+		/*
+		 * Checksum needs single linear buffer, multi-fragment replies
+		 * have to go through the copying path to get one.
+		 */
+		if (iov_num != 1)
+			return -ENOTSUP;
+
+		err = dnet_checksum_data(n, iov[0].iov_base, io->size, h.io.parent, sizeof(h.io.parent));
+		if (err)
+			return err;
+	}
+
+	err = dnet_send_data_iov(st, &h, sizeof(h), iov, iov_num, iov_free, iov_priv);
+
+	dnet_log_raw(n, DNET_LOG_INFO, "%s: %s: reply-iov: cflags: 0x%llx, ioflags: 0x%llx, offset: %llu, size: %llu, fragments: %d.\n",
+			dnet_dump_id(&cmd->id), dnet_cmd_string(DNET_CMD_READ),
+			(unsigned long long)cmd->flags, (unsigned long long)io->flags,
+			(unsigned long long)io->offset, (unsigned long long)io->size, iov_num);
+
+	return err;
+}
+
 static void dnet_fill_state_addr(void *state, struct dnet_addr *addr)
 {
 	struct dnet_net_state *st = state;
@@ -1536,7 +2403,8 @@ int dnet_send_file_info(void *state, struct dnet_cmd *cmd, int fd, uint64_t offs
 		info->offset = offset;
 
 	if (cmd->flags & DNET_FLAGS_CHECKSUM) {
-		err = dnet_checksum_fd(n, fd, info->offset, info->size, info->checksum, sizeof(info->checksum));
+		err = dnet_checksum_fd_cached(n, cmd->id.id, fd, info->offset, info->size,
+				info->checksum, sizeof(info->checksum));
 		if (err) {
 			dnet_log(n, DNET_LOG_ERROR, "%s: file-info: %s: checksum: %d: %s.\n",
 					dnet_dump_id(&cmd->id), file, err, strerror(-err));
@@ -1611,7 +2479,7 @@ int dnet_send_file_info_ts(void *state, struct dnet_cmd *cmd, int fd,
 	memcpy(info + 1, file, flen);
 
 	if (cmd->flags & DNET_FLAGS_CHECKSUM)
-		dnet_checksum_fd(st->n, fd, info->offset,
+		dnet_checksum_fd_cached(st->n, cmd->id.id, fd, info->offset,
 				info->size, info->checksum, sizeof(info->checksum));
 
 	dnet_convert_file_info(info);
@@ -1657,6 +2525,198 @@ int dnet_send_file_info_ts_without_fd(void *state, struct dnet_cmd *cmd, const v
 	return dnet_send_reply(state, cmd, a, a_size, 0);
 }
 
+/*
+ * Checksum cache.
+ *
+ * Checksummed lookups and reads recompute the object checksum from disk every
+ * time, which for large objects means a full read. Cache computed checksums
+ * keyed by id plus record position and revalidate every hit against
+ * mtime/size of the backing file, so a record appended or rewritten behind
+ * our back never serves a stale checksum. Explicit removal on WRITE/DEL
+ * commands covers updates within one mtime granule.
+ */
+
+#define DNET_CSUM_CACHE_BUCKET_MAX	64
+
+struct dnet_csum_cache_entry {
+	struct list_head	entry;
+
+	unsigned char		id[DNET_ID_SIZE];
+	uint64_t		offset, size;
+
+	/* mtime and size of the backing file when the checksum was computed */
+	uint64_t		mtime_sec, mtime_nsec;
+	uint64_t		file_size;
+
+	unsigned char		csum[DNET_ID_SIZE];
+};
+
+static unsigned int dnet_csum_cache_hash(const unsigned char *id)
+{
+	unsigned int hash = 0xbb40e64d; /* 3.141592653 */
+	unsigned int i;
+	const unsigned int *int_id = (const unsigned int *)id;
+
+	for (i = 0; i < DNET_ID_SIZE / 4; ++i)
+		hash ^= int_id[i];
+
+	return hash % DNET_CSUM_CACHE_SIZE;
+}
+
+int dnet_csum_cache_init(struct dnet_node *n)
+{
+	struct dnet_csum_cache_bucket *b;
+	int i;
+
+	n->csum_cache = malloc(sizeof(struct dnet_csum_cache_bucket) * DNET_CSUM_CACHE_SIZE);
+	if (!n->csum_cache)
+		return -ENOMEM;
+
+	for (i = 0; i < DNET_CSUM_CACHE_SIZE; ++i) {
+		b = &n->csum_cache[i];
+
+		INIT_LIST_HEAD(&b->entry_list);
+		pthread_mutex_init(&b->lock, NULL);
+		b->num = 0;
+	}
+
+	return 0;
+}
+
+void dnet_csum_cache_exit(struct dnet_node *n)
+{
+	struct dnet_csum_cache_bucket *b;
+	struct dnet_csum_cache_entry *e, *tmp;
+	int i;
+
+	if (!n->csum_cache)
+		return;
+
+	for (i = 0; i < DNET_CSUM_CACHE_SIZE; ++i) {
+		b = &n->csum_cache[i];
+
+		list_for_each_entry_safe(e, tmp, &b->entry_list, entry) {
+			list_del(&e->entry);
+			free(e);
+		}
+
+		pthread_mutex_destroy(&b->lock);
+	}
+
+	free(n->csum_cache);
+	n->csum_cache = NULL;
+}
+
+void dnet_csum_cache_remove(struct dnet_node *n, const unsigned char *id)
+{
+	struct dnet_csum_cache_bucket *b;
+	struct dnet_csum_cache_entry *e, *tmp;
+
+	if (!n->csum_cache)
+		return;
+
+	b = &n->csum_cache[dnet_csum_cache_hash(id)];
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry_safe(e, tmp, &b->entry_list, entry) {
+		if (!memcmp(e->id, id, DNET_ID_SIZE)) {
+			list_del(&e->entry);
+			b->num--;
+			free(e);
+		}
+	}
+	pthread_mutex_unlock(&b->lock);
+}
+
+static int dnet_csum_cache_lookup(struct dnet_node *n, const unsigned char *id,
+		uint64_t offset, uint64_t size, const struct stat *st, void *csum, int csize)
+{
+	struct dnet_csum_cache_bucket *b;
+	struct dnet_csum_cache_entry *e;
+	int err = -ENOENT;
+
+	b = &n->csum_cache[dnet_csum_cache_hash(id)];
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(e, &b->entry_list, entry) {
+		if (memcmp(e->id, id, DNET_ID_SIZE) || (e->offset != offset) || (e->size != size))
+			continue;
+
+		if ((e->mtime_sec != (uint64_t)st->st_mtim.tv_sec) ||
+				(e->mtime_nsec != (uint64_t)st->st_mtim.tv_nsec) ||
+				(e->file_size != (uint64_t)st->st_size)) {
+			/* backing file has changed, entry is stale */
+			list_del(&e->entry);
+			b->num--;
+			free(e);
+			break;
+		}
+
+		memcpy(csum, e->csum, csize < DNET_ID_SIZE ? csize : DNET_ID_SIZE);
+		err = 0;
+		break;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	return err;
+}
+
+static void dnet_csum_cache_store(struct dnet_node *n, const unsigned char *id,
+		uint64_t offset, uint64_t size, const struct stat *st, const void *csum, int csize)
+{
+	struct dnet_csum_cache_bucket *b;
+	struct dnet_csum_cache_entry *e;
+
+	if (csize > DNET_ID_SIZE)
+		return;
+
+	e = malloc(sizeof(struct dnet_csum_cache_entry));
+	if (!e)
+		return;
+
+	memcpy(e->id, id, DNET_ID_SIZE);
+	e->offset = offset;
+	e->size = size;
+	e->mtime_sec = st->st_mtim.tv_sec;
+	e->mtime_nsec = st->st_mtim.tv_nsec;
+	e->file_size = st->st_size;
+
+	memset(e->csum, 0, DNET_ID_SIZE);
+	memcpy(e->csum, csum, csize);
+
+	b = &n->csum_cache[dnet_csum_cache_hash(id)];
+
+	pthread_mutex_lock(&b->lock);
+	list_add(&e->entry, &b->entry_list);
+	if (++b->num > DNET_CSUM_CACHE_BUCKET_MAX) {
+		e = list_entry(b->entry_list.prev, struct dnet_csum_cache_entry, entry);
+		list_del(&e->entry);
+		b->num--;
+		free(e);
+	}
+	pthread_mutex_unlock(&b->lock);
+}
+
+static int dnet_checksum_fd_cached(struct dnet_node *n, const unsigned char *id,
+		int fd, uint64_t offset, uint64_t size, void *csum, int csize)
+{
+	struct stat st;
+	int err;
+
+	if (!n->csum_cache || fstat(fd, &st))
+		return dnet_checksum_fd(n, fd, offset, size, csum, csize);
+
+	err = dnet_csum_cache_lookup(n, id, offset, size, &st, csum, csize);
+	if (!err)
+		return 0;
+
+	err = dnet_checksum_fd(n, fd, offset, size, csum, csize);
+	if (!err)
+		dnet_csum_cache_store(n, id, offset, size, &st, csum, csize);
+
+	return err;
+}
+
 int dnet_checksum_data(struct dnet_node *n, const void *data, uint64_t size, unsigned char *csum, int csize)
 {
 	return dnet_transform_node(n, data, size, csum, csize);
@@ -44,6 +44,25 @@ int dnet_transform_node(struct dnet_node *n, const void *src, uint64_t size, uns
 	return t->transform(t->priv, NULL, src, size, csum, (unsigned int *)&csize, 0);
 }
 
+int dnet_transform_node_batch(struct dnet_node *n, const void *const *srcs, const uint64_t *sizes,
+		unsigned char *const *csums, int csize, int num)
+{
+	struct dnet_transform *t = &n->transform;
+	unsigned int rs = csize;
+	int i, err;
+
+	if (t->transform_batch)
+		return t->transform_batch(t->priv, NULL, srcs, sizes, (void *const *)csums, &rs, 0, num);
+
+	for (i = 0; i < num; ++i) {
+		err = dnet_transform_node(n, srcs[i], sizes[i], csums[i], csize);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 int dnet_transform_raw(struct dnet_session *s, const void *src, uint64_t size, char *csum, unsigned int csize)
 {
 	struct dnet_node *n = s->node;
@@ -57,6 +76,26 @@ int dnet_transform(struct dnet_session *s, const void *src, uint64_t size, struc
 	return dnet_transform_raw(s, src, size, (char *)id->id, sizeof(id->id));
 }
 
+int dnet_transform_raw_batch(struct dnet_session *s, const void *const *srcs, const uint64_t *sizes,
+		char *const *csums, unsigned int csize, int num)
+{
+	struct dnet_node *n = s->node;
+	struct dnet_transform *t = &n->transform;
+	unsigned int rs = csize;
+	int i, err;
+
+	if (t->transform_batch)
+		return t->transform_batch(t->priv, s, srcs, sizes, (void *const *)csums, &rs, 0, num);
+
+	for (i = 0; i < num; ++i) {
+		err = dnet_transform_raw(s, srcs[i], sizes[i], csums[i], csize);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 static void dnet_indexes_transform_id(struct dnet_node *node, const uint8_t *src, uint8_t *id,
 				      const char *suffix, int suffix_len)
 {
@@ -85,33 +124,86 @@ void dnet_indexes_transform_object_id(struct dnet_node *node, const struct dnet_
       (((x) & 0x0000ff00) <<  8) | (((x) & 0x000000ff) << 24))
 #endif
 
-void dnet_indexes_transform_index_id(struct dnet_node *node, const struct dnet_raw_id *src, struct dnet_raw_id *id, int shard_id)
+static void dnet_indexes_apply_shard(struct dnet_raw_id *id, int shard_id, int shard_count)
+{
+	unsigned shard_int = (1ull << 32) * shard_id / shard_count;
+
+	memset(id->id, 0, DNET_ID_SIZE / 2);
+
+	// Convert to Big-Endian to set less-significant bytes to the begin
+	*(unsigned *)id->id = dnet_swap32_to_be(shard_int);
+}
+
+void dnet_indexes_transform_index_id_raw(struct dnet_node *node, const struct dnet_raw_id *src,
+		struct dnet_raw_id *id, int shard_id, int shard_count)
 {
 	char suffix[] = "\0index_table";
 
 	dnet_indexes_transform_id(node, src->id, id->id, suffix, sizeof(suffix));
 
-	memset(id->id, 0, DNET_ID_SIZE / 2);
+	dnet_indexes_apply_shard(id, shard_id, shard_count);
+}
 
-	unsigned shard_int = (1ull << 32) * shard_id / node->indexes_shard_count;
+void dnet_indexes_transform_index_id(struct dnet_node *node, const struct dnet_raw_id *src, struct dnet_raw_id *id, int shard_id)
+{
+	dnet_indexes_transform_index_id_raw(node, src, id, shard_id, node->indexes_shard_count);
+}
 
-	// Convert to Big-Endian to set less-significant bytes to the begin
-	*(unsigned *)id->id = dnet_swap32_to_be(shard_int);
+void dnet_indexes_transform_index_ids_raw(struct dnet_node *node, const struct dnet_raw_id *const *srcs,
+		struct dnet_raw_id *const *ids, int shard_id, int shard_count, int num)
+{
+	char suffix[] = "\0index_table";
+	enum { batch = 16 };
+	char buffer[batch][DNET_ID_SIZE + 32];
+	const void *srcp[batch];
+	uint64_t sizep[batch];
+	unsigned char *csump[batch];
+	int i, j, cnt;
+
+	for (i = 0; i < num; i += batch) {
+		cnt = num - i;
+		if (cnt > batch)
+			cnt = batch;
+
+		for (j = 0; j < cnt; ++j) {
+			memcpy(buffer[j], srcs[i + j]->id, DNET_ID_SIZE);
+			memcpy(buffer[j] + DNET_ID_SIZE, suffix, sizeof(suffix));
+
+			srcp[j] = buffer[j];
+			sizep[j] = DNET_ID_SIZE + sizeof(suffix);
+			csump[j] = ids[i + j]->id;
+		}
+
+		dnet_transform_node_batch(node, srcp, sizep, csump, DNET_ID_SIZE, cnt);
+	}
+
+	for (i = 0; i < num; ++i)
+		dnet_indexes_apply_shard(ids[i], shard_id, shard_count);
 }
 
-int dnet_indexes_get_shard_id(struct dnet_node *node, const struct dnet_raw_id *object_id)
+void dnet_indexes_transform_index_ids(struct dnet_node *node, const struct dnet_raw_id *const *srcs,
+		struct dnet_raw_id *const *ids, int shard_id, int num)
+{
+	dnet_indexes_transform_index_ids_raw(node, srcs, ids, shard_id, node->indexes_shard_count, num);
+}
+
+int dnet_indexes_get_shard_id_raw(const struct dnet_raw_id *object_id, int shard_count)
 {
-	int indexes_shard_count = node->indexes_shard_count;
 	int i;
 	int result = 0;
 
 	for (i = 0; i < DNET_ID_SIZE; ++i) {
-		result = (result * 256 + object_id->id[i]) % indexes_shard_count;
+		result = (result * 256 + object_id->id[i]) % shard_count;
 	}
 
 	return result;
 }
 
+int dnet_indexes_get_shard_id(struct dnet_node *node, const struct dnet_raw_id *object_id)
+{
+	return dnet_indexes_get_shard_id_raw(object_id, node->indexes_shard_count);
+}
+
 int dnet_node_get_indexes_shard_count(struct dnet_node *node)
 {
 	return node->indexes_shard_count;
@@ -140,6 +232,7 @@ static char *dnet_cmd_strings[] = {
 	[DNET_CMD_INDEXES_UPDATE] = "INDEXES_UPDATE",
 	[DNET_CMD_INDEXES_INTERNAL] = "INDEXES_INTERNAL",
 	[DNET_CMD_INDEXES_FIND] = "INDEXES_FIND",
+	[DNET_CMD_BATCH] = "BATCH",
 	[DNET_CMD_UNKNOWN] = "UNKNOWN",
 };
 
@@ -170,6 +263,12 @@ static char *dnet_counter_strings[] = {
 	[DNET_CNTR_DBR_ERROR] = "DNET_CNTR_DBR_ERROR",
 	[DNET_CNTR_DBW_SYSTEM] = "DNET_CNTR_DBW_SYSTEM",
 	[DNET_CNTR_DBW_ERROR] = "DNET_CNTR_DBW_ERROR",
+	[DNET_CNTR_CACHE_HIT] = "DNET_CNTR_CACHE_HIT",
+	[DNET_CNTR_CACHE_MISS] = "DNET_CNTR_CACHE_MISS",
+	[DNET_CNTR_CACHE_EVICT] = "DNET_CNTR_CACHE_EVICT",
+	[DNET_CNTR_CACHE_SYNC_QUEUE] = "DNET_CNTR_CACHE_SYNC_QUEUE",
+	[DNET_CNTR_CACHE_BYTES] = "DNET_CNTR_CACHE_BYTES",
+	[DNET_CNTR_CACHE_LOCK_WAIT] = "DNET_CNTR_CACHE_LOCK_WAIT",
 	[DNET_CNTR_UNKNOWN] = "UNKNOWN",
 };
 
@@ -235,13 +334,12 @@ err_out_exit:
 	return err;
 }
 
-static int dnet_add_received_state(struct dnet_net_state *connected_state,
+static int dnet_add_received_state(struct dnet_node *n, int idx,
 		struct dnet_addr_container *cnt,
 		int group_id, struct dnet_raw_id *ids, int id_num)
 {
-	struct dnet_node *n = connected_state->n;
 	int s, err = 0;
-	struct dnet_addr *addr = &cnt->addrs[connected_state->idx];
+	struct dnet_addr *addr = &cnt->addrs[idx];
 	struct dnet_net_state *nst;
 	struct dnet_id raw;
 	int join;
@@ -266,7 +364,7 @@ static int dnet_add_received_state(struct dnet_net_state *connected_state,
 	if (n->flags & DNET_CFG_JOIN_NETWORK)
 		join = DNET_JOIN;
 
-	nst = dnet_state_create(n, group_id, ids, id_num, addr,	s, &err, join, connected_state->idx, dnet_state_net_process);
+	nst = dnet_state_create(n, group_id, ids, id_num, addr,	s, &err, join, idx, 0, dnet_state_net_process);
 	if (!nst)
 		goto err_out_close;
 
@@ -274,6 +372,10 @@ static int dnet_add_received_state(struct dnet_net_state *connected_state,
 	if (err)
 		goto err_out_put;
 
+	/* extra connections are best effort - single connection still works */
+	if (n->connections_per_addr > 1)
+		dnet_state_open_connections(nst, n->connections_per_addr);
+
 	dnet_log(n, DNET_LOG_NOTICE, "%d: added received state %s.\n",
 			group_id, dnet_state_dump_addr(nst));
 
@@ -290,7 +392,94 @@ err_out_exit:
 	return err;
 }
 
-static int dnet_process_route_reply(struct dnet_net_state *st, struct dnet_addr_container *cnt, int group_id, int ids_num)
+/*
+ * Connecting to a peer costs two network round-trips (TCP handshake plus
+ * reverse lookup), so adding the peers from a route list reply one by one
+ * makes client bootstrap time scale with cluster size. Unknown peers are
+ * therefore connected from short-lived detached threads, bounded by
+ * @connect_threads - when the limit is hit the connect falls back to the
+ * old synchronous path instead of queueing.
+ */
+#define DNET_CONNECT_THREADS_MAX	64
+
+struct dnet_connect_state_args {
+	struct dnet_node		*n;
+	int				idx;
+	int				group_id;
+	int				id_num;
+	struct dnet_addr_container	*cnt;
+	struct dnet_raw_id		*ids;
+};
+
+static void *dnet_connect_state_proc(void *data)
+{
+	struct dnet_connect_state_args *args = data;
+	struct dnet_node *n = args->n;
+
+	dnet_set_name("connect");
+
+	if (!n->need_exit)
+		dnet_add_received_state(n, args->idx, args->cnt, args->group_id, args->ids, args->id_num);
+
+	free(args);
+	atomic_dec(&n->connect_threads);
+	return NULL;
+}
+
+static int dnet_add_received_state_async(struct dnet_net_state *connected_state,
+		struct dnet_addr_container *cnt,
+		int group_id, struct dnet_raw_id *ids, int id_num)
+{
+	struct dnet_node *n = connected_state->n;
+	struct dnet_connect_state_args *args;
+	struct dnet_net_state *nst;
+	size_t cnt_size = sizeof(struct dnet_addr_container) + cnt->addr_num * sizeof(struct dnet_addr);
+	pthread_t tid;
+	int err;
+
+	/*
+	 * Known peers are the common case for periodic route list refreshes -
+	 * refresh their addresses in place, do not spawn a thread for them.
+	 */
+	nst = dnet_state_search_by_addr(n, &cnt->addrs[connected_state->idx]);
+	if (nst) {
+		dnet_copy_addrs(nst, cnt->addrs, cnt->addr_num);
+		dnet_state_put(nst);
+		return -EEXIST;
+	}
+
+	if (atomic_inc(&n->connect_threads) > DNET_CONNECT_THREADS_MAX)
+		goto err_out_dec;
+
+	args = malloc(sizeof(struct dnet_connect_state_args) + cnt_size + id_num * sizeof(struct dnet_raw_id));
+	if (!args)
+		goto err_out_dec;
+
+	args->n = n;
+	args->idx = connected_state->idx;
+	args->group_id = group_id;
+	args->id_num = id_num;
+	args->cnt = (struct dnet_addr_container *)(args + 1);
+	args->ids = (struct dnet_raw_id *)((char *)args->cnt + cnt_size);
+
+	memcpy(args->cnt, cnt, cnt_size);
+	memcpy(args->ids, ids, id_num * sizeof(struct dnet_raw_id));
+
+	err = pthread_create(&tid, &n->attr, dnet_connect_state_proc, args);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "Failed to create connect thread: %s [%d]\n", strerror(err), err);
+		free(args);
+		goto err_out_dec;
+	}
+
+	return 0;
+
+err_out_dec:
+	atomic_dec(&n->connect_threads);
+	return dnet_add_received_state(n, connected_state->idx, cnt, group_id, ids, id_num);
+}
+
+int dnet_process_route_reply(struct dnet_net_state *st, struct dnet_addr_container *cnt, int group_id, int ids_num)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_raw_id *ids;
@@ -321,9 +510,12 @@ static int dnet_process_route_reply(struct dnet_net_state *st, struct dnet_addr_
 		char tmp[128];
 		dnet_log(n, DNET_LOG_NOTICE, "%s: route reply: %s, ids-num: %d\n",
 				server_addr, dnet_server_convert_dnet_addr_raw(&cnt->addrs[i], tmp, sizeof(tmp)), ids_num);
+
+		/* somebody still announces this peer - retry it without waiting out the backoff */
+		dnet_reconnect_hint(n, &cnt->addrs[i]);
 	}
 
-	err = dnet_add_received_state(st, cnt, group_id, ids, ids_num);
+	err = dnet_add_received_state_async(st, cnt, group_id, ids, ids_num);
 
 	dnet_log(n, DNET_LOG_NOTICE, "%s: route reply: recv-addr-num: %d, local-addr-num: %d, idx: %d, err: %d\n",
 			server_addr, cnt->addr_num, n->addr_num, st->idx, err);
@@ -355,6 +547,20 @@ static int dnet_recv_route_list_complete(struct dnet_net_state *st, struct dnet_
 	if (!cmd->size || err)
 		goto err_out_exit;
 
+	/* version record trailing the table - remember which version we now hold */
+	if (cmd->size == sizeof(struct dnet_route_version)) {
+		struct dnet_route_version *rv = (struct dnet_route_version *)(cmd + 1);
+
+		dnet_convert_route_version(rv);
+		st->route_version_seen = rv->version;
+
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: route table version: %llu\n",
+				dnet_state_dump_addr(st), (unsigned long long)rv->version);
+
+		err = 0;
+		goto err_out_exit;
+	}
+
 	size = cmd->size + sizeof(struct dnet_cmd);
 	if (size < (signed)sizeof(struct dnet_addr_cmd)) {
 		err = -EINVAL;
@@ -387,6 +593,7 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 	struct dnet_node *n = st->n;
 	struct dnet_trans *t;
 	struct dnet_cmd *cmd;
+	struct dnet_route_version *rv;
 	struct dnet_wait *w;
 	int err;
 
@@ -396,7 +603,7 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 		goto err_out_exit;
 	}
 
-	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd));
+	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + sizeof(struct dnet_route_version));
 	if (!t) {
 		err = -ENOMEM;
 		goto err_out_wait_put;
@@ -410,6 +617,12 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 	cmd->flags = DNET_FLAGS_NEED_ACK | DNET_FLAGS_DIRECT | DNET_FLAGS_NOLOCK;
 	cmd->status = 0;
 
+	/* the peer skips the transfer when our view of its table is current */
+	cmd->size = sizeof(struct dnet_route_version);
+	rv = (struct dnet_route_version *)(cmd + 1);
+	rv->version = st->route_version_seen;
+	dnet_convert_route_version(rv);
+
 	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
 
 	cmd->cmd = t->command = DNET_CMD_ROUTE_LIST;
@@ -425,7 +638,7 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 	memset(&req, 0, sizeof(req));
 	req.st = st;
 	req.header = cmd;
-	req.hsize = sizeof(struct dnet_cmd);
+	req.hsize = sizeof(struct dnet_cmd) + sizeof(struct dnet_route_version);
 
 	dnet_wait_get(w);
 	err = dnet_trans_send(t, &req);
@@ -456,6 +669,7 @@ static struct dnet_net_state *dnet_add_state_socket(struct dnet_node *n, struct
 	void *data;
 	int version[4] = {0, 0, 0, 0};
 	int indexes_shard_count = 0;
+	int caps = 0;
 
 	memset(buf, 0, sizeof(buf));
 
@@ -466,6 +680,7 @@ static struct dnet_net_state *dnet_add_state_socket(struct dnet_node *n, struct
 
 	dnet_version_encode(&cmd->id);
 	dnet_indexes_shard_count_encode(&cmd->id, n->indexes_shard_count);
+	dnet_capabilities_encode(&cmd->id, DNET_CAPABILITIES_SUPPORTED);
 	dnet_convert_cmd(cmd);
 
 	st = &dummy;
@@ -494,6 +709,8 @@ static struct dnet_net_state *dnet_add_state_socket(struct dnet_node *n, struct
 	dnet_convert_cmd(cmd);
 	dnet_version_decode(&cmd->id, version);
 	dnet_indexes_shard_count_decode(&cmd->id, &indexes_shard_count);
+	dnet_capabilities_decode(&cmd->id, &caps);
+	caps &= DNET_CAPABILITIES_SUPPORTED;
 
 	if (cmd->status != 0) {
 		err = cmd->status;
@@ -577,12 +794,21 @@ static struct dnet_net_state *dnet_add_state_socket(struct dnet_node *n, struct
 	for (i=0; i<num; ++i)
 		dnet_convert_raw_id(&ids[i]);
 
-	st = dnet_state_create(n, cmd->id.group_id, ids, num, addr, s, &err, join, idx, dnet_state_net_process);
+	if (caps & DNET_CAPABILITIES_COMPACT)
+		dnet_log(n, DNET_LOG_INFO, "%s: negotiated compact wire framing\n",
+				dnet_server_convert_dnet_addr(addr));
+
+	st = dnet_state_create(n, cmd->id.group_id, ids, num, addr, s, &err, join, idx, caps, dnet_state_net_process);
 	if (!st) {
 		/* socket is already closed */
 		s = -1;
 		goto err_out_free;
 	}
+
+	/* extra connections are best effort - single connection still works */
+	if (n->connections_per_addr > 1)
+		dnet_state_open_connections(st, n->connections_per_addr);
+
 	dnet_log(n, DNET_LOG_NOTICE, "%s: connected: id-num: %d, addr-num: %d, idx: %d.\n",
 			dnet_server_convert_dnet_addr(addr), num, cnt->addr_num, idx);
 	free(data);
@@ -634,7 +860,7 @@ err_out_reconnect:
 
 	if ((err == -EADDRINUSE) || (err == -ECONNREFUSED) || (err == -ECONNRESET) ||
 			(err == -EINPROGRESS) || (err == -EAGAIN))
-		dnet_add_reconnect_state(n, &addr, join);
+		dnet_add_reconnect_state(n, &addr, join, 0);
 	return err;
 }
 
@@ -756,6 +982,18 @@ static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dn
 		goto err_out_destroy;
 	}
 
+	/*
+	 * Fail fast when the target state's circuit breaker is open - the
+	 * completion fires immediately with an error and the multigroup
+	 * retry logic moves to the next group instead of queueing behind
+	 * a hung node.
+	 */
+	err = dnet_state_breaker_check(t->st);
+	if (err) {
+		t->cmd.status = err;
+		goto err_out_destroy;
+	}
+
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 
 	dnet_log(n, DNET_LOG_INFO, "%s: created trans: %llu, cmd: %s, cflags: 0x%llx, size: %llu, offset: %llu, "
@@ -1316,54 +1554,119 @@ err_out_exit:
 	return err;
 }
 
+static void dnet_reconnect_one(struct dnet_node *n, struct dnet_addr *addr, unsigned int __join_state, int interval)
+{
+	struct dnet_net_state *st;
+	int s, err, join;
+
+	s = dnet_socket_create_addr(n, addr, 0);
+	dnet_log(n, DNET_LOG_NOTICE, "Tried to create socket during reconnection to %s: %d\n",
+			dnet_server_convert_dnet_addr(addr), s);
+	if (s < 0) {
+		dnet_log(n, DNET_LOG_ERROR, "Failed to create socket during reconnection to %s: %d\n",
+				dnet_server_convert_dnet_addr(addr), s);
+		goto out_add;
+	}
+
+	join = DNET_WANT_RECONNECT;
+	if (__join_state == DNET_JOIN)
+		join = DNET_JOIN;
+
+	err = 0;
+	/* will close socket on error */
+	st = dnet_add_state_socket(n, addr, s, &err, join);
+	if (st) {
+		dnet_log(n, DNET_LOG_INFO, "Successfully reconnected to %s, possible error: %d\n",
+			dnet_server_convert_dnet_addr(addr), err);
+		return;
+	}
+
+	dnet_log(n, DNET_LOG_ERROR, "Failed to add state during reconnection to %s, can remove state from reconnection list due to error: %d\n",
+			dnet_server_convert_dnet_addr(addr), err);
+
+	if (err == -EEXIST || err == -EINVAL)
+		return;
+
+out_add:
+	dnet_add_reconnect_state(n, addr, __join_state, interval);
+}
+
+struct dnet_reconnect_args {
+	struct dnet_node	*n;
+	struct dnet_addr	addr;
+	unsigned int		__join_state;
+	int			interval;
+};
+
+static void *dnet_reconnect_proc(void *data)
+{
+	struct dnet_reconnect_args *args = data;
+	struct dnet_node *n = args->n;
+
+	dnet_set_name("reconnect");
+
+	if (!n->need_exit)
+		dnet_reconnect_one(n, &args->addr, args->__join_state, args->interval);
+
+	free(args);
+	atomic_dec(&n->connect_threads);
+	return NULL;
+}
+
 int dnet_try_reconnect(struct dnet_node *n)
 {
 	struct dnet_addr_storage *ast, *tmp;
-	struct dnet_net_state *st;
+	struct dnet_reconnect_args *args;
+	time_t now = time(NULL);
 	LIST_HEAD(list);
-	int s, err, join;
+	pthread_t tid;
+	int err, interval;
 
 	if (list_empty(&n->reconnect_list))
 		return 0;
 
+	/* only pick the addresses whose backoff interval has expired */
 	pthread_mutex_lock(&n->reconnect_lock);
 	list_for_each_entry_safe(ast, tmp, &n->reconnect_list, reconnect_entry) {
-		list_move(&ast->reconnect_entry, &list);
+		if (ast->reconnect_ts <= now)
+			list_move(&ast->reconnect_entry, &list);
 	}
 	pthread_mutex_unlock(&n->reconnect_lock);
 
+	/*
+	 * Reconnects go through the same bounded thread fan-out as the route
+	 * list fan-out, so one dead peer with a long connect timeout does not
+	 * delay reconnection to everybody behind it in the list.
+	 */
 	list_for_each_entry_safe(ast, tmp, &list, reconnect_entry) {
-		s = dnet_socket_create_addr(n, &ast->addr, 0);
-		dnet_log(n, DNET_LOG_NOTICE, "Tried to create socket during reconnection to %s: %d\n",
-				dnet_server_convert_dnet_addr(&ast->addr), s);
-		if (s < 0) {
-			dnet_log(n, DNET_LOG_ERROR, "Failed to create socket during reconnection to %s: %d\n",
-					dnet_server_convert_dnet_addr(&ast->addr), s);
-			goto out_add;
+		/* interval the next attempt backs off with if this one fails */
+		interval = ast->reconnect_time ? ast->reconnect_time * 2 : 1;
+		if (interval > ast->reconnect_time_max)
+			interval = ast->reconnect_time_max;
+
+		if (atomic_inc(&n->connect_threads) > DNET_CONNECT_THREADS_MAX)
+			goto out_sync;
+
+		args = malloc(sizeof(struct dnet_reconnect_args));
+		if (!args)
+			goto out_sync;
+
+		args->n = n;
+		args->addr = ast->addr;
+		args->__join_state = ast->__join_state;
+		args->interval = interval;
+
+		err = pthread_create(&tid, &n->attr, dnet_reconnect_proc, args);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "Failed to create reconnect thread: %s [%d]\n", strerror(err), err);
+			free(args);
+			goto out_sync;
 		}
+		goto out_remove;
 
-		join = DNET_WANT_RECONNECT;
-		if (ast->__join_state == DNET_JOIN)
-			join = DNET_JOIN;
-
-		err = 0;
-		st = dnet_add_state_socket(n, &ast->addr, s, &err, join);
-		if (st) {
-			dnet_log(n, DNET_LOG_INFO, "Successfully reconnected to %s, possible error: %d\n",
-				dnet_server_convert_dnet_addr(&ast->addr), err);
-			goto out_remove;
-		}
-
-		dnet_sock_close(s);
-
-		dnet_log(n, DNET_LOG_ERROR, "Failed to add state during reconnection to %s, can remove state from reconnection list due to error: %d\n",
-				dnet_server_convert_dnet_addr(&ast->addr), err);
-
-		if (err == -EEXIST || err == -EINVAL)
-			goto out_remove;
-
-out_add:
-		dnet_add_reconnect_state(n, &ast->addr, ast->__join_state);
+out_sync:
+		atomic_dec(&n->connect_threads);
+		dnet_reconnect_one(n, &ast->addr, ast->__join_state, interval);
 out_remove:
 		list_del(&ast->reconnect_entry);
 		free(ast);
@@ -1407,6 +1710,10 @@ int dnet_lookup_object(struct dnet_session *s, struct dnet_id *id,
 		goto err_out_destroy;
 	}
 
+	err = dnet_state_breaker_check(t->st);
+	if (err)
+		goto err_out_destroy;
+
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 	dnet_convert_cmd(cmd);
 
@@ -1485,6 +1792,14 @@ static int dnet_stat_complete(struct dnet_net_state *state, struct dnet_cmd *cmd
 				(unsigned long long)(st->frsize * st->blocks / 1024 / 1024),
 				(unsigned long long)(st->bavail * st->bsize / 1024 / 1024),
 				(unsigned long long)st->files, (unsigned long long)st->fsid);
+		dnet_log(state->n, DNET_LOG_DATA, "%s: %s: queues: "
+				"io: %llu (max: %llu), nonblocking: %llu (max: %llu), send: %llu.\n",
+				dnet_dump_id(&cmd->id), dnet_state_dump_addr(state),
+				(unsigned long long)st->io_queue_size,
+				(unsigned long long)st->io_queue_max,
+				(unsigned long long)st->io_nb_queue_size,
+				(unsigned long long)st->io_nb_queue_max,
+				(unsigned long long)st->send_queue_size);
 		err = 0;
 	} else if (cmd->size >= sizeof(struct dnet_addr_stat) && cmd->cmd == DNET_CMD_STAT_COUNT) {
 		struct dnet_addr_stat *as = (struct dnet_addr_stat *)(cmd + 1);
@@ -1514,6 +1829,143 @@ static int dnet_stat_complete(struct dnet_net_state *state, struct dnet_cmd *cmd
 	return err;
 }
 
+/*
+ * Placement poll: the reconnect thread periodically fires a fire-and-forget
+ * DNET_CMD_STAT at every connected state and the completion below folds the
+ * reply into the state, so dnet_mix_states() can weight write fan-out by
+ * how full and how busy the remote node actually is.
+ */
+#define DNET_PLACEMENT_QUEUE_SCALE	100.0
+#define DNET_PLACEMENT_DEADBAND		0.1f
+#define DNET_PLACEMENT_GAIN		4
+
+static int dnet_placement_stat_complete(struct dnet_net_state *state, struct dnet_cmd *cmd, void *priv)
+{
+	struct dnet_stat stat;
+	double avail_ratio, target;
+	float cur, diff;
+
+	(void) priv;
+
+	if (is_trans_destroyed(state, cmd))
+		return 0;
+
+	if (cmd->cmd != DNET_CMD_STAT || cmd->size != sizeof(struct dnet_stat))
+		return cmd->status;
+
+	memcpy(&stat, cmd + 1, sizeof(struct dnet_stat));
+	dnet_convert_stat(&stat);
+
+	state->fs_total = stat.frsize * stat.blocks;
+	state->fs_avail = stat.bavail * stat.bsize;
+	state->io_qdepth = stat.io_queue_size;
+
+	avail_ratio = 1.0;
+	if (state->fs_total)
+		avail_ratio = (double)state->fs_avail / (double)state->fs_total;
+
+	target = avail_ratio / (1.0 + (double)state->io_qdepth / DNET_PLACEMENT_QUEUE_SCALE);
+	if (target < 0.01)
+		target = 0.01;
+
+	/*
+	 * Deadband plus low-gain tracking: the factor only moves when the
+	 * fresh target escapes the ten percent band around the current value
+	 * and then only a quarter of the way toward it, so group selection
+	 * does not flap when consecutive samples disagree.
+	 */
+	cur = state->place_factor;
+	diff = (float)target - cur;
+	if (diff > cur * DNET_PLACEMENT_DEADBAND || diff < -cur * DNET_PLACEMENT_DEADBAND) {
+		state->place_factor = cur + diff / DNET_PLACEMENT_GAIN;
+
+		dnet_log(state->n, DNET_LOG_NOTICE, "%s: placement: avail: %llu/%llu, queue: %llu, factor: %f -> %f\n",
+				dnet_state_dump_addr(state),
+				(unsigned long long)state->fs_avail,
+				(unsigned long long)state->fs_total,
+				(unsigned long long)state->io_qdepth,
+				cur, state->place_factor);
+	}
+
+	return 0;
+}
+
+static int dnet_placement_stat_request(struct dnet_net_state *st)
+{
+	struct dnet_io_req req;
+	struct dnet_node *n = st->n;
+	struct dnet_trans *t;
+	struct dnet_cmd *cmd;
+	int err;
+
+	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd));
+	if (!t) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	t->complete = dnet_placement_stat_complete;
+	t->priv = NULL;
+
+	cmd = (struct dnet_cmd *)(t + 1);
+
+	cmd->flags = DNET_FLAGS_NEED_ACK | DNET_FLAGS_DIRECT | DNET_FLAGS_NOLOCK;
+	cmd->status = 0;
+	cmd->size = 0;
+
+	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
+
+	cmd->cmd = t->command = DNET_CMD_STAT;
+
+	t->st = dnet_state_get(st);
+	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
+
+	dnet_convert_cmd(cmd);
+
+	memset(&req, 0, sizeof(req));
+	req.st = st;
+	req.header = cmd;
+	req.hsize = sizeof(struct dnet_cmd);
+
+	err = dnet_trans_send(t, &req);
+	if (err)
+		goto err_out_destroy;
+
+	return 0;
+
+err_out_destroy:
+	dnet_trans_put(t);
+err_out_exit:
+	return err;
+}
+
+void dnet_placement_poll(struct dnet_node *n)
+{
+	struct dnet_net_state *states[128];
+	struct dnet_net_state *st;
+	struct dnet_group *g;
+	int num = 0, i;
+
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		list_for_each_entry(st, &g->state_list, state_entry) {
+			if (st == n->st)
+				continue;
+
+			if (num >= (int)ARRAY_SIZE(states))
+				break;
+
+			states[num++] = dnet_state_get(st);
+		}
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	for (i = 0; i < num; ++i) {
+		dnet_placement_stat_request(states[i]);
+		dnet_state_put(states[i]);
+	}
+}
+
 static int dnet_request_cmd_single(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl)
 {
 	if (st)
@@ -1797,6 +2249,110 @@ err_out_exit:
 	return err;
 }
 
+struct dnet_update_tune_priv {
+	struct dnet_wait *w;
+	struct dnet_node_status status;
+	struct dnet_node_tune tune;
+	atomic_t refcnt;
+};
+
+static int dnet_update_status_tune_complete(struct dnet_net_state *state, struct dnet_cmd *cmd, void *priv)
+{
+	struct dnet_update_tune_priv *p = priv;
+
+	if (is_trans_destroyed(state, cmd)) {
+		dnet_wakeup(p->w, p->w->cond++);
+		dnet_wait_put(p->w);
+		if (atomic_dec_and_test(&p->refcnt)) {
+			free(p);
+			return -ENOENT;
+		}
+	}
+
+	if (cmd->size == sizeof(struct dnet_node_status) + sizeof(struct dnet_node_tune)) {
+		memcpy(&p->status, cmd + 1, sizeof(struct dnet_node_status));
+		memcpy(&p->tune, (char *)(cmd + 1) + sizeof(struct dnet_node_status),
+				sizeof(struct dnet_node_tune));
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Same as dnet_update_status(), but also carries the runtime tuning
+ * extension: on return @status and @tune hold the node's current values.
+ */
+int dnet_update_status_tune(struct dnet_session *s, struct dnet_addr *addr, struct dnet_id *id,
+		struct dnet_node_status *status, struct dnet_node_tune *tune)
+{
+	char payload[sizeof(struct dnet_node_status) + sizeof(struct dnet_node_tune)];
+	struct dnet_update_tune_priv *priv;
+	struct dnet_trans_control ctl;
+	int err;
+
+	if (!id && !addr) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+
+	memset(&ctl, 0, sizeof(ctl));
+
+	if (id) {
+		memcpy(&ctl.id, id, sizeof(struct dnet_id));
+	} else {
+		struct dnet_net_state *st;
+
+		st = dnet_state_search_by_addr(s->node, addr);
+		if (!st) {
+			err = -ENXIO;
+			goto err_out_exit;
+		}
+
+		dnet_setup_id(&ctl.id, st->idc->group->group_id, st->idc->ids[0].raw.id);
+		dnet_state_put(st);
+	}
+
+	priv = malloc(sizeof(struct dnet_update_tune_priv));
+	if (!priv) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	priv->w = dnet_wait_alloc(0);
+	if (!priv->w) {
+		free(priv);
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+	atomic_init(&priv->refcnt, 2);
+
+	memcpy(payload, status, sizeof(struct dnet_node_status));
+	memcpy(payload + sizeof(struct dnet_node_status), tune, sizeof(struct dnet_node_tune));
+
+	ctl.complete = dnet_update_status_tune_complete;
+	ctl.priv = priv;
+	ctl.cmd = DNET_CMD_STATUS;
+	ctl.cflags = DNET_FLAGS_NEED_ACK;
+	ctl.size = sizeof(payload);
+	ctl.data = payload;
+
+	dnet_wait_get(priv->w);
+	dnet_request_cmd_single(s, NULL, &ctl);
+
+	err = dnet_wait_event(priv->w, priv->w->cond == 1, dnet_session_get_timeout(s));
+	dnet_wait_put(priv->w);
+	if (!err) {
+		memcpy(status, &priv->status, sizeof(struct dnet_node_status));
+		memcpy(tune, &priv->tune, sizeof(struct dnet_node_tune));
+	}
+	if (atomic_dec_and_test(&priv->refcnt))
+		free(priv);
+
+err_out_exit:
+	return err;
+}
+
 static int dnet_remove_object_raw(struct dnet_session *s, struct dnet_id *id,
 	int (* complete)(struct dnet_net_state *state,
 			struct dnet_cmd *cmd,
@@ -2067,7 +2623,30 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
 
 			st = dnet_state_get_first(n, id);
 			if (st) {
-				weights[num].weight = (int)st->weight;
+				double w;
+
+				if (st->rtt_smoothed) {
+					/*
+					 * EWMA latency with error-rate penalty reacts
+					 * to load shifts within tens of requests, while
+					 * multiplicative @weight needs hundreds - the
+					 * scale is "completions per second one
+					 * outstanding transaction would achieve".
+					 */
+					w = 1000000.0 / ((double)st->rtt_smoothed *
+							 (1.0 + 10.0 * st->error_rate));
+				} else {
+					w = st->weight;
+				}
+
+				/*
+				 * Placement factor folds in the remote free space
+				 * and queue depth from the periodic stat poll, so
+				 * the fullest group gradually stops winning the
+				 * weighted coin toss and writes drain toward
+				 * spare capacity.
+				 */
+				weights[num].weight = (int)(w * st->place_factor) + 1;
 				weights[num].group_id = id->group_id;
 
 				dnet_state_put(st);
@@ -2099,6 +2678,27 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp)
 	return group_num;
 }
 
+long dnet_get_read_latency_p99(struct dnet_session *s, struct dnet_id *id)
+{
+	struct dnet_net_state *st;
+	long p99 = 0;
+
+	st = dnet_state_get_first(s->node, id);
+	if (!st)
+		return 0;
+
+	/*
+	 * Smoothed latency plus three mean deviations - the same tail bound
+	 * TCP uses for its retransmission timer, cheap and good enough for
+	 * a hedging threshold.
+	 */
+	if (st->rtt_smoothed)
+		p99 = st->rtt_smoothed + 3 * st->rtt_variance;
+
+	dnet_state_put(st);
+	return p99;
+}
+
 static int dnet_data_map_ll(struct dnet_map_fd *map, int prot)
 {
 	uint64_t off;
@@ -2489,6 +3089,111 @@ err:
 	return err ? err : diff_offset;
 }
 
+/*!
+ * K-way merges \a num sorted containers: for every key the globally newest
+ * record (w.r.t. \fn dnet_iterator_response_cmp) wins and is appended to the
+ * output container with the same index as the input it came from, older
+ * duplicates from other inputs are dropped. Inputs are mmap()ed and never
+ * copied around in memory. Fills \a out_sizes with the resulting container
+ * sizes, returns negative error code on failure.
+ *
+ * Recovery uses this to split a set of per-node diffs into per-node fetch
+ * lists without pushing every record through the interpreter.
+ */
+int dnet_iterator_response_container_merge(int num,
+		int in_fds[], uint64_t in_sizes[],
+		int out_fds[], uint64_t out_sizes[])
+{
+	const ssize_t resp_size = sizeof(struct dnet_iterator_response);
+	struct dnet_map_fd *maps = NULL;
+	uint64_t *offsets = NULL;
+	int i, mapped = 0, err = 0;
+
+	/* Sanity */
+	if (num <= 0 || in_fds == NULL || in_sizes == NULL
+			|| out_fds == NULL || out_sizes == NULL)
+		return -EINVAL;
+	for (i = 0; i < num; ++i) {
+		if (in_fds[i] < 0 || out_fds[i] < 0)
+			return -EINVAL;
+		if (in_sizes[i] % resp_size != 0)
+			return -EINVAL;
+	}
+
+	maps = calloc(num, sizeof(struct dnet_map_fd));
+	offsets = calloc(num, sizeof(uint64_t));
+	if (maps == NULL || offsets == NULL) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < num; ++i) {
+		out_sizes[i] = 0;
+		maps[i].fd = in_fds[i];
+		maps[i].size = in_sizes[i];
+
+		/* empty containers have nothing to map */
+		if (maps[i].size == 0)
+			continue;
+
+		err = dnet_data_map(&maps[i]);
+		if (err != 0)
+			goto err_out_unmap;
+		mapped = i + 1;
+	}
+
+	while (1) {
+		const struct dnet_iterator_response *best_resp = NULL;
+		int best = -1;
+
+		/* inputs are sorted, so heads hold the newest record per key */
+		for (i = 0; i < num; ++i) {
+			const struct dnet_iterator_response *resp;
+
+			if (offsets[i] >= in_sizes[i])
+				continue;
+
+			resp = (struct dnet_iterator_response *)maps[i].data
+				+ offsets[i] / resp_size;
+			if (best == -1 || dnet_iterator_response_cmp(resp, best_resp) < 0) {
+				best = i;
+				best_resp = resp;
+			}
+		}
+		if (best == -1)
+			break;
+
+		err = dnet_iterator_response_container_append(best_resp,
+				out_fds[best], out_sizes[best]);
+		if (err != 0)
+			goto err_out_unmap;
+		out_sizes[best] += resp_size;
+
+		/* drop every record of that key, the winner included */
+		for (i = 0; i < num; ++i) {
+			const struct dnet_iterator_response *resp;
+
+			if (offsets[i] >= in_sizes[i])
+				continue;
+
+			resp = (struct dnet_iterator_response *)maps[i].data
+				+ offsets[i] / resp_size;
+			if (dnet_id_cmp_str(resp->key.id, best_resp->key.id) == 0)
+				dnet_iterator_response_skip_equal_keys(maps[i].data,
+						&offsets[i], in_sizes[i]);
+		}
+	}
+
+err_out_unmap:
+	for (i = 0; i < mapped; ++i)
+		if (maps[i].size != 0)
+			dnet_data_unmap(&maps[i]);
+err_out_free:
+	free(offsets);
+	free(maps);
+	return err;
+}
+
 int dnet_parse_numeric_id(const char *value, unsigned char *id)
 {
 	unsigned char ch[5];
@@ -2606,6 +3311,43 @@ int dnet_iterator_set_state(struct dnet_node *n,
 	return err;
 }
 
+/* Sets reply rate limits of iterator given it's id, zero means unlimited */
+int dnet_iterator_set_limits(struct dnet_node *n, uint64_t id,
+		uint64_t bytes_per_sec, uint64_t replies_per_sec)
+{
+	struct dnet_iterator *it;
+	int err = 0;
+
+	/* Sanity */
+	if (n == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&n->iterator_lock);
+
+	it = dnet_iterator_list_lookup_nolock(n, id);
+	if (it == NULL) {
+		err = -ENOENT;
+		goto err_out_unlock;
+	}
+
+	pthread_mutex_lock(&it->lock);
+
+	it->limit_bytes_per_sec = bytes_per_sec;
+	it->limit_replies_per_sec = replies_per_sec;
+
+	/* Restart the buckets and wake the iterator if it sleeps on the old limit */
+	it->tokens_bytes = bytes_per_sec;
+	it->tokens_replies = replies_per_sec;
+	dnet_current_time(&it->tokens_time);
+	pthread_cond_broadcast(&it->wait);
+
+	pthread_mutex_unlock(&it->lock);
+
+err_out_unlock:
+	pthread_mutex_unlock(&n->iterator_lock);
+	return err;
+}
+
 /* Allocate and init iterator */
 struct dnet_iterator *dnet_iterator_alloc(uint64_t id)
 {
@@ -2618,7 +3360,6 @@ struct dnet_iterator *dnet_iterator_alloc(uint64_t id)
 
 	it->id = id;
 	it->state = DNET_ITERATOR_ACTION_START;
-	INIT_LIST_HEAD(&it->list);
 	err = pthread_cond_init(&it->wait, NULL);
 	if (err != 0)
 		goto err_out_free;
@@ -2648,62 +3389,47 @@ void dnet_iterator_free(struct dnet_iterator *it)
 	free(it);
 }
 
-/* Adds iterator to the list of running iterators if it's not already there */
+/* Adds iterator to the registry of running iterators if it's not already there */
 int dnet_iterator_list_insert_nolock(struct dnet_node *n, struct dnet_iterator *it)
 {
 	/* Sanity */
 	if (n == NULL || it == NULL)
 		return -EINVAL;
 
-	/* Check that iterator not already in list */
+	/* Check that iterator not already in registry */
 	if (dnet_iterator_list_lookup_nolock(n, it->id) != NULL)
 		return -EEXIST;
 
-	/* Add to list */
-	list_add(&it->list, &n->iterator_list);
-
-	return 0;
+	return dnet_flat_hash_insert(&n->iterator_hash, it->id, it);
 }
 
-/* Looks up iterator in list by id */
+/* Looks up iterator in registry by id */
 struct dnet_iterator *dnet_iterator_list_lookup_nolock(struct dnet_node *n, uint64_t id)
 {
-	struct dnet_iterator *it;
+	unsigned int pos;
 
 	/* Sanity */
 	if (n == NULL)
 		return NULL;
 
-	/* Lookup iterator by id and return pointer */
-	list_for_each_entry(it, &n->iterator_list, list)
-		if (it->id == id)
-			return it;
-
-	return NULL;
+	/* ids are unique - the first hit is the iterator */
+	return dnet_flat_hash_find(&n->iterator_hash, id, &pos);
 }
 
-/* Removes iterator from list by id */
+/* Removes iterator from registry by id */
 int dnet_iterator_list_remove(struct dnet_node *n, uint64_t id)
 {
-	struct dnet_iterator *it;
+	int err;
 
 	/* Sanity */
 	if (n == NULL)
 		return -EINVAL;
 
 	pthread_mutex_lock(&n->iterator_lock);
-
-	/* Lookup iterator by id and remove */
-	it = dnet_iterator_list_lookup_nolock(n, id);
-	if (it != NULL) {
-		list_del_init(&it->list);
-		pthread_mutex_unlock(&n->iterator_lock);
-		return 0;
-	}
-
+	err = dnet_flat_hash_remove(&n->iterator_hash, id, NULL);
 	pthread_mutex_unlock(&n->iterator_lock);
 
-	return -ENOENT;
+	return err;
 }
 
 /* Find next free id */
@@ -2766,17 +3492,22 @@ void dnet_iterator_destroy(struct dnet_node *n, struct dnet_iterator *it)
 }
 
 /* Async cancel all iterators */
-void dnet_iterator_cancel_all(struct dnet_node *n)
+static void dnet_iterator_cancel_one(void *ptr, void *priv)
 {
-	struct dnet_iterator *it;
+	struct dnet_iterator *it = ptr;
+	struct dnet_node *n = priv;
+
+	dnet_iterator_set_state_nolock(n, DNET_ITERATOR_ACTION_CANCEL, it->id);
+}
 
+void dnet_iterator_cancel_all(struct dnet_node *n)
+{
 	/* Sanity */
 	if (n == NULL)
 		return;
 
 	pthread_mutex_lock(&n->iterator_lock);
-	list_for_each_entry(it, &n->iterator_list, list)
-		dnet_iterator_set_state_nolock(n, DNET_ITERATOR_ACTION_CANCEL, it->id);
+	dnet_flat_hash_for_each(&n->iterator_hash, dnet_iterator_cancel_one, n);
 	pthread_mutex_unlock(&n->iterator_lock);
 
 }
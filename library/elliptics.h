@@ -19,6 +19,7 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include <errno.h>
 #include <limits.h>
@@ -40,6 +41,7 @@ typedef unsigned short u_short;
 #include "list.h"
 
 #include "rbtree.h"
+#include "flathash.h"
 
 #include "atomic.h"
 #include "lock.h"
@@ -58,9 +60,15 @@ extern "C" {
 struct dnet_node;
 struct dnet_group;
 struct dnet_net_state;
+struct dnet_net_io;
 
 extern __thread uint32_t trace_id;
 
+/* span timestamps of the traced command executed by this IO thread */
+extern __thread uint64_t trace_queue_time;
+extern __thread uint64_t trace_dequeue_time;
+extern __thread uint64_t trace_proc_time;
+
 #define dnet_log(n, level, format, a...)							\
 	do {											\
 		if (n->log && ((n->log->log_level >= level) || (trace_id & DNET_TRACE_BIT)))	\
@@ -70,6 +78,8 @@ extern __thread uint32_t trace_id;
 
 struct dnet_io_req {
 	struct list_head	req_entry;
+	/* link in the state's lock-free send inbox, see dnet_net_state */
+	struct dnet_io_req	*inbox_next;
 
 	struct dnet_net_state	*st;
 
@@ -79,12 +89,36 @@ struct dnet_io_req {
 	void			*data;
 	size_t			dsize;
 
+	/*
+	 * Scatter-gather payload: fragments are sent after @data via writev()
+	 * and are never coalesced into single buffer. @isize is the sum of all
+	 * fragment sizes. @iov_free (if set) releases fragment owner when the
+	 * request has been fully sent or dropped.
+	 */
+	struct iovec		*iov;
+	int			iov_num;
+	size_t			isize;
+	void			(* iov_free)(void *iov_priv);
+	void			*iov_priv;
+
 	int			on_exit;
 	int			fd;
 	off_t			local_offset;
 	size_t			fsize;
+
+	/* allocation size class, set by dnet_io_req_alloc(), used on free */
+	int			alloc_class;
+
+	/* microsecond timestamp set when the request was put into the IO
+	 * processing queue, used to account queue wait time */
+	uint64_t		queue_time;
 };
 
+static inline size_t dnet_io_req_total_size(struct dnet_io_req *r)
+{
+	return r->hsize + r->dsize + r->isize + r->fsize;
+}
+
 /*
  * Currently executed network state machine:
  * receives and sends command and data.
@@ -96,6 +130,12 @@ struct dnet_io_req {
 /* Attached data should be discarded */
 #define DNET_IO_DROP		(1<<1)
 
+/* Reading a frame tag (compact framing negotiated on this connection) */
+#define DNET_IO_FRAME		(1<<2)
+
+/* Incoming command header is struct dnet_cmd_compact */
+#define DNET_IO_CMD_COMPACT	(1<<3)
+
 #define DNET_STATE_MAX_WEIGHT		(1024 * 10)
 
 /* Iterator watermarks for sending data and sleeping */
@@ -119,8 +159,24 @@ struct dnet_net_state
 
 	int			stall;
 
+	/*
+	 * Circuit breaker: trips after two consecutive stall-checker rounds
+	 * with timed out transactions, new transactions then fail instantly
+	 * with -ENXIO (dnet_state_breaker_check()) so the multigroup retry
+	 * logic fails over to the next group instead of queueing behind a
+	 * hung node. Once per second a single probe request is let through
+	 * half-open; its successful completion closes the breaker, further
+	 * timeouts keep it open. Unlocked like @stall and @weight - an
+	 * extra probe slipping through a race is harmless.
+	 */
+	int			breaker_open;
+	long			breaker_probe_ts;
+
 	int			__join_state;
 
+	/* route table version of this peer we saw last, see struct dnet_route_version */
+	uint64_t		route_version_seen;
+
 	/* all address of the given node */
 	int			addr_num;
 	struct dnet_addr	*addrs;
@@ -139,10 +195,52 @@ struct dnet_net_state
 	unsigned int		rcv_flags;
 	void			*rcv_data;
 
+	/*
+	 * Compact wire framing was negotiated during the reverse lookup
+	 * handshake: outgoing packets are tagged and replies use
+	 * struct dnet_cmd_compact, incoming packets start with a frame tag
+	 * read into @rcv_frame. Set once while the handshake is the only
+	 * traffic on the connection, never cleared.
+	 */
+	int			compact;
+	uint32_t		rcv_frame;
+
+	/*
+	 * LZ4 wire compression was negotiated during the reverse lookup
+	 * handshake: payloads above the size threshold are compressed on
+	 * send and packets marked DNET_FLAGS_LZ4 are expanded on receive.
+	 * Negotiated and set together with @compact.
+	 */
+	int			lz4;
+
 	int			epoll_fd;
+	/* network thread this state is assigned to, set together with epoll_fd */
+	struct dnet_net_io	*nio;
+	/*
+	 * io_uring engine bookkeeping, protected by ring submission lock:
+	 * want - schedule/unschedule state, inflight - poll request submitted.
+	 * Index 0 - recv, 1 - send.
+	 */
+	int			uring_want[2], uring_inflight[2];
+	/*
+	 * Lazily created pipe used by splice()-based zero-copy send path,
+	 * splice_pending is number of bytes spliced into the pipe from file,
+	 * but not yet pushed into the socket. Protected by send_lock.
+	 */
+	int			splice_pipe[2];
+	uint64_t		splice_pending;
 	size_t			send_offset;
 	pthread_mutex_t		send_lock;
+	/*
+	 * Private send queue of the network thread owning the state - no
+	 * locking, nobody else touches it. Workers enqueue into @send_inbox,
+	 * a lock-free MPSC stack drained into @send_list by the network
+	 * thread; @send_armed flags that EPOLLOUT is (being) armed, so only
+	 * the empty->non-empty transition pays the epoll_ctl() syscall.
+	 */
 	struct list_head	send_list;
+	struct dnet_io_req	*send_inbox;
+	int			send_armed;
 	/*
 	 * Condition variable to wait when send_queue_size reaches high
 	 * watermark
@@ -152,8 +250,17 @@ struct dnet_net_state
 	atomic_t		send_queue_size;
 
 	pthread_mutex_t		trans_lock;
-	struct rb_root		trans_root;
-	struct list_head	trans_list;
+	/* DNET_TRANS_HASH_SIZE bucket heads, protected by trans_lock */
+	struct list_head	*trans_hash;
+	/*
+	 * Timer wheel for transaction expiry: DNET_TRANS_WHEEL_SIZE one-second
+	 * slots, transaction is armed into slot (expiry & mask) and checked
+	 * only when the stall checker reaches that second - timeouts longer
+	 * than the wheel survive the scan and fire on a later wrap.
+	 * Protected by trans_lock, slots follow trans_hash in one allocation.
+	 */
+	struct list_head	*trans_wheel;
+	long			trans_wheel_tick;
 
 
 	int			la;
@@ -161,8 +268,45 @@ struct dnet_net_state
 	float			weight;
 	long			median_read_time;
 
+	/*
+	 * Placement view of the remote node, refreshed by the periodic stat
+	 * poll in the reconnect thread (dnet_placement_poll()): backend
+	 * free/total space and input io queue depth from the DNET_CMD_STAT
+	 * reply. @place_factor in (0, 1] scales this state's weight in
+	 * dnet_mix_states(), so writes drain toward nodes with spare
+	 * capacity and shallow queues; it tracks fresh samples with a
+	 * deadband and low gain to avoid flapping.
+	 */
+	uint64_t		fs_total;
+	uint64_t		fs_avail;
+	uint64_t		io_qdepth;
+	float			place_factor;
+
+	/*
+	 * EWMA view of READ/LOOKUP completions: TCP-style smoothed latency
+	 * and mean deviation in microseconds (gains 1/8 and 1/4) plus a
+	 * failure rate in [0, 1] (gain 1/16), all updated on transaction
+	 * destruction. Unlike multiplicative @weight above these converge
+	 * within tens of requests, so dnet_mix_states() prefers them for
+	 * replica selection once the first sample arrived.
+	 */
+	long			rtt_smoothed;
+	long			rtt_variance;
+	float			error_rate;
+
 	struct dnet_idc		*idc;
 
+	/*
+	 * Extra connections to the same remote node, opened for client states
+	 * when 'connections_per_addr' is above one. Transactions are spread
+	 * over them by dnet_state_select_connection(), each entry holds a
+	 * state reference. Filled once right after the state is created and
+	 * never changed, so lockless readers are safe.
+	 */
+	struct dnet_net_state	**siblings;
+	int			sibling_num;
+	atomic_t		sibling_seq;
+
 	struct dnet_stat_count	stat[__DNET_CMD_MAX];
 };
 
@@ -192,13 +336,24 @@ int dnet_state_micro_init(struct dnet_net_state *st, struct dnet_node *n, struct
 
 struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		int group_id, struct dnet_raw_id *ids, int id_num,
-		struct dnet_addr *addr, int s, int *errp, int join, int idx,
+		struct dnet_addr *addr, int s, int *errp, int join, int idx, int caps,
 		int (* process)(struct dnet_net_state *st, struct epoll_event *ev));
 
+int dnet_state_breaker_check(struct dnet_net_state *st);
+
 void dnet_state_reset(struct dnet_net_state *st, int error);
 void dnet_state_clean(struct dnet_net_state *st);
 void dnet_state_remove_nolock(struct dnet_net_state *st);
 
+/*
+ * Connection pool per remote address: opens @num - 1 extra connections to
+ * the peer of @st, selection picks the connection a request is sent over -
+ * small transactions are spread round-robin, large transfers prefer the
+ * last connection so they do not head-of-line block lookups.
+ */
+int dnet_state_open_connections(struct dnet_net_state *st, int num);
+struct dnet_net_state *dnet_state_select_connection(struct dnet_net_state *st, uint64_t size);
+
 struct dnet_net_state *dnet_state_search_by_addr(struct dnet_node *n, struct dnet_addr *addr);
 struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id *id);
 struct dnet_net_state *dnet_state_search_nolock(struct dnet_node *n, struct dnet_id *id);
@@ -210,6 +365,8 @@ int dnet_search_range(struct dnet_node *n, struct dnet_id *id,
 		struct dnet_raw_id *start, struct dnet_raw_id *next);
 
 int dnet_recv_route_list(struct dnet_net_state *st);
+void dnet_placement_poll(struct dnet_node *n);
+int dnet_process_route_reply(struct dnet_net_state *st, struct dnet_addr_container *cnt, int group_id, int ids_num);
 
 void dnet_state_destroy(struct dnet_net_state *st);
 
@@ -223,7 +380,8 @@ void dnet_unschedule_recv(struct dnet_net_state *st);
 
 int dnet_setup_control_nolock(struct dnet_net_state *st);
 
-int dnet_add_reconnect_state(struct dnet_node *n, struct dnet_addr *addr, unsigned int join_state);
+int dnet_add_reconnect_state(struct dnet_node *n, struct dnet_addr *addr, unsigned int join_state, int interval);
+void dnet_reconnect_hint(struct dnet_node *n, struct dnet_addr *addr);
 
 static inline struct dnet_net_state *dnet_state_get(struct dnet_net_state *st)
 {
@@ -284,7 +442,12 @@ static inline void dnet_wait_put(struct dnet_wait *w)
 
 struct dnet_notify_bucket
 {
-	struct list_head		notify_list;
+	/*
+	 * Subscriptions keyed by the leading 8 bytes of the watched id
+	 * (ids are content hashes, the prefix is well distributed);
+	 * duplicate keys hold multiple subscribers of the same id.
+	 */
+	struct dnet_flat_hash		notify_hash;
 	pthread_rwlock_t		notify_lock;
 };
 
@@ -296,6 +459,25 @@ int dnet_notify_remove(struct dnet_net_state *st, struct dnet_cmd *cmd);
 int dnet_notify_init(struct dnet_node *n);
 void dnet_notify_exit(struct dnet_node *n);
 
+/*
+ * Server-side checksum cache: caches checksums computed over backend file
+ * descriptors so that checksummed lookups do not re-read whole objects.
+ * Entries are validated against mtime/size of the backing file on every hit
+ * and dropped when a write or removal for their id goes through this node.
+ */
+#define DNET_CSUM_CACHE_SIZE		1024
+
+struct dnet_csum_cache_bucket
+{
+	struct list_head		entry_list;
+	pthread_mutex_t			lock;
+	int				num;
+};
+
+int dnet_csum_cache_init(struct dnet_node *n);
+void dnet_csum_cache_exit(struct dnet_node *n);
+void dnet_csum_cache_remove(struct dnet_node *n, const unsigned char *id);
+
 struct dnet_group
 {
 	struct list_head	group_entry;
@@ -323,23 +505,95 @@ static inline void dnet_group_put(struct dnet_group *g)
 		dnet_group_destroy(g);
 }
 
+/*
+ * Immutable route table snapshot used by the per-request lookup path.
+ *
+ * The live route table (@group_list and the per-group id arrays) is mutated
+ * under @state_lock. Taking that mutex for every dnet_state_get_first() call
+ * makes unrelated client threads bounce its cache line, so lookups instead
+ * run against a read-only snapshot rebuilt by dnet_route_update() on the
+ * rare route table changes (dnet_idc_create/destroy).
+ *
+ * Readers serialize against snapshot replacement via an array of padded
+ * mutexes: every reader takes a single lock picked by hashing its thread id
+ * (so it is private and cache-local in the common case), while the publisher
+ * takes all of them. The snapshot holds a reference to every state it points
+ * to, thus a lookup racing with state removal returns a state which is alive
+ * but possibly already disconnected - sending to it fails and the caller
+ * retries, exactly as it would with the locked lookup.
+ */
+struct dnet_route_entry {
+	struct dnet_raw_id	raw;
+	struct dnet_net_state	*st;
+};
+
+struct dnet_route_group {
+	unsigned int		group_id;
+	int			id_num;
+	struct dnet_route_entry	*entries;
+};
+
+struct dnet_route_table {
+	uint64_t		version;
+	int			group_num;
+	struct dnet_route_group	*groups;
+};
+
+#define DNET_ROUTE_LOCK_NUM	16
+
+struct dnet_route_lock {
+	pthread_mutex_t		lock;
+} __attribute__ ((aligned (64)));
+
+void dnet_route_update(struct dnet_node *n);
+void dnet_route_table_destroy(struct dnet_route_table *rt);
+
 struct dnet_transform
 {
 	void			*priv;
 
 	int 			(* transform)(void *priv, struct dnet_session *s, const void *src, uint64_t size,
 					void *dst, unsigned int *dsize, unsigned int flags);
+
+	/*
+	 * Optional batch variant: hashes @num independent buffers, possibly in
+	 * parallel. May be NULL, in which case callers fall back to per-buffer
+	 * transform() calls. All digests share one @dsize.
+	 */
+	int 			(* transform_batch)(void *priv, struct dnet_session *s,
+					const void *const *srcs, const uint64_t *sizes,
+					void *const *dsts, unsigned int *dsize, unsigned int flags, int num);
 };
 
-int dnet_crypto_init(struct dnet_node *n);
+int dnet_crypto_init(struct dnet_node *n, struct dnet_config *cfg);
 void dnet_crypto_cleanup(struct dnet_node *n);
 
 struct dnet_net_io {
 	int			epoll_fd;
 	pthread_t		tid;
 	struct dnet_node	*n;
+	/* io_uring engine context (library/uring.c), NULL when epoll engine is used */
+	struct dnet_uring	*uring;
 };
 
+/*
+ * io_uring based network engine. Plays the same role as the epoll loop in
+ * dnet_io_process_network(): waits for socket readiness and runs st->process().
+ * Compiled into stubs returning -ENOTSUP without HAVE_URING_SUPPORT.
+ */
+int dnet_uring_init(struct dnet_net_io *nio);
+void dnet_uring_exit(struct dnet_net_io *nio);
+int dnet_uring_schedule(struct dnet_net_state *st, int send);
+int dnet_uring_unschedule(struct dnet_net_state *st, int send);
+void *dnet_io_process_network_uring(void *data_);
+
+/*
+ * Handles one readiness event: runs state machine until it blocks,
+ * resetting the state on fatal errors the same way for both engines.
+ * Returns negative error if the state has been reset and put.
+ */
+int dnet_state_process_event(struct dnet_net_state *st, struct epoll_event *ev);
+
 enum dnet_work_io_mode {
 	DNET_WORK_IO_MODE_BLOCKING = 0,
 	DNET_WORK_IO_MODE_NONBLOCKING,
@@ -347,11 +601,15 @@ enum dnet_work_io_mode {
 };
 
 struct dnet_work_pool;
+struct dnet_work_queue;
 struct dnet_work_io {
 	struct list_head	wio_entry;
 	int			thread_index;
+	/* set by pool monitor when given worker has to exit (pool shrink) */
+	int			need_exit;
 	pthread_t		tid;
 	struct dnet_work_pool	*pool;
+	struct dnet_work_queue	*queue;
 };
 
 struct list_stat {
@@ -359,6 +617,15 @@ struct list_stat {
 	uint64_t		volume;
 	uint64_t		min_list_size;
 	uint64_t		max_list_size;
+	/*
+	 * Queue wait accounting: number of dequeued requests and total
+	 * number of microseconds they spent waiting in the list. Unlike
+	 * @volume/@min/@max these are cumulative and survive
+	 * list_stat_reset(), so the average wait time and processing rate
+	 * can be derived from two subsequent snapshots.
+	 */
+	uint64_t		wait_num;
+	uint64_t		wait_time;
 	struct timeval	time_base;
 };
 
@@ -367,6 +634,8 @@ static inline void list_stat_init(struct list_stat *st) {
 	st->volume = 0ULL;
 	st->min_list_size = ~0ULL;
 	st->max_list_size = 0ULL;
+	st->wait_num = 0ULL;
+	st->wait_time = 0ULL;
 	memset(&st->time_base, 0, sizeof(struct timeval));
 }
 
@@ -385,6 +654,19 @@ static inline void list_stat_size_decrease(struct list_stat *st, int num) {
 		st->min_list_size = st->list_size;
 }
 
+static inline void list_stat_wait_increase(struct list_stat *st, uint64_t usecs) {
+	st->wait_num++;
+	st->wait_time += usecs;
+}
+
+static inline uint64_t dnet_usecs_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
 static inline void list_stat_reset(struct list_stat *st, struct timeval *time) {
 	st->volume = 0ULL;
 	st->min_list_size = ~0ULL;
@@ -393,54 +675,102 @@ static inline void list_stat_reset(struct list_stat *st, struct timeval *time) {
 	st->time_base.tv_usec = time->tv_usec;
 }
 
+/*
+ * Single queue shard of the IO processing pool.
+ * Every shard owns its own lock, condition variable and set of worker threads,
+ * so enqueue from the network thread and dequeue from the workers of different
+ * shards never serialize on one mutex.
+ *
+ * Replies of the same transaction are always scheduled into the same shard
+ * (shard index is derived from transaction number), so per-transaction
+ * ordering logic in take_request() keeps working within the shard.
+ */
+/*
+ * IO queue priority lanes: interactive reads/lookups go first, bulk
+ * writes next, iterator/recovery and DNET_FLAGS_BACKGROUND traffic last.
+ * Lanes share workers through weighted dequeue, see take_request().
+ */
+#define DNET_IO_PRIO_HIGH	0
+#define DNET_IO_PRIO_NORMAL	1
+#define DNET_IO_PRIO_LOW	2
+#define DNET_IO_PRIO_NUM	3
+
+struct dnet_work_queue {
+	struct list_head	lane[DNET_IO_PRIO_NUM];
+	int			credit[DNET_IO_PRIO_NUM];
+	struct list_stat	list_stats;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	int			num;
+	/* NUMA node the shard workers are pinned to, -1 - no pinning */
+	int			numa_node;
+	uint64_t		*trans;
+};
+
 struct dnet_work_pool {
 	struct dnet_node	*n;
 	int			mode;
 	int			num;
-	struct list_head	list;
-	struct list_stat	list_stats;
-	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
+	/*
+	 * Pool size bounds for runtime autoscaling, zero @max means
+	 * pool size is static. Only pool monitor changes pool size
+	 * after the startup.
+	 */
+	int			min, max;
+	int			queue_num;
+	struct dnet_work_queue	*queues;
+	atomic_t		seq;
 	struct list_head	wio_list;
-	uint64_t		*trans;
 };
 
 struct dnet_io {
 	int			need_exit;
 
+	/* DNET_NET_IO_ENGINE_* - which engine network threads run */
+	int			engine;
+
 	int			net_thread_num, net_thread_pos;
 	struct dnet_net_io	*net;
 
 	struct dnet_work_pool	*recv_pool;
 	struct dnet_work_pool	*recv_pool_nb;
+
+	/* thread resizing recv_pool at runtime */
+	int			pool_monitor_started;
+	pthread_t		pool_monitor_tid;
+
+	/* operator-requested blocking pool size, applied by pool monitor, zero means none */
+	int			pool_resize_target;
+
+	/* number of NUMA nodes when NUMA-aware placement is enabled, otherwise zero */
+	int			numa_nodes;
 };
 
 int dnet_state_accept_process(struct dnet_net_state *st, struct epoll_event *ev);
 int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev);
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg);
+void dnet_io_pool_set_size(struct dnet_node *n, int num, int min, int max);
 void dnet_io_exit(struct dnet_node *n);
 
+struct dnet_io_req *dnet_io_req_alloc(size_t size);
 void dnet_io_req_free(struct dnet_io_req *r);
+void dnet_io_req_cache_cleanup(void);
 
-struct dnet_locks_entry {
-	struct rb_node		lock_tree_entry;
-	struct list_head	lock_list_entry;
-	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
-	struct dnet_raw_id	id;
-	int			locked;
-	atomic_t		refcnt;
-};
-
+/*
+ * Striped reader-writer key locks: a key hashes to one of @num stripes.
+ * Read-only commands of one key proceed in parallel, writers are exclusive.
+ * Distinct keys sharing a stripe contend with each other - that is the price
+ * of not maintaining a per-key lock registry on the hot path.
+ */
 struct dnet_locks {
-	struct list_head	lock_list;
-	struct rb_root		lock_tree;
-	pthread_mutex_t		lock;
+	int			num;
+	pthread_rwlock_t	locks[0];
 };
 
 void dnet_locks_destroy(struct dnet_node *n);
 int dnet_locks_init(struct dnet_node *n, int num);
 void dnet_oplock(struct dnet_node *n, struct dnet_id *key);
+void dnet_oplock_read(struct dnet_node *n, struct dnet_id *key);
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key);
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key);
 
@@ -462,6 +792,38 @@ struct dnet_config_data
 
 	struct dnet_config_backend *cfg_backend;
 	int cfg_backend_num;
+
+	/*
+	 * Deferred backend initialization: config parser runs backend init
+	 * (eblob open, index scan) in this thread concurrently with node and
+	 * cache setup, dnet_server_node_create() joins it before the backend
+	 * is first needed.
+	 */
+	pthread_t backend_init_thread;
+	int backend_init_async;
+	int backend_init_err;
+};
+
+/* Size of the slow command sample ring, newest samples overwrite the oldest */
+#define DNET_SLOW_CMD_NUM	128
+
+/*
+ * Per-tenant QoS budget, one slot per DNET_FLAGS_QOS class (slot 0 -
+ * untagged traffic - is never limited). Token buckets are refilled from
+ * the wall clock at IO queue admission, burst is capped at one second
+ * worth of tokens. All fields are protected by dnet_node::qos_lock.
+ */
+#define DNET_QOS_CLASS_NUM	16
+
+struct dnet_qos_class {
+	uint64_t		limit_ops;	/* per second, zero - unlimited */
+	uint64_t		limit_bytes;
+	uint64_t		tokens_ops;
+	uint64_t		tokens_bytes;
+	struct dnet_time	tokens_time;	/* last refill */
+
+	uint64_t		queued;		/* requests of this class in the IO queue */
+	uint64_t		demoted;	/* requests pushed to the background lane */
 };
 
 struct dnet_node
@@ -488,6 +850,22 @@ struct dnet_node
 	pthread_mutex_t		state_lock;
 	struct list_head	group_list;
 
+	/*
+	 * Route table version: bumped under @state_lock whenever states are
+	 * added to or removed from the route table, exchanged in route list
+	 * requests so unchanged tables are not resent (struct
+	 * dnet_route_version).
+	 */
+	uint64_t		route_version;
+
+	/*
+	 * Published lookup snapshot and its reader locks, see the comment
+	 * near struct dnet_route_table. @route is written by
+	 * dnet_route_update() only, under @state_lock plus all @route_locks.
+	 */
+	struct dnet_route_table	*route;
+	struct dnet_route_lock	route_locks[DNET_ROUTE_LOCK_NUM];
+
 	/* hosts client states, i.e. those who didn't join network */
 	struct list_head	empty_state_list;
 
@@ -496,6 +874,9 @@ struct dnet_node
 
 	atomic_t		trans;
 
+	/* number of in-flight detached connector threads, see dnet_common.c */
+	atomic_t		connect_threads;
+
 	struct dnet_net_state	*st;
 
 	int			error;
@@ -523,12 +904,41 @@ struct dnet_node
 	unsigned int		notify_hash_size;
 	struct dnet_notify_bucket	*notify_hash;
 
+	struct dnet_csum_cache_bucket	*csum_cache;
+
 	pthread_mutex_t		reconnect_lock;
 	struct list_head	reconnect_list;
+	/* wakes the reconnect thread when an address becomes due early */
+	pthread_cond_t		reconnect_cond;
+
+	/*
+	 * One-shot deferred calls (dnet_node_defer()): entries sorted by
+	 * deadline, executed by a lazily started thread. Entries always
+	 * fire exactly once - pending ones fire early on node shutdown -
+	 * so @priv ownership can safely live inside the callback.
+	 */
+	pthread_t		defer_tid;
+	int			defer_started;
+	pthread_mutex_t		defer_lock;
+	pthread_cond_t		defer_wait;
+	struct list_head	defer_list;
 
 	struct dnet_lock	counters_lock;
 	struct dnet_stat_count	counters[__DNET_CNTR_MAX];
 
+	/*
+	 * Lock-free command instrumentation: worker threads accumulate
+	 * latency histograms and sample slow commands into the ring with
+	 * atomic increments in dnet_process_cmd_raw(), readers export a
+	 * racy but monotonic snapshot via DNET_CMD_STAT_COUNT with
+	 * DNET_ATTR_CNTR_HISTOGRAM set.
+	 */
+	struct dnet_cmd_histogram	cmd_histograms[__DNET_CMD_MAX];
+
+	long			slow_cmd_threshold;	/* usecs, zero disables sampling */
+	uint32_t		slow_cmd_pos;
+	struct dnet_slow_cmd	slow_cmds[DNET_SLOW_CMD_NUM];
+
 	int			bg_ionice_class;
 	int			bg_ionice_prio;
 	int			removal_delay;
@@ -538,24 +948,47 @@ struct dnet_node
 	void			*srw;
 	void			*indexes;
 	int			indexes_shard_count;
+	int			indexes_update_window;
+
+	/* number of connections opened to every remote node, see dnet_state_open_connections() */
+	int			connections_per_addr;
 
 	int			server_prio;
 	int			client_prio;
 
 	struct dnet_locks	*locks;
 	/*
-	 * List of dnet_iterator.
+	 * Running iterators keyed by iterator id.
 	 * Used for iterator management e.g. pause/continue actions.
 	 */
-	struct list_head	iterator_list;
+	struct dnet_flat_hash	iterator_hash;
 	/*
-	 * Lock used for list management
+	 * Lock used for hash management
 	 */
 	pthread_mutex_t		iterator_lock;
+	/*
+	 * Directory iterator checkpoints are persisted into (copy of
+	 * dnet_config::history_env, next to the ids file). Empty string
+	 * disables checkpointing and resume.
+	 */
+	char			iterator_dir[1024];
 
 	size_t			cache_size;
+	int			cache_shards;
+	int			cache_sync_batch_size;
+	int			cache_sync_batch_bytes;
 	void			*cache;
 
+	/* sampled command journal, see dnet_config::capture_journal */
+	int			capture_fd;
+	int			capture_sample;
+	atomic_t		capture_counter;
+
+	/* per-tenant QoS budgets, see dnet_config::qos; zero @qos_enabled skips classification */
+	int			qos_enabled;
+	pthread_mutex_t		qos_lock;
+	struct dnet_qos_class	qos[DNET_QOS_CLASS_NUM];
+
 	struct dnet_config_data *config_data;
 };
 
@@ -584,6 +1017,13 @@ struct dnet_session {
 	/* Namespace */
 	char			*ns;
 	int			nsize;
+
+	/*
+	 * Per-session index shard count override, used together with the
+	 * namespace to shard hot indexes wider than the node-wide default.
+	 * Zero means node's indexes_shard_count.
+	 */
+	int			indexes_shard_count;
 };
 
 static inline int dnet_counter_init(struct dnet_node *n)
@@ -630,10 +1070,13 @@ static inline void dnet_counter_set(struct dnet_node *n, int counter, int err, i
 
 struct dnet_trans;
 int __attribute__((weak)) dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int recursive);
+/* nonzero when the command's dispatch descriptor declares it nonblocking-safe */
+int dnet_cmd_nonblocking(int cmd);
 int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r);
 
 int dnet_recv(struct dnet_net_state *st, void *data, unsigned int size);
 int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size);
+int dnet_splicefile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size);
 
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
 
@@ -653,9 +1096,32 @@ enum dnet_join_state {
 
 int __attribute__((weak)) dnet_state_join_nolock(struct dnet_net_state *st);
 
+/*
+ * Per-state transaction table: chained hash keyed by transaction number.
+ * Transaction ids are allocated by atomic increment, so (trans & mask)
+ * spreads them perfectly even and buckets stay shallow; lookup is O(1)
+ * instead of a deep rbtree walk under st->trans_lock.
+ */
+#define DNET_TRANS_HASH_BITS		10
+#define DNET_TRANS_HASH_SIZE		(1 << DNET_TRANS_HASH_BITS)
+
+static inline struct list_head *dnet_trans_hash_bucket(struct list_head *hash, uint64_t trans)
+{
+	return &hash[trans & (DNET_TRANS_HASH_SIZE - 1)];
+}
+
+/* One-second timer wheel slots for transaction expiry, see dnet_net_state::trans_wheel */
+#define DNET_TRANS_WHEEL_BITS		8
+#define DNET_TRANS_WHEEL_SIZE		(1 << DNET_TRANS_WHEEL_BITS)
+
+static inline struct list_head *dnet_trans_wheel_slot(struct list_head *wheel, long sec)
+{
+	return &wheel[sec & (DNET_TRANS_WHEEL_SIZE - 1)];
+}
+
 struct dnet_trans
 {
-	struct rb_node			trans_entry;
+	struct list_head		trans_hash_entry;
 	struct list_head		trans_list_entry;
 
 	struct timeval			time, start;
@@ -675,11 +1141,13 @@ struct dnet_trans
 	int				(* complete)(struct dnet_net_state *st,
 						     struct dnet_cmd *cmd,
 						     void *priv);
+
+	/* allocation size class, set by dnet_trans_alloc(), used on destroy */
+	int				alloc_class;
 };
 
 void dnet_trans_destroy(struct dnet_trans *t);
 struct dnet_trans *dnet_trans_alloc(struct dnet_node *n, uint64_t size);
-int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl);
 int dnet_trans_timer_setup(struct dnet_trans *t);
 
 static inline struct dnet_trans *dnet_trans_get(struct dnet_trans *t)
@@ -694,10 +1162,12 @@ static inline void dnet_trans_put(struct dnet_trans *t)
 		dnet_trans_destroy(t);
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a);
+int dnet_trans_insert_nolock(struct list_head *hash, struct dnet_trans *a);
 void dnet_trans_remove(struct dnet_trans *t);
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t);
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans);
+void dnet_trans_remove_nolock(struct dnet_trans *t);
+struct dnet_trans *dnet_trans_search(struct list_head *hash, uint64_t trans);
+
+void dnet_trans_cache_cleanup(void);
 
 void dnet_trans_clean_list(struct list_head *head);
 int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_head *head);
@@ -710,6 +1180,8 @@ int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 		int fd, uint64_t offset, uint64_t dsize, int on_exit);
 ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize);
+ssize_t dnet_send_data_iov(struct dnet_net_state *st, void *header, uint64_t hsize,
+		const struct iovec *iov, int iov_num, void (* iov_free)(void *iov_priv), void *iov_priv);
 ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size);
 ssize_t dnet_send_nolock(struct dnet_net_state *st, void *data, uint64_t size);
 
@@ -720,9 +1192,21 @@ struct dnet_io_completion
 	uint64_t		offset;
 };
 
+/*
+ * Dead address waiting for a reconnect attempt.
+ *
+ * Attempts are scheduled individually with jittered exponential backoff:
+ * @reconnect_time is the interval used for the current attempt (doubled on
+ * every failure up to @reconnect_time_max), @reconnect_ts is the absolute
+ * time of the next attempt. A route list reply mentioning the address
+ * resets the schedule, see dnet_reconnect_hint().
+ */
+#define DNET_RECONNECT_MAX_INTERVAL	60
+
 struct dnet_addr_storage
 {
 	int				reconnect_time, reconnect_time_max;
+	time_t				reconnect_ts;
 	struct list_head		reconnect_entry;
 	struct dnet_addr		addr;
 	unsigned int			__join_state;
@@ -730,6 +1214,7 @@ struct dnet_addr_storage
 
 int dnet_check_thread_start(struct dnet_node *n);
 void dnet_check_thread_stop(struct dnet_node *n);
+void dnet_node_defer_stop(struct dnet_node *n);
 int dnet_try_reconnect(struct dnet_node *n);
 
 void dnet_monitor_exit(struct dnet_node *n);
@@ -760,7 +1245,23 @@ void dnet_srw_cleanup(struct dnet_node *n);
 int dnet_cmd_exec_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, struct sph *header, const void *data);
 
 int dnet_cache_init(struct dnet_node *n);
+int dnet_cache_set_size(struct dnet_node *n, uint64_t size);
 void dnet_cache_cleanup(struct dnet_node *n);
+/* sums per-shard cache counters into n->counters, DNET_CNTR_CACHE_* */
+void dnet_cache_stat(struct dnet_node *n);
+
+/* one entry of the hot-key top list exported through the monitor endpoint */
+struct dnet_cache_hot_key {
+	struct dnet_raw_id	id;
+	uint64_t		frequency;
+};
+
+/*
+ * Fills @keys with up to @num of the most frequently accessed cached ids,
+ * hottest first, and returns how many were filled. Zero when the cache is
+ * disabled or nothing is hot right now.
+ */
+int dnet_cache_hot_keys(struct dnet_node *n, struct dnet_cache_hot_key *keys, int num);
 int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data);
 int dnet_cmd_cache_indexes(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_indexes_request *request);
 int dnet_cmd_cache_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd);
@@ -768,6 +1269,7 @@ int dnet_cmd_cache_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd);
 int dnet_indexes_init(struct dnet_node *, struct dnet_config *);
 void dnet_indexes_cleanup(struct dnet_node *);
 int dnet_process_indexes(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
+void dnet_indexes_invalidate(struct dnet_node *n, struct dnet_id *id);
 
 int dnet_ids_update(int update_local, const char *file, struct dnet_addr *cfg_addrs, char *remotes);
 
@@ -782,9 +1284,19 @@ int dnet_discovery(struct dnet_node *n);
 struct dnet_iterator {
 	uint64_t			id;		/* Iterator's unique id */
 	enum dnet_iterator_action	state;		/* Desired state of iterator */
-	struct list_head		list;		/* List of all iterators */
 	pthread_mutex_t			lock;		/* Lock for iterator manipulation */
 	pthread_cond_t			wait;		/* We wait here in case we stopped */
+
+	/*
+	 * Reply rate limits (zero: unlimited), enforced by the iterator
+	 * thread via token buckets refilled from the wall clock.
+	 * All fields are protected by @lock.
+	 */
+	uint64_t			limit_bytes_per_sec;
+	uint64_t			limit_replies_per_sec;
+	uint64_t			tokens_bytes;
+	uint64_t			tokens_replies;
+	struct dnet_time		tokens_time;	/* Last refill time */
 };
 
 /*
@@ -794,6 +1306,8 @@ struct dnet_iterator *dnet_iterator_create(struct dnet_node *n);
 void dnet_iterator_destroy(struct dnet_node *n, struct dnet_iterator *it);
 int dnet_iterator_set_state(struct dnet_node *n,
 		enum dnet_iterator_action action, uint64_t id);
+int dnet_iterator_set_limits(struct dnet_node *n, uint64_t id,
+		uint64_t bytes_per_sec, uint64_t replies_per_sec);
 void dnet_iterator_cancel_all(struct dnet_node *n);
 
 /*
@@ -805,7 +1319,7 @@ void dnet_iterator_cancel_all(struct dnet_node *n);
 struct dnet_iterator *dnet_iterator_alloc(uint64_t id);
 /* Free previously allocated iterator */
 void dnet_iterator_free(struct dnet_iterator *it);
-/* Iterator list management routines */
+/* Iterator registry management routines */
 int dnet_iterator_list_insert_nolock(struct dnet_node *n, struct dnet_iterator *it);
 struct dnet_iterator *dnet_iterator_list_lookup_nolock(struct dnet_node *n, uint64_t id);
 int dnet_iterator_list_remove(struct dnet_node *n, uint64_t id);
@@ -820,10 +1334,42 @@ struct dnet_iterator_common_private {
 	struct dnet_iterator_request	*req;		/* Original request */
 	struct dnet_iterator_range		*range;		/* Original ranges */
 	struct dnet_iterator		*it;		/* Iterator control structure */
+	struct dnet_node		*n;		/* Node, for server-side checksums */
 	int				(*next_callback)(void *priv, void *data, uint64_t dsize);
 	void				*next_private;	/* One of predefined callbacks */
+
+	/*
+	 * Checkpointed resume (DNET_IFLAGS_RESUME): @pos counts every record
+	 * the backend handed over, @done - records fully shipped to the
+	 * client, @skip leading records are dropped because a previous run
+	 * already processed them. @checkpoint_id is the client-chosen request
+	 * id the checkpoint file is keyed by, zero disables checkpointing.
+	 */
+	uint64_t			pos;
+	uint64_t			done;
+	uint64_t			skip;
+	uint64_t			checkpoint_id;
+	uint64_t			checkpoint_pos;
+	time_t				checkpoint_time;
 };
 
+/* Iterator checkpoint file payload, stored in dnet_node::iterator_dir */
+#define DNET_ITERATOR_CHECKPOINT_MAGIC	0x504b43544e44ULL	/* "DNTCKP" */
+
+struct dnet_iterator_checkpoint {
+	uint64_t			magic;
+	uint64_t			pos;		/* Records already shipped */
+} __attribute__ ((packed));
+
+/*
+ * Filtering/flow-control part shared by all iterator users, exported for
+ * the range-diff command which drives the backend iterator directly.
+ */
+int dnet_iterator_callback_common(void *priv, struct dnet_raw_id *key,
+		void *data, uint64_t dsize, struct dnet_ext_list *elist);
+
+int dnet_cmd_range_diff(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
+
 /*
  * Send over network callback private.
  */
@@ -909,6 +1455,41 @@ static inline void dnet_indexes_shard_count_decode(struct dnet_id *id, int *coun
     *count = dnet_bswap32(data[5]);
 }
 
+/*
+ * Optional protocol capabilities exchanged during the reverse lookup
+ * handshake next to the version and indexes shard count. The client sends
+ * the set it supports, the server replies with the intersection, both
+ * sides enable the agreed features on that connection only. Older peers
+ * leave the word zeroed, which disables everything.
+ */
+#define DNET_CAPABILITIES_COMPACT	(1<<0)
+/* LZ4 wire compression of packet bodies, see DNET_FLAGS_LZ4 */
+#define DNET_CAPABILITIES_LZ4		(1<<1)
+
+/*
+ * Both sides intersect the peer's set with this mask, so a build without
+ * liblz4 never negotiates the compression it could not undo.
+ */
+#ifdef HAVE_LZ4_SUPPORT
+#define DNET_CAPABILITIES_SUPPORTED	(DNET_CAPABILITIES_COMPACT | DNET_CAPABILITIES_LZ4)
+#else
+#define DNET_CAPABILITIES_SUPPORTED	(DNET_CAPABILITIES_COMPACT)
+#endif
+
+static inline void dnet_capabilities_encode(struct dnet_id *id, int caps)
+{
+    int *data = (int *)(id->id);
+
+    data[4] = dnet_bswap32(caps);
+}
+
+static inline void dnet_capabilities_decode(struct dnet_id *id, int *caps)
+{
+    int *data = (int *)(id->id);
+
+    *caps = dnet_bswap32(data[4]);
+}
+
 
 #ifdef __cplusplus
 }
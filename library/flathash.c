@@ -0,0 +1,194 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flathash.h"
+
+/*
+ * Deleted slots are tombstoned instead of emptied so probe runs crossing
+ * them stay intact; a grow rehashes live entries only and drops the
+ * tombstones. Insertion keeps at least a quarter of the slots empty
+ * (tombstones included), so probe runs stay short and every probe loop
+ * below is guaranteed to hit an empty slot.
+ */
+#define DNET_FLAT_TOMB		((void *)(uintptr_t)-1)
+#define DNET_FLAT_MIN_SIZE	16
+
+static unsigned int dnet_flat_hash_slot(struct dnet_flat_hash *h, uint64_t key)
+{
+	/* fibonacci hashing - multiplicative spread of mostly-sequential keys */
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & h->mask;
+}
+
+int dnet_flat_hash_init(struct dnet_flat_hash *h, unsigned int size)
+{
+	unsigned int num = DNET_FLAT_MIN_SIZE;
+
+	while (num < size)
+		num <<= 1;
+
+	h->slots = calloc(num, sizeof(struct dnet_flat_slot));
+	if (!h->slots)
+		return -ENOMEM;
+
+	h->mask = num - 1;
+	h->used = 0;
+	h->tombs = 0;
+
+	return 0;
+}
+
+void dnet_flat_hash_destroy(struct dnet_flat_hash *h)
+{
+	free(h->slots);
+	h->slots = NULL;
+}
+
+static int dnet_flat_hash_grow(struct dnet_flat_hash *h)
+{
+	struct dnet_flat_hash nh;
+	unsigned int i, num = h->mask + 1;
+	int err;
+
+	/* grow only when live entries need it - a rehash alone drops tombstones */
+	if (h->used * 2 > num)
+		num <<= 1;
+
+	err = dnet_flat_hash_init(&nh, num);
+	if (err)
+		return err;
+
+	for (i = 0; i <= h->mask; ++i) {
+		struct dnet_flat_slot *s = &h->slots[i];
+
+		if (s->ptr && s->ptr != DNET_FLAT_TOMB)
+			dnet_flat_hash_insert(&nh, s->key, s->ptr);
+	}
+
+	free(h->slots);
+	*h = nh;
+
+	return 0;
+}
+
+int dnet_flat_hash_insert(struct dnet_flat_hash *h, uint64_t key, void *ptr)
+{
+	unsigned int i;
+	int err;
+
+	if (!ptr || ptr == DNET_FLAT_TOMB)
+		return -EINVAL;
+
+	if ((h->used + h->tombs) * 4 >= (h->mask + 1) * 3) {
+		err = dnet_flat_hash_grow(h);
+		if (err)
+			return err;
+	}
+
+	i = dnet_flat_hash_slot(h, key);
+	while (h->slots[i].ptr && h->slots[i].ptr != DNET_FLAT_TOMB)
+		i = (i + 1) & h->mask;
+
+	if (h->slots[i].ptr == DNET_FLAT_TOMB)
+		h->tombs--;
+
+	h->slots[i].key = key;
+	h->slots[i].ptr = ptr;
+	h->used++;
+
+	return 0;
+}
+
+int dnet_flat_hash_remove(struct dnet_flat_hash *h, uint64_t key, void *ptr)
+{
+	unsigned int i = dnet_flat_hash_slot(h, key);
+
+	while (h->slots[i].ptr) {
+		struct dnet_flat_slot *s = &h->slots[i];
+
+		if (s->ptr != DNET_FLAT_TOMB && s->key == key &&
+				(!ptr || s->ptr == ptr)) {
+			s->ptr = DNET_FLAT_TOMB;
+			h->used--;
+			h->tombs++;
+			return 0;
+		}
+
+		i = (i + 1) & h->mask;
+	}
+
+	return -ENOENT;
+}
+
+void *dnet_flat_hash_find(struct dnet_flat_hash *h, uint64_t key, unsigned int *pos)
+{
+	*pos = dnet_flat_hash_slot(h, key);
+	return dnet_flat_hash_find_next(h, key, pos);
+}
+
+/*
+ * Continues the probe run started by dnet_flat_hash_find(): @pos is the
+ * next slot to look at and is advanced past the returned entry, so
+ * duplicate keys come out one by one until the run hits an empty slot.
+ */
+void *dnet_flat_hash_find_next(struct dnet_flat_hash *h, uint64_t key, unsigned int *pos)
+{
+	unsigned int i = *pos;
+
+	while (h->slots[i].ptr) {
+		struct dnet_flat_slot *s = &h->slots[i];
+
+		i = (i + 1) & h->mask;
+
+		if (s->ptr != DNET_FLAT_TOMB && s->key == key) {
+			*pos = i;
+			return s->ptr;
+		}
+	}
+
+	*pos = i;
+	return NULL;
+}
+
+void dnet_flat_hash_for_each(struct dnet_flat_hash *h, void (*cb)(void *ptr, void *priv), void *priv)
+{
+	unsigned int i;
+
+	for (i = 0; i <= h->mask; ++i) {
+		void *ptr = h->slots[i].ptr;
+
+		if (ptr && ptr != DNET_FLAT_TOMB)
+			cb(ptr, priv);
+	}
+}
+
+void dnet_flat_hash_clear(struct dnet_flat_hash *h, void (*cb)(void *ptr, void *priv), void *priv)
+{
+	unsigned int i;
+
+	for (i = 0; i <= h->mask; ++i) {
+		void *ptr = h->slots[i].ptr;
+
+		h->slots[i].ptr = NULL;
+		if (ptr && ptr != DNET_FLAT_TOMB && cb)
+			cb(ptr, priv);
+	}
+
+	h->used = 0;
+	h->tombs = 0;
+}
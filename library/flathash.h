@@ -0,0 +1,65 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __DNET_FLATHASH_H
+#define __DNET_FLATHASH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Flat open-addressing hash table: a power-of-two slot array probed
+ * linearly. A slot is 16 bytes, so four of them share a cache line and a
+ * probe run walks sequential memory instead of chasing tree or list
+ * pointers. Duplicate keys are allowed - dnet_flat_hash_find() returns a
+ * probe cursor which dnet_flat_hash_find_next() continues, so multimap
+ * users walk all candidates while unique-key users just take the first
+ * hit. The table is not thread-safe, callers bring their own locking.
+ */
+
+struct dnet_flat_slot {
+	uint64_t		key;
+	void			*ptr;
+};
+
+struct dnet_flat_hash {
+	struct dnet_flat_slot	*slots;
+	unsigned int		mask;		/* slot number - 1, power of two */
+	unsigned int		used;		/* live entries */
+	unsigned int		tombs;		/* deleted slots still breaking probe runs */
+};
+
+int dnet_flat_hash_init(struct dnet_flat_hash *h, unsigned int size);
+void dnet_flat_hash_destroy(struct dnet_flat_hash *h);
+
+int dnet_flat_hash_insert(struct dnet_flat_hash *h, uint64_t key, void *ptr);
+/* @ptr selects among duplicates, NULL removes the first entry with @key */
+int dnet_flat_hash_remove(struct dnet_flat_hash *h, uint64_t key, void *ptr);
+
+void *dnet_flat_hash_find(struct dnet_flat_hash *h, uint64_t key, unsigned int *pos);
+void *dnet_flat_hash_find_next(struct dnet_flat_hash *h, uint64_t key, unsigned int *pos);
+
+void dnet_flat_hash_for_each(struct dnet_flat_hash *h, void (*cb)(void *ptr, void *priv), void *priv);
+/* empties the table, @cb (may be NULL) runs on every live entry */
+void dnet_flat_hash_clear(struct dnet_flat_hash *h, void (*cb)(void *ptr, void *priv), void *priv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DNET_FLATHASH_H */
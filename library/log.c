@@ -44,16 +44,238 @@ int dnet_log_init(struct dnet_node *n, struct dnet_log *l)
 	return 0;
 }
 
+/*
+ * Asynchronous log pipeline.
+ *
+ * Every logging thread owns a single-producer ring of preformatted records,
+ * a single drain thread walks all rings and feeds the records to their log
+ * sinks. IO threads thus never touch the log file or the sink's internal
+ * serialization - enabling INFO level no longer taxes the data path.
+ *
+ * Messages are still rendered by the producer: format arguments routinely
+ * point into per-thread scratch buffers (dnet_dump_id() and friends), so
+ * deferring vsnprintf() to the drain thread would read reused memory.
+ * Rendering goes directly into the ring slot, there are no allocations and
+ * no locks on the fast path.
+ *
+ * On overflow records are dropped and counted, the drain thread reports the
+ * count once the ring has room again.
+ */
+
+#define DNET_LOG_RING_RECORDS		256		/* power of two */
+#define DNET_LOG_RECORD_SIZE		512
+
+struct dnet_log_record {
+	struct dnet_log		*log;
+	int			level;
+	char			msg[DNET_LOG_RECORD_SIZE];
+};
+
+struct dnet_log_ring {
+	struct dnet_log_ring	*next;
+
+	uint64_t		head;		/* written by the owner thread only */
+	uint64_t		tail;		/* written by the drain thread only */
+
+	uint64_t		dropped;	/* owner-side overflow counter */
+	uint64_t		reported;	/* drain-side: drops already reported */
+
+	struct dnet_log		*last_log;	/* sink for the drop report */
+	int			exited;		/* owner thread is gone, free once empty */
+
+	struct dnet_log_record	records[DNET_LOG_RING_RECORDS];
+};
+
+static pthread_mutex_t dnet_log_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dnet_log_ring *dnet_log_rings;
+static pthread_key_t dnet_log_ring_key;
+static pthread_once_t dnet_log_once = PTHREAD_ONCE_INIT;
+static int dnet_log_drain_running;
+
+static void dnet_log_ring_drain(struct dnet_log_ring *r)
+{
+	struct dnet_log_record *rec;
+
+	while (r->tail != r->head) {
+		__sync_synchronize();
+
+		rec = &r->records[r->tail & (DNET_LOG_RING_RECORDS - 1)];
+		rec->log->log(rec->log->log_private, rec->level, rec->msg);
+
+		__sync_synchronize();
+		r->tail++;
+	}
+
+	if (r->dropped != r->reported) {
+		uint64_t dropped = r->dropped;
+		char buf[128];
+
+		if (r->last_log) {
+			snprintf(buf, sizeof(buf), "dropped %llu log records: ring overflow\n",
+					(unsigned long long)(dropped - r->reported));
+			r->last_log->log(r->last_log->log_private, DNET_LOG_ERROR, buf);
+		}
+		r->reported = dropped;
+	}
+}
+
+static void *dnet_log_drain_proc(void *arg __unused)
+{
+	struct dnet_log_ring *r, *prev, *next;
+	int work;
+
+	dnet_set_name("log_drain");
+
+	while (1) {
+		work = 0;
+
+		pthread_mutex_lock(&dnet_log_ring_lock);
+		prev = NULL;
+		for (r = dnet_log_rings; r; r = next) {
+			next = r->next;
+
+			if (r->tail != r->head)
+				work = 1;
+			dnet_log_ring_drain(r);
+
+			if (r->exited && (r->tail == r->head)) {
+				if (prev)
+					prev->next = next;
+				else
+					dnet_log_rings = next;
+				free(r);
+				continue;
+			}
+
+			prev = r;
+		}
+		pthread_mutex_unlock(&dnet_log_ring_lock);
+
+		if (!work)
+			usleep(10000);
+	}
+
+	return NULL;
+}
+
+static void dnet_log_ring_exit(void *priv)
+{
+	struct dnet_log_ring *r = priv;
+
+	/* the drain thread unlinks and frees the ring once it is empty */
+	__sync_synchronize();
+	r->exited = 1;
+}
+
+static void dnet_log_async_init(void)
+{
+	pthread_t tid;
+	int err;
+
+	err = pthread_key_create(&dnet_log_ring_key, dnet_log_ring_exit);
+	if (err)
+		return;
+
+	err = pthread_create(&tid, NULL, dnet_log_drain_proc, NULL);
+	if (err) {
+		pthread_key_delete(dnet_log_ring_key);
+		return;
+	}
+
+	dnet_log_drain_running = 1;
+}
+
+static struct dnet_log_ring *dnet_log_ring_get(void)
+{
+	struct dnet_log_ring *r;
+
+	pthread_once(&dnet_log_once, dnet_log_async_init);
+	if (!dnet_log_drain_running)
+		return NULL;
+
+	r = pthread_getspecific(dnet_log_ring_key);
+	if (r)
+		return r;
+
+	r = calloc(1, sizeof(struct dnet_log_ring));
+	if (!r)
+		return NULL;
+
+	if (pthread_setspecific(dnet_log_ring_key, r)) {
+		free(r);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&dnet_log_ring_lock);
+	r->next = dnet_log_rings;
+	dnet_log_rings = r;
+	pthread_mutex_unlock(&dnet_log_ring_lock);
+
+	return r;
+}
+
+void dnet_log_flush(void)
+{
+	struct dnet_log_ring *r;
+	int i, busy;
+
+	if (!dnet_log_drain_running)
+		return;
+
+	for (i = 0; i < 1000; ++i) {
+		busy = 0;
+
+		pthread_mutex_lock(&dnet_log_ring_lock);
+		for (r = dnet_log_rings; r; r = r->next) {
+			if (r->tail != r->head) {
+				busy = 1;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&dnet_log_ring_lock);
+
+		if (!busy)
+			break;
+
+		usleep(1000);
+	}
+}
+
 void dnet_log_raw(struct dnet_node *n, int level, const char *format, ...)
 {
 	va_list args;
 	char buf[1024];
 	struct dnet_log *l = n->log;
+	struct dnet_log_ring *r;
+	struct dnet_log_record *rec;
 	int buflen = sizeof(buf);
 
 	if (!l->log || ((l->log_level < level) && !(trace_id & DNET_TRACE_BIT)))
 		return;
 
+	r = dnet_log_ring_get();
+	if (r) {
+		if (r->head - r->tail >= DNET_LOG_RING_RECORDS) {
+			r->dropped++;
+			return;
+		}
+
+		rec = &r->records[r->head & (DNET_LOG_RING_RECORDS - 1)];
+		rec->log = l;
+		rec->level = level;
+
+		va_start(args, format);
+		vsnprintf(rec->msg, sizeof(rec->msg), format, args);
+		rec->msg[sizeof(rec->msg) - 1] = '\0';
+		va_end(args);
+
+		r->last_log = l;
+
+		__sync_synchronize();
+		r->head++;
+		return;
+	}
+
 	va_start(args, format);
 	vsnprintf(buf, buflen, format, args);
 	buf[buflen-1] = '\0';
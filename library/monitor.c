@@ -0,0 +1,457 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/*
+ * Embedded monitoring endpoint: a single thread serving read-only JSON
+ * statistic snapshots over HTTP, so dashboards can scrape a node without
+ * speaking the elliptics protocol. Everything is read from the counters,
+ * histograms and queue stats the worker threads maintain anyway - racy
+ * uint64 reads can lag a snapshot a little behind, but a scrape never
+ * takes data path locks.
+ */
+
+struct dnet_monitor_buf {
+	char			*data;
+	size_t			size;
+	size_t			off;
+};
+
+static int dnet_monitor_printf(struct dnet_monitor_buf *b, const char *fmt, ...)
+{
+	va_list args;
+	char *tmp;
+	int len;
+
+	while (1) {
+		va_start(args, fmt);
+		len = vsnprintf(b->data + b->off, b->size - b->off, fmt, args);
+		va_end(args);
+
+		if (len < 0)
+			return -EINVAL;
+
+		if (b->off + len < b->size) {
+			b->off += len;
+			return 0;
+		}
+
+		tmp = realloc(b->data, b->size * 2);
+		if (!tmp)
+			return -ENOMEM;
+
+		b->data = tmp;
+		b->size *= 2;
+	}
+}
+
+static int dnet_monitor_dump_counters(struct dnet_node *n, struct dnet_monitor_buf *b)
+{
+	int i, err, comma = 0;
+
+	err = dnet_monitor_printf(b, "\"storage_commands\":{");
+	for (i = 0; i < __DNET_CMD_MAX && !err; ++i) {
+		if (!n->counters[i].count && !n->counters[i].err)
+			continue;
+
+		err = dnet_monitor_printf(b, "%s\"%s\":{\"count\":%llu,\"err\":%llu}",
+				comma++ ? "," : "", dnet_counter_string(i, __DNET_CMD_MAX),
+				(unsigned long long)n->counters[i].count,
+				(unsigned long long)n->counters[i].err);
+	}
+
+	if (!err)
+		err = dnet_monitor_printf(b, "},\"proxy_commands\":{");
+
+	comma = 0;
+	for (i = __DNET_CMD_MAX; i < 2 * __DNET_CMD_MAX && !err; ++i) {
+		if (!n->counters[i].count && !n->counters[i].err)
+			continue;
+
+		err = dnet_monitor_printf(b, "%s\"%s\":{\"count\":%llu,\"err\":%llu}",
+				comma++ ? "," : "", dnet_counter_string(i, __DNET_CMD_MAX),
+				(unsigned long long)n->counters[i].count,
+				(unsigned long long)n->counters[i].err);
+	}
+
+	if (!err)
+		err = dnet_monitor_printf(b, "},\"counters\":{");
+
+	comma = 0;
+	for (i = 2 * __DNET_CMD_MAX; i < __DNET_CNTR_MAX && !err; ++i) {
+		if (!n->counters[i].count && !n->counters[i].err)
+			continue;
+
+		err = dnet_monitor_printf(b, "%s\"%s\":{\"count\":%llu,\"err\":%llu}",
+				comma++ ? "," : "", dnet_counter_string(i, __DNET_CMD_MAX),
+				(unsigned long long)n->counters[i].count,
+				(unsigned long long)n->counters[i].err);
+	}
+
+	if (!err)
+		err = dnet_monitor_printf(b, "}");
+
+	return err;
+}
+
+static int dnet_monitor_dump_histogram_array(struct dnet_monitor_buf *b, const uint64_t *buckets)
+{
+	int i, err = 0;
+
+	err = dnet_monitor_printf(b, "[");
+	for (i = 0; i < DNET_HISTOGRAM_BUCKETS && !err; ++i)
+		err = dnet_monitor_printf(b, "%s%llu", i ? "," : "", (unsigned long long)buckets[i]);
+	if (!err)
+		err = dnet_monitor_printf(b, "]");
+
+	return err;
+}
+
+static int dnet_monitor_dump_histograms(struct dnet_node *n, struct dnet_monitor_buf *b)
+{
+	int c, i, err, comma = 0;
+
+	err = dnet_monitor_printf(b, "\"histograms\":{");
+	for (c = 0; c < __DNET_CMD_MAX && !err; ++c) {
+		struct dnet_cmd_histogram *h = &n->cmd_histograms[c];
+		uint64_t total = 0;
+
+		for (i = 0; i < DNET_HISTOGRAM_BUCKETS; ++i)
+			total += h->cache[i] + h->disk[i];
+
+		if (!total)
+			continue;
+
+		err = dnet_monitor_printf(b, "%s\"%s\":{\"cache\":",
+				comma++ ? "," : "", dnet_cmd_string(c));
+		if (!err)
+			err = dnet_monitor_dump_histogram_array(b, h->cache);
+		if (!err)
+			err = dnet_monitor_printf(b, ",\"disk\":");
+		if (!err)
+			err = dnet_monitor_dump_histogram_array(b, h->disk);
+		if (!err)
+			err = dnet_monitor_printf(b, "}");
+	}
+
+	if (!err)
+		err = dnet_monitor_printf(b, "}");
+
+	return err;
+}
+
+static int dnet_monitor_dump_slow_cmds(struct dnet_node *n, struct dnet_monitor_buf *b)
+{
+	char id_str[DNET_ID_SIZE * 2 + 1];
+	int i, err, comma = 0;
+
+	err = dnet_monitor_printf(b, "\"slow_commands\":{\"threshold\":%ld,\"samples\":[",
+			n->slow_cmd_threshold);
+
+	for (i = 0; i < DNET_SLOW_CMD_NUM && !err; ++i) {
+		struct dnet_slow_cmd *s = &n->slow_cmds[i];
+
+		if (!s->duration)
+			continue;
+
+		dnet_dump_id_len_raw(s->cmd.id.id, DNET_ID_SIZE, id_str);
+
+		err = dnet_monitor_printf(b, "%s{\"command\":\"%s\",\"id\":\"%s\",\"group\":%d,"
+				"\"trans\":%llu,\"size\":%llu,\"flags\":%llu,"
+				"\"duration\":%llu,\"time\":%llu}",
+				comma++ ? "," : "", dnet_cmd_string(s->cmd.cmd), id_str,
+				s->cmd.id.group_id,
+				(unsigned long long)(s->cmd.trans & ~DNET_TRANS_REPLY),
+				(unsigned long long)s->cmd.size,
+				(unsigned long long)s->cmd.flags,
+				(unsigned long long)s->duration,
+				(unsigned long long)s->time.tsec);
+	}
+
+	if (!err)
+		err = dnet_monitor_printf(b, "]}");
+
+	return err;
+}
+
+#define DNET_MONITOR_HOT_KEYS	32
+
+static int dnet_monitor_dump_hot_keys(struct dnet_node *n, struct dnet_monitor_buf *b)
+{
+	struct dnet_cache_hot_key keys[DNET_MONITOR_HOT_KEYS];
+	char id_str[DNET_ID_SIZE * 2 + 1];
+	int i, num, err;
+
+	num = dnet_cache_hot_keys(n, keys, DNET_MONITOR_HOT_KEYS);
+
+	err = dnet_monitor_printf(b, "\"hot_keys\":[");
+	for (i = 0; i < num && !err; ++i) {
+		dnet_dump_id_len_raw(keys[i].id.id, DNET_ID_SIZE, id_str);
+
+		err = dnet_monitor_printf(b, "%s{\"id\":\"%s\",\"frequency\":%llu}",
+				i ? "," : "", id_str,
+				(unsigned long long)keys[i].frequency);
+	}
+
+	if (!err)
+		err = dnet_monitor_printf(b, "]");
+
+	return err;
+}
+
+static int dnet_monitor_dump_pool(struct dnet_monitor_buf *b, const char *name, struct dnet_work_pool *pool)
+{
+	int i, err;
+
+	err = dnet_monitor_printf(b, "\"%s\":{\"threads\":%d,\"queues\":[", name, pool->num);
+	for (i = 0; i < pool->queue_num && !err; ++i) {
+		struct list_stat *st = &pool->queues[i].list_stats;
+
+		err = dnet_monitor_printf(b, "%s{\"size\":%llu,\"volume\":%llu,\"max\":%llu,"
+				"\"wait_num\":%llu,\"wait_time\":%llu}",
+				i ? "," : "",
+				(unsigned long long)st->list_size,
+				(unsigned long long)st->volume,
+				(unsigned long long)st->max_list_size,
+				(unsigned long long)st->wait_num,
+				(unsigned long long)st->wait_time);
+	}
+	if (!err)
+		err = dnet_monitor_printf(b, "]}");
+
+	return err;
+}
+
+static int dnet_monitor_dump_io_queues(struct dnet_node *n, struct dnet_monitor_buf *b)
+{
+	int err;
+
+	err = dnet_monitor_printf(b, "\"io_queues\":{");
+	if (!err)
+		err = dnet_monitor_dump_pool(b, "blocking", n->io->recv_pool);
+	if (!err)
+		err = dnet_monitor_printf(b, ",");
+	if (!err)
+		err = dnet_monitor_dump_pool(b, "nonblocking", n->io->recv_pool_nb);
+	if (!err)
+		err = dnet_monitor_printf(b, "}");
+
+	return err;
+}
+
+static int dnet_monitor_dump(struct dnet_node *n, struct dnet_monitor_buf *b)
+{
+	struct dnet_time now;
+	int err;
+
+	/* refreshes DNET_CNTR_CACHE_* counters exported below */
+	dnet_cache_stat(n);
+
+	dnet_current_time(&now);
+
+	err = dnet_monitor_printf(b, "{\"time\":%llu,", (unsigned long long)now.tsec);
+	if (!err)
+		err = dnet_monitor_dump_counters(n, b);
+	if (!err)
+		err = dnet_monitor_printf(b, ",");
+	if (!err)
+		err = dnet_monitor_dump_histograms(n, b);
+	if (!err)
+		err = dnet_monitor_printf(b, ",");
+	if (!err)
+		err = dnet_monitor_dump_slow_cmds(n, b);
+	if (!err)
+		err = dnet_monitor_printf(b, ",");
+	if (!err)
+		err = dnet_monitor_dump_io_queues(n, b);
+	if (!err)
+		err = dnet_monitor_printf(b, ",");
+	if (!err)
+		err = dnet_monitor_dump_hot_keys(n, b);
+	if (!err)
+		err = dnet_monitor_printf(b, "}");
+
+	return err;
+}
+
+static int dnet_monitor_write(int fd, const char *data, size_t size)
+{
+	while (size) {
+		ssize_t written = write(fd, data, size);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		data += written;
+		size -= written;
+	}
+
+	return 0;
+}
+
+static void dnet_monitor_serve(struct dnet_node *n, int fd)
+{
+	struct dnet_monitor_buf b;
+	char header[128];
+	char request[1024];
+	int err;
+
+	/* the request content does not matter - every path returns the snapshot */
+	err = read(fd, request, sizeof(request));
+	(void) err;
+
+	b.size = 64 * 1024;
+	b.off = 0;
+	b.data = malloc(b.size);
+	if (!b.data)
+		return;
+
+	err = dnet_monitor_dump(n, &b);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "monitor: failed to dump statistics: %d\n", err);
+		goto err_out_free;
+	}
+
+	snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+			"Content-Type: application/json\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", b.off);
+
+	err = dnet_monitor_write(fd, header, strlen(header));
+	if (!err)
+		dnet_monitor_write(fd, b.data, b.off);
+
+err_out_free:
+	free(b.data);
+}
+
+static void *dnet_monitor_process(void *data)
+{
+	struct dnet_node *n = data;
+	struct pollfd pfd;
+	int err, fd;
+
+	dnet_set_name("monitor");
+
+	while (!n->need_exit) {
+		pfd.fd = n->monitor_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		err = poll(&pfd, 1, 1000);
+		if (err <= 0)
+			continue;
+
+		if (!(pfd.revents & POLLIN))
+			continue;
+
+		fd = accept(n->monitor_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		dnet_monitor_serve(n, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int dnet_monitor_init(struct dnet_node *n, struct dnet_config *cfg)
+{
+	struct sockaddr_in addr;
+	int err, s, on = 1;
+
+	n->monitor_fd = -1;
+
+	if (!cfg->monitor_port)
+		return 0;
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0) {
+		err = -errno;
+		dnet_log(n, DNET_LOG_ERROR, "monitor: failed to create socket: %d\n", err);
+		goto err_out_exit;
+	}
+
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(cfg->monitor_port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	err = bind(s, (struct sockaddr *)&addr, sizeof(addr));
+	if (err) {
+		err = -errno;
+		dnet_log(n, DNET_LOG_ERROR, "monitor: failed to bind port %d: %d\n", cfg->monitor_port, err);
+		goto err_out_close;
+	}
+
+	err = listen(s, 32);
+	if (err) {
+		err = -errno;
+		dnet_log(n, DNET_LOG_ERROR, "monitor: failed to listen on port %d: %d\n", cfg->monitor_port, err);
+		goto err_out_close;
+	}
+
+	n->monitor_fd = s;
+
+	err = pthread_create(&n->monitor_tid, NULL, dnet_monitor_process, n);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "monitor: failed to create thread: %d\n", err);
+		n->monitor_fd = -1;
+		goto err_out_close;
+	}
+
+	dnet_log(n, DNET_LOG_INFO, "monitor: HTTP statistics endpoint listening on port %d\n", cfg->monitor_port);
+
+	return 0;
+
+err_out_close:
+	close(s);
+err_out_exit:
+	return err;
+}
+
+void dnet_monitor_exit(struct dnet_node *n)
+{
+	if (n->monitor_fd < 0)
+		return;
+
+	n->need_exit = 1;
+	pthread_join(n->monitor_tid, NULL);
+
+	close(n->monitor_fd);
+	n->monitor_fd = -1;
+}
@@ -25,6 +25,10 @@
 
 #include <netinet/tcp.h>
 
+#ifdef HAVE_LZ4_SUPPORT
+#include <lz4.h>
+#endif
+
 #include "elliptics.h"
 #include "elliptics/packet.h"
 #include "elliptics/interface.h"
@@ -245,33 +249,197 @@ err_out_exit:
 
 void dnet_state_clean(struct dnet_net_state *st)
 {
-	struct rb_node *rb_node;
 	struct dnet_trans *t;
 	int num = 0;
+	int i;
 
-	while (1) {
-		t = NULL;
+	for (i = 0; i < DNET_TRANS_HASH_SIZE; ++i) {
+		while (1) {
+			t = NULL;
 
-		pthread_mutex_lock(&st->trans_lock);
-		rb_node = rb_first(&st->trans_root);
-		if (rb_node) {
-			t = rb_entry(rb_node, struct dnet_trans, trans_entry);
-			dnet_trans_get(t);
-			dnet_trans_remove_nolock(&st->trans_root, t);
-			list_del_init(&t->trans_list_entry);
+			pthread_mutex_lock(&st->trans_lock);
+			if (!list_empty(&st->trans_hash[i])) {
+				t = list_first_entry(&st->trans_hash[i], struct dnet_trans, trans_hash_entry);
+				dnet_trans_get(t);
+				dnet_trans_remove_nolock(t);
+				list_del_init(&t->trans_list_entry);
+			}
+			pthread_mutex_unlock(&st->trans_lock);
+
+			if (!t)
+				break;
+
+			dnet_trans_put(t);
+			dnet_trans_put(t);
+			num++;
 		}
-		pthread_mutex_unlock(&st->trans_lock);
+	}
+
+	dnet_log(st->n, DNET_LOG_NOTICE, "Cleaned state %s, transactions freed: %d\n", dnet_state_dump_addr(st), num);
+}
+
+/*
+ * Thread-local size-class cache in front of malloc for dnet_io_req
+ * allocations. Request header and inline payload live in the same
+ * allocation as the structure, so every packet costs one allocation -
+ * this cache removes glibc arena contention from the packet hot path.
+ *
+ * Every IO/network thread both allocates and frees requests at a similar
+ * rate in steady state (received request is freed by a worker which in
+ * turn allocates the reply freed by a network thread), so per-thread
+ * caches recycle well without a shared freelist. Library threads flush
+ * their cache via dnet_io_req_cache_cleanup() on exit.
+ */
+#define DNET_IO_REQ_CACHE_CLASSES	4
+#define DNET_IO_REQ_CACHE_DEPTH		16
 
-		if (!t)
+static const size_t dnet_io_req_cache_sizes[DNET_IO_REQ_CACHE_CLASSES] = {
+	1024, 4096, 16384, 65536,
+};
+
+struct dnet_io_req_cache {
+	void		*head;
+	int		num;
+};
+
+static __thread struct dnet_io_req_cache dnet_io_req_cache[DNET_IO_REQ_CACHE_CLASSES];
+
+struct dnet_io_req *dnet_io_req_alloc(size_t size)
+{
+	struct dnet_io_req_cache *c;
+	struct dnet_io_req *r;
+	int class;
+
+	for (class = 0; class < DNET_IO_REQ_CACHE_CLASSES; ++class) {
+		if (size <= dnet_io_req_cache_sizes[class])
 			break;
+	}
 
-		dnet_trans_put(t);
-		dnet_trans_put(t);
-		num++;
+	if (class < DNET_IO_REQ_CACHE_CLASSES) {
+		c = &dnet_io_req_cache[class];
+		if (c->head) {
+			r = c->head;
+			c->head = *(void **)r;
+			c->num--;
+		} else {
+			r = malloc(dnet_io_req_cache_sizes[class]);
+		}
+	} else {
+		r = malloc(size);
 	}
 
-	dnet_log(st->n, DNET_LOG_NOTICE, "Cleaned state %s, transactions freed: %d\n", dnet_state_dump_addr(st), num);
+	if (!r)
+		return NULL;
+
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->alloc_class = class;
+
+	return r;
+}
+
+void dnet_io_req_cache_cleanup(void)
+{
+	struct dnet_io_req_cache *c;
+	void *p;
+	int class;
+
+	for (class = 0; class < DNET_IO_REQ_CACHE_CLASSES; ++class) {
+		c = &dnet_io_req_cache[class];
+
+		while (c->head) {
+			p = c->head;
+			c->head = *(void **)p;
+			free(p);
+		}
+		c->num = 0;
+	}
+}
+
+#ifdef HAVE_LZ4_SUPPORT
+/* payloads below this are not worth the lz4 call and the body prefix */
+#define DNET_LZ4_MIN_SIZE	512
+
+/*
+ * Checks whether the packet payload should be considered for wire
+ * compression: IO commands whose attribute header asks the backend to
+ * compress the data (DNET_IO_FLAGS_COMPRESS) carry already-compressed
+ * bytes, recompressing them wastes the idle CPU the feature is meant to
+ * spend. The attribute sits either in the header tail or at the start of
+ * the payload depending on the sender, both are in wire order.
+ */
+static int dnet_wire_compressible(struct dnet_io_req *orig)
+{
+	struct dnet_cmd *cmd = orig->header;
+	struct dnet_io_attr *io = NULL;
+	int c = dnet_bswap32(cmd->cmd);
+
+	if (c != DNET_CMD_READ && c != DNET_CMD_WRITE)
+		return 1;
+
+	if (orig->hsize >= sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr))
+		io = orig->header + sizeof(struct dnet_cmd);
+	else if (orig->dsize >= sizeof(struct dnet_io_attr))
+		io = orig->data;
+
+	if (io && (dnet_bswap32(io->flags) & DNET_IO_FLAGS_COMPRESS))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Compresses the in-memory payload of @orig into a malloc'ed body laid
+ * out as struct dnet_lz4_hdr, the attribute headers beyond struct
+ * dnet_cmd kept raw and one LZ4 block. Fills @creq/@ccmd describing the
+ * compressed packet - the caller's request and header are not touched.
+ * Returns NULL when compression fails or does not shrink the payload,
+ * the packet then goes out unmodified.
+ */
+static void *dnet_wire_compress(struct dnet_io_req *orig, struct dnet_io_req *creq, struct dnet_cmd *ccmd)
+{
+	struct dnet_cmd *cmd = orig->header;
+	struct dnet_lz4_hdr hdr;
+	uint64_t raw_size = orig->hsize - sizeof(struct dnet_cmd);
+	uint64_t flags;
+	void *buf;
+	int bound, csize;
+
+	bound = LZ4_compressBound(orig->dsize);
+	if (bound <= 0)
+		return NULL;
+
+	buf = malloc(sizeof(hdr) + raw_size + bound);
+	if (!buf)
+		return NULL;
+
+	csize = LZ4_compress_default(orig->data, buf + sizeof(hdr) + raw_size, orig->dsize, bound);
+	if (csize <= 0 || sizeof(hdr) + (uint64_t)csize >= orig->dsize) {
+		free(buf);
+		return NULL;
+	}
+
+	hdr.orig_size = orig->dsize;
+	hdr.raw_size = raw_size;
+	dnet_convert_lz4_hdr(&hdr);
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), orig->header + sizeof(struct dnet_cmd), raw_size);
+
+	/* @orig->header is already in wire order, rewrite the copy in kind */
+	memcpy(ccmd, cmd, sizeof(struct dnet_cmd));
+	ccmd->size = dnet_bswap64(sizeof(hdr) + raw_size + csize);
+	flags = dnet_bswap64(ccmd->flags);
+	ccmd->flags = dnet_bswap64(flags | DNET_FLAGS_LZ4);
+
+	memset(creq, 0, sizeof(struct dnet_io_req));
+	creq->header = ccmd;
+	creq->hsize = sizeof(struct dnet_cmd);
+	creq->data = buf;
+	creq->dsize = sizeof(hdr) + raw_size + csize;
+	creq->fd = -1;
+
+	return buf;
 }
+#endif /* HAVE_LZ4_SUPPORT */
 
 /*
  * Eventually we may end up with proper reference counters here, but for now let's just copy the whole buf.
@@ -280,19 +448,79 @@ void dnet_state_clean(struct dnet_net_state *st)
 static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig)
 {
 	void *buf;
+#ifdef HAVE_LZ4_SUPPORT
+	struct dnet_io_req creq;
+	struct dnet_cmd ccmd;
+#endif
+	void *cbuf = NULL;
 	struct dnet_io_req *r;
 	int offset = 0;
 	int err = 0;
+	int i;
 
-	buf = r = malloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize);
+#ifdef HAVE_LZ4_SUPPORT
+	/*
+	 * LZ4 wire compression was negotiated on this connection. Only plain
+	 * in-memory payloads are considered: sendfile and scatter-gather
+	 * fragments are served zero-copy and would have to be pulled into
+	 * memory first. A packet whose compressed body would not be smaller
+	 * goes out unmodified - the flag in the header tells the receiver
+	 * which case it got.
+	 */
+	if (st->lz4 && orig->header && orig->hsize >= sizeof(struct dnet_cmd) &&
+			orig->data && orig->dsize >= DNET_LZ4_MIN_SIZE &&
+			orig->fd < 0 && !orig->iov_num &&
+			dnet_wire_compressible(orig)) {
+		cbuf = dnet_wire_compress(orig, &creq, &ccmd);
+		if (cbuf)
+			orig = &creq;
+	}
+#endif
+
+	buf = r = dnet_io_req_alloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize +
+			(st->compact ? sizeof(uint32_t) : 0) +
+			orig->iov_num * sizeof(struct iovec));
 	if (!r) {
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
-	memset(r, 0, sizeof(struct dnet_io_req));
 	r->fd = -1;
 
-	if (orig->header && orig->hsize) {
+	if (st->compact) {
+		/*
+		 * Compact framing was negotiated on this connection: every
+		 * packet starts with a frame tag, bare reply headers are
+		 * shrunk to struct dnet_cmd_compact - the peer restores the
+		 * elided ID from the transaction it matches the reply
+		 * against. @orig->header is already in wire order, so the
+		 * surviving fields are copied as-is.
+		 */
+		struct dnet_cmd *cmd = orig->header;
+		uint32_t frame = DNET_FRAME_FULL;
+
+		r->header = buf + sizeof(struct dnet_io_req);
+		r->hsize = sizeof(uint32_t);
+
+		if (cmd && orig->hsize == sizeof(struct dnet_cmd) &&
+				(dnet_bswap64(cmd->trans) & DNET_TRANS_REPLY)) {
+			struct dnet_cmd_compact *cc = r->header + sizeof(uint32_t);
+
+			frame = DNET_FRAME_COMPACT;
+			cc->status = cmd->status;
+			cc->cmd = cmd->cmd;
+			cc->flags = cmd->flags;
+			cc->trans = cmd->trans;
+			cc->size = cmd->size;
+
+			r->hsize += sizeof(struct dnet_cmd_compact);
+		} else if (cmd && orig->hsize) {
+			memcpy(r->header + sizeof(uint32_t), orig->header, orig->hsize);
+			r->hsize += orig->hsize;
+		}
+
+		*(uint32_t *)r->header = dnet_bswap32(frame);
+		offset = r->hsize;
+	} else if (orig->header && orig->hsize) {
 		r->header = buf + sizeof(struct dnet_io_req);
 		r->hsize = orig->hsize;
 
@@ -308,6 +536,22 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		memcpy(r->data, orig->data, r->dsize);
 	}
 
+	/*
+	 * Scatter-gather payload is not copied - only the fragment vector is,
+	 * fragments themselves stay referenced until @iov_free releases them.
+	 */
+	if (orig->iov && orig->iov_num) {
+		r->iov = buf + sizeof(struct dnet_io_req) + offset;
+		r->iov_num = orig->iov_num;
+		memcpy(r->iov, orig->iov, orig->iov_num * sizeof(struct iovec));
+
+		for (i = 0; i < r->iov_num; ++i)
+			r->isize += r->iov[i].iov_len;
+
+		r->iov_free = orig->iov_free;
+		r->iov_priv = orig->iov_priv;
+	}
+
 	if (orig->fd >= 0 && orig->fsize) {
 		r->fd = orig->fd;
 		r->on_exit = orig->on_exit;
@@ -315,25 +559,48 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		r->fsize = orig->fsize;
 	}
 
-	pthread_mutex_lock(&st->send_lock);
-	list_add_tail(&r->req_entry, &st->send_list);
+	/*
+	 * Wait-free enqueue: push onto the state's MPSC inbox, only the
+	 * network thread pops. EPOLLOUT is armed just once per empty ->
+	 * non-empty transition: whoever wins the send_armed flag does it,
+	 * the network thread re-checks the inbox after dropping the flag,
+	 * so a concurrent push can not get lost.
+	 */
+	do {
+		r->inbox_next = st->send_inbox;
+	} while (!__sync_bool_compare_and_swap(&st->send_inbox, r->inbox_next, r));
 
-	if (!st->need_exit)
+	if (!st->need_exit && __sync_bool_compare_and_swap(&st->send_armed, 0, 1))
 		dnet_schedule_send(st);
-	pthread_mutex_unlock(&st->send_lock);
 
 err_out_exit:
+	/* the compressed body, if any, was copied into @r above */
+	free(cbuf);
 	return err;
 }
 
 void dnet_io_req_free(struct dnet_io_req *r)
 {
+	if (r->iov_free)
+		r->iov_free(r->iov_priv);
 	if (r->fd >= 0 && r->fsize) {
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CACHE_FORGET)
 			posix_fadvise(r->fd, r->local_offset, r->fsize, POSIX_FADV_DONTNEED);
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CLOSE)
 			close(r->fd);
 	}
+
+	if (r->alloc_class < DNET_IO_REQ_CACHE_CLASSES) {
+		struct dnet_io_req_cache *c = &dnet_io_req_cache[r->alloc_class];
+
+		if (c->num < DNET_IO_REQ_CACHE_DEPTH) {
+			*(void **)r = c->head;
+			c->head = r;
+			c->num++;
+			return;
+		}
+	}
+
 	free(r);
 }
 
@@ -445,12 +712,117 @@ ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize,
 	return dnet_io_req_queue(st, &r);
 }
 
+/*
+ * Sends scatter-gather fragments starting at @offset bytes into the vector.
+ * Builds partial copy of the head fragment when @offset falls in the middle
+ * of it, never coalesces fragment payload.
+ */
+static ssize_t dnet_send_iov_nolock(struct dnet_net_state *st, struct iovec *iov, int iov_num, size_t offset)
+{
+	struct iovec vec[UIO_MAXIOV];
+	ssize_t err = 0;
+	size_t skip = offset;
+	int i, num;
+
+	while (1) {
+		num = 0;
+
+		for (i = 0; (i < iov_num) && (num < UIO_MAXIOV); ++i) {
+			if (skip >= iov[i].iov_len) {
+				skip -= iov[i].iov_len;
+				continue;
+			}
+
+			vec[num].iov_base = iov[i].iov_base + skip;
+			vec[num].iov_len = iov[i].iov_len - skip;
+			skip = 0;
+			num++;
+		}
+
+		if (!num)
+			break;
+
+		err = writev(st->write_s, vec, num);
+		if (err < 0) {
+			err = -errno;
+			if (err != -EAGAIN)
+				dnet_log_err(st->n, "Failed to send iov: fragments: %d, socket: %d",
+						iov_num, st->write_s);
+			break;
+		}
+
+		if (err == 0) {
+			dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n",
+					dnet_state_dump_addr(st), st->write_s);
+			err = -ECONNRESET;
+			break;
+		}
+
+		offset += err;
+		skip = offset;
+		st->send_offset += err;
+		err = 0;
+	}
+
+	return err;
+}
+
+ssize_t dnet_send_data_iov(struct dnet_net_state *st, void *header, uint64_t hsize,
+		const struct iovec *iov, int iov_num, void (* iov_free)(void *iov_priv), void *iov_priv)
+{
+	struct dnet_io_req r;
+
+	memset(&r, 0, sizeof(r));
+	r.header = header;
+	r.hsize = hsize;
+	r.iov = (struct iovec *)iov;
+	r.iov_num = iov_num;
+	r.iov_free = iov_free;
+	r.iov_priv = iov_priv;
+	r.fd = -1;
+
+	return dnet_io_req_queue(st, &r);
+}
+
+/* Chunking limits for large file transfers */
+#define DNET_SEND_FD_CHUNK		(1024 * 1024)
+#define DNET_SEND_FD_READAHEAD		(4 * 1024 * 1024)
+
 static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t offset, uint64_t dsize)
 {
 	ssize_t err;
+	uint64_t sent = 0;
+	uint64_t chunk, window;
 
+	/*
+	 * Large transfers go in bounded chunks with readahead kicked off one
+	 * window ahead of the send position, so the disk read of the next
+	 * window overlaps the socket send of the current one. After a full
+	 * chunk control returns to the event loop (EPOLLOUT stays armed,
+	 * level-triggered epoll re-fires immediately), so one multi-GB read
+	 * does not head-of-line block other replies on this thread.
+	 */
 	while (dsize) {
-		err = dnet_sendfile(st, fd, &offset, dsize);
+		chunk = dsize;
+		if (chunk > DNET_SEND_FD_CHUNK)
+			chunk = DNET_SEND_FD_CHUNK;
+
+		if (dsize > chunk) {
+			window = dsize - chunk;
+			if (window > DNET_SEND_FD_READAHEAD)
+				window = DNET_SEND_FD_READAHEAD;
+			posix_fadvise(fd, offset + chunk, window, POSIX_FADV_WILLNEED);
+		}
+
+		err = dnet_sendfile(st, fd, &offset, chunk);
+		if (err == -EINVAL || err == -ENOSYS) {
+			/*
+			 * sendfile() refuses some descriptors (for example
+			 * O_DIRECT files on older kernels) - retry through
+			 * splice() via per-state pipe
+			 */
+			err = dnet_splicefile(st, fd, &offset, chunk);
+		}
 		if (err < 0)
 			break;
 		if (err == 0) {
@@ -461,8 +833,15 @@ static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t o
 		}
 
 		dsize -= err;
+		sent += err;
 		st->send_offset += err;
 		err = 0;
+
+		/* yield to the event loop between chunks of a large transfer */
+		if (dsize && sent >= DNET_SEND_FD_CHUNK) {
+			err = -EAGAIN;
+			break;
+		}
 	}
 
 	return err;
@@ -493,18 +872,33 @@ static void dnet_trans_timestamp(struct dnet_net_state *st, struct dnet_trans *t
 	t->time.tv_sec += wait_ts->tv_sec;
 	t->time.tv_usec += wait_ts->tv_nsec / 1000;
 
-	list_move_tail(&t->trans_list_entry, &st->trans_list);
+	list_move_tail(&t->trans_list_entry, dnet_trans_wheel_slot(st->trans_wheel, t->time.tv_sec));
 }
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
 {
-	struct dnet_net_state *st = req->st;
+	struct dnet_net_state *st;
 	int err;
 
+	/*
+	 * Client states may own several connections to the peer - spread
+	 * transactions over them. The transaction is tracked on the state
+	 * which actually carries it, so the reply lookup finds it in the
+	 * hash of the receiving connection.
+	 */
+	st = dnet_state_select_connection(req->st, dnet_io_req_total_size(req));
+	if (st != req->st) {
+		req->st = st;
+		if (t->st) {
+			dnet_state_put(t->st);
+			t->st = dnet_state_get(st);
+		}
+	}
+
 	dnet_trans_get(t);
 
 	pthread_mutex_lock(&st->trans_lock);
-	err = dnet_trans_insert_nolock(&st->trans_root, t);
+	err = dnet_trans_insert_nolock(st->trans_hash, t);
 	if (!err)
 		dnet_trans_timestamp(st, t);
 	pthread_mutex_unlock(&st->trans_lock);
@@ -576,7 +970,13 @@ err_out_exit:
 	return NULL;
 }
 
-int dnet_add_reconnect_state(struct dnet_node *n, struct dnet_addr *addr, unsigned int join_state)
+/*
+ * @interval is the backoff interval (seconds) the failed attempt ran with:
+ * 0 for a freshly dead address, the next attempt is then scheduled
+ * immediately. A small random jitter is added so a batch of addresses
+ * which died together does not produce reconnect herds on every retry.
+ */
+int dnet_add_reconnect_state(struct dnet_node *n, struct dnet_addr *addr, unsigned int join_state, int interval)
 {
 	struct dnet_addr_storage *a, *it;
 	int err = 0;
@@ -597,6 +997,9 @@ int dnet_add_reconnect_state(struct dnet_node *n, struct dnet_addr *addr, unsign
 
 	memcpy(&a->addr, addr, sizeof(struct dnet_addr));
 	a->__join_state = join_state;
+	a->reconnect_time = interval;
+	a->reconnect_time_max = DNET_RECONNECT_MAX_INTERVAL;
+	a->reconnect_ts = time(NULL) + interval + (interval ? rand() % interval : 0);
 
 	pthread_mutex_lock(&n->reconnect_lock);
 	list_for_each_entry(it, &n->reconnect_list, reconnect_entry) {
@@ -609,19 +1012,49 @@ int dnet_add_reconnect_state(struct dnet_node *n, struct dnet_addr *addr, unsign
 	}
 
 	if (!err) {
-		dnet_log(n, DNET_LOG_INFO, "Added reconnection addr: %s, join state: 0x%x.\n",
-			dnet_server_convert_dnet_addr(&a->addr), join_state);
+		dnet_log(n, DNET_LOG_INFO, "Added reconnection addr: %s, join state: 0x%x, interval: %d.\n",
+			dnet_server_convert_dnet_addr(&a->addr), join_state, interval);
 		list_add_tail(&a->reconnect_entry, &n->reconnect_list);
 	}
 	pthread_mutex_unlock(&n->reconnect_lock);
 
 	if (err)
 		free(a);
+	else
+		pthread_cond_broadcast(&n->reconnect_cond);
 
 out_exit:
 	return err;
 }
 
+/*
+ * Called when a route list reply mentions @addr: somebody talks about the
+ * peer again, so drop its backoff and retry right away instead of waiting
+ * out the remaining (possibly minute-long) interval.
+ */
+void dnet_reconnect_hint(struct dnet_node *n, struct dnet_addr *addr)
+{
+	struct dnet_addr_storage *it;
+	int found = 0;
+
+	pthread_mutex_lock(&n->reconnect_lock);
+	list_for_each_entry(it, &n->reconnect_list, reconnect_entry) {
+		if (!memcmp(&it->addr, addr, sizeof(struct dnet_addr))) {
+			it->reconnect_time = 0;
+			it->reconnect_ts = 0;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&n->reconnect_lock);
+
+	if (found) {
+		dnet_log(n, DNET_LOG_INFO, "Reconnect hint for %s: rescheduled immediately.\n",
+				dnet_server_convert_dnet_addr(addr));
+		pthread_cond_broadcast(&n->reconnect_cond);
+	}
+}
+
 static int dnet_trans_complete_forward(struct dnet_net_state *state __unused, struct dnet_cmd *cmd, void *priv)
 {
 	struct dnet_trans *t = priv;
@@ -676,6 +1109,42 @@ static int dnet_trans_forward(struct dnet_trans *t, struct dnet_io_req *r,
 	return dnet_trans_send(t, r);
 }
 
+/*
+ * Strips the trace annex off the final ack of a traced transaction and
+ * logs the server-side spans together with the client-side round trip.
+ * Runs before the completion callback, so command parsers never see the
+ * annex. Forwarded transactions are not touched - the annex travels
+ * through to the node which originated the trace.
+ */
+static void dnet_trans_process_trace(struct dnet_net_state *st, struct dnet_trans *t,
+		struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_trace_annex *a;
+	struct timeval tv;
+	long total;
+
+	cmd->flags &= ~DNET_FLAGS_TRACE_ANNEX;
+
+	if (cmd->size < sizeof(struct dnet_trace_annex))
+		return;
+
+	cmd->size -= sizeof(struct dnet_trace_annex);
+	a = (struct dnet_trace_annex *)((char *)data + cmd->size);
+	dnet_convert_trace_annex(a);
+
+	gettimeofday(&tv, NULL);
+	total = 1000000 * (tv.tv_sec - t->start.tv_sec) + (tv.tv_usec - t->start.tv_usec);
+
+	dnet_log(st->n, DNET_LOG_INFO, "%s: %s: trace 0x%x: trans: %llu, total: %ld usecs, "
+			"queue: %llu, dispatch: %llu, backend: %llu, network+client: %ld usecs\n",
+			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), cmd->id.trace_id,
+			(unsigned long long)(cmd->trans & ~DNET_TRANS_REPLY), total,
+			(unsigned long long)(a->dequeue_time - a->queue_time),
+			(unsigned long long)(a->proc_time - a->dequeue_time),
+			(unsigned long long)(a->send_time - a->proc_time),
+			total - (long)(a->send_time - a->queue_time));
+}
+
 int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 {
 	int err = 0;
@@ -688,10 +1157,10 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 		uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
 
 		pthread_mutex_lock(&st->trans_lock);
-		t = dnet_trans_search(&st->trans_root, tid);
+		t = dnet_trans_search(st->trans_hash, tid);
 		if (t) {
 			if (!(cmd->flags & DNET_FLAGS_MORE)) {
-				dnet_trans_remove_nolock(&st->trans_root, t);
+				dnet_trans_remove_nolock(t);
 			} else {
 				dnet_trans_timestamp(st, t);
 			}
@@ -712,6 +1181,20 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 			goto err_out_exit;
 		}
 
+		/*
+		 * Compact reply header arrived without the ID - restore it
+		 * from the original command kept in the transaction, so
+		 * completion handlers see the same header as with full
+		 * framing.
+		 */
+		if (cmd->flags & DNET_FLAGS_COMPACT) {
+			memcpy(&cmd->id, &t->cmd.id, sizeof(struct dnet_id));
+			cmd->flags &= ~DNET_FLAGS_COMPACT;
+		}
+
+		if ((cmd->flags & DNET_FLAGS_TRACE_ANNEX) && !t->orig)
+			dnet_trans_process_trace(st, t, cmd, r->data);
+
 		if (t->complete)
 			t->complete(t->st, cmd, t->priv);
 
@@ -784,6 +1267,8 @@ static void dnet_state_remove(struct dnet_net_state *st)
 	pthread_mutex_lock(&n->state_lock);
 	dnet_state_remove_nolock(st);
 	pthread_mutex_unlock(&n->state_lock);
+
+	dnet_route_update(n);
 }
 
 static void dnet_state_remove_and_shutdown(struct dnet_net_state *st, int error)
@@ -828,6 +1313,8 @@ void dnet_state_reset(struct dnet_net_state *st, int error)
 	dnet_state_reset_nolock_noclean(st, error, &head);
 	pthread_mutex_unlock(&st->n->state_lock);
 
+	dnet_route_update(st->n);
+
 	dnet_trans_clean_list(&head);
 }
 
@@ -873,6 +1360,7 @@ int dnet_setup_control_nolock(struct dnet_net_state *st)
 		if (++io->net_thread_pos >= io->net_thread_num)
 			io->net_thread_pos = 0;
 		st->epoll_fd = io->net[pos].epoll_fd;
+		st->nio = &io->net[pos];
 
 		err = dnet_schedule_recv(st);
 		if (err)
@@ -943,6 +1431,7 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 		int (* process)(struct dnet_net_state *st, struct epoll_event *ev))
 {
 	int err = 0;
+	int i;
 
 	st->n = n;
 
@@ -951,23 +1440,41 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	st->la = 1;
 	st->weight = DNET_STATE_MAX_WEIGHT / 2;
 	st->median_read_time = 1000; /* useconds for start */
+	st->rtt_smoothed = 0; /* no samples yet - dnet_mix_states() falls back to @weight */
+	st->rtt_variance = 0;
+	st->error_rate = 0;
+	st->place_factor = 1.0; /* neutral until the first placement stat arrives */
 
 	INIT_LIST_HEAD(&st->state_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
 
-	st->trans_root = RB_ROOT;
-	INIT_LIST_HEAD(&st->trans_list);
+	st->trans_hash = malloc(sizeof(struct list_head) * (DNET_TRANS_HASH_SIZE + DNET_TRANS_WHEEL_SIZE));
+	if (!st->trans_hash) {
+		err = -ENOMEM;
+		goto err_out;
+	}
+	for (i = 0; i < DNET_TRANS_HASH_SIZE; ++i)
+		INIT_LIST_HEAD(&st->trans_hash[i]);
+
+	st->trans_wheel = st->trans_hash + DNET_TRANS_HASH_SIZE;
+	for (i = 0; i < DNET_TRANS_WHEEL_SIZE; ++i)
+		INIT_LIST_HEAD(&st->trans_wheel[i]);
+	/* zero tick forces full wheel sweep on the first stall check */
+	st->trans_wheel_tick = 0;
 
 	st->epoll_fd = -1;
+	st->splice_pipe[0] = st->splice_pipe[1] = -1;
 
 	err = pthread_mutex_init(&st->trans_lock, NULL);
 	if (err) {
 		err = -err;
 		dnet_log_err(n, "Failed to initialize transaction mutex: %d", err);
-		goto err_out;
+		goto err_out_hash_free;
 	}
 
 	INIT_LIST_HEAD(&st->send_list);
+	st->send_inbox = NULL;
+	st->send_armed = 0;
 	err = pthread_mutex_init(&st->send_lock, NULL);
 	if (err) {
 		err = -err;
@@ -996,6 +1503,9 @@ err_out_send_destroy:
 	pthread_mutex_destroy(&st->send_lock);
 err_out_trans_destroy:
 	pthread_mutex_destroy(&st->trans_lock);
+err_out_hash_free:
+	free(st->trans_hash);
+	st->trans_hash = NULL;
 err_out:
 	dnet_sock_close(st->write_s);
 
@@ -1004,7 +1514,7 @@ err_out:
 
 struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		int group_id, struct dnet_raw_id *ids, int id_num,
-		struct dnet_addr *addr, int s, int *errp, int join, int idx,
+		struct dnet_addr *addr, int s, int *errp, int join, int idx, int caps,
 		int (* process)(struct dnet_net_state *st, struct epoll_event *ev))
 {
 	int err = -ENOMEM;
@@ -1026,6 +1536,13 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 	memset(st, 0, sizeof(struct dnet_net_state));
 
 	st->idx = idx;
+	/*
+	 * Must be set before the state is published in the route table:
+	 * once visible, other threads may send over it and the peer
+	 * already expects the negotiated framing.
+	 */
+	st->compact = !!(caps & DNET_CAPABILITIES_COMPACT);
+	st->lz4 = !!(caps & DNET_CAPABILITIES_LZ4);
 	st->read_s = s;
 	st->write_s = dup(s);
 	if (st->write_s < 0) {
@@ -1124,6 +1641,80 @@ err_out_exit:
 	return NULL;
 }
 
+/*
+ * Requests at least this large prefer the dedicated bulk connection,
+ * see dnet_state_select_connection().
+ */
+#define DNET_SIBLING_BULK_SIZE		(1024 * 1024)
+
+int dnet_state_open_connections(struct dnet_net_state *st, int num)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_net_state *sib;
+	int i, s, err = -ENOMEM;
+
+	if (num <= 1)
+		return 0;
+
+	st->siblings = malloc((num - 1) * sizeof(struct dnet_net_state *));
+	if (!st->siblings)
+		return -ENOMEM;
+	memset(st->siblings, 0, (num - 1) * sizeof(struct dnet_net_state *));
+
+	for (i = 0; i < num - 1; ++i) {
+		s = dnet_socket_create_addr(n, &st->addr, 0);
+		if (s < 0) {
+			err = s;
+			break;
+		}
+
+		/* empty state: no route table entries, created only to carry transactions */
+		sib = dnet_state_create(n, 0, NULL, 0, &st->addr, s, &err, 0, st->idx, 0, dnet_state_net_process);
+		if (!sib)
+			break;
+
+		st->siblings[st->sibling_num++] = dnet_state_get(sib);
+	}
+
+	if (st->sibling_num) {
+		dnet_log(n, DNET_LOG_INFO, "%s: opened %d extra connection(s).\n",
+				dnet_state_dump_addr(st), st->sibling_num);
+		return 0;
+	}
+
+	free(st->siblings);
+	st->siblings = NULL;
+	return err;
+}
+
+struct dnet_net_state *dnet_state_select_connection(struct dnet_net_state *st, uint64_t size)
+{
+	struct dnet_net_state *sel;
+	int num = st->sibling_num;
+	int lanes, pos;
+
+	if (!num)
+		return st;
+
+	if (size >= DNET_SIBLING_BULK_SIZE) {
+		sel = st->siblings[num - 1];
+		return sel->need_exit ? st : sel;
+	}
+
+	/*
+	 * When there is more than one extra connection, the last one is left
+	 * to bulk transfers and small transactions rotate over the rest.
+	 */
+	lanes = (num > 1) ? (num - 1) : num;
+
+	pos = (int)((unsigned long)atomic_inc(&st->sibling_seq) % (unsigned)(lanes + 1));
+	if (pos == 0)
+		return st;
+
+	sel = st->siblings[pos - 1];
+	return sel->need_exit ? st : sel;
+}
+
 int dnet_state_num(struct dnet_session *s)
 {
 	struct dnet_node *n = s->node;
@@ -1144,22 +1735,44 @@ int dnet_state_num(struct dnet_session *s)
 static void dnet_state_send_clean(struct dnet_net_state *st)
 {
 	struct dnet_io_req *r, *tmp;
+	struct dnet_io_req *inbox;
 
 	list_for_each_entry_safe(r, tmp, &st->send_list, req_entry) {
 		list_del(&r->req_entry);
 		dnet_io_req_free(r);
 	}
+
+	/* nobody can push anymore - the state is being destroyed */
+	inbox = __sync_lock_test_and_set(&st->send_inbox, NULL);
+	while (inbox) {
+		r = inbox;
+		inbox = r->inbox_next;
+		dnet_io_req_free(r);
+	}
 }
 
 void dnet_state_destroy(struct dnet_net_state *st)
 {
+	int i;
+
 	dnet_state_remove(st);
 
+	if (st->siblings) {
+		for (i = 0; i < st->sibling_num; ++i)
+			dnet_state_put(st->siblings[i]);
+		free(st->siblings);
+	}
+
 	if (st->read_s >= 0) {
 		dnet_sock_close(st->read_s);
 		dnet_sock_close(st->write_s);
 	}
 
+	if (st->splice_pipe[0] >= 0) {
+		close(st->splice_pipe[0]);
+		close(st->splice_pipe[1]);
+	}
+
 	dnet_state_clean(st);
 
 	dnet_state_send_clean(st);
@@ -1167,6 +1780,8 @@ void dnet_state_destroy(struct dnet_net_state *st)
 	pthread_mutex_destroy(&st->send_lock);
 	pthread_mutex_destroy(&st->trans_lock);
 
+	free(st->trans_hash);
+
 	dnet_log(st->n, DNET_LOG_NOTICE, "Freeing state %s, socket: %d/%d, addr-num: %d.\n",
 		dnet_server_convert_dnet_addr(&st->addr), st->read_s, st->write_s, st->addr_num);
 
@@ -1252,12 +1867,79 @@ int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int
 	return err;
 }
 
+int dnet_send_reply_iov(void *state, struct dnet_cmd *cmd, const struct iovec *iov, int iov_num,
+		int more, void (* iov_free)(void *iov_priv), void *iov_priv)
+{
+	struct dnet_net_state *st = state;
+	struct dnet_cmd c;
+	uint64_t size = 0;
+	int i;
+
+	if (st == st->n->st)
+		return 0;
+
+	for (i = 0; i < iov_num; ++i)
+		size += iov[i].iov_len;
+
+	c = *cmd;
+
+	if ((cmd->flags & DNET_FLAGS_NEED_ACK) || more)
+		c.flags |= DNET_FLAGS_MORE;
+
+	c.size = size;
+	c.trans |= DNET_TRANS_REPLY;
+
+	dnet_log(st->n, DNET_LOG_NOTICE, "%s: %s: reply-iov -> %s: trans: %lld, size: %llu, fragments: %d, cflags: 0x%llx.\n",
+		dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
+		(unsigned long long)(c.trans &~ DNET_TRANS_REPLY),
+		(unsigned long long)size, iov_num, (unsigned long long)c.flags);
+
+	dnet_convert_cmd(&c);
+
+	return dnet_send_data_iov(st, &c, sizeof(struct dnet_cmd), iov, iov_num, iov_free, iov_priv);
+}
+
+/*
+ * With compact framing the header buffer starts with a frame tag and reply
+ * headers are struct dnet_cmd_compact, so the debug logging has to peel the
+ * frame before interpreting the bytes. Fields are logged in wire order just
+ * like the full-header variant below.
+ */
+static void dnet_send_request_log(struct dnet_net_state *st, struct dnet_io_req *r, const char *stage)
+{
+	struct dnet_cmd *cmd = r->header;
+
+	if (st->compact && r->header) {
+		if (dnet_bswap32(*(uint32_t *)r->header) == DNET_FRAME_COMPACT) {
+			struct dnet_cmd_compact *cc = r->header + sizeof(uint32_t);
+
+			dnet_log(st->n, DNET_LOG_DEBUG, "%s: sending compact -> %s: trans: %lld, size: %llu, cflags: 0x%llx, %s: %zd/%zd.\n",
+				dnet_cmd_string(cc->cmd), dnet_server_convert_dnet_addr(&st->addr),
+				(unsigned long long)(cc->trans &~ DNET_TRANS_REPLY),
+				(unsigned long long)cc->size, (unsigned long long)cc->flags,
+				stage, st->send_offset, dnet_io_req_total_size(r));
+			return;
+		}
+
+		cmd = (r->hsize > sizeof(uint32_t)) ? r->header + sizeof(uint32_t) : NULL;
+	}
+
+	if (!cmd)
+		cmd = r->data;
+
+	dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: sending -> %s: trans: %lld, size: %llu, cflags: 0x%llx, %s: %zd/%zd.\n",
+		dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
+		(unsigned long long)(cmd->trans &~ DNET_TRANS_REPLY),
+		(unsigned long long)cmd->size, (unsigned long long)cmd->flags,
+		stage, st->send_offset, dnet_io_req_total_size(r));
+}
+
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 {
 	int cork;
 	int err = 0;
 	size_t offset = st->send_offset;
-	size_t total_size = r->dsize + r->hsize + r->fsize;
+	size_t total_size = dnet_io_req_total_size(r);
 
 	if (total_size > sizeof(struct dnet_cmd)) {
 		/* Use TCP_CORK to send headers and packet body in one piece */
@@ -1265,16 +1947,7 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
 	}
 
-	if (1) {
-		struct dnet_cmd *cmd = r->header;
-		if (!cmd)
-			cmd = r->data;
-		dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: sending -> %s: trans: %lld, size: %llu, cflags: 0x%llx, start-sent: %zd/%zd.\n",
-			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
-			(unsigned long long)(cmd->trans &~ DNET_TRANS_REPLY),
-			(unsigned long long)cmd->size, (unsigned long long)cmd->flags,
-			st->send_offset, r->dsize + r->hsize + r->fsize);
-	}
+	dnet_send_request_log(st, r, "start-sent");
 
 	if (r->hsize && r->header && st->send_offset < r->hsize) {
 		err = dnet_send_nolock(st, r->header + offset, r->hsize - offset);
@@ -1289,19 +1962,26 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 			goto err_out_exit;
 	}
 
-	if (r->fd >= 0 && r->fsize && st->send_offset < (r->dsize + r->hsize + r->fsize)) {
-		offset = st->send_offset - r->dsize - r->hsize;
+	if (r->iov && r->isize && st->send_offset < (r->hsize + r->dsize + r->isize)) {
+		offset = st->send_offset - r->hsize - r->dsize;
+		err = dnet_send_iov_nolock(st, r->iov, r->iov_num, offset);
+		if (err)
+			goto err_out_exit;
+	}
+
+	if (r->fd >= 0 && r->fsize && st->send_offset < dnet_io_req_total_size(r)) {
+		offset = st->send_offset - r->dsize - r->hsize - r->isize;
 		err = dnet_send_fd_nolock(st, r->fd, r->local_offset + offset, r->fsize - offset);
 		if (err)
 			goto err_out_exit;
 	}
 
-	if (r->hsize > sizeof(struct dnet_cmd)) {
-		struct dnet_cmd *cmd = r->header;
+	if (r->hsize > sizeof(struct dnet_cmd) + (st->compact ? sizeof(uint32_t) : 0)) {
+		struct dnet_cmd *cmd = r->header + (st->compact ? sizeof(uint32_t) : 0);
 		int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
 
 		dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: SENT %s cmd: %s: cmd-size: %llu, nonblocking: %d\n",
-			dnet_state_dump_addr(st), dnet_dump_id(r->header),
+			dnet_state_dump_addr(st), dnet_dump_id(&cmd->id),
 			nonblocking ? "nonblocking" : "blocking",
 			dnet_cmd_string(cmd->cmd),
 			(unsigned long long)cmd->size, nonblocking);
@@ -1309,16 +1989,7 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 
 err_out_exit:
 
-	if (1) {
-		struct dnet_cmd *cmd = r->header;
-		if (!cmd)
-			cmd = r->data;
-		dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: sending -> %s: trans: %lld, size: %llu, cflags: 0x%llx, finish-sent: %zd/%zd.\n",
-			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
-			(unsigned long long)(cmd->trans &~ DNET_TRANS_REPLY),
-			(unsigned long long)cmd->size, (unsigned long long)cmd->flags,
-			st->send_offset, r->dsize + r->hsize + r->fsize);
-	}
+	dnet_send_request_log(st, r, "finish-sent");
 
 	if (err && err != -EAGAIN) {
 		dnet_log(st->n, DNET_LOG_ERROR, "%s: setting send need_exit to %d\n", dnet_state_dump_addr(st), err);
@@ -1334,11 +2005,10 @@ err_out_exit:
 	 * Flush TCP output pipeline if we've sent whole request.
 	 *
 	 * We do not destroy request here, it is postponed to caller.
-	 * Function can be called without lock - default call path from network processing thread and dnet_process_send_single()
-	 * or under st->send_lock, if queue was empty and dnet_send*() caller directly invoked this function from dnet_io_req_queue()
-	 * instead of queueing.
+	 * Only the network processing thread owning the state calls this -
+	 * via dnet_process_send_single() - so no locking is needed.
 	 */
-	if (st->send_offset == r->dsize + r->hsize + r->fsize) {
+	if (st->send_offset == dnet_io_req_total_size(r)) {
 		int nodelay = 1;
 		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
 	}
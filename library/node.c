@@ -27,7 +27,7 @@
 static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 {
 	struct dnet_node *n;
-	int err;
+	int err, i;
 
 	n = malloc(sizeof(struct dnet_node));
 	if (!n)
@@ -36,6 +36,7 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 	memset(n, 0, sizeof(struct dnet_node));
 
 	atomic_init(&n->trans, 0);
+	atomic_init(&n->connect_threads, 0);
 
 	err = dnet_log_init(n, cfg->log);
 	if (err)
@@ -47,10 +48,20 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 		goto err_out_free;
 	}
 
+	for (i = 0; i < DNET_ROUTE_LOCK_NUM; ++i) {
+		err = pthread_mutex_init(&n->route_locks[i].lock, NULL);
+		if (err) {
+			dnet_log_err(n, "Failed to initialize route lock: err: %d", err);
+			while (--i >= 0)
+				pthread_mutex_destroy(&n->route_locks[i].lock);
+			goto err_out_destroy_state;
+		}
+	}
+
 	n->wait = dnet_wait_alloc(0);
 	if (!n->wait) {
 		dnet_log(n, DNET_LOG_ERROR, "Failed to allocate wait structure.\n");
-		goto err_out_destroy_state;
+		goto err_out_destroy_route;
 	}
 
 	err = dnet_counter_init(n);
@@ -66,21 +77,55 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 		goto err_out_destroy_counter;
 	}
 
+	err = pthread_cond_init(&n->reconnect_cond, NULL);
+	if (err) {
+		err = -err;
+		dnet_log_err(n, "Failed to initialize reconnection condition variable: err: %d", err);
+		goto err_out_destroy_reconnect_lock;
+	}
+
+	err = pthread_mutex_init(&n->defer_lock, NULL);
+	if (err) {
+		err = -err;
+		dnet_log_err(n, "Failed to initialize defer lock: err: %d", err);
+		goto err_out_destroy_reconnect_cond;
+	}
+
+	err = pthread_cond_init(&n->defer_wait, NULL);
+	if (err) {
+		err = -err;
+		dnet_log_err(n, "Failed to initialize defer condition variable: err: %d", err);
+		goto err_out_destroy_defer_lock;
+	}
+
+	err = pthread_mutex_init(&n->qos_lock, NULL);
+	if (err) {
+		err = -err;
+		dnet_log_err(n, "Failed to initialize qos lock: err: %d", err);
+		goto err_out_destroy_defer_wait;
+	}
+
 	err = pthread_attr_init(&n->attr);
 	if (err) {
 		err = -err;
 		dnet_log_err(n, "Failed to initialize pthread attributes: err: %d", err);
-		goto err_out_destroy_reconnect_lock;
+		goto err_out_destroy_qos_lock;
 	}
 	pthread_attr_setdetachstate(&n->attr, PTHREAD_CREATE_DETACHED);
 
+	err = dnet_flat_hash_init(&n->iterator_hash, 16);
+	if (err) {
+		dnet_log_err(n, "Failed to initialize iterator hash: err: %d", err);
+		goto err_out_destroy_attr;
+	}
+
 	n->autodiscovery_socket = -1;
 
 	INIT_LIST_HEAD(&n->group_list);
 	INIT_LIST_HEAD(&n->empty_state_list);
 	INIT_LIST_HEAD(&n->storage_state_list);
 	INIT_LIST_HEAD(&n->reconnect_list);
-	INIT_LIST_HEAD(&n->iterator_list);
+	INIT_LIST_HEAD(&n->defer_list);
 
 	INIT_LIST_HEAD(&n->check_entry);
 
@@ -88,12 +133,25 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 
 	return n;
 
+err_out_destroy_attr:
+	pthread_attr_destroy(&n->attr);
+err_out_destroy_qos_lock:
+	pthread_mutex_destroy(&n->qos_lock);
+err_out_destroy_defer_wait:
+	pthread_cond_destroy(&n->defer_wait);
+err_out_destroy_defer_lock:
+	pthread_mutex_destroy(&n->defer_lock);
+err_out_destroy_reconnect_cond:
+	pthread_cond_destroy(&n->reconnect_cond);
 err_out_destroy_reconnect_lock:
 	pthread_mutex_destroy(&n->reconnect_lock);
 err_out_destroy_counter:
 	dnet_counter_destroy(n);
 err_out_destroy_wait:
 	dnet_wait_put(n->wait);
+err_out_destroy_route:
+	for (i = 0; i < DNET_ROUTE_LOCK_NUM; ++i)
+		pthread_mutex_destroy(&n->route_locks[i].lock);
 err_out_destroy_state:
 	pthread_mutex_destroy(&n->state_lock);
 err_out_free:
@@ -249,8 +307,12 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 	if (err)
 		goto err_out_remove_nolock;
 
+	n->route_version++;
+
 	pthread_mutex_unlock(&n->state_lock);
 
+	dnet_route_update(n);
+
 	gettimeofday(&end, NULL);
 	diff = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
 
@@ -306,6 +368,109 @@ void dnet_idc_destroy_nolock(struct dnet_net_state *st)
 	dnet_idc_remove_ids(st, g);
 	dnet_group_put(g);
 	free(idc);
+
+	st->n->route_version++;
+}
+
+/* must be called under @state_lock */
+static struct dnet_route_table *dnet_route_table_create(struct dnet_node *n)
+{
+	struct dnet_route_table *rt;
+	struct dnet_route_entry *e;
+	struct dnet_group *g;
+	int group_num = 0, id_num = 0, i;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		group_num++;
+		id_num += g->id_num;
+	}
+
+	rt = malloc(sizeof(struct dnet_route_table) +
+			group_num * sizeof(struct dnet_route_group) +
+			id_num * sizeof(struct dnet_route_entry));
+	if (!rt)
+		return NULL;
+
+	rt->version = n->route_version;
+	rt->group_num = group_num;
+	rt->groups = (struct dnet_route_group *)(rt + 1);
+	e = (struct dnet_route_entry *)(rt->groups + group_num);
+
+	group_num = 0;
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		struct dnet_route_group *rg = &rt->groups[group_num++];
+
+		rg->group_id = g->group_id;
+		rg->id_num = g->id_num;
+		rg->entries = e;
+
+		for (i = 0; i < g->id_num; ++i, ++e) {
+			memcpy(&e->raw, &g->ids[i].raw, sizeof(struct dnet_raw_id));
+			e->st = dnet_state_get(g->ids[i].idc->st);
+		}
+	}
+
+	return rt;
+}
+
+void dnet_route_table_destroy(struct dnet_route_table *rt)
+{
+	int i, j;
+
+	for (i = 0; i < rt->group_num; ++i) {
+		for (j = 0; j < rt->groups[i].id_num; ++j)
+			dnet_state_put(rt->groups[i].entries[j].st);
+	}
+
+	free(rt);
+}
+
+/*
+ * Rebuilds the lookup snapshot from the live route table and publishes it.
+ * Cheap when nothing changed: the stored version matches @route_version and
+ * the snapshot is left alone. The old snapshot is dropped outside of all
+ * locks, since putting the last reference to a state ends up in
+ * dnet_state_remove(), which takes @state_lock.
+ */
+void dnet_route_update(struct dnet_node *n)
+{
+	struct dnet_route_table *rt, *old = NULL;
+	int i;
+
+	pthread_mutex_lock(&n->state_lock);
+	if (n->route && n->route->version == n->route_version)
+		goto err_out_unlock;
+
+	rt = dnet_route_table_create(n);
+	if (!rt)
+		goto err_out_unlock;
+
+	for (i = 0; i < DNET_ROUTE_LOCK_NUM; ++i)
+		pthread_mutex_lock(&n->route_locks[i].lock);
+
+	old = n->route;
+	n->route = rt;
+
+	for (i = DNET_ROUTE_LOCK_NUM - 1; i >= 0; --i)
+		pthread_mutex_unlock(&n->route_locks[i].lock);
+
+err_out_unlock:
+	pthread_mutex_unlock(&n->state_lock);
+
+	if (old)
+		dnet_route_table_destroy(old);
+}
+
+static struct dnet_route_lock *dnet_route_lock_self(struct dnet_node *n)
+{
+	unsigned long tid = (unsigned long)pthread_self();
+
+	/*
+	 * Thread ids are page-aligned addresses on common pthread
+	 * implementations, so mix the high bits in before reducing,
+	 * otherwise every thread lands on the same lock.
+	 */
+	return &n->route_locks[((tid * 0x9E3779B97F4A7C15ULL) >> 32) % DNET_ROUTE_LOCK_NUM];
 }
 
 static int __dnet_idc_search(struct dnet_group *g, struct dnet_id *id)
@@ -443,18 +608,74 @@ err_out_exit:
 	return found;
 }
 
+static int __dnet_route_entry_search(struct dnet_route_group *g, struct dnet_id *id)
+{
+	int low, high, i, cmp;
+	struct dnet_route_entry *e;
+
+	for (low = -1, high = g->id_num; high-low > 1; ) {
+		i = low + (high - low)/2;
+		e = &g->entries[i];
+
+		cmp = dnet_id_cmp_str(e->raw.id, id->id);
+		if (cmp < 0)
+			low = i;
+		else if (cmp > 0)
+			high = i;
+		else
+			goto out;
+	}
+	i = high - 1;
+
+out:
+	if (i == -1)
+		i = g->id_num - 1;
+
+	return i;
+}
+
 struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id *id)
 {
-	struct dnet_net_state *found;
+	struct dnet_route_lock *l = dnet_route_lock_self(n);
+	struct dnet_net_state *found = NULL;
+	struct dnet_route_group *g = NULL;
+	struct dnet_route_table *rt;
+	int i;
+
+	pthread_mutex_lock(&l->lock);
+
+	rt = n->route;
+	if (!rt) {
+		/* no snapshot published yet - fall back to the locked lookup */
+		pthread_mutex_unlock(&l->lock);
+
+		pthread_mutex_lock(&n->state_lock);
+		found = dnet_state_search_nolock(n, id);
+		if (found == n->st) {
+			dnet_state_put(found);
+			found = NULL;
+		}
+		pthread_mutex_unlock(&n->state_lock);
+
+		return found;
+	}
+
+	for (i = 0; i < rt->group_num; ++i) {
+		if (rt->groups[i].group_id == id->group_id) {
+			g = &rt->groups[i];
+			break;
+		}
+	}
+
+	if (g && g->id_num)
+		found = dnet_state_get(g->entries[__dnet_route_entry_search(g, id)].st);
 
-	pthread_mutex_lock(&n->state_lock);
-	found = dnet_state_search_nolock(n, id);
 	if (found == n->st) {
 		dnet_state_put(found);
 		found = NULL;
 	}
 
-	pthread_mutex_unlock(&n->state_lock);
+	pthread_mutex_unlock(&l->lock);
 
 	return found;
 }
@@ -482,6 +703,54 @@ struct dnet_net_state *dnet_node_state(struct dnet_node *n)
 	return found;
 }
 
+/*
+ * Parses dnet_config::qos ('class:ops_per_sec:bytes_per_sec' triplets) into
+ * per-class token buckets. Parse failure is not fatal - malformed entries are
+ * skipped, the node just runs without limits for them.
+ */
+static void dnet_qos_init(struct dnet_node *n, struct dnet_config *cfg)
+{
+	char *conf, *entry, *saveptr = NULL;
+	unsigned int class;
+	unsigned long long ops, bytes;
+	struct dnet_time now;
+
+	if (!cfg->qos)
+		return;
+
+	conf = strdup(cfg->qos);
+	if (!conf)
+		return;
+
+	dnet_current_time(&now);
+
+	for (entry = strtok_r(conf, " \t", &saveptr); entry; entry = strtok_r(NULL, " \t", &saveptr)) {
+		if (sscanf(entry, "%u:%llu:%llu", &class, &ops, &bytes) != 3) {
+			dnet_log(n, DNET_LOG_ERROR, "Invalid qos entry '%s', expected class:ops_per_sec:bytes_per_sec.\n",
+					entry);
+			continue;
+		}
+
+		if (!class || class >= DNET_QOS_CLASS_NUM) {
+			dnet_log(n, DNET_LOG_ERROR, "Invalid qos class in '%s', must be in 1..%d.\n",
+					entry, DNET_QOS_CLASS_NUM - 1);
+			continue;
+		}
+
+		n->qos[class].limit_ops = ops;
+		n->qos[class].limit_bytes = bytes;
+		n->qos[class].tokens_ops = ops;
+		n->qos[class].tokens_bytes = bytes;
+		n->qos[class].tokens_time = now;
+
+		n->qos_enabled = 1;
+		dnet_log(n, DNET_LOG_INFO, "QoS class %u: %llu ops/s, %llu bytes/s (0 - unlimited).\n",
+				class, ops, bytes);
+	}
+
+	free(conf);
+}
+
 struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 {
 	struct dnet_node *n;
@@ -494,7 +763,7 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 
 	srand(time(NULL));
 
-	if ((cfg->flags & DNET_CFG_JOIN_NETWORK) && (!cfg->cb)) {
+	if ((cfg->flags & DNET_CFG_JOIN_NETWORK) && (!cfg->cb) && (!cfg->cb_deferred)) {
 		err = -EINVAL;
 		if (cfg->log && cfg->log->log)
 			cfg->log->log(cfg->log->log_private, DNET_LOG_ERROR, "Joining node has to register "
@@ -553,7 +822,17 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	n->removal_delay = cfg->removal_delay;
 	n->flags = cfg->flags;
 	n->cache_size = cfg->cache_size;
+	n->cache_shards = cfg->cache_shards;
+	n->cache_sync_batch_size = cfg->cache_sync_batch_size;
+	n->cache_sync_batch_bytes = cfg->cache_sync_batch_bytes;
+	n->slow_cmd_threshold = cfg->slow_cmd_threshold;
 	n->indexes_shard_count = cfg->indexes_shard_count;
+	n->indexes_update_window = cfg->indexes_update_window;
+	n->connections_per_addr = cfg->connections_per_addr;
+
+	n->capture_fd = -1;
+	n->capture_sample = cfg->capture_sample;
+	atomic_init(&n->capture_counter, 0);
 
 	if (!n->log)
 		dnet_log_init(n, cfg->log);
@@ -593,7 +872,38 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 				n->indexes_shard_count);
 	}
 
-	err = dnet_crypto_init(n);
+	if (n->cache_size && !n->cache_shards) {
+		n->cache_shards = DNET_DEFAULT_CACHE_SHARDS;
+		dnet_log(n, DNET_LOG_NOTICE, "Using default cache shard count (%d shards).\n",
+				n->cache_shards);
+	}
+
+	/* capture failure is not fatal - the node just runs without the journal */
+	if (cfg->capture_journal && cfg->capture_sample > 0) {
+		n->capture_fd = open(cfg->capture_journal, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (n->capture_fd < 0) {
+			dnet_log(n, DNET_LOG_ERROR, "Failed to open capture journal '%s': %s %d.\n",
+					cfg->capture_journal, strerror(errno), -errno);
+		} else {
+			struct dnet_capture_header hdr = { DNET_CAPTURE_MAGIC, DNET_CAPTURE_VERSION, 0 };
+			struct stat st;
+
+			if (!fstat(n->capture_fd, &st) && !st.st_size &&
+					write(n->capture_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+				dnet_log(n, DNET_LOG_ERROR, "Failed to write capture journal header to '%s': %s %d.\n",
+						cfg->capture_journal, strerror(errno), -errno);
+				close(n->capture_fd);
+				n->capture_fd = -1;
+			} else {
+				dnet_log(n, DNET_LOG_INFO, "Capture enabled: journal: %s, 1 in %d commands.\n",
+						cfg->capture_journal, n->capture_sample);
+			}
+		}
+	}
+
+	dnet_qos_init(n, cfg);
+
+	err = dnet_crypto_init(n, cfg);
 	if (err)
 		goto err_out_free;
 
@@ -634,20 +944,45 @@ int dnet_need_exit(struct dnet_node *n)
 void dnet_set_need_exit(struct dnet_node *n)
 {
 	n->need_exit = 1;
+	pthread_cond_broadcast(&n->reconnect_cond);
 }
 
 void dnet_node_cleanup_common_resources(struct dnet_node *n)
 {
 	struct dnet_addr_storage *it, *atmp;
+	int i;
 
 	n->need_exit = 1;
+	pthread_cond_broadcast(&n->reconnect_cond);
 	dnet_iterator_cancel_all(n);
 	dnet_check_thread_stop(n);
 
+	/*
+	 * Detached connector threads hold no node reference - wait them out
+	 * while the IO infrastructure they use is still alive.
+	 */
+	while (atomic_read(&n->connect_threads) > 0)
+		usleep(10000);
+	/* fires pending deferred calls while IO is still alive */
+	dnet_node_defer_stop(n);
+
 	dnet_io_exit(n);
 
+	dnet_flat_hash_destroy(&n->iterator_hash);
+
 	pthread_attr_destroy(&n->attr);
 
+	/*
+	 * Dropped before @state_lock goes away: putting the last state
+	 * references may recurse into dnet_state_remove().
+	 */
+	if (n->route) {
+		dnet_route_table_destroy(n->route);
+		n->route = NULL;
+	}
+	for (i = 0; i < DNET_ROUTE_LOCK_NUM; ++i)
+		pthread_mutex_destroy(&n->route_locks[i].lock);
+
 	pthread_mutex_destroy(&n->state_lock);
 	dnet_crypto_cleanup(n);
 
@@ -656,7 +991,11 @@ void dnet_node_cleanup_common_resources(struct dnet_node *n)
 		free(it);
 	}
 	dnet_counter_destroy(n);
+	pthread_cond_destroy(&n->reconnect_cond);
 	pthread_mutex_destroy(&n->reconnect_lock);
+	pthread_cond_destroy(&n->defer_wait);
+	pthread_mutex_destroy(&n->defer_lock);
+	pthread_mutex_destroy(&n->qos_lock);
 
 	dnet_wait_put(n->wait);
 
@@ -669,6 +1008,12 @@ void dnet_node_destroy(struct dnet_node *n)
 
 	dnet_node_cleanup_common_resources(n);
 
+	if (n->capture_fd >= 0)
+		close(n->capture_fd);
+
+	/* queued log records reference n->log's sink - push them out first */
+	dnet_log_flush();
+
 	free(n);
 }
 
@@ -699,6 +1044,7 @@ struct dnet_session *dnet_session_copy(struct dnet_session *s)
 	new_s->ioflags = s->ioflags;
 	new_s->ts = s->ts;
 	new_s->user_flags = s->user_flags;
+	new_s->indexes_shard_count = s->indexes_shard_count;
 
 	if (s->group_num > 0) {
 		err = dnet_session_set_groups(new_s, s->groups, s->group_num);
@@ -790,6 +1136,25 @@ err_out_exit:
 	return err;
 }
 
+const char *dnet_session_get_ns(struct dnet_session *s, int *nsize)
+{
+	*nsize = s->nsize;
+	return s->ns;
+}
+
+void dnet_session_set_indexes_shard_count(struct dnet_session *s, int shard_count)
+{
+	s->indexes_shard_count = shard_count;
+}
+
+int dnet_session_get_indexes_shard_count(struct dnet_session *s)
+{
+	if (s->indexes_shard_count > 0)
+		return s->indexes_shard_count;
+
+	return s->node->indexes_shard_count;
+}
+
 uint32_t dnet_session_get_ioflags(struct dnet_session *s)
 {
 	return s->ioflags;
@@ -31,11 +31,36 @@
 #include "elliptics/packet.h"
 #include "elliptics/interface.h"
 
+/*
+ * Notifications are not sent one packet per update: updates hitting the same
+ * subscriber are coalesced into @batch under @lock and flushed as a single
+ * reply either when the batch fills up or when a short deferred timer
+ * (DNET_NOTIFY_FLUSH_USECS, scheduled via dnet_node_defer()) expires. A
+ * subscriber whose socket send queue is backed up gets updates dropped and
+ * counted instead of queued, so a slow watcher can not amplify write-path
+ * latency; the drop count is logged on the next successful flush.
+ *
+ * The reply payload is an array of dnet_io_notification records - clients
+ * iterate over cmd->size, fixed-size records keep old single-record parsers
+ * working on the first entry.
+ */
+#define DNET_NOTIFY_BATCH_MAX		64
+#define DNET_NOTIFY_FLUSH_USECS		20000
+#define DNET_NOTIFY_SEND_QUEUE_MAX	1000
+
 struct dnet_notify_entry
 {
-	struct list_head		notify_entry;
 	struct dnet_cmd			cmd;
 	struct dnet_net_state		*state;
+
+	atomic_t			refcnt;
+
+	/* protects everything below: the batch is touched outside the bucket lock too */
+	pthread_mutex_t			lock;
+	int				pending;
+	int				flush_scheduled;
+	unsigned long long		dropped;
+	struct dnet_io_notification	batch[DNET_NOTIFY_BATCH_MAX];
 };
 
 static unsigned int dnet_notify_hash(struct dnet_id *id, unsigned int hash_size)
@@ -51,6 +76,68 @@ static unsigned int dnet_notify_hash(struct dnet_id *id, unsigned int hash_size)
 	return hash;
 }
 
+/*
+ * Key inside the bucket's flat hash: the leading 8 bytes of the watched
+ * id. Ids are content hashes, so the prefix is well distributed; the
+ * full id is compared only for entries whose key already matched.
+ */
+static uint64_t dnet_notify_key(struct dnet_id *id)
+{
+	uint64_t key;
+
+	memcpy(&key, id->id, sizeof(key));
+	return key;
+}
+
+static void dnet_notify_entry_destroy(struct dnet_notify_entry *e)
+{
+	dnet_state_put(e->state);
+	pthread_mutex_destroy(&e->lock);
+	free(e);
+}
+
+static struct dnet_notify_entry *dnet_notify_entry_get(struct dnet_notify_entry *e)
+{
+	atomic_inc(&e->refcnt);
+	return e;
+}
+
+static void dnet_notify_entry_put(struct dnet_notify_entry *e)
+{
+	if (e && atomic_dec_and_test(&e->refcnt))
+		dnet_notify_entry_destroy(e);
+}
+
+/* must be called under @e->lock */
+static void dnet_notify_flush_nolock(struct dnet_notify_entry *e)
+{
+	struct dnet_node *n = e->state->n;
+
+	if (!e->pending)
+		return;
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: sending notification: events: %d, dropped: %llu.\n",
+			dnet_dump_id(&e->cmd.id), e->pending, e->dropped);
+
+	dnet_send_reply(e->state, &e->cmd, e->batch,
+			e->pending * sizeof(struct dnet_io_notification), 1);
+
+	e->pending = 0;
+	e->dropped = 0;
+}
+
+static void dnet_notify_flush_defer(void *priv)
+{
+	struct dnet_notify_entry *e = priv;
+
+	pthread_mutex_lock(&e->lock);
+	e->flush_scheduled = 0;
+	dnet_notify_flush_nolock(e);
+	pthread_mutex_unlock(&e->lock);
+
+	dnet_notify_entry_put(e);
+}
+
 int dnet_update_notify(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
 {
 	struct dnet_node *n = st->n;
@@ -59,49 +146,85 @@ int dnet_update_notify(struct dnet_net_state *st, struct dnet_cmd *cmd, void *da
 	struct dnet_notify_entry *nt;
 	struct dnet_io_attr *io = data;
 	struct dnet_io_notification notif;
+	uint64_t key = dnet_notify_key(&cmd->id);
+	unsigned int pos;
+	int err;
 
 	memcpy(&notif.io, io, sizeof(struct dnet_io_attr));
 	dnet_convert_io_attr(&notif.io);
+	memcpy(&notif.addr, &st->addr, sizeof(struct dnet_addr));
 
 	pthread_rwlock_rdlock(&b->notify_lock);
-	list_for_each_entry(nt, &b->notify_list, notify_entry) {
+	for (nt = dnet_flat_hash_find(&b->notify_hash, key, &pos); nt != NULL;
+			nt = dnet_flat_hash_find_next(&b->notify_hash, key, &pos)) {
 		if (dnet_id_cmp(&cmd->id, &nt->cmd.id))
 			continue;
 
-		memcpy(&notif.addr, &st->addr, sizeof(struct dnet_addr));
+		pthread_mutex_lock(&nt->lock);
+
+		if (atomic_read(&nt->state->send_queue_size) > DNET_NOTIFY_SEND_QUEUE_MAX) {
+			/* subscriber can not keep up - drop and count, never queue */
+			nt->dropped++;
+			pthread_mutex_unlock(&nt->lock);
+			continue;
+		}
+
+		memcpy(&nt->batch[nt->pending++], &notif, sizeof(struct dnet_io_notification));
+
+		if (nt->pending == DNET_NOTIFY_BATCH_MAX) {
+			dnet_notify_flush_nolock(nt);
+		} else if (!nt->flush_scheduled) {
+			nt->flush_scheduled = 1;
+			err = dnet_node_defer(n, DNET_NOTIFY_FLUSH_USECS,
+					dnet_notify_flush_defer, dnet_notify_entry_get(nt));
+			if (err) {
+				/* no timer - do not coalesce, send right away */
+				nt->flush_scheduled = 0;
+				dnet_notify_flush_nolock(nt);
+				dnet_notify_entry_put(nt);
+			}
+		}
 
-		dnet_log(n, DNET_LOG_NOTICE, "%s: sending notification.\n", dnet_dump_id(&cmd->id));
-		dnet_send_reply(nt->state, &nt->cmd, &notif, sizeof(struct dnet_io_notification), 1);
+		pthread_mutex_unlock(&nt->lock);
 	}
 	pthread_rwlock_unlock(&b->notify_lock);
 
 	return 0;
 }
 
-static void dnet_notify_entry_destroy(struct dnet_notify_entry *e)
-{
-	dnet_state_put(e->state);
-	free(e);
-}
-
 int dnet_notify_add(struct dnet_net_state *st, struct dnet_cmd *cmd)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_notify_entry *e;
 	unsigned int hash = dnet_notify_hash(&cmd->id, n->notify_hash_size);
 	struct dnet_notify_bucket *b = &n->notify_hash[hash];
+	int err;
 
 	e = malloc(sizeof(struct dnet_notify_entry));
 	if (!e)
 		return -ENOMEM;
 
+	memset(e, 0, sizeof(struct dnet_notify_entry));
+
+	err = pthread_mutex_init(&e->lock, NULL);
+	if (err) {
+		free(e);
+		return -err;
+	}
+
+	atomic_init(&e->refcnt, 1);
 	e->state = dnet_state_get(st);
 	memcpy(&e->cmd, cmd, sizeof(struct dnet_cmd));
 
 	pthread_rwlock_wrlock(&b->notify_lock);
-	list_add_tail(&e->notify_entry, &b->notify_list);
+	err = dnet_flat_hash_insert(&b->notify_hash, dnet_notify_key(&cmd->id), e);
 	pthread_rwlock_unlock(&b->notify_lock);
 
+	if (err) {
+		dnet_notify_entry_put(e);
+		return err;
+	}
+
 	dnet_log(n, DNET_LOG_INFO, "%s: added notification, hash: 0x%x.\n", dnet_dump_id(&cmd->id), hash);
 
 	return 0;
@@ -110,22 +233,30 @@ int dnet_notify_add(struct dnet_net_state *st, struct dnet_cmd *cmd)
 int dnet_notify_remove(struct dnet_net_state *st, struct dnet_cmd *cmd)
 {
 	struct dnet_node *n = st->n;
-	struct dnet_notify_entry *e, *tmp;
+	struct dnet_notify_entry *e;
 	unsigned int hash = dnet_notify_hash(&cmd->id, n->notify_hash_size);
 	struct dnet_notify_bucket *b = &n->notify_hash[hash];
+	uint64_t key = dnet_notify_key(&cmd->id);
+	unsigned int pos;
 	int err = -ENXIO;
 
 	pthread_rwlock_wrlock(&b->notify_lock);
-	list_for_each_entry_safe(e, tmp, &b->notify_list, notify_entry) {
+	for (e = dnet_flat_hash_find(&b->notify_hash, key, &pos); e != NULL;
+			e = dnet_flat_hash_find_next(&b->notify_hash, key, &pos)) {
 		if (dnet_id_cmp(&e->cmd.id, &cmd->id))
 			continue;
 
+		/* push out whatever is still coalescing before the final ack */
+		pthread_mutex_lock(&e->lock);
+		dnet_notify_flush_nolock(e);
+		pthread_mutex_unlock(&e->lock);
+
 		e->cmd.flags = 0;
 		err = dnet_send_reply(e->state, &e->cmd, NULL, 0, 0);
 
-		list_del(&e->notify_entry);
-		dnet_notify_entry_destroy(e);
-		
+		dnet_flat_hash_remove(&b->notify_hash, key, e);
+		dnet_notify_entry_put(e);
+
 		dnet_log(n, DNET_LOG_INFO, "%s: removed notification.\n", dnet_dump_id(&cmd->id));
 		break;
 	}
@@ -151,10 +282,16 @@ int dnet_notify_init(struct dnet_node *n)
 	for (i=0; i<n->notify_hash_size; ++i) {
 		b = &n->notify_hash[i];
 
-		INIT_LIST_HEAD(&b->notify_list);
+		err = dnet_flat_hash_init(&b->notify_hash, 16);
+		if (err) {
+			dnet_log_err(n, "Failed to initialize %d'th bucket hash: err: %d", i, err);
+			goto err_out_free;
+		}
+
 		err = pthread_rwlock_init(&b->notify_lock, NULL);
 		if (err) {
 			err = -err;
+			dnet_flat_hash_destroy(&b->notify_hash);
 			dnet_log_err(n, "Failed to initialize %d'th bucket lock: err: %d", i, err);
 			goto err_out_free;
 		}
@@ -170,30 +307,32 @@ err_out_free:
 	for (i=0; i<n->notify_hash_size; ++i) {
 		b = &n->notify_hash[i];
 		pthread_rwlock_destroy(&b->notify_lock);
+		dnet_flat_hash_destroy(&b->notify_hash);
 	}
 	free(n->notify_hash);
 err_out_exit:
 	return err;
 }
 
+static void dnet_notify_exit_one(void *ptr, void *priv __attribute__ ((unused)))
+{
+	dnet_notify_entry_put(ptr);
+}
+
 void dnet_notify_exit(struct dnet_node *n)
 {
 	unsigned int i;
 	struct dnet_notify_bucket *b;
-	struct dnet_notify_entry *e, *tmp;
 
 	for (i=0; i<n->notify_hash_size; ++i) {
 		b = &n->notify_hash[i];
 
 		pthread_rwlock_wrlock(&b->notify_lock);
-		list_for_each_entry_safe(e, tmp, &b->notify_list, notify_entry) {
-			list_del(&e->notify_entry);
-
-			dnet_notify_entry_destroy(e);
-		}
+		dnet_flat_hash_clear(&b->notify_hash, dnet_notify_exit_one, NULL);
 		pthread_rwlock_unlock(&b->notify_lock);
 
 		pthread_rwlock_destroy(&b->notify_lock);
+		dnet_flat_hash_destroy(&b->notify_hash);
 	}
 	free(n->notify_hash);
 }
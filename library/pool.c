@@ -15,12 +15,23 @@
 
 #include <sys/stat.h>
 
+#include <netinet/tcp.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
 
+#ifdef HAVE_LZ4_SUPPORT
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_NUMA_SUPPORT
+#include <numa.h>
+#include <sys/syscall.h>
+#endif
+
 #include "elliptics.h"
 #include "elliptics/interface.h"
 
@@ -31,6 +42,22 @@ static char *dnet_work_io_mode_string[] = {
 
 __thread uint32_t trace_id = 0;
 
+/*
+ * Span timestamps of the traced command currently executed by this IO
+ * thread (DNET_FLAGS_TRACE), consumed by dnet_send_ack() when it
+ * attaches the trace annex to the final ack.
+ */
+__thread uint64_t trace_queue_time = 0;
+__thread uint64_t trace_dequeue_time = 0;
+__thread uint64_t trace_proc_time = 0;
+
+/*
+ * Weighted dequeue shares of the IO queue priority lanes: with all lanes
+ * backlogged workers serve 8 interactive requests per 4 writes per 1
+ * background request, so bulk ingest can not starve reads and vice versa.
+ */
+static const int dnet_io_prio_weight[DNET_IO_PRIO_NUM] = {8, 4, 1};
+
 static char *dnet_work_io_mode_str(int mode)
 {
 	if (mode < 0 || mode >= (int)ARRAY_SIZE(dnet_work_io_mode_string))
@@ -43,6 +70,8 @@ static void dnet_work_pool_cleanup(struct dnet_work_pool *pool)
 {
 	struct dnet_io_req *r, *tmp;
 	struct dnet_work_io *wio, *wio_tmp;
+	struct dnet_work_queue *q;
+	int i, prio;
 
 	list_for_each_entry_safe(wio, wio_tmp, &pool->wio_list, wio_entry) {
 		pthread_join(wio->tid, NULL);
@@ -50,26 +79,72 @@ static void dnet_work_pool_cleanup(struct dnet_work_pool *pool)
 		free(wio);
 	}
 
+	for (i = 0; i < pool->queue_num; ++i) {
+		q = &pool->queues[i];
 
-	list_for_each_entry_safe(r, tmp, &pool->list, req_entry) {
-		list_del(&r->req_entry);
-		dnet_io_req_free(r);
+		for (prio = 0; prio < DNET_IO_PRIO_NUM; ++prio) {
+			list_for_each_entry_safe(r, tmp, &q->lane[prio], req_entry) {
+				list_del(&r->req_entry);
+				dnet_io_req_free(r);
+			}
+		}
+
+		pthread_cond_destroy(&q->wait);
+		pthread_mutex_destroy(&q->lock);
+		free(q->trans);
 	}
 
-	pthread_cond_destroy(&pool->wait);
-	pthread_mutex_destroy(&pool->lock);
-	free(pool->trans);
+	free(pool->queues);
 	free(pool);
 }
 
-static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, void *(* process)(void *))
+/*
+ * Retires the most recently started worker. Workers are always removed in
+ * reverse creation order, so retired worker owns the highest claim slot of
+ * its queue shard and q->num can be simply decremented.
+ *
+ * Worker finishes its current request before exiting, thus clearing its
+ * claim slot is safe: not-yet-processed replies of the claimed transaction
+ * are still queued in FIFO order and will be claimed afresh.
+ */
+static void dnet_work_pool_shrink(struct dnet_node *n, struct dnet_work_pool *pool)
 {
-	int i, err;
-	struct dnet_work_io *wio, *tmp;
+	struct dnet_work_io *wio;
+	struct dnet_work_queue *q;
+
+	if (list_empty(&pool->wio_list))
+		return;
 
-	pthread_mutex_lock(&pool->lock);
+	wio = list_entry(pool->wio_list.prev, struct dnet_work_io, wio_entry);
+	q = wio->queue;
 
-	pool->trans = realloc(pool->trans, sizeof(uint64_t) * (pool->num + num));
+	wio->need_exit = 1;
+
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_broadcast(&q->wait);
+	pthread_mutex_unlock(&q->lock);
+
+	pthread_join(wio->tid, NULL);
+
+	pthread_mutex_lock(&q->lock);
+	q->trans[wio->thread_index] = ~0ULL;
+	q->num--;
+	pthread_mutex_unlock(&q->lock);
+
+	list_del(&wio->wio_entry);
+	free(wio);
+	pool->num--;
+
+	dnet_log(n, DNET_LOG_INFO, "Shrunk %s pool: %d -> %d IO threads\n",
+			dnet_work_io_mode_str(pool->mode), pool->num + 1, pool->num);
+}
+
+static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, void *(* process)(void *))
+{
+	int i, err, start = pool->num;
+	struct dnet_work_io *wio;
+	struct dnet_work_queue *q;
+	uint64_t *trans;
 
 	for (i = 0; i < num; ++i) {
 		wio = malloc(sizeof(struct dnet_work_io));
@@ -78,13 +153,34 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 			goto err_out_io_threads;
 		}
 
-		wio->thread_index = i;
+		/* workers are sprayed over queue shards round-robin */
+		q = &pool->queues[pool->num % pool->queue_num];
+
+		pthread_mutex_lock(&q->lock);
+		trans = realloc(q->trans, sizeof(uint64_t) * (q->num + 1));
+		if (!trans) {
+			pthread_mutex_unlock(&q->lock);
+			free(wio);
+			err = -ENOMEM;
+			goto err_out_io_threads;
+		}
+
+		q->trans = trans;
+		q->trans[q->num] = ~0ULL;
+
+		wio->thread_index = q->num;
+		wio->need_exit = 0;
 		wio->pool = pool;
+		wio->queue = q;
 
-		pool->trans[pool->num + i] = ~0ULL;
+		q->num++;
+		pthread_mutex_unlock(&q->lock);
 
 		err = pthread_create(&wio->tid, NULL, process, wio);
 		if (err) {
+			pthread_mutex_lock(&q->lock);
+			q->num--;
+			pthread_mutex_unlock(&q->lock);
 			free(wio);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create IO thread: %d\n", err);
@@ -92,32 +188,32 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 		}
 
 		list_add_tail(&wio->wio_entry, &pool->wio_list);
+		pool->num++;
 	}
 
-	dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads\n",
-			dnet_work_io_mode_str(pool->mode), pool->num, pool->num + num);
-
-	pool->num += num;
-	pthread_mutex_unlock(&pool->lock);
+	dnet_log(n, DNET_LOG_INFO, "Grew %s pool: %d -> %d IO threads, queue shards: %d\n",
+			dnet_work_io_mode_str(pool->mode), start, pool->num, pool->queue_num);
 
 	return 0;
 
 err_out_io_threads:
-	list_for_each_entry_safe(wio, tmp, &pool->wio_list, wio_entry) {
-		pthread_join(wio->tid, NULL);
-		list_del(&wio->wio_entry);
-		free(wio);
-	}
-
-	pthread_mutex_unlock(&pool->lock);
+	/* unwind only the workers started by this call */
+	while (pool->num > start)
+		dnet_work_pool_shrink(n, pool);
 
 	return err;
 }
 
-static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int mode, void *(* process)(void *))
+static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int mode, int queue_num, void *(* process)(void *))
 {
 	struct dnet_work_pool *pool;
-	int err;
+	struct dnet_work_queue *q;
+	int err, i, j;
+
+	if (queue_num <= 0)
+		queue_num = 1;
+	if (queue_num > num)
+		queue_num = num;
 
 	pool = malloc(sizeof(struct dnet_work_pool));
 	if (!pool) {
@@ -130,32 +226,61 @@ static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num,
 	pool->num = 0;
 	pool->mode = mode;
 	pool->n = n;
-	INIT_LIST_HEAD(&pool->list);
-	list_stat_init(&pool->list_stats);
+	pool->queue_num = 0;
+	atomic_init(&pool->seq, 0);
 	INIT_LIST_HEAD(&pool->wio_list);
 
-	err = pthread_mutex_init(&pool->lock, NULL);
-	if (err) {
-		err = -err;
+	pool->queues = malloc(sizeof(struct dnet_work_queue) * queue_num);
+	if (!pool->queues) {
+		err = -ENOMEM;
 		goto err_out_free;
 	}
 
-	err = pthread_cond_init(&pool->wait, NULL);
-	if (err) {
-		err = -err;
-		goto err_out_mutex_destroy;
+	memset(pool->queues, 0, sizeof(struct dnet_work_queue) * queue_num);
+
+	for (i = 0; i < queue_num; ++i) {
+		q = &pool->queues[i];
+
+		for (j = 0; j < DNET_IO_PRIO_NUM; ++j) {
+			INIT_LIST_HEAD(&q->lane[j]);
+			q->credit[j] = dnet_io_prio_weight[j];
+		}
+		list_stat_init(&q->list_stats);
+
+		/* spread queue shards over NUMA nodes, workers follow their shard */
+		q->numa_node = -1;
+		if (n->io->numa_nodes > 1)
+			q->numa_node = i % n->io->numa_nodes;
+
+		err = pthread_mutex_init(&q->lock, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_queues_destroy;
+		}
+
+		err = pthread_cond_init(&q->wait, NULL);
+		if (err) {
+			err = -err;
+			pthread_mutex_destroy(&q->lock);
+			goto err_out_queues_destroy;
+		}
+
+		pool->queue_num++;
 	}
 
 	err = dnet_work_pool_grow(n, pool, num, process);
 	if (err)
-		goto err_out_cond_destroy;
+		goto err_out_queues_destroy;
 
 	return pool;
 
-err_out_cond_destroy:
-	pthread_cond_destroy(&pool->wait);
-err_out_mutex_destroy:
-	pthread_mutex_destroy(&pool->lock);
+err_out_queues_destroy:
+	for (i = 0; i < pool->queue_num; ++i) {
+		q = &pool->queues[i];
+		pthread_cond_destroy(&q->wait);
+		pthread_mutex_destroy(&q->lock);
+	}
+	free(pool->queues);
 err_out_free:
 	free(pool);
 err_out_exit:
@@ -179,12 +304,154 @@ static inline void list_stat_log(struct list_stat *st, struct dnet_node *node, c
 
 
 static void *dnet_io_process(void *data_);
+
+/*
+ * Selects the queue shard given request goes into.
+ *
+ * Transaction replies are pinned to the shard derived from transaction
+ * number, so all replies of one transaction are seen by one set of
+ * worker threads and take_request() claim logic stays shard-local.
+ * Everything else is distributed round-robin, preferring shards whose
+ * workers run on the NUMA node of the calling network thread - request
+ * buffer was just allocated (first-touched) on that node.
+ */
+static struct dnet_work_queue *dnet_schedule_io_queue(struct dnet_work_pool *pool, struct dnet_cmd *cmd)
+{
+	uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
+	int seq;
+
+	if (cmd->trans & DNET_TRANS_REPLY)
+		return &pool->queues[tid % pool->queue_num];
+
+	seq = atomic_inc(&pool->seq);
+
+#if defined(HAVE_NUMA_SUPPORT) && defined(SYS_getcpu)
+	if (pool->n->io->numa_nodes > 1) {
+		unsigned int cpu, node;
+		int i, idx;
+
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+			for (i = 0; i < pool->queue_num; ++i) {
+				idx = (seq + i) % pool->queue_num;
+				if (pool->queues[idx].numa_node == (int)node)
+					return &pool->queues[idx];
+			}
+		}
+	}
+#endif
+
+	return &pool->queues[seq % pool->queue_num];
+}
+
+/*
+ * Maps command to its IO queue priority lane. Replies carry the command
+ * number and flags of the original request and thus land in the same
+ * lane, keeping per-transaction ordering lane-local.
+ */
+static int dnet_cmd_priority(struct dnet_cmd *cmd)
+{
+	if (cmd->flags & DNET_FLAGS_BACKGROUND)
+		return DNET_IO_PRIO_LOW;
+
+	switch (cmd->cmd) {
+	case DNET_CMD_READ:
+	case DNET_CMD_LOOKUP:
+		return DNET_IO_PRIO_HIGH;
+	case DNET_CMD_ITERATOR:
+	case DNET_CMD_DEFRAG:
+		return DNET_IO_PRIO_LOW;
+	default:
+		return DNET_IO_PRIO_NORMAL;
+	}
+}
+
+/*
+ * Per-tenant QoS admission: charge the request against the token buckets
+ * of its class and demote it to the background lane when the class ran
+ * out of budget. Demotion instead of dropping keeps the tenant making
+ * progress at leftover capacity, while the weighted lane dequeue protects
+ * interactive traffic from the backlog.
+ */
+static void dnet_qos_admit(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	struct dnet_qos_class *qos;
+	struct dnet_time now;
+	long long elapsed_ms;
+	int ok_ops, ok_bytes;
+	int class = DNET_FLAGS_QOS(cmd->flags);
+
+	if (!n->qos_enabled || !class || (cmd->trans & DNET_TRANS_REPLY))
+		return;
+
+	qos = &n->qos[class];
+	if (!qos->limit_ops && !qos->limit_bytes)
+		return;
+
+	pthread_mutex_lock(&n->qos_lock);
+
+	/* Refill buckets, burst is capped at one second worth of tokens */
+	dnet_current_time(&now);
+	elapsed_ms = ((long long)now.tsec - (long long)qos->tokens_time.tsec) * 1000 +
+		((long long)now.tnsec - (long long)qos->tokens_time.tnsec) / 1000000;
+	if (elapsed_ms > 0) {
+		qos->tokens_ops += qos->limit_ops * elapsed_ms / 1000;
+		if (qos->tokens_ops > qos->limit_ops)
+			qos->tokens_ops = qos->limit_ops;
+
+		qos->tokens_bytes += qos->limit_bytes * elapsed_ms / 1000;
+		if (qos->tokens_bytes > qos->limit_bytes)
+			qos->tokens_bytes = qos->limit_bytes;
+
+		qos->tokens_time = now;
+	}
+
+	/* A request larger than the whole bucket passes on a full bucket */
+	ok_ops = !qos->limit_ops || qos->tokens_ops >= 1;
+	ok_bytes = !qos->limit_bytes || qos->tokens_bytes >= cmd->size ||
+		qos->tokens_bytes == qos->limit_bytes;
+
+	if (ok_ops && ok_bytes) {
+		if (qos->limit_ops)
+			qos->tokens_ops--;
+		if (qos->limit_bytes)
+			qos->tokens_bytes -= cmd->size < qos->tokens_bytes ? cmd->size : qos->tokens_bytes;
+	} else {
+		cmd->flags |= DNET_FLAGS_BACKGROUND;
+		qos->demoted++;
+		dnet_counter_inc(n, DNET_CNTR_QOS_DEMOTED, 0);
+	}
+
+	qos->queued++;
+
+	pthread_mutex_unlock(&n->qos_lock);
+
+	if (cmd->flags & DNET_FLAGS_BACKGROUND)
+		dnet_log(n, DNET_LOG_DEBUG, "%s: qos: class %d over budget, demoted: %s, queued: %llu\n",
+				dnet_dump_id(&cmd->id), class, dnet_cmd_string(cmd->cmd),
+				(unsigned long long)qos->queued);
+}
+
+/* Drops the IO queue accounting taken by dnet_qos_admit() */
+static void dnet_qos_dequeue(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	int class = DNET_FLAGS_QOS(cmd->flags);
+
+	if (!n->qos_enabled || !class || (cmd->trans & DNET_TRANS_REPLY))
+		return;
+
+	pthread_mutex_lock(&n->qos_lock);
+	if (n->qos[class].queued)
+		n->qos[class].queued--;
+	pthread_mutex_unlock(&n->qos_lock);
+}
+
 static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 {
 	struct dnet_io *io = n->io;
 	struct dnet_work_pool *pool = io->recv_pool;
+	struct dnet_work_queue *q;
 	struct dnet_cmd *cmd = r->header;
-	int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
+	int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK) || dnet_cmd_nonblocking(cmd->cmd);
 
 	if (cmd->size > 0) {
 		dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: RECV cmd: %s: cmd-size: %llu, nonblocking: %d\n",
@@ -202,15 +469,21 @@ static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 			(unsigned long long)cmd->size, (unsigned long long)cmd->flags, tid, reply);
 	}
 
+	dnet_qos_admit(n, cmd);
+
 	if (nonblocking)
 		pool = io->recv_pool_nb;
 
-	pthread_mutex_lock(&pool->lock);
-	list_add_tail(&r->req_entry, &pool->list);
-	list_stat_size_increase(&pool->list_stats, 1);
-	list_stat_log(&pool->list_stats, r->st->n, "input io queue");
-	pthread_cond_signal(&pool->wait);
-	pthread_mutex_unlock(&pool->lock);
+	q = dnet_schedule_io_queue(pool, cmd);
+
+	r->queue_time = dnet_usecs_now();
+
+	pthread_mutex_lock(&q->lock);
+	list_add_tail(&r->req_entry, &q->lane[dnet_cmd_priority(cmd)]);
+	list_stat_size_increase(&q->list_stats, 1);
+	list_stat_log(&q->list_stats, r->st->n, "input io queue");
+	pthread_cond_signal(&q->wait);
+	pthread_mutex_unlock(&q->lock);
 }
 
 
@@ -229,10 +502,102 @@ void dnet_schedule_command(struct dnet_net_state *st)
 		st->rcv_data = NULL;
 	}
 
-	st->rcv_end = sizeof(struct dnet_cmd);
+	/* with compact framing every packet starts with a frame tag */
+	if (st->compact) {
+		st->rcv_flags = DNET_IO_FRAME;
+		st->rcv_end = sizeof(uint32_t);
+	} else {
+		st->rcv_end = sizeof(struct dnet_cmd);
+	}
 	st->rcv_offset = 0;
 }
 
+#ifdef HAVE_LZ4_SUPPORT
+/*
+ * Expands a packet whose body was LZ4-compressed by the sender (see
+ * dnet_io_req_queue()): the body carries struct dnet_lz4_hdr, @raw_size
+ * bytes of uncompressed attribute headers and one LZ4 block. Returns a
+ * freshly allocated request holding the original packet, @r is consumed.
+ * NULL return means the body was malformed and the connection has to be
+ * reset.
+ */
+static struct dnet_io_req *dnet_io_req_decompress(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_lz4_hdr hdr;
+	struct dnet_io_req *nr;
+	struct dnet_cmd *ncmd;
+	int err;
+
+	if (r->dsize < sizeof(struct dnet_lz4_hdr))
+		goto err_out_proto;
+
+	memcpy(&hdr, r->data, sizeof(struct dnet_lz4_hdr));
+	dnet_convert_lz4_hdr(&hdr);
+
+	if (hdr.raw_size > r->dsize - sizeof(struct dnet_lz4_hdr) ||
+			hdr.orig_size > INT_MAX || hdr.raw_size > INT_MAX)
+		goto err_out_proto;
+
+	nr = dnet_io_req_alloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) +
+			hdr.raw_size + hdr.orig_size);
+	if (!nr) {
+		dnet_io_req_free(r);
+		return NULL;
+	}
+
+	nr->header = nr + 1;
+	nr->hsize = sizeof(struct dnet_cmd);
+	nr->fd = -1;
+
+	ncmd = nr->header;
+	memcpy(ncmd, cmd, sizeof(struct dnet_cmd));
+	ncmd->size = hdr.raw_size + hdr.orig_size;
+	ncmd->flags &= ~DNET_FLAGS_LZ4;
+
+	nr->data = nr->header + sizeof(struct dnet_cmd);
+	nr->dsize = hdr.raw_size + hdr.orig_size;
+
+	memcpy(nr->data, r->data + sizeof(struct dnet_lz4_hdr), hdr.raw_size);
+
+	err = LZ4_decompress_safe(r->data + sizeof(struct dnet_lz4_hdr) + hdr.raw_size,
+			nr->data + hdr.raw_size,
+			r->dsize - sizeof(struct dnet_lz4_hdr) - hdr.raw_size,
+			hdr.orig_size);
+	if (err < 0 || (uint64_t)err != hdr.orig_size) {
+		dnet_io_req_free(nr);
+		goto err_out_proto;
+	}
+
+	dnet_io_req_free(r);
+	return nr;
+
+err_out_proto:
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: malformed LZ4 packet: trans: %llu, size: %llu, resetting connection.\n",
+			dnet_server_convert_dnet_addr(&st->addr),
+			(unsigned long long)(cmd->trans & ~DNET_TRANS_REPLY),
+			(unsigned long long)cmd->size);
+	dnet_io_req_free(r);
+	return NULL;
+}
+#else
+static struct dnet_io_req *dnet_io_req_decompress(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+
+	/*
+	 * This build never advertises DNET_CAPABILITIES_LZ4, so a compressed
+	 * packet means the peer violated the handshake - reset the connection.
+	 */
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: received LZ4 packet without liblz4 support: trans: %llu, size: %llu, resetting connection.\n",
+			dnet_server_convert_dnet_addr(&st->addr),
+			(unsigned long long)(cmd->trans & ~DNET_TRANS_REPLY),
+			(unsigned long long)cmd->size);
+	dnet_io_req_free(r);
+	return NULL;
+}
+#endif /* HAVE_LZ4_SUPPORT */
+
 static int dnet_process_recv_single(struct dnet_net_state *st)
 {
 	struct dnet_node *n = st->n;
@@ -242,11 +607,25 @@ static int dnet_process_recv_single(struct dnet_net_state *st)
 	int err;
 
 again:
+	/*
+	 * The handshake enables compact framing after the next header read
+	 * was already scheduled - re-route to the frame tag as long as
+	 * nothing of the packet has been consumed yet.
+	 */
+	if (st->compact && st->rcv_offset == 0 &&
+			(st->rcv_flags & DNET_IO_CMD) &&
+			!(st->rcv_flags & (DNET_IO_FRAME | DNET_IO_CMD_COMPACT))) {
+		st->rcv_flags = DNET_IO_FRAME;
+		st->rcv_end = sizeof(uint32_t);
+	}
+
 	/*
 	 * Reading command first.
 	 */
 	if (st->rcv_flags & DNET_IO_CMD)
 		data = &st->rcv_cmd;
+	else if (st->rcv_flags & DNET_IO_FRAME)
+		data = &st->rcv_frame;
 	else
 		data = st->rcv_data;
 	data += st->rcv_offset;
@@ -278,11 +657,51 @@ again:
 	if (st->rcv_offset != st->rcv_end)
 		goto again;
 
+	if ((st->rcv_flags & DNET_IO_FRAME) && !(st->rcv_flags & DNET_IO_CMD)) {
+		uint32_t frame = dnet_bswap32(st->rcv_frame);
+
+		st->rcv_offset = 0;
+		if (frame == DNET_FRAME_FULL) {
+			st->rcv_flags = DNET_IO_CMD | DNET_IO_FRAME;
+			st->rcv_end = sizeof(struct dnet_cmd);
+		} else if (frame == DNET_FRAME_COMPACT) {
+			st->rcv_flags = DNET_IO_CMD | DNET_IO_FRAME | DNET_IO_CMD_COMPACT;
+			st->rcv_end = sizeof(struct dnet_cmd_compact);
+		} else {
+			dnet_log(n, DNET_LOG_ERROR, "%s: invalid frame tag 0x%08x, resetting connection.\n",
+					dnet_server_convert_dnet_addr(&st->addr), frame);
+			err = -EPROTO;
+			goto out;
+		}
+
+		goto again;
+	}
+
 	if (st->rcv_flags & DNET_IO_CMD) {
 		unsigned long long tid;
 		struct dnet_cmd *c = &st->rcv_cmd;
 
-		dnet_convert_cmd(c);
+		if (st->rcv_flags & DNET_IO_CMD_COMPACT) {
+			/*
+			 * Expand the compact reply header in place: the ID
+			 * stays zeroed and is restored from the matched
+			 * transaction in dnet_process_recv(), the marker
+			 * flag tells it to do so.
+			 */
+			struct dnet_cmd_compact cc;
+
+			memcpy(&cc, &st->rcv_cmd, sizeof(struct dnet_cmd_compact));
+			dnet_convert_cmd_compact(&cc);
+
+			memset(c, 0, sizeof(struct dnet_cmd));
+			c->status = cc.status;
+			c->cmd = cc.cmd;
+			c->flags = cc.flags | DNET_FLAGS_COMPACT;
+			c->trans = cc.trans;
+			c->size = cc.size;
+		} else {
+			dnet_convert_cmd(c);
+		}
 
 		tid = c->trans & ~DNET_TRANS_REPLY;
 
@@ -292,12 +711,11 @@ again:
 				!!(c->trans & DNET_TRANS_REPLY),
 				(unsigned long long)c->size, (unsigned long long)c->flags, c->status);
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		r = dnet_io_req_alloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
 		if (!r) {
 			err = -ENOMEM;
 			goto out;
 		}
-		memset(r, 0, sizeof(struct dnet_io_req));
 
 		r->header = r + 1;
 		r->hsize = sizeof(struct dnet_cmd);
@@ -306,7 +724,7 @@ again:
 		st->rcv_data = r;
 		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
 		st->rcv_end = st->rcv_offset + c->size;
-		st->rcv_flags &= ~DNET_IO_CMD;
+		st->rcv_flags &= ~(DNET_IO_CMD | DNET_IO_CMD_COMPACT | DNET_IO_FRAME);
 
 		if (c->size) {
 			r->data = r->header + sizeof(struct dnet_cmd);
@@ -322,6 +740,14 @@ again:
 	r = st->rcv_data;
 	st->rcv_data = NULL;
 
+	if (((struct dnet_cmd *)r->header)->flags & DNET_FLAGS_LZ4) {
+		r = dnet_io_req_decompress(st, r);
+		if (!r) {
+			err = -EPROTO;
+			goto out;
+		}
+	}
+
 	dnet_schedule_command(st);
 
 	r->st = dnet_state_get(st);
@@ -410,7 +836,7 @@ int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *e
 
 	idx = dnet_local_addr_index(n, &saddr);
 
-	st = dnet_state_create(n, 0, NULL, 0, &addr, cs, &err, 0, idx, dnet_state_net_process);
+	st = dnet_state_create(n, 0, NULL, 0, &addr, cs, &err, 0, idx, 0, dnet_state_net_process);
 	if (!st) {
 		dnet_log(n, DNET_LOG_ERROR, "%s: Failed to create state for accepted client: %s [%d]\n",
 				dnet_server_convert_dnet_addr_raw(&addr, client_addr, sizeof(client_addr)), strerror(-err), -err);
@@ -434,6 +860,11 @@ void dnet_unschedule_send(struct dnet_net_state *st)
 {
 	struct epoll_event ev;
 
+	if (st->n->io->engine == DNET_NET_IO_ENGINE_URING) {
+		dnet_uring_unschedule(st, 1);
+		return;
+	}
+
 	ev.events = EPOLLOUT;
 	ev.data.ptr = st;
 
@@ -444,12 +875,155 @@ void dnet_unschedule_recv(struct dnet_net_state *st)
 {
 	struct epoll_event ev;
 
+	if (st->n->io->engine == DNET_NET_IO_ENGINE_URING) {
+		dnet_uring_unschedule(st, 0);
+		return;
+	}
+
 	ev.events = EPOLLIN;
 	ev.data.ptr = st;
 
 	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, &ev);
 }
 
+/* Limits for coalescing small inline replies into single writev() */
+#define DNET_SEND_BATCH_REQS		16
+#define DNET_SEND_BATCH_BYTES		(64 * 1024)
+
+/*
+ * Moves everything workers pushed into the lock-free send inbox to the
+ * network thread's private send list. The inbox is a LIFO stack, so the
+ * popped chain is reversed to restore queueing order. Only the network
+ * thread owning the state calls this.
+ */
+static void dnet_state_send_inbox_drain(struct dnet_net_state *st)
+{
+	struct dnet_io_req *r, *next, *prev = NULL;
+
+	r = __sync_lock_test_and_set(&st->send_inbox, NULL);
+	if (!r)
+		return;
+
+	while (r) {
+		next = r->inbox_next;
+		r->inbox_next = prev;
+		prev = r;
+		r = next;
+	}
+
+	for (r = prev; r; r = next) {
+		next = r->inbox_next;
+		list_add_tail(&r->req_entry, &st->send_list);
+	}
+}
+
+/*
+ * Coalesces consecutive small inline requests from the head of the send
+ * queue into one writev() call. The send list is private to the network
+ * thread owning the state, workers only push into the lock-free inbox -
+ * no locking is needed anywhere below.
+ *
+ * Returns -ENOENT when there is nothing to coalesce (caller falls back to
+ * the regular one-request path), zero or negative error otherwise.
+ */
+static int dnet_process_send_batch(struct dnet_net_state *st)
+{
+	struct dnet_io_req *r, *tmp;
+	struct iovec iov[DNET_SEND_BATCH_REQS * 2];
+	size_t total = 0, size, sent;
+	ssize_t err;
+	int num = 0, reqs = 0;
+
+	if (st->send_offset)
+		return -ENOENT;
+
+	list_for_each_entry(r, &st->send_list, req_entry) {
+		if (reqs >= DNET_SEND_BATCH_REQS)
+			break;
+		if (r->fd >= 0 || r->iov_num)
+			break;
+		if (total + r->hsize + r->dsize > DNET_SEND_BATCH_BYTES)
+			break;
+
+		if (r->hsize) {
+			iov[num].iov_base = r->header;
+			iov[num].iov_len = r->hsize;
+			num++;
+		}
+		if (r->dsize) {
+			iov[num].iov_base = r->data;
+			iov[num].iov_len = r->dsize;
+			num++;
+		}
+
+		total += r->hsize + r->dsize;
+		reqs++;
+	}
+
+	if (reqs < 2)
+		return -ENOENT;
+
+	err = writev(st->write_s, iov, num);
+	if (err < 0) {
+		err = -errno;
+		if (err == -EAGAIN || err == -EINTR)
+			return -EAGAIN;
+
+		dnet_log_err(st->n, "Failed to send reply batch: reqs: %d, size: %zu, socket: %d",
+				reqs, total, st->write_s);
+		st->need_exit = err;
+		return err;
+	}
+
+	if (err == 0) {
+		dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n",
+				dnet_state_dump_addr(st), st->write_s);
+		st->need_exit = -ECONNRESET;
+		return -ECONNRESET;
+	}
+
+	dnet_log(st->n, DNET_LOG_DEBUG, "%s: sent reply batch: reqs: %d, size: %zu/%zd\n",
+			dnet_state_dump_addr(st), reqs, total, err);
+
+	sent = err;
+
+	list_for_each_entry_safe(r, tmp, &st->send_list, req_entry) {
+		size = r->hsize + r->dsize;
+
+		if (sent < size) {
+			/* partially sent request continues through the regular path */
+			st->send_offset = sent;
+			break;
+		}
+
+		sent -= size;
+
+		list_del(&r->req_entry);
+
+		if (atomic_read(&st->send_queue_size) > 0)
+			if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
+				dnet_log(st->n, DNET_LOG_DEBUG,
+						"State low_watermark reached: %s: %d, waking up\n",
+						dnet_server_convert_dnet_addr(&st->addr),
+						atomic_read(&st->send_queue_size));
+				pthread_cond_broadcast(&st->send_wait);
+			}
+
+		dnet_io_req_free(r);
+
+		if (!sent)
+			break;
+	}
+
+	if (!st->send_offset) {
+		/* flush TCP output pipeline the same way dnet_send_request() does */
+		int nodelay = 1;
+		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
+	}
+
+	return 0;
+}
+
 static int dnet_process_send_single(struct dnet_net_state *st)
 {
 	struct dnet_io_req *r = NULL;
@@ -458,13 +1032,32 @@ static int dnet_process_send_single(struct dnet_net_state *st)
 	while (1) {
 		r = NULL;
 
-		pthread_mutex_lock(&st->send_lock);
+		err = dnet_process_send_batch(st);
+		if (err == 0)
+			continue;
+		if (err != -ENOENT)
+			goto err_out_exit;
+
+		dnet_state_send_inbox_drain(st);
+
 		if (!list_empty(&st->send_list)) {
 			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
 		} else {
+			/*
+			 * Disarm and re-check the inbox: a worker which pushed
+			 * after the drain above saw send_armed set and skipped
+			 * arming, so it is on us to rearm for its request.
+			 */
 			dnet_unschedule_send(st);
+
+			__sync_synchronize();
+			st->send_armed = 0;
+			__sync_synchronize();
+
+			if (st->send_inbox &&
+					__sync_bool_compare_and_swap(&st->send_armed, 0, 1))
+				dnet_schedule_send(st);
 		}
-		pthread_mutex_unlock(&st->send_lock);
 
 		if (!r) {
 			err = -EAGAIN;
@@ -472,10 +1065,8 @@ static int dnet_process_send_single(struct dnet_net_state *st)
 		}
 
 		err = dnet_send_request(st, r);
-		if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
-			pthread_mutex_lock(&st->send_lock);
+		if (st->send_offset == dnet_io_req_total_size(r)) {
 			list_del(&r->req_entry);
-			pthread_mutex_unlock(&st->send_lock);
 
 			if (atomic_read(&st->send_queue_size) > 0)
 				if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
@@ -503,6 +1094,9 @@ static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
 	struct epoll_event ev;
 	int err, fd;
 
+	if (st->n->io->engine == DNET_NET_IO_ENGINE_URING)
+		return dnet_uring_schedule(st, send);
+
 	if (send) {
 		ev.events = EPOLLOUT;
 		fd = st->write_s;
@@ -562,6 +1156,48 @@ err_out_exit:
 	return err;
 }
 
+int dnet_state_process_event(struct dnet_net_state *st, struct epoll_event *ev)
+{
+	int err;
+
+	while (1) {
+		err = st->process(st, ev);
+		if (err == 0)
+			continue;
+
+		if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS) {
+			err = 0;
+			break;
+		}
+
+		if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
+			if (!err)
+				err = -ETIMEDOUT;
+
+			dnet_state_reset(st, err);
+
+			pthread_mutex_lock(&st->send_lock);
+			dnet_unschedule_send(st);
+			dnet_unschedule_recv(st);
+			pthread_mutex_unlock(&st->send_lock);
+
+			dnet_add_reconnect_state(st->n, &st->addr, st->__join_state, 0);
+
+			// state still contains a fair number of transactions in its queue
+			// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
+			// while every transaction holds a reference
+			//
+			// IO thread could remove transaction, it is the only place allowed to do it.
+			// transactions may live in the tree and be accessed without locks in IO thread,
+			// IO thread is kind of 'owner' of the transaction processing
+			dnet_state_put(st);
+			break;
+		}
+	}
+
+	return err;
+}
+
 static void *dnet_io_process_network(void *data_)
 {
 	struct dnet_net_io *nio = data_;
@@ -590,41 +1226,14 @@ static void *dnet_io_process_network(void *data_)
 
 		st = ev.data.ptr;
 		st->epoll_fd = nio->epoll_fd;
+		st->nio = nio;
 
-		while (1) {
-			err = st->process(st, &ev);
-			if (err == 0)
-				continue;
-
-			if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
-				break;
-
-			if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
-				if (!err)
-					err = -ETIMEDOUT;
-
-				dnet_state_reset(st, err);
-
-				pthread_mutex_lock(&st->send_lock);
-				dnet_unschedule_send(st);
-				dnet_unschedule_recv(st);
-				pthread_mutex_unlock(&st->send_lock);
-
-				dnet_add_reconnect_state(st->n, &st->addr, st->__join_state);
-
-				// state still contains a fair number of transactions in its queue
-				// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
-				// while every transaction holds a reference
-				//
-				// IO thread could remove transaction, it is the only place allowed to do it.
-				// transactions may live in the tree and be accessed without locks in IO thread,
-				// IO thread is kind of 'owner' of the transaction processing
-				dnet_state_put(st);
-				break;
-			}
-		}
+		dnet_state_process_event(st, &ev);
 	}
 
+	dnet_io_req_cache_cleanup();
+	dnet_trans_cache_cleanup();
+
 	return &n->need_exit;
 }
 
@@ -648,7 +1257,7 @@ struct dnet_io_process_data {
 	int thread_number;
 };
 
-static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_index)
+static struct dnet_io_req *take_request_lane(struct dnet_work_queue *q, struct list_head *lane, int thread_index)
 {
 	struct dnet_io_req *it = NULL;
 	struct dnet_cmd *cmd;
@@ -656,7 +1265,7 @@ static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_
 	int i;
 	int ok;
 
-	list_for_each_entry(it, &pool->list, req_entry) {
+	list_for_each_entry(it, lane, req_entry) {
 		cmd = it->header;
 		tid = cmd->trans & ~DNET_TRANS_REPLY;
 		ok = 1;
@@ -665,14 +1274,14 @@ static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_
 		if (!(cmd->trans & DNET_TRANS_REPLY))
 			return it;
 
-		for (i = 0; i < pool->num; ++i) {
+		for (i = 0; i < q->num; ++i) {
 			 /* Someone claimed transaction @tid */
-			if (pool->trans[i] == tid) {
+			if (q->trans[i] == tid) {
 				 /* Its our transaction, let's handle it */
 				if (i == thread_index) {
 					/* its the last transaction in given set, clear 'claim' flag for current thread */
 					if (!(cmd->flags & DNET_FLAGS_MORE))
-						pool->trans[thread_index] = ~0ULL;
+						q->trans[thread_index] = ~0ULL;
 
 					return it;
 				}
@@ -688,10 +1297,10 @@ static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_
 		 * but only if 'we' do not wait for another transaction already.
 		 */
 		if (ok) {
-			if (pool->trans[thread_index] == ~0ULL) {
+			if (q->trans[thread_index] == ~0ULL) {
 				/* only claim this transaction if there will be others */
 				if (cmd->flags & DNET_FLAGS_MORE)
-					pool->trans[thread_index] = tid;
+					q->trans[thread_index] = tid;
 				return it;
 			}
 		}
@@ -700,10 +1309,146 @@ static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_
 	return NULL;
 }
 
+/*
+ * Weighted dequeue over priority lanes: every lane may consume its credit
+ * before lower lanes are considered, when all serviceable lanes ran out
+ * of credit the credits are refilled. With all lanes backlogged this
+ * converges to the dnet_io_prio_weight sharing, an empty lane costs
+ * nothing to the others.
+ */
+static struct dnet_io_req *take_request(struct dnet_work_queue *q, int thread_index)
+{
+	struct dnet_io_req *r;
+	int prio;
+
+	for (prio = 0; prio < DNET_IO_PRIO_NUM; ++prio) {
+		if (q->credit[prio] <= 0)
+			continue;
+
+		r = take_request_lane(q, &q->lane[prio], thread_index);
+		if (r) {
+			q->credit[prio]--;
+			return r;
+		}
+	}
+
+	for (prio = 0; prio < DNET_IO_PRIO_NUM; ++prio)
+		q->credit[prio] = dnet_io_prio_weight[prio];
+
+	for (prio = 0; prio < DNET_IO_PRIO_NUM; ++prio) {
+		r = take_request_lane(q, &q->lane[prio], thread_index);
+		if (r) {
+			q->credit[prio]--;
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Whether another entry of transaction @tid is queued in shard @q besides
+ * @self. Replies of one transaction are pinned to one shard, so any other
+ * queued packet of @tid precedes the terminal reply in processing order:
+ * stealing the terminal one while such a packet sits unclaimed would
+ * complete the transaction before its intermediate replies are handled.
+ */
+static int dnet_work_queue_tid_queued(struct dnet_work_queue *q, struct dnet_io_req *self, uint64_t tid)
+{
+	struct dnet_io_req *it;
+	struct dnet_cmd *cmd;
+	int prio;
+
+	for (prio = 0; prio < DNET_IO_PRIO_NUM; ++prio) {
+		list_for_each_entry(it, &q->lane[prio], req_entry) {
+			if (it == self)
+				continue;
+
+			cmd = it->header;
+			if ((cmd->trans & DNET_TRANS_REPLY) && ((cmd->trans & ~DNET_TRANS_REPLY) == tid))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Steal one request from the peer pool when own queue shard ran empty.
+ *
+ * Blocking workers may execute anything the nonblocking pool could run.
+ * Nonblocking workers only steal single-packet replies: reply completion
+ * never recurses into the nonblocking pool and thus can not deadlock it,
+ * while stealing a blocking command could.
+ *
+ * Transactions claimed by victim's workers and multi-packet replies are
+ * skipped - their ordering must stay within the victim shard.
+ */
+static struct dnet_io_req *dnet_work_pool_steal(struct dnet_work_pool *victim, int mode)
+{
+	struct dnet_io_req *it, *r = NULL;
+	struct dnet_work_queue *q;
+	struct dnet_cmd *cmd;
+	uint64_t tid;
+	int i, qi, prio, claimed;
+
+	if (!victim)
+		return NULL;
+
+	for (qi = 0; (qi < victim->queue_num) && !r; ++qi) {
+		q = &victim->queues[qi];
+
+		/* never wait on a contended victim shard - its own workers are active there */
+		if (pthread_mutex_trylock(&q->lock))
+			continue;
+
+		for (prio = 0; (prio < DNET_IO_PRIO_NUM) && !r; ++prio) {
+			list_for_each_entry(it, &q->lane[prio], req_entry) {
+				cmd = it->header;
+				tid = cmd->trans & ~DNET_TRANS_REPLY;
+
+				if (mode == DNET_WORK_IO_MODE_NONBLOCKING) {
+					if (!(cmd->trans & DNET_TRANS_REPLY) || (cmd->flags & DNET_FLAGS_MORE))
+						continue;
+				}
+
+				claimed = 0;
+				if (cmd->trans & DNET_TRANS_REPLY) {
+					if (cmd->flags & DNET_FLAGS_MORE)
+						claimed = 1;
+
+					for (i = 0; !claimed && (i < q->num); ++i) {
+						if (q->trans[i] == tid)
+							claimed = 1;
+					}
+
+					/* earlier packets of this transaction are still queued here */
+					if (!claimed && dnet_work_queue_tid_queued(q, it, tid))
+						claimed = 1;
+				}
+
+				if (claimed)
+					continue;
+
+				list_del_init(&it->req_entry);
+				list_stat_size_decrease(&q->list_stats, 1);
+				list_stat_wait_increase(&q->list_stats, dnet_usecs_now() - it->queue_time);
+				r = it;
+				break;
+			}
+		}
+
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	return r;
+}
+
 static void *dnet_io_process(void *data_)
 {
 	struct dnet_work_io *wio = data_;
 	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_work_queue *q = wio->queue;
 	struct dnet_node *n = pool->n;
 	struct dnet_net_state *st;
 	struct timespec ts;
@@ -714,7 +1459,15 @@ static void *dnet_io_process(void *data_)
 
 	dnet_set_name("io_pool");
 
-	while (!n->need_exit) {
+#ifdef HAVE_NUMA_SUPPORT
+	if (q->numa_node >= 0) {
+		/* run on the shard's node and allocate there even when spilling */
+		numa_run_on_node(q->numa_node);
+		numa_set_preferred(q->numa_node);
+	}
+#endif
+
+	while (!n->need_exit && !wio->need_exit) {
 		r = NULL;
 		err = 0;
 
@@ -722,28 +1475,40 @@ static void *dnet_io_process(void *data_)
 		ts.tv_sec = tv.tv_sec + 1;
 		ts.tv_nsec = tv.tv_usec * 1000;
 
-		pthread_mutex_lock(&pool->lock);
+		pthread_mutex_lock(&q->lock);
 
-		pool->trans[wio->thread_index] = -1;
+		q->trans[wio->thread_index] = -1;
 
-		if (!(r = take_request(pool, wio->thread_index))) {
-			err = pthread_cond_timedwait(&pool->wait, &pool->lock, &ts);
-			if ((r = take_request(pool, wio->thread_index)))
+		if (!(r = take_request(q, wio->thread_index))) {
+			err = pthread_cond_timedwait(&q->wait, &q->lock, &ts);
+			if ((r = take_request(q, wio->thread_index)))
 				err = 0;
 		}
 
 		if (r) {
 			list_del_init(&r->req_entry);
-			list_stat_size_decrease(&pool->list_stats, 1);
+			list_stat_size_decrease(&q->list_stats, 1);
+			list_stat_wait_increase(&q->list_stats, dnet_usecs_now() - r->queue_time);
 		}
-		pthread_mutex_unlock(&pool->lock);
+		pthread_mutex_unlock(&q->lock);
 
-		if (!r || err)
-			continue;
+		if (!r || err) {
+			/* own shard is empty - try to help the peer pool */
+			r = dnet_work_pool_steal(pool->mode == DNET_WORK_IO_MODE_BLOCKING ?
+					n->io->recv_pool_nb : n->io->recv_pool, pool->mode);
+			if (!r)
+				continue;
+
+			dnet_log(n, DNET_LOG_DEBUG, "%s pool stole request from peer pool\n",
+					dnet_work_io_mode_str(pool->mode));
+		}
 
 		st = r->st;
 		cmd = r->header;
+		dnet_qos_dequeue(n, cmd);
 		trace_id = cmd->id.trace_id;
+		trace_queue_time = r->queue_time;
+		trace_dequeue_time = dnet_usecs_now();
 
 		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: hsize: %zu, dsize: %zu, mode: %s\n",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode));
@@ -755,9 +1520,210 @@ static void *dnet_io_process(void *data_)
 		dnet_state_put(st);
 	}
 
+	dnet_io_req_cache_cleanup();
+	dnet_trans_cache_cleanup();
+
+	return NULL;
+}
+
+/* Pool monitor sampling interval and reaction thresholds, all in seconds */
+#define DNET_POOL_MONITOR_INTERVAL	1
+#define DNET_POOL_BUSY_SECONDS		3
+#define DNET_POOL_IDLE_SECONDS		60
+#define DNET_POOL_GROW_STEP		4
+
+/*
+ * Resizes blocking IO pool between configured min/max bounds.
+ *
+ * Queue depth is sampled from per-shard list_stats every second: when
+ * summary backlog exceeds number of workers for several seconds in a row,
+ * pool grows by a step, and after a long fully-idle period it sheds one
+ * worker per second until the lower bound (or next request) is reached.
+ * Timings are deliberately asymmetric - growing has to be fast to serve
+ * the load spike, shrinking is just reclaiming idle thread stacks.
+ */
+/*
+ * Approximate number of requests queued in the IO processing pools.
+ * Used by backends (defragmentation scheduler) to tell whether there is
+ * foreground load - the probe is advisory, so per-shard locking is the
+ * only synchronization.
+ */
+uint64_t dnet_node_io_queue_size(struct dnet_node *n)
+{
+	struct dnet_work_pool *pools[2] = { n->io->recv_pool, n->io->recv_pool_nb };
+	struct dnet_work_queue *q;
+	uint64_t depth = 0;
+	int i, p;
+
+	for (p = 0; p < 2; ++p) {
+		for (i = 0; i < pools[p]->queue_num; ++i) {
+			q = &pools[p]->queues[i];
+
+			pthread_mutex_lock(&q->lock);
+			depth += q->list_stats.list_size;
+			pthread_mutex_unlock(&q->lock);
+		}
+	}
+
+	return depth;
+}
+
+/*
+ * Fills IO queue section of the DNET_CMD_STAT reply: per-pool queue
+ * length and wait-time counters summed over per-thread shards plus
+ * summary length of per-client send queues. The probe is advisory, so
+ * per-shard locking is the only synchronization. The rest of @stat has
+ * already been converted to wire order by the backend when this is
+ * called, so the filled fields are swapped by hand.
+ */
+void dnet_fill_queue_stat(void *state, struct dnet_stat *stat)
+{
+	struct dnet_node *n = dnet_get_node_from_state(state);
+	struct dnet_work_pool *pool;
+	struct dnet_work_queue *q;
+	struct dnet_net_state *st;
+	uint64_t size, max, num, wait;
+	uint64_t send_queue_size = 0;
+	int i, p;
+
+	if (!n || !n->io)
+		return;
+
+	for (p = 0; p < 2; ++p) {
+		pool = p ? n->io->recv_pool_nb : n->io->recv_pool;
+
+		size = max = num = wait = 0;
+		for (i = 0; i < pool->queue_num; ++i) {
+			q = &pool->queues[i];
+
+			pthread_mutex_lock(&q->lock);
+			size += q->list_stats.list_size;
+			max += q->list_stats.max_list_size;
+			num += q->list_stats.wait_num;
+			wait += q->list_stats.wait_time;
+			pthread_mutex_unlock(&q->lock);
+		}
+
+		if (p) {
+			stat->io_nb_queue_size = dnet_bswap64(size);
+			stat->io_nb_queue_max = dnet_bswap64(max);
+			stat->io_nb_queue_num = dnet_bswap64(num);
+			stat->io_nb_queue_wait_time = dnet_bswap64(wait);
+		} else {
+			stat->io_queue_size = dnet_bswap64(size);
+			stat->io_queue_max = dnet_bswap64(max);
+			stat->io_queue_num = dnet_bswap64(num);
+			stat->io_queue_wait_time = dnet_bswap64(wait);
+		}
+	}
+
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(st, &n->storage_state_list, storage_state_entry) {
+		send_queue_size += atomic_read(&st->send_queue_size);
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	stat->send_queue_size = dnet_bswap64(send_queue_size);
+}
+
+static void *dnet_io_pool_monitor(void *data_)
+{
+	struct dnet_node *n = data_;
+	struct dnet_work_pool *pool = n->io->recv_pool;
+	struct dnet_work_queue *q;
+	uint64_t depth;
+	int busy = 0, idle = 0;
+	int i, step, target;
+
+	dnet_set_name("pool_mon");
+
+	while (!n->need_exit) {
+		sleep(DNET_POOL_MONITOR_INTERVAL);
+
+		/* operator-requested resize via DNET_CMD_STATUS tuning */
+		target = n->io->pool_resize_target;
+		if (target > 0) {
+			n->io->pool_resize_target = 0;
+
+			while (pool->num > target)
+				dnet_work_pool_shrink(n, pool);
+			if (pool->num < target)
+				dnet_work_pool_grow(n, pool, target - pool->num, dnet_io_process);
+
+			/* keep autoscale bounds containing the explicit size */
+			if (pool->max) {
+				if (target < pool->min)
+					pool->min = target;
+				if (target > pool->max)
+					pool->max = target;
+			}
+
+			busy = 0;
+			idle = 0;
+			continue;
+		}
+
+		/* without autoscale bounds monitor only serves explicit resizes */
+		if (!pool->max)
+			continue;
+
+		depth = 0;
+		for (i = 0; i < pool->queue_num; ++i) {
+			q = &pool->queues[i];
+
+			pthread_mutex_lock(&q->lock);
+			depth += q->list_stats.list_size;
+			pthread_mutex_unlock(&q->lock);
+		}
+
+		if (depth > (uint64_t)pool->num) {
+			idle = 0;
+
+			if (++busy >= DNET_POOL_BUSY_SECONDS && pool->num < pool->max) {
+				step = pool->max - pool->num;
+				if (step > DNET_POOL_GROW_STEP)
+					step = DNET_POOL_GROW_STEP;
+
+				if (!dnet_work_pool_grow(n, pool, step, dnet_io_process))
+					busy = 0;
+			}
+		} else if (depth == 0) {
+			busy = 0;
+
+			if (++idle >= DNET_POOL_IDLE_SECONDS && pool->num > pool->min)
+				dnet_work_pool_shrink(n, pool);
+		} else {
+			busy = 0;
+			idle = 0;
+		}
+	}
+
 	return NULL;
 }
 
+/*
+ * Runtime tuning entry: explicit @num is applied asynchronously by the pool
+ * monitor (an IO worker can not join itself), autoscale bounds take effect
+ * immediately. Non-positive arguments leave the corresponding setting intact.
+ */
+void dnet_io_pool_set_size(struct dnet_node *n, int num, int min, int max)
+{
+	struct dnet_work_pool *pool = n->io->recv_pool;
+
+	if (min > 0 && max > min) {
+		pool->min = min;
+		pool->max = max;
+
+		dnet_log(n, DNET_LOG_INFO, "IO pool autoscale bounds changed: %d/%d\n", min, max);
+	}
+
+	if (num > 0) {
+		n->io->pool_resize_target = num;
+
+		dnet_log(n, DNET_LOG_INFO, "IO pool resize requested: %d -> %d threads\n", pool->num, num);
+	}
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
 	int err, i;
@@ -775,13 +1741,53 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 	n->io->net_thread_pos = 0;
 	n->io->net = (struct dnet_net_io *)(n->io + 1);
 
-	n->io->recv_pool = dnet_work_pool_alloc(n, cfg->io_thread_num, DNET_WORK_IO_MODE_BLOCKING, dnet_io_process);
+	n->io->numa_nodes = 0;
+#ifdef HAVE_NUMA_SUPPORT
+	if (cfg->numa_aware && numa_available() >= 0) {
+		n->io->numa_nodes = numa_max_node() + 1;
+		if (n->io->numa_nodes > 1)
+			dnet_log(n, DNET_LOG_INFO, "NUMA-aware IO pool placement enabled: %d nodes\n",
+					n->io->numa_nodes);
+	}
+#else
+	if (cfg->numa_aware)
+		dnet_log(n, DNET_LOG_ERROR, "NUMA support is not compiled in, 'numa_aware' config option ignored\n");
+#endif
+
+	n->io->engine = DNET_NET_IO_ENGINE_EPOLL;
+	if (cfg->net_io_engine == DNET_NET_IO_ENGINE_URING) {
+#ifdef HAVE_URING_SUPPORT
+		n->io->engine = DNET_NET_IO_ENGINE_URING;
+		dnet_log(n, DNET_LOG_INFO, "Using io_uring network engine\n");
+#else
+		dnet_log(n, DNET_LOG_ERROR, "io_uring network engine is not compiled in, falling back to epoll\n");
+#endif
+	}
+
+	n->io->recv_pool = dnet_work_pool_alloc(n, cfg->io_thread_num, DNET_WORK_IO_MODE_BLOCKING,
+			cfg->io_pool_queue_shards, dnet_io_process);
 	if (!n->io->recv_pool) {
 		err = -ENOMEM;
 		goto err_out_free;
 	}
 
-	n->io->recv_pool_nb = dnet_work_pool_alloc(n, cfg->nonblocking_io_thread_num, DNET_WORK_IO_MODE_NONBLOCKING, dnet_io_process);
+	if (cfg->io_thread_num_max > cfg->io_thread_num_min && cfg->io_thread_num_min > 0) {
+		n->io->recv_pool->min = cfg->io_thread_num_min;
+		n->io->recv_pool->max = cfg->io_thread_num_max;
+
+		/* bring startup size into configured bounds */
+		if (n->io->recv_pool->num < n->io->recv_pool->min) {
+			err = dnet_work_pool_grow(n, n->io->recv_pool,
+					n->io->recv_pool->min - n->io->recv_pool->num, dnet_io_process);
+			if (err)
+				goto err_out_free_recv_pool;
+		}
+		while (n->io->recv_pool->num > n->io->recv_pool->max)
+			dnet_work_pool_shrink(n, n->io->recv_pool);
+	}
+
+	n->io->recv_pool_nb = dnet_work_pool_alloc(n, cfg->nonblocking_io_thread_num, DNET_WORK_IO_MODE_NONBLOCKING,
+			cfg->io_pool_queue_shards, dnet_io_process);
 	if (!n->io->recv_pool_nb) {
 		err = -ENOMEM;
 		goto err_out_free_recv_pool;
@@ -789,6 +1795,7 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 	for (i=0; i<n->io->net_thread_num; ++i) {
 		struct dnet_net_io *nio = &n->io->net[i];
+		void *(* process)(void *) = dnet_io_process_network;
 
 		nio->n = n;
 
@@ -802,8 +1809,20 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		fcntl(nio->epoll_fd, F_SETFD, FD_CLOEXEC);
 		fcntl(nio->epoll_fd, F_SETFL, O_NONBLOCK);
 
-		err = pthread_create(&nio->tid, NULL, dnet_io_process_network, nio);
+		if (n->io->engine == DNET_NET_IO_ENGINE_URING) {
+			err = dnet_uring_init(nio);
+			if (err) {
+				close(nio->epoll_fd);
+				dnet_log(n, DNET_LOG_ERROR, "Failed to create uring context: %d\n", err);
+				goto err_out_net_destroy;
+			}
+
+			process = dnet_io_process_network_uring;
+		}
+
+		err = pthread_create(&nio->tid, NULL, process, nio);
 		if (err) {
+			dnet_uring_exit(nio);
 			close(nio->epoll_fd);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create network processing thread: %d\n", err);
@@ -811,11 +1830,26 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		}
 	}
 
+	/* monitor is always needed: it applies runtime resize requests too */
+	err = pthread_create(&n->io->pool_monitor_tid, NULL, dnet_io_pool_monitor, n);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Failed to create IO pool monitor thread: %d\n", err);
+		n->need_exit = err;
+		goto err_out_net_destroy;
+	}
+
+	n->io->pool_monitor_started = 1;
+	if (n->io->recv_pool->max)
+		dnet_log(n, DNET_LOG_INFO, "IO pool autoscaling enabled: %d threads, bounds: %d/%d\n",
+				n->io->recv_pool->num, n->io->recv_pool->min, n->io->recv_pool->max);
+
 	return 0;
 
 err_out_net_destroy:
 	while (--i >= 0) {
 		pthread_join(n->io->net[i].tid, NULL);
+		dnet_uring_exit(&n->io->net[i]);
 		close(n->io->net[i].epoll_fd);
 	}
 
@@ -836,8 +1870,12 @@ void dnet_io_exit(struct dnet_node *n)
 
 	n->need_exit = 1;
 
+	if (io->pool_monitor_started)
+		pthread_join(io->pool_monitor_tid, NULL);
+
 	for (i=0; i<io->net_thread_num; ++i) {
 		pthread_join(io->net[i].tid, NULL);
+		dnet_uring_exit(&io->net[i]);
 		close(io->net[i].epoll_fd);
 	}
 
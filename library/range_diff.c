@@ -0,0 +1,440 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+/*
+ * DNET_CMD_RANGE_DIFF: server-to-server replica comparison.
+ *
+ * The receiving node iterates the requested key range locally, asks its
+ * counterpart in the remote group to iterate the same range over
+ * DNET_CMD_ITERATOR (metadata only, optionally with checksums), and
+ * merge-walks the two sorted digest lists. Only divergent keys are sent
+ * back as dnet_range_diff_entry records, so the recovery driver never
+ * sees the keys that already match and only has to schedule copies.
+ *
+ * The caller must intersect the range with both route tables so that a
+ * single remote node owns it completely, and should diff a large keyspace
+ * in slices: both digest lists are held in memory for the merge.
+ */
+
+struct dnet_diff_digests {
+	struct dnet_iterator_response	*resp;
+	uint64_t			num, cap;
+
+	/* remote digests are appended from network IO threads */
+	pthread_mutex_t			lock;
+};
+
+static int dnet_diff_digests_init(struct dnet_diff_digests *d)
+{
+	memset(d, 0, sizeof(struct dnet_diff_digests));
+	return -pthread_mutex_init(&d->lock, NULL);
+}
+
+static void dnet_diff_digests_free(struct dnet_diff_digests *d)
+{
+	free(d->resp);
+	pthread_mutex_destroy(&d->lock);
+}
+
+static int dnet_diff_digests_add(struct dnet_diff_digests *d, struct dnet_iterator_response *resp)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->num == d->cap) {
+		uint64_t cap = d->cap ? d->cap * 2 : 1024;
+		struct dnet_iterator_response *tmp;
+
+		tmp = realloc(d->resp, cap * sizeof(struct dnet_iterator_response));
+		if (!tmp) {
+			err = -ENOMEM;
+			goto err_out_unlock;
+		}
+
+		d->resp = tmp;
+		d->cap = cap;
+	}
+
+	memcpy(&d->resp[d->num++], resp, sizeof(struct dnet_iterator_response));
+
+err_out_unlock:
+	pthread_mutex_unlock(&d->lock);
+	return err;
+}
+
+/*
+ * Local leg: next_callback invoked by dnet_iterator_callback_common with
+ * a wire-order response header (no data, DNET_IFLAGS_DATA is never set).
+ */
+static int dnet_diff_local_callback(void *priv, void *data, uint64_t dsize)
+{
+	struct dnet_diff_digests *d = priv;
+	struct dnet_iterator_response resp;
+
+	if (dsize < sizeof(struct dnet_iterator_response))
+		return -EINVAL;
+
+	memcpy(&resp, data, sizeof(struct dnet_iterator_response));
+	dnet_convert_iterator_response(&resp);
+
+	return dnet_diff_digests_add(d, &resp);
+}
+
+struct dnet_diff_remote {
+	struct dnet_wait		*w;
+	struct dnet_diff_digests	*d;
+	int				err;
+};
+
+static int dnet_diff_remote_complete(struct dnet_net_state *state, struct dnet_cmd *cmd, void *priv)
+{
+	struct dnet_diff_remote *r = priv;
+	struct dnet_iterator_response resp;
+	struct dnet_wait *w = r->w;
+	int err;
+
+	if (is_trans_destroyed(state, cmd)) {
+		dnet_wakeup(w, w->cond++);
+		dnet_wait_put(w);
+		return 0;
+	}
+
+	if (cmd->status) {
+		r->err = cmd->status;
+		return cmd->status;
+	}
+
+	if (cmd->size < sizeof(struct dnet_iterator_response))
+		return 0;
+
+	memcpy(&resp, cmd + 1, sizeof(struct dnet_iterator_response));
+	dnet_convert_iterator_response(&resp);
+
+	err = dnet_diff_digests_add(r->d, &resp);
+	if (err)
+		r->err = err;
+	return err;
+}
+
+static int dnet_diff_resp_cmp(const void *p1, const void *p2)
+{
+	const struct dnet_iterator_response *r1 = p1, *r2 = p2;
+
+	return dnet_id_cmp_str(r1->key.id, r2->key.id);
+}
+
+/*
+ * Fetch digests of @range from the node serving @range.key_begin in
+ * @group_id: start a network iterator there without DNET_IFLAGS_DATA and
+ * collect the response headers it streams back.
+ */
+static int dnet_diff_remote_digests(struct dnet_net_state *st, struct dnet_cmd *cmd,
+		struct dnet_range_diff_request *req, struct dnet_iterator_request *ireq,
+		struct dnet_diff_digests *d)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_net_state *rst;
+	struct dnet_session *s;
+	struct dnet_trans_control ctl;
+	struct dnet_diff_remote r;
+	struct dnet_wait *w;
+	struct dnet_iterator_request *remote_req;
+	struct dnet_id rid;
+	void *payload;
+	uint64_t payload_size = sizeof(struct dnet_iterator_request) + sizeof(struct dnet_iterator_range);
+	int err;
+
+	memset(&rid, 0, sizeof(struct dnet_id));
+	rid.group_id = req->group_id;
+	memcpy(rid.id, req->range.key_begin.id, DNET_ID_SIZE);
+
+	rst = dnet_state_get_first(n, &rid);
+	if (!rst) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: range-diff: no state in remote group %d\n",
+				dnet_dump_id(&cmd->id), req->group_id);
+		err = -ENXIO;
+		goto err_out_exit;
+	}
+
+	s = dnet_session_create(n);
+	if (!s) {
+		err = -ENOMEM;
+		goto err_out_state_put;
+	}
+
+	w = dnet_wait_alloc(0);
+	if (!w) {
+		err = -ENOMEM;
+		goto err_out_session_destroy;
+	}
+
+	payload = malloc(payload_size);
+	if (!payload) {
+		err = -ENOMEM;
+		goto err_out_wait_put;
+	}
+
+	remote_req = payload;
+	memcpy(remote_req, ireq, sizeof(struct dnet_iterator_request));
+	remote_req->itype = DNET_ITYPE_NETWORK;
+	dnet_convert_iterator_request(remote_req);
+	/* raw ids are not converted, see dnet_cmd_iterator() */
+	memcpy(payload + sizeof(struct dnet_iterator_request), &req->range,
+			sizeof(struct dnet_iterator_range));
+
+	r.w = w;
+	r.d = d;
+	r.err = 0;
+
+	memset(&ctl, 0, sizeof(struct dnet_trans_control));
+	memcpy(&ctl.id, &rid, sizeof(struct dnet_id));
+	ctl.cmd = DNET_CMD_ITERATOR;
+	ctl.cflags = DNET_FLAGS_NEED_ACK | DNET_FLAGS_NOLOCK;
+	ctl.data = payload;
+	ctl.size = payload_size;
+	ctl.complete = dnet_diff_remote_complete;
+	ctl.priv = &r;
+
+	dnet_wait_get(w);
+	err = dnet_trans_alloc_send_state(s, rst, &ctl);
+	if (err)
+		goto err_out_free;
+
+	err = dnet_wait_event(w, w->cond != 0, dnet_session_get_timeout(s));
+	if (!err)
+		err = r.err;
+
+err_out_free:
+	free(payload);
+err_out_wait_put:
+	dnet_wait_put(w);
+err_out_session_destroy:
+	dnet_session_destroy(s);
+err_out_state_put:
+	dnet_state_put(rst);
+err_out_exit:
+	return err;
+}
+
+static int dnet_diff_entry_add(struct dnet_range_diff_entry **entries, uint64_t *num, uint64_t *cap,
+		struct dnet_raw_id *key, uint64_t flags,
+		struct dnet_iterator_response *local, struct dnet_iterator_response *remote)
+{
+	struct dnet_range_diff_entry *e;
+
+	if (*num == *cap) {
+		uint64_t new_cap = *cap ? *cap * 2 : 256;
+
+		e = realloc(*entries, new_cap * sizeof(struct dnet_range_diff_entry));
+		if (!e)
+			return -ENOMEM;
+
+		*entries = e;
+		*cap = new_cap;
+	}
+
+	e = &(*entries)[(*num)++];
+	memset(e, 0, sizeof(struct dnet_range_diff_entry));
+	memcpy(&e->key, key, sizeof(struct dnet_raw_id));
+	e->flags = flags;
+	if (local) {
+		e->local_ts = local->timestamp;
+		e->local_size = local->size;
+	}
+	if (remote) {
+		e->remote_ts = remote->timestamp;
+		e->remote_size = remote->size;
+	}
+
+	return 0;
+}
+
+/*
+ * Merge-walk two key-sorted digest lists and collect divergent entries.
+ */
+static int dnet_diff_merge(struct dnet_diff_digests *local, struct dnet_diff_digests *remote,
+		uint64_t flags, struct dnet_range_diff_entry **entries, uint64_t *num)
+{
+	struct dnet_iterator_response *l, *r;
+	uint64_t li = 0, ri = 0, cap = 0;
+	uint64_t dflags;
+	int cmp, err = 0;
+
+	*entries = NULL;
+	*num = 0;
+
+	qsort(local->resp, local->num, sizeof(struct dnet_iterator_response), dnet_diff_resp_cmp);
+	qsort(remote->resp, remote->num, sizeof(struct dnet_iterator_response), dnet_diff_resp_cmp);
+
+	while (li < local->num || ri < remote->num) {
+		l = li < local->num ? &local->resp[li] : NULL;
+		r = ri < remote->num ? &remote->resp[ri] : NULL;
+
+		cmp = !l ? 1 : (!r ? -1 : dnet_id_cmp_str(l->key.id, r->key.id));
+
+		if (cmp < 0) {
+			err = dnet_diff_entry_add(entries, num, &cap, &l->key,
+					DNET_DIFF_REMOTE_MISSING, l, NULL);
+			li++;
+		} else if (cmp > 0) {
+			err = dnet_diff_entry_add(entries, num, &cap, &r->key,
+					DNET_DIFF_LOCAL_MISSING, NULL, r);
+			ri++;
+		} else {
+			dflags = 0;
+
+			cmp = dnet_time_cmp(&l->timestamp, &r->timestamp);
+			if (cmp > 0)
+				dflags = DNET_DIFF_LOCAL_NEWER;
+			else if (cmp < 0)
+				dflags = DNET_DIFF_REMOTE_NEWER;
+			else if (l->size != r->size)
+				dflags = DNET_DIFF_DATA_MISMATCH;
+			else if ((flags & DNET_IFLAGS_CSUM) &&
+					memcmp(l->checksum, r->checksum, sizeof(l->checksum)))
+				dflags = DNET_DIFF_DATA_MISMATCH;
+
+			if (dflags)
+				err = dnet_diff_entry_add(entries, num, &cap, &l->key, dflags, l, r);
+			li++;
+			ri++;
+		}
+
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
+int dnet_cmd_range_diff(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_range_diff_request *req = data;
+	struct dnet_iterator_request ireq;
+	struct dnet_iterator_common_private cpriv;
+	struct dnet_iterator_ctl ictl;
+	struct dnet_diff_digests local, remote;
+	struct dnet_range_diff_entry *entries = NULL;
+	struct dnet_raw_id empty_key = { .id = {} };
+	uint64_t i, num = 0;
+	int err;
+
+	if (cmd->size < sizeof(struct dnet_range_diff_request)) {
+		err = -EINVAL;
+		goto err_out_exit;
+	}
+	dnet_convert_range_diff_request(req);
+
+	if (req->flags & ~(DNET_IFLAGS_TS_RANGE | DNET_IFLAGS_CSUM)) {
+		err = -ENOTSUP;
+		goto err_out_exit;
+	}
+	if (!n->cb->iterator) {
+		err = -ENOTSUP;
+		goto err_out_exit;
+	}
+	if (dnet_id_cmp_str(req->range.key_begin.id, req->range.key_end.id) > 0) {
+		err = -ERANGE;
+		goto err_out_exit;
+	}
+
+	/* Both iterator legs share one request */
+	memset(&ireq, 0, sizeof(struct dnet_iterator_request));
+	ireq.action = DNET_ITERATOR_ACTION_START;
+	ireq.flags = req->flags;
+	ireq.range_num = 1;
+	ireq.time_begin = req->time_begin;
+	ireq.time_end = req->time_end;
+	if (memcmp(&empty_key, &req->range.key_begin, sizeof(struct dnet_raw_id)) ||
+			memcmp(&empty_key, &req->range.key_end, sizeof(struct dnet_raw_id)))
+		ireq.flags |= DNET_IFLAGS_KEY_RANGE;
+
+	err = dnet_diff_digests_init(&local);
+	if (err)
+		goto err_out_exit;
+	err = dnet_diff_digests_init(&remote);
+	if (err)
+		goto err_out_free_local;
+
+	/* Local leg: drive the backend iterator through the common filter */
+	memset(&cpriv, 0, sizeof(struct dnet_iterator_common_private));
+	cpriv.req = &ireq;
+	cpriv.range = &req->range;
+	cpriv.n = n;
+	cpriv.next_callback = dnet_diff_local_callback;
+	cpriv.next_private = &local;
+
+	cpriv.it = dnet_iterator_create(n);
+	if (!cpriv.it) {
+		err = -ENOMEM;
+		goto err_out_free_remote;
+	}
+
+	memset(&ictl, 0, sizeof(struct dnet_iterator_ctl));
+	ictl.iterate_private = n->cb->command_private;
+	ictl.callback = dnet_iterator_callback_common;
+	ictl.callback_private = &cpriv;
+
+	err = n->cb->iterator(&ictl);
+	dnet_iterator_destroy(n, cpriv.it);
+	if (err)
+		goto err_out_free_remote;
+
+	/* Remote leg */
+	err = dnet_diff_remote_digests(st, cmd, req, &ireq, &remote);
+	if (err)
+		goto err_out_free_remote;
+
+	err = dnet_diff_merge(&local, &remote, req->flags, &entries, &num);
+	if (err)
+		goto err_out_free_entries;
+
+	dnet_log(n, DNET_LOG_INFO, "%s: range-diff: group: %d, local: %llu, remote: %llu, diff: %llu\n",
+			dnet_dump_id(&cmd->id), req->group_id,
+			(unsigned long long)local.num, (unsigned long long)remote.num,
+			(unsigned long long)num);
+
+	if (num) {
+		for (i = 0; i < num; ++i)
+			dnet_convert_range_diff_entry(&entries[i]);
+
+		err = dnet_send_reply(st, cmd, entries,
+				num * sizeof(struct dnet_range_diff_entry), 1);
+	}
+
+err_out_free_entries:
+	free(entries);
+err_out_free_remote:
+	dnet_diff_digests_free(&remote);
+err_out_free_local:
+	dnet_diff_digests_free(&local);
+err_out_exit:
+	return err;
+}
@@ -173,6 +173,28 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Joins deferred backend initialization started by the config parser.
+ * Idempotent: the async flag is dropped after the first join, so the
+ * error unwind may call it again safely.
+ */
+static int dnet_server_backend_wait(struct dnet_config_data *cfg_data)
+{
+	int err;
+
+	if (!cfg_data || !cfg_data->backend_init_async)
+		return 0;
+
+	cfg_data->backend_init_async = 0;
+	cfg_data->cfg_state.cb_deferred = 0;
+
+	err = pthread_join(cfg_data->backend_init_thread, NULL);
+	if (err)
+		return -err;
+
+	return cfg_data->backend_init_err;
+}
+
 static void dnet_local_addr_cleanup(struct dnet_node *n)
 {
 	free(n->addrs);
@@ -234,22 +256,42 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data, str
 				n->notify_hash_size);
 	}
 
-	err = dnet_cache_init(n);
+	err = dnet_csum_cache_init(n);
 	if (err)
 		goto err_out_notify_exit;
 
+	err = dnet_cache_init(n);
+	if (err)
+		goto err_out_csum_cache_exit;
+
 	err = dnet_local_addr_add(n, addrs, addr_num);
 	if (err)
 		goto err_out_cache_cleanup;
 
+	/*
+	 * Everything above (node threads, notify, caches, addresses) does not
+	 * need the backend, so it ran concurrently with backend init: ids
+	 * below use backend storage_free and network state creation makes the
+	 * node serve commands, wait for the backend here.
+	 */
+	err = dnet_server_backend_wait(cfg_data);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "Backend initialization failed: %s %d.\n", strerror(-err), err);
+		goto err_out_addr_cleanup;
+	}
+	n->cb = cfg->cb;
+
 	if (cfg->flags & DNET_CFG_JOIN_NETWORK) {
 		struct dnet_addr la;
 		int s;
 
-		err = dnet_locks_init(n, 1024);
+		err = dnet_locks_init(n, cfg->oplock_num ? cfg->oplock_num : 1024);
 		if (err)
 			goto err_out_addr_cleanup;
 
+		/* iterator checkpoints live next to the ids file */
+		snprintf(n->iterator_dir, sizeof(n->iterator_dir), "%s", cfg->history_env);
+
 		ids = dnet_ids_init(n, cfg->history_env, &id_num, cfg->storage_free, cfg_data->cfg_addrs, cfg_data->cfg_remotes);
 		if (!ids)
 			goto err_out_locks_destroy;
@@ -265,7 +307,7 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data, str
 		s = err;
 		dnet_setup_id(&n->id, cfg->group_id, ids[0].id);
 
-		n->st = dnet_state_create(n, cfg->group_id, ids, id_num, &la, s, &err, DNET_JOIN, -1, dnet_state_accept_process);
+		n->st = dnet_state_create(n, cfg->group_id, ids, id_num, &la, s, &err, DNET_JOIN, -1, 0, dnet_state_accept_process);
 		if (!n->st) {
 			close(s);
 			goto err_out_state_destroy;
@@ -286,6 +328,10 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data, str
 		}
 	}
 
+	err = dnet_monitor_init(n, cfg);
+	if (err)
+		goto err_out_state_destroy;
+
 	dnet_log(n, DNET_LOG_DEBUG, "New server node has been created at port %d, ids: %d.\n", cfg->port, id_num);
 
 	pthread_sigmask(SIG_SETMASK, &previous_sigset, NULL);
@@ -302,11 +348,15 @@ err_out_addr_cleanup:
 	dnet_local_addr_cleanup(n);
 err_out_cache_cleanup:
 	dnet_cache_cleanup(n);
+err_out_csum_cache_exit:
+	dnet_csum_cache_exit(n);
 err_out_notify_exit:
 	dnet_notify_exit(n);
 err_out_node_destroy:
 	dnet_node_destroy(n);
 err_out_exit:
+	/* never leave deferred backend init running past node creation */
+	dnet_server_backend_wait(cfg_data);
 	pthread_sigmask(SIG_SETMASK, &previous_sigset, NULL);
 	return NULL;
 }
@@ -315,6 +365,7 @@ void dnet_server_node_destroy(struct dnet_node *n)
 {
 	dnet_log(n, DNET_LOG_DEBUG, "Destroying server node.\n");
 
+	dnet_monitor_exit(n);
 	dnet_srw_cleanup(n);
 	dnet_cache_cleanup(n);
 
@@ -325,6 +376,7 @@ void dnet_server_node_destroy(struct dnet_node *n)
 
 	dnet_locks_destroy(n);
 	dnet_local_addr_cleanup(n);
+	dnet_csum_cache_exit(n);
 	dnet_notify_exit(n);
 
 	if (n->config_data) {
@@ -26,53 +26,176 @@
 #include "elliptics/packet.h"
 #include "elliptics/interface.h"
 
-static inline int dnet_trans_cmp(uint64_t old, uint64_t new)
+/*
+ * Size-classed recycling for transaction objects: the hot path of bulk
+ * client operations allocates and frees one dnet_trans (plus small
+ * payload) per key, which is mostly allocator time on small requests.
+ *
+ * Unlike dnet_io_req, a transaction is usually allocated on a client
+ * thread and freed on an IO thread, so purely thread-local caches would
+ * never recycle. Freed blocks therefore overflow from the thread-local
+ * cache into a locked global depot in half-cache batches, and allocation
+ * refills the local cache from the depot the same way - the depot lock is
+ * taken once per batch, not per transaction.
+ */
+#define DNET_TRANS_CACHE_CLASSES	3
+#define DNET_TRANS_CACHE_DEPTH		16
+#define DNET_TRANS_DEPOT_DEPTH		256
+
+static const size_t dnet_trans_cache_sizes[DNET_TRANS_CACHE_CLASSES] = {512, 2048, 8192};
+
+struct dnet_trans_cache {
+	void		*head;
+	int		num;
+};
+
+struct dnet_trans_depot {
+	pthread_mutex_t	lock;
+	void		*head;
+	int		num;
+};
+
+static __thread struct dnet_trans_cache dnet_trans_cache[DNET_TRANS_CACHE_CLASSES];
+static struct dnet_trans_depot dnet_trans_depot[DNET_TRANS_CACHE_CLASSES] = {
+	{ PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+	{ PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+	{ PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+};
+
+static void *dnet_trans_cache_alloc(size_t size, int *class)
 {
-	if (old > new)
-		return 1;
-	if (old < new)
-		return -1;
-	return 0;
+	struct dnet_trans_cache *c;
+	struct dnet_trans_depot *d;
+	void *p;
+	int i;
+
+	for (i = 0; i < DNET_TRANS_CACHE_CLASSES; ++i) {
+		if (size <= dnet_trans_cache_sizes[i])
+			break;
+	}
+	*class = i;
+
+	if (i >= DNET_TRANS_CACHE_CLASSES)
+		return malloc(size);
+
+	c = &dnet_trans_cache[i];
+
+	if (!c->head && dnet_trans_depot[i].head) {
+		d = &dnet_trans_depot[i];
+
+		pthread_mutex_lock(&d->lock);
+		while (d->head && (c->num < DNET_TRANS_CACHE_DEPTH / 2)) {
+			p = d->head;
+			d->head = *(void **)p;
+			d->num--;
+
+			*(void **)p = c->head;
+			c->head = p;
+			c->num++;
+		}
+		pthread_mutex_unlock(&d->lock);
+	}
+
+	if (c->head) {
+		p = c->head;
+		c->head = *(void **)p;
+		c->num--;
+		return p;
+	}
+
+	return malloc(dnet_trans_cache_sizes[i]);
 }
 
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans)
+static void dnet_trans_cache_free(void *p, int class)
 {
-	struct rb_node *n = root->rb_node;
-	struct dnet_trans *t = NULL;
-	int cmp = 1;
-
-	while (n) {
-		t = rb_entry(n, struct dnet_trans, trans_entry);
-
-		cmp = dnet_trans_cmp(t->trans, trans);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
-			return dnet_trans_get(t);
+	struct dnet_trans_cache *c;
+	struct dnet_trans_depot *d;
+
+	if (class >= DNET_TRANS_CACHE_CLASSES) {
+		free(p);
+		return;
 	}
 
-	return NULL;
+	c = &dnet_trans_cache[class];
+
+	if (c->num >= DNET_TRANS_CACHE_DEPTH) {
+		d = &dnet_trans_depot[class];
+
+		pthread_mutex_lock(&d->lock);
+		while (c->head && (c->num > DNET_TRANS_CACHE_DEPTH / 2) && (d->num < DNET_TRANS_DEPOT_DEPTH)) {
+			void *b = c->head;
+
+			c->head = *(void **)b;
+			c->num--;
+
+			*(void **)b = d->head;
+			d->head = b;
+			d->num++;
+		}
+		pthread_mutex_unlock(&d->lock);
+
+		if (c->num >= DNET_TRANS_CACHE_DEPTH) {
+			/* depot is full too - release to the system */
+			free(p);
+			return;
+		}
+	}
+
+	*(void **)p = c->head;
+	c->head = p;
+	c->num++;
+}
+
+void dnet_trans_cache_cleanup(void)
+{
+	struct dnet_trans_cache *c;
+	struct dnet_trans_depot *d;
+	void *p;
+	int i;
+
+	for (i = 0; i < DNET_TRANS_CACHE_CLASSES; ++i) {
+		c = &dnet_trans_cache[i];
+		d = &dnet_trans_depot[i];
+
+		pthread_mutex_lock(&d->lock);
+		while (c->head) {
+			p = c->head;
+			c->head = *(void **)p;
+			c->num--;
+
+			if (d->num < DNET_TRANS_DEPOT_DEPTH) {
+				*(void **)p = d->head;
+				d->head = p;
+				d->num++;
+			} else {
+				free(p);
+			}
+		}
+		pthread_mutex_unlock(&d->lock);
+		c->num = 0;
+	}
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
+struct dnet_trans *dnet_trans_search(struct list_head *hash, uint64_t trans)
 {
-	struct rb_node **n = &root->rb_node, *parent = NULL;
+	struct list_head *bucket = dnet_trans_hash_bucket(hash, trans);
 	struct dnet_trans *t;
-	int cmp;
 
-	while (*n) {
-		parent = *n;
+	list_for_each_entry(t, bucket, trans_hash_entry) {
+		if (t->trans == trans)
+			return dnet_trans_get(t);
+	}
 
-		t = rb_entry(parent, struct dnet_trans, trans_entry);
+	return NULL;
+}
 
-		cmp = dnet_trans_cmp(t->trans, a->trans);
-		if (cmp < 0)
-			n = &parent->rb_left;
-		else if (cmp > 0)
-			n = &parent->rb_right;
-		else
+int dnet_trans_insert_nolock(struct list_head *hash, struct dnet_trans *a)
+{
+	struct list_head *bucket = dnet_trans_hash_bucket(hash, a->trans);
+	struct dnet_trans *t;
+
+	list_for_each_entry(t, bucket, trans_hash_entry) {
+		if (t->trans == a->trans)
 			return -EEXIST;
 	}
 
@@ -81,24 +204,20 @@ int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
 			dnet_dump_id(&a->cmd.id), (unsigned long long)a->trans,
 			dnet_server_convert_dnet_addr(&a->st->addr));
 
-	rb_link_node(&a->trans_entry, parent, n);
-	rb_insert_color(&a->trans_entry, root);
+	list_add(&a->trans_hash_entry, bucket);
 	return 0;
 }
 
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t)
+void dnet_trans_remove_nolock(struct dnet_trans *t)
 {
-	if (!t->trans_entry.rb_parent_color) {
+	if (list_empty(&t->trans_hash_entry)) {
 		if (t->st && t->st->n)
 			dnet_log(t->st->n, DNET_LOG_ERROR, "%s: trying to remove standalone transaction %llu.\n",
 				dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans);
 		return;
 	}
 
-	if (t) {
-		rb_erase(&t->trans_entry, root);
-		t->trans_entry.rb_parent_color = 0;
-	}
+	list_del_init(&t->trans_hash_entry);
 }
 
 void dnet_trans_remove(struct dnet_trans *t)
@@ -106,7 +225,7 @@ void dnet_trans_remove(struct dnet_trans *t)
 	struct dnet_net_state *st = t->st;
 
 	pthread_mutex_lock(&st->trans_lock);
-	dnet_trans_remove_nolock(&st->trans_root, t);
+	dnet_trans_remove_nolock(t);
 	list_del_init(&t->trans_list_entry);
 	pthread_mutex_unlock(&st->trans_lock);
 }
@@ -114,14 +233,17 @@ void dnet_trans_remove(struct dnet_trans *t)
 struct dnet_trans *dnet_trans_alloc(struct dnet_node *n __unused, uint64_t size)
 {
 	struct dnet_trans *t;
+	int class;
 
-	t = malloc(sizeof(struct dnet_trans) + size);
+	t = dnet_trans_cache_alloc(sizeof(struct dnet_trans) + size, &class);
 	if (!t)
 		goto err_out_exit;
 
 	memset(t, 0, sizeof(struct dnet_trans) + size);
+	t->alloc_class = class;
 
 	atomic_init(&t->refcnt, 1);
+	INIT_LIST_HEAD(&t->trans_hash_entry);
 	INIT_LIST_HEAD(&t->trans_list_entry);
 
 	gettimeofday(&t->start, NULL);
@@ -151,7 +273,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		list_del_init(&t->trans_list_entry);
 		pthread_mutex_unlock(&st->trans_lock);
 
-		if (t->trans_entry.rb_parent_color)
+		if (!list_empty(&t->trans_hash_entry))
 			dnet_trans_remove(t);
 	} else if (!list_empty(&t->trans_list_entry)) {
 		assert(0);
@@ -162,15 +284,38 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		t->complete(t->st, &t->cmd, t->priv);
 	}
 
-	if (st && (t->cmd.status == 0) &&
-			((t->command == DNET_CMD_READ) || (t->command == DNET_CMD_LOOKUP))) {
+	if (st && st->breaker_open && t->cmd.status == 0) {
+		st->breaker_open = 0;
+		st->stall = 0;
 
-		if (diff < st->median_read_time && st->weight < DNET_STATE_MAX_WEIGHT)
-			st->weight *= 1.1;
-		else if (diff > st->median_read_time && st->weight > 1)
-			st->weight *= 0.8;
+		dnet_log(st->n, DNET_LOG_INFO, "%s: circuit breaker closed: probe trans: %llu completed.\n",
+				dnet_state_dump_addr(st),
+				(unsigned long long)(t->trans & ~DNET_TRANS_REPLY));
+	}
 
-		st->median_read_time = (st->median_read_time + diff) / 2;
+	if (st && ((t->command == DNET_CMD_READ) || (t->command == DNET_CMD_LOOKUP))) {
+		if (t->cmd.status == 0) {
+			long rtt_err;
+
+			if (diff < st->median_read_time && st->weight < DNET_STATE_MAX_WEIGHT)
+				st->weight *= 1.1;
+			else if (diff > st->median_read_time && st->weight > 1)
+				st->weight *= 0.8;
+
+			st->median_read_time = (st->median_read_time + diff) / 2;
+
+			if (!st->rtt_smoothed) {
+				st->rtt_smoothed = diff ? diff : 1;
+				st->rtt_variance = diff / 2;
+			} else {
+				rtt_err = diff - st->rtt_smoothed;
+				st->rtt_smoothed += rtt_err / 8;
+				st->rtt_variance += (labs(rtt_err) - st->rtt_variance) / 4;
+			}
+			st->error_rate -= st->error_rate / 16;
+		} else {
+			st->error_rate += (1.0 - st->error_rate) / 16;
+		}
 	}
 
 	if (st && st->n && t->command != 0) {
@@ -196,7 +341,35 @@ void dnet_trans_destroy(struct dnet_trans *t)
 	dnet_state_put(t->st);
 	dnet_state_put(t->orig);
 
-	free(t);
+	dnet_trans_cache_free(t, t->alloc_class);
+}
+
+#define DNET_BREAKER_TRIP_STALLS	2
+#define DNET_BREAKER_PROBE_INTERVAL	1
+
+/*
+ * Circuit breaker gate called before a new transaction is queued to @st:
+ * returns 0 when the request may proceed, -ENXIO when the breaker is open
+ * and the caller has to fail fast. Once per probe interval one request is
+ * let through half-open - its successful completion closes the breaker in
+ * dnet_trans_destroy(), a timeout keeps it open via the stall checker.
+ */
+int dnet_state_breaker_check(struct dnet_net_state *st)
+{
+	long now;
+
+	if (!st->breaker_open)
+		return 0;
+
+	now = time(NULL);
+	if (now - st->breaker_probe_ts >= DNET_BREAKER_PROBE_INTERVAL) {
+		st->breaker_probe_ts = now;
+		dnet_log(st->n, DNET_LOG_INFO, "%s: circuit breaker half-open: passing probe request.\n",
+				dnet_state_dump_addr(st));
+		return 0;
+	}
+
+	return -ENXIO;
 }
 
 int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl)
@@ -207,6 +380,13 @@ int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *s
 	struct dnet_trans *t;
 	int err;
 
+	err = dnet_state_breaker_check(st);
+	if (err) {
+		if (ctl->complete)
+			ctl->complete(NULL, NULL, ctl->priv);
+		goto err_out_exit;
+	}
+
 	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + ctl->size);
 	if (!t) {
 		err = -ENOMEM;
@@ -307,38 +487,58 @@ int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_h
 	struct dnet_trans *t, *tmp;
 	struct timeval tv;
 	int trans_moved = 0;
+	long s, start, now;
 	char str[64];
 	struct tm tm;
 
 	gettimeofday(&tv, NULL);
+	now = tv.tv_sec;
 
 	pthread_mutex_lock(&st->trans_lock);
-	list_for_each_entry_safe(t, tmp, &st->trans_list, trans_list_entry) {
-		if ((t->time.tv_sec >= tv.tv_sec) && !st->need_exit)
-			break;
-
-		localtime_r((time_t *)&t->start.tv_sec, &tm);
-		strftime(str, sizeof(str), "%F %R:%S", &tm);
-
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT/need-exit: stall-check wait-ts: %ld, need-exit: %d, cmd: %s [%d], started: %s.%06lu\n",
-				dnet_state_dump_addr(st), (unsigned long long)t->trans,
-				(unsigned long)t->wait_ts.tv_sec,
-				st->need_exit,
-				dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
-				str, t->start.tv_usec);
 
-		trans_moved++;
-
-		/*
-		 * Remove transaction from every tree/list, so it could not be accessed and found while we deal with it.
-		 * In particular, we will call ->complete() callback, which must ensure that no other thread calls it.
-		 *
-		 * Memory allocation for every transaction is handled by reference counters, but callbacks must ensure,
-		 * that no calls are made after 'final' callback has been invoked. 'Final' means is_trans_destroyed() returns true.
-		 */
-		dnet_trans_remove_nolock(&st->trans_root, t);
-		list_move(&t->trans_list_entry, head);
+	/*
+	 * Only wheel slots of fully elapsed seconds since the previous check
+	 * are scanned - a slot is visited strictly after the second it is
+	 * keyed with, so everything due in it has already expired. When wheel
+	 * wrapped since the last check (or state is going down and everything
+	 * must be timed out) every slot is visited exactly once.
+	 */
+	now--;
+	start = st->trans_wheel_tick + 1;
+	if ((now - st->trans_wheel_tick >= DNET_TRANS_WHEEL_SIZE) || st->need_exit)
+		start = now - DNET_TRANS_WHEEL_SIZE + 1;
+
+	for (s = start; s <= now; ++s) {
+		list_for_each_entry_safe(t, tmp, dnet_trans_wheel_slot(st->trans_wheel, s), trans_list_entry) {
+			/* timeout is longer than the wheel - fires on a later wrap */
+			if ((t->time.tv_sec > s) && !st->need_exit)
+				continue;
+
+			localtime_r((time_t *)&t->start.tv_sec, &tm);
+			strftime(str, sizeof(str), "%F %R:%S", &tm);
+
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT/need-exit: stall-check wait-ts: %ld, need-exit: %d, cmd: %s [%d], started: %s.%06lu\n",
+					dnet_state_dump_addr(st), (unsigned long long)t->trans,
+					(unsigned long)t->wait_ts.tv_sec,
+					st->need_exit,
+					dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
+					str, t->start.tv_usec);
+
+			trans_moved++;
+
+			/*
+			 * Remove transaction from every tree/list, so it could not be accessed and found while we deal with it.
+			 * In particular, we will call ->complete() callback, which must ensure that no other thread calls it.
+			 *
+			 * Memory allocation for every transaction is handled by reference counters, but callbacks must ensure,
+			 * that no calls are made after 'final' callback has been invoked. 'Final' means is_trans_destroyed() returns true.
+			 */
+			dnet_trans_remove_nolock(t);
+			list_move(&t->trans_list_entry, head);
+		}
 	}
+
+	st->trans_wheel_tick = now;
 	pthread_mutex_unlock(&st->trans_lock);
 
 	dnet_log(st->n, DNET_LOG_DEBUG, "stall check: state: %s, st: %p, transactions-moved: %d\n", dnet_state_dump_addr(st), st, trans_moved);
@@ -359,6 +559,15 @@ static void dnet_trans_check_stall(struct dnet_net_state *st, struct list_head *
 		dnet_log(st->n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%u, weight: %f\n",
 				dnet_state_dump_addr(st), trans_timeout, st->stall, DNET_DEFAULT_STALL_TRANSACTIONS, st->weight);
 
+		if (st->stall >= DNET_BREAKER_TRIP_STALLS && !st->breaker_open) {
+			st->breaker_open = 1;
+			st->breaker_probe_ts = time(NULL);
+
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: circuit breaker tripped: %d stalled rounds, "
+					"new transactions fail fast until a probe succeeds.\n",
+					dnet_state_dump_addr(st), st->stall);
+		}
+
 		if (st->stall >= st->n->stall_count) {
 			dnet_state_reset_nolock_noclean(st, -ETIMEDOUT, head);
 		}
@@ -389,6 +598,9 @@ static void dnet_check_all_states(struct dnet_node *n)
 	}
 	pthread_mutex_unlock(&n->state_lock);
 
+	/* no-op unless the stall check above reset somebody */
+	dnet_route_update(n);
+
 	dnet_trans_clean_list(&head);
 }
 
@@ -427,42 +639,54 @@ static int dnet_check_route_table(struct dnet_node *n)
 static void *dnet_reconnect_process(void *data)
 {
 	struct dnet_node *n = data;
-	long i, timeout;
-	struct timeval tv1, tv2;
-	int checks = 0, route_table_checks = 1;
+	struct dnet_addr_storage *ast;
+	time_t now, deadline, next_check;
+	struct timespec ts;
 
 	dnet_set_name("reconnect");
 
 	if (!n->check_timeout)
 		n->check_timeout = 10;
 
-	if (n->check_timeout > 30)
-		route_table_checks = 1;
-
-	dnet_log(n, DNET_LOG_INFO, "Started reconnection thread. Timeout: %lu seconds. Route table update every %lu seconds.\n",
-			n->check_timeout, n->check_timeout * route_table_checks);
+	dnet_log(n, DNET_LOG_INFO, "Started reconnection thread. Route table update every %lu seconds.\n",
+			n->check_timeout);
 
 	dnet_discovery(n);
+	next_check = time(NULL) + n->check_timeout;
 
 	while (!n->need_exit) {
-		gettimeofday(&tv1, NULL);
 		dnet_try_reconnect(n);
-		if (++checks == route_table_checks) {
-			checks = 0;
+
+		now = time(NULL);
+		if (now >= next_check) {
 			dnet_check_route_table(n);
+			/* placement stats only matter when group mixing is on */
+			if (n->flags & DNET_CFG_MIX_STATES)
+				dnet_placement_poll(n);
+			dnet_discovery(n);
+			next_check = time(NULL) + n->check_timeout;
 		}
 
-		dnet_discovery(n);
-		gettimeofday(&tv2, NULL);
-
-		timeout = n->check_timeout - (tv2.tv_sec - tv1.tv_sec);
+		/*
+		 * Sleep until the earliest per-address reconnect deadline or
+		 * the next periodic route table check, whichever comes first.
+		 * dnet_add_reconnect_state() and dnet_reconnect_hint() wake us
+		 * up early when an address becomes due.
+		 */
+		pthread_mutex_lock(&n->reconnect_lock);
+		deadline = next_check;
+		list_for_each_entry(ast, &n->reconnect_list, reconnect_entry) {
+			if (ast->reconnect_ts < deadline)
+				deadline = ast->reconnect_ts;
+		}
 
-		for (i=0; i<timeout; ++i) {
-			if (n->need_exit)
-				break;
+		now = time(NULL);
+		ts.tv_sec = deadline > now ? deadline : now + 1;
+		ts.tv_nsec = 0;
 
-			sleep(1);
-		}
+		if (!n->need_exit)
+			pthread_cond_timedwait(&n->reconnect_cond, &n->reconnect_lock, &ts);
+		pthread_mutex_unlock(&n->reconnect_lock);
 	}
 
 	return NULL;
@@ -518,3 +742,144 @@ void dnet_check_thread_stop(struct dnet_node *n)
 	pthread_join(n->check_tid, NULL);
 	dnet_log(n, DNET_LOG_NOTICE, "Checking thread stopped.\n");
 }
+
+/*
+ * One-shot deferred calls with microsecond deadlines - the transaction
+ * timer wheel above only ticks in seconds, which is too coarse for things
+ * like hedged read delays. Entries are kept sorted by deadline and served
+ * by a single thread which is started on first use, so nodes that never
+ * defer anything pay nothing.
+ *
+ * An entry always fires exactly once: either at its deadline or early
+ * when the node shuts down, never silently dropped. The callback can
+ * therefore own @priv and free it itself.
+ */
+struct dnet_defer_entry {
+	struct list_head	defer_entry;
+	struct timeval		deadline;
+	void			(* func)(void *priv);
+	void			*priv;
+};
+
+static void *dnet_defer_process(void *data)
+{
+	struct dnet_node *n = data;
+	struct dnet_defer_entry *e;
+	struct timeval tv;
+	struct timespec ts;
+
+	dnet_set_name("defer");
+
+	pthread_mutex_lock(&n->defer_lock);
+	while (!n->need_exit) {
+		if (list_empty(&n->defer_list)) {
+			pthread_cond_wait(&n->defer_wait, &n->defer_lock);
+			continue;
+		}
+
+		e = list_first_entry(&n->defer_list, struct dnet_defer_entry, defer_entry);
+
+		gettimeofday(&tv, NULL);
+		if (tv.tv_sec < e->deadline.tv_sec ||
+				(tv.tv_sec == e->deadline.tv_sec && tv.tv_usec < e->deadline.tv_usec)) {
+			ts.tv_sec = e->deadline.tv_sec;
+			ts.tv_nsec = e->deadline.tv_usec * 1000;
+			pthread_cond_timedwait(&n->defer_wait, &n->defer_lock, &ts);
+			continue;
+		}
+
+		list_del(&e->defer_entry);
+		pthread_mutex_unlock(&n->defer_lock);
+
+		e->func(e->priv);
+		free(e);
+
+		pthread_mutex_lock(&n->defer_lock);
+	}
+
+	/* shutdown: fire everything still pending ahead of its deadline */
+	while (!list_empty(&n->defer_list)) {
+		e = list_first_entry(&n->defer_list, struct dnet_defer_entry, defer_entry);
+		list_del(&e->defer_entry);
+		pthread_mutex_unlock(&n->defer_lock);
+
+		e->func(e->priv);
+		free(e);
+
+		pthread_mutex_lock(&n->defer_lock);
+	}
+	pthread_mutex_unlock(&n->defer_lock);
+
+	return NULL;
+}
+
+int dnet_node_defer(struct dnet_node *n, long delay_usec, void (* func)(void *priv), void *priv)
+{
+	struct dnet_defer_entry *e, *it;
+	int err;
+
+	e = malloc(sizeof(struct dnet_defer_entry));
+	if (!e) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	gettimeofday(&e->deadline, NULL);
+	e->deadline.tv_sec += delay_usec / 1000000;
+	e->deadline.tv_usec += delay_usec % 1000000;
+	if (e->deadline.tv_usec >= 1000000) {
+		e->deadline.tv_sec++;
+		e->deadline.tv_usec -= 1000000;
+	}
+	e->func = func;
+	e->priv = priv;
+
+	pthread_mutex_lock(&n->defer_lock);
+	if (n->need_exit) {
+		err = -ESHUTDOWN;
+		goto err_out_unlock;
+	}
+
+	if (!n->defer_started) {
+		err = pthread_create(&n->defer_tid, NULL, dnet_defer_process, n);
+		if (err) {
+			err = -err;
+			dnet_log(n, DNET_LOG_ERROR, "Failed to start defer thread: err: %d.\n", err);
+			goto err_out_unlock;
+		}
+
+		n->defer_started = 1;
+	}
+
+	list_for_each_entry(it, &n->defer_list, defer_entry) {
+		if (it->deadline.tv_sec > e->deadline.tv_sec ||
+				(it->deadline.tv_sec == e->deadline.tv_sec &&
+				 it->deadline.tv_usec > e->deadline.tv_usec))
+			break;
+	}
+	/* insert before @it: works for the empty list and tail insertion too */
+	list_add_tail(&e->defer_entry, &it->defer_entry);
+
+	pthread_cond_broadcast(&n->defer_wait);
+	pthread_mutex_unlock(&n->defer_lock);
+
+	return 0;
+
+err_out_unlock:
+	pthread_mutex_unlock(&n->defer_lock);
+	free(e);
+err_out_exit:
+	return err;
+}
+
+void dnet_node_defer_stop(struct dnet_node *n)
+{
+	pthread_mutex_lock(&n->defer_lock);
+	pthread_cond_broadcast(&n->defer_wait);
+	pthread_mutex_unlock(&n->defer_lock);
+
+	if (n->defer_started) {
+		pthread_join(n->defer_tid, NULL);
+		n->defer_started = 0;
+	}
+}
@@ -0,0 +1,284 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/*
+ * io_uring based network engine.
+ *
+ * The engine keeps the overall processing model of the epoll loop: socket
+ * readiness drives st->process(), all data moves through the existing
+ * send/recv machinery. The difference is that readiness requests of all
+ * states assigned to the network thread are submitted into one ring and
+ * completions are harvested in batches, so a loaded thread pays roughly one
+ * syscall per batch instead of one epoll_wait()/epoll_ctl() pair per event.
+ *
+ * Poll requests are single-shot: after a completion has been processed the
+ * request is rearmed unless the state has been unscheduled or reset in
+ * between. Every submitted poll holds a state reference, dropped when its
+ * completion is consumed, so a state can not be destroyed under the ring.
+ */
+
+#ifdef HAVE_URING_SUPPORT
+
+#include <liburing.h>
+
+#define DNET_URING_QUEUE_DEPTH		4096
+/* Bit stored in cqe user_data next to the state pointer: send poll */
+#define DNET_URING_SEND			0x1UL
+
+struct dnet_uring {
+	struct io_uring		ring;
+	/* Submission side is shared between network and IO threads */
+	pthread_mutex_t		lock;
+};
+
+int dnet_uring_init(struct dnet_net_io *nio)
+{
+	struct dnet_uring *u;
+	int err;
+
+	u = malloc(sizeof(struct dnet_uring));
+	if (!u) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(u, 0, sizeof(struct dnet_uring));
+
+	err = pthread_mutex_init(&u->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	err = io_uring_queue_init(DNET_URING_QUEUE_DEPTH, &u->ring, 0);
+	if (err < 0)
+		goto err_out_mutex_destroy;
+
+	nio->uring = u;
+	return 0;
+
+err_out_mutex_destroy:
+	pthread_mutex_destroy(&u->lock);
+err_out_free:
+	free(u);
+err_out_exit:
+	return err;
+}
+
+void dnet_uring_exit(struct dnet_net_io *nio)
+{
+	struct dnet_uring *u = nio->uring;
+
+	if (!u)
+		return;
+
+	io_uring_queue_exit(&u->ring);
+	pthread_mutex_destroy(&u->lock);
+	free(u);
+	nio->uring = NULL;
+}
+
+static struct io_uring_sqe *dnet_uring_get_sqe(struct dnet_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&u->ring);
+	if (!sqe) {
+		/* submission queue is full - push it to the kernel and retry */
+		io_uring_submit(&u->ring);
+		sqe = io_uring_get_sqe(&u->ring);
+	}
+
+	return sqe;
+}
+
+int dnet_uring_schedule(struct dnet_net_state *st, int send)
+{
+	struct dnet_uring *u = st->nio->uring;
+	struct io_uring_sqe *sqe;
+	int err = 0;
+
+	if (st->need_exit)
+		return -ENOEXEC;
+
+	pthread_mutex_lock(&u->lock);
+
+	st->uring_want[send] = 1;
+
+	if (!st->uring_inflight[send]) {
+		sqe = dnet_uring_get_sqe(u);
+		if (!sqe) {
+			err = -ENOBUFS;
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to get uring sqe for %s poll\n",
+					dnet_state_dump_addr(st), send ? "SEND" : "RECV");
+			goto err_out_unlock;
+		}
+
+		io_uring_prep_poll_add(sqe, send ? st->write_s : st->read_s,
+				send ? POLLOUT : POLLIN);
+		io_uring_sqe_set_data(sqe, (void *)((unsigned long)dnet_state_get(st) |
+					(send ? DNET_URING_SEND : 0)));
+
+		st->uring_inflight[send] = 1;
+		io_uring_submit(&u->ring);
+	}
+
+err_out_unlock:
+	pthread_mutex_unlock(&u->lock);
+	return err;
+}
+
+int dnet_uring_unschedule(struct dnet_net_state *st, int send)
+{
+	struct dnet_uring *u;
+	struct io_uring_sqe *sqe;
+
+	if (!st->nio || !st->nio->uring)
+		return -EINVAL;
+
+	u = st->nio->uring;
+
+	pthread_mutex_lock(&u->lock);
+
+	st->uring_want[send] = 0;
+
+	if (st->uring_inflight[send]) {
+		sqe = dnet_uring_get_sqe(u);
+		if (sqe) {
+			/*
+			 * Cancels pending poll: its completion arrives with
+			 * -ECANCELED and drops the state reference as usual.
+			 */
+			io_uring_prep_poll_remove(sqe, (void *)((unsigned long)st |
+						(send ? DNET_URING_SEND : 0)));
+			io_uring_sqe_set_data(sqe, NULL);
+			io_uring_submit(&u->ring);
+		}
+	}
+
+	pthread_mutex_unlock(&u->lock);
+	return 0;
+}
+
+static void dnet_uring_process_cqe(struct dnet_net_io *nio, struct io_uring_cqe *cqe)
+{
+	struct dnet_uring *u = nio->uring;
+	unsigned long data = (unsigned long)io_uring_cqe_get_data(cqe);
+	struct dnet_net_state *st = (struct dnet_net_state *)(data & ~DNET_URING_SEND);
+	int send = !!(data & DNET_URING_SEND);
+	struct epoll_event ev;
+	int err;
+
+	/* completion of poll_remove request itself */
+	if (!st)
+		return;
+
+	pthread_mutex_lock(&u->lock);
+	st->uring_inflight[send] = 0;
+	pthread_mutex_unlock(&u->lock);
+
+	if (cqe->res >= 0 && !st->need_exit) {
+		st->epoll_fd = nio->epoll_fd;
+		st->nio = nio;
+
+		ev.events = cqe->res;
+		ev.data.ptr = st;
+
+		err = dnet_state_process_event(st, &ev);
+
+		/* state is alive - rearm the single-shot poll if it is still wanted */
+		if (err >= 0 && st->uring_want[send])
+			dnet_uring_schedule(st, send);
+	}
+
+	/* reference held by the completed poll request */
+	dnet_state_put(st);
+}
+
+void *dnet_io_process_network_uring(void *data_)
+{
+	struct dnet_net_io *nio = data_;
+	struct dnet_node *n = nio->n;
+	struct dnet_uring *u = nio->uring;
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts;
+	unsigned head, num;
+	int err;
+
+	dnet_set_name("net_pool_uring");
+
+	while (!n->need_exit) {
+		ts.tv_sec = 1;
+		ts.tv_nsec = 0;
+
+		err = io_uring_wait_cqe_timeout(&u->ring, &cqe, &ts);
+		if (err < 0) {
+			if (err == -ETIME || err == -EINTR || err == -EAGAIN)
+				continue;
+
+			dnet_log(n, DNET_LOG_ERROR, "Failed to wait for uring completion: %d\n", err);
+			n->need_exit = err;
+			break;
+		}
+
+		/* harvest the whole batch accumulated in the completion queue */
+		num = 0;
+		io_uring_for_each_cqe(&u->ring, head, cqe) {
+			dnet_uring_process_cqe(nio, cqe);
+			num++;
+		}
+		io_uring_cq_advance(&u->ring, num);
+	}
+
+	dnet_io_req_cache_cleanup();
+	dnet_trans_cache_cleanup();
+
+	return &n->need_exit;
+}
+
+#else /* !HAVE_URING_SUPPORT */
+
+int dnet_uring_init(struct dnet_net_io *nio __unused)
+{
+	return -ENOTSUP;
+}
+
+void dnet_uring_exit(struct dnet_net_io *nio __unused)
+{
+}
+
+int dnet_uring_schedule(struct dnet_net_state *st __unused, int send __unused)
+{
+	return -ENOTSUP;
+}
+
+int dnet_uring_unschedule(struct dnet_net_state *st __unused, int send __unused)
+{
+	return -ENOTSUP;
+}
+
+void *dnet_io_process_network_uring(void *data_ __unused)
+{
+	return NULL;
+}
+
+#endif /* HAVE_URING_SUPPORT */
@@ -20,6 +20,7 @@ Wrappers for iterator and it's result container
 
 import sys
 import os
+import hashlib
 
 from .utils.misc import logged_class, mk_container_name
 from .etime import Time
@@ -98,22 +99,14 @@ class IteratorResult(object):
     @classmethod
     def merge(cls, results, tmp_dir):
         """
-        Merges diffs and split result by node owner:
+        Merges diffs and splits the result by node owner:
             results contains diffs from all remote nodes
             Removes from results empty diffs
             If results is empty - skipping merge stage
             If results contains diffs only for 1 node - nothing to merge just copy this diffs
-            Otherwise:
-                for each node creates tuple (value, iterator, result) and combines it in the list:
-                    Value - record from the top of node diffs.
-                    Iterator - iterator of node diffs.
-                    results - resulting container of merged diffs.
-                1.  Goes through tuples and find tuple with minimum key and maximum timestamp in value
-                2.  Value from the tuple appends in corresponding result container.
-                3.  Goes through tuples again and for tuple with a key equal to minimum key, gets new record from iterator while it key == minimum or end of node diffs is reached.
-                4.  If for some tuple all node diffs are processed - adds number of the tuple into remove list
-                5.  After that removes from tuple list all tuples from remove list
-                6.  Repeates step 1-6 while tuple list isn't empty
+            Otherwise runs the native k-way merge: for every key the record
+            with the newest timestamp wins and lands in the container of the
+            node it should be fetched from, older duplicates are dropped.
         """
         results = [d for d in results if d and len(d) != 0]
         if len(results) == 1:
@@ -133,35 +126,21 @@ class IteratorResult(object):
 
     @classmethod
     def __merge__(cls, results, tmp_dir):
-        import heapq
         ret = []
-        heap = []
         for d in results:
-            try:
-                heapq.heappush(heap,
-                               MergeData(iter(d),
-                                         IteratorResult.from_filename(os.path.join(tmp_dir, mk_container_name(d.address, "merge_")),
-                                                                      address=d.address,
-                                                                      tmp_dir=tmp_dir,
-                                                                      leave_file=True
-                                                                      )))
-            except StopIteration:
-                pass
-
-        while len(heap):
-            min_data = heapq.heappop(heap)
-            min_data.container.append_rr(min_data.value)
-            same_datas = [min_data]
-            while len(heap) and min_data.value.key == heap[0].value.key:
-                same_datas.append(heapq.heappop(heap))
-            for i in same_datas:
-                try:
-                    i.next()
-                    heapq.heappush(heap, i)
-                except StopIteration:
-                    ret.append(i.container)
-
-        return ret
+            ret.append(IteratorResult.from_filename(os.path.join(tmp_dir, mk_container_name(d.address, "merge_")),
+                                                    address=d.address,
+                                                    tmp_dir=tmp_dir,
+                                                    leave_file=True
+                                                    ))
+
+        outputs = [r.container for r in ret]
+        elliptics.IteratorResultContainer.merge([d.container for d in results], outputs)
+        # merge() updates the copies held by the list, not our originals
+        for r, container in zip(ret, outputs):
+            r.container = container
+
+        return [r for r in ret if len(r)]
 
     @classmethod
     def from_filename(cls, filename, tmp_dir="", **kwargs):
@@ -240,7 +219,16 @@ class Iterator(object):
                                                   )
 
             ranges = [IdRange.elliptics_range(start, stop) for start, stop in key_ranges]
-            records = self.session.start_iterator(eid, ranges, itype, flags, timestamp_range[0], timestamp_range[1])
+
+            # Stable per-node iterator id makes the scan resumable: the server
+            # checkpoints its progress under this id and a recovery run
+            # restarted after a crash or network blip continues from the last
+            # checkpoint instead of rescanning the whole base.
+            iterator_id = (int(hashlib.sha256(str(address)).hexdigest()[:15], 16) or 1)
+            records = self.session.start_iterator(eid, ranges, itype,
+                                                  flags | elliptics.iterator_flags.resume,
+                                                  timestamp_range[0], timestamp_range[1],
+                                                  iterator_id)
             last = 0
 
             for num, record in enumerate(records):
@@ -284,53 +272,3 @@ class Iterator(object):
                 stats.counter(c, it)
 
         return result, result_len
-
-
-class MergeData(object):
-    __doc__ = \
-        """
-        Assist class for IteratorResult.__merge__
-        """
-
-    def __init__(self, iter, container):
-        self.iter = iter
-        self.container = container
-        self.value = None
-        self.next_value = None
-        self.next()
-
-    def __cmp__(self, other):
-        cmp_res = cmp(self.value.key, other.value.key)
-
-        if cmp_res == 0:
-            cmp_res = cmp(other.value.timestamp, self.value.timestamp)
-
-            if cmp_res == 0:
-                cmp_res = cmp(self.value.size, other.value.size)
-
-        return cmp_res
-
-    def next(self):
-        if self.iter is None:
-            raise StopIteration
-
-        if self.value is None:
-            self.value = next(self.iter)
-        else:
-            self.value = self.next_value
-
-        try:
-            self.next_value = next(self.iter)
-        except StopIteration:
-            self.next_value = None
-            self.iter = None
-            return
-
-        try:
-            while cmp(self.value.key, self.next_value.key) == 0:
-                if cmp(self.value.timestamp, self.next_value.timestamp) < 0:
-                    self.value = self.next_value
-                self.next_value = next(self.iter)
-        except StopIteration:
-            self.next_value = None
-            self.iter = None
@@ -176,14 +176,15 @@ def recover((address, )):
 
 def recover_keys(ctx, address, group_id, keys, local_session, remote_session, stats):
     """
-    Bulk recovery of keys.
+    Bulk recovery of keys: one bulk_read from the remote node, one batched
+    bulk_write into the local one.
     """
     keys_len = len(keys)
 
     log.debug("Copying {0} keys".format(keys_len))
 
-    async_write_results = []
-    batch = None
+    datas = []
+    total_size = 0
 
     try:
         batch = remote_session.bulk_read(keys)
@@ -203,42 +204,40 @@ def recover_keys(ctx, address, group_id, keys, local_session, remote_session, st
             io.id = b.id
             io.timestamp = b.timestamp
             io.user_flags = b.user_flags
-            async_write_results.append((local_session.write_data(io, b.data),
-                                        len(b.data)))
+            datas.append((io, b.data))
+            total_size += len(b.data)
         except StopIteration:
             break
         except Exception as e:
             failed += 1
-            log.error("Write failed: {0}".format(e))
+            log.error("Read failed: {0}".format(e))
 
-    read_len = len(async_write_results)
+    read_len = len(datas)
     stats.counter('read_keys', read_len)
     stats.counter('read_keys', -failed)
     stats.counter('skipped_keys', keys_len - read_len - failed)
 
-    successes, successes_size, failures_size = (0, 0, 0)
-    for r, bsize in async_write_results:
-        try:
-            r.wait()
-            if r.successful():
-                successes_size += bsize
-                successes += 1
-            else:
-                failures_size += bsize
-                failed += 1
-        except Exception as e:
-            log.error("Write failed: {0}".format(e))
-            failures_size += bsize
-            failed += 1
+    if not datas:
+        return failed == 0
+
+    write_ok = False
+    try:
+        r = local_session.bulk_write(datas)
+        r.wait()
+        write_ok = r.successful()
+    except Exception as e:
+        log.error("Bulk write failed: {0} keys: {1}".format(read_len, e))
 
-    log.debug("Recovered batch: {0}/{1} of size: {2}/{3}".format(successes + failed, keys_len, successes_size, failures_size))
+    log.debug("Recovered batch: {0}/{1} of size: {2}".format(read_len if write_ok else 0, keys_len, total_size))
 
-    stats.counter('recovered_keys', successes)
-    stats.counter('recovered_keys', -failed)
-    stats.counter('recovered_bytes', successes_size)
-    stats.counter('recovered_bytes', -failures_size)
+    if write_ok:
+        stats.counter('recovered_keys', read_len)
+        stats.counter('recovered_bytes', total_size)
+    else:
+        stats.counter('recovered_keys', -read_len)
+        stats.counter('recovered_bytes', -total_size)
 
-    return failed == 0
+    return write_ok and failed == 0
 
 
 def iterate_node(address_ranges):
@@ -185,26 +185,32 @@ def recover(ctx, diff, group, stats):
             stats.counter('recovered_keys', -len(keys))
             continue
 
-        async_remove_results = []
+        write_result, records = results
+        batch_size = sum(size for size, _ in records)
+
         successes, failures, successes_size, failures_size = (0, 0, 0, 0)
-        for r, size, key in results:
-            try:
-                r.wait()
-                if r.successful():
-                    if ctx.safe != True:
-                        # If data was successfully moved to local node
-                        # and `Safe' mode is not enabled - remove it from remote node.
-                        async_remove_results.append((remote_session.remove(key), key))
-                    successes_size += size
-                    successes += 1
-                else:
-                    failures_size += size
-                    failures += 1
-                total_records += 1
-                total_size += size
-            except Exception as e:
-                log.info("Can't recover key: {0}: {1}".format(key, e))
-                failures += 1
+        write_ok = False
+        try:
+            write_result.wait()
+            write_ok = write_result.successful()
+        except Exception as e:
+            log.info("Can't recover batch of {0} keys: {1}".format(len(records), e))
+
+        if write_ok:
+            successes = len(records)
+            successes_size = batch_size
+        else:
+            failures = len(records)
+            failures_size = batch_size
+        total_records += len(records)
+        total_size += batch_size
+
+        async_remove_results = []
+        if write_ok and ctx.safe != True:
+            # If data was successfully moved to local node
+            # and `Safe' mode is not enabled - remove it from remote node.
+            for _, key in records:
+                async_remove_results.append((remote_session.remove(key), key))
 
         remove_successes, remove_failures = (0, 0)
         for r, key in async_remove_results:
@@ -231,24 +237,28 @@ def recover(ctx, diff, group, stats):
 
 def recover_keys(ctx, address, group, keys, local_session, remote_session, stats):
     """
-    Bulk recovery of keys.
+    Bulk recovery of keys: one bulk_read from the remote node, one batched
+    bulk_write into the local one.
     """
     keys_len = len(keys)
-    async_write_results = []
 
     try:
         batch = remote_session.bulk_read(keys)
+        datas = []
+        records = []
         for b in batch:
             io = elliptics.IoAttr()
             io.id = b.id
             io.timestamp = b.timestamp
             io.user_flags = b.user_flags
-            async_write_results.append(
-                (local_session.write_data(io, b.data), len(b.data), b.id))
-        read_len = len(async_write_results)
+            datas.append((io, b.data))
+            records.append((len(b.data), b.id))
+        read_len = len(datas)
         stats.counter('read_keys', read_len)
         stats.counter('skipped_keys', keys_len - read_len)
-        return async_write_results
+        if not datas:
+            return None
+        return (local_session.bulk_write(datas), records)
     except Exception as e:
         log.error("Bulk read failed: {0} keys: {1}".format(keys_len, e))
         stats.counter('skipped_keys', keys_len)
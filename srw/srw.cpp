@@ -70,6 +70,13 @@ namespace {
 
 		return result;
 	}
+
+	/*
+	 * Exec payloads at least this large travel between the server and
+	 * the workers through a posix shared memory segment (see sph_shm_info
+	 * in elliptics/srw.h) instead of being copied into the cocaine stream.
+	 */
+	static const size_t srw_shm_threshold = 1024 * 1024;
 }
 
 class srw_log {
@@ -518,7 +525,17 @@ class srw {
 
 				guard.unlock();
 
-				upstream->reply(final, (char *)sph, sizeof(struct sph) + sph->event_size + sph->data_size);
+				if (sph->flags & DNET_SPH_FLAGS_SHM) {
+					err = reply_from_shm(upstream, final, sph, data);
+					if (err) {
+						dnet_log(m_s->node, DNET_LOG_ERROR, "%s: sph: %s: %s: job: %d: "
+								"failed to map shm reply segment: %d\n",
+								id_str, sph_str, event.c_str(), sph->src_key, err);
+						return err;
+					}
+				} else {
+					upstream->reply(final, (char *)sph, sizeof(struct sph) + sph->event_size + sph->data_size);
+				}
 
 				dnet_log(m_s->node, DNET_LOG_INFO, "%s: sph: %s: %s: completed: job: %d, total-size: %zd, finish: %d\n",
 						id_str, sph_str, event.c_str(), sph->src_key, total_size(sph), final);
@@ -531,6 +548,20 @@ class srw {
 				 */
 				int src_key = sph->src_key;
 
+				if (sph->flags & DNET_SPH_FLAGS_KEY_AFFINITY) {
+					uint32_t prefix;
+
+					/*
+					 * Consistently route execs for one id to one named worker:
+					 * the id prefix is stable, so repeated requests against the
+					 * same key reuse that worker's warm per-key state. Requires
+					 * the app to be started via start-multiple-task, otherwise
+					 * there are no named workers and the flag is ignored.
+					 */
+					memcpy(&prefix, cmd->id.id, sizeof(prefix));
+					src_key = prefix & 0x7fffffff;
+				}
+
 				if (sph->flags & DNET_SPH_FLAGS_SRC_BLOCK) {
 					sph->src_key = atomic_inc(&m_src_key);
 					memcpy(sph->src.id, cmd->id.id, sizeof(sph->src.id));
@@ -567,7 +598,7 @@ class srw {
 						stream = eng->enqueue(cevent, upstream, app);
 					}
 
-					stream->write((const char *)sph, total_size(sph) + sizeof(struct sph));
+					write_stream(stream, sph, data);
 				} catch (const std::exception &e) {
 					dnet_log(m_s->node, DNET_LOG_ERROR, "%s: sph: %s: %s: enqueue/write-exception: queue: %s, src-key-orig: %d, "
 							"job: %d, total-size: %zd, block: %d: %s\n",
@@ -609,6 +640,80 @@ class srw {
 		size_t total_size(const struct sph *sph) {
 			return sph->event_size + sph->data_size;
 		}
+
+		/*
+		 * Sends sph and its payload into the worker stream.
+		 * Payloads of at least @srw_shm_threshold bytes are placed into
+		 * a posix shm segment and only struct sph_shm_info travels
+		 * through the stream, any shm failure falls back to the plain
+		 * inline copy.
+		 */
+		void write_stream(std::shared_ptr<cocaine::api::stream_t> &stream, struct sph *sph, const char *data) {
+			if (sph->data_size >= srw_shm_threshold) {
+				struct sph_shm_info info;
+
+				int fd = dnet_sph_shm_create(&info, sph->data_size);
+				if (fd >= 0) {
+					void *ptr = mmap(NULL, sph->data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+					close(fd);
+
+					if (ptr != MAP_FAILED) {
+						memcpy(ptr, data + sph->event_size, sph->data_size);
+						munmap(ptr, sph->data_size);
+
+						struct sph copy = *sph;
+						copy.flags |= DNET_SPH_FLAGS_SHM;
+						copy.data_size = sizeof(struct sph_shm_info);
+
+						std::string buf;
+						buf.reserve(sizeof(struct sph) + sph->event_size + sizeof(info));
+						buf.assign((char *)&copy, sizeof(struct sph));
+						buf.append(data, sph->event_size);
+						buf.append((char *)&info, sizeof(info));
+
+						stream->write(buf.data(), buf.size());
+						return;
+					}
+
+					shm_unlink(info.shm_name);
+				}
+			}
+
+			stream->write((const char *)sph, total_size(sph) + sizeof(struct sph));
+		}
+
+		/*
+		 * A worker reply carrying DNET_SPH_FLAGS_SHM holds sph_shm_info
+		 * instead of the payload - materialize one contiguous packet
+		 * for the client, who knows nothing about the segment.
+		 */
+		int reply_from_shm(dnet_shared_upstream_t &upstream, bool final, const struct sph *sph, const char *data) {
+			if (sph->data_size != sizeof(struct sph_shm_info))
+				return -EINVAL;
+
+			struct sph_shm_info info;
+			memcpy(&info, data + sph->event_size, sizeof(info));
+			info.shm_name[sizeof(info.shm_name) - 1] = '\0';
+
+			void *ptr = dnet_sph_shm_map(&info);
+			if (!ptr)
+				return -ENOENT;
+
+			struct sph copy = *sph;
+			copy.flags &= ~DNET_SPH_FLAGS_SHM;
+			copy.data_size = info.shm_size;
+
+			std::string buf;
+			buf.reserve(sizeof(struct sph) + sph->event_size + info.shm_size);
+			buf.assign((char *)&copy, sizeof(struct sph));
+			buf.append(data, sph->event_size);
+			buf.append((char *)ptr, info.shm_size);
+
+			dnet_sph_shm_unmap(&info, ptr);
+
+			upstream->reply(final, buf.data(), buf.size());
+			return 0;
+		}
 };
 
 int dnet_srw_init(struct dnet_node *n, struct dnet_config *cfg)